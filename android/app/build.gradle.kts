@@ -31,6 +31,14 @@ android {
         versionName = flutter.versionName
     }
 
+    // Native transfer engine shared with the desktop runners, loaded from
+    // Dart through dart:ffi.
+    externalNativeBuild {
+        cmake {
+            path = file("../../native/CMakeLists.txt")
+        }
+    }
+
     buildTypes {
         release {
             // TODO: Add your own signing config for the release build.
@@ -142,6 +142,22 @@ class MainActivity : FlutterActivity() {
                     }
                 }
 
+                "openFd" -> {
+                    // A raw descriptor for the native fan-out cache, which
+                    // takes ownership of it
+                    val uriStr = call.argument<String>("uri")
+                    try {
+                        val pfd = contentResolver.openFileDescriptor(Uri.parse(uriStr), "r")
+                        if (pfd != null) {
+                            result.success(pfd.detachFd())
+                        } else {
+                            result.error("FD_FAIL", "Could not open file descriptor", null)
+                        }
+                    } catch (e: Exception) {
+                        result.error("EXCEPTION", e.message, null)
+                    }
+                }
+
                "getFileSize" -> {
                     val uriStr = call.argument<String>("uri")
                     try {
@@ -206,7 +222,35 @@ class MainActivity : FlutterActivity() {
                     }
                 }
 
-                "closeStream" -> {
+                "seekStream" -> {
+                    // Streams are opened per request, so the position is
+                    // counted from the start of the file
+                    val streamId = call.argument<String>("streamId")
+                    val position = call.argument<Number>("position")?.toLong() ?: 0L
+                    val stream = if (streamId != null) inputStreams[streamId] else null
+                    if (stream == null) {
+                        result.error("NO_STREAM", "Stream not found", null)
+                        return@setMethodCallHandler
+                    }
+                    try {
+                        var remaining = position
+                        while (remaining > 0) {
+                            val skipped = stream.skip(remaining)
+                            if (skipped > 0) {
+                                remaining -= skipped
+                            } else if (stream.read() == -1) {
+                                break
+                            } else {
+                                remaining--
+                            }
+                        }
+                        result.success(remaining == 0L)
+                    } catch (e: Exception) {
+                        result.error("SEEK_ERROR", e.message, null)
+                    }
+                }
+
+                "closeStream", "closeReadStream" -> {
                     val streamId = call.argument<String>("streamId")
                     val uriStr = call.argument<String>("uri")
                     
@@ -272,40 +316,6 @@ class MainActivity : FlutterActivity() {
                     }
                 }
 
-                "zipFilesToCache" -> {
-                    val uris = call.argument<List<String>>("uris")
-                    val names = call.argument<List<String>>("names")
-                    val zipName = call.argument<String>("zipName") ?: "shared.zip"
-                    if (uris == null || names == null || uris.size != names.size) {
-                        result.error("INVALID_ARGS", "Invalid file list", null)
-                        return@setMethodCallHandler
-                    }
-                    try {
-                        val cacheDir = cacheDir
-                        val zipFile = java.io.File(cacheDir, zipName)
-                        val zos = java.util.zip.ZipOutputStream(zipFile.outputStream())
-                        for (i in uris.indices) {
-                            val uri = Uri.parse(uris[i])
-                            val entry = java.util.zip.ZipEntry(names[i])
-                            zos.putNextEntry(entry)
-                            val input = contentResolver.openInputStream(uri)
-                            if (input != null) {
-                                val buffer = ByteArray(4 * 1024 * 1024)
-                                var len: Int
-                                while (input.read(buffer).also { len = it } > 0) {
-                                    zos.write(buffer, 0, len)
-                                }
-                                input.close()
-                            }
-                            zos.closeEntry()
-                        }
-                        zos.close()
-                        result.success(zipFile.absolutePath)
-                    } catch (e: Exception) {
-                        result.error("ZIP_ERROR", e.message, null)
-                    }
-                }
-
                 "acquireMulticastLock" -> {
                     try {
                         acquireMulticastLock()
@@ -14,6 +14,15 @@ import 'package:shared_preferences/shared_preferences.dart';
 import 'package:permission_handler/permission_handler.dart';
 import 'package:flutter_local_notifications/flutter_local_notifications.dart';
 import 'dart:convert';
+import '../../native/batch.dart';
+import '../../native/compression.dart';
+import '../../native/content_hash.dart';
+import '../../native/content_store.dart';
+import '../../services/batch_transfer_service.dart';
+import '../../services/compression_stage.dart';
+import '../../services/delta_transfer_service.dart';
+import '../../services/mux_transfer_service.dart';
+import '../../services/secure_channel_service.dart';
 import '../../widgets/tv_widgets.dart';
 import 'AndroidHomeScreen.dart';
 
@@ -33,11 +42,17 @@ class FileItem {
   double speedMbps;
   bool isPaused;
   bool isCancelled;
+  ChunkDigests? digests; // Advertised by the sender, if it has hashed the file
+  int codecs; // Compression both sides support over TCP, 0 for none
+  bool batchable; // Small enough to go in a BATCH request over TCP
 
   FileItem({
     required this.name,
     required this.size,
     required this.url,
+    this.digests,
+    this.codecs = 0,
+    this.batchable = false,
     this.isSelected = true,
     this.progress = 0.0,
     this.status = 'Waiting',
@@ -91,6 +106,15 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
   List<FileItem> _downloadQueue = [];
   String? _saveFolder;
   bool _downloading = false;
+  // Protocol v2 session with the sender, shared by parallel downloads
+  late bool _useMux = widget.useTcp &&
+      widget.files.isNotEmpty &&
+      MuxTransferService.canMux(widget.files.first);
+  Future<MuxClient?>? _mux;
+  // Encrypt it when the sender offers that; both sides key the handshake
+  // with the sender's share code
+  late final bool _secureMux =
+      _useMux && SecureChannelService.canSecure(widget.files.first);
   final FlutterLocalNotificationsPlugin _notificationsPlugin =
       FlutterLocalNotificationsPlugin();
 
@@ -130,6 +154,7 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
   @override
   void dispose() {
     _pulseController.dispose();
+    _mux?.then((client) => client?.close());
     super.dispose();
   }
 
@@ -141,6 +166,9 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
             size: f['size'] ?? 0,
             url:
                 'http://${widget.serverIp}:${widget.serverPort}/file/${f['index']}',
+            digests: ChunkDigests.fromJson(f, f['size'] ?? 0),
+            codecs: CompressionStage.negotiate(f['codecs'] ?? 0),
+            batchable: widget.useTcp && BatchTransferService.canBatch(f),
           ),
         )
         .toList();
@@ -398,6 +426,16 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
       file.isPaused = false;
     }
 
+    // Identical files received in an earlier session never hit the network
+    await _placeKnownFiles(selectedFiles);
+    selectedFiles.removeWhere((f) => f.status == 'Complete');
+    if (selectedFiles.isEmpty) return;
+
+    // Small files several per stream; the rest go one by one
+    await _downloadBatches(selectedFiles);
+    selectedFiles.removeWhere((f) => f.status == 'Complete');
+    if (selectedFiles.isEmpty) return;
+
     setState(() {
       _downloadQueue = List.from(selectedFiles);
       _downloading = true;
@@ -411,9 +449,14 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
       ),
     );
 
-    try {
-      while (_downloadQueue.isNotEmpty) {
-        final file = _downloadQueue.first;
+    // Protocol v2 carries several files at once over one connection
+    final started = <FileItem>{};
+    Future<void> worker() async {
+      while (true) {
+        final next = _downloadQueue.where((f) => !started.contains(f));
+        if (next.isEmpty) return;
+        final file = next.first;
+        started.add(file);
         if (file.isCancelled) {
           _downloadQueue.remove(file);
           continue;
@@ -429,6 +472,11 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
           _downloadQueue.remove(file);
         }
       }
+    }
+
+    try {
+      final workers = _useMux ? MuxTransferService.PARALLEL_FILES : 1;
+      await Future.wait(List.generate(workers, (_) => worker()));
     } finally {
       try {
         await FlutterForegroundTask.stopService();
@@ -451,22 +499,28 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
       await _requestStoragePermissions();
       _saveFolder ??= await _getDefaultDownloadFolder();
 
-      String fileName = file.name.replaceAll(RegExp(r'[<>:"/\\|?*]'), '_');
-      String savePath = '$_saveFolder/$fileName';
-      int count = 1;
-      while (await File(savePath).exists()) {
-        final parts = fileName.split('.');
-        if (parts.length > 1) {
-          final base = parts.sublist(0, parts.length - 1).join('.');
-          final ext = parts.last;
-          savePath = '$_saveFolder/${base}_$count.$ext';
-        } else {
-          savePath = '$_saveFolder/${fileName}_$count';
-        }
-        count++;
+      String fileName = _safeFileName(file.name);
+      final savePath = await _uniqueSavePath(fileName);
+      file.savePath = savePath;
+
+      // An older copy under the same name: fetch only what changed. Goes
+      // over HTTP even in TCP mode; the sender serves both.
+      final basisPath = '$_saveFolder/$fileName';
+      if (savePath != basisPath && await _downloadDelta(file, basisPath)) {
+        await _indexReceived(savePath, file.digests?.fileDigest);
+        await _addToHistory(
+          fileName: file.name,
+          fileSize: file.size,
+          path: savePath,
+          peerIp: widget.serverIp,
+        );
+        setState(() {
+          file.status = 'Complete';
+          file.progress = 1.0;
+        });
+        return;
       }
 
-      file.savePath = savePath;
       final fileToWrite = File(savePath);
       final sink = fileToWrite.openWrite();
 
@@ -474,8 +528,14 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
       int contentLength = file.size;
       http.Client? httpClient;
       Socket? tcpSocket;
-
-      if (widget.useTcp) {
+      final muxBody = widget.useTcp ? await _muxGet(file) : null;
+
+      if (muxBody != null) {
+        // Protocol v2: no connection or ACK of its own, and reading the
+        // body is what lets the sender send more
+        contentLength = muxBody.size;
+        contentStream = muxBody.body;
+      } else if (widget.useTcp) {
         const maxRetries = 5;
         for (int retry = 0; retry < maxRetries; retry++) {
           try {
@@ -486,11 +546,22 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
               widget.serverPort + 1,
               timeout: const Duration(seconds: 10),
             );
+            // Senders that advertised codecs get a flagged index followed
+            // by the codecs this side can decode
+            final word = file.codecs != 0
+                ? fileIndex | CompressionStage.TCP_CODECS_FLAG
+                : fileIndex;
             final indexBytes = [
-              (fileIndex >> 24) & 0xFF,
-              (fileIndex >> 16) & 0xFF,
-              (fileIndex >> 8) & 0xFF,
-              fileIndex & 0xFF,
+              (word >> 24) & 0xFF,
+              (word >> 16) & 0xFF,
+              (word >> 8) & 0xFF,
+              word & 0xFF,
+              if (file.codecs != 0) ...[
+                (file.codecs >> 24) & 0xFF,
+                (file.codecs >> 16) & 0xFF,
+                (file.codecs >> 8) & 0xFF,
+                file.codecs & 0xFF,
+              ],
             ];
             tcpSocket.add(indexBytes);
             await tcpSocket.flush();
@@ -499,6 +570,19 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
             final metadataBytes = <int>[];
             int? metadataLength;
             bool metadataComplete = false;
+            NativeDecompressor? frames;
+            void deliver(List<int> bytes) {
+              if (frames == null) {
+                controller.add(bytes);
+                return;
+              }
+              try {
+                final raw = frames!.update(bytes);
+                if (raw.isNotEmpty) controller.add(raw);
+              } on FormatException catch (e) {
+                controller.addError(e);
+              }
+            }
 
             tcpSocket.listen(
               (chunk) {
@@ -517,25 +601,30 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
                     );
                     final metadata = jsonDecode(metadataJson);
                     contentLength = metadata['fileSize'] as int;
+                    if (metadata['encoding'] ==
+                        CompressionStage.ENCODING_NAME) {
+                      frames = NativeDecompressor.create();
+                    }
                     metadataComplete = true;
                     if (metadataBytes.length > 4 + metadataLength!) {
-                      controller
-                          .add(metadataBytes.sublist(4 + metadataLength!));
+                      deliver(metadataBytes.sublist(4 + metadataLength!));
                     }
                   }
                 } else {
-                  controller.add(chunk);
+                  deliver(chunk);
                 }
               },
               onError: (error) {
                 print('TCP socket error during download: $error');
                 // Don't propagate error to stream — just close gracefully
                 // Buffered data will still be delivered before the done event
+                frames?.dispose();
                 if (!controller.isClosed) {
                   controller.close();
                 }
               },
               onDone: () {
+                frames?.dispose();
                 if (!controller.isClosed) {
                   controller.close();
                 }
@@ -561,6 +650,10 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
             httpClient = http.Client();
             final request = http.Request('GET', Uri.parse(file.url));
             request.headers['Connection'] = 'close';
+            if (CompressionStage.localCodecs != 0) {
+              request.headers[CompressionStage.CODECS_HEADER] =
+                  '${CompressionStage.localCodecs}';
+            }
             final response = await httpClient.send(request).timeout(
                   Duration(minutes: 60),
                   onTimeout: () =>
@@ -569,8 +662,18 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
             if (response.statusCode != 200) {
               throw Exception('Server returned ${response.statusCode}');
             }
-            contentLength = response.contentLength ?? file.size;
-            contentStream = response.stream;
+            if (CompressionStage.isEncoded(response.headers)) {
+              contentLength = int.tryParse(
+                    response.headers[
+                            CompressionStage.LENGTH_HEADER.toLowerCase()] ??
+                        '',
+                  ) ??
+                  file.size;
+              contentStream = CompressionStage.decode(response.stream);
+            } else {
+              contentLength = response.contentLength ?? file.size;
+              contentStream = response.stream;
+            }
             break;
           } catch (e) {
             httpClient?.close();
@@ -590,9 +693,13 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
       int lastBytes = 0;
       DateTime lastSpeedTime = DateTime.now();
       bool downloadSuccess = false;
+      // Digest of what landed, for the received-file index
+      final hasher =
+          contentLength > 0 ? NativeChunkHasher.create(contentLength) : null;
 
       try {
         await for (var chunk in contentStream) {
+          hasher?.update(received, chunk);
           sink.add(chunk);
           received += chunk.length;
           file.bytesReceived = received;
@@ -678,6 +785,16 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
         await cancelProgressNotification(_fileItems.indexOf(file));
       }
 
+      // Only complete downloads matching what the sender advertised are
+      // indexed; the short-read tolerance above can't vouch for content.
+      final digest = hasher?.fileDigest();
+      hasher?.dispose();
+      if (downloadSuccess &&
+          digest != null &&
+          (file.digests == null || file.digests!.fileDigest == digest)) {
+        await _indexReceived(savePath, digest);
+      }
+
       if (downloadSuccess) {
         await _addToHistory(
           fileName: file.name,
@@ -705,6 +822,207 @@ class _AndroidFileListScreenState extends State<AndroidFileListScreen>
     }
   }
 
+  /// Requests [file] on the sender's protocol v2 session, connecting on
+  /// first use. Null when v2 isn't available, in which case the caller
+  /// opens a v1 connection as before.
+  Future<MuxBody?> _muxGet(FileItem file) async {
+    if (!_useMux) return null;
+    final index = int.tryParse(Uri.parse(file.url).pathSegments.last);
+    if (index == null) return null;
+    try {
+      final connecting = _mux;
+      final current = connecting == null ? null : await connecting;
+      if (current == null || current.isClosed) {
+        if (identical(_mux, connecting)) {
+          _mux = MuxClient.connect(
+            widget.serverIp,
+            widget.serverPort + 1,
+            pairingCode: _secureMux
+                ? SecureChannelService.pairingCode(
+                    widget.serverIp,
+                    widget.serverPort,
+                  )
+                : null,
+          );
+        }
+      }
+      final client = await _mux!;
+      if (client == null) {
+        _useMux = false;
+        return null;
+      }
+      return await client.get(index);
+    } catch (e) {
+      print('Note: Protocol v2 request failed, falling back to v1: $e');
+      return null;
+    }
+  }
+
+  /// Satisfies files whose advertised digest matches one received earlier:
+  /// skipped when it already sits under the same name, otherwise linked (or
+  /// copied locally) into place.
+  Future<void> _placeKnownFiles(List<FileItem> files) async {
+    final store = await NativeContentStore.shared();
+    if (store == null) return;
+    await _requestStoragePermissions();
+    _saveFolder ??= await _getDefaultDownloadFolder();
+    int placed = 0;
+    for (final file in files) {
+      final digest = file.digests?.fileDigest;
+      if (digest == null) continue;
+      final existing = store.find(file.size, digest);
+      if (existing == null) continue;
+      final fileName = _safeFileName(file.name);
+      try {
+        if (existing == '$_saveFolder/$fileName') {
+          file.savePath = existing;
+        } else {
+          file.savePath = await _uniqueSavePath(fileName);
+          final kind = await NativeContentStore.place(
+            existing,
+            file.savePath!,
+          );
+          print('Reused ${file.name}: ${kind.name} from $existing');
+          await _addToHistory(
+            fileName: file.name,
+            fileSize: file.size,
+            path: file.savePath!,
+            peerIp: widget.serverIp,
+          );
+        }
+      } catch (e) {
+        print('Note: Could not reuse $existing: $e');
+        continue;
+      }
+      placed++;
+      setState(() {
+        file.status = 'Complete';
+        file.progress = 1.0;
+        file.bytesReceived = file.size;
+      });
+    }
+    if (placed > 0) print('$placed file(s) already on this device');
+  }
+
+  /// Fetches the small files in [files] the sender can batch, up to
+  /// [BatchTransferService.MAX_FILES] per stream. Whatever a batch didn't
+  /// deliver is left 'Waiting' for the per-file download.
+  Future<void> _downloadBatches(List<FileItem> files) async {
+    final pending = <int, FileItem>{};
+    for (final file in files) {
+      if (!file.batchable || file.isCancelled) continue;
+      final index = int.tryParse(Uri.parse(file.url).pathSegments.last);
+      if (index != null) pending[index] = file;
+    }
+    if (pending.length < BatchTransferService.MIN_FILES) return;
+    await _requestStoragePermissions();
+    _saveFolder ??= await _getDefaultDownloadFolder();
+
+    final indices = pending.keys.toList();
+    for (int start = 0; start < indices.length;) {
+      final end = min(start + BatchTransferService.MAX_FILES, indices.length);
+      final batch = indices.sublist(start, end);
+      start = end;
+      setState(() {
+        for (final i in batch) {
+          pending[i]!.status = 'Downloading';
+        }
+      });
+      await BatchTransferService.download(
+        host: widget.serverIp,
+        port: widget.serverPort + 1,
+        indices: batch,
+        directory: _saveFolder!,
+        isCancelled: () => !mounted,
+        onResult: (result) {
+          final file = pending[result.index];
+          if (file == null || result.status != BatchFileStatus.written) {
+            return;
+          }
+          _indexReceived(result.path, result.digest);
+          _addToHistory(
+            fileName: file.name,
+            fileSize: file.size,
+            path: result.path,
+            peerIp: widget.serverIp,
+          );
+          if (!mounted) return;
+          setState(() {
+            file.savePath = result.path;
+            file.status = 'Complete';
+            file.progress = 1.0;
+            file.bytesReceived = file.size;
+          });
+        },
+      );
+      if (!mounted) return;
+      setState(() {
+        for (final i in batch) {
+          if (pending[i]!.status == 'Downloading') {
+            pending[i]!.status = 'Waiting';
+          }
+        }
+      });
+    }
+  }
+
+  String _safeFileName(String name) =>
+      name.replaceAll(RegExp(r'[<>:"/\\|?*]'), '_');
+
+  /// First free `name`, `name_1`, `name_2`… in the save folder.
+  Future<String> _uniqueSavePath(String fileName) async {
+    String savePath = '$_saveFolder/$fileName';
+    int count = 1;
+    while (await File(savePath).exists()) {
+      final parts = fileName.split('.');
+      if (parts.length > 1) {
+        final base = parts.sublist(0, parts.length - 1).join('.');
+        final ext = parts.last;
+        savePath = '$_saveFolder/${base}_$count.$ext';
+      } else {
+        savePath = '$_saveFolder/${fileName}_$count';
+      }
+      count++;
+    }
+    return savePath;
+  }
+
+  /// Remembers a verified download so later shares of it can be skipped.
+  Future<void> _indexReceived(String path, String? digest) async {
+    if (digest == null) return;
+    final store = await NativeContentStore.shared();
+    store?.add(path, digest);
+  }
+
+  /// Rebuilds [file] from the older copy at [basisPath] plus a delta from
+  /// the sender. False if the sender can't do delta or it failed midway, in
+  /// which case the caller downloads the whole file.
+  Future<bool> _downloadDelta(FileItem file, String basisPath) async {
+    if (!DeltaTransferService.isAvailable) return false;
+    DateTime lastUpdate = DateTime.now();
+    try {
+      return await DeltaTransferService.download(
+        fileUrl: file.url,
+        basisPath: basisPath,
+        savePath: file.savePath!,
+        isCancelled: () => file.isCancelled,
+        onProgress: (written, total) {
+          file.bytesReceived = written;
+          file.progress = total > 0 ? written / total : 0.0;
+          final now = DateTime.now();
+          if (now.difference(lastUpdate).inMilliseconds > 200 && mounted) {
+            lastUpdate = now;
+            setState(() {});
+          }
+        },
+      );
+    } catch (e) {
+      if (file.isCancelled) rethrow;
+      print('Note: Delta download failed, sending in full: $e');
+      return false;
+    }
+  }
+
   // ═══════════════════════════════════════════════════════════
   //   UI
   // ═══════════════════════════════════════════════════════════
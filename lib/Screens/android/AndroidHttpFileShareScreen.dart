@@ -12,7 +12,18 @@ import 'package:flutter_local_notifications/flutter_local_notifications.dart';
 import 'dart:convert';
 import 'dart:math';
 import 'package:zap_share/services/device_discovery_service.dart';
+import '../../services/batch_transfer_service.dart';
+import '../../services/compression_stage.dart';
+import '../../services/delta_transfer_service.dart';
+import '../../services/digest_service.dart';
+import '../../services/mux_transfer_service.dart';
+import '../../services/secure_channel_service.dart';
+import '../../services/fanout_service.dart';
+import '../../services/read_ahead_service.dart';
+import '../../services/sparse_transfer_service.dart';
 import '../../services/range_request_handler.dart';
+import '../../services/zip_stream_service.dart';
+import '../../native/screen_mirror.dart';
 
 import 'package:http/http.dart' as http; // Add http package for handshake
 import '../../services/wifi_direct_service.dart';
@@ -93,6 +104,14 @@ class _AndroidHttpFileShareScreenState
   List<int> _fileSizeList = [];
   List<bool> _completedFiles = []; // Added for tracking completion
 
+  // Integrity: chunk digests of every shared file, keyed by uri
+  final DigestService _digests = DigestService();
+
+  // Archives served at /zip, keyed by file selection; dropped (not freed,
+  // responses may still be using them) whenever the shared list changes
+  final Map<String, StreamedZip> _zipArchives = {};
+  String _zipFilesKey = '';
+
   // Track total bytes sent across all parallel range requests per file
   final Map<int, int> _totalBytesSentPerFile =
       {}; // fileIndex -> totalBytesSent
@@ -120,6 +139,9 @@ class _AndroidHttpFileShareScreenState
   StreamSubscription? _connectionResponseSubscription;
   String? _pendingRequestDeviceIp;
   Timer? _requestTimeoutTimer;
+
+  // Desktop screen mirroring (Linux): captured and served natively
+  NativeScreenMirror? _screenMirror;
   Timer? _wifiDirectDiscoveryTimer;
   DiscoveredDevice? _pendingDevice;
   final Set<String> _processedRequests =
@@ -1278,6 +1300,8 @@ class _AndroidHttpFileShareScreenState
           uri: uri,
           fileName: fileName,
           fileSize: fileSize,
+          onData: (offset, bytes) =>
+              _digests.update(uri, fileSize, offset, bytes),
           onProgress: (bytesForRange, progress) {
             // bytesForRange is the total bytes sent so far for this range
             final prev = _rangeBytesSentPerRequest[fileIndex]?[rangeKey] ?? 0;
@@ -1358,11 +1382,27 @@ class _AndroidHttpFileShareScreenState
     double speedMbps = 0.0;
 
     dynamic streamId; // Stream ID for cleanup
+    // Receivers downloading the file at the same time share one disk read;
+    // a lone one gets the next chunks read ahead while this one is sent
+    FileChunkReader? reader;
+    // Compressed frames for receivers that asked for them
+    final frames = CompressedWriter.create(
+      response,
+      CompressionStage.requestedCodecs(request),
+    );
 
     try {
       // Set headers (including Accept-Ranges for parallel streaming support)
       response.statusCode = HttpStatus.ok;
-      response.headers.set('Content-Length', fileSize.toString());
+      if (frames != null) {
+        response.headers.set(
+          CompressionStage.ENCODING_HEADER,
+          CompressionStage.ENCODING_NAME,
+        );
+        response.headers.set(CompressionStage.LENGTH_HEADER, '$fileSize');
+      } else {
+        response.headers.set('Content-Length', fileSize.toString());
+      }
       response.headers.set('Content-Type', 'application/octet-stream');
       response.headers.set(
         'Content-Disposition',
@@ -1375,10 +1415,14 @@ class _AndroidHttpFileShareScreenState
 
       // Open stream
       print('Opening stream for file $fileIndex: $fileName');
-      streamId = await MethodChannel(
-        'zapshare.saf',
-      ).invokeMethod('openReadStream', {'uri': uri});
-      if (streamId == null) {
+      reader =
+          await FanoutService.open(uri) ?? await ReadAheadService.open(uri);
+      streamId = reader != null
+          ? null
+          : await MethodChannel(
+              'zapshare.saf',
+            ).invokeMethod('openReadStream', {'uri': uri});
+      if (reader == null && streamId == null) {
         print('Failed to open stream for file $fileIndex: $fileName');
         response.statusCode = HttpStatus.internalServerError;
         response.write('Could not open SAF stream.');
@@ -1397,13 +1441,15 @@ class _AndroidHttpFileShareScreenState
           await Future.delayed(Duration(milliseconds: 200));
         }
         try {
-          final chunk = await MethodChannel(
-            'zapshare.saf',
-          ).invokeMethod<Uint8List>('readChunk', {
-            'uri': uri,
-            'streamId': streamId,
-            'size': chunkSize,
-          });
+          final chunk = reader != null
+              ? await reader.read(chunkSize)
+              : await MethodChannel(
+                  'zapshare.saf',
+                ).invokeMethod<Uint8List>('readChunk', {
+                  'uri': uri,
+                  'streamId': streamId,
+                  'size': chunkSize,
+                });
 
           if (chunk == null || chunk.isEmpty) {
             print(
@@ -1411,14 +1457,19 @@ class _AndroidHttpFileShareScreenState
             );
             done = true;
           } else {
-            response.add(chunk);
+            _digests.update(uri, fileSize, bytesSent, chunk);
+            if (frames != null) {
+              await frames.add(chunk);
+            } else {
+              response.add(chunk);
+            }
             bytesSent += chunk.length;
             _bytesSentList[fileIndex] = bytesSent;
             double progress = bytesSent / fileSize;
 
             // Force flush response in release builds to ensure data is sent
             // Use more aggressive flushing for release builds
-            if (bytesSent % (chunkSize * 2) == 0) {
+            if (frames == null && bytesSent % (chunkSize * 2) == 0) {
               await response.flush();
             }
 
@@ -1489,7 +1540,7 @@ class _AndroidHttpFileShareScreenState
               }
             }
             // Final flush to ensure all data is sent
-            await response.flush();
+            if (frames == null) await response.flush();
           }
         } catch (e) {
           print('Stream error: $e');
@@ -1497,13 +1548,18 @@ class _AndroidHttpFileShareScreenState
           break;
         }
       }
+      await frames?.finish();
     } catch (e) {
       print('Serve file error: $e');
       response.statusCode = HttpStatus.internalServerError;
     } finally {
-      await MethodChannel(
-        'zapshare.saf',
-      ).invokeMethod('closeStream', {'uri': uri, 'streamId': streamId});
+      frames?.dispose();
+      reader?.close();
+      if (streamId != null) {
+        await MethodChannel(
+          'zapshare.saf',
+        ).invokeMethod('closeStream', {'uri': uri, 'streamId': streamId});
+      }
       await response.close();
 
       // Mark file as completed for this specific client
@@ -1808,6 +1864,13 @@ class _AndroidHttpFileShareScreenState
               'index': i,
               'name': _fileNames[i],
               'size': _fileSizeList.length > i ? _fileSizeList[i] : 0,
+              'codecs': CompressionStage.localCodecs,
+              ..._digestFields(i),
+              ...BatchTransferService.listFields(
+                _fileSizeList.length > i ? _fileSizeList[i] : 0,
+              ),
+              ...MuxTransferService.listFields,
+              ...SecureChannelService.listFields,
             },
           );
           request.response.headers.contentType = ContentType.json;
@@ -1914,6 +1977,95 @@ class _AndroidHttpFileShareScreenState
         }
 
         final segments = request.uri.pathSegments;
+        if (segments.length == 2 && segments[0] == 'digest') {
+          // Chunk digests; whatever the downloads so far didn't hash is read
+          // back from storage now
+          final index = int.tryParse(segments[1]);
+          final digests =
+              index != null &&
+                  index < _fileUris.length &&
+                  index < _fileSizeList.length
+              ? await _digests.complete(
+                  _fileUris[index],
+                  _fileSizeList[index],
+                  () => _readFileStream(_fileUris[index]),
+                )
+              : null;
+          if (digests != null) {
+            request.response.headers.contentType = ContentType.json;
+            request.response.write(jsonEncode(digests.toJson()));
+          } else {
+            request.response.statusCode = HttpStatus.notFound;
+          }
+          await request.response.close();
+          return;
+        }
+
+        if (segments.length == 2 &&
+            segments[0] == SparseTransferService.PATH_SEGMENT) {
+          // Data extents of a sparse file, so receivers can skip its holes
+          final index = int.tryParse(segments[1]);
+          await SparseTransferService.serve(
+            request,
+            index != null && index < _fileUris.length
+                ? _fileUris[index]
+                : null,
+          );
+          return;
+        }
+
+        if (segments.length == 2 &&
+            segments[0] == 'delta' &&
+            request.method == 'POST') {
+          // Receiver already has an older copy: send only what changed
+          final index = int.tryParse(segments[1]);
+          if (index == null || index >= _fileUris.length) {
+            request.response.statusCode = HttpStatus.notFound;
+            await request.response.close();
+            return;
+          }
+          final fileSize =
+              _fileSizeList.length > index ? _fileSizeList[index] : 0;
+          try {
+            await DeltaTransferService.serve(
+              request,
+              source: _readFileStream(_fileUris[index]),
+              fileSize: fileSize,
+              onProgress: (read) {
+                if (fileSize > 0 && index < _progressList.length) {
+                  _progressList[index].value = read / fileSize;
+                }
+              },
+            );
+          } catch (e) {
+            print('Error streaming delta: $e');
+          }
+          return;
+        }
+
+        if (path == ZipStreamService.ARCHIVE_PATH) {
+          // Several files as one archive, generated while it is sent
+          final indices = _zipIndices(request.uri.queryParameters['files']);
+          final zip = indices.isEmpty ? null : _zipFor(indices);
+          if (zip == null) {
+            request.response.statusCode =
+                indices.isEmpty
+                    ? HttpStatus.notFound
+                    : HttpStatus.notImplemented;
+            await request.response.close();
+            return;
+          }
+          final clientIP =
+              request.connectionInfo?.remoteAddress.address ?? 'unknown';
+          print('🗂️ Client $clientIP requested a ${indices.length}-file ZIP');
+          await ZipStreamService.serve(
+            request,
+            zip,
+            archiveName: 'ZapShare_${indices.length}_files.zip',
+          );
+          return;
+        }
+
         if (segments.length == 2 && segments[0] == 'file') {
           final index = int.tryParse(segments[1]);
           if (index == null || index >= _fileUris.length) {
@@ -1958,13 +2110,22 @@ class _AndroidHttpFileShareScreenState
   }
 
   /// Handle incoming TCP client connections for app-to-app file transfer
-  /// Supports two protocols:
+  /// Supports five protocols:
   /// 1. Text: "LIST\n" → JSON array of files
-  /// 2. Binary: [4 bytes file index] → metadata + file data
+  /// 2. Text: "BATCH i,j,k\n" → one batch container with those files
+  /// 3. Binary: [4 bytes file index] → metadata + file data
+  /// 4. Protocol v2: "ZSM2" → multiplexed session, see MuxTransferService
+  /// 5. "ZSE1" → the same session encrypted, see SecureChannelService
   Future<void> _handleTcpClient(Socket client) async {
     final clientAddress = client.remoteAddress.address;
     print('📱 TCP: Client connected from $clientAddress');
 
+    final (protocol, input) = await MuxTransferService.detect(client);
+    if (protocol != TcpProtocol.v1) {
+      await _serveMux(client, protocol, input);
+      return;
+    }
+
     // Define requestProcessed before try block to ensure it's accessible in finally
     bool requestProcessed = false;
 
@@ -1972,7 +2133,7 @@ class _AndroidHttpFileShareScreenState
       // Use a subscription to handle potentially fragmented packets
       final buffer = <int>[];
 
-      await for (final chunk in client) {
+      await for (final chunk in input) {
         if (requestProcessed)
           break; // Should not happen with current protocol logic
         buffer.addAll(chunk);
@@ -1980,9 +2141,9 @@ class _AndroidHttpFileShareScreenState
         // Try to process buffer
         if (buffer.isEmpty) continue;
 
-        // Check if it's a text command (starts with 'L' for LIST)
-        if (buffer[0] == 76) {
-          // 'L'
+        // Check if it's a text command ('L' for LIST, 'B' for BATCH). File
+        // indices never get that large, so binary requests can't collide.
+        if (buffer[0] == 76 || buffer[0] == 66) {
           // Wait for newline to ensure full command
           if (buffer.contains(10)) {
             // 10 is '\n'
@@ -1998,12 +2159,23 @@ class _AndroidHttpFileShareScreenState
                   'index': i,
                   'name': _fileNames[i],
                   'size': _fileSizeList.length > i ? _fileSizeList[i] : 0,
+                  'codecs': CompressionStage.localCodecs,
+                  ..._digestFields(i),
+                  ...BatchTransferService.listFields(
+                    _fileSizeList.length > i ? _fileSizeList[i] : 0,
+                  ),
+                  ...MuxTransferService.listFields,
+                  ...SecureChannelService.listFields,
                 },
               );
               final response = jsonEncode(fileList);
               client.writeln(response);
               await client.flush();
               print('✅ TCP: Sent file list (${fileList.length} files)');
+            } else if (command.startsWith('${BatchTransferService.COMMAND} ')) {
+              requestProcessed = true;
+              await _sendBatchOverTcp(client, command);
+              return;
             } else {
               print('❌ TCP: Unknown command: $command');
             }
@@ -2015,14 +2187,26 @@ class _AndroidHttpFileShareScreenState
           continue;
         }
 
-        // Binary protocol for file download (4 bytes index)
+        // Binary protocol for file download (4 bytes index, then 4 bytes of
+        // codecs if the index carries TCP_CODECS_FLAG)
         if (buffer.length >= 4) {
           // Parse file index (big-endian int32)
-          final fileIndex =
+          int fileIndex =
               (buffer[0] << 24) |
               (buffer[1] << 16) |
               (buffer[2] << 8) |
               buffer[3];
+          int codecs = 0;
+          if (fileIndex & CompressionStage.TCP_CODECS_FLAG != 0) {
+            if (buffer.length < 8) continue;
+            fileIndex &= ~CompressionStage.TCP_CODECS_FLAG;
+            codecs = CompressionStage.negotiate(
+              (buffer[4] << 24) |
+                  (buffer[5] << 16) |
+                  (buffer[6] << 8) |
+                  buffer[7],
+            );
+          }
 
           print('📥 TCP: Client requested file index: $fileIndex');
 
@@ -2038,7 +2222,7 @@ class _AndroidHttpFileShareScreenState
           // No, easiest is to call a helper or handle it right here.
           // Since we are inside 'await for', let's handle file sending here and then return.
 
-          await _sendFileOverTcp(client, fileIndex);
+          await _sendFileOverTcp(client, fileIndex, codecs: codecs);
           return;
         }
       }
@@ -2055,7 +2239,210 @@ class _AndroidHttpFileShareScreenState
     }
   }
 
-  Future<void> _sendFileOverTcp(Socket client, int fileIndex) async {
+  /// Serves a protocol v2 connection until the receiver hangs up. Files
+  /// are pipelined and interleaved on the one socket, so progress is only
+  /// marked per finished file. An encrypted session first has to pass the
+  /// handshake on our share code.
+  Future<void> _serveMux(
+    Socket client,
+    TcpProtocol protocol,
+    Stream<Uint8List> input,
+  ) async {
+    print('📥 TCP: Protocol v2 session from ${client.remoteAddress.address}');
+    final ByteChannel? channel = protocol == TcpProtocol.secure
+        ? await EncryptedChannel.accept(
+            client,
+            input,
+            SecureChannelService.pairingCode(client.address.address, _port),
+          )
+        : PlainChannel(client, input);
+    if (channel == null) {
+      client.destroy();
+      return;
+    }
+    final fileCount = () => min(_fileUris.length, _fileSizeList.length);
+    await MuxServer.serve(
+      channel,
+      fileCount: fileCount,
+      list: () => List.generate(
+        fileCount(),
+        (i) => {
+          'index': i,
+          'name': _fileNames[i],
+          'size': _fileSizeList[i],
+          ..._digestFields(i),
+          ...MuxTransferService.listFields,
+          ...SecureChannelService.listFields,
+        },
+      ),
+      nameOf: (i) => _fileNames[i],
+      sizeOf: (i) => _fileSizeList[i],
+      read: (i) => _readFileStream(_fileUris[i]),
+      onSent: (i) {
+        if (!mounted || i >= _progressList.length) return;
+        _progressList[i].value = 1.0;
+        if (_completedFiles.length > i) _completedFiles[i] = true;
+      },
+    );
+  }
+
+  /// Answers a `BATCH i,j,k` request with every listed file in one stream
+  /// and closes; the receiver verifies each file, so there is no ACK.
+  Future<void> _sendBatchOverTcp(Socket client, String command) async {
+    final indices = BatchTransferService.parseCommand(
+      command,
+      min(_fileUris.length, _fileSizeList.length),
+    );
+    try {
+      final sent = await BatchTransferService.send(
+        client,
+        indices ?? const [],
+        nameOf: (i) => _fileNames[i],
+        sizeOf: (i) => _fileSizeList[i],
+        read: (i) => _readFileStream(_fileUris[i]),
+        onSent: (i) {
+          if (!mounted || i >= _progressList.length) return;
+          _progressList[i].value = 1.0;
+          if (_completedFiles.length > i) _completedFiles[i] = true;
+        },
+      );
+      print('✅ TCP: Batch of $sent files sent');
+    } catch (e) {
+      print('❌ TCP: Error sending batch: $e');
+    } finally {
+      try {
+        await client.close();
+      } catch (_) {
+        client.destroy();
+      }
+    }
+  }
+
+  /// Reads a shared file, SAF or plain path. Receivers reading the same
+  /// file at the same time share one disk read
+  Stream<Uint8List> _readFileStream(String fileUri) => FanoutService.openRead(
+    fileUri,
+    fallback: () => _readFileDirect(fileUri),
+  );
+
+  /// Reads a shared file on its own, SAF or plain path, in 512KB pieces
+  Stream<Uint8List> _readFileDirect(String fileUri) async* {
+    if (!fileUri.startsWith('content://')) {
+      yield* File(fileUri).openRead().map(Uint8List.fromList);
+      return;
+    }
+    final streamId = await _channel.invokeMethod('openReadStream', {
+      'uri': fileUri,
+    });
+    if (streamId == null) throw Exception('Could not open SAF stream');
+    try {
+      while (true) {
+        final chunk = await _channel.invokeMethod<Uint8List>('readChunk', {
+          'uri': fileUri,
+          'streamId': streamId,
+          'size': 512 * 1024,
+        });
+        if (chunk == null || chunk.isEmpty) break;
+        yield chunk;
+      }
+    } finally {
+      await _channel.invokeMethod('closeReadStream', {
+        'uri': fileUri,
+        'streamId': streamId,
+      });
+    }
+  }
+
+  /// Reads bytes [start, end) of a shared file, SAF or plain path
+  Stream<Uint8List> _readFileRange(String fileUri, int start, int end) async* {
+    if (start >= end) return;
+    if (!fileUri.startsWith('content://')) {
+      yield* File(fileUri).openRead(start, end).map(Uint8List.fromList);
+      return;
+    }
+    final streamId = await _channel.invokeMethod('openReadStream', {
+      'uri': fileUri,
+    });
+    if (streamId == null) throw Exception('Could not open SAF stream');
+    try {
+      if (start > 0) {
+        await _channel.invokeMethod('seekStream', {
+          'uri': fileUri,
+          'streamId': streamId,
+          'position': start,
+        });
+      }
+      int remaining = end - start;
+      while (remaining > 0) {
+        final chunk = await _channel.invokeMethod<Uint8List>('readChunk', {
+          'uri': fileUri,
+          'streamId': streamId,
+          'size': min(remaining, 512 * 1024),
+        });
+        if (chunk == null || chunk.isEmpty) break;
+        remaining -= chunk.length;
+        yield chunk;
+      }
+    } finally {
+      await _channel.invokeMethod('closeStream', {
+        'uri': fileUri,
+        'streamId': streamId,
+      });
+    }
+  }
+
+  /// File indices from a `/zip?files=0,3,7` query, all files if absent
+  List<int> _zipIndices(String? files) {
+    if (files == null) return List.generate(_fileUris.length, (i) => i);
+    final indices = <int>{};
+    for (final part in files.split(',')) {
+      final index = int.tryParse(part.trim());
+      if (index != null && index >= 0 && index < _fileUris.length) {
+        indices.add(index);
+      }
+    }
+    return indices.toList();
+  }
+
+  /// Archive of the given files, reused across requests (parallel ranges,
+  /// resumed downloads) until the shared list changes
+  StreamedZip? _zipFor(List<int> indices) {
+    final filesKey = '${_fileUris.join('\n')}|${_fileSizeList.join(',')}';
+    if (filesKey != _zipFilesKey) {
+      _zipArchives.clear();
+      _zipFilesKey = filesKey;
+    }
+    final key = indices.join(',');
+    final cached = _zipArchives[key];
+    if (cached != null) return cached;
+    final uris = [for (final i in indices) _fileUris[i]];
+    final zip = StreamedZip.create(
+      ZipStreamService.entriesFor(
+        [for (final i in indices) _fileNames[i]],
+        [for (final i in indices) _fileSizeList[i]],
+        DateTime.now(),
+      ),
+      (entry, start, end) => _readFileRange(uris[entry], start, end),
+    );
+    if (zip != null) _zipArchives[key] = zip;
+    return zip;
+  }
+
+  /// Digest fields for a LIST / `/list` entry, once the file has been hashed
+  Map<String, dynamic> _digestFields(int index) {
+    if (index >= _fileUris.length || index >= _fileSizeList.length) {
+      return const {};
+    }
+    return _digests.fieldsFor(_fileUris[index], _fileSizeList[index]);
+  }
+
+  /// Streams one file; [codecs] is the compression negotiated with the
+  /// receiver, 0 for the raw stream.
+  Future<void> _sendFileOverTcp(
+    Socket client,
+    int fileIndex, {
+    int codecs = 0,
+  }) async {
     final fileName = _fileNames[fileIndex];
     final fileSize = _fileSizeList[fileIndex];
     final fileUri = _fileUris[fileIndex];
@@ -2063,12 +2450,14 @@ class _AndroidHttpFileShareScreenState
 
     print('📤 TCP: Sending file: $fileName ($fileSize bytes)');
 
+    final frames = CompressedWriter.create(client, codecs);
     try {
       // Send metadata header (JSON)
       final metadata = jsonEncode({
         'fileName': fileName,
         'fileSize': fileSize,
         'fileIndex': fileIndex,
+        if (frames != null) 'encoding': CompressionStage.ENCODING_NAME,
       });
       final metadataBytes = utf8.encode(metadata);
       final metadataLength = metadataBytes.length;
@@ -2101,13 +2490,21 @@ class _AndroidHttpFileShareScreenState
       double speedMbps = 0.0;
 
       if (fileUri.startsWith('content://')) {
-        // SAF URI - use method channel
+        // SAF URI - shared with concurrent receivers when possible, read
+        // ahead natively when the provider only gives a pipe, else through
+        // the method channel
         dynamic streamId;
+        FileChunkReader? reader;
         try {
-          streamId = await _channel.invokeMethod('openReadStream', {
-            'uri': fileUri,
-          });
-          if (streamId == null) {
+          reader =
+              await FanoutService.open(fileUri) ??
+              await ReadAheadService.open(fileUri);
+          streamId = reader != null
+              ? null
+              : await _channel.invokeMethod('openReadStream', {
+                  'uri': fileUri,
+                });
+          if (reader == null && streamId == null) {
             print('❌ TCP: Failed to open SAF stream');
             // Ensure client is closed if an error occurs here
             await client.close();
@@ -2122,22 +2519,28 @@ class _AndroidHttpFileShareScreenState
               await Future.delayed(Duration(milliseconds: 200));
             }
 
-            final chunk = await _channel.invokeMethod<Uint8List>('readChunk', {
-              'uri': fileUri,
-              'streamId': streamId,
-              'size': chunkSize,
-            });
+            final chunk = reader != null
+                ? await reader.read(chunkSize)
+                : await _channel.invokeMethod<Uint8List>('readChunk', {
+                    'uri': fileUri,
+                    'streamId': streamId,
+                    'size': chunkSize,
+                  });
 
             if (chunk == null || chunk.isEmpty) {
               done = true;
             } else {
-              client.add(chunk);
+              _digests.update(fileUri, fileSize, bytesSent, chunk);
               bytesSent += chunk.length;
-
-              // Flush regularly to manage backpressure and ensure smooth progress
-              // Flush every 512KB
-              if (bytesSent % (512 * 1024) == 0) {
-                await client.flush();
+              if (frames != null) {
+                await frames.add(chunk);
+              } else {
+                client.add(chunk);
+                // Flush regularly to manage backpressure and ensure smooth progress
+                // Flush every 512KB
+                if (bytesSent % (512 * 1024) == 0) {
+                  await client.flush();
+                }
               }
 
               // Update progress logic
@@ -2183,22 +2586,29 @@ class _AndroidHttpFileShareScreenState
           }
 
           // Closing stream
-          await _channel.invokeMethod('closeReadStream', {
-            'uri': fileUri,
-            'streamId': streamId,
-          });
+          if (streamId != null) {
+            await _channel.invokeMethod('closeReadStream', {
+              'uri': fileUri,
+              'streamId': streamId,
+            });
+          }
         } catch (e) {
           print('❌ TCP: Error streaming file: $e');
           // Ensure client is closed if an error occurs during streaming
           await client.close();
           return;
+        } finally {
+          reader?.close();
         }
       } else {
         // Regular file path (fallback)
         try {
           final file = File(fileUri);
           if (await file.exists()) {
-            final stream = file.openRead();
+            final stream = FanoutService.openRead(
+              fileUri,
+              fallback: () => file.openRead().cast<Uint8List>(),
+            );
             await for (final chunk in stream) {
               // Check pause state
               while (_isPausedList.length > fileIndex &&
@@ -2206,12 +2616,16 @@ class _AndroidHttpFileShareScreenState
                 await Future.delayed(Duration(milliseconds: 200));
               }
 
-              client.add(chunk);
+              _digests.update(fileUri, fileSize, bytesSent, chunk);
               bytesSent += chunk.length;
-
-              // Flush regularly
-              if (bytesSent % (512 * 1024) == 0) {
-                await client.flush();
+              if (frames != null) {
+                await frames.add(chunk);
+              } else {
+                client.add(chunk);
+                // Flush regularly
+                if (bytesSent % (512 * 1024) == 0) {
+                  await client.flush();
+                }
               }
 
               // Update progress logic
@@ -2255,6 +2669,7 @@ class _AndroidHttpFileShareScreenState
         }
       }
 
+      await frames?.finish();
       await client.flush();
 
       // Completion updates
@@ -2289,6 +2704,7 @@ class _AndroidHttpFileShareScreenState
     } catch (e) {
       print('❌ TCP: Error handling client: $e');
     } finally {
+      frames?.dispose();
       try {
         // Give TCP stack time to drain send buffer before closing
         await Future.delayed(const Duration(milliseconds: 300));
@@ -2489,18 +2905,6 @@ class _AndroidHttpFileShareScreenState
         .toList();
   }
 
-  Future<String?> zipFilesToCache(
-    List<String> uris,
-    List<String> names,
-    String zipName,
-  ) async {
-    return await _channel.invokeMethod<String>('zipFilesToCache', {
-      'uris': uris,
-      'names': names,
-      'zipName': zipName,
-    });
-  }
-
   Future<void> _pickFolder() async {
     HapticFeedback.mediumImpact();
     final folderUri = await pickFolderSAF();
@@ -2991,6 +3395,9 @@ class _AndroidHttpFileShareScreenState
                             <button class="bulk-btn" onclick="downloadSelected()">Download Selected</button>
                         </div>
                     </div>
+                    <div id="zipAll" class="bulk-actions" style="display: none;">
+                        <a class="bulk-btn" href="/zip" download>Download All (.zip)</a>
+                    </div>
                     <div id="pagination" class="pagination" style="display: none;">
                         <button id="prevBtn" onclick="changePage(-1)">Previous</button>
                         <span id="paginationInfo" class="pagination-info"></span>
@@ -3046,8 +3453,11 @@ class _AndroidHttpFileShareScreenState
                     '<div class="no-files"><h3>No files available</h3><p>No files have been shared yet</p></div>';
                 bulkActions.style.display = 'none';
                 pagination.style.display = 'none';
+                document.getElementById('zipAll').style.display = 'none';
                 return;
             }
+            document.getElementById('zipAll').style.display =
+                allFiles.length > 1 ? 'flex' : 'none';
             
             // Calculate pagination
             const startIndex = currentPage * filesPerPage;
@@ -3190,7 +3600,18 @@ class _AndroidHttpFileShareScreenState
         function downloadSelected() {
             if (selectedFiles.size === 0) return;
             
-            // Download files one by one
+            // Several files: one archive, streamed as it is generated
+            if (selectedFiles.size > 1) {
+                const link = document.createElement('a');
+                link.href = `/zip?files=\${[...selectedFiles].join(',')}`;
+                link.download = '';
+                link.style.display = 'none';
+                document.body.appendChild(link);
+                link.click();
+                document.body.removeChild(link);
+                return;
+            }
+            
             selectedFiles.forEach(fileIndex => {
                 const link = document.createElement('a');
                 link.href = `/file/\${fileIndex}`;
@@ -4226,6 +4647,7 @@ class _AndroidHttpFileShareScreenState
   @override
   void dispose() {
     _server?.close(force: true);
+    _digests.dispose();
     // Clean up Wi-Fi Direct group
     _wifiDirectService.removeGroup();
     _pageController.dispose();
@@ -4238,6 +4660,7 @@ class _AndroidHttpFileShareScreenState
     _requestTimeoutTimer?.cancel();
     _wifiDirectDiscoveryTimer?.cancel();
     _statusDismissTimer?.cancel(); // Cancel status timer
+    _screenMirror?.stop();
 
     // Don't stop the singleton discovery service - it runs globally
     super.dispose();
@@ -5506,6 +5929,60 @@ class _AndroidHttpFileShareScreenState
     );
   }
 
+  /// Starts serving this desktop's screen and asks [device] to show it.
+  /// Capture and encoding run natively; see [NativeScreenMirror].
+  Future<void> _startScreenMirror(DiscoveredDevice device) async {
+    final ip = _localIp;
+    if (ip == null) {
+      ScaffoldMessenger.of(context).showSnackBar(
+        SnackBar(
+          content: Text('Could not determine local IP address'),
+          backgroundColor: Colors.red,
+          behavior: SnackBarBehavior.floating,
+        ),
+      );
+      return;
+    }
+    final mirror = NativeScreenMirror.start();
+    if (mirror == null) {
+      ScaffoldMessenger.of(context).showSnackBar(
+        SnackBar(
+          content: Text('This screen cannot be captured (X11 required)'),
+          backgroundColor: Colors.red,
+          behavior: SnackBarBehavior.floating,
+        ),
+      );
+      return;
+    }
+    setState(() => _screenMirror = mirror);
+    final streamUrl = 'http://$ip:${mirror.port}/stream';
+    print('🪞 Mirroring this screen to ${device.ipAddress}: $streamUrl');
+    await _discoveryService.sendScreenMirrorRequest(
+      device.ipAddress,
+      streamUrl,
+    );
+    if (!mounted) return;
+    ScaffoldMessenger.of(context).showSnackBar(
+      SnackBar(
+        content: Text('Mirroring this screen to ${device.deviceName}'),
+        behavior: SnackBarBehavior.floating,
+      ),
+    );
+  }
+
+  void _stopScreenMirror() {
+    final stats = _screenMirror?.stats;
+    if (stats != null) {
+      print(
+        '🪞 Mirror stopped: ${stats.framesSent} frames sent, '
+        '${stats.unchanged} unchanged grabs skipped, '
+        '${stats.averageEncodeMs.toStringAsFixed(1)} ms per encode',
+      );
+    }
+    _screenMirror?.stop();
+    setState(() => _screenMirror = null);
+  }
+
   void _showDeviceDetailsDialog(DiscoveredDevice device) {
     HapticFeedback.mediumImpact();
 
@@ -5627,6 +6104,43 @@ class _AndroidHttpFileShareScreenState
 
                   SizedBox(height: 24),
 
+                  // Mirror this desktop to the device
+                  if (NativeScreenMirror.isAvailable) ...[
+                    GestureDetector(
+                      onTap: () {
+                        Navigator.of(context).pop();
+                        if (_screenMirror != null) {
+                          _stopScreenMirror();
+                        } else {
+                          _startScreenMirror(device);
+                        }
+                      },
+                      child: Container(
+                        width: double.infinity,
+                        padding: EdgeInsets.symmetric(vertical: 14),
+                        decoration: BoxDecoration(
+                          borderRadius: BorderRadius.circular(12),
+                          border: Border.all(
+                            color: Colors.yellow[300]!,
+                            width: 1.5,
+                          ),
+                        ),
+                        child: Text(
+                          _screenMirror != null
+                              ? 'Stop Mirroring'
+                              : 'Mirror This Screen',
+                          textAlign: TextAlign.center,
+                          style: TextStyle(
+                            color: Colors.yellow[300],
+                            fontSize: 16,
+                            fontWeight: FontWeight.bold,
+                          ),
+                        ),
+                      ),
+                    ),
+                    SizedBox(height: 12),
+                  ],
+
                   // Close Button
                   GestureDetector(
                     onTap: () => Navigator.of(context).pop(),
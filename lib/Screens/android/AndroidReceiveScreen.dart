@@ -15,6 +15,7 @@ import 'package:google_fonts/google_fonts.dart';
 import 'package:file_picker/file_picker.dart';
 import 'package:shared_preferences/shared_preferences.dart';
 import 'package:zap_share/blocs/navigation/smooth_page_route.dart';
+import 'package:zap_share/native/connection_pool.dart';
 
 import 'AndroidFileListScreen.dart';
 import 'AndroidHomeScreen.dart';
@@ -104,6 +105,39 @@ class _AndroidReceiveScreenState extends State<AndroidReceiveScreen> {
   bool _loading = false;
   List<String> _recentCodes = [];
 
+  Future<void> _showTcpFiles(
+    List files, {
+    String? code,
+    required bool showLoading,
+  }) async {
+    if (showLoading) setState(() => _loading = false);
+
+    if (files.isNotEmpty) {
+      if (code != null) {
+        await _saveRecentCode(code);
+      }
+
+      HapticFeedback.mediumImpact();
+      // Navigate to file list screen with TCP mode enabled
+      if (mounted) {
+        Navigator.push(
+          context,
+          MaterialPageRoute(
+            builder:
+                (context) => AndroidFileListScreen(
+                  serverIp: _serverIp!,
+                  serverPort: _serverPort,
+                  files: files.cast<Map<String, dynamic>>(),
+                  useTcp: true, // Enable TCP for following downloads
+                ),
+          ),
+        );
+      }
+    } else {
+      _showErrorSnackBar('No files found on this device.');
+    }
+  }
+
   Future<void> _connectToServer({String? code, bool showLoading = true}) async {
     if (showLoading) setState(() => _loading = true);
 
@@ -154,6 +188,21 @@ class _AndroidReceiveScreenState extends State<AndroidReceiveScreen> {
     }
 
     // TCP Connection Flow (Auto Connect / Dialog Accept)
+    // Discovery fetched the list when the share request arrived
+    final prefetched = NativeConnectionPool.shared?.listing(
+      _serverIp!,
+      _serverPort,
+    );
+    if (prefetched != null) {
+      try {
+        final List files = jsonDecode(prefetched);
+        print('⚡ Using the file list fetched ahead');
+        await _showTcpFiles(files, code: code, showLoading: showLoading);
+        return;
+      } catch (e) {
+        print('Prefetched list unusable, asking again: $e');
+      }
+    }
     const maxAttempts = 3;
     for (int attempt = 1; attempt <= maxAttempts; attempt++) {
       try {
@@ -177,32 +226,7 @@ class _AndroidReceiveScreenState extends State<AndroidReceiveScreen> {
         await for (var line in stream) {
           final List files = jsonDecode(line);
           received = true;
-          if (showLoading) setState(() => _loading = false);
-
-          if (files.isNotEmpty) {
-            if (code != null) {
-              await _saveRecentCode(code);
-            }
-
-            HapticFeedback.mediumImpact();
-            // Navigate to file list screen with TCP mode enabled
-            if (mounted) {
-              Navigator.push(
-                context,
-                MaterialPageRoute(
-                  builder:
-                      (context) => AndroidFileListScreen(
-                        serverIp: _serverIp!,
-                        serverPort: _serverPort,
-                        files: files.cast<Map<String, dynamic>>(),
-                        useTcp: true, // Enable TCP for following downloads
-                      ),
-                ),
-              );
-            }
-          } else {
-            _showErrorSnackBar('No files found on this device.');
-          }
+          await _showTcpFiles(files, code: code, showLoading: showLoading);
           socket.close();
           return; // Success — exit the retry loop
         }
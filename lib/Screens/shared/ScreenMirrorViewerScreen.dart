@@ -6,6 +6,8 @@ import 'package:flutter/material.dart';
 import 'package:flutter/services.dart';
 import 'package:google_fonts/google_fonts.dart';
 import 'package:media_kit/media_kit.dart';
+import 'package:zap_share/native/mirror_receiver.dart';
+import 'package:zap_share/native/mjpeg_demuxer.dart';
 import 'package:zap_share/services/device_discovery_service.dart';
 
 /// Displays a live MJPEG stream from an Android device's screen mirror server.
@@ -30,6 +32,12 @@ class ScreenMirrorViewerScreen extends StatefulWidget {
 
 class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
   Uint8List? _currentFrame;
+
+  // Native decoding into a texture, where the runner supports it
+  NativeMirrorReceiver? _receiver;
+  Size? _textureFrameSize; // Of the newest decoded frame; null until one
+  MirrorStats? _mirrorStats;
+  Timer? _statsTimer;
   bool _isConnected = false;
   bool _isConnecting = true;
   String? _error;
@@ -110,7 +118,16 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
       _error = null;
     });
 
+    // Frames are decoded natively into a texture where the runner can
+    // show one, or else cut natively and shown with Image.memory; the Dart
+    // loop below is the last fallback. Only the texture path can compose
+    // a tile stream, so only it asks for one; the multipart boundary, if
+    // the answer is MJPEG, is learned from the stream.
+    NativeMirrorReceiver? receiver;
     try {
+      receiver = await NativeMirrorReceiver.create();
+      if (_isDisposed || !mounted) return;
+
       _httpClient?.close(force: true);
       _httpClient = HttpClient();
       _httpClient!.connectionTimeout = const Duration(seconds: 10);
@@ -118,6 +135,12 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
 
       final request = await _httpClient!.getUrl(Uri.parse(widget.streamUrl));
       request.headers.set('Connection', 'keep-alive');
+      if (receiver != null) {
+        request.headers.set(
+          NativeMirrorReceiver.tileStreamHeader,
+          NativeMirrorReceiver.tileStreamVersion,
+        );
+      }
       final response = await request.close();
 
       if (_isDisposed || !mounted) return;
@@ -135,47 +158,33 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
 
       _resetIdleTimer();
 
-      List<int> buffer = [];
-
-      await for (final chunk in response) {
-        if (_isDisposed || !mounted) break;
-        buffer.addAll(chunk);
-
-        // Find JPEG frames by SOI (FF D8) and EOI (FF D9) markers
-        while (true) {
-          final jpegStart = _findMarker(buffer, 0xFF, 0xD8);
-          if (jpegStart == -1) break;
-
-          final jpegEnd = _findMarker(buffer, 0xFF, 0xD9, jpegStart + 2);
-          if (jpegEnd == -1) break;
-
-          final frameEnd = jpegEnd + 2;
-          if (frameEnd <= buffer.length) {
-            final frame = Uint8List.fromList(buffer.sublist(jpegStart, frameEnd));
-            _frameCount++;
-            _lastFrameTime = DateTime.now();
-            _resetIdleTimer();
-
-            // Frame rate throttle
-            final now = DateTime.now();
-            if (_lastFrameRender != null &&
-                now.difference(_lastFrameRender!) < _minFrameInterval) {
-              _droppedFrames++;
-            } else {
-              _lastFrameRender = now;
-              if (mounted) {
-                setState(() => _currentFrame = frame);
+      final boundary = response.headers.contentType?.parameters['boundary'];
+      final demuxer = receiver == null
+          ? NativeMjpegDemuxer.create(boundary: boundary)
+          : null;
+      try {
+        if (receiver != null) {
+          final adopted = receiver;
+          receiver = null; // Released with the texture from here on.
+          await _readFramesToTexture(response, adopted);
+        } else if (demuxer != null) {
+          await for (final chunk in response) {
+            if (_isDisposed || !mounted) break;
+            demuxer.feed(chunk);
+            for (var frame = demuxer.next(); frame != null;
+                frame = demuxer.next()) {
+              // A view of the demuxer's buffer: copied only if shown.
+              if (_takeFrame() && mounted) {
+                final shown = Uint8List.fromList(frame);
+                setState(() => _currentFrame = shown);
               }
             }
           }
-
-          buffer = buffer.sublist(frameEnd);
-        }
-
-        // Prevent buffer from growing unbounded (4MB limit)
-        if (buffer.length > 4 * 1024 * 1024) {
-          buffer = [];
+        } else {
+          await _readFramesInDart(response);
         }
+      } finally {
+        demuxer?.dispose();
       }
 
       if (mounted && !_isDisposed) {
@@ -215,7 +224,107 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
         });
         _scheduleReconnect();
       }
+    } finally {
+      // Still set only if the stream never reached the texture.
+      receiver?.dispose();
+    }
+  }
+
+  /// Feeds the stream to [receiver], which decodes on its own thread
+  /// straight into its texture; only counters come back to Dart, and the
+  /// widget tree is rebuilt when the frame's shape changes, not per frame.
+  Future<void> _readFramesToTexture(
+    HttpClientResponse response,
+    NativeMirrorReceiver receiver,
+  ) async {
+    _releaseTexture();
+    _receiver = receiver;
+    _statsTimer = Timer.periodic(const Duration(seconds: 1), (_) {
+      if (mounted && !_isDisposed) {
+        setState(() => _mirrorStats = _receiver?.stats);
+      }
+    });
+    var received = 0;
+    await for (final chunk in response) {
+      if (_isDisposed || !mounted) break;
+      receiver.feed(chunk);
+      final stats = receiver.stats;
+      if (stats.received == received) continue;
+      _frameCount += stats.received - received;
+      received = stats.received;
+      _lastFrameTime = DateTime.now();
+      _resetIdleTimer();
+      if (stats.width > 0 &&
+          (_textureFrameSize?.width != stats.width ||
+              _textureFrameSize?.height != stats.height)) {
+        setState(() {
+          _textureFrameSize = Size(
+            stats.width.toDouble(),
+            stats.height.toDouble(),
+          );
+        });
+      }
+    }
+  }
+
+  void _releaseTexture() {
+    _statsTimer?.cancel();
+    _statsTimer = null;
+    _receiver?.dispose();
+    _receiver = null;
+    _textureFrameSize = null;
+    _mirrorStats = null;
+  }
+
+  Future<void> _readFramesInDart(HttpClientResponse response) async {
+    List<int> buffer = [];
+
+    await for (final chunk in response) {
+      if (_isDisposed || !mounted) break;
+      buffer.addAll(chunk);
+
+      // Find JPEG frames by SOI (FF D8) and EOI (FF D9) markers
+      while (true) {
+        final jpegStart = _findMarker(buffer, 0xFF, 0xD8);
+        if (jpegStart == -1) break;
+
+        final jpegEnd = _findMarker(buffer, 0xFF, 0xD9, jpegStart + 2);
+        if (jpegEnd == -1) break;
+
+        final frameEnd = jpegEnd + 2;
+        if (frameEnd <= buffer.length) {
+          final frame = Uint8List.fromList(buffer.sublist(jpegStart, frameEnd));
+          if (_takeFrame() && mounted) {
+            setState(() => _currentFrame = frame);
+          }
+        }
+
+        buffer = buffer.sublist(frameEnd);
+      }
+
+      // Prevent buffer from growing unbounded (4MB limit)
+      if (buffer.length > 4 * 1024 * 1024) {
+        buffer = [];
+      }
+    }
+  }
+
+  /// Counts a frame that arrived; false if it comes too soon after the last
+  /// one shown and should be dropped.
+  bool _takeFrame() {
+    _frameCount++;
+    _lastFrameTime = DateTime.now();
+    _resetIdleTimer();
+
+    // Frame rate throttle
+    final now = DateTime.now();
+    if (_lastFrameRender != null &&
+        now.difference(_lastFrameRender!) < _minFrameInterval) {
+      _droppedFrames++;
+      return false;
     }
+    _lastFrameRender = now;
+    return true;
   }
 
   void _resetIdleTimer() {
@@ -282,6 +391,7 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
     _frameCount = 0;
     _droppedFrames = 0;
     _currentFrame = null;
+    _releaseTexture();
     _reconnectAttempts = 0;
     _connect();
   }
@@ -297,6 +407,11 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
     if (!_isConnected && _reconnectAttempts > 0) {
       return 'Reconnecting ($_reconnectAttempts/$_maxReconnectAttempts)';
     }
+    final stats = _mirrorStats;
+    if (stats != null) {
+      final decodeMs = stats.averageDecodeMs.toStringAsFixed(1);
+      return '$_fps fps • $decodeMs ms decode • ${stats.dropped} dropped';
+    }
     return '$_fps fps • $_frameCount frames';
   }
 
@@ -306,6 +421,7 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
     _reconnectTimer?.cancel();
     _idleTimer?.cancel();
     _httpClient?.close(force: true);
+    _releaseTexture();
     _keyboardFocusNode.dispose();
     _textController.dispose();
     _audioPlayer?.dispose();
@@ -671,7 +787,7 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
       );
     }
 
-    if (_error != null && _currentFrame == null) {
+    if (_error != null && _currentFrame == null && _textureFrameSize == null) {
       return Center(
         child: Column(
           mainAxisAlignment: MainAxisAlignment.center,
@@ -737,7 +853,7 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
       );
     }
 
-    if (_currentFrame != null) {
+    if (_currentFrame != null || _textureFrameSize != null) {
       return Center(
         child: Listener(
           onPointerSignal: _onPointerSignal,
@@ -773,13 +889,15 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
               _dragStart = null;
               _isDragging = false;
             },
-            child: Image.memory(
-              _currentFrame!,
-              key: _imageKey,
-              gaplessPlayback: true,
-              fit: BoxFit.contain,
-              filterQuality: FilterQuality.medium,
-            ),
+            child: _textureFrameSize != null
+                ? _buildTexture()
+                : Image.memory(
+                    _currentFrame!,
+                    key: _imageKey,
+                    gaplessPlayback: true,
+                    fit: BoxFit.contain,
+                    filterQuality: FilterQuality.medium,
+                  ),
           ),
         ),
       );
@@ -793,6 +911,32 @@ class _ScreenMirrorViewerScreenState extends State<ScreenMirrorViewerScreen> {
     );
   }
 
+  /// The receiver's texture, letterboxed like Image.memory with
+  /// BoxFit.contain; the receiver is told the size so it decodes no more
+  /// pixels than are shown.
+  Widget _buildTexture() {
+    final frame = _textureFrameSize!;
+    return LayoutBuilder(
+      builder: (context, constraints) {
+        final ratio = MediaQuery.of(context).devicePixelRatio;
+        if (constraints.hasBoundedWidth && constraints.hasBoundedHeight) {
+          _receiver?.setTargetSize(
+            (constraints.maxWidth * ratio).round(),
+            (constraints.maxHeight * ratio).round(),
+          );
+        }
+        return AspectRatio(
+          aspectRatio: frame.width / frame.height,
+          child: Texture(
+            key: _imageKey,
+            textureId: _receiver!.textureId,
+            filterQuality: FilterQuality.medium,
+          ),
+        );
+      },
+    );
+  }
+
   Widget _buildControlPanel() {
     return Positioned(
       bottom: 16,
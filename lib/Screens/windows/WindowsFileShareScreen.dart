@@ -9,7 +9,17 @@ import 'package:flutter/services.dart';
 import 'package:google_fonts/google_fonts.dart';
 import 'package:qr_flutter/qr_flutter.dart';
 
+import '../../services/batch_transfer_service.dart';
+import '../../services/compression_stage.dart';
+import '../../services/delta_transfer_service.dart';
+import '../../services/mux_transfer_service.dart';
+import '../../services/secure_channel_service.dart';
+import '../../services/fanout_service.dart';
+import '../../services/read_ahead_service.dart';
+import '../../services/sparse_transfer_service.dart';
 import '../../services/device_discovery_service.dart';
+import '../../services/digest_service.dart';
+import '../../services/range_request_handler.dart';
 import '../../widgets/CustomAvatarWidget.dart';
 
 // --- Ripple/Pulse Animation Widget (Android Style) ---
@@ -269,6 +279,13 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
   List<double> _progressList = [];
   List<bool> _isPausedList = [];
   List<int> _downloadCounts = []; // Track successful downloads per file
+  // Parallel downloads: bytes sent across a file's Range responses, and
+  // how many of them are still running
+  final Map<int, int> _rangeBytesSent = {};
+  final Map<int, int> _activeRanges = {};
+
+  // Integrity: chunk digests of every shared file, keyed by path
+  final DigestService _digests = DigestService();
 
   // Drag & Drop
   bool _isDragOver = false;
@@ -308,6 +325,7 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
     _connectionRequestSubscription?.cancel();
     _connectionResponseSubscription?.cancel();
     _statusDismissTimer?.cancel();
+    _digests.dispose();
     super.dispose();
   }
 
@@ -569,7 +587,12 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
     if (path == '/list') {
       final list = List.generate(
         _files.length,
-        (i) => {'index': i, 'name': _files[i].name, 'size': _files[i].size},
+        (i) => {
+          'index': i,
+          'name': _files[i].name,
+          'size': _files[i].size,
+          ..._digestFields(i),
+        },
       );
       request.response.headers.contentType = ContentType.json;
       request.response.write(jsonEncode(list));
@@ -622,38 +645,169 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
     }
 
     final segments = request.uri.pathSegments;
+    if (segments.length == 2 && segments[0] == 'digest') {
+      // Chunk digests; whatever the downloads so far didn't hash is read
+      // back from disk now
+      final index = int.tryParse(segments[1]);
+      final file =
+          index != null && index < _files.length ? _files[index] : null;
+      final digests = file?.path != null
+          ? await _digests.complete(
+              file!.path!,
+              file.size,
+              () => File(file.path!).openRead(),
+            )
+          : null;
+      if (digests != null) {
+        request.response.headers.contentType = ContentType.json;
+        request.response.write(jsonEncode(digests.toJson()));
+      } else {
+        request.response.statusCode = HttpStatus.notFound;
+      }
+      await request.response.close();
+      return;
+    }
+
+    if (segments.length == 2 &&
+        segments[0] == SparseTransferService.PATH_SEGMENT) {
+      // Data extents of a sparse file, so receivers can skip its holes
+      final index = int.tryParse(segments[1]);
+      await SparseTransferService.serve(
+        request,
+        index != null && index < _files.length ? _files[index].path : null,
+      );
+      return;
+    }
+
+    if (segments.length == 2 &&
+        segments[0] == 'delta' &&
+        request.method == 'POST') {
+      // Receiver already has an older copy: send only what changed
+      final index = int.tryParse(segments[1]);
+      if (index != null && index < _files.length) {
+        final file = _files[index];
+        final fsFile = File(file.path!);
+        if (await fsFile.exists()) {
+          final fileSize = await fsFile.length();
+          await DeltaTransferService.serve(
+            request,
+            source: fsFile.openRead(),
+            fileSize: fileSize,
+            onProgress: (read) {
+              if (mounted && index < _progressList.length) {
+                setState(() => _progressList[index] = read / fileSize);
+              }
+            },
+          );
+          return;
+        }
+      }
+    }
+
     if (segments.length == 2 && segments[0] == 'file') {
       final index = int.tryParse(segments[1]);
       if (index != null && index < _files.length) {
         final file = _files[index];
         final fsFile = File(file.path!);
         if (await fsFile.exists()) {
+          final fileSize = file.size;
+
+          // Single Range requests let receivers re-fetch corrupted chunks
+          int start = 0;
+          int end = fileSize - 1;
+          final ranges = request.getRanges(fileSize);
+          if (request.isRangeRequest && ranges.isNotEmpty) {
+            start = ranges.first['start']!;
+            end = ranges.first['end']!;
+            request.response.statusCode = HttpStatus.partialContent;
+            request.response.headers.set(
+              'Content-Range',
+              'bytes $start-$end/$fileSize',
+            );
+          }
+
           request.response.headers.contentType = ContentType.binary;
           request.response.headers.add(
             'Content-Disposition',
             'attachment; filename="${file.name}"',
           );
-          request.response.headers.contentLength = file.size;
+          request.response.headers.set('Accept-Ranges', 'bytes');
+          // Lets receivers tell a resumable partial download from a stale one
+          request.response.headers.set(
+            HttpHeaders.lastModifiedHeader,
+            HttpDate.format(await fsFile.lastModified()),
+          );
+          // Receivers that can decode frames get whole files compressed
+          final frames = CompressedWriter.create(
+            request.response,
+            CompressionStage.requestedCodecs(request),
+          );
+          if (frames != null) {
+            request.response.headers.set(
+              CompressionStage.ENCODING_HEADER,
+              CompressionStage.ENCODING_NAME,
+            );
+            request.response.headers.set(
+              CompressionStage.LENGTH_HEADER,
+              '$fileSize',
+            );
+          } else {
+            request.response.headers.contentLength = end - start + 1;
+          }
 
-          // Manual Stream for HTTP Progress Tracking - RandomAccessFile
+          // Manual Stream for HTTP Progress Tracking. Receivers fetching
+          // the same file at once share one disk read; otherwise the next
+          // chunks are read ahead while this one is sent
           RandomAccessFile? raf;
+          FileChunkReader? reader;
+          final wholeFile = start == 0 && end == fileSize - 1;
+          if (!wholeFile) {
+            _activeRanges[index] = (_activeRanges[index] ?? 0) + 1;
+          }
           try {
             int bytesSent = 0;
-            final fileSize = file.size;
+            int position = start;
             DateTime lastUpdate = DateTime.now();
 
-            raf = await fsFile.open();
+            reader =
+                await FanoutService.open(
+                  file.path!,
+                  start: start,
+                  end: end + 1,
+                ) ??
+                await ReadAheadService.open(
+                  file.path!,
+                  start: start,
+                  end: end + 1,
+                );
+            if (reader == null) {
+              raf = await fsFile.open();
+              await raf.setPosition(start);
+            }
             const int chunkSize = 64 * 1024; // 64KB chunks
 
-            while (bytesSent < fileSize) {
-              final chunk = await raf.read(chunkSize);
+            while (position <= end) {
+              final toRead = min(chunkSize, end - position + 1);
+              final chunk = reader != null
+                  ? await reader.read(toRead)
+                  : await raf!.read(toRead);
               if (chunk.isEmpty) break;
 
-              request.response.add(chunk);
+              _digests.update(file.path!, fileSize, position, chunk);
               bytesSent += chunk.length;
-
-              // Flush EVERY chunk for exact progress
-              await request.response.flush();
+              position += chunk.length;
+              if (!wholeFile) {
+                _rangeBytesSent[index] =
+                    (_rangeBytesSent[index] ?? 0) + chunk.length;
+              }
+              if (frames != null) {
+                // Flushes as it measures the link rate
+                await frames.add(chunk);
+              } else {
+                request.response.add(chunk);
+                // Flush EVERY chunk for exact progress
+                await request.response.flush();
+              }
 
               // Update UI Progress
               final now = DateTime.now();
@@ -662,14 +816,24 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
                 if (mounted) {
                   setState(() {
                     if (index < _progressList.length) {
-                      _progressList[index] = bytesSent / fileSize;
+                      _progressList[index] = wholeFile
+                          ? position / fileSize
+                          : min((_rangeBytesSent[index] ?? 0) / fileSize, 1.0);
                     }
                   });
                 }
               }
             }
-            // Finalize
-            if (mounted) {
+            await frames?.finish();
+            // Finalize: a range is only a piece of the file, which is done
+            // once every range of it has gone out
+            final done = wholeFile
+                ? position > end
+                : _activeRanges[index] == 1 &&
+                      (_rangeBytesSent[index] ?? 0) >= fileSize;
+            // The next download of it counts from zero
+            if (done && !wholeFile) _rangeBytesSent.remove(index);
+            if (mounted && done) {
               setState(() {
                 if (index < _progressList.length) {
                   _progressList[index] = 1.0;
@@ -679,6 +843,16 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
           } catch (e) {
             print("Error streaming file via HTTP: $e");
           } finally {
+            if (!wholeFile) {
+              final left = (_activeRanges[index] ?? 1) - 1;
+              if (left > 0) {
+                _activeRanges[index] = left;
+              } else {
+                _activeRanges.remove(index);
+              }
+            }
+            frames?.dispose();
+            reader?.close();
             await raf?.close();
             await request.response.close();
           }
@@ -748,10 +922,17 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
     );
   }
 
-  void _handleTcpClient(Socket client) {
+  Future<void> _handleTcpClient(Socket client) async {
     Completer<void>? pendingAck;
 
-    client
+    // v2 clients open with the mux or handshake magic; the rest is v1 text
+    final (protocol, input) = await MuxTransferService.detect(client);
+    if (protocol != TcpProtocol.v1) {
+      await _serveMux(client, protocol, input);
+      return;
+    }
+
+    input
         .cast<List<int>>()
         .transform(utf8.decoder)
         .transform(const LineSplitter())
@@ -770,10 +951,16 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
                 'name': _files[i].name,
                 'size': _files[i].size,
                 'uri': 'file://$i',
+                ..._digestFields(i),
+                ...BatchTransferService.listFields(_files[i].size),
+                ...MuxTransferService.listFields,
+                ...SecureChannelService.listFields,
               },
             );
             client.writeln(jsonEncode(list));
             await client.flush();
+          } else if (line.startsWith('${BatchTransferService.COMMAND} ')) {
+            await _sendBatch(client, line);
           } else if (line.startsWith('GET ')) {
             final indexStr = line.substring(4);
             final index = int.tryParse(indexStr);
@@ -790,14 +977,21 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
 
               pendingAck = Completer<void>();
               RandomAccessFile? raf;
+              FileChunkReader? reader;
               try {
-                raf = await fsFile.open();
+                reader =
+                    await FanoutService.open(file.path!) ??
+                    await ReadAheadService.open(file.path!);
+                if (reader == null) raf = await fsFile.open();
                 const int chunkSize = 64 * 1024; // 64KB chunks
 
                 while (bytesSent < fileSize) {
-                  final chunk = await raf.read(chunkSize);
+                  final chunk = reader != null
+                      ? await reader.read(chunkSize)
+                      : await raf!.read(chunkSize);
                   if (chunk.isEmpty) break;
 
+                  _digests.update(file.path!, fileSize, bytesSent, chunk);
                   client.add(chunk);
                   bytesSent += chunk.length;
 
@@ -857,6 +1051,7 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
               } catch (e) {
                 print("Error sending file: $e");
               } finally {
+                reader?.close();
                 await raf?.close();
                 // Important: Close socket to signal EOF to receiver
                 await client.close();
@@ -866,6 +1061,98 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
         });
   }
 
+  /// Serves a protocol v2 connection: any number of pipelined requests,
+  /// no ACKs; a file counts as sent once its last frame is queued. An
+  /// encrypted session first has to pass the handshake on our share code.
+  Future<void> _serveMux(
+    Socket client,
+    TcpProtocol protocol,
+    Stream<Uint8List> input,
+  ) async {
+    final ByteChannel? channel = protocol == TcpProtocol.secure
+        ? await EncryptedChannel.accept(
+            client,
+            input,
+            SecureChannelService.pairingCode(client.address.address, _port),
+          )
+        : PlainChannel(client, input);
+    if (channel == null) {
+      client.destroy();
+      return;
+    }
+    await MuxServer.serve(
+      channel,
+      fileCount: () => _files.length,
+      list: () => List.generate(
+        _files.length,
+        (i) => {
+          'index': i,
+          'name': _files[i].name,
+          'size': _files[i].size,
+          ..._digestFields(i),
+          ...MuxTransferService.listFields,
+          ...SecureChannelService.listFields,
+        },
+      ),
+      nameOf: (i) => _files[i].name,
+      sizeOf: (i) => _files[i].size,
+      read: (i) => FanoutService.openRead(
+        _files[i].path!,
+        fallback: () => File(_files[i].path!).openRead().cast<Uint8List>(),
+      ),
+      onSent: (i) {
+        if (!mounted || i >= _progressList.length) return;
+        setState(() {
+          _progressList[i] = 1.0;
+          _downloadCounts[i]++;
+        });
+      },
+    );
+  }
+
+  /// Answers a `BATCH i,j,k` request with every listed file in one stream,
+  /// then closes. Nothing to wait for: there is no per-file ACK.
+  Future<void> _sendBatch(Socket client, String line) async {
+    final indices = BatchTransferService.parseCommand(line, _files.length);
+    try {
+      final sent = await BatchTransferService.send(
+        client,
+        indices ?? const [],
+        nameOf: (i) => _files[i].name,
+        sizeOf: (i) => _files[i].size,
+        read: (i) => File(_files[i].path!).openRead(),
+        onSent: (i) {
+          if (!mounted || i >= _progressList.length) return;
+          setState(() {
+            _progressList[i] = 1.0;
+            _downloadCounts[i]++;
+          });
+        },
+      );
+      if (mounted && sent > 0) {
+        _showStatus(
+          message: "$sent file${sent == 1 ? '' : 's'} sent",
+          subtitle: "Batch transfer completed",
+          icon: Icons.check_circle_rounded,
+          isSuccess: true,
+          autoDismiss: const Duration(seconds: 5),
+        );
+      }
+    } catch (e) {
+      print("Error sending batch: $e");
+    } finally {
+      await client.close();
+    }
+  }
+
+  /// Digest fields for a LIST / `/list` entry, once the file has been hashed
+  Map<String, dynamic> _digestFields(int index) {
+    final file = _files[index];
+    return file.path != null
+        ? _digests.fieldsFor(file.path!, file.size)
+        : const {};
+  }
+
   void _initDeviceDiscovery() async {
     await _discoveryService.initialize();
     await _discoveryService.start();
@@ -1563,6 +1850,8 @@ class _WindowsFileShareScreenState extends State<WindowsFileShareScreen> {
                           _progressList.clear();
                           _isPausedList.clear();
                           _downloadCounts.clear();
+                          _rangeBytesSent.clear();
+                          _activeRanges.clear();
                           _stopServer();
                         });
                       },
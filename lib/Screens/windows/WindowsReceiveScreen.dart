@@ -11,6 +11,14 @@ import 'package:shared_preferences/shared_preferences.dart';
 import 'package:flutter/services.dart';
 import 'package:open_file/open_file.dart';
 
+import '../../native/batch.dart';
+import '../../native/content_hash.dart';
+import '../../native/content_store.dart';
+import '../../services/batch_transfer_service.dart';
+import '../../services/compression_stage.dart';
+import '../../services/delta_transfer_service.dart';
+import '../../services/parallel_transfer_service.dart';
+
 class DownloadTask {
   final String url;
   final String fileName;
@@ -22,6 +30,9 @@ class DownloadTask {
   bool isPaused;
   int bytesReceived;
   double speedMbps;
+  ChunkDigests? digests; // Advertised by the sender, if it has hashed the file
+  bool batchable; // Small enough to go in a BATCH request to this sender
+  IntegrityResult? integrity; // Once complete; null if it wasn't checked
 
   DownloadTask({
     required this.url,
@@ -34,6 +45,8 @@ class DownloadTask {
     this.isPaused = false,
     this.bytesReceived = 0,
     this.speedMbps = 0.0,
+    this.digests,
+    this.batchable = false,
   });
 }
 
@@ -250,6 +263,13 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
                     fileName: name,
                     fileSize: size,
                     savePath: '',
+                    digests: ChunkDigests.fromJson(
+                      Map<String, dynamic>.from(f),
+                      size,
+                    ),
+                    batchable: BatchTransferService.canBatch(
+                      Map<String, dynamic>.from(f),
+                    ),
                   );
                 }).toList();
           });
@@ -305,6 +325,10 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
                   fileName: name,
                   fileSize: size,
                   savePath: '',
+                  digests: ChunkDigests.fromJson(
+                    Map<String, dynamic>.from(f),
+                    size,
+                  ),
                 );
               }).toList();
         });
@@ -434,14 +458,158 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
     final selectedTasks = _tasks.where((task) => task.isSelected).toList();
     if (selectedTasks.isEmpty) return;
 
+    // Identical files received in an earlier session never hit the network
+    final placed = await _placeKnownFiles(selectedTasks);
+    if (placed > 0) {
+      _showStatus(
+        message: 'Already on this device',
+        subtitle: '$placed file${placed == 1 ? '' : 's'} reused',
+        icon: Icons.done_all_rounded,
+        isSuccess: true,
+        autoDismiss: Duration(seconds: 3),
+      );
+    }
+    if (!_tasks.any((t) => t.isSelected && t.status == 'Waiting')) return;
+
     setState(() {
       _downloading = true;
       _activeDownloads = 0;
     });
 
+    // Small files first, several per stream; the rest go one by one
+    await _downloadBatches();
+    if (!_tasks.any((t) => t.isSelected && t.status != 'Complete')) {
+      setState(() => _downloading = false);
+      _showStatus(
+        message: 'All downloads complete',
+        icon: Icons.done_all_rounded,
+        isSuccess: true,
+        autoDismiss: Duration(seconds: 3),
+      );
+      return;
+    }
+
     _startQueuedDownloads();
   }
 
+  /// Fetches the small files the sender can batch over its TCP port, up to
+  /// [BatchTransferService.MAX_FILES] per stream. Whatever a batch didn't
+  /// deliver goes back to 'Waiting' for the normal HTTP download.
+  Future<void> _downloadBatches() async {
+    final pending = <int, DownloadTask>{};
+    for (final task in _tasks) {
+      if (task.isSelected && task.status == 'Waiting' && task.batchable) {
+        final index = int.tryParse(Uri.parse(task.url).pathSegments.last);
+        if (index != null) pending[index] = task;
+      }
+    }
+    if (pending.length < BatchTransferService.MIN_FILES) return;
+
+    final indices = pending.keys.toList();
+    for (int start = 0; start < indices.length;) {
+      final end = min(start + BatchTransferService.MAX_FILES, indices.length);
+      final batch = indices.sublist(start, end);
+      start = end;
+      setState(() {
+        for (final i in batch) {
+          pending[i]!.status = 'Downloading';
+        }
+      });
+      await BatchTransferService.download(
+        host: _serverIp!,
+        port: _serverPort + 1,
+        indices: batch,
+        directory: _saveFolder!,
+        isCancelled: () => !mounted,
+        onResult: (result) {
+          final task = pending[result.index];
+          if (task == null || result.status != BatchFileStatus.written) {
+            return;
+          }
+          _indexReceived(result.path, result.digest);
+          if (!mounted) return;
+          setState(() {
+            task.savePath = result.path;
+            task.status = 'Complete';
+            task.progress = 1.0;
+            task.bytesReceived = task.fileSize;
+            _downloadedFiles.add(task);
+            _tasks.remove(task);
+          });
+        },
+      );
+      if (!mounted) return;
+      setState(() {
+        for (final i in batch) {
+          if (pending[i]!.status == 'Downloading') {
+            pending[i]!.status = 'Waiting';
+          }
+        }
+      });
+    }
+  }
+
+  /// Satisfies tasks whose advertised digest matches a file received
+  /// earlier: skipped when it already sits under the same name, otherwise
+  /// linked into place. Returns how many tasks were handled.
+  Future<int> _placeKnownFiles(List<DownloadTask> tasks) async {
+    final store = await NativeContentStore.shared();
+    if (store == null) return 0;
+    int placed = 0;
+    for (final task in tasks) {
+      final digest = task.digests?.fileDigest;
+      if (digest == null || task.status != 'Waiting') continue;
+      final existing = store.find(task.fileSize, digest);
+      if (existing == null) continue;
+      try {
+        if (existing == '$_saveFolder\\${task.fileName}') {
+          task.savePath = existing;
+        } else {
+          task.savePath = await _uniqueSavePath(task.fileName);
+          final kind = await NativeContentStore.place(existing, task.savePath);
+          print('♻️ ${task.fileName}: ${kind.name} from $existing');
+        }
+      } catch (e) {
+        print('⚠️ Could not reuse $existing: $e');
+        continue;
+      }
+      placed++;
+      setState(() {
+        task.status = 'Complete';
+        task.progress = 1.0;
+        task.bytesReceived = task.fileSize;
+        _downloadedFiles.add(task);
+        _tasks.remove(task);
+      });
+    }
+    return placed;
+  }
+
+  /// First free `name`, `name_1`, `name_2`… in the save folder.
+  Future<String> _uniqueSavePath(String fileName) async {
+    String savePath = '$_saveFolder\\$fileName';
+    int count = 1;
+    while (await File(savePath).exists()) {
+      final parts = fileName.split('.');
+      if (parts.length > 1) {
+        final base = parts.sublist(0, parts.length - 1).join('.');
+        final ext = parts.last;
+        savePath = '$_saveFolder\\${base}_$count.$ext';
+      } else {
+        savePath = '$_saveFolder\\${fileName}_$count';
+      }
+      count++;
+    }
+    return savePath;
+  }
+
+  /// Remembers a verified download so later shares of it can be skipped.
+  Future<void> _indexReceived(String path, String? digest) async {
+    if (digest == null) return;
+    final store = await NativeContentStore.shared();
+    store?.add(path, digest);
+  }
+
   void _startQueuedDownloads() {
     while (_activeDownloads < _maxParallel) {
       final next = _tasks.indexWhere(
@@ -460,10 +628,29 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
       task.status = 'Downloading';
     });
 
+    NativeChunkHasher? hasher;
     try {
+      String fileName = task.fileName;
+      // Handle content disposition if needed, but we usually trust the Task's fileName
+
+      final basisPath = '$_saveFolder\\$fileName';
+      final savePath = await _uniqueSavePath(fileName);
+      task.savePath = savePath;
+
+      // An older copy under the same name: fetch only what changed
+      if (savePath != basisPath && await _downloadDelta(task, basisPath)) {
+        await _indexReceived(savePath, task.digests?.fileDigest);
+        _onDownloadComplete(task);
+        return;
+      }
+
       final client = http.Client();
       final request = http.Request('GET', Uri.parse(task.url));
       request.headers['Connection'] = 'keep-alive';
+      if (CompressionStage.localCodecs != 0) {
+        request.headers[CompressionStage.CODECS_HEADER] =
+            '${CompressionStage.localCodecs}';
+      }
 
       final response = await client
           .send(request)
@@ -472,33 +659,28 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
             onTimeout: () => throw TimeoutException('Download timed out'),
           );
 
-      String fileName = task.fileName;
-      // Handle content disposition if needed, but we usually trust the Task's fileName
-
-      String savePath = '$_saveFolder\\$fileName';
-      int count = 1;
-      while (await File(savePath).exists()) {
-        final parts = fileName.split('.');
-        if (parts.length > 1) {
-          final base = parts.sublist(0, parts.length - 1).join('.');
-          final ext = parts.last;
-          savePath = '$_saveFolder\\${base}_$count.$ext';
-        } else {
-          savePath = '$_saveFolder\\${fileName}_$count';
-        }
-        count++;
-      }
-
-      task.savePath = savePath;
       final file = File(savePath);
       final sink = file.openWrite();
       int received = 0;
-      final contentLength = response.contentLength ?? task.fileSize;
+      // Compressed bodies are decoded before hashing and writing
+      final encoded = CompressionStage.isEncoded(response.headers);
+      final contentLength =
+          encoded
+              ? int.tryParse(
+                    response.headers[CompressionStage.LENGTH_HEADER
+                            .toLowerCase()] ??
+                        '',
+                  ) ??
+                  task.fileSize
+              : response.contentLength ?? task.fileSize;
+      if (contentLength > 0) hasher = NativeChunkHasher.create(contentLength);
+      final body =
+          encoded ? CompressionStage.decode(response.stream) : response.stream;
 
       DateTime lastSpeedTime = DateTime.now();
       int lastBytes = 0;
 
-      await for (var chunk in response.stream) {
+      await for (var chunk in body) {
         if (task.isPaused && mounted) {
           // Simple pause logic: wait loop
           while (task.isPaused && mounted) {
@@ -506,6 +688,7 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
           }
         }
 
+        hasher?.update(received, chunk);
         sink.add(chunk);
         received += chunk.length;
         task.bytesReceived = received;
@@ -530,28 +713,19 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
       await sink.close();
       client.close();
 
-      setState(() {
-        task.status = 'Complete';
-        _activeDownloads--;
-        _downloadedFiles.add(task);
-        _tasks.remove(task);
-      });
-
-      _startQueuedDownloads();
-
-      if (_tasks.every(
-        (task) => task.status == 'Complete' || !task.isSelected,
-      )) {
-        setState(() {
-          _downloading = false;
-        });
-        _showStatus(
-          message: 'All downloads complete',
-          icon: Icons.done_all_rounded,
-          isSuccess: true,
-          autoDismiss: Duration(seconds: 3),
+      // Verify against the sender's chunk digests; re-fetch only bad chunks
+      if (hasher != null) {
+        if (mounted) setState(() => task.status = 'Verifying');
+        task.integrity = await ParallelTransferService.verify(
+          url: task.url,
+          savePath: savePath,
+          hasher: hasher,
+          expected: task.digests,
         );
+        await _indexReceived(savePath, hasher.fileDigest());
       }
+
+      _onDownloadComplete(task);
     } catch (e) {
       if (!mounted) return;
       setState(() {
@@ -559,6 +733,65 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
         _activeDownloads--;
       });
       _startQueuedDownloads();
+    } finally {
+      hasher?.dispose();
+    }
+  }
+
+  /// Rebuilds [task] from the older copy at [basisPath] plus a delta from
+  /// the sender. False if the sender can't do delta or it failed midway, in
+  /// which case the caller downloads the whole file.
+  Future<bool> _downloadDelta(DownloadTask task, String basisPath) async {
+    if (!DeltaTransferService.isAvailable) return false;
+    if (mounted) setState(() => task.status = 'Comparing');
+    DateTime lastUpdate = DateTime.now();
+    try {
+      final ok = await DeltaTransferService.download(
+        fileUrl: task.url,
+        basisPath: basisPath,
+        savePath: task.savePath,
+        isCancelled: () => !mounted,
+        onProgress: (written, total) {
+          task.bytesReceived = written;
+          task.progress = total > 0 ? written / total : 0.0;
+          final now = DateTime.now();
+          if (now.difference(lastUpdate).inMilliseconds > 200 && mounted) {
+            lastUpdate = now;
+            setState(() => task.status = 'Downloading');
+          }
+        },
+      );
+      if (!ok && mounted) setState(() => task.status = 'Downloading');
+      return ok;
+    } catch (e) {
+      print('⚠️ Delta download failed, sending in full: $e');
+      if (mounted) setState(() => task.status = 'Downloading');
+      return false;
+    }
+  }
+
+  void _onDownloadComplete(DownloadTask task) {
+    setState(() {
+      task.status = 'Complete';
+      _activeDownloads--;
+      _downloadedFiles.add(task);
+      _tasks.remove(task);
+    });
+
+    _startQueuedDownloads();
+
+    if (_tasks.every(
+      (task) => task.status == 'Complete' || !task.isSelected,
+    )) {
+      setState(() {
+        _downloading = false;
+      });
+      _showStatus(
+        message: 'All downloads complete',
+        icon: Icons.done_all_rounded,
+        isSuccess: true,
+        autoDismiss: Duration(seconds: 3),
+      );
     }
   }
 
@@ -1448,7 +1681,10 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
   }
 
   Widget _buildFileItem(DownloadTask task) {
-    final bool isDownloading = task.status == 'Downloading';
+    final bool isDownloading =
+        task.status == 'Downloading' ||
+        task.status == 'Comparing' ||
+        task.status == 'Verifying';
     final bool isComplete = task.status == 'Complete';
 
     return Container(
@@ -1519,6 +1755,17 @@ class _WindowsReceiveScreenState extends State<WindowsReceiveScreen> {
                           ),
                         ),
                       ],
+                      if (isComplete &&
+                          task.integrity == IntegrityResult.unverified) ...[
+                        Text(" • ", style: TextStyle(color: Colors.grey[700])),
+                        Text(
+                          "Unverified",
+                          style: GoogleFonts.outfit(
+                            color: Colors.orangeAccent,
+                            fontSize: 12,
+                          ),
+                        ),
+                      ],
                     ],
                   ),
                   if (isDownloading) ...[
@@ -0,0 +1,311 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsBatchWriter extends Opaque {}
+
+final class _ZsBatchReceiver extends Opaque {}
+
+class _BatchBindings {
+  final Pointer<_ZsBatchWriter> Function() writerNew;
+  final NativeFinalizer writerFinalizer;
+  final void Function(Pointer<Void>) writerFree;
+  final void Function(Pointer<_ZsBatchWriter>, int, Pointer<Utf8>, int)
+  beginFile;
+  final void Function(Pointer<_ZsBatchWriter>, Pointer<Uint8>, int)
+  writerUpdate;
+  final int Function(Pointer<_ZsBatchWriter>) endFile;
+  final void Function(Pointer<_ZsBatchWriter>, int) skipFile;
+  final void Function(Pointer<_ZsBatchWriter>) writerFinish;
+  final int Function(Pointer<_ZsBatchWriter>) writerPending;
+  final int Function(Pointer<_ZsBatchWriter>, Pointer<Uint8>, int) writerRead;
+  final Pointer<_ZsBatchReceiver> Function(Pointer<Utf8>, int) receiverNew;
+  final NativeFinalizer receiverFinalizer;
+  final void Function(Pointer<Void>) receiverFree;
+  final int Function(Pointer<_ZsBatchReceiver>, Pointer<Uint8>, int)
+  receiverUpdate;
+  final int Function(Pointer<_ZsBatchReceiver>) inFlight;
+  final int Function(Pointer<_ZsBatchReceiver>) state;
+  final int Function(
+    Pointer<_ZsBatchReceiver>,
+    Pointer<Uint32>,
+    Pointer<Int32>,
+    Pointer<Uint8>,
+    Pointer<Utf8>,
+    int,
+  )
+  next;
+
+  _BatchBindings(DynamicLibrary lib)
+    : writerNew = lib.lookupFunction<
+        Pointer<_ZsBatchWriter> Function(),
+        Pointer<_ZsBatchWriter> Function()
+      >('zs_batch_writer_new'),
+      writerFinalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_batch_writer_free'),
+      ),
+      writerFree = lib
+          .lookup<NativeFinalizerFunction>('zs_batch_writer_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      beginFile = lib.lookupFunction<
+        Void Function(Pointer<_ZsBatchWriter>, Uint32, Pointer<Utf8>, Uint64),
+        void Function(Pointer<_ZsBatchWriter>, int, Pointer<Utf8>, int)
+      >('zs_batch_writer_begin_file', isLeaf: true),
+      writerUpdate = lib.lookupFunction<
+        Void Function(Pointer<_ZsBatchWriter>, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsBatchWriter>, Pointer<Uint8>, int)
+      >('zs_batch_writer_update', isLeaf: true),
+      endFile = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsBatchWriter>),
+        int Function(Pointer<_ZsBatchWriter>)
+      >('zs_batch_writer_end_file', isLeaf: true),
+      skipFile = lib.lookupFunction<
+        Void Function(Pointer<_ZsBatchWriter>, Uint32),
+        void Function(Pointer<_ZsBatchWriter>, int)
+      >('zs_batch_writer_skip_file', isLeaf: true),
+      writerFinish = lib.lookupFunction<
+        Void Function(Pointer<_ZsBatchWriter>),
+        void Function(Pointer<_ZsBatchWriter>)
+      >('zs_batch_writer_finish', isLeaf: true),
+      writerPending = lib.lookupFunction<
+        Size Function(Pointer<_ZsBatchWriter>),
+        int Function(Pointer<_ZsBatchWriter>)
+      >('zs_batch_writer_pending', isLeaf: true),
+      writerRead = lib.lookupFunction<
+        Size Function(Pointer<_ZsBatchWriter>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsBatchWriter>, Pointer<Uint8>, int)
+      >('zs_batch_writer_read', isLeaf: true),
+      receiverNew = lib.lookupFunction<
+        Pointer<_ZsBatchReceiver> Function(Pointer<Utf8>, Uint32),
+        Pointer<_ZsBatchReceiver> Function(Pointer<Utf8>, int)
+      >('zs_batch_receiver_new'),
+      receiverFinalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_batch_receiver_free'),
+      ),
+      receiverFree = lib
+          .lookup<NativeFinalizerFunction>('zs_batch_receiver_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      receiverUpdate = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsBatchReceiver>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsBatchReceiver>, Pointer<Uint8>, int)
+      >('zs_batch_receiver_update', isLeaf: true),
+      inFlight = lib.lookupFunction<
+        Uint64 Function(Pointer<_ZsBatchReceiver>),
+        int Function(Pointer<_ZsBatchReceiver>)
+      >('zs_batch_receiver_in_flight', isLeaf: true),
+      state = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsBatchReceiver>),
+        int Function(Pointer<_ZsBatchReceiver>)
+      >('zs_batch_receiver_state', isLeaf: true),
+      next = lib.lookupFunction<
+        Int32 Function(
+          Pointer<_ZsBatchReceiver>,
+          Pointer<Uint32>,
+          Pointer<Int32>,
+          Pointer<Uint8>,
+          Pointer<Utf8>,
+          Size,
+        ),
+        int Function(
+          Pointer<_ZsBatchReceiver>,
+          Pointer<Uint32>,
+          Pointer<Int32>,
+          Pointer<Uint8>,
+          Pointer<Utf8>,
+          int,
+        )
+      >('zs_batch_receiver_next', isLeaf: true);
+
+  static _BatchBindings? _instance;
+  static bool _resolved = false;
+
+  static _BatchBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _BatchBindings(lib);
+    } catch (e) {
+      print('⚠️ Batch transfer unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Outcome of one file in a batch, mirroring `BatchFileStatus`.
+enum BatchFileStatus { written, corrupt, ioError, skipped }
+
+class BatchFileResult {
+  final int index;
+  final BatchFileStatus status;
+  final String path; // Empty unless written
+  final String digest; // Verified whole-file digest (hex), when written
+
+  const BatchFileResult(this.index, this.status, this.path, this.digest);
+}
+
+/// Framing for a batch of small files, backed by `native/src/batch.cc`. The
+/// caller writes each file's bytes to the socket itself, interleaved with
+/// the framing from [take].
+class NativeBatchWriter implements Finalizable {
+  final _BatchBindings _b;
+  final Pointer<_ZsBatchWriter> _handle;
+  Pointer<Uint8> _scratch = nullptr;
+  int _scratchLen = 0;
+  bool _disposed = false;
+
+  NativeBatchWriter._(this._b, this._handle) {
+    _b.writerFinalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  static bool get isAvailable => _BatchBindings.instance != null;
+
+  /// Null when the native engine isn't available.
+  static NativeBatchWriter? create() {
+    final b = _BatchBindings.instance;
+    if (b == null) return null;
+    return NativeBatchWriter._(b, b.writerNew());
+  }
+
+  void beginFile(int index, String name, int size) {
+    if (_disposed) return;
+    final nativeName = name.toNativeUtf8();
+    try {
+      _b.beginFile(_handle, index, nativeName, size);
+    } finally {
+      malloc.free(nativeName);
+    }
+  }
+
+  /// Hashes file bytes on their way to the socket.
+  void update(List<int> bytes) {
+    if (_disposed || bytes.isEmpty) return;
+    final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+    _b.writerUpdate(_handle, data.address, data.length);
+  }
+
+  /// False if the file came up short of the size given to [beginFile].
+  bool endFile() => !_disposed && _b.endFile(_handle) != 0;
+
+  void skipFile(int index) {
+    if (!_disposed) _b.skipFile(_handle, index);
+  }
+
+  void finish() {
+    if (!_disposed) _b.writerFinish(_handle);
+  }
+
+  /// Framing bytes produced since the last call.
+  Uint8List take() {
+    if (_disposed) return Uint8List(0);
+    final pending = _b.writerPending(_handle);
+    if (pending == 0) return Uint8List(0);
+    if (_scratchLen < pending) {
+      if (_scratch != nullptr) calloc.free(_scratch);
+      _scratchLen = pending;
+      _scratch = calloc<Uint8>(_scratchLen);
+    }
+    final n = _b.writerRead(_handle, _scratch, pending);
+    return Uint8List.fromList(_scratch.asTypedList(n));
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.writerFinalizer.detach(this);
+    _b.writerFree(_handle.cast());
+    if (_scratch != nullptr) calloc.free(_scratch);
+    _scratch = nullptr;
+  }
+}
+
+/// Parses a batch stream and writes its files into a directory from a
+/// native thread pool, so hashing and disk writes stay off the UI isolate.
+class NativeBatchReceiver implements Finalizable {
+  static const int _pathCap = 4096;
+
+  final _BatchBindings _b;
+  final Pointer<_ZsBatchReceiver> _handle;
+  final Pointer<Uint32> _index = calloc<Uint32>();
+  final Pointer<Int32> _status = calloc<Int32>();
+  final Pointer<Uint8> _digest = calloc<Uint8>(32);
+  final Pointer<Utf8> _path = calloc<Uint8>(_pathCap).cast();
+  bool _disposed = false;
+
+  NativeBatchReceiver._(this._b, this._handle) {
+    _b.receiverFinalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// [threads] 0 picks one per core, up to 4. Null when the native engine
+  /// isn't available.
+  static NativeBatchReceiver? create(String directory, {int threads = 0}) {
+    final b = _BatchBindings.instance;
+    if (b == null) return null;
+    final dir = directory.toNativeUtf8();
+    try {
+      return NativeBatchReceiver._(b, b.receiverNew(dir, threads));
+    } finally {
+      malloc.free(dir);
+    }
+  }
+
+  /// Feeds stream bytes. Throws [FormatException] once the stream turns out
+  /// to be malformed.
+  void update(List<int> bytes) {
+    if (_disposed || bytes.isEmpty) return;
+    final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+    if (_b.receiverUpdate(_handle, data.address, data.length) == 0) {
+      throw const FormatException('Malformed batch stream');
+    }
+  }
+
+  /// File bytes received but not yet written.
+  int get bytesInFlight => _disposed ? 0 : _b.inFlight(_handle);
+
+  bool get isBusy => !_disposed && _b.state(_handle) & 1 != 0;
+
+  /// True once the end record arrived and matched the files received.
+  bool get isComplete => !_disposed && _b.state(_handle) & 2 != 0;
+
+  /// Files finished since the last call.
+  List<BatchFileResult> takeResults() {
+    final results = <BatchFileResult>[];
+    if (_disposed) return results;
+    while (_b.next(_handle, _index, _status, _digest, _path, _pathCap) != 0) {
+      final status = BatchFileStatus.values[_status.value];
+      results.add(
+        BatchFileResult(
+          _index.value,
+          status,
+          _path.toDartString(),
+          status == BatchFileStatus.written ? _hex(_digest) : '',
+        ),
+      );
+    }
+    return results;
+  }
+
+  /// Stops the worker threads, waiting for the file being written.
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.receiverFinalizer.detach(this);
+    _b.receiverFree(_handle.cast());
+    calloc.free(_index);
+    calloc.free(_status);
+    calloc.free(_digest);
+    calloc.free(_path);
+  }
+
+  static String _hex(Pointer<Uint8> bytes) {
+    final sb = StringBuffer();
+    for (int i = 0; i < 32; i++) {
+      sb.write(bytes[i].toRadixString(16).padLeft(2, '0'));
+    }
+    return sb.toString();
+  }
+}
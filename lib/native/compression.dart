@@ -0,0 +1,274 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsCompressor extends Opaque {}
+
+final class _ZsDecompressor extends Opaque {}
+
+class _CompressionBindings {
+  final int Function() supported;
+  final Pointer<_ZsCompressor> Function(int) compressorNew;
+  final NativeFinalizer compressorFinalizer;
+  final void Function(Pointer<Void>) compressorFree;
+  final void Function(Pointer<_ZsCompressor>, double) setLinkRate;
+  final void Function(Pointer<_ZsCompressor>, Pointer<Uint8>, int)
+  compressorUpdate;
+  final void Function(Pointer<_ZsCompressor>) compressorFinish;
+  final int Function(Pointer<_ZsCompressor>) compressorPending;
+  final int Function(Pointer<_ZsCompressor>, Pointer<Uint8>, int)
+  compressorRead;
+  final void Function(Pointer<_ZsCompressor>, Pointer<Uint64>)
+  compressorStats;
+  final Pointer<_ZsDecompressor> Function() decompressorNew;
+  final NativeFinalizer decompressorFinalizer;
+  final void Function(Pointer<Void>) decompressorFree;
+  final int Function(Pointer<_ZsDecompressor>, Pointer<Uint8>, int)
+  decompressorUpdate;
+  final int Function(Pointer<_ZsDecompressor>) decompressorPending;
+  final int Function(Pointer<_ZsDecompressor>, Pointer<Uint8>, int)
+  decompressorRead;
+
+  _CompressionBindings(DynamicLibrary lib)
+    : supported = lib.lookupFunction<Uint32 Function(), int Function()>(
+        'zs_compress_supported',
+        isLeaf: true,
+      ),
+      compressorNew = lib.lookupFunction<
+        Pointer<_ZsCompressor> Function(Uint32),
+        Pointer<_ZsCompressor> Function(int)
+      >('zs_compressor_new'),
+      compressorFinalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_compressor_free'),
+      ),
+      compressorFree = lib
+          .lookup<NativeFinalizerFunction>('zs_compressor_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      setLinkRate = lib.lookupFunction<
+        Void Function(Pointer<_ZsCompressor>, Double),
+        void Function(Pointer<_ZsCompressor>, double)
+      >('zs_compressor_set_link_rate', isLeaf: true),
+      compressorUpdate = lib.lookupFunction<
+        Void Function(Pointer<_ZsCompressor>, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsCompressor>, Pointer<Uint8>, int)
+      >('zs_compressor_update', isLeaf: true),
+      compressorFinish = lib.lookupFunction<
+        Void Function(Pointer<_ZsCompressor>),
+        void Function(Pointer<_ZsCompressor>)
+      >('zs_compressor_finish', isLeaf: true),
+      compressorPending = lib.lookupFunction<
+        Size Function(Pointer<_ZsCompressor>),
+        int Function(Pointer<_ZsCompressor>)
+      >('zs_compressor_pending', isLeaf: true),
+      compressorRead = lib.lookupFunction<
+        Size Function(Pointer<_ZsCompressor>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsCompressor>, Pointer<Uint8>, int)
+      >('zs_compressor_read', isLeaf: true),
+      compressorStats = lib.lookupFunction<
+        Void Function(Pointer<_ZsCompressor>, Pointer<Uint64>),
+        void Function(Pointer<_ZsCompressor>, Pointer<Uint64>)
+      >('zs_compressor_stats', isLeaf: true),
+      decompressorNew = lib.lookupFunction<
+        Pointer<_ZsDecompressor> Function(),
+        Pointer<_ZsDecompressor> Function()
+      >('zs_decompressor_new'),
+      decompressorFinalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_decompressor_free'),
+      ),
+      decompressorFree = lib
+          .lookup<NativeFinalizerFunction>('zs_decompressor_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      decompressorUpdate = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsDecompressor>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsDecompressor>, Pointer<Uint8>, int)
+      >('zs_decompressor_update', isLeaf: true),
+      decompressorPending = lib.lookupFunction<
+        Size Function(Pointer<_ZsDecompressor>),
+        int Function(Pointer<_ZsDecompressor>)
+      >('zs_decompressor_pending', isLeaf: true),
+      decompressorRead = lib.lookupFunction<
+        Size Function(Pointer<_ZsDecompressor>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsDecompressor>, Pointer<Uint8>, int)
+      >('zs_decompressor_read', isLeaf: true);
+
+  static _CompressionBindings? _instance;
+  static bool _resolved = false;
+
+  static _CompressionBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _CompressionBindings(lib);
+    } catch (e) {
+      print('⚠️ Compression unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Frames sent per codec, and the bytes before and after compression.
+class CompressionStats {
+  final int rawBytes;
+  final int wireBytes;
+  final List<int> frames; // store, lz4, deflate1, deflate6
+
+  const CompressionStats({
+    required this.rawBytes,
+    required this.wireBytes,
+    required this.frames,
+  });
+
+  double get ratio => rawBytes == 0 ? 1 : wireBytes / rawBytes;
+
+  @override
+  String toString() =>
+      'raw=$rawBytes wire=$wireBytes (${(ratio * 100).toStringAsFixed(1)}%) '
+      'store=${frames[0]} lz4=${frames[1]} '
+      'deflate=${frames[2] + frames[3]}';
+}
+
+/// Adaptive per-chunk compression, backed by `native/src/compress.cc`.
+class NativeCompression {
+  static const int store = 1 << 0;
+  static const int lz4 = 1 << 1;
+  static const int deflate1 = 1 << 2;
+  static const int deflate6 = 1 << 3;
+
+  /// Codecs this build can encode and decode; 0 without the native engine.
+  static int get supportedCodecs =>
+      _CompressionBindings.instance?.supported() ?? 0;
+}
+
+/// Turns raw file bytes into compressed frames, picking a codec per 128KB
+/// chunk from its sampled entropy and the link rate.
+class NativeCompressor implements Finalizable {
+  final _CompressionBindings _b;
+  final Pointer<_ZsCompressor> _handle;
+  Pointer<Uint8> _scratch = nullptr;
+  int _scratchLen = 0;
+  bool _disposed = false;
+
+  NativeCompressor._(this._b, this._handle) {
+    _b.compressorFinalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// [codecs] is the mask negotiated with the peer. Returns null when the
+  /// native engine isn't available.
+  static NativeCompressor? create(int codecs) {
+    final b = _CompressionBindings.instance;
+    if (b == null) return null;
+    return NativeCompressor._(b, b.compressorNew(codecs));
+  }
+
+  /// Measured throughput of the connection in bytes per second.
+  set linkRate(double bytesPerSecond) {
+    if (!_disposed) _b.setLinkRate(_handle, bytesPerSecond);
+  }
+
+  /// Feeds raw bytes and returns the frames that are ready, possibly empty.
+  Uint8List update(List<int> bytes) {
+    if (_disposed) return Uint8List(0);
+    if (bytes.isNotEmpty) {
+      final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+      _b.compressorUpdate(_handle, data.address, data.length);
+    }
+    return _drain();
+  }
+
+  /// Flushes the trailing partial chunk.
+  Uint8List finish() {
+    if (_disposed) return Uint8List(0);
+    _b.compressorFinish(_handle);
+    return _drain();
+  }
+
+  CompressionStats get stats {
+    final out = calloc<Uint64>(6);
+    try {
+      if (!_disposed) _b.compressorStats(_handle, out);
+      return CompressionStats(
+        rawBytes: out[0],
+        wireBytes: out[1],
+        frames: [out[2], out[3], out[4], out[5]],
+      );
+    } finally {
+      calloc.free(out);
+    }
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.compressorFinalizer.detach(this);
+    _b.compressorFree(_handle.cast());
+    if (_scratch != nullptr) calloc.free(_scratch);
+    _scratch = nullptr;
+  }
+
+  Uint8List _drain() {
+    final pending = _b.compressorPending(_handle);
+    if (pending == 0) return Uint8List(0);
+    if (_scratchLen < pending) {
+      if (_scratch != nullptr) calloc.free(_scratch);
+      _scratchLen = pending;
+      _scratch = calloc<Uint8>(_scratchLen);
+    }
+    final n = _b.compressorRead(_handle, _scratch, pending);
+    return Uint8List.fromList(_scratch.asTypedList(n));
+  }
+}
+
+/// Turns frames from a [NativeCompressor] back into raw bytes.
+class NativeDecompressor implements Finalizable {
+  final _CompressionBindings _b;
+  final Pointer<_ZsDecompressor> _handle;
+  Pointer<Uint8> _scratch = nullptr;
+  int _scratchLen = 0;
+  bool _disposed = false;
+
+  NativeDecompressor._(this._b, this._handle) {
+    _b.decompressorFinalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// Returns null when the native engine isn't available.
+  static NativeDecompressor? create() {
+    final b = _CompressionBindings.instance;
+    if (b == null) return null;
+    return NativeDecompressor._(b, b.decompressorNew());
+  }
+
+  /// Feeds frame bytes and returns the raw bytes decoded so far. Throws
+  /// [FormatException] once the stream turns out to be malformed.
+  Uint8List update(List<int> bytes) {
+    if (_disposed) return Uint8List(0);
+    if (bytes.isNotEmpty) {
+      final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+      if (_b.decompressorUpdate(_handle, data.address, data.length) == 0) {
+        throw const FormatException('Corrupt compressed frame');
+      }
+    }
+    final pending = _b.decompressorPending(_handle);
+    if (pending == 0) return Uint8List(0);
+    if (_scratchLen < pending) {
+      if (_scratch != nullptr) calloc.free(_scratch);
+      _scratchLen = pending;
+      _scratch = calloc<Uint8>(_scratchLen);
+    }
+    final n = _b.decompressorRead(_handle, _scratch, pending);
+    return Uint8List.fromList(_scratch.asTypedList(n));
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.decompressorFinalizer.detach(this);
+    _b.decompressorFree(_handle.cast());
+    if (_scratch != nullptr) calloc.free(_scratch);
+    _scratch = nullptr;
+  }
+}
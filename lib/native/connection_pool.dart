@@ -0,0 +1,220 @@
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:io';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsConnectionPool extends Opaque {}
+
+class _ConnectionPoolBindings {
+  final Pointer<_ZsConnectionPool> Function(int, int) start;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) free;
+  final void Function(Pointer<_ZsConnectionPool>, Pointer<Utf8>, int, int)
+  warm;
+  final void Function(Pointer<_ZsConnectionPool>, Pointer<Utf8>, int) forget;
+  final int Function(
+    Pointer<_ZsConnectionPool>,
+    Pointer<Utf8>,
+    int,
+    Pointer<Uint8>,
+    int,
+  )
+  listing;
+  final void Function(Pointer<_ZsConnectionPool>, Pointer<Uint64>) stats;
+
+  _ConnectionPoolBindings(DynamicLibrary lib)
+    : start = lib.lookupFunction<
+        Pointer<_ZsConnectionPool> Function(Uint32, Uint32),
+        Pointer<_ZsConnectionPool> Function(int, int)
+      >('zs_connection_pool_start'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_connection_pool_free'),
+      ),
+      free = lib
+          .lookup<NativeFinalizerFunction>('zs_connection_pool_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      warm = lib.lookupFunction<
+        Void Function(Pointer<_ZsConnectionPool>, Pointer<Utf8>, Uint16, Int32),
+        void Function(Pointer<_ZsConnectionPool>, Pointer<Utf8>, int, int)
+      >('zs_connection_pool_warm', isLeaf: true),
+      forget = lib.lookupFunction<
+        Void Function(Pointer<_ZsConnectionPool>, Pointer<Utf8>, Uint16),
+        void Function(Pointer<_ZsConnectionPool>, Pointer<Utf8>, int)
+      >('zs_connection_pool_forget', isLeaf: true),
+      listing = lib.lookupFunction<
+        Int64 Function(
+          Pointer<_ZsConnectionPool>,
+          Pointer<Utf8>,
+          Uint16,
+          Pointer<Uint8>,
+          Size,
+        ),
+        int Function(
+          Pointer<_ZsConnectionPool>,
+          Pointer<Utf8>,
+          int,
+          Pointer<Uint8>,
+          int,
+        )
+      >('zs_connection_pool_listing', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(Pointer<_ZsConnectionPool>, Pointer<Uint64>),
+        void Function(Pointer<_ZsConnectionPool>, Pointer<Uint64>)
+      >('zs_connection_pool_stats', isLeaf: true);
+
+  static _ConnectionPoolBindings? _instance;
+  static bool _resolved = false;
+
+  static _ConnectionPoolBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _ConnectionPoolBindings(lib);
+    } catch (e) {
+      print('⚠️ Connection pool unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Counters of a [NativeConnectionPool].
+class ConnectionPoolStats {
+  final int connects;
+  final int failures; // Connects and list fetches
+  final int taken; // Handed out warm
+  final int missed; // Asked for with none warm
+  final int stale; // Found closed by the sender
+  final int listings; // File lists fetched ahead
+  final int ready; // Warm right now
+
+  const ConnectionPoolStats(
+    this.connects,
+    this.failures,
+    this.taken,
+    this.missed,
+    this.stale,
+    this.listings,
+    this.ready,
+  );
+}
+
+/// Connections kept open to the peers a transfer is likely to come from,
+/// backed by `native/src/connection_pool.cc`. A [NativeRangeReceiver]
+/// given the pool starts with its request instead of a handshake, and
+/// [listing] has the file list of a share before it's accepted.
+class NativeConnectionPool implements Finalizable {
+  /// Connections kept per peer; ParallelTransferService opens more streams
+  /// than this, and the rest connect as before.
+  static const int defaultPerPeer = 2;
+  static const Duration defaultIdle = Duration(seconds: 30);
+
+  final _ConnectionPoolBindings _b;
+  final Pointer<_ZsConnectionPool> _handle;
+  bool _disposed = false;
+
+  NativeConnectionPool._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  static NativeConnectionPool? _shared;
+  static bool _sharedStarted = false;
+
+  /// The app-wide pool, which discovery warms and downloads take from;
+  /// null where the native engine isn't available, including Windows.
+  static NativeConnectionPool? get shared {
+    if (!_sharedStarted) {
+      _sharedStarted = true;
+      _shared = start();
+    }
+    return _shared;
+  }
+
+  static NativeConnectionPool? start({
+    int perPeer = defaultPerPeer,
+    Duration idle = defaultIdle,
+  }) {
+    if (Platform.isWindows) return null;
+    final b = _ConnectionPoolBindings.instance;
+    if (b == null) return null;
+    final handle = b.start(perPeer, idle.inMilliseconds);
+    return handle == nullptr ? null : NativeConnectionPool._(b, handle);
+  }
+
+  /// Keeps connections to [host]:[port], the peer's HTTP port, open for
+  /// another idle period; with [list] also fetches its file list over the
+  /// port after it, replacing any fetched before.
+  void warm(String host, int port, {bool list = false}) {
+    if (_disposed) return;
+    final h = host.toNativeUtf8();
+    try {
+      _b.warm(_handle, h, port, list ? 1 : 0);
+    } finally {
+      malloc.free(h);
+    }
+  }
+
+  void forget(String host, int port) {
+    if (_disposed) return;
+    final h = host.toNativeUtf8();
+    try {
+      _b.forget(_handle, h, port);
+    } finally {
+      malloc.free(h);
+    }
+  }
+
+  /// The peer's answer to LIST once it has arrived, else null.
+  String? listing(String host, int port) {
+    if (_disposed) return null;
+    final h = host.toNativeUtf8();
+    Pointer<Uint8> out = nullptr;
+    try {
+      final size = _b.listing(_handle, h, port, nullptr, 0);
+      if (size < 0) return null;
+      out = malloc<Uint8>(size == 0 ? 1 : size);
+      // It may have been fetched again in between; then it's the size
+      // that's returned and nothing is copied.
+      final got = _b.listing(_handle, h, port, out, size);
+      if (got != size) return null;
+      return utf8.decode(out.asTypedList(size), allowMalformed: true);
+    } finally {
+      malloc.free(h);
+      if (out != nullptr) malloc.free(out);
+    }
+  }
+
+  ConnectionPoolStats get stats {
+    if (_disposed) return const ConnectionPoolStats(0, 0, 0, 0, 0, 0, 0);
+    final values = calloc<Uint64>(7);
+    try {
+      _b.stats(_handle, values);
+      return ConnectionPoolStats(
+        values[0],
+        values[1],
+        values[2],
+        values[3],
+        values[4],
+        values[5],
+        values[6],
+      );
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  /// The handle for [NativeRangeReceiver.start].
+  Pointer<Void> get handle => _disposed ? nullptr : _handle.cast();
+
+  /// Closes every connection.
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.free(_handle.cast());
+  }
+}
@@ -0,0 +1,241 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+/// Per-chunk and whole-file BLAKE3 digests of a shared file.
+///
+/// Senders advertise these in LIST / `/list` metadata once a file is hashed
+/// and serve them from `/digest/<index>` on request (see `DigestService`);
+/// receivers compare them with what they hashed on the way in and
+/// re-request only the chunks that differ.
+class ChunkDigests {
+  static const int defaultChunkSize = 4 * 1024 * 1024; // 4MB
+
+  final int fileSize;
+  final int chunkSize;
+  final String fileDigest;
+  final List<String> chunkDigests;
+
+  const ChunkDigests({
+    required this.fileSize,
+    required this.chunkSize,
+    required this.fileDigest,
+    required this.chunkDigests,
+  });
+
+  /// Fields merged into a file entry of the LIST / `/list` JSON.
+  Map<String, dynamic> toJson() => {
+    'digest': fileDigest,
+    'chunkSize': chunkSize,
+    'chunkDigests': chunkDigests,
+  };
+
+  /// Reads the digest fields of a file entry; null for peers that don't
+  /// send them.
+  static ChunkDigests? fromJson(Map<String, dynamic> json, int fileSize) {
+    final digest = json['digest'];
+    final chunks = json['chunkDigests'];
+    if (digest is! String || chunks is! List) return null;
+    return ChunkDigests(
+      fileSize: fileSize,
+      chunkSize: (json['chunkSize'] as int?) ?? defaultChunkSize,
+      fileDigest: digest,
+      chunkDigests: chunks.cast<String>(),
+    );
+  }
+}
+
+final class _ZsChunkHasher extends Opaque {}
+
+class _ContentHashBindings {
+  final Pointer<_ZsChunkHasher> Function(int, int) create;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) free;
+  final void Function(Pointer<_ZsChunkHasher>, int, Pointer<Uint8>, int)
+  update;
+  final void Function(Pointer<_ZsChunkHasher>, int, int) updateZeros;
+  final void Function(Pointer<_ZsChunkHasher>, int) resetChunk;
+  final int Function(Pointer<_ZsChunkHasher>) chunkCount;
+  final int Function(Pointer<_ZsChunkHasher>) completed;
+  final int Function(Pointer<_ZsChunkHasher>, int, Pointer<Uint8>) chunkDigest;
+  final int Function(Pointer<_ZsChunkHasher>, Pointer<Uint8>) fileDigest;
+
+  _ContentHashBindings(DynamicLibrary lib)
+    : create = lib.lookupFunction<
+        Pointer<_ZsChunkHasher> Function(Uint64, Uint32),
+        Pointer<_ZsChunkHasher> Function(int, int)
+      >('zs_chunk_hasher_new'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_chunk_hasher_free'),
+      ),
+      free = lib
+          .lookup<NativeFinalizerFunction>('zs_chunk_hasher_free')
+          .asFunction<void Function(Pointer<Void>)>(isLeaf: true),
+      update = lib.lookupFunction<
+        Void Function(Pointer<_ZsChunkHasher>, Uint64, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsChunkHasher>, int, Pointer<Uint8>, int)
+      >('zs_chunk_hasher_update', isLeaf: true),
+      updateZeros = lib.lookupFunction<
+        Void Function(Pointer<_ZsChunkHasher>, Uint64, Uint64),
+        void Function(Pointer<_ZsChunkHasher>, int, int)
+      >('zs_chunk_hasher_update_zeros', isLeaf: true),
+      resetChunk = lib.lookupFunction<
+        Void Function(Pointer<_ZsChunkHasher>, Uint32),
+        void Function(Pointer<_ZsChunkHasher>, int)
+      >('zs_chunk_hasher_reset_chunk', isLeaf: true),
+      chunkCount = lib.lookupFunction<
+        Uint32 Function(Pointer<_ZsChunkHasher>),
+        int Function(Pointer<_ZsChunkHasher>)
+      >('zs_chunk_hasher_chunk_count', isLeaf: true),
+      completed = lib.lookupFunction<
+        Uint32 Function(Pointer<_ZsChunkHasher>),
+        int Function(Pointer<_ZsChunkHasher>)
+      >('zs_chunk_hasher_completed', isLeaf: true),
+      chunkDigest = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsChunkHasher>, Uint32, Pointer<Uint8>),
+        int Function(Pointer<_ZsChunkHasher>, int, Pointer<Uint8>)
+      >('zs_chunk_hasher_chunk_digest', isLeaf: true),
+      fileDigest = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsChunkHasher>, Pointer<Uint8>),
+        int Function(Pointer<_ZsChunkHasher>, Pointer<Uint8>)
+      >('zs_chunk_hasher_file_digest', isLeaf: true);
+
+  static _ContentHashBindings? _instance;
+  static bool _resolved = false;
+
+  static _ContentHashBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _ContentHashBindings(lib);
+    } catch (e) {
+      print('⚠️ Content hashing unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Inline BLAKE3 hashing of a file as its bytes stream through a send or
+/// receive path, backed by `native/src/content_hash.cc`.
+///
+/// Feed every buffer with its absolute file offset. Chunks are hashed as long
+/// as their bytes arrive in order from the chunk boundary, so parallel range
+/// streams work as long as ranges start on [chunkSize] boundaries.
+class NativeChunkHasher implements Finalizable {
+  final _ContentHashBindings _b;
+  final Pointer<_ZsChunkHasher> _handle;
+  final int fileSize;
+  final int chunkSize;
+  bool _disposed = false;
+
+  NativeChunkHasher._(this._b, this._handle, this.fileSize, this.chunkSize) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// Returns null when the native engine isn't available on this platform.
+  static NativeChunkHasher? create(
+    int fileSize, {
+    int chunkSize = ChunkDigests.defaultChunkSize,
+  }) {
+    final b = _ContentHashBindings.instance;
+    if (b == null || fileSize < 0) return null;
+    final handle = b.create(fileSize, chunkSize);
+    if (handle == nullptr) return null;
+    return NativeChunkHasher._(b, handle, fileSize, chunkSize);
+  }
+
+  void update(int offset, List<int> bytes) {
+    if (_disposed || bytes.isEmpty) return;
+    final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+    _b.update(_handle, offset, data.address, data.length);
+  }
+
+  /// Feeds [length] zero bytes at [offset], as a sparse file's holes read;
+  /// whole chunks cost next to nothing.
+  void updateZeros(int offset, int length) {
+    if (!_disposed && length > 0) _b.updateZeros(_handle, offset, length);
+  }
+
+  /// The native hasher, for engines that feed it themselves; valid until
+  /// [dispose].
+  Pointer<Void> get handle => _handle.cast();
+
+  void resetChunk(int index) {
+    if (!_disposed) _b.resetChunk(_handle, index);
+  }
+
+  int get chunkCount => _disposed ? 0 : _b.chunkCount(_handle);
+  int get completedChunks => _disposed ? 0 : _b.completed(_handle);
+  bool get isComplete => completedChunks == chunkCount;
+
+  String? chunkDigest(int index) {
+    if (_disposed) return null;
+    final out = calloc<Uint8>(32);
+    try {
+      if (_b.chunkDigest(_handle, index, out) == 0) return null;
+      return _hex(out);
+    } finally {
+      calloc.free(out);
+    }
+  }
+
+  String? fileDigest() {
+    if (_disposed) return null;
+    final out = calloc<Uint8>(32);
+    try {
+      if (_b.fileDigest(_handle, out) == 0) return null;
+      return _hex(out);
+    } finally {
+      calloc.free(out);
+    }
+  }
+
+  /// Digests for advertising, once every chunk has been hashed.
+  ChunkDigests? digests() {
+    final file = fileDigest();
+    if (file == null) return null;
+    return ChunkDigests(
+      fileSize: fileSize,
+      chunkSize: chunkSize,
+      fileDigest: file,
+      chunkDigests: List.generate(chunkCount, (i) => chunkDigest(i)!),
+    );
+  }
+
+  /// Indices of chunks that are missing or don't match [expected].
+  List<int> mismatchedChunks(ChunkDigests expected) {
+    if (expected.chunkSize != chunkSize || expected.fileSize != fileSize) {
+      return List.generate(chunkCount, (i) => i);
+    }
+    final bad = <int>[];
+    for (int i = 0; i < chunkCount; i++) {
+      final got = chunkDigest(i);
+      if (got == null ||
+          i >= expected.chunkDigests.length ||
+          got != expected.chunkDigests[i]) {
+        bad.add(i);
+      }
+    }
+    return bad;
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.free(_handle.cast());
+  }
+
+  static String _hex(Pointer<Uint8> bytes) {
+    final sb = StringBuffer();
+    for (int i = 0; i < 32; i++) {
+      sb.write(bytes[i].toRadixString(16).padLeft(2, '0'));
+    }
+    return sb.toString();
+  }
+}
@@ -0,0 +1,234 @@
+import 'dart:ffi';
+import 'dart:io';
+
+import 'package:ffi/ffi.dart';
+import 'package:path_provider/path_provider.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsContentStore extends Opaque {}
+
+class _ContentStoreBindings {
+  final Pointer<_ZsContentStore> Function(Pointer<Utf8>) open;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) close;
+  final int Function(Pointer<_ZsContentStore>, Pointer<Utf8>, Pointer<Uint8>)
+  add;
+  final int Function(
+    Pointer<_ZsContentStore>,
+    int,
+    Pointer<Uint8>,
+    Pointer<Utf8>,
+    int,
+  )
+  find;
+  final void Function(Pointer<_ZsContentStore>, int, Pointer<Uint8>) remove;
+  final int Function(Pointer<_ZsContentStore>) count;
+  final int Function(Pointer<Utf8>, Pointer<Utf8>) cloneOrLink;
+
+  _ContentStoreBindings(DynamicLibrary lib)
+    : open = lib.lookupFunction<
+        Pointer<_ZsContentStore> Function(Pointer<Utf8>),
+        Pointer<_ZsContentStore> Function(Pointer<Utf8>)
+      >('zs_store_open'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_store_close'),
+      ),
+      close = lib
+          .lookup<NativeFinalizerFunction>('zs_store_close')
+          .asFunction<void Function(Pointer<Void>)>(),
+      add = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsContentStore>, Pointer<Utf8>, Pointer<Uint8>),
+        int Function(Pointer<_ZsContentStore>, Pointer<Utf8>, Pointer<Uint8>)
+      >('zs_store_add'),
+      find = lib.lookupFunction<
+        Int32 Function(
+          Pointer<_ZsContentStore>,
+          Uint64,
+          Pointer<Uint8>,
+          Pointer<Utf8>,
+          Size,
+        ),
+        int Function(
+          Pointer<_ZsContentStore>,
+          int,
+          Pointer<Uint8>,
+          Pointer<Utf8>,
+          int,
+        )
+      >('zs_store_find'),
+      remove = lib.lookupFunction<
+        Void Function(Pointer<_ZsContentStore>, Uint64, Pointer<Uint8>),
+        void Function(Pointer<_ZsContentStore>, int, Pointer<Uint8>)
+      >('zs_store_remove', isLeaf: true),
+      count = lib.lookupFunction<
+        Uint32 Function(Pointer<_ZsContentStore>),
+        int Function(Pointer<_ZsContentStore>)
+      >('zs_store_count', isLeaf: true),
+      cloneOrLink = lib.lookupFunction<
+        Int32 Function(Pointer<Utf8>, Pointer<Utf8>),
+        int Function(Pointer<Utf8>, Pointer<Utf8>)
+      >('zs_clone_or_link');
+
+  static _ContentStoreBindings? _instance;
+  static bool _resolved = false;
+
+  static _ContentStoreBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _ContentStoreBindings(lib);
+    } catch (e) {
+      print('⚠️ Content store unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// How [NativeContentStore.place] produced a file.
+enum PlaceKind {
+  /// Copy-on-write clone; the two files are independent.
+  cloned,
+
+  /// Hard link to the existing copy.
+  hardLinked,
+
+  /// Plain local copy, where the filesystem can't link.
+  copied,
+}
+
+/// Index of files already received on this device, keyed by size plus the
+/// BLAKE3 file digest senders advertise, backed by
+/// `native/src/content_store.cc`.
+///
+/// Receivers [add] every verified download and, before starting a batch,
+/// [find] each offered file; a hit is [place]d from disk instead of being
+/// transferred again.
+class NativeContentStore implements Finalizable {
+  static const String fileName = 'received_index.zsc';
+
+  final _ContentStoreBindings _b;
+  final Pointer<_ZsContentStore> _handle;
+  bool _closed = false;
+
+  NativeContentStore._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  static Future<NativeContentStore?>? _shared;
+
+  /// The app-wide index in the application support directory; null when the
+  /// native engine isn't available.
+  static Future<NativeContentStore?> shared() {
+    return _shared ??= () async {
+      try {
+        final dir = await getApplicationSupportDirectory();
+        await dir.create(recursive: true);
+        return open('${dir.path}${Platform.pathSeparator}$fileName');
+      } catch (e) {
+        print('⚠️ Could not open received-file index: $e');
+        return null;
+      }
+    }();
+  }
+
+  static NativeContentStore? open(String path) {
+    final b = _ContentStoreBindings.instance;
+    if (b == null) return null;
+    final p = path.toNativeUtf8();
+    try {
+      final handle = b.open(p);
+      if (handle == nullptr) return null;
+      return NativeContentStore._(b, handle);
+    } finally {
+      calloc.free(p);
+    }
+  }
+
+  int get count => _closed ? 0 : _b.count(_handle);
+
+  /// Records the file at [path] as holding [digest] (hex).
+  bool add(String path, String digest) {
+    if (_closed) return false;
+    final p = path.toNativeUtf8();
+    final d = _digestBytes(digest);
+    try {
+      return _b.add(_handle, p, d) != 0;
+    } finally {
+      calloc.free(p);
+      calloc.free(d);
+    }
+  }
+
+  /// Path of an unchanged local file with this size and [digest] (hex).
+  String? find(int size, String digest) {
+    if (_closed) return null;
+    final d = _digestBytes(digest);
+    int cap = 1024;
+    try {
+      while (true) {
+        final out = calloc<Uint8>(cap);
+        try {
+          final n = _b.find(_handle, size, d, out.cast(), cap);
+          if (n == 0) return null;
+          if (n > 0) return out.cast<Utf8>().toDartString(length: n);
+          cap = -n;
+        } finally {
+          calloc.free(out);
+        }
+      }
+    } finally {
+      calloc.free(d);
+    }
+  }
+
+  void remove(int size, String digest) {
+    if (_closed) return;
+    final d = _digestBytes(digest);
+    try {
+      _b.remove(_handle, size, d);
+    } finally {
+      calloc.free(d);
+    }
+  }
+
+  void close() {
+    if (_closed) return;
+    _closed = true;
+    _b.finalizer.detach(this);
+    _b.close(_handle.cast());
+  }
+
+  /// Creates [to], which must not exist, with the content of [from]:
+  /// reflink, else hard link, else a local copy.
+  static Future<PlaceKind> place(String from, String to) async {
+    final b = _ContentStoreBindings.instance;
+    if (b != null) {
+      final f = from.toNativeUtf8();
+      final t = to.toNativeUtf8();
+      try {
+        switch (b.cloneOrLink(f, t)) {
+          case 1:
+            return PlaceKind.cloned;
+          case 2:
+            return PlaceKind.hardLinked;
+        }
+      } finally {
+        calloc.free(f);
+        calloc.free(t);
+      }
+    }
+    await File(from).copy(to);
+    return PlaceKind.copied;
+  }
+
+  static Pointer<Uint8> _digestBytes(String hex) {
+    final out = calloc<Uint8>(32);
+    for (int i = 0; i < 32 && i * 2 + 2 <= hex.length; i++) {
+      out[i] = int.parse(hex.substring(i * 2, i * 2 + 2), radix: 16);
+    }
+    return out;
+  }
+}
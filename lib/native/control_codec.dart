@@ -0,0 +1,291 @@
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsControlMessage extends Opaque {}
+
+class _ControlBindings {
+  final Pointer<Utf8> Function(int) typeName;
+  final int Function(int) fieldCount;
+  final Pointer<Utf8> Function(int, int) fieldKey;
+  final int Function(int, int) fieldKind;
+  final Pointer<_ZsControlMessage> Function() create;
+  final NativeFinalizer finalizer;
+  final int Function(Pointer<_ZsControlMessage>, int) reset;
+  final int Function(Pointer<_ZsControlMessage>, Pointer<Uint8>, int) decode;
+  final int Function(Pointer<_ZsControlMessage>) version;
+  final void Function(Pointer<_ZsControlMessage>, int, int) setInt;
+  final void Function(Pointer<_ZsControlMessage>, int, double) setDouble;
+  final void Function(Pointer<_ZsControlMessage>, int, Pointer<Uint8>, int)
+  setString;
+  final void Function(Pointer<_ZsControlMessage>, int, Pointer<Uint8>, int)
+  addString;
+  final int Function(Pointer<_ZsControlMessage>, int) present;
+  final int Function(Pointer<_ZsControlMessage>, int) getInt;
+  final double Function(Pointer<_ZsControlMessage>, int) getDouble;
+  final Pointer<Uint8> Function(
+    Pointer<_ZsControlMessage>,
+    int,
+    int,
+    Pointer<Size>,
+  )
+  getString;
+  final int Function(Pointer<_ZsControlMessage>, int) listSize;
+  final int Function(Pointer<_ZsControlMessage>, int) encode;
+  final Pointer<Uint8> Function(Pointer<_ZsControlMessage>) encoded;
+
+  _ControlBindings(DynamicLibrary lib)
+    : typeName = lib.lookupFunction<
+        Pointer<Utf8> Function(Int32),
+        Pointer<Utf8> Function(int)
+      >('zs_control_type_name', isLeaf: true),
+      fieldCount = lib.lookupFunction<Int32 Function(Int32), int Function(int)>(
+        'zs_control_field_count',
+        isLeaf: true,
+      ),
+      fieldKey = lib.lookupFunction<
+        Pointer<Utf8> Function(Int32, Int32),
+        Pointer<Utf8> Function(int, int)
+      >('zs_control_field_key', isLeaf: true),
+      fieldKind = lib.lookupFunction<
+        Int32 Function(Int32, Int32),
+        int Function(int, int)
+      >('zs_control_field_kind', isLeaf: true),
+      create = lib.lookupFunction<
+        Pointer<_ZsControlMessage> Function(),
+        Pointer<_ZsControlMessage> Function()
+      >('zs_control_new'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_control_free'),
+      ),
+      reset = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsControlMessage>, Int32),
+        int Function(Pointer<_ZsControlMessage>, int)
+      >('zs_control_reset', isLeaf: true),
+      decode = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsControlMessage>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsControlMessage>, Pointer<Uint8>, int)
+      >('zs_control_decode', isLeaf: true),
+      version = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsControlMessage>),
+        int Function(Pointer<_ZsControlMessage>)
+      >('zs_control_version', isLeaf: true),
+      setInt = lib.lookupFunction<
+        Void Function(Pointer<_ZsControlMessage>, Int32, Int64),
+        void Function(Pointer<_ZsControlMessage>, int, int)
+      >('zs_control_set_int', isLeaf: true),
+      setDouble = lib.lookupFunction<
+        Void Function(Pointer<_ZsControlMessage>, Int32, Double),
+        void Function(Pointer<_ZsControlMessage>, int, double)
+      >('zs_control_set_double', isLeaf: true),
+      setString = lib.lookupFunction<
+        Void Function(Pointer<_ZsControlMessage>, Int32, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsControlMessage>, int, Pointer<Uint8>, int)
+      >('zs_control_set_string', isLeaf: true),
+      addString = lib.lookupFunction<
+        Void Function(Pointer<_ZsControlMessage>, Int32, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsControlMessage>, int, Pointer<Uint8>, int)
+      >('zs_control_add_string', isLeaf: true),
+      present = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsControlMessage>, Int32),
+        int Function(Pointer<_ZsControlMessage>, int)
+      >('zs_control_present', isLeaf: true),
+      getInt = lib.lookupFunction<
+        Int64 Function(Pointer<_ZsControlMessage>, Int32),
+        int Function(Pointer<_ZsControlMessage>, int)
+      >('zs_control_get_int', isLeaf: true),
+      getDouble = lib.lookupFunction<
+        Double Function(Pointer<_ZsControlMessage>, Int32),
+        double Function(Pointer<_ZsControlMessage>, int)
+      >('zs_control_get_double', isLeaf: true),
+      getString = lib.lookupFunction<
+        Pointer<Uint8> Function(
+          Pointer<_ZsControlMessage>,
+          Int32,
+          Int32,
+          Pointer<Size>,
+        ),
+        Pointer<Uint8> Function(
+          Pointer<_ZsControlMessage>,
+          int,
+          int,
+          Pointer<Size>,
+        )
+      >('zs_control_get_string', isLeaf: true),
+      listSize = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsControlMessage>, Int32),
+        int Function(Pointer<_ZsControlMessage>, int)
+      >('zs_control_list_size', isLeaf: true),
+      encode = lib.lookupFunction<
+        Size Function(Pointer<_ZsControlMessage>, Int32),
+        int Function(Pointer<_ZsControlMessage>, int)
+      >('zs_control_encode', isLeaf: true),
+      encoded = lib.lookupFunction<
+        Pointer<Uint8> Function(Pointer<_ZsControlMessage>),
+        Pointer<Uint8> Function(Pointer<_ZsControlMessage>)
+      >('zs_control_encoded', isLeaf: true);
+
+  static _ControlBindings? _instance;
+  static bool _resolved = false;
+
+  static _ControlBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _ControlBindings(lib);
+    } catch (e) {
+      print('⚠️ Control codec unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Mirrors `ControlKind`.
+enum _Kind { string, int, double, bool, strings }
+
+class _Schema {
+  final int type;
+  final String name;
+  final List<String> keys;
+  final List<_Kind> kinds;
+  final Map<String, int> index;
+
+  _Schema(this.type, this.name, this.keys, this.kinds)
+    : index = {for (var i = 0; i < keys.length; i++) keys[i]: i};
+}
+
+/// The control messages of [DeviceDiscoveryService] (share requests,
+/// casting, screen mirroring) in the binary form of
+/// `native/src/control_codec.cc`, or in JSON for peers that don't read it.
+/// Messages are the same maps `jsonEncode` took and `jsonDecode` gave, so
+/// the handlers don't change.
+class NativeControlCodec implements Finalizable {
+  /// The key decoded messages carry when the sender's codec could have
+  /// sent binary; its value is the sender's codec version.
+  static const String versionKey = 'zsc';
+
+  final _ControlBindings _b;
+  final Pointer<_ZsControlMessage> _handle;
+  final Map<String, _Schema> _byName;
+  final Map<int, _Schema> _byType;
+  final Pointer<Size> _len = calloc<Size>();
+
+  NativeControlCodec._(this._b, this._handle, List<_Schema> schemas)
+    : _byName = {for (final s in schemas) s.name: s},
+      _byType = {for (final s in schemas) s.type: s} {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  static NativeControlCodec? _shared;
+  static bool _sharedCreated = false;
+
+  /// Null where the native engine isn't available; then everything stays
+  /// JSON.
+  static NativeControlCodec? get shared {
+    if (!_sharedCreated) {
+      _sharedCreated = true;
+      _shared = _create();
+    }
+    return _shared;
+  }
+
+  static NativeControlCodec? _create() {
+    final b = _ControlBindings.instance;
+    if (b == null) return null;
+    final schemas = <_Schema>[];
+    for (var type = 1; ; type++) {
+      final name = b.typeName(type);
+      if (name == nullptr) break;
+      final count = b.fieldCount(type);
+      schemas.add(
+        _Schema(
+          type,
+          name.toDartString(),
+          [for (var i = 0; i < count; i++) b.fieldKey(type, i).toDartString()],
+          [for (var i = 0; i < count; i++) _Kind.values[b.fieldKind(type, i)]],
+        ),
+      );
+    }
+    return NativeControlCodec._(b, b.create(), schemas);
+  }
+
+  /// [message] as binary, or as JSON marked with [versionKey]; null if it
+  /// isn't a message the codec knows or has a key or value its schema has
+  /// no room for, which the caller sends with `jsonEncode` as before.
+  Uint8List? encode(Map<String, Object?> message, {required bool binary}) {
+    final schema = _byName[message['type']];
+    if (schema == null || _b.reset(_handle, schema.type) == 0) return null;
+    for (final entry in message.entries) {
+      if (entry.key == 'type') continue;
+      final i = schema.index[entry.key];
+      if (i == null) return null;
+      final value = entry.value;
+      if (value == null) continue;
+      switch (schema.kinds[i]) {
+        case _Kind.string:
+          if (value is! String) return null;
+          final bytes = utf8.encode(value);
+          _b.setString(_handle, i, bytes.address, bytes.length);
+        case _Kind.int:
+          if (value is! int) return null;
+          _b.setInt(_handle, i, value);
+        case _Kind.double:
+          if (value is! num) return null;
+          _b.setDouble(_handle, i, value.toDouble());
+        case _Kind.bool:
+          if (value is! bool) return null;
+          _b.setInt(_handle, i, value ? 1 : 0);
+        case _Kind.strings:
+          if (value is! List) return null;
+          for (final item in value) {
+            if (item is! String) return null;
+            final bytes = utf8.encode(item);
+            _b.addString(_handle, i, bytes.address, bytes.length);
+          }
+      }
+    }
+    final size = _b.encode(_handle, binary ? 0 : 1);
+    return Uint8List.fromList(_b.encoded(_handle).asTypedList(size));
+  }
+
+  /// The message in [data], binary or JSON, as the map `jsonDecode` would
+  /// have made; null if it's neither or of a type the codec doesn't know,
+  /// which the caller decodes as before.
+  Map<String, dynamic>? decode(Uint8List data) {
+    final schema = _byType[_b.decode(_handle, data.address, data.length)];
+    if (schema == null) return null;
+    final message = <String, dynamic>{'type': schema.name};
+    for (var i = 0; i < schema.keys.length; i++) {
+      // Binary has no empty list, so an absent one reads as empty.
+      if (schema.kinds[i] == _Kind.strings) {
+        message[schema.keys[i]] = [
+          for (var j = 0; j < _b.listSize(_handle, i); j++) _string(i, j),
+        ];
+        continue;
+      }
+      if (_b.present(_handle, i) == 0) continue;
+      message[schema.keys[i]] = switch (schema.kinds[i]) {
+        _Kind.string => _string(i, 0),
+        _Kind.int => _b.getInt(_handle, i),
+        _Kind.double => _b.getDouble(_handle, i),
+        _Kind.bool => _b.getInt(_handle, i) != 0,
+        _Kind.strings => const <String>[],
+      };
+    }
+    final version = _b.version(_handle);
+    if (version > 0) message[versionKey] = version;
+    return message;
+  }
+
+  String _string(int index, int item) {
+    final p = _b.getString(_handle, index, item, _len);
+    if (p == nullptr) return '';
+    return utf8.decode(p.asTypedList(_len.value), allowMalformed: true);
+  }
+}
@@ -0,0 +1,241 @@
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsSignatureBuilder extends Opaque {}
+
+final class _ZsDeltaEncoder extends Opaque {}
+
+class _DeltaBindings {
+  final int Function(int) blockSize;
+  final Pointer<_ZsSignatureBuilder> Function(int, int) signatureNew;
+  final void Function(Pointer<_ZsSignatureBuilder>) signatureFree;
+  final void Function(Pointer<_ZsSignatureBuilder>, Pointer<Uint8>, int)
+  signatureUpdate;
+  final Pointer<Uint8> Function(Pointer<_ZsSignatureBuilder>, Pointer<Size>)
+  signatureFinish;
+  final Pointer<_ZsDeltaEncoder> Function(Pointer<Uint8>, int, int) encoderNew;
+  final NativeFinalizer encoderFinalizer;
+  final void Function(Pointer<Void>) encoderFree;
+  final void Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint8>, int)
+  encoderUpdate;
+  final void Function(Pointer<_ZsDeltaEncoder>) encoderFinish;
+  final int Function(Pointer<_ZsDeltaEncoder>) encoderPending;
+  final int Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint8>, int)
+  encoderRead;
+  final void Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint64>) encoderStats;
+
+  _DeltaBindings(DynamicLibrary lib)
+    : blockSize = lib.lookupFunction<
+        Uint32 Function(Uint64),
+        int Function(int)
+      >('zs_delta_block_size', isLeaf: true),
+      signatureNew = lib.lookupFunction<
+        Pointer<_ZsSignatureBuilder> Function(Uint64, Uint32),
+        Pointer<_ZsSignatureBuilder> Function(int, int)
+      >('zs_signature_new'),
+      signatureFree = lib.lookupFunction<
+        Void Function(Pointer<_ZsSignatureBuilder>),
+        void Function(Pointer<_ZsSignatureBuilder>)
+      >('zs_signature_free'),
+      signatureUpdate = lib.lookupFunction<
+        Void Function(Pointer<_ZsSignatureBuilder>, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsSignatureBuilder>, Pointer<Uint8>, int)
+      >('zs_signature_update', isLeaf: true),
+      signatureFinish = lib.lookupFunction<
+        Pointer<Uint8> Function(Pointer<_ZsSignatureBuilder>, Pointer<Size>),
+        Pointer<Uint8> Function(Pointer<_ZsSignatureBuilder>, Pointer<Size>)
+      >('zs_signature_finish', isLeaf: true),
+      encoderNew = lib.lookupFunction<
+        Pointer<_ZsDeltaEncoder> Function(Pointer<Uint8>, Size, Uint64),
+        Pointer<_ZsDeltaEncoder> Function(Pointer<Uint8>, int, int)
+      >('zs_delta_encoder_new', isLeaf: true),
+      encoderFinalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_delta_encoder_free'),
+      ),
+      encoderFree = lib
+          .lookup<NativeFinalizerFunction>('zs_delta_encoder_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      encoderUpdate = lib.lookupFunction<
+        Void Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint8>, int)
+      >('zs_delta_encoder_update', isLeaf: true),
+      encoderFinish = lib.lookupFunction<
+        Void Function(Pointer<_ZsDeltaEncoder>),
+        void Function(Pointer<_ZsDeltaEncoder>)
+      >('zs_delta_encoder_finish', isLeaf: true),
+      encoderPending = lib.lookupFunction<
+        Size Function(Pointer<_ZsDeltaEncoder>),
+        int Function(Pointer<_ZsDeltaEncoder>)
+      >('zs_delta_encoder_pending', isLeaf: true),
+      encoderRead = lib.lookupFunction<
+        Size Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint8>, int)
+      >('zs_delta_encoder_read', isLeaf: true),
+      encoderStats = lib.lookupFunction<
+        Void Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint64>),
+        void Function(Pointer<_ZsDeltaEncoder>, Pointer<Uint64>)
+      >('zs_delta_encoder_stats', isLeaf: true);
+
+  static _DeltaBindings? _instance;
+  static bool _resolved = false;
+
+  static _DeltaBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _DeltaBindings(lib);
+    } catch (e) {
+      print('⚠️ Delta transfer unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// How much of a target the delta encoder matched against the basis.
+class DeltaStats {
+  final int targetBytes;
+  final int copiedBytes;
+  final int literalBytes;
+  final int outputBytes;
+  final bool gaveUp;
+
+  const DeltaStats({
+    required this.targetBytes,
+    required this.copiedBytes,
+    required this.literalBytes,
+    required this.outputBytes,
+    required this.gaveUp,
+  });
+
+  @override
+  String toString() =>
+      'target=$targetBytes copied=$copiedBytes literal=$literalBytes '
+      'delta=$outputBytes${gaveUp ? ' (gave up)' : ''}';
+}
+
+/// rsync-style signatures and deltas, backed by `native/src/delta.cc`.
+///
+/// The receiver sends [signatureOf] its old copy of a file; the sender feeds
+/// the new file through a [NativeDeltaEncoder] and streams back copy and
+/// literal instructions instead of the whole file.
+class NativeDelta {
+  static bool get isAvailable => _DeltaBindings.instance != null;
+
+  /// Signature of the basis file at [path], read in 1MB pieces. Runs on the
+  /// calling isolate; wrap in `Isolate.run` for large files.
+  ///
+  /// Returns null when the native engine isn't available.
+  static Uint8List? signatureOf(String path) {
+    final b = _DeltaBindings.instance;
+    if (b == null) return null;
+    final raf = File(path).openSync();
+    final size = raf.lengthSync();
+    final builder = b.signatureNew(size, 0);
+    final buf = calloc<Uint8>(1024 * 1024);
+    final lenPtr = calloc<Size>();
+    try {
+      final view = buf.asTypedList(1024 * 1024);
+      while (true) {
+        final n = raf.readIntoSync(view);
+        if (n <= 0) break;
+        b.signatureUpdate(builder, buf, n);
+      }
+      final sig = b.signatureFinish(builder, lenPtr);
+      return Uint8List.fromList(sig.asTypedList(lenPtr.value));
+    } finally {
+      raf.closeSync();
+      calloc.free(buf);
+      calloc.free(lenPtr);
+      b.signatureFree(builder);
+    }
+  }
+}
+
+/// Streams the delta of a target file against a receiver's signature.
+class NativeDeltaEncoder implements Finalizable {
+  final _DeltaBindings _b;
+  final Pointer<_ZsDeltaEncoder> _handle;
+  Pointer<Uint8> _scratch = nullptr;
+  int _scratchLen = 0;
+  bool _disposed = false;
+
+  NativeDeltaEncoder._(this._b, this._handle) {
+    _b.encoderFinalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// Returns null when the native engine isn't available or [signature] is
+  /// malformed.
+  static NativeDeltaEncoder? create(Uint8List signature, int targetSize) {
+    final b = _DeltaBindings.instance;
+    if (b == null) return null;
+    final handle = b.encoderNew(
+      signature.address,
+      signature.length,
+      targetSize,
+    );
+    if (handle == nullptr) return null;
+    return NativeDeltaEncoder._(b, handle);
+  }
+
+  /// Feeds the next target bytes and returns whatever delta output is ready,
+  /// possibly empty.
+  Uint8List update(List<int> bytes) {
+    if (_disposed) return Uint8List(0);
+    if (bytes.isNotEmpty) {
+      final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+      _b.encoderUpdate(_handle, data.address, data.length);
+    }
+    return _drain();
+  }
+
+  /// Flushes the tail and the trailing digest.
+  Uint8List finish() {
+    if (_disposed) return Uint8List(0);
+    _b.encoderFinish(_handle);
+    return _drain();
+  }
+
+  DeltaStats get stats {
+    final out = calloc<Uint64>(5);
+    try {
+      if (!_disposed) _b.encoderStats(_handle, out);
+      return DeltaStats(
+        targetBytes: out[0],
+        copiedBytes: out[1],
+        literalBytes: out[2],
+        outputBytes: out[3],
+        gaveUp: out[4] != 0,
+      );
+    } finally {
+      calloc.free(out);
+    }
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.encoderFinalizer.detach(this);
+    _b.encoderFree(_handle.cast());
+    if (_scratch != nullptr) calloc.free(_scratch);
+    _scratch = nullptr;
+  }
+
+  Uint8List _drain() {
+    final pending = _b.encoderPending(_handle);
+    if (pending == 0) return Uint8List(0);
+    if (_scratchLen < pending) {
+      if (_scratch != nullptr) calloc.free(_scratch);
+      _scratchLen = pending;
+      _scratch = calloc<Uint8>(_scratchLen);
+    }
+    final n = _b.encoderRead(_handle, _scratch, pending);
+    return Uint8List.fromList(_scratch.asTypedList(n));
+  }
+}
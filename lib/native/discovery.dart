@@ -0,0 +1,422 @@
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'native_wakeup.dart';
+import 'zapshare_native.dart';
+
+final class _ZsDiscovery extends Opaque {}
+
+class _DiscoveryBindings {
+  final Pointer<_ZsDiscovery> Function(
+    Pointer<Utf8>,
+    Pointer<Utf8>,
+    Pointer<Utf8>,
+    int,
+    int,
+    int,
+    Pointer<Utf8>,
+    int,
+    int,
+    int,
+    Pointer<Uint8>,
+    int,
+  )
+  start;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) free;
+  final int Function(Pointer<_ZsDiscovery>, Pointer<Uint8>, int) poll;
+  final void Function(
+    Pointer<_ZsDiscovery>,
+    Pointer<NativeFunction<NativeWakeupFunction>>,
+    int,
+  )
+  notify;
+  final void Function(Pointer<_ZsDiscovery>) announce;
+  final void Function(Pointer<_ZsDiscovery>) query;
+  final int Function(Pointer<_ZsDiscovery>, Pointer<Utf8>, int) firstInWindow;
+  final void Function(Pointer<_ZsDiscovery>, int) setPaused;
+  final void Function(Pointer<_ZsDiscovery>, Pointer<Uint64>) stats;
+
+  _DiscoveryBindings(DynamicLibrary lib)
+    : start = lib.lookupFunction<
+        Pointer<_ZsDiscovery> Function(
+          Pointer<Utf8>,
+          Pointer<Utf8>,
+          Pointer<Utf8>,
+          Int32,
+          Uint16,
+          Uint16,
+          Pointer<Utf8>,
+          Uint32,
+          Uint32,
+          Uint16,
+          Pointer<Uint8>,
+          Size,
+        ),
+        Pointer<_ZsDiscovery> Function(
+          Pointer<Utf8>,
+          Pointer<Utf8>,
+          Pointer<Utf8>,
+          int,
+          int,
+          int,
+          Pointer<Utf8>,
+          int,
+          int,
+          int,
+          Pointer<Uint8>,
+          int,
+        )
+      >('zs_discovery_start'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_discovery_free'),
+      ),
+      free = lib
+          .lookup<NativeFinalizerFunction>('zs_discovery_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      poll = lib.lookupFunction<
+        Size Function(Pointer<_ZsDiscovery>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsDiscovery>, Pointer<Uint8>, int)
+      >('zs_discovery_poll', isLeaf: true),
+      notify = lib.lookupFunction<
+        Void Function(
+          Pointer<_ZsDiscovery>,
+          Pointer<NativeFunction<NativeWakeupFunction>>,
+          Int64,
+        ),
+        void Function(
+          Pointer<_ZsDiscovery>,
+          Pointer<NativeFunction<NativeWakeupFunction>>,
+          int,
+        )
+      >('zs_discovery_notify'),
+      announce = lib.lookupFunction<
+        Void Function(Pointer<_ZsDiscovery>),
+        void Function(Pointer<_ZsDiscovery>)
+      >('zs_discovery_announce', isLeaf: true),
+      query = lib.lookupFunction<
+        Void Function(Pointer<_ZsDiscovery>),
+        void Function(Pointer<_ZsDiscovery>)
+      >('zs_discovery_query', isLeaf: true),
+      firstInWindow = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsDiscovery>, Pointer<Utf8>, Uint32),
+        int Function(Pointer<_ZsDiscovery>, Pointer<Utf8>, int)
+      >('zs_discovery_first_in_window', isLeaf: true),
+      setPaused = lib.lookupFunction<
+        Void Function(Pointer<_ZsDiscovery>, Int32),
+        void Function(Pointer<_ZsDiscovery>, int)
+      >('zs_discovery_set_paused', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(Pointer<_ZsDiscovery>, Pointer<Uint64>),
+        void Function(Pointer<_ZsDiscovery>, Pointer<Uint64>)
+      >('zs_discovery_stats', isLeaf: true);
+
+  static _DiscoveryBindings? _instance;
+  static bool _resolved = false;
+
+  static _DiscoveryBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _DiscoveryBindings(lib);
+    } catch (e) {
+      print('⚠️ Native discovery unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// A peer as the native engine's table has it; mirrors `kPeerEvent`.
+class DiscoveryPeer {
+  // The app's device id; the beacon's 64-bit id in hex when the peer is
+  // too old to send it
+  final String deviceId;
+  final String name;
+  final String? avatar;
+  final String platform;
+  final int port;
+  final List<String> addresses; // The one most recently heard from first
+
+  const DiscoveryPeer(
+    this.deviceId,
+    this.name,
+    this.avatar,
+    this.platform,
+    this.port,
+    this.addresses,
+  );
+}
+
+/// What changed since the last [NativeDiscovery.poll].
+class DiscoveryChanges {
+  final List<DiscoveryPeer> peers = [];
+  final List<String> gone = []; // Device ids, as [DiscoveryPeer] had them
+  // Datagrams that aren't beacons, for the JSON handlers
+  final List<Datagram> messages = [];
+
+  bool get isEmpty => peers.isEmpty && gone.isEmpty && messages.isEmpty;
+}
+
+/// Counters of a [NativeDiscovery].
+class DiscoveryStats {
+  final int datagrams;
+  final int beacons; // From peers
+  final int sent;
+  final int messages;
+  final int dropped; // Messages the queue had no room for
+  final int peers;
+  final int cpuNs; // Of the engine's thread
+  final int suppressed; // Our beacons left out as redundant
+  final int answered; // Query beacons and mDNS queries
+
+  const DiscoveryStats(
+    this.datagrams,
+    this.beacons,
+    this.sent,
+    this.messages,
+    this.dropped,
+    this.peers,
+    this.cpuNs,
+    this.suppressed,
+    this.answered,
+  );
+}
+
+/// LAN discovery on one native thread with compact binary beacons, backed
+/// by `native/src/discovery.cc`. The app only polls for changes to the
+/// peer table and for the datagrams that aren't beacons, when [changed]
+/// says there are some.
+class NativeDiscovery implements Finalizable {
+  /// Indexed by the beacon's platform byte.
+  static const List<String> platforms = [
+    'Unknown',
+    'Android',
+    'iOS',
+    'Windows',
+    'macOS',
+    'Linux',
+  ];
+
+  static const int _peerEvent = 1;
+  static const int _goneEvent = 2;
+  static const int _bufferSize = 128 * 1024;
+
+  final _DiscoveryBindings _b;
+  final Pointer<_ZsDiscovery> _handle;
+  final Pointer<Uint8> _buffer = calloc<Uint8>(_bufferSize);
+  // Gone events only carry the beacon's id
+  final Map<String, String> _deviceIds = {};
+  bool _disposed = false;
+
+  NativeDiscovery._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// Listens on [port] and beacons as [deviceId] on every interface,
+  /// every [minInterval] at first and backing off to every [maxInterval]
+  /// while the LAN stays the same. Answers mDNS browses for
+  /// `_zapshare._tcp` on [mdnsPort] unless it's 0. [legacyBeacon], when
+  /// given, goes out alongside for older versions. Null on Windows,
+  /// without the native engine, or if the port can't be bound.
+  static NativeDiscovery? start({
+    required String deviceId,
+    required String name,
+    String? avatar,
+    required String platform,
+    required int servicePort,
+    required int port,
+    required String group,
+    required Duration minInterval,
+    required Duration maxInterval,
+    int mdnsPort = 0,
+    List<int>? legacyBeacon,
+  }) {
+    final b = _DiscoveryBindings.instance;
+    if (b == null || Platform.isWindows) return null;
+    final nativeId = deviceId.toNativeUtf8();
+    final nativeName = name.toNativeUtf8();
+    final nativeAvatar = (avatar ?? '').toNativeUtf8();
+    final nativeGroup = group.toNativeUtf8();
+    final legacyLength = legacyBeacon?.length ?? 0;
+    final nativeLegacy =
+        legacyBeacon == null ? nullptr : malloc<Uint8>(legacyLength);
+    if (legacyBeacon != null) {
+      nativeLegacy.asTypedList(legacyLength).setAll(0, legacyBeacon);
+    }
+    final platformIndex = platforms.indexOf(platform);
+    try {
+      final handle = b.start(
+        nativeId,
+        nativeName,
+        nativeAvatar,
+        platformIndex < 0 ? 0 : platformIndex,
+        servicePort,
+        port,
+        nativeGroup,
+        minInterval.inMilliseconds,
+        maxInterval.inMilliseconds,
+        mdnsPort,
+        nativeLegacy,
+        legacyLength,
+      );
+      return handle == nullptr ? null : NativeDiscovery._(b, handle);
+    } finally {
+      malloc.free(nativeId);
+      malloc.free(nativeName);
+      malloc.free(nativeAvatar);
+      malloc.free(nativeGroup);
+      if (nativeLegacy != nullptr) malloc.free(nativeLegacy);
+    }
+  }
+
+  /// Completes once [poll] has something: a peer was added, changed or
+  /// went away, or a datagram that isn't a beacon came in. Also completes
+  /// when the engine is disposed. Beacons that say nothing new don't.
+  Future<void> changed() {
+    if (_disposed) return Future.value();
+    return NativeWakeup.wait(
+      (callback, token) => _b.notify(_handle, callback, token),
+    );
+  }
+
+  /// Beacons again within the shortest interval and has everyone answer,
+  /// for when a screen that lists peers opens.
+  void announce() {
+    if (!_disposed) _b.announce(_handle);
+  }
+
+  /// Has every peer that hears it answer straight back with its beacon,
+  /// rather than within the shortest interval.
+  void query() {
+    if (!_disposed) _b.query(_handle);
+  }
+
+  /// False if [key] was passed here less than [window] ago, for dropping
+  /// requests a peer repeated. Either way it counts as seen now.
+  bool firstInWindow(String key, Duration window) {
+    if (_disposed) return true;
+    final nativeKey = key.toNativeUtf8();
+    try {
+      final ms = window.inMilliseconds;
+      return _b.firstInWindow(_handle, nativeKey, ms) != 0;
+    } finally {
+      malloc.free(nativeKey);
+    }
+  }
+
+  /// Stops our beacons while paused; peers are still heard.
+  void setPaused(bool paused) {
+    if (!_disposed) _b.setPaused(_handle, paused ? 1 : 0);
+  }
+
+  /// Everything that changed since the last call; cheap when nothing did.
+  DiscoveryChanges poll() {
+    final changes = DiscoveryChanges();
+    if (_disposed) return changes;
+    for (;;) {
+      final n = _b.poll(_handle, _buffer, _bufferSize);
+      if (n == 0) return changes;
+      _parse(ByteData.sublistView(_buffer.asTypedList(n)), changes);
+    }
+  }
+
+  void _parse(ByteData data, DiscoveryChanges out) {
+    var pos = 0;
+    String id(int at) =>
+        data.getUint32(at).toRadixString(16).padLeft(8, '0') +
+        data.getUint32(at + 4).toRadixString(16).padLeft(8, '0');
+    String text(int at, int length) => utf8.decode(
+      Uint8List.sublistView(data, at, at + length),
+      allowMalformed: true,
+    );
+    InternetAddress ipv4(int at) => InternetAddress.fromRawAddress(
+      Uint8List.fromList(Uint8List.sublistView(data, at, at + 4)),
+    );
+    while (pos < data.lengthInBytes) {
+      final kind = data.getUint8(pos);
+      if (kind == _goneEvent) {
+        final beaconId = id(pos + 1);
+        out.gone.add(_deviceIds.remove(beaconId) ?? beaconId);
+        pos += 9;
+      } else if (kind == _peerEvent) {
+        final platform = data.getUint8(pos + 1);
+        final port = data.getUint16(pos + 2);
+        final beaconId = id(pos + 4);
+        pos += 13;
+        final nameLength = data.getUint8(pos);
+        final name = text(pos + 1, nameLength);
+        pos += 1 + nameLength;
+        final avatarLength = data.getUint8(pos);
+        final avatar = avatarLength == 0 ? null : text(pos + 1, avatarLength);
+        pos += 1 + avatarLength;
+        final deviceIdLength = data.getUint8(pos);
+        final deviceId = deviceIdLength == 0
+            ? beaconId
+            : text(pos + 1, deviceIdLength);
+        _deviceIds[beaconId] = deviceId;
+        pos += 1 + deviceIdLength;
+        final count = data.getUint8(pos++);
+        final addresses = [
+          for (var i = 0; i < count; i++) ipv4(pos + 4 * i).address,
+        ];
+        pos += 4 * count;
+        out.peers.add(
+          DiscoveryPeer(
+            deviceId,
+            name,
+            avatar,
+            platforms[platform < platforms.length ? platform : 0],
+            port,
+            addresses,
+          ),
+        );
+      } else {
+        final length = data.getUint16(pos + 5);
+        out.messages.add(
+          Datagram(
+            Uint8List.fromList(
+              Uint8List.sublistView(data, pos + 7, pos + 7 + length),
+            ),
+            ipv4(pos + 1),
+            0,
+          ),
+        );
+        pos += 7 + length;
+      }
+    }
+  }
+
+  DiscoveryStats get stats {
+    final values = calloc<Uint64>(9);
+    try {
+      if (!_disposed) _b.stats(_handle, values);
+      return DiscoveryStats(
+        values[0],
+        values[1],
+        values[2],
+        values[3],
+        values[4],
+        values[5],
+        values[6],
+        values[7],
+        values[8],
+      );
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.free(_handle.cast());
+    calloc.free(_buffer);
+  }
+}
@@ -0,0 +1,256 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'native_wakeup.dart';
+import 'zapshare_native.dart';
+
+final class _ZsFanoutCache extends Opaque {}
+
+final class _ZsFanoutReader extends Opaque {}
+
+class _FanoutBindings {
+  final Pointer<_ZsFanoutCache> Function(int, int) cacheNew;
+  final Pointer<_ZsFanoutReader> Function(
+    Pointer<_ZsFanoutCache>,
+    Pointer<Utf8>,
+    int,
+    int,
+  )
+  open;
+  final Pointer<_ZsFanoutReader> Function(
+    Pointer<_ZsFanoutCache>,
+    Pointer<Utf8>,
+    int,
+    int,
+    int,
+  )
+  openFd;
+  final NativeFinalizer readerFinalizer;
+  final void Function(Pointer<Void>) readerFree;
+  final int Function(Pointer<_ZsFanoutReader>, Pointer<Uint8>, int) read;
+  final void Function(
+    Pointer<_ZsFanoutReader>,
+    Pointer<NativeFunction<NativeWakeupFunction>>,
+    int,
+  )
+  notify;
+  final int Function(Pointer<_ZsFanoutReader>) remaining;
+  final void Function(
+    Pointer<_ZsFanoutCache>,
+    Pointer<Uint64>,
+    Pointer<Uint64>,
+    Pointer<Uint64>,
+  )
+  stats;
+
+  _FanoutBindings(DynamicLibrary lib)
+    : cacheNew = lib.lookupFunction<
+        Pointer<_ZsFanoutCache> Function(Uint32, Uint32),
+        Pointer<_ZsFanoutCache> Function(int, int)
+      >('zs_fanout_new'),
+      open = lib.lookupFunction<
+        Pointer<_ZsFanoutReader> Function(
+          Pointer<_ZsFanoutCache>,
+          Pointer<Utf8>,
+          Uint64,
+          Uint64,
+        ),
+        Pointer<_ZsFanoutReader> Function(
+          Pointer<_ZsFanoutCache>,
+          Pointer<Utf8>,
+          int,
+          int,
+        )
+      >('zs_fanout_open'),
+      openFd = lib.lookupFunction<
+        Pointer<_ZsFanoutReader> Function(
+          Pointer<_ZsFanoutCache>,
+          Pointer<Utf8>,
+          Int32,
+          Uint64,
+          Uint64,
+        ),
+        Pointer<_ZsFanoutReader> Function(
+          Pointer<_ZsFanoutCache>,
+          Pointer<Utf8>,
+          int,
+          int,
+          int,
+        )
+      >('zs_fanout_open_fd'),
+      readerFinalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_fanout_reader_free'),
+      ),
+      readerFree = lib
+          .lookup<NativeFinalizerFunction>('zs_fanout_reader_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      read = lib.lookupFunction<
+        Int64 Function(Pointer<_ZsFanoutReader>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsFanoutReader>, Pointer<Uint8>, int)
+      >('zs_fanout_read', isLeaf: true),
+      notify = lib.lookupFunction<
+        Void Function(
+          Pointer<_ZsFanoutReader>,
+          Pointer<NativeFunction<NativeWakeupFunction>>,
+          Int64,
+        ),
+        void Function(
+          Pointer<_ZsFanoutReader>,
+          Pointer<NativeFunction<NativeWakeupFunction>>,
+          int,
+        )
+      >('zs_fanout_notify'),
+      remaining = lib.lookupFunction<
+        Uint64 Function(Pointer<_ZsFanoutReader>),
+        int Function(Pointer<_ZsFanoutReader>)
+      >('zs_fanout_remaining', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(
+          Pointer<_ZsFanoutCache>,
+          Pointer<Uint64>,
+          Pointer<Uint64>,
+          Pointer<Uint64>,
+        ),
+        void Function(
+          Pointer<_ZsFanoutCache>,
+          Pointer<Uint64>,
+          Pointer<Uint64>,
+          Pointer<Uint64>,
+        )
+      >('zs_fanout_stats', isLeaf: true);
+
+  static _FanoutBindings? _instance;
+  static bool _resolved = false;
+
+  static _FanoutBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _FanoutBindings(lib);
+    } catch (e) {
+      print('⚠️ Shared file reads unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Read counters of a [NativeFanoutCache].
+class FanoutStats {
+  final int diskBytes; // Read from storage
+  final int servedBytes; // Handed to connections
+  final int joined; // Readers that found their file already being read
+
+  const FanoutStats(this.diskBytes, this.servedBytes, this.joined);
+}
+
+/// Concurrent readers of the same file sharing one sequential disk read,
+/// backed by `native/src/fanout.cc`. Lives as long as the app.
+class NativeFanoutCache {
+  static const int _wholeFile = -1; // UINT64_MAX as a Uint64
+
+  final _FanoutBindings _b;
+  final Pointer<_ZsFanoutCache> _handle;
+
+  NativeFanoutCache._(this._b, this._handle);
+
+  static bool get isAvailable => _FanoutBindings.instance != null;
+
+  /// [blockSize] and [blocks] size each shared file's ring; 0 takes the
+  /// native defaults. Null when the native engine isn't available.
+  static NativeFanoutCache? create({int blockSize = 0, int blocks = 0}) {
+    final b = _FanoutBindings.instance;
+    if (b == null) return null;
+    return NativeFanoutCache._(b, b.cacheNew(blockSize, blocks));
+  }
+
+  /// Reads bytes [start, end) of the file at [path]; null if it can't be
+  /// opened.
+  NativeFanoutReader? open(String path, {int start = 0, int? end}) {
+    final nativePath = path.toNativeUtf8();
+    try {
+      return _wrap(_b.open(_handle, nativePath, start, end ?? _wholeFile));
+    } finally {
+      malloc.free(nativePath);
+    }
+  }
+
+  /// The same for a descriptor the platform opened, shared under [key].
+  /// Takes ownership of [fd].
+  NativeFanoutReader? openFd(String key, int fd, {int start = 0, int? end}) {
+    final nativeKey = key.toNativeUtf8();
+    try {
+      return _wrap(
+        _b.openFd(_handle, nativeKey, fd, start, end ?? _wholeFile),
+      );
+    } finally {
+      malloc.free(nativeKey);
+    }
+  }
+
+  FanoutStats get stats {
+    final values = calloc<Uint64>(3);
+    try {
+      _b.stats(_handle, values, values + 1, values + 2);
+      return FanoutStats(values[0], values[1], values[2]);
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  NativeFanoutReader? _wrap(Pointer<_ZsFanoutReader> handle) =>
+      handle == nullptr ? null : NativeFanoutReader._(_b, handle);
+}
+
+/// One connection's position in a shared file.
+class NativeFanoutReader implements Finalizable, NativeChunkSource {
+  final _FanoutBindings _b;
+  final Pointer<_ZsFanoutReader> _handle;
+  Uint8List? _spare; // Kept across reads that came back empty
+  bool _disposed = false;
+
+  NativeFanoutReader._(this._b, this._handle) {
+    _b.readerFinalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// Bytes left before the end of the reader's range.
+  @override
+  int get remaining => _disposed ? 0 : _b.remaining(_handle);
+
+  /// Up to [max] bytes from the reader's position: empty while they are
+  /// still being loaded (or at the end), null if the file can't be read.
+  @override
+  Uint8List? read(int max) {
+    if (_disposed) return null;
+    final spare = _spare;
+    final out = spare != null && spare.length == max ? spare : Uint8List(max);
+    final n = _b.read(_handle, out.address, max);
+    if (n < 0) return null;
+    if (n == 0) {
+      _spare = out;
+      return Uint8List(0);
+    }
+    _spare = null;
+    return n == max ? out : Uint8List.sublistView(out, 0, n);
+  }
+
+  /// Completes once the next [read] is worth trying, after one came back
+  /// empty while its bytes were being loaded.
+  @override
+  Future<void> ready() {
+    if (_disposed) return Future.value();
+    return NativeWakeup.wait(
+      (callback, token) => _b.notify(_handle, callback, token),
+    );
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.readerFinalizer.detach(this);
+    _b.readerFree(_handle.cast());
+  }
+}
@@ -0,0 +1,220 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+import 'package:flutter/services.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsMirrorReceiver extends Opaque {}
+
+class _MirrorBindings {
+  final int Function() available;
+  final Pointer<_ZsMirrorReceiver> Function(Pointer<Utf8>) create;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) free;
+  final void Function(Pointer<_ZsMirrorReceiver>, Pointer<Uint8>, int) feed;
+  final void Function(Pointer<_ZsMirrorReceiver>, int, int) setTargetSize;
+  final void Function(Pointer<_ZsMirrorReceiver>, Pointer<Uint64>) stats;
+
+  _MirrorBindings(DynamicLibrary lib)
+    : available = lib.lookupFunction<Int32 Function(), int Function()>(
+        'zs_mirror_receiver_available',
+        isLeaf: true,
+      ),
+      create = lib.lookupFunction<
+        Pointer<_ZsMirrorReceiver> Function(Pointer<Utf8>),
+        Pointer<_ZsMirrorReceiver> Function(Pointer<Utf8>)
+      >('zs_mirror_receiver_new'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_mirror_receiver_free'),
+      ),
+      free = lib
+          .lookup<NativeFinalizerFunction>('zs_mirror_receiver_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      feed = lib.lookupFunction<
+        Void Function(Pointer<_ZsMirrorReceiver>, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsMirrorReceiver>, Pointer<Uint8>, int)
+      >('zs_mirror_receiver_feed', isLeaf: true),
+      setTargetSize = lib.lookupFunction<
+        Void Function(Pointer<_ZsMirrorReceiver>, Int32, Int32),
+        void Function(Pointer<_ZsMirrorReceiver>, int, int)
+      >('zs_mirror_receiver_set_target_size', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(Pointer<_ZsMirrorReceiver>, Pointer<Uint64>),
+        void Function(Pointer<_ZsMirrorReceiver>, Pointer<Uint64>)
+      >('zs_mirror_receiver_stats', isLeaf: true);
+
+  static _MirrorBindings? _instance;
+  static bool _resolved = false;
+
+  static _MirrorBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      final b = _MirrorBindings(lib);
+      if (b.available() != 0) _instance = b;
+    } catch (e) {
+      print('⚠️ Mirror receiver unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Counters of a [NativeMirrorReceiver].
+class MirrorStats {
+  final int received; // Frames cut from the stream
+  final int decoded;
+  final int dropped; // Replaced by a newer frame before decoding
+  final int failed; // Undecodable, or a tile frame out of sync
+  final int unshown; // Decoded, but replaced before the texture took it
+  final int presented; // Taken by the texture
+  final int decodeNs;
+  final int lastDecodeNs;
+  final int maxDecodeNs;
+  final int queueDepth; // Frames waiting or being decoded
+  final int maxQueueDepth;
+  final int width; // Of the newest frame, as decoded
+  final int height;
+
+  const MirrorStats(
+    this.received,
+    this.decoded,
+    this.dropped,
+    this.failed,
+    this.unshown,
+    this.presented,
+    this.decodeNs,
+    this.lastDecodeNs,
+    this.maxDecodeNs,
+    this.queueDepth,
+    this.maxQueueDepth,
+    this.width,
+    this.height,
+  );
+
+  double get averageDecodeMs {
+    final n = decoded + failed;
+    return n == 0 ? 0 : decodeNs / n / 1e6;
+  }
+}
+
+/// Decodes a screen mirror stream on a native thread into a Flutter
+/// external texture, backed by `native/src/mirror_receiver.cc` and the
+/// runners' "zapshare/mirror_texture" channel: chunks go in, frames are
+/// cut, the ones that would be late are dropped before decoding, and the
+/// rest are decoded at the size they're shown at. Show it with
+/// `Texture(textureId: receiver.textureId)`.
+///
+/// Besides MJPEG it composes the tile stream of `native/src/tile_stream.h`,
+/// which only sends what changed; ask a sender for it by setting
+/// [tileStreamHeader] to [tileStreamVersion] on the request. Senders that
+/// don't know it answer with MJPEG, and the receiver tells the two apart
+/// by their first bytes.
+class NativeMirrorReceiver implements Finalizable {
+  static const tileStreamHeader = 'X-ZapShare-Mirror';
+  static const tileStreamVersion = 'tiles/1';
+
+  static const _channel = MethodChannel('zapshare/mirror_texture');
+
+  final _MirrorBindings _b;
+  final Pointer<_ZsMirrorReceiver> _handle;
+  final int textureId;
+  int _targetWidth = -1;
+  int _targetHeight = -1;
+  bool _disposed = false;
+
+  NativeMirrorReceiver._(this._b, this._handle, this.textureId) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// [boundary] is the response's Content-Type boundary parameter, or null
+  /// to learn it from the stream. Null when the native engine can't decode
+  /// frames or the runner has no texture support (Android, macOS); show
+  /// frames with Image.memory then.
+  static Future<NativeMirrorReceiver?> create({String? boundary}) async {
+    final b = _MirrorBindings.instance;
+    if (b == null) return null;
+    final nativeBoundary = boundary?.toNativeUtf8() ?? nullptr;
+    final Pointer<_ZsMirrorReceiver> handle;
+    try {
+      handle = b.create(nativeBoundary);
+    } finally {
+      if (nativeBoundary != nullptr) malloc.free(nativeBoundary);
+    }
+    if (handle == nullptr) return null;
+    int? textureId;
+    try {
+      textureId = await _channel.invokeMethod<int>('create', {
+        'receiver': handle.address,
+      });
+    } on MissingPluginException {
+      textureId = null;
+    } on PlatformException catch (e) {
+      print('⚠️ Mirror texture unavailable: ${e.message}');
+      textureId = null;
+    }
+    if (textureId == null) {
+      b.free(handle.cast());
+      return null;
+    }
+    return NativeMirrorReceiver._(b, handle, textureId);
+  }
+
+  /// Appends a chunk of the response.
+  void feed(List<int> chunk) {
+    if (_disposed || chunk.isEmpty) return;
+    final data = chunk is Uint8List ? chunk : Uint8List.fromList(chunk);
+    _b.feed(_handle, data.address, data.length);
+  }
+
+  /// The size, in physical pixels, the texture is shown at; frames are
+  /// decoded scaled down towards it.
+  void setTargetSize(int width, int height) {
+    if (_disposed || (width == _targetWidth && height == _targetHeight)) {
+      return;
+    }
+    _targetWidth = width;
+    _targetHeight = height;
+    _b.setTargetSize(_handle, width, height);
+  }
+
+  MirrorStats get stats {
+    if (_disposed) {
+      return const MirrorStats(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    }
+    final values = calloc<Uint64>(13);
+    try {
+      _b.stats(_handle, values);
+      return MirrorStats(
+        values[0],
+        values[1],
+        values[2],
+        values[3],
+        values[4],
+        values[5],
+        values[6],
+        values[7],
+        values[8],
+        values[9],
+        values[10],
+        values[11],
+        values[12],
+      );
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  /// Unregisters the texture. The runner holds its own reference to the
+  /// receiver until the engine is done with it, so this doesn't wait.
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _channel.invokeMethod('dispose', {'textureId': textureId});
+    _b.free(_handle.cast());
+  }
+}
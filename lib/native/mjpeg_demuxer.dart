@@ -0,0 +1,153 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsMjpegDemuxer extends Opaque {}
+
+class _MjpegBindings {
+  final Pointer<_ZsMjpegDemuxer> Function(Pointer<Utf8>) create;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) free;
+  final void Function(Pointer<_ZsMjpegDemuxer>, Pointer<Uint8>, int) feed;
+  final Pointer<Uint8> Function(Pointer<_ZsMjpegDemuxer>, Pointer<Size>) next;
+  final void Function(Pointer<_ZsMjpegDemuxer>, Pointer<Uint64>) stats;
+
+  _MjpegBindings(DynamicLibrary lib)
+    : create = lib.lookupFunction<
+        Pointer<_ZsMjpegDemuxer> Function(Pointer<Utf8>),
+        Pointer<_ZsMjpegDemuxer> Function(Pointer<Utf8>)
+      >('zs_mjpeg_demuxer_new'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_mjpeg_demuxer_free'),
+      ),
+      free = lib
+          .lookup<NativeFinalizerFunction>('zs_mjpeg_demuxer_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      feed = lib.lookupFunction<
+        Void Function(Pointer<_ZsMjpegDemuxer>, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsMjpegDemuxer>, Pointer<Uint8>, int)
+      >('zs_mjpeg_demuxer_feed', isLeaf: true),
+      next = lib.lookupFunction<
+        Pointer<Uint8> Function(Pointer<_ZsMjpegDemuxer>, Pointer<Size>),
+        Pointer<Uint8> Function(Pointer<_ZsMjpegDemuxer>, Pointer<Size>)
+      >('zs_mjpeg_demuxer_next', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(Pointer<_ZsMjpegDemuxer>, Pointer<Uint64>),
+        void Function(Pointer<_ZsMjpegDemuxer>, Pointer<Uint64>)
+      >('zs_mjpeg_demuxer_stats', isLeaf: true);
+
+  static _MjpegBindings? _instance;
+  static bool _resolved = false;
+
+  static _MjpegBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _MjpegBindings(lib);
+    } catch (e) {
+      print('⚠️ MJPEG demuxer unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Counters of a [NativeMjpegDemuxer].
+class MjpegStats {
+  final int frames;
+  final int byLength; // Cut by Content-Length
+  final int byMarker; // Cut at a boundary or an EOI marker
+  final int bytes;
+  final int skipped; // Parts that weren't a JPEG
+  final int resyncs;
+  final int allocations; // Times its buffer grew
+  final int compactions;
+
+  const MjpegStats(
+    this.frames,
+    this.byLength,
+    this.byMarker,
+    this.bytes,
+    this.skipped,
+    this.resyncs,
+    this.allocations,
+    this.compactions,
+  );
+}
+
+/// Splits a multipart MJPEG stream into JPEG frames, backed by
+/// `native/src/mjpeg_demuxer.cc`: parts are cut by their Content-Length,
+/// or at the boundary, or at SOI/EOI markers for a stream that isn't
+/// multipart, without rescanning or reallocating per frame.
+class NativeMjpegDemuxer implements Finalizable {
+  final _MjpegBindings _b;
+  final Pointer<_ZsMjpegDemuxer> _handle;
+  final Pointer<Size> _size = calloc<Size>();
+  bool _disposed = false;
+
+  NativeMjpegDemuxer._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// [boundary] is the response's Content-Type boundary parameter, or null
+  /// to learn it from the stream. Null when the native engine isn't
+  /// available.
+  static NativeMjpegDemuxer? create({String? boundary}) {
+    final b = _MjpegBindings.instance;
+    if (b == null) return null;
+    final nativeBoundary = boundary?.toNativeUtf8() ?? nullptr;
+    try {
+      return NativeMjpegDemuxer._(b, b.create(nativeBoundary));
+    } finally {
+      if (nativeBoundary != nullptr) malloc.free(nativeBoundary);
+    }
+  }
+
+  /// Appends a chunk of the response. Frames from [next] are invalid
+  /// after this.
+  void feed(List<int> chunk) {
+    if (_disposed || chunk.isEmpty) return;
+    final data = chunk is Uint8List ? chunk : Uint8List.fromList(chunk);
+    _b.feed(_handle, data.address, data.length);
+  }
+
+  /// The next complete frame, or null until more is fed. It's a view of
+  /// native memory, valid until the next [feed]; copy what you keep.
+  Uint8List? next() {
+    if (_disposed) return null;
+    final data = _b.next(_handle, _size);
+    return data == nullptr ? null : data.asTypedList(_size.value);
+  }
+
+  MjpegStats get stats {
+    if (_disposed) return const MjpegStats(0, 0, 0, 0, 0, 0, 0, 0);
+    final values = calloc<Uint64>(8);
+    try {
+      _b.stats(_handle, values);
+      return MjpegStats(
+        values[0],
+        values[1],
+        values[2],
+        values[3],
+        values[4],
+        values[5],
+        values[6],
+        values[7],
+      );
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.free(_handle.cast());
+    calloc.free(_size);
+  }
+}
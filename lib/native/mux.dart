@@ -0,0 +1,325 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsMuxSession extends Opaque {}
+
+class _MuxBindings {
+  final Pointer<_ZsMuxSession> Function(int) sessionNew;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) sessionFree;
+  final int Function(Pointer<_ZsMuxSession>, Pointer<Uint8>, int) receive;
+  final int Function(
+    Pointer<_ZsMuxSession>,
+    Pointer<Uint64>,
+    Pointer<Pointer<Uint8>>,
+    Pointer<Size>,
+  )
+  nextEvent;
+  final int Function(Pointer<_ZsMuxSession>, int, int, int, int) request;
+  final void Function(Pointer<_ZsMuxSession>, int, int) setPriority;
+  final void Function(Pointer<_ZsMuxSession>, int, int) consumed;
+  final void Function(Pointer<_ZsMuxSession>, int, int, Pointer<Uint8>, int)
+  respond;
+  final int Function(Pointer<_ZsMuxSession>, int) writable;
+  final int Function(Pointer<_ZsMuxSession>, int, Pointer<Uint8>, int) write;
+  final void Function(Pointer<_ZsMuxSession>, int) end;
+  final void Function(Pointer<_ZsMuxSession>, int, int) reset;
+  final void Function(Pointer<_ZsMuxSession>, int) ping;
+  final void Function(Pointer<_ZsMuxSession>, int) goAway;
+  final int Function(Pointer<_ZsMuxSession>) pending;
+  final int Function(Pointer<_ZsMuxSession>, Pointer<Uint8>, int) read;
+  final int Function(Pointer<_ZsMuxSession>) openStreams;
+
+  _MuxBindings(DynamicLibrary lib)
+    : sessionNew = lib.lookupFunction<
+        Pointer<_ZsMuxSession> Function(Int32),
+        Pointer<_ZsMuxSession> Function(int)
+      >('zs_mux_new'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_mux_free'),
+      ),
+      sessionFree = lib
+          .lookup<NativeFinalizerFunction>('zs_mux_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      receive = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsMuxSession>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsMuxSession>, Pointer<Uint8>, int)
+      >('zs_mux_receive', isLeaf: true),
+      nextEvent = lib.lookupFunction<
+        Int32 Function(
+          Pointer<_ZsMuxSession>,
+          Pointer<Uint64>,
+          Pointer<Pointer<Uint8>>,
+          Pointer<Size>,
+        ),
+        int Function(
+          Pointer<_ZsMuxSession>,
+          Pointer<Uint64>,
+          Pointer<Pointer<Uint8>>,
+          Pointer<Size>,
+        )
+      >('zs_mux_next_event', isLeaf: true),
+      request = lib.lookupFunction<
+        Uint32 Function(Pointer<_ZsMuxSession>, Uint32, Uint64, Uint64, Uint8),
+        int Function(Pointer<_ZsMuxSession>, int, int, int, int)
+      >('zs_mux_request', isLeaf: true),
+      setPriority = lib.lookupFunction<
+        Void Function(Pointer<_ZsMuxSession>, Uint32, Uint8),
+        void Function(Pointer<_ZsMuxSession>, int, int)
+      >('zs_mux_set_priority', isLeaf: true),
+      consumed = lib.lookupFunction<
+        Void Function(Pointer<_ZsMuxSession>, Uint32, Size),
+        void Function(Pointer<_ZsMuxSession>, int, int)
+      >('zs_mux_consumed', isLeaf: true),
+      respond = lib.lookupFunction<
+        Void Function(
+          Pointer<_ZsMuxSession>,
+          Uint32,
+          Uint64,
+          Pointer<Uint8>,
+          Size,
+        ),
+        void Function(Pointer<_ZsMuxSession>, int, int, Pointer<Uint8>, int)
+      >('zs_mux_respond', isLeaf: true),
+      writable = lib.lookupFunction<
+        Size Function(Pointer<_ZsMuxSession>, Uint32),
+        int Function(Pointer<_ZsMuxSession>, int)
+      >('zs_mux_writable', isLeaf: true),
+      write = lib.lookupFunction<
+        Size Function(Pointer<_ZsMuxSession>, Uint32, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsMuxSession>, int, Pointer<Uint8>, int)
+      >('zs_mux_write', isLeaf: true),
+      end = lib.lookupFunction<
+        Void Function(Pointer<_ZsMuxSession>, Uint32),
+        void Function(Pointer<_ZsMuxSession>, int)
+      >('zs_mux_end', isLeaf: true),
+      reset = lib.lookupFunction<
+        Void Function(Pointer<_ZsMuxSession>, Uint32, Uint32),
+        void Function(Pointer<_ZsMuxSession>, int, int)
+      >('zs_mux_reset', isLeaf: true),
+      ping = lib.lookupFunction<
+        Void Function(Pointer<_ZsMuxSession>, Uint64),
+        void Function(Pointer<_ZsMuxSession>, int)
+      >('zs_mux_ping', isLeaf: true),
+      goAway = lib.lookupFunction<
+        Void Function(Pointer<_ZsMuxSession>, Uint32),
+        void Function(Pointer<_ZsMuxSession>, int)
+      >('zs_mux_go_away', isLeaf: true),
+      pending = lib.lookupFunction<
+        Size Function(Pointer<_ZsMuxSession>),
+        int Function(Pointer<_ZsMuxSession>)
+      >('zs_mux_pending', isLeaf: true),
+      read = lib.lookupFunction<
+        Size Function(Pointer<_ZsMuxSession>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsMuxSession>, Pointer<Uint8>, int)
+      >('zs_mux_read', isLeaf: true),
+      openStreams = lib.lookupFunction<
+        Uint32 Function(Pointer<_ZsMuxSession>),
+        int Function(Pointer<_ZsMuxSession>)
+      >('zs_mux_open_streams', isLeaf: true);
+
+  static _MuxBindings? _instance;
+  static bool _resolved = false;
+
+  static _MuxBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _MuxBindings(lib);
+    } catch (e) {
+      print('⚠️ Multiplexed transfer unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// What a [NativeMuxSession] saw, mirroring `MuxEventType`.
+enum MuxEventType { hello, request, headers, data, end, reset, pong, goAway }
+
+/// Why a stream or session was stopped, mirroring `MuxError`.
+class MuxError {
+  static const int none = 0;
+  static const int protocol = 1;
+  static const int flowControl = 2;
+  static const int refused = 3;
+  static const int cancel = 4;
+  static const int notFound = 5;
+  static const int internal = 6;
+}
+
+/// One event. The meaning of [a] to [d] depends on [type]:
+///
+/// - hello: a is the peer's version
+/// - request: a index, b offset, c length, d priority
+/// - headers: a body size, [data] the metadata
+/// - data: [data] the body bytes
+/// - reset, goAway: a is a [MuxError] code
+/// - pong: a is the value that was pinged
+class MuxEvent {
+  final MuxEventType type;
+  final int stream;
+  final int a;
+  final int b;
+  final int c;
+  final int d;
+  final Uint8List data;
+
+  const MuxEvent(
+    this.type,
+    this.stream,
+    this.a,
+    this.b,
+    this.c,
+    this.d,
+    this.data,
+  );
+}
+
+/// Transfer protocol v2 framing, backed by `native/src/mux.cc`. Does no I/O:
+/// socket bytes go in through [receive], frames to send come out of [take]
+/// and what happened is read with [takeEvents].
+class NativeMuxSession implements Finalizable {
+  static const int version = 2;
+  static const int listIndex = 0xFFFFFFFF;
+  static const int toEnd = -1; // ~0 as a uint64
+  static const int defaultPriority = 3;
+  static const int lowestPriority = 7;
+  static const int maxStreams = 256;
+
+  final _MuxBindings _b;
+  final Pointer<_ZsMuxSession> _handle;
+  final Pointer<Uint64> _fields = calloc<Uint64>(5);
+  final Pointer<Pointer<Uint8>> _data = calloc<Pointer<Uint8>>();
+  final Pointer<Size> _len = calloc<Size>();
+  bool _disposed = false;
+
+  NativeMuxSession._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  static bool get isAvailable => _MuxBindings.instance != null;
+
+  /// Null when the native engine isn't available.
+  static NativeMuxSession? create({required bool server}) {
+    final b = _MuxBindings.instance;
+    if (b == null) return null;
+    return NativeMuxSession._(b, b.sessionNew(server ? 1 : 0));
+  }
+
+  /// Feeds socket bytes. False once the peer broke the protocol; send what
+  /// [take] still has (a GOAWAY) and close.
+  bool receive(List<int> bytes) {
+    if (_disposed) return false;
+    if (bytes.isEmpty) return true;
+    final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+    return _b.receive(_handle, data.address, data.length) != 0;
+  }
+
+  /// Events since the last call.
+  List<MuxEvent> takeEvents() {
+    final events = <MuxEvent>[];
+    if (_disposed) return events;
+    while (true) {
+      final type = _b.nextEvent(_handle, _fields, _data, _len);
+      if (type < 0) break;
+      final len = _len.value;
+      events.add(
+        MuxEvent(
+          MuxEventType.values[type],
+          _fields[0],
+          _fields[1],
+          _fields[2],
+          _fields[3],
+          _fields[4],
+          len == 0
+              ? Uint8List(0)
+              : Uint8List.fromList(_data.value.asTypedList(len)),
+        ),
+      );
+    }
+    return events;
+  }
+
+  /// Client: opens a stream for file [index] and returns its id, or 0 when
+  /// [maxStreams] are already open.
+  int request(
+    int index, {
+    int offset = 0,
+    int length = toEnd,
+    int priority = defaultPriority,
+  }) => _disposed ? 0 : _b.request(_handle, index, offset, length, priority);
+
+  void setPriority(int stream, int priority) {
+    if (!_disposed) _b.setPriority(_handle, stream, priority);
+  }
+
+  /// Client: body bytes written out, which lets the server send more.
+  void consumed(int stream, int length) {
+    if (!_disposed && length > 0) _b.consumed(_handle, stream, length);
+  }
+
+  /// Server: answers a request with the body size and JSON metadata.
+  void respond(int stream, int size, List<int> metadata) {
+    if (_disposed) return;
+    final data = Uint8List.fromList(metadata);
+    _b.respond(_handle, stream, size, data.address, data.length);
+  }
+
+  /// Server: body bytes that may still be queued on [stream].
+  int writable(int stream) => _disposed ? 0 : _b.writable(_handle, stream);
+
+  /// Server: queues up to [writable] bytes and returns how many it took.
+  int write(int stream, List<int> bytes) {
+    if (_disposed || bytes.isEmpty) return 0;
+    final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+    return _b.write(_handle, stream, data.address, data.length);
+  }
+
+  void end(int stream) {
+    if (!_disposed) _b.end(_handle, stream);
+  }
+
+  void reset(int stream, int code) {
+    if (!_disposed) _b.reset(_handle, stream, code);
+  }
+
+  void ping(int value) {
+    if (!_disposed) _b.ping(_handle, value);
+  }
+
+  void goAway(int code) {
+    if (!_disposed) _b.goAway(_handle, code);
+  }
+
+  int get openStreams => _disposed ? 0 : _b.openStreams(_handle);
+
+  /// Frames ready for the socket, possibly empty. With [headroom] and
+  /// [tailroom] the frames are read straight into a buffer with that much
+  /// space around them, so a record layer can frame them in place.
+  Uint8List take({int headroom = 0, int tailroom = 0}) {
+    if (_disposed) return Uint8List(0);
+    final pending = _b.pending(_handle);
+    if (pending == 0) return Uint8List(0);
+    final out = Uint8List(headroom + pending + tailroom);
+    final frames = Uint8List.sublistView(out, headroom);
+    final n = _b.read(_handle, frames.address, pending);
+    if (n == pending) return out;
+    return Uint8List.sublistView(out, 0, headroom + n + tailroom);
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.sessionFree(_handle.cast());
+    calloc.free(_fields);
+    calloc.free(_data);
+    calloc.free(_len);
+  }
+}
@@ -0,0 +1,67 @@
+import 'dart:async';
+import 'dart:ffi';
+import 'dart:typed_data';
+
+/// The C signature native code calls back to wake Dart: `void (*)(int64_t)`.
+typedef NativeWakeupFunction = Void Function(Int64 token);
+
+/// Hands native threads a function pointer that wakes Dart code waiting on
+/// them, so readers await the engine instead of polling it.
+///
+/// [wait] gives a fresh token to a native `*_notify` call along with
+/// [NativeWakeup]'s one listener; when the engine calls it back, from any
+/// thread, the token's future completes on this isolate's event loop.
+class NativeWakeup {
+  static NativeCallable<NativeWakeupFunction>? _callable;
+  static final Map<int, Completer<void>> _waiting = {};
+  static int _nextToken = 0;
+
+  static Pointer<NativeFunction<NativeWakeupFunction>> get _pointer {
+    var callable = _callable;
+    if (callable == null) {
+      callable = NativeCallable<NativeWakeupFunction>.listener(_fire);
+      // Waiting on the engine shouldn't keep the isolate from exiting
+      callable.keepIsolateAlive = false;
+      _callable = callable;
+    }
+    return callable.nativeFunction;
+  }
+
+  /// Completes once the native side calls the callback [arm] registers.
+  /// [arm] must make sure it gets called exactly once.
+  static Future<void> wait(
+    void Function(
+      Pointer<NativeFunction<NativeWakeupFunction>> callback,
+      int token,
+    )
+    arm,
+  ) {
+    final token = _nextToken++;
+    final completer = Completer<void>();
+    _waiting[token] = completer;
+    arm(_pointer, token);
+    return completer.future;
+  }
+
+  static void _fire(int token) => _waiting.remove(token)?.complete();
+}
+
+/// A native reader whose [read] comes back empty while a thread of its own
+/// is still loading the bytes, and whose [ready] says when to try again.
+abstract interface class NativeChunkSource {
+  int get remaining;
+  Uint8List? read(int max);
+  Future<void> ready();
+}
+
+extension NativeChunkSourceReads on NativeChunkSource {
+  /// Up to [max] bytes, awaiting the native thread when none are loaded
+  /// yet: empty only at the end, null if the file can't be read.
+  Future<Uint8List?> readReady(int max) async {
+    while (true) {
+      final chunk = read(max);
+      if (chunk == null || chunk.isNotEmpty || remaining == 0) return chunk;
+      await ready();
+    }
+  }
+}
@@ -0,0 +1,174 @@
+import 'dart:ffi';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsPathManager extends Opaque {}
+
+class _PathManagerBindings {
+  final Pointer<_ZsPathManager> Function() create;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) free;
+  final int Function(Pointer<_ZsPathManager>, Pointer<Utf8>, Pointer<Utf8>)
+  add;
+  final int Function(Pointer<_ZsPathManager>, int) assign;
+  final void Function(Pointer<_ZsPathManager>, int, int) delivered;
+  final void Function(Pointer<_ZsPathManager>, int, int, int) release;
+  final void Function(Pointer<_ZsPathManager>, int, Pointer<Uint64>) stats;
+
+  _PathManagerBindings(DynamicLibrary lib)
+    : create = lib.lookupFunction<
+        Pointer<_ZsPathManager> Function(),
+        Pointer<_ZsPathManager> Function()
+      >('zs_path_manager_new'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_path_manager_free'),
+      ),
+      free = lib
+          .lookup<NativeFinalizerFunction>('zs_path_manager_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      add = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsPathManager>, Pointer<Utf8>, Pointer<Utf8>),
+        int Function(Pointer<_ZsPathManager>, Pointer<Utf8>, Pointer<Utf8>)
+      >('zs_path_manager_add'),
+      assign = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsPathManager>, Uint64),
+        int Function(Pointer<_ZsPathManager>, int)
+      >('zs_path_manager_assign', isLeaf: true),
+      delivered = lib.lookupFunction<
+        Void Function(Pointer<_ZsPathManager>, Int32, Uint64),
+        void Function(Pointer<_ZsPathManager>, int, int)
+      >('zs_path_manager_delivered', isLeaf: true),
+      release = lib.lookupFunction<
+        Void Function(Pointer<_ZsPathManager>, Int32, Uint64, Int32),
+        void Function(Pointer<_ZsPathManager>, int, int, int)
+      >('zs_path_manager_release', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(Pointer<_ZsPathManager>, Int32, Pointer<Uint64>),
+        void Function(Pointer<_ZsPathManager>, int, Pointer<Uint64>)
+      >('zs_path_manager_stats', isLeaf: true);
+
+  static _PathManagerBindings? _instance;
+  static bool _resolved = false;
+
+  static _PathManagerBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _PathManagerBindings(lib);
+    } catch (e) {
+      print('⚠️ Path manager unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// One way to reach a peer: the local address to connect from and the
+/// peer's address on that network. An empty [local] lets routing choose.
+typedef NetworkPath = ({String local, String remote});
+
+/// Counters of one path of a [NativePathManager].
+class PathStats {
+  final int rate; // Bytes per second; 0 until measured
+  final int queued; // Assigned bytes not delivered yet
+  final int delivered;
+  final int inFlight; // Pieces
+  final int failures; // In a row
+  final bool up; // False while backing off or given up on
+  final int drops; // Ever; never cleared
+
+  const PathStats(
+    this.rate,
+    this.queued,
+    this.delivered,
+    this.inFlight,
+    this.failures,
+    this.up,
+    this.drops,
+  );
+}
+
+/// Spreads one download's pieces over several [NetworkPath]s to a peer,
+/// weighted by each path's measured throughput, backed by
+/// `native/src/path_manager.cc`.
+class NativePathManager implements Finalizable {
+  /// What [assign] returns while every path is backing off.
+  static const int allPathsDown = -1;
+
+  /// What [assign] returns once every path has been given up on.
+  static const int noPathsLeft = -2;
+
+  final _PathManagerBindings _b;
+  final Pointer<_ZsPathManager> _handle;
+  final List<NetworkPath> _paths = [];
+  bool _disposed = false;
+
+  NativePathManager._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// Null when the native engine isn't available.
+  static NativePathManager? create() {
+    final b = _PathManagerBindings.instance;
+    if (b == null) return null;
+    return NativePathManager._(b, b.create());
+  }
+
+  /// Adds [path] and returns its id, or the id it already has.
+  int add(NetworkPath path) {
+    final nativeLocal = path.local.toNativeUtf8();
+    final nativeRemote = path.remote.toNativeUtf8();
+    try {
+      final id = _b.add(_handle, nativeLocal, nativeRemote);
+      if (id == _paths.length) _paths.add(path);
+      return id;
+    } finally {
+      malloc.free(nativeLocal);
+      malloc.free(nativeRemote);
+    }
+  }
+
+  NetworkPath path(int id) => _paths[id];
+
+  int get length => _paths.length;
+
+  /// The path to fetch the next [bytes] over, or [allPathsDown] /
+  /// [noPathsLeft]. Every assignment must be [release]d.
+  int assign(int bytes) => _b.assign(_handle, bytes);
+
+  /// [bytes] more of [path]'s work arrived.
+  void delivered(int path, int bytes) => _b.delivered(_handle, path, bytes);
+
+  /// A piece on [path] is over with [undelivered] of its bytes missing;
+  /// [failed] marks the path down for a while.
+  void release(int path, int undelivered, {bool failed = false}) =>
+      _b.release(_handle, path, undelivered, failed ? 1 : 0);
+
+  PathStats stats(int path) {
+    final values = calloc<Uint64>(7);
+    try {
+      _b.stats(_handle, path, values);
+      return PathStats(
+        values[0],
+        values[1],
+        values[2],
+        values[3],
+        values[4],
+        values[5] != 0,
+        values[6],
+      );
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.free(_handle.cast());
+  }
+}
@@ -0,0 +1,246 @@
+import 'dart:ffi';
+import 'dart:io';
+
+import 'package:ffi/ffi.dart';
+
+import 'connection_pool.dart';
+import 'content_hash.dart';
+import 'zapshare_native.dart';
+
+final class _ZsRangeReceiver extends Opaque {}
+
+class _RangeReceiverBindings {
+  final Pointer<_ZsRangeReceiver> Function(
+    Pointer<Utf8>,
+    int,
+    Pointer<Utf8>,
+    int,
+    int,
+    int,
+    Pointer<Utf8>,
+    Pointer<Void>,
+    int,
+    Pointer<Utf8>,
+    Pointer<Void>,
+  )
+  start;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) free;
+  final void Function(Pointer<_ZsRangeReceiver>, int) setPaused;
+  final int Function(Pointer<_ZsRangeReceiver>) state;
+  final void Function(Pointer<_ZsRangeReceiver>, Pointer<Uint64>) stats;
+  final int Function(Pointer<Utf8>, int) preallocate;
+
+  _RangeReceiverBindings(DynamicLibrary lib)
+    : start = lib.lookupFunction<
+        Pointer<_ZsRangeReceiver> Function(
+          Pointer<Utf8>,
+          Uint16,
+          Pointer<Utf8>,
+          Uint64,
+          Uint64,
+          Int32,
+          Pointer<Utf8>,
+          Pointer<Void>,
+          Uint64,
+          Pointer<Utf8>,
+          Pointer<Void>,
+        ),
+        Pointer<_ZsRangeReceiver> Function(
+          Pointer<Utf8>,
+          int,
+          Pointer<Utf8>,
+          int,
+          int,
+          int,
+          Pointer<Utf8>,
+          Pointer<Void>,
+          int,
+          Pointer<Utf8>,
+          Pointer<Void>,
+        )
+      >('zs_range_receiver_start'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_range_receiver_free'),
+      ),
+      free = lib
+          .lookup<NativeFinalizerFunction>('zs_range_receiver_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      setPaused = lib.lookupFunction<
+        Void Function(Pointer<_ZsRangeReceiver>, Int32),
+        void Function(Pointer<_ZsRangeReceiver>, int)
+      >('zs_range_receiver_set_paused', isLeaf: true),
+      state = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsRangeReceiver>),
+        int Function(Pointer<_ZsRangeReceiver>)
+      >('zs_range_receiver_state', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(Pointer<_ZsRangeReceiver>, Pointer<Uint64>),
+        void Function(Pointer<_ZsRangeReceiver>, Pointer<Uint64>)
+      >('zs_range_receiver_stats', isLeaf: true),
+      preallocate = lib.lookupFunction<
+        Int32 Function(Pointer<Utf8>, Uint64),
+        int Function(Pointer<Utf8>, int)
+      >('zs_preallocate_file');
+
+  static _RangeReceiverBindings? _instance;
+  static bool _resolved = false;
+
+  static _RangeReceiverBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _RangeReceiverBindings(lib);
+    } catch (e) {
+      print('⚠️ Range receiver unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+enum ReceiveState { running, done, failed }
+
+/// Why a [NativeRangeReceiver] failed; mirrors `ReceiveError`.
+enum ReceiveError { none, connect, status, length, closed, io, cancelled }
+
+/// Counters of a [NativeRangeReceiver], all counted from its start offset.
+class ReceiveStats {
+  final int received;
+  final int durable; // Of received, synced to storage
+  final int syncs;
+  final int cpuNs; // CPU time of the receiving thread
+  final bool spliced; // Went socket -> pipe -> file without a copy
+  final bool warm; // Sent on a connection from the pool
+
+  const ReceiveStats(
+    this.received,
+    this.durable,
+    this.syncs,
+    this.cpuNs,
+    this.spliced,
+    this.warm,
+  );
+}
+
+/// One HTTP GET received straight into a file by a native thread, backed
+/// by `native/src/range_receiver.cc`.
+class NativeRangeReceiver implements Finalizable {
+  /// Sync every four digest chunks, so the journal trails by at most that.
+  static const int defaultSyncEvery = 4 * ChunkDigests.defaultChunkSize;
+
+  final _RangeReceiverBindings _b;
+  final Pointer<_ZsRangeReceiver> _handle;
+  bool _disposed = false;
+
+  NativeRangeReceiver._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// False where downloads have to go through Dart, including Windows.
+  static bool get isAvailable =>
+      !Platform.isWindows && _RangeReceiverBindings.instance != null;
+
+  /// Starts fetching bytes [start, end) of [url] into the same offsets of
+  /// [path]. [ranged] false sends a plain GET for the whole file. Bytes
+  /// are fed to [hasher] as they land. [bindAddress] picks the local
+  /// interface to connect from; without it a warm connection is taken
+  /// from [pool] when it has one. Null if the receiver isn't available or
+  /// [path] can't be opened.
+  static NativeRangeReceiver? start({
+    required Uri url,
+    required int start,
+    required int end,
+    required String path,
+    bool ranged = true,
+    NativeChunkHasher? hasher,
+    int syncEvery = defaultSyncEvery,
+    String? bindAddress,
+    NativeConnectionPool? pool,
+  }) {
+    final b = _RangeReceiverBindings.instance;
+    if (b == null || !isAvailable) return null;
+    final target = url.hasQuery ? '${url.path}?${url.query}' : url.path;
+    final nativeHost = url.host.toNativeUtf8();
+    final nativeTarget = target.toNativeUtf8();
+    final nativePath = path.toNativeUtf8();
+    final nativeBind = bindAddress?.toNativeUtf8() ?? nullptr;
+    try {
+      final handle = b.start(
+        nativeHost,
+        url.port,
+        nativeTarget,
+        start,
+        end,
+        ranged ? 1 : 0,
+        nativePath,
+        hasher?.handle ?? nullptr,
+        syncEvery,
+        nativeBind,
+        pool?.handle ?? nullptr,
+      );
+      return handle == nullptr ? null : NativeRangeReceiver._(b, handle);
+    } finally {
+      malloc.free(nativeHost);
+      malloc.free(nativeTarget);
+      malloc.free(nativePath);
+      if (nativeBind != nullptr) malloc.free(nativeBind);
+    }
+  }
+
+  /// Reserves [size] bytes for the file at [path], creating it if needed,
+  /// so a download can't run out of space halfway. Never shrinks the file;
+  /// false if the engine is missing or storage refused.
+  static bool preallocate(String path, int size) {
+    final b = _RangeReceiverBindings.instance;
+    if (b == null) return false;
+    final nativePath = path.toNativeUtf8();
+    try {
+      return b.preallocate(nativePath, size) != 0;
+    } finally {
+      malloc.free(nativePath);
+    }
+  }
+
+  int get _packed => _disposed ? 0 : _b.state(_handle);
+
+  ReceiveState get state =>
+      _disposed ? ReceiveState.failed : ReceiveState.values[_packed & 0xff];
+
+  ReceiveError get error => ReceiveError.values[(_packed >> 8) & 0xff];
+
+  /// The sender's status code once its headers arrived, else 0.
+  int get httpStatus => _packed >> 16;
+
+  /// While paused nothing is read, so TCP flow control holds the sender.
+  set paused(bool paused) {
+    if (!_disposed) _b.setPaused(_handle, paused ? 1 : 0);
+  }
+
+  ReceiveStats get stats {
+    if (_disposed) return const ReceiveStats(0, 0, 0, 0, false, false);
+    final values = calloc<Uint64>(6);
+    try {
+      _b.stats(_handle, values);
+      return ReceiveStats(
+        values[0],
+        values[1],
+        values[2],
+        values[3],
+        values[4] != 0,
+        values[5] != 0,
+      );
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  /// Cancels the download if it's still running.
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.free(_handle.cast());
+  }
+}
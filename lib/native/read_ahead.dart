@@ -0,0 +1,227 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'native_wakeup.dart';
+import 'zapshare_native.dart';
+
+final class _ZsReadAhead extends Opaque {}
+
+class _ReadAheadBindings {
+  final Pointer<_ZsReadAhead> Function(Pointer<Utf8>, int, int, int, int)
+  open;
+  final Pointer<_ZsReadAhead> Function(int, int, int, int, int) openFd;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) free;
+  final int Function(Pointer<_ZsReadAhead>, Pointer<Uint8>, int) read;
+  final void Function(
+    Pointer<_ZsReadAhead>,
+    Pointer<NativeFunction<NativeWakeupFunction>>,
+    int,
+  )
+  notify;
+  final int Function(Pointer<_ZsReadAhead>) remaining;
+  final void Function(Pointer<_ZsReadAhead>, Pointer<Uint64>) stats;
+
+  _ReadAheadBindings(DynamicLibrary lib)
+    : open = lib.lookupFunction<
+        Pointer<_ZsReadAhead> Function(
+          Pointer<Utf8>,
+          Uint64,
+          Uint64,
+          Uint32,
+          Uint32,
+        ),
+        Pointer<_ZsReadAhead> Function(Pointer<Utf8>, int, int, int, int)
+      >('zs_read_ahead_open'),
+      openFd = lib.lookupFunction<
+        Pointer<_ZsReadAhead> Function(Int32, Uint64, Uint64, Uint32, Uint32),
+        Pointer<_ZsReadAhead> Function(int, int, int, int, int)
+      >('zs_read_ahead_open_fd'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_read_ahead_free'),
+      ),
+      free = lib
+          .lookup<NativeFinalizerFunction>('zs_read_ahead_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      read = lib.lookupFunction<
+        Int64 Function(Pointer<_ZsReadAhead>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsReadAhead>, Pointer<Uint8>, int)
+      >('zs_read_ahead_read', isLeaf: true),
+      notify = lib.lookupFunction<
+        Void Function(
+          Pointer<_ZsReadAhead>,
+          Pointer<NativeFunction<NativeWakeupFunction>>,
+          Int64,
+        ),
+        void Function(
+          Pointer<_ZsReadAhead>,
+          Pointer<NativeFunction<NativeWakeupFunction>>,
+          int,
+        )
+      >('zs_read_ahead_notify'),
+      remaining = lib.lookupFunction<
+        Uint64 Function(Pointer<_ZsReadAhead>),
+        int Function(Pointer<_ZsReadAhead>)
+      >('zs_read_ahead_remaining', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(Pointer<_ZsReadAhead>, Pointer<Uint64>),
+        void Function(Pointer<_ZsReadAhead>, Pointer<Uint64>)
+      >('zs_read_ahead_stats', isLeaf: true);
+
+  static _ReadAheadBindings? _instance;
+  static bool _resolved = false;
+
+  static _ReadAheadBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _ReadAheadBindings(lib);
+    } catch (e) {
+      print('⚠️ Read-ahead unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Queue counters of a [NativeReadAhead], for tuning its depth.
+class ReadAheadStats {
+  final int diskBytes;
+  final int diskReads;
+  final double averageDepth; // Filled buffers waiting, per read
+  final int maxDepth;
+  final int consumerStalls; // Reads that found nothing loaded yet
+  final int readerStalls; // Times every buffer was full
+
+  const ReadAheadStats(
+    this.diskBytes,
+    this.diskReads,
+    this.averageDepth,
+    this.maxDepth,
+    this.consumerStalls,
+    this.readerStalls,
+  );
+
+  @override
+  String toString() =>
+      'depth ${averageDepth.toStringAsFixed(1)} (max $maxDepth), '
+      '$consumerStalls disk stalls, $readerStalls socket stalls, '
+      '$diskReads reads';
+}
+
+/// A file read ahead of its consumer by a native thread, backed by
+/// `native/src/read_ahead.cc`.
+class NativeReadAhead implements Finalizable, NativeChunkSource {
+  static const int _wholeFile = -1; // UINT64_MAX as a Uint64
+
+  final _ReadAheadBindings _b;
+  final Pointer<_ZsReadAhead> _handle;
+  Uint8List? _spare; // Kept across reads that came back empty
+  bool _disposed = false;
+
+  NativeReadAhead._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  static bool get isAvailable => _ReadAheadBindings.instance != null;
+
+  /// Reads bytes [start, end) of the file at [path] through [depth]
+  /// buffers of [bufferSize]; 0 takes the native defaults. Null if the
+  /// engine isn't available or the file can't be opened.
+  static NativeReadAhead? open(
+    String path, {
+    int start = 0,
+    int? end,
+    int depth = 0,
+    int bufferSize = 0,
+  }) {
+    final b = _ReadAheadBindings.instance;
+    if (b == null) return null;
+    final nativePath = path.toNativeUtf8();
+    try {
+      return _wrap(
+        b,
+        b.open(nativePath, start, end ?? _wholeFile, depth, bufferSize),
+      );
+    } finally {
+      malloc.free(nativePath);
+    }
+  }
+
+  /// The same for a descriptor the platform opened; it may be a pipe.
+  /// Takes ownership of [fd].
+  static NativeReadAhead? openFd(
+    int fd, {
+    int start = 0,
+    int? end,
+    int depth = 0,
+    int bufferSize = 0,
+  }) {
+    final b = _ReadAheadBindings.instance;
+    if (b == null) return null;
+    return _wrap(b, b.openFd(fd, start, end ?? _wholeFile, depth, bufferSize));
+  }
+
+  static NativeReadAhead? _wrap(
+    _ReadAheadBindings b,
+    Pointer<_ZsReadAhead> handle,
+  ) => handle == nullptr ? null : NativeReadAhead._(b, handle);
+
+  /// Bytes left before the end of the range.
+  @override
+  int get remaining => _disposed ? 0 : _b.remaining(_handle);
+
+  /// Up to [max] bytes from the reader's position: empty while they are
+  /// still being loaded (or at the end), null if the file can't be read.
+  @override
+  Uint8List? read(int max) {
+    if (_disposed) return null;
+    final spare = _spare;
+    final out = spare != null && spare.length == max ? spare : Uint8List(max);
+    final n = _b.read(_handle, out.address, max);
+    if (n < 0) return null;
+    if (n == 0) {
+      _spare = out;
+      return Uint8List(0);
+    }
+    _spare = null;
+    return n == max ? out : Uint8List.sublistView(out, 0, n);
+  }
+
+  /// Completes once the next [read] is worth trying, after one came back
+  /// empty while its buffer was being filled.
+  @override
+  Future<void> ready() {
+    if (_disposed) return Future.value();
+    return NativeWakeup.wait(
+      (callback, token) => _b.notify(_handle, callback, token),
+    );
+  }
+
+  ReadAheadStats get stats {
+    final values = calloc<Uint64>(7);
+    try {
+      _b.stats(_handle, values);
+      return ReadAheadStats(
+        values[0],
+        values[1],
+        values[3] == 0 ? 0 : values[2] / values[3],
+        values[4],
+        values[5],
+        values[6],
+      );
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.free(_handle.cast());
+  }
+}
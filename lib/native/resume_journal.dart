@@ -0,0 +1,290 @@
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'content_hash.dart';
+import 'zapshare_native.dart';
+
+final class _ZsResumeJournal extends Opaque {}
+
+class _ResumeJournalBindings {
+  final Pointer<_ZsResumeJournal> Function(
+    Pointer<Utf8>,
+    Pointer<Uint8>,
+    int,
+    int,
+    int,
+    int,
+    Pointer<Uint8>,
+    Pointer<Int32>,
+  )
+  open;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) close;
+  final int Function(Pointer<_ZsResumeJournal>) chunkCount;
+  final int Function(Pointer<_ZsResumeJournal>) completed;
+  final int Function(Pointer<_ZsResumeJournal>, int) isDone;
+  final void Function(Pointer<_ZsResumeJournal>, int) mark;
+  final void Function(Pointer<_ZsResumeJournal>, int) clear;
+  final void Function(Pointer<_ZsResumeJournal>, Pointer<Uint8>) copyBitmap;
+  final int Function(Pointer<_ZsResumeJournal>) sync;
+  final int Function(Pointer<Utf8>) remove;
+
+  _ResumeJournalBindings(DynamicLibrary lib)
+    : open = lib.lookupFunction<
+        Pointer<_ZsResumeJournal> Function(
+          Pointer<Utf8>,
+          Pointer<Uint8>,
+          Size,
+          Uint64,
+          Int64,
+          Uint32,
+          Pointer<Uint8>,
+          Pointer<Int32>,
+        ),
+        Pointer<_ZsResumeJournal> Function(
+          Pointer<Utf8>,
+          Pointer<Uint8>,
+          int,
+          int,
+          int,
+          int,
+          Pointer<Uint8>,
+          Pointer<Int32>,
+        )
+      >('zs_journal_open'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_journal_close'),
+      ),
+      close = lib
+          .lookup<NativeFinalizerFunction>('zs_journal_close')
+          .asFunction<void Function(Pointer<Void>)>(),
+      chunkCount = lib.lookupFunction<
+        Uint32 Function(Pointer<_ZsResumeJournal>),
+        int Function(Pointer<_ZsResumeJournal>)
+      >('zs_journal_chunk_count', isLeaf: true),
+      completed = lib.lookupFunction<
+        Uint32 Function(Pointer<_ZsResumeJournal>),
+        int Function(Pointer<_ZsResumeJournal>)
+      >('zs_journal_completed', isLeaf: true),
+      isDone = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsResumeJournal>, Uint32),
+        int Function(Pointer<_ZsResumeJournal>, int)
+      >('zs_journal_is_done', isLeaf: true),
+      mark = lib.lookupFunction<
+        Void Function(Pointer<_ZsResumeJournal>, Uint32),
+        void Function(Pointer<_ZsResumeJournal>, int)
+      >('zs_journal_mark', isLeaf: true),
+      clear = lib.lookupFunction<
+        Void Function(Pointer<_ZsResumeJournal>, Uint32),
+        void Function(Pointer<_ZsResumeJournal>, int)
+      >('zs_journal_clear', isLeaf: true),
+      copyBitmap = lib.lookupFunction<
+        Void Function(Pointer<_ZsResumeJournal>, Pointer<Uint8>),
+        void Function(Pointer<_ZsResumeJournal>, Pointer<Uint8>)
+      >('zs_journal_copy_bitmap', isLeaf: true),
+      sync = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsResumeJournal>),
+        int Function(Pointer<_ZsResumeJournal>)
+      >('zs_journal_sync'),
+      remove = lib.lookupFunction<
+        Int32 Function(Pointer<Utf8>),
+        int Function(Pointer<Utf8>)
+      >('zs_journal_remove');
+
+  static _ResumeJournalBindings? _instance;
+  static bool _resolved = false;
+
+  static _ResumeJournalBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _ResumeJournalBindings(lib);
+    } catch (e) {
+      print('⚠️ Resume journal unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Crash-safe record of which chunks of a download have landed, backed by
+/// `native/src/resume_journal.cc`.
+///
+/// The journal is a memory-mapped `<dest>.zsj` sidecar. Bits are set as soon
+/// as a chunk has been written, so if the app is killed the next attempt
+/// reopens the journal and fetches only the [missingRanges].
+class NativeResumeJournal implements Finalizable {
+  static const String suffix = '.zsj';
+
+  final _ResumeJournalBindings _b;
+  final Pointer<_ZsResumeJournal> _handle;
+  final int fileSize;
+  final int chunkSize;
+
+  /// True when progress from an earlier attempt was kept.
+  final bool resumed;
+  bool _closed = false;
+
+  NativeResumeJournal._(
+    this._b,
+    this._handle,
+    this.fileSize,
+    this.chunkSize,
+    this.resumed,
+  ) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// Opens or creates the journal for [destination]; it is reset unless
+  /// peer, size and modification time match the stored ones. [digest] is
+  /// stored once known, and only resets the journal when it differs from
+  /// a digest stored by an earlier attempt.
+  ///
+  /// Returns null when the native engine isn't available.
+  static NativeResumeJournal? open({
+    required String destination,
+    required String peerId,
+    required int fileSize,
+    int modifiedMs = 0,
+    String? digest,
+    int chunkSize = ChunkDigests.defaultChunkSize,
+  }) {
+    final b = _ResumeJournalBindings.instance;
+    if (b == null || fileSize <= 0) return null;
+
+    final path = (destination + suffix).toNativeUtf8();
+    final peer = utf8.encode(peerId);
+    final peerPtr = calloc<Uint8>(peer.isEmpty ? 1 : peer.length);
+    final digestPtr = digest != null ? calloc<Uint8>(32) : nullptr;
+    final resumedPtr = calloc<Int32>();
+    try {
+      peerPtr.asTypedList(peer.length).setAll(0, peer);
+      if (digest != null) {
+        for (int i = 0; i < 32; i++) {
+          final byte = digest.substring(i * 2, i * 2 + 2);
+          digestPtr[i] = int.parse(byte, radix: 16);
+        }
+      }
+      final handle = b.open(
+        path,
+        peerPtr,
+        peer.length,
+        fileSize,
+        modifiedMs,
+        chunkSize,
+        digestPtr,
+        resumedPtr,
+      );
+      if (handle == nullptr) return null;
+      return NativeResumeJournal._(
+        b,
+        handle,
+        fileSize,
+        chunkSize,
+        resumedPtr.value != 0,
+      );
+    } finally {
+      calloc.free(path);
+      calloc.free(peerPtr);
+      if (digestPtr != nullptr) calloc.free(digestPtr);
+      calloc.free(resumedPtr);
+    }
+  }
+
+  /// Deletes the journal for [destination], if any.
+  static void delete(String destination) {
+    final b = _ResumeJournalBindings.instance;
+    if (b == null) return;
+    final path = (destination + suffix).toNativeUtf8();
+    try {
+      b.remove(path);
+    } finally {
+      calloc.free(path);
+    }
+  }
+
+  int get chunkCount => _closed ? 0 : _b.chunkCount(_handle);
+  int get completedChunks => _closed ? 0 : _b.completed(_handle);
+  bool get isComplete => completedChunks == chunkCount;
+
+  bool isChunkDone(int index) => !_closed && _b.isDone(_handle, index) != 0;
+
+  void markChunk(int index) {
+    if (!_closed) _b.mark(_handle, index);
+  }
+
+  void clearChunk(int index) {
+    if (!_closed) _b.clear(_handle, index);
+  }
+
+  /// Bytes already on disk according to the journal.
+  int get completedBytes {
+    int total = 0;
+    for (final i in doneChunks()) {
+      total += _chunkLength(i);
+    }
+    return total;
+  }
+
+  /// Indices of chunks that have landed.
+  List<int> doneChunks() {
+    final bits = _bitmap();
+    return [
+      for (int i = 0; i < chunkCount; i++)
+        if ((bits[i >> 3] >> (i & 7)) & 1 != 0) i,
+    ];
+  }
+
+  /// Byte ranges (inclusive `start`/`end`) still to fetch, with runs of
+  /// missing chunks coalesced.
+  List<({int start, int end})> missingRanges() {
+    final bits = _bitmap();
+    final ranges = <({int start, int end})>[];
+    int? runStart;
+    for (int i = 0; i <= chunkCount; i++) {
+      final missing = i < chunkCount && (bits[i >> 3] >> (i & 7)) & 1 == 0;
+      if (missing) {
+        runStart ??= i;
+      } else if (runStart != null) {
+        ranges.add((
+          start: runStart * chunkSize,
+          end: i * chunkSize > fileSize ? fileSize - 1 : i * chunkSize - 1,
+        ));
+        runStart = null;
+      }
+    }
+    return ranges;
+  }
+
+  /// Pushes the bitmap to storage; marks already survive an app kill.
+  void sync() {
+    if (!_closed) _b.sync(_handle);
+  }
+
+  void close() {
+    if (_closed) return;
+    _closed = true;
+    _b.finalizer.detach(this);
+    _b.close(_handle.cast());
+  }
+
+  int _chunkLength(int index) {
+    final start = index * chunkSize;
+    return start + chunkSize > fileSize ? fileSize - start : chunkSize;
+  }
+
+  Uint8List _bitmap() {
+    final n = (chunkCount + 7) >> 3;
+    final out = calloc<Uint8>(n == 0 ? 1 : n);
+    try {
+      _b.copyBitmap(_handle, out);
+      return Uint8List.fromList(out.asTypedList(n));
+    } finally {
+      calloc.free(out);
+    }
+  }
+}
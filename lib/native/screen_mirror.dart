@@ -0,0 +1,175 @@
+import 'dart:ffi';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsScreenMirror extends Opaque {}
+
+class _ScreenMirrorBindings {
+  final int Function() available;
+  final Pointer<_ZsScreenMirror> Function(Pointer<Utf8>, int, int, int, int)
+  start;
+  final int Function(Pointer<_ZsScreenMirror>) port;
+  final void Function(Pointer<_ZsScreenMirror>, Pointer<Uint64>) stats;
+  final void Function(Pointer<_ZsScreenMirror>) stop;
+
+  _ScreenMirrorBindings(DynamicLibrary lib)
+    : available = lib.lookupFunction<Int32 Function(), int Function()>(
+        'zs_screen_mirror_available',
+        isLeaf: true,
+      ),
+      start = lib.lookupFunction<
+        Pointer<_ZsScreenMirror> Function(
+          Pointer<Utf8>,
+          Uint16,
+          Int32,
+          Int32,
+          Int32,
+        ),
+        Pointer<_ZsScreenMirror> Function(Pointer<Utf8>, int, int, int, int)
+      >('zs_screen_mirror_start'),
+      port = lib.lookupFunction<
+        Uint16 Function(Pointer<_ZsScreenMirror>),
+        int Function(Pointer<_ZsScreenMirror>)
+      >('zs_screen_mirror_port', isLeaf: true),
+      stats = lib.lookupFunction<
+        Void Function(Pointer<_ZsScreenMirror>, Pointer<Uint64>),
+        void Function(Pointer<_ZsScreenMirror>, Pointer<Uint64>)
+      >('zs_screen_mirror_stats', isLeaf: true),
+      stop = lib.lookupFunction<
+        Void Function(Pointer<_ZsScreenMirror>),
+        void Function(Pointer<_ZsScreenMirror>)
+      >('zs_screen_mirror_stop');
+
+  static _ScreenMirrorBindings? _instance;
+  static bool _resolved = false;
+
+  static _ScreenMirrorBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      final b = _ScreenMirrorBindings(lib);
+      if (b.available() != 0) _instance = b;
+    } catch (e) {
+      print('⚠️ Screen mirror unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Counters of a [NativeScreenMirror].
+class ScreenMirrorStats {
+  final int captured;
+  final int unchanged; // Captured, but nothing changed: not encoded
+  final int encoded;
+  final int resent; // Sent again so viewers don't time out
+  final int failed;
+  final int bandsEncoded;
+  final int bandsReused; // Copied from the previous frame
+  final int captureNs;
+  final int encodeNs;
+  final int lastFrameBytes;
+  final int clients; // Viewers connected now
+  final int framesSent;
+  final int framesSkipped; // Published while a viewer was still busy
+  final int bytesSent;
+
+  const ScreenMirrorStats(
+    this.captured,
+    this.unchanged,
+    this.encoded,
+    this.resent,
+    this.failed,
+    this.bandsEncoded,
+    this.bandsReused,
+    this.captureNs,
+    this.encodeNs,
+    this.lastFrameBytes,
+    this.clients,
+    this.framesSent,
+    this.framesSkipped,
+    this.bytesSent,
+  );
+
+  double get averageEncodeMs => encoded == 0 ? 0 : encodeNs / encoded / 1e6;
+}
+
+/// Mirrors this desktop's screen, backed by `native/src/mirror_sender.cc`:
+/// the screen is captured over X11 shared memory, only the parts that
+/// changed are encoded, and frames are served as the MJPEG stream that
+/// [ScreenMirrorViewerScreen] and the TV receiver read, or, to a viewer
+/// that asks for one, as a stream of just the tiles that changed. Send a
+/// viewer `http://<ip>:$port/stream` with
+/// `DeviceDiscoveryService.sendScreenMirrorRequest`.
+class NativeScreenMirror {
+  final _ScreenMirrorBindings _b;
+  final Pointer<_ZsScreenMirror> _handle;
+  final int port;
+  bool _stopped = false;
+
+  NativeScreenMirror._(this._b, this._handle, this.port);
+
+  /// Whether this desktop can be mirrored (Linux under X11, with the
+  /// native engine built with Xlib and libjpeg).
+  static bool get isAvailable => _ScreenMirrorBindings.instance != null;
+
+  /// Starts capturing [display] (null for `$DISPLAY`) and listening on
+  /// [port] (0 for any free one). Null when the screen can't be captured,
+  /// e.g. in a Wayland session without XWayland.
+  static NativeScreenMirror? start({
+    String? display,
+    int port = 0,
+    int fps = 30,
+    int quality = 70,
+  }) {
+    final b = _ScreenMirrorBindings.instance;
+    if (b == null) return null;
+    final nativeDisplay = display?.toNativeUtf8() ?? nullptr;
+    final Pointer<_ZsScreenMirror> handle;
+    try {
+      handle = b.start(nativeDisplay, port, fps, quality, 0);
+    } finally {
+      if (nativeDisplay != nullptr) malloc.free(nativeDisplay);
+    }
+    if (handle == nullptr) return null;
+    return NativeScreenMirror._(b, handle, b.port(handle));
+  }
+
+  ScreenMirrorStats get stats {
+    if (_stopped) {
+      return const ScreenMirrorStats(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    }
+    final values = calloc<Uint64>(14);
+    try {
+      _b.stats(_handle, values);
+      return ScreenMirrorStats(
+        values[0],
+        values[1],
+        values[2],
+        values[3],
+        values[4],
+        values[5],
+        values[6],
+        values[7],
+        values[8],
+        values[9],
+        values[10],
+        values[11],
+        values[12],
+        values[13],
+      );
+    } finally {
+      calloc.free(values);
+    }
+  }
+
+  /// Disconnects every viewer and stops capturing.
+  void stop() {
+    if (_stopped) return;
+    _stopped = true;
+    _b.stop(_handle);
+  }
+}
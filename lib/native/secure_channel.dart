@@ -0,0 +1,219 @@
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsSecureChannel extends Opaque {}
+
+class _SecureBindings {
+  final int Function() supported;
+  final Pointer<_ZsSecureChannel> Function(
+    int,
+    Pointer<Uint8>,
+    int,
+    Pointer<Uint8>,
+    int,
+  )
+  channelNew;
+  final NativeFinalizer finalizer;
+  final void Function(Pointer<Void>) channelFree;
+  final int Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, int) receive;
+  final int Function(Pointer<_ZsSecureChannel>) pending;
+  final int Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, int) read;
+  final int Function(Pointer<_ZsSecureChannel>) state;
+  final int Function(Pointer<_ZsSecureChannel>) cipher;
+  final int Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, int) seal;
+  final int Function(Pointer<Uint8>) recordSize;
+  final int Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, int) open;
+
+  _SecureBindings(DynamicLibrary lib)
+    : supported = lib.lookupFunction<Uint32 Function(), int Function()>(
+        'zs_aead_supported',
+        isLeaf: true,
+      ),
+      channelNew = lib.lookupFunction<
+        Pointer<_ZsSecureChannel> Function(
+          Int32,
+          Pointer<Uint8>,
+          Size,
+          Pointer<Uint8>,
+          Uint32,
+        ),
+        Pointer<_ZsSecureChannel> Function(
+          int,
+          Pointer<Uint8>,
+          int,
+          Pointer<Uint8>,
+          int,
+        )
+      >('zs_secure_new'),
+      finalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_secure_free'),
+      ),
+      channelFree = lib
+          .lookup<NativeFinalizerFunction>('zs_secure_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      receive = lib.lookupFunction<
+        Size Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, int)
+      >('zs_secure_receive', isLeaf: true),
+      pending = lib.lookupFunction<
+        Size Function(Pointer<_ZsSecureChannel>),
+        int Function(Pointer<_ZsSecureChannel>)
+      >('zs_secure_pending', isLeaf: true),
+      read = lib.lookupFunction<
+        Size Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, int)
+      >('zs_secure_read', isLeaf: true),
+      state = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsSecureChannel>),
+        int Function(Pointer<_ZsSecureChannel>)
+      >('zs_secure_state', isLeaf: true),
+      cipher = lib.lookupFunction<
+        Uint32 Function(Pointer<_ZsSecureChannel>),
+        int Function(Pointer<_ZsSecureChannel>)
+      >('zs_secure_cipher', isLeaf: true),
+      seal = lib.lookupFunction<
+        Size Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, int)
+      >('zs_secure_seal', isLeaf: true),
+      recordSize = lib.lookupFunction<
+        Size Function(Pointer<Uint8>),
+        int Function(Pointer<Uint8>)
+      >('zs_secure_record_size', isLeaf: true),
+      open = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsSecureChannel>, Pointer<Uint8>, int)
+      >('zs_secure_open', isLeaf: true);
+
+  static _SecureBindings? _instance;
+  static bool _resolved = false;
+
+  static _SecureBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _SecureBindings(lib);
+    } catch (e) {
+      print('⚠️ Encrypted transport unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Pairing handshake and AEAD records, backed by
+/// `native/src/secure_channel.cc`. Does no I/O: handshake bytes go in
+/// through [receive] and out through [take]; records are sealed and opened
+/// in the buffers they live in.
+class NativeSecureChannel implements Finalizable {
+  static const int version = 1;
+  static const int aes256Gcm = 1;
+  static const int chaCha20Poly1305 = 2;
+  static const int recordHeader = 4;
+  static const int tagSize = 16;
+  static const int maxRecord = 1024 * 1024; // Plaintext bytes
+  static const int _entropySize = 64;
+
+  final _SecureBindings _b;
+  final Pointer<_ZsSecureChannel> _handle;
+  bool _disposed = false;
+
+  NativeSecureChannel._(this._b, this._handle) {
+    _b.finalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  static bool get isAvailable => _SecureBindings.instance != null;
+
+  /// Mask of the ciphers this machine runs: ChaCha20-Poly1305 always,
+  /// AES-256-GCM when the CPU has AES instructions.
+  static int get supportedCiphers => _SecureBindings.instance?.supported() ?? 0;
+
+  /// Starts a handshake keyed by [code]. Null when the native engine isn't
+  /// available.
+  static NativeSecureChannel? create({
+    required bool server,
+    required String code,
+  }) {
+    final b = _SecureBindings.instance;
+    if (b == null) return null;
+    final random = Random.secure();
+    final codeBytes = utf8.encode(code);
+    final entropy = calloc<Uint8>(_entropySize);
+    final codePtr = calloc<Uint8>(codeBytes.isEmpty ? 1 : codeBytes.length);
+    try {
+      for (int i = 0; i < _entropySize; i++) {
+        entropy[i] = random.nextInt(256);
+      }
+      codePtr.asTypedList(codeBytes.length).setAll(0, codeBytes);
+      final handle = b.channelNew(
+        server ? 1 : 0,
+        codePtr,
+        codeBytes.length,
+        entropy,
+        0xFFFFFFFF,
+      );
+      return NativeSecureChannel._(b, handle);
+    } finally {
+      entropy.asTypedList(_entropySize).fillRange(0, _entropySize, 0);
+      calloc.free(entropy);
+      calloc.free(codePtr);
+    }
+  }
+
+  /// Feeds handshake bytes and returns how many it used; anything after
+  /// that is already records.
+  int receive(Uint8List bytes) {
+    if (_disposed || bytes.isEmpty) return 0;
+    return _b.receive(_handle, bytes.address, bytes.length);
+  }
+
+  /// Handshake bytes for the socket, possibly empty.
+  Uint8List take() {
+    if (_disposed) return Uint8List(0);
+    final pending = _b.pending(_handle);
+    if (pending == 0) return Uint8List(0);
+    final out = Uint8List(pending);
+    final n = _b.read(_handle, out.address, pending);
+    return n == pending ? out : Uint8List.sublistView(out, 0, n);
+  }
+
+  bool get established => !_disposed && _b.state(_handle) == 1;
+  bool get failed => _disposed || _b.state(_handle) < 0;
+
+  /// The agreed cipher, [aes256Gcm] or [chaCha20Poly1305].
+  int get cipher => _disposed ? 0 : _b.cipher(_handle);
+
+  /// Seals the [length] bytes at [recordHeader] in [record], which must have
+  /// [tagSize] bytes of room after them. Returns the record size, or 0 if
+  /// the channel isn't established.
+  int seal(Uint8List record, int length) {
+    if (_disposed) return 0;
+    return _b.seal(_handle, record.address, length);
+  }
+
+  /// The size of the record whose header starts at [offset], or 0 if the
+  /// header is invalid.
+  int recordSize(Uint8List bytes, int offset) {
+    if (_disposed) return 0;
+    return _b.recordSize(Uint8List.sublistView(bytes, offset).address);
+  }
+
+  /// Opens a whole record in place. False means the data was tampered with.
+  bool open(Uint8List record) {
+    if (_disposed) return false;
+    return _b.open(_handle, record.address, record.length) != 0;
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.finalizer.detach(this);
+    _b.channelFree(_handle.cast());
+  }
+}
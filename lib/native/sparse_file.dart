@@ -0,0 +1,162 @@
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+class _SparseFileBindings {
+  final int Function(Pointer<Utf8>, Pointer<Uint8>, int) extentMap;
+  final int Function(Pointer<Utf8>, Pointer<Uint8>, int) prepare;
+
+  _SparseFileBindings(DynamicLibrary lib)
+    : extentMap = lib.lookupFunction<
+        Int64 Function(Pointer<Utf8>, Pointer<Uint8>, Size),
+        int Function(Pointer<Utf8>, Pointer<Uint8>, int)
+      >('zs_extent_map'),
+      prepare = lib.lookupFunction<
+        Int32 Function(Pointer<Utf8>, Pointer<Uint8>, Size),
+        int Function(Pointer<Utf8>, Pointer<Uint8>, int)
+      >('zs_prepare_sparse_file');
+
+  static _SparseFileBindings? _instance;
+  static bool _resolved = false;
+
+  static _SparseFileBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _SparseFileBindings(lib);
+    } catch (e) {
+      print('⚠️ Sparse files unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// Where a sparse file keeps its data; everything else is a hole.
+///
+/// Mirrors the map of `native/src/sparse_file.h`: "ZSX1", le64 file size,
+/// le32 count, then le64 offset and le64 length per extent.
+class ExtentMap {
+  final int fileSize;
+  final List<({int offset, int length})> extents;
+  final Uint8List bytes; // As sent
+
+  ExtentMap._(this.fileSize, this.extents, this.bytes);
+
+  int get dataBytes => extents.fold(0, (sum, e) => sum + e.length);
+
+  /// Null unless [bytes] is a well-formed map.
+  static ExtentMap? parse(Uint8List bytes) {
+    if (bytes.length < 16 ||
+        bytes[0] != 0x5A || // Z
+        bytes[1] != 0x53 || // S
+        bytes[2] != 0x58 || // X
+        bytes[3] != 0x31) {
+      return null;
+    }
+    final data = ByteData.sublistView(bytes);
+    final fileSize = data.getUint64(4, Endian.little);
+    final count = data.getUint32(12, Endian.little);
+    if (bytes.length != 16 + count * 16) return null;
+    final extents = <({int offset, int length})>[];
+    int at = 0;
+    for (int i = 0; i < count; i++) {
+      final offset = data.getUint64(16 + i * 16, Endian.little);
+      final length = data.getUint64(24 + i * 16, Endian.little);
+      if (length <= 0 ||
+          offset < at ||
+          (i > 0 && offset == at) ||
+          offset + length > fileSize) {
+        return null;
+      }
+      extents.add((offset: offset, length: length));
+      at = offset + length;
+    }
+    return ExtentMap._(fileSize, extents, bytes);
+  }
+
+  /// Inclusive byte ranges covering the data, rounded out to whole
+  /// [chunkSize] chunks, for fetching chunk by chunk.
+  List<({int start, int end})> chunkRanges(int chunkSize) {
+    final out = <({int start, int end})>[];
+    for (final e in extents) {
+      final start = e.offset ~/ chunkSize * chunkSize;
+      final stop = (e.offset + e.length + chunkSize - 1) ~/ chunkSize;
+      final end = stop * chunkSize < fileSize ? stop * chunkSize : fileSize;
+      if (out.isNotEmpty && start <= out.last.end + 1) {
+        out.add((start: out.removeLast().start, end: end - 1));
+      } else {
+        out.add((start: start, end: end - 1));
+      }
+    }
+    return out;
+  }
+
+  /// Indices of the [chunkSize] chunks that hold no data at all.
+  List<int> holeChunks(int chunkSize) {
+    final count = (fileSize + chunkSize - 1) ~/ chunkSize;
+    final holes = <int>[];
+    int next = 0;
+    for (final r in chunkRanges(chunkSize)) {
+      for (; next < r.start ~/ chunkSize; next++) {
+        holes.add(next);
+      }
+      next = r.end ~/ chunkSize + 1;
+    }
+    for (; next < count; next++) {
+      holes.add(next);
+    }
+    return holes;
+  }
+}
+
+/// Sparse-file support from `native/src/sparse_file.cc`.
+class NativeSparseFile {
+  static bool get isAvailable => _SparseFileBindings.instance != null;
+
+  /// The extent map of the file at [path], or null when it has no holes
+  /// worth skipping, they can't be found, or the engine isn't available.
+  static ExtentMap? extentMap(String path) {
+    final b = _SparseFileBindings.instance;
+    if (b == null) return null;
+    final nativePath = path.toNativeUtf8();
+    int cap = 4096;
+    try {
+      while (true) {
+        final out = malloc<Uint8>(cap);
+        try {
+          final len = b.extentMap(nativePath, out, cap);
+          if (len <= 0) return null;
+          if (len <= cap) {
+            return ExtentMap.parse(Uint8List.fromList(out.asTypedList(len)));
+          }
+          cap = len;
+        } finally {
+          malloc.free(out);
+        }
+      }
+    } finally {
+      malloc.free(nativePath);
+    }
+  }
+
+  /// Lays out [path] as [map] describes: the full size, with holes
+  /// wherever there's no data. False if the file system can't make holes.
+  static bool prepare(String path, ExtentMap map) {
+    final b = _SparseFileBindings.instance;
+    if (b == null) return false;
+    final nativePath = path.toNativeUtf8();
+    final bytes = malloc<Uint8>(map.bytes.length);
+    try {
+      bytes.asTypedList(map.bytes.length).setAll(0, map.bytes);
+      return b.prepare(nativePath, bytes, map.bytes.length) != 0;
+    } finally {
+      malloc.free(bytes);
+      malloc.free(nativePath);
+    }
+  }
+}
@@ -0,0 +1,31 @@
+import 'dart:ffi';
+import 'dart:io';
+
+/// Loader for the ZapShare native transfer engine (`native/` in the repo).
+///
+/// The library is bundled by the Linux and Windows runners and built by the
+/// Android Gradle project. On every other platform, or if loading fails,
+/// [library] is null and callers keep their pure-Dart code path.
+class ZapShareNative {
+  static DynamicLibrary? _library;
+  static bool _loadAttempted = false;
+
+  static DynamicLibrary? get library {
+    if (_loadAttempted) return _library;
+    _loadAttempted = true;
+
+    try {
+      if (Platform.isWindows) {
+        _library = DynamicLibrary.open('zapshare_native.dll');
+      } else if (Platform.isLinux || Platform.isAndroid) {
+        _library = DynamicLibrary.open('libzapshare_native.so');
+      }
+    } catch (e) {
+      print('⚠️ Native transfer engine unavailable: $e');
+      _library = null;
+    }
+    return _library;
+  }
+
+  static bool get isAvailable => library != null;
+}
@@ -0,0 +1,427 @@
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+import 'zapshare_native.dart';
+
+final class _ZsZipLayout extends Opaque {}
+
+final class _ZsZipWriter extends Opaque {}
+
+class _ZipBindings {
+  final int Function(int, Pointer<Uint8>, int) crc32;
+  final int Function(int, int, int) crc32Combine;
+  final Pointer<_ZsZipLayout> Function(
+    Pointer<Utf8>,
+    int,
+    Pointer<Uint64>,
+    Pointer<Int64>,
+    int,
+  )
+  layoutNew;
+  final NativeFinalizer layoutFinalizer;
+  final void Function(Pointer<Void>) layoutFree;
+  final int Function(Pointer<_ZsZipLayout>) layoutSize;
+  final void Function(
+    Pointer<_ZsZipLayout>,
+    int,
+    Pointer<Int64>,
+    Pointer<Uint64>,
+    Pointer<Uint64>,
+  )
+  layoutLocate;
+  final int Function(
+    Pointer<_ZsZipLayout>,
+    int,
+    int,
+    Pointer<Uint8>,
+    Pointer<Uint32>,
+  )
+  layoutRender;
+  final void Function(Pointer<_ZsZipLayout>, int, int, int, int)
+  layoutRecordCrc;
+  final int Function(
+    Pointer<_ZsZipLayout>,
+    int,
+    Pointer<Uint64>,
+    Pointer<Uint64>,
+  )
+  layoutCrcGap;
+  final int Function(Pointer<_ZsZipLayout>, int) layoutCrcCovered;
+  final Pointer<_ZsZipWriter> Function(int) writerNew;
+  final NativeFinalizer writerFinalizer;
+  final void Function(Pointer<Void>) writerFree;
+  final void Function(Pointer<_ZsZipWriter>, Pointer<Utf8>, int, int)
+  writerBeginEntry;
+  final void Function(Pointer<_ZsZipWriter>, Pointer<Uint8>, int)
+  writerUpdate;
+  final int Function(Pointer<_ZsZipWriter>) writerEndEntry;
+  final void Function(Pointer<_ZsZipWriter>) writerFinish;
+  final int Function(Pointer<_ZsZipWriter>) writerPending;
+  final int Function(Pointer<_ZsZipWriter>, Pointer<Uint8>, int) writerRead;
+
+  _ZipBindings(DynamicLibrary lib)
+    : crc32 = lib.lookupFunction<
+        Uint32 Function(Uint32, Pointer<Uint8>, Size),
+        int Function(int, Pointer<Uint8>, int)
+      >('zs_crc32', isLeaf: true),
+      crc32Combine = lib.lookupFunction<
+        Uint32 Function(Uint32, Uint32, Uint64),
+        int Function(int, int, int)
+      >('zs_crc32_combine', isLeaf: true),
+      layoutNew = lib.lookupFunction<
+        Pointer<_ZsZipLayout> Function(
+          Pointer<Utf8>,
+          Size,
+          Pointer<Uint64>,
+          Pointer<Int64>,
+          Uint32,
+        ),
+        Pointer<_ZsZipLayout> Function(
+          Pointer<Utf8>,
+          int,
+          Pointer<Uint64>,
+          Pointer<Int64>,
+          int,
+        )
+      >('zs_zip_layout_new'),
+      layoutFinalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_zip_layout_free'),
+      ),
+      layoutFree = lib
+          .lookup<NativeFinalizerFunction>('zs_zip_layout_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      layoutSize = lib.lookupFunction<
+        Uint64 Function(Pointer<_ZsZipLayout>),
+        int Function(Pointer<_ZsZipLayout>)
+      >('zs_zip_layout_size', isLeaf: true),
+      layoutLocate = lib.lookupFunction<
+        Void Function(
+          Pointer<_ZsZipLayout>,
+          Uint64,
+          Pointer<Int64>,
+          Pointer<Uint64>,
+          Pointer<Uint64>,
+        ),
+        void Function(
+          Pointer<_ZsZipLayout>,
+          int,
+          Pointer<Int64>,
+          Pointer<Uint64>,
+          Pointer<Uint64>,
+        )
+      >('zs_zip_layout_locate', isLeaf: true),
+      layoutRender = lib.lookupFunction<
+        Int32 Function(
+          Pointer<_ZsZipLayout>,
+          Uint64,
+          Size,
+          Pointer<Uint8>,
+          Pointer<Uint32>,
+        ),
+        int Function(
+          Pointer<_ZsZipLayout>,
+          int,
+          int,
+          Pointer<Uint8>,
+          Pointer<Uint32>,
+        )
+      >('zs_zip_layout_render', isLeaf: true),
+      layoutRecordCrc = lib.lookupFunction<
+        Void Function(Pointer<_ZsZipLayout>, Uint32, Uint64, Uint64, Uint32),
+        void Function(Pointer<_ZsZipLayout>, int, int, int, int)
+      >('zs_zip_layout_record_crc', isLeaf: true),
+      layoutCrcGap = lib.lookupFunction<
+        Int32 Function(
+          Pointer<_ZsZipLayout>,
+          Uint32,
+          Pointer<Uint64>,
+          Pointer<Uint64>,
+        ),
+        int Function(
+          Pointer<_ZsZipLayout>,
+          int,
+          Pointer<Uint64>,
+          Pointer<Uint64>,
+        )
+      >('zs_zip_layout_crc_gap', isLeaf: true),
+      layoutCrcCovered = lib.lookupFunction<
+        Uint64 Function(Pointer<_ZsZipLayout>, Uint32),
+        int Function(Pointer<_ZsZipLayout>, int)
+      >('zs_zip_layout_crc_covered', isLeaf: true),
+      writerNew = lib.lookupFunction<
+        Pointer<_ZsZipWriter> Function(Int32),
+        Pointer<_ZsZipWriter> Function(int)
+      >('zs_zip_writer_new'),
+      writerFinalizer = NativeFinalizer(
+        lib.lookup<NativeFinalizerFunction>('zs_zip_writer_free'),
+      ),
+      writerFree = lib
+          .lookup<NativeFinalizerFunction>('zs_zip_writer_free')
+          .asFunction<void Function(Pointer<Void>)>(),
+      writerBeginEntry = lib.lookupFunction<
+        Void Function(Pointer<_ZsZipWriter>, Pointer<Utf8>, Uint64, Int64),
+        void Function(Pointer<_ZsZipWriter>, Pointer<Utf8>, int, int)
+      >('zs_zip_writer_begin_entry', isLeaf: true),
+      writerUpdate = lib.lookupFunction<
+        Void Function(Pointer<_ZsZipWriter>, Pointer<Uint8>, Size),
+        void Function(Pointer<_ZsZipWriter>, Pointer<Uint8>, int)
+      >('zs_zip_writer_update', isLeaf: true),
+      writerEndEntry = lib.lookupFunction<
+        Int32 Function(Pointer<_ZsZipWriter>),
+        int Function(Pointer<_ZsZipWriter>)
+      >('zs_zip_writer_end_entry', isLeaf: true),
+      writerFinish = lib.lookupFunction<
+        Void Function(Pointer<_ZsZipWriter>),
+        void Function(Pointer<_ZsZipWriter>)
+      >('zs_zip_writer_finish', isLeaf: true),
+      writerPending = lib.lookupFunction<
+        Size Function(Pointer<_ZsZipWriter>),
+        int Function(Pointer<_ZsZipWriter>)
+      >('zs_zip_writer_pending', isLeaf: true),
+      writerRead = lib.lookupFunction<
+        Size Function(Pointer<_ZsZipWriter>, Pointer<Uint8>, Size),
+        int Function(Pointer<_ZsZipWriter>, Pointer<Uint8>, int)
+      >('zs_zip_writer_read', isLeaf: true);
+
+  static _ZipBindings? _instance;
+  static bool _resolved = false;
+
+  static _ZipBindings? get instance {
+    if (_resolved) return _instance;
+    _resolved = true;
+    final lib = ZapShareNative.library;
+    if (lib == null) return null;
+    try {
+      _instance = _ZipBindings(lib);
+    } catch (e) {
+      print('⚠️ ZIP streaming unavailable: $e');
+    }
+    return _instance;
+  }
+}
+
+/// One file in a streamed archive.
+class ZipEntryInfo {
+  final String name; // '/' separated path inside the archive
+  final int size;
+  final DateTime modified;
+
+  const ZipEntryInfo({
+    required this.name,
+    required this.size,
+    required this.modified,
+  });
+}
+
+/// A run of archive bytes: generated metadata when [entry] is null (and
+/// [offset] is the archive offset), otherwise bytes [offset] onwards of
+/// that entry's file.
+class ZipSpan {
+  final int? entry;
+  final int offset;
+  final int length;
+
+  const ZipSpan(this.entry, this.offset, this.length);
+}
+
+/// CRC-32 as used by ZIP, backed by `native/src/crc32.cc`.
+class NativeCrc32 {
+  static bool get isAvailable => _ZipBindings.instance != null;
+
+  /// Continues [crc] (0 to start) over [bytes].
+  static int update(int crc, Uint8List bytes) =>
+      _ZipBindings.instance!.crc32(crc, bytes.address, bytes.length);
+
+  /// CRC of A followed by B, from their CRCs and B's length.
+  static int combine(int crcA, int crcB, int lengthB) =>
+      _ZipBindings.instance!.crc32Combine(crcA, crcB, lengthB);
+}
+
+/// Fixed plan of a stored (uncompressed) archive; any byte range of it can
+/// be produced on demand. Backed by `ZipLayout` in `native/src/zip_stream.cc`.
+class NativeZipLayout implements Finalizable {
+  final _ZipBindings _b;
+  final Pointer<_ZsZipLayout> _handle;
+  final List<ZipEntryInfo> entries;
+  bool _disposed = false;
+
+  NativeZipLayout._(this._b, this._handle, this.entries) {
+    _b.layoutFinalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  /// Null when the native engine is missing or a name is too long.
+  static NativeZipLayout? create(List<ZipEntryInfo> entries) {
+    final b = _ZipBindings.instance;
+    if (b == null) return null;
+    final names = BytesBuilder(copy: false);
+    for (final e in entries) {
+      names
+        ..add(utf8.encode(e.name))
+        ..addByte(0);
+    }
+    final nameBytes = names.takeBytes();
+    final namesPtr = calloc<Uint8>(nameBytes.length + 1);
+    final sizes = calloc<Uint64>(entries.length + 1);
+    final mtimes = calloc<Int64>(entries.length + 1);
+    try {
+      namesPtr.asTypedList(nameBytes.length).setAll(0, nameBytes);
+      for (int i = 0; i < entries.length; i++) {
+        sizes[i] = entries[i].size;
+        mtimes[i] = entries[i].modified.millisecondsSinceEpoch;
+      }
+      final handle = b.layoutNew(
+        namesPtr.cast(),
+        nameBytes.length,
+        sizes,
+        mtimes,
+        entries.length,
+      );
+      if (handle == nullptr) return null;
+      return NativeZipLayout._(b, handle, List.unmodifiable(entries));
+    } finally {
+      calloc.free(namesPtr);
+      calloc.free(sizes);
+      calloc.free(mtimes);
+    }
+  }
+
+  /// Total archive length, known before any file is read.
+  int get size => _b.layoutSize(_handle);
+
+  /// The span starting at archive offset [pos].
+  ZipSpan locate(int pos) {
+    final out = calloc<Uint64>(3);
+    try {
+      _b.layoutLocate(_handle, pos, out.cast(), out + 1, out + 2);
+      final entry = out.cast<Int64>()[0];
+      return ZipSpan(entry < 0 ? null : entry, out[1], out[2]);
+    } finally {
+      calloc.free(out);
+    }
+  }
+
+  /// Metadata bytes [pos, pos + length), or null if they include the CRC of
+  /// an entry that isn't fully known yet; [missingEntry] then names it.
+  Uint8List? render(int pos, int length, {void Function(int)? missingEntry}) {
+    final buf = calloc<Uint8>(length);
+    final missing = calloc<Uint32>();
+    try {
+      if (_b.layoutRender(_handle, pos, length, buf, missing) == 0) {
+        missingEntry?.call(missing.value);
+        return null;
+      }
+      return Uint8List.fromList(buf.asTypedList(length));
+    } finally {
+      calloc.free(buf);
+      calloc.free(missing);
+    }
+  }
+
+  /// Records the CRC of bytes [offset, offset + length) of [entry].
+  void recordCrc(int entry, int offset, int length, int crc) {
+    if (!_disposed) _b.layoutRecordCrc(_handle, entry, offset, length, crc);
+  }
+
+  /// Bytes of [entry] whose CRC is known.
+  int crcCovered(int entry) => _b.layoutCrcCovered(_handle, entry);
+
+  /// First range of [entry] still missing a CRC as (start, end), or null.
+  (int, int)? crcGap(int entry) {
+    final out = calloc<Uint64>(2);
+    try {
+      if (_b.layoutCrcGap(_handle, entry, out, out + 1) == 0) return null;
+      return (out[0], out[1]);
+    } finally {
+      calloc.free(out);
+    }
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.layoutFinalizer.detach(this);
+    _b.layoutFree(_handle.cast());
+  }
+}
+
+/// Front-to-back archive writer that can deflate compressible entries;
+/// its length isn't known up front, so it can't serve ranges.
+class NativeZipWriter implements Finalizable {
+  final _ZipBindings _b;
+  final Pointer<_ZsZipWriter> _handle;
+  Pointer<Uint8> _scratch = nullptr;
+  int _scratchLen = 0;
+  bool _disposed = false;
+
+  NativeZipWriter._(this._b, this._handle) {
+    _b.writerFinalizer.attach(this, _handle.cast(), detach: this);
+  }
+
+  static NativeZipWriter? create({required bool deflate}) {
+    final b = _ZipBindings.instance;
+    if (b == null) return null;
+    return NativeZipWriter._(b, b.writerNew(deflate ? 1 : 0));
+  }
+
+  /// Starts [entry] and returns its local header.
+  Uint8List beginEntry(ZipEntryInfo entry) {
+    final name = entry.name.toNativeUtf8();
+    try {
+      _b.writerBeginEntry(
+        _handle,
+        name,
+        entry.size,
+        entry.modified.millisecondsSinceEpoch,
+      );
+    } finally {
+      malloc.free(name);
+    }
+    return _drain();
+  }
+
+  Uint8List update(List<int> bytes) {
+    if (bytes.isNotEmpty) {
+      final data = bytes is Uint8List ? bytes : Uint8List.fromList(bytes);
+      _b.writerUpdate(_handle, data.address, data.length);
+    }
+    return _drain();
+  }
+
+  /// Ends the entry; throws if it didn't get the announced number of bytes.
+  Uint8List endEntry() {
+    if (_b.writerEndEntry(_handle) == 0) {
+      throw StateError('File changed size while being archived');
+    }
+    return _drain();
+  }
+
+  /// Returns the central directory.
+  Uint8List finish() {
+    _b.writerFinish(_handle);
+    return _drain();
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    _b.writerFinalizer.detach(this);
+    _b.writerFree(_handle.cast());
+    if (_scratch != nullptr) calloc.free(_scratch);
+    _scratch = nullptr;
+  }
+
+  Uint8List _drain() {
+    final pending = _b.writerPending(_handle);
+    if (pending == 0) return Uint8List(0);
+    if (_scratchLen < pending) {
+      if (_scratch != nullptr) calloc.free(_scratch);
+      _scratchLen = pending;
+      _scratch = calloc<Uint8>(_scratchLen);
+    }
+    final n = _b.writerRead(_handle, _scratch, pending);
+    return Uint8List.fromList(_scratch.asTypedList(n));
+  }
+}
@@ -0,0 +1,194 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:typed_data';
+
+import '../native/batch.dart';
+
+/// Many small files (a photo folder, a source tree) over one TCP stream
+/// instead of a connection, metadata exchange and ACK per file.
+///
+/// 1. Senders with the native engine mark files up to [MAX_FILE_SIZE] with
+///    `batch: 1` in their LIST entries
+/// 2. The receiver sends `BATCH 3,7,12\n` on the TCP port; the sender
+///    answers with a `native/src/batch.h` container holding each file and
+///    its digest, then closes. There is no per-file ACK
+/// 3. A [NativeBatchReceiver] checks each file's digest and writes it into
+///    the save folder from a native thread pool, while this isolate keeps
+///    reading the socket
+///
+/// Files the batch didn't deliver (unreadable on the sender, corrupt, a
+/// dropped connection) are left to the caller's normal per-file download.
+class BatchTransferService {
+  static const String COMMAND = 'BATCH';
+  static const String LIST_FIELD = 'batch';
+  static const int MAX_FILE_SIZE = 1024 * 1024; // Larger files go alone
+  static const int MIN_FILES = 4; // Below this a batch saves next to nothing
+  static const int MAX_FILES = 2000; // Per request
+  static const int MAX_IN_FLIGHT = 32 * 1024 * 1024; // Unwritten bytes
+  static const Duration IDLE_TIMEOUT = Duration(seconds: 30);
+  static const Duration _poll = Duration(milliseconds: 5);
+  static const int _flushEvery = 1024 * 1024;
+
+  static bool get isAvailable => NativeBatchWriter.isAvailable;
+
+  /// LIST entry fields for a shared file of [size] bytes.
+  static Map<String, dynamic> listFields(int size) =>
+      isAvailable && size <= MAX_FILE_SIZE ? const {LIST_FIELD: 1} : const {};
+
+  /// Whether a file the sender listed with [entry] fields can be batched.
+  static bool canBatch(Map<String, dynamic> entry) =>
+      isAvailable &&
+      entry[LIST_FIELD] == 1 &&
+      (entry['size'] ?? MAX_FILE_SIZE + 1) <= MAX_FILE_SIZE;
+
+  static String command(List<int> indices) => '$COMMAND ${indices.join(',')}';
+
+  /// File indices from a `BATCH` line, dropping any outside [fileCount];
+  /// null if [line] isn't a batch request.
+  static List<int>? parseCommand(String line, int fileCount) {
+    if (!line.startsWith('$COMMAND ')) return null;
+    final indices = <int>[];
+    for (final part in line.substring(COMMAND.length + 1).split(',')) {
+      final index = int.tryParse(part.trim());
+      if (index != null && index >= 0 && index < fileCount) {
+        indices.add(index);
+      }
+      if (indices.length == MAX_FILES) break;
+    }
+    return indices;
+  }
+
+  // ═══════════════════════════════════════════════════════════
+  //   Sender
+  // ═══════════════════════════════════════════════════════════
+
+  /// Streams [indices] into [sink] as one container. Each file is read
+  /// whole (they're small) while the previous one is on the wire; files
+  /// that can't be read or don't match [sizeOf] are sent as skip records.
+  /// Returns how many files went out; the caller closes the sink.
+  static Future<int> send(
+    IOSink sink,
+    List<int> indices, {
+    required String Function(int index) nameOf,
+    required int Function(int index) sizeOf,
+    required Stream<List<int>> Function(int index) read,
+    void Function(int index)? onSent,
+  }) async {
+    final writer = NativeBatchWriter.create();
+    if (writer == null) return 0;
+    int sent = 0;
+    int unflushed = 0;
+    try {
+      Future<Uint8List?> load(int index) async {
+        final size = sizeOf(index);
+        if (size > MAX_FILE_SIZE) return null;
+        try {
+          final bytes = BytesBuilder(copy: false);
+          await for (final chunk in read(index)) {
+            bytes.add(chunk);
+            if (bytes.length > size) return null;
+          }
+          return bytes.length == size ? bytes.takeBytes() : null;
+        } catch (e) {
+          print('⚠️ Batch: could not read file $index: $e');
+          return null;
+        }
+      }
+
+      Future<Uint8List?>? next = indices.isEmpty ? null : load(indices[0]);
+      for (int i = 0; i < indices.length; i++) {
+        final index = indices[i];
+        final data = await next!;
+        next = i + 1 < indices.length ? load(indices[i + 1]) : null;
+        if (data == null) {
+          writer.skipFile(index);
+          continue;
+        }
+        writer.beginFile(index, nameOf(index), data.length);
+        writer.update(data);
+        sink.add(writer.take());
+        sink.add(data);
+        writer.endFile();
+        sink.add(writer.take());
+        sent++;
+        onSent?.call(index);
+        unflushed += data.length;
+        if (unflushed >= _flushEvery) {
+          await sink.flush();
+          unflushed = 0;
+        }
+      }
+      writer.finish();
+      sink.add(writer.take());
+      await sink.flush();
+      print('📦 Batch sent: $sent of ${indices.length} files');
+      return sent;
+    } finally {
+      writer.dispose();
+    }
+  }
+
+  // ═══════════════════════════════════════════════════════════
+  //   Receiver
+  // ═══════════════════════════════════════════════════════════
+
+  /// Requests [indices] from the sender's TCP port and writes them into
+  /// [directory], renaming to `name_1.ext` etc. where taken. [onResult]
+  /// runs as each file lands. Returns the results by index; indices missing
+  /// from it, or not [BatchFileStatus.written], still need downloading.
+  static Future<Map<int, BatchFileResult>> download({
+    required String host,
+    required int port,
+    required List<int> indices,
+    required String directory,
+    void Function(BatchFileResult result)? onResult,
+    bool Function()? isCancelled,
+  }) async {
+    final results = <int, BatchFileResult>{};
+    final receiver = NativeBatchReceiver.create(directory);
+    if (receiver == null || indices.isEmpty) {
+      receiver?.dispose();
+      return results;
+    }
+
+    void collect() {
+      for (final result in receiver.takeResults()) {
+        results[result.index] = result;
+        onResult?.call(result);
+      }
+    }
+
+    Socket? socket;
+    try {
+      socket = await Socket.connect(
+        host,
+        port,
+        timeout: const Duration(seconds: 10),
+      );
+      socket.writeln(command(indices));
+      await socket.flush();
+      // Awaiting inside the loop pauses the socket, which is the
+      // backpressure while the writers catch up.
+      await for (final chunk in socket.timeout(IDLE_TIMEOUT)) {
+        if (isCancelled?.call() ?? false) break;
+        receiver.update(chunk);
+        collect();
+        while (receiver.bytesInFlight > MAX_IN_FLIGHT) {
+          await Future.delayed(_poll);
+          collect();
+        }
+      }
+      if (!receiver.isComplete) print('⚠️ Batch ended early');
+    } catch (e) {
+      print('⚠️ Batch transfer failed: $e');
+    } finally {
+      socket?.destroy();
+      while (receiver.isBusy) {
+        await Future.delayed(_poll);
+      }
+      collect();
+      receiver.dispose();
+    }
+    return results;
+  }
+}
@@ -0,0 +1,123 @@
+import 'dart:async';
+import 'dart:io';
+
+import '../native/compression.dart';
+
+/// Per-connection adaptive compression between the file reader and the
+/// socket, for both the HTTP `/file/<index>` path and the raw TCP path.
+///
+/// 1. The receiver advertises the codecs it can decode: an
+///    `X-ZapShare-Codecs` header on HTTP, a flagged index on TCP
+/// 2. The sender intersects that with its own and, if anything beyond store
+///    is left, wraps the response in a [CompressedWriter] and says so with
+///    `X-ZapShare-Encoding` (HTTP) or `encoding` in the metadata JSON (TCP)
+/// 3. The writer samples each 128KB chunk and stores, LZ4s or deflates it
+///    depending on its entropy and the link rate measured while sending
+/// 4. The receiver runs the body through [decode] before writing and
+///    hashing, so digests always cover the raw file
+///
+/// Peers that predate this never send the codecs header and get the plain
+/// stream. Range requests are never compressed, so chunk repair and resumed
+/// downloads keep working on raw byte offsets.
+class CompressionStage {
+  static const String CODECS_HEADER = 'X-ZapShare-Codecs';
+  static const String ENCODING_HEADER = 'X-ZapShare-Encoding';
+  static const String LENGTH_HEADER = 'X-ZapShare-Length'; // Raw file size
+  static const String ENCODING_NAME = 'zsframe';
+  static const int TCP_CODECS_FLAG = 0x40000000; // Set on the file index
+
+  /// Codecs worth offering; 0 when only store is possible.
+  static int get localCodecs {
+    final mask = NativeCompression.supportedCodecs;
+    return mask & ~NativeCompression.store == 0 ? 0 : mask;
+  }
+
+  /// Codecs both sides support, or 0 when compression is off for this
+  /// connection.
+  static int negotiate(int peerCodecs) {
+    final mask = peerCodecs & localCodecs;
+    return mask & ~NativeCompression.store == 0 ? 0 : mask;
+  }
+
+  /// Mask from a request's [CODECS_HEADER], or 0 if absent or malformed.
+  static int requestedCodecs(HttpRequest request) {
+    if (request.headers.value(HttpHeaders.rangeHeader) != null) return 0;
+    final value = request.headers.value(CODECS_HEADER);
+    return value == null ? 0 : negotiate(int.tryParse(value) ?? 0);
+  }
+
+  /// True if response [headers] announce compressed frames.
+  static bool isEncoded(Map<String, String> headers) =>
+      headers[ENCODING_HEADER.toLowerCase()] == ENCODING_NAME;
+
+  /// Decodes a frame stream back into raw bytes.
+  static Stream<List<int>> decode(Stream<List<int>> frames) async* {
+    final decompressor = NativeDecompressor.create();
+    if (decompressor == null) {
+      throw StateError('Compressed stream but no native decoder');
+    }
+    try {
+      await for (final chunk in frames) {
+        final raw = decompressor.update(chunk);
+        if (raw.isNotEmpty) yield raw;
+      }
+    } finally {
+      decompressor.dispose();
+    }
+  }
+}
+
+/// Compresses raw bytes into an [IOSink] (an `HttpResponse` or `Socket`)
+/// and keeps the compressor's idea of the link rate current.
+///
+/// The rate is taken from how long `flush()` blocks per megabyte on the
+/// wire, which is how fast the peer is draining the socket. Compression time
+/// is left out on purpose: when the CPU is the bottleneck the flushes return
+/// at once, the estimate goes up and the policy backs off to lighter codecs.
+class CompressedWriter {
+  static const int _measureEvery = 1024 * 1024; // Wire bytes per sample
+
+  final IOSink _sink;
+  final NativeCompressor _compressor;
+  final Stopwatch _clock = Stopwatch();
+  int _sinceMeasure = 0;
+
+  CompressedWriter._(this._sink, this._compressor);
+
+  /// Null when compression is off or the native engine is missing, in
+  /// which case the caller writes to [sink] directly.
+  static CompressedWriter? create(IOSink sink, int codecs) {
+    if (codecs == 0) return null;
+    final compressor = NativeCompressor.create(codecs);
+    if (compressor == null) return null;
+    return CompressedWriter._(sink, compressor);
+  }
+
+  Future<void> add(List<int> chunk) => _write(_compressor.update(chunk));
+
+  /// Writes the last frame; the caller still closes the sink.
+  Future<void> finish() async {
+    await _write(_compressor.finish());
+    await _sink.flush();
+    print('🗜️ Compressed: ${_compressor.stats}');
+    _compressor.dispose();
+  }
+
+  /// Releases the compressor without writing, after an aborted send.
+  void dispose() => _compressor.dispose();
+
+  Future<void> _write(List<int> frames) async {
+    if (frames.isEmpty) return;
+    _sink.add(frames);
+    _sinceMeasure += frames.length;
+    if (_sinceMeasure < _measureEvery) return;
+    _clock
+      ..reset()
+      ..start();
+    await _sink.flush();
+    _clock.stop();
+    final seconds = _clock.elapsedMicroseconds / 1e6;
+    if (seconds > 0) _compressor.linkRate = _sinceMeasure / seconds;
+    _sinceMeasure = 0;
+  }
+}
@@ -0,0 +1,287 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:isolate';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:http/http.dart' as http;
+
+import '../native/content_hash.dart';
+import '../native/delta.dart';
+
+/// rsync-style delta transfer for files the receiver already has an older
+/// copy of (a re-sent log, an edited project file, the same video again).
+///
+/// 1. The receiver computes the signature of its old copy (the basis) and
+///    POSTs it to `/delta/<index>` on the sender
+/// 2. The sender streams the new file through a [NativeDeltaEncoder] and
+///    answers with copy-block and literal instructions
+/// 3. The receiver rebuilds the file from the basis plus the literals and
+///    checks the trailing BLAKE3 digest
+///
+/// Senders that predate delta answer 404, in which case the caller falls back
+/// to a normal download. When little of the file matches, the encoder gives
+/// up early and the delta costs about the same as a full send.
+class DeltaTransferService {
+  static const int MIN_BASIS_SIZE = 1024 * 1024; // Below this just re-send
+  static const int MAX_SIGNATURE_SIZE = 32 * 1024 * 1024;
+  static const String PART_SUFFIX = '.zsdelta'; // File being rebuilt
+  static const String DELTA_HEADER = 'X-ZapShare-Delta';
+  static const int _readSize = 1024 * 1024; // 1MB
+
+  static bool get isAvailable => NativeDelta.isAvailable;
+
+  /// Signature of [basisPath], computed off the UI isolate; null if the
+  /// native engine is missing or the basis is too small to be worth it.
+  static Future<Uint8List?> signatureFor(String basisPath) async {
+    if (!isAvailable) return null;
+    try {
+      if (await File(basisPath).length() < MIN_BASIS_SIZE) return null;
+      return await Isolate.run(() => NativeDelta.signatureOf(basisPath));
+    } catch (e) {
+      print('⚠️ Delta signature failed: $e');
+      return null;
+    }
+  }
+
+  /// URL of the delta endpoint for a `/file/<index>` URL.
+  static String deltaUrl(String fileUrl) =>
+      fileUrl.replaceFirst('/file/', '/delta/');
+
+  // ═══════════════════════════════════════════════════════════
+  //   Sender
+  // ═══════════════════════════════════════════════════════════
+
+  /// Answers `POST /delta/<index>`: reads the receiver's signature from the
+  /// body and streams the delta of [source], which must yield exactly
+  /// [fileSize] bytes. Closes the response; returns the encoder stats, or
+  /// null if the request was rejected.
+  static Future<DeltaStats?> serve(
+    HttpRequest request, {
+    required Stream<List<int>> source,
+    required int fileSize,
+    void Function(int bytesRead)? onProgress,
+  }) async {
+    final response = request.response;
+    final body = BytesBuilder(copy: false);
+    await for (final chunk in request) {
+      body.add(chunk);
+      if (body.length > MAX_SIGNATURE_SIZE) break;
+    }
+
+    final signature = body.takeBytes();
+    final encoder =
+        signature.length <= MAX_SIGNATURE_SIZE
+            ? NativeDeltaEncoder.create(signature, fileSize)
+            : null;
+    if (encoder == null) {
+      response.statusCode =
+          isAvailable ? HttpStatus.badRequest : HttpStatus.notImplemented;
+      await response.close();
+      return null;
+    }
+
+    try {
+      response.headers.contentType = ContentType.binary;
+      response.headers.set(DELTA_HEADER, '1');
+      int read = 0;
+      await for (final chunk in source) {
+        read += chunk.length;
+        final out = encoder.update(chunk);
+        if (out.isNotEmpty) {
+          response.add(out);
+          await response.flush();
+        }
+        onProgress?.call(read);
+      }
+      response.add(encoder.finish());
+      final stats = encoder.stats;
+      print('🧩 Delta sent: $stats');
+      return stats;
+    } finally {
+      encoder.dispose();
+      await response.close();
+    }
+  }
+
+  // ═══════════════════════════════════════════════════════════
+  //   Receiver
+  // ═══════════════════════════════════════════════════════════
+
+  /// Rebuilds the sender's file at [savePath] from [basisPath] plus a delta
+  /// fetched from the `/delta/` twin of [fileUrl].
+  ///
+  /// Returns false, leaving nothing behind, when delta isn't possible (no
+  /// native engine, basis too small, sender without delta support) so the
+  /// caller can fall back to a normal download. Throws if the transfer
+  /// started but failed.
+  static Future<bool> download({
+    required String fileUrl,
+    required String basisPath,
+    required String savePath,
+    void Function(int bytesWritten, int fileSize)? onProgress,
+    bool Function()? isCancelled,
+  }) async {
+    final signature = await signatureFor(basisPath);
+    if (signature == null) return false;
+
+    final client = http.Client();
+    try {
+      final request = http.Request('POST', Uri.parse(deltaUrl(fileUrl)));
+      request.headers['Content-Type'] = 'application/octet-stream';
+      request.bodyBytes = signature;
+      final response = await client
+          .send(request)
+          .timeout(
+            const Duration(minutes: 60),
+            onTimeout: () => throw TimeoutException('Delta timed out'),
+          );
+      if (response.statusCode != HttpStatus.ok ||
+          response.headers[DELTA_HEADER.toLowerCase()] != '1') {
+        await response.stream.drain<void>();
+        return false;
+      }
+
+      final partPath = savePath + PART_SUFFIX;
+      try {
+        await _apply(
+          response.stream,
+          basisPath: basisPath,
+          outPath: partPath,
+          onProgress: onProgress,
+          isCancelled: isCancelled,
+        );
+        await File(partPath).rename(savePath);
+      } catch (_) {
+        try {
+          await File(partPath).delete();
+        } catch (_) {}
+        rethrow;
+      }
+      return true;
+    } finally {
+      client.close();
+    }
+  }
+
+  /// Streaming counterpart of `ApplyDelta` in `native/src/delta.cc`.
+  static Future<void> _apply(
+    Stream<List<int>> delta, {
+    required String basisPath,
+    required String outPath,
+    void Function(int bytesWritten, int fileSize)? onProgress,
+    bool Function()? isCancelled,
+  }) async {
+    final reader = _DeltaReader(delta);
+    final basis = await File(basisPath).open();
+    final out = await File(outPath).open(mode: FileMode.write);
+    NativeChunkHasher? hasher;
+    try {
+      final header = await reader.read(16);
+      if (String.fromCharCodes(header, 0, 4) != 'ZSD1') {
+        throw const FormatException('Not a delta stream');
+      }
+      final view = ByteData.sublistView(header);
+      final targetSize = view.getUint64(4, Endian.little);
+      final blockSize = view.getUint32(12, Endian.little);
+      final basisSize = await basis.length();
+      hasher = NativeChunkHasher.create(targetSize);
+
+      int written = 0;
+      Future<void> emit(List<int> bytes) async {
+        if (written + bytes.length > targetSize) {
+          throw const FormatException('Delta overruns target size');
+        }
+        hasher?.update(written, bytes);
+        await out.writeFrom(bytes);
+        written += bytes.length;
+        onProgress?.call(written, targetSize);
+      }
+
+      while (true) {
+        if (isCancelled?.call() ?? false) throw Exception('Cancelled by user');
+        final op = (await reader.read(1))[0];
+        if (op == 0x45) {
+          // 'E': whole-file digest of the target
+          final digest = await reader.read(32);
+          if (written != targetSize) {
+            throw const FormatException('Delta ended early');
+          }
+          final got = hasher?.fileDigest();
+          if (got != null && got != _hex(digest)) {
+            throw Exception('Delta digest mismatch');
+          }
+          break;
+        }
+        if (op == 0x43) {
+          // 'C': copy whole blocks from the basis
+          final args = ByteData.sublistView(await reader.read(8));
+          final first = args.getUint32(0, Endian.little);
+          final count = args.getUint32(4, Endian.little);
+          int pos = first * blockSize;
+          final end = min(pos + count * blockSize, basisSize);
+          if (count == 0 || pos >= basisSize) {
+            throw const FormatException('Copy outside basis');
+          }
+          await basis.setPosition(pos);
+          while (pos < end) {
+            final piece = await basis.read(min(_readSize, end - pos));
+            if (piece.isEmpty) throw const FormatException('Basis shrank');
+            await emit(piece);
+            pos += piece.length;
+          }
+        } else if (op == 0x4C) {
+          // 'L': literal bytes
+          final len = ByteData.sublistView(
+            await reader.read(4),
+          ).getUint32(0, Endian.little);
+          await emit(await reader.read(len));
+        } else {
+          throw FormatException('Unknown delta op $op');
+        }
+      }
+      await out.flush();
+    } finally {
+      hasher?.dispose();
+      await basis.close();
+      await out.close();
+    }
+  }
+
+  static String _hex(List<int> bytes) {
+    final sb = StringBuffer();
+    for (final b in bytes) {
+      sb.write(b.toRadixString(16).padLeft(2, '0'));
+    }
+    return sb.toString();
+  }
+}
+
+/// Pulls exact byte counts out of a chunked stream.
+class _DeltaReader {
+  final StreamIterator<List<int>> _it;
+  List<int> _chunk = const [];
+  int _offset = 0;
+
+  _DeltaReader(Stream<List<int>> stream) : _it = StreamIterator(stream);
+
+  Future<Uint8List> read(int n) async {
+    final out = Uint8List(n);
+    int filled = 0;
+    while (filled < n) {
+      if (_offset == _chunk.length) {
+        if (!await _it.moveNext()) {
+          throw const FormatException('Delta stream truncated');
+        }
+        _chunk = _it.current;
+        _offset = 0;
+        continue;
+      }
+      final take = min(n - filled, _chunk.length - _offset);
+      out.setRange(filled, filled + take, _chunk, _offset);
+      filled += take;
+      _offset += take;
+    }
+    return out;
+  }
+}
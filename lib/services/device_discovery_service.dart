@@ -3,6 +3,11 @@ import 'dart:convert';
 import 'dart:io';
 import 'package:shared_preferences/shared_preferences.dart';
 import 'package:flutter/services.dart';
+
+import '../native/connection_pool.dart';
+import '../native/control_codec.dart';
+import '../native/discovery.dart';
+import '../native/path_manager.dart';
 // import 'wifi_direct_service.dart'; // REMOVED: Using Bluetooth + Hotspot instead
 
 // Connection request model
@@ -182,13 +187,17 @@ class DiscoveredDevice {
   final String ipAddress;
   final int port;
   final String platform;
-  final DateTime lastSeen;
+  // Refreshed in place for peers the native engine still has
+  DateTime lastSeen;
   bool isFavorite;
   final DiscoveryMethod discoveryMethod;
   final String? wifiDirectAddress; // MAC address for Wi-Fi Direct peers
   final String? bleAddress; // BLE address for Bluetooth-discovered peers
   final String? avatarUrl;
   final String? userName;
+  // Every address its beacons lately arrived from, one per network it
+  // shares with us; ipAddress is the latest
+  final List<String> addresses;
 
   DiscoveredDevice({
     required this.deviceId,
@@ -203,6 +212,7 @@ class DiscoveredDevice {
     this.bleAddress,
     this.avatarUrl,
     this.userName,
+    this.addresses = const [],
   });
 
   Map<String, dynamic> toJson() => {
@@ -287,6 +297,14 @@ class DeviceDiscoveryService {
       '224.0.0.167'; // Compatible with all Android devices (LocalSend uses this)
   static const int BROADCAST_INTERVAL_SECONDS =
       8; // Reduced frequency for better performance
+  static const int PATH_TTL_SECONDS =
+      30; // An address without a beacon for this long is gone
+  static const int BEACON_MIN_INTERVAL_MILLISECONDS =
+      250; // Native beacons right after something changed
+  static const int BEACON_MAX_INTERVAL_SECONDS =
+      32; // Native beacons once nothing has for a while
+  static const int MDNS_PORT =
+      5353; // Answering DNS-SD browses for _zapshare._tcp
 
   // Singleton instance
   static final DeviceDiscoveryService _instance =
@@ -305,10 +323,19 @@ class DeviceDiscoveryService {
   Timer? _broadcastTimer;
   Timer? _cleanupTimer;
   Timer? _keepAliveTimer;
+  // Beacons and the peer table, when the native engine runs; replies and
+  // requests still go out from Dart
+  NativeDiscovery? _nativeDiscovery;
+  // Device IDs the native engine currently reports
+  final Set<String> _nativePeers = {};
+  // Addresses whose control messages showed they read the binary form
+  final Set<String> _binaryControlPeers = {};
   bool _isRunning = false;
   bool _isRestarting = false; // Flag to prevent multiple restart attempts
 
   final Map<String, DiscoveredDevice> _discoveredDevices = {};
+  // Device ID -> every address its beacons arrived from, and when last
+  final Map<String, Map<String, DateTime>> _peerAddresses = {};
   final StreamController<List<DiscoveredDevice>> _devicesController =
       StreamController<List<DiscoveredDevice>>.broadcast();
 
@@ -519,7 +546,13 @@ class DeviceDiscoveryService {
 
   Future<void> start() async {
     if (_isRunning) {
-      print('⚠️  Device discovery already running');
+      // A screen listing peers opened: have everyone answer now
+      print('⚠️  Device discovery already running, querying');
+      if (_nativeDiscovery != null) {
+        _nativeDiscovery!.query();
+      } else {
+        _broadcastPresence();
+      }
       return;
     }
 
@@ -539,6 +572,12 @@ class DeviceDiscoveryService {
       _networkInterfaces.clear();
       _sockets.clear();
 
+      // One native socket listens on every interface; Dart's are only
+      // needed without it
+      _nativeDiscovery = await _startNativeDiscovery();
+      // Everyone answers at once rather than within their interval
+      _nativeDiscovery?.query();
+
       // LocalSend approach: Create ONE socket per interface, each bound to anyIPv4 with the discovery port
       // Then join multicast group ON THAT SPECIFIC INTERFACE
       // This ensures packets from that interface are received
@@ -563,6 +602,7 @@ class DeviceDiscoveryService {
           // Store interface info for broadcasting
           final interfaceInfo = _NetworkInterfaceInfo(interface, ipv4Addresses);
           _networkInterfaces.add(interfaceInfo);
+          if (_nativeDiscovery != null) continue;
 
           // CRITICAL: Bind to anyIPv4 with the DISCOVERY_PORT (like LocalSend)
           // This allows receiving on this port from all addresses
@@ -611,6 +651,17 @@ class DeviceDiscoveryService {
         }
       }
 
+      if (_nativeDiscovery != null) {
+        // For sending only; receivers answer to DISCOVERY_PORT
+        final sendSocket = await RawDatagramSocket.bind(
+          InternetAddress.anyIPv4,
+          0,
+        );
+        sendSocket.broadcastEnabled = true;
+        _sockets.add(sendSocket);
+        _watchNativeDiscovery(_nativeDiscovery!);
+      }
+
       if (_sockets.isEmpty) {
         throw Exception('Failed to bind to any network interface');
       }
@@ -645,6 +696,7 @@ class DeviceDiscoveryService {
     if (_isPaused) return;
     _isPaused = true;
     _broadcastTimer?.cancel();
+    _nativeDiscovery?.setPaused(true);
     print(
       '⏸️ Discovery broadcasts PAUSED (saving resources for video playback)',
     );
@@ -661,6 +713,11 @@ class DeviceDiscoveryService {
 
   void _startBroadcasting() {
     if (_isPaused) return;
+    if (_nativeDiscovery != null) {
+      // The engine keeps its own schedule
+      _nativeDiscovery!.setPaused(false);
+      return;
+    }
     _broadcastTimer?.cancel();
     _broadcastTimer = Timer.periodic(
       Duration(seconds: BROADCAST_INTERVAL_SECONDS),
@@ -692,16 +749,7 @@ class DeviceDiscoveryService {
         '🔍 Final avatar before broadcast: $avatarUrl, userName: $userName',
       );
 
-      final message = jsonEncode({
-        'type': 'ZAPSHARE_DISCOVERY',
-        'deviceId': _myDeviceId,
-        'deviceName': _myDeviceName,
-        'platform': _getPlatformName(),
-        'port': 8080, // File sharing port
-        'timestamp': DateTime.now().millisecondsSinceEpoch,
-        'avatarUrl': avatarUrl,
-        'userName': userName,
-      });
+      final message = _discoveryBeacon(avatarUrl, userName);
 
       // Debug: Log what we're broadcasting
       print(
@@ -775,6 +823,115 @@ class DeviceDiscoveryService {
     }
   }
 
+  String _discoveryBeacon(String? avatarUrl, String? userName) {
+    return jsonEncode({
+      'type': 'ZAPSHARE_DISCOVERY',
+      'deviceId': _myDeviceId,
+      'deviceName': _myDeviceName,
+      'platform': _getPlatformName(),
+      'port': 8080, // File sharing port
+      'timestamp': DateTime.now().millisecondsSinceEpoch,
+      'avatarUrl': avatarUrl,
+      'userName': userName,
+    });
+  }
+
+  /// Starts the native engine with our binary beacon, and our JSON one for
+  /// older versions; null where discovery has to stay in Dart
+  Future<NativeDiscovery?> _startNativeDiscovery() async {
+    final prefs = await SharedPreferences.getInstance();
+    final avatarUrl = prefs.getString('custom_avatar');
+    final discovery = NativeDiscovery.start(
+      deviceId: _myDeviceId ?? '',
+      name: _myDeviceName ?? 'ZapShare Device',
+      avatar: avatarUrl,
+      platform: _getPlatformName(),
+      servicePort: 8080,
+      port: DISCOVERY_PORT,
+      group: MULTICAST_GROUP,
+      minInterval: Duration(milliseconds: BEACON_MIN_INTERVAL_MILLISECONDS),
+      maxInterval: Duration(seconds: BEACON_MAX_INTERVAL_SECONDS),
+      mdnsPort: MDNS_PORT,
+      legacyBeacon: utf8.encode(_discoveryBeacon(avatarUrl, null)),
+    );
+    if (discovery != null) {
+      print('✅ Native discovery engine listening on port $DISCOVERY_PORT');
+    }
+    return discovery;
+  }
+
+  // Peer changes and control messages are picked up as soon as the engine
+  // has them, and nothing runs while the LAN stays the same
+  Future<void> _watchNativeDiscovery(NativeDiscovery discovery) async {
+    while (identical(_nativeDiscovery, discovery)) {
+      await discovery.changed();
+      if (!identical(_nativeDiscovery, discovery)) return;
+      _pollNativeDiscovery();
+    }
+  }
+
+  void _pollNativeDiscovery() {
+    final changes = _nativeDiscovery?.poll();
+    if (changes == null || changes.isEmpty) return;
+    for (final message in changes.messages) {
+      _handleDiscoveryMessage(message);
+    }
+    for (final deviceId in changes.gone) {
+      _nativePeers.remove(deviceId);
+      _peerAddresses.remove(deviceId);
+      // Favorites stay listed, going offline as lastSeen ages
+      if (_discoveredDevices[deviceId]?.isFavorite == false) {
+        _discoveredDevices.remove(deviceId);
+      }
+    }
+    for (final peer in changes.peers) {
+      _handleNativePeer(peer);
+    }
+    if (changes.peers.isNotEmpty || changes.gone.isNotEmpty) {
+      _notifyListeners();
+    }
+  }
+
+  /// The native counterpart of _handleDiscoveryBroadcast, called only when
+  /// the peer is new or something about it changed
+  void _handleNativePeer(DiscoveryPeer peer) {
+    // A device that restarted with a new ID replaces its old entry
+    final replaced = [
+      for (final entry in _discoveredDevices.entries)
+        if (entry.key != peer.deviceId &&
+            peer.addresses.contains(entry.value.ipAddress))
+          entry,
+    ];
+    for (final entry in replaced) {
+      print('🔄 Removing duplicate device: ${entry.key} (same IP)');
+      _discoveredDevices.remove(entry.key);
+    }
+    final isFavorite =
+        _discoveredDevices[peer.deviceId]?.isFavorite ??
+        replaced.any((entry) => entry.value.isFavorite);
+
+    final now = DateTime.now();
+    _nativePeers.add(peer.deviceId);
+    _peerAddresses[peer.deviceId] = {
+      for (final address in peer.addresses) address: now,
+    };
+    _discoveredDevices[peer.deviceId] = DiscoveredDevice(
+      deviceId: peer.deviceId,
+      deviceName: peer.name,
+      ipAddress: peer.addresses.first, // The most recently heard from
+      port: peer.port,
+      platform: peer.platform,
+      lastSeen: now,
+      isFavorite: isFavorite,
+      avatarUrl: peer.avatar,
+      addresses: peer.addresses,
+    );
+    // Favorites are who transfers usually come from
+    if (isFavorite) {
+      NativeConnectionPool.shared?.warm(peer.addresses.first, peer.port);
+    }
+  }
+
   void _handleBroadcastError(dynamic error) {
     print('⚠️  Broadcast error detected, attempting to recover...');
     if (_isRestarting) {
@@ -822,7 +979,7 @@ class DeviceDiscoveryService {
     }
 
     try {
-      final message = jsonEncode({
+      final data = _encodeControl(targetIp, {
         'type': 'ZAPSHARE_CONNECTION_REQUEST',
         'deviceId': _myDeviceId,
         'deviceName': _myDeviceName,
@@ -834,8 +991,6 @@ class DeviceDiscoveryService {
         'timestamp': DateTime.now().millisecondsSinceEpoch,
       });
 
-      final data = utf8.encode(message);
-
       // Try to send on all sockets (at least one should work)
       int totalBytesSent = 0;
       for (final socket in _sockets) {
@@ -866,7 +1021,7 @@ class DeviceDiscoveryService {
     if (_sockets.isEmpty) return;
 
     try {
-      final message = jsonEncode({
+      final data = _encodeControl(targetIp, {
         'type': 'ZAPSHARE_CONNECTION_RESPONSE',
         'deviceId': _myDeviceId,
         'deviceName': _myDeviceName,
@@ -874,8 +1029,6 @@ class DeviceDiscoveryService {
         'timestamp': DateTime.now().millisecondsSinceEpoch,
       });
 
-      final data = utf8.encode(message);
-
       // Send on all sockets
       for (final socket in _sockets) {
         try {
@@ -891,10 +1044,25 @@ class DeviceDiscoveryService {
     }
   }
 
+  /// A control message for [targetIp]: binary if it has shown it reads
+  /// that, else JSON, which carries the codec's version when the native
+  /// codec wrote it so that the peer may answer in binary.
+  Uint8List _encodeControl(String targetIp, Map<String, Object?> message) {
+    final binary = _binaryControlPeers.contains(targetIp);
+    return NativeControlCodec.shared?.encode(message, binary: binary) ??
+        utf8.encode(jsonEncode(message));
+  }
+
   void _handleDiscoveryMessage(Datagram datagram) {
     try {
-      final message = utf8.decode(datagram.data);
-      final data = jsonDecode(message);
+      // The native codec reads binary and JSON control messages alike;
+      // beacons and anything it doesn't know are still decoded here.
+      final data =
+          NativeControlCodec.shared?.decode(datagram.data) ??
+          jsonDecode(utf8.decode(datagram.data));
+      if (data[NativeControlCodec.versionKey] != null) {
+        _binaryControlPeers.add(datagram.address.address);
+      }
 
       final senderDeviceId = data['deviceId'] as String?;
       final messageType = data['type'] as String?;
@@ -979,6 +1147,14 @@ class DeviceDiscoveryService {
     final isFavorite =
         existingDevice?.isFavorite ?? duplicateByIp?.isFavorite ?? false;
 
+    // A peer on several of our networks beacons on each of them
+    final now = DateTime.now();
+    final seen = _peerAddresses.putIfAbsent(deviceId, () => {});
+    seen[ipAddress] = now;
+    seen.removeWhere(
+      (_, at) => now.difference(at).inSeconds >= PATH_TTL_SECONDS,
+    );
+
     // Update or add device
     _discoveredDevices[deviceId] = DiscoveredDevice(
       deviceId: deviceId,
@@ -990,11 +1166,49 @@ class DeviceDiscoveryService {
       isFavorite: isFavorite,
       avatarUrl: avatarUrl,
       userName: userName,
+      addresses: seen.keys.toList(),
     );
 
     _notifyListeners();
   }
 
+  /// Every network path to the peer at [host], for bonded transfers
+  ///
+  /// One path per address the peer's beacons arrived from lately, each
+  /// paired with our own address on that network so the stream leaves
+  /// through the right interface. Just [host] when the peer isn't known.
+  List<NetworkPath> pathsTo(String host) {
+    final now = DateTime.now();
+    for (final seen in _peerAddresses.values) {
+      if (!seen.containsKey(host)) continue;
+      final remotes = [
+        host,
+        for (final entry in seen.entries)
+          if (entry.key != host &&
+              now.difference(entry.value).inSeconds < PATH_TTL_SECONDS)
+            entry.key,
+      ];
+      return [
+        for (final remote in remotes)
+          (local: _localAddressFor(remote) ?? '', remote: remote),
+      ];
+    }
+    return [(local: '', remote: host)];
+  }
+
+  /// Our address on the same /24 as [remote], as getBroadcastAddress
+  /// assumes
+  String? _localAddressFor(String remote) {
+    final prefix = remote.substring(0, remote.lastIndexOf('.') + 1);
+    if (prefix.isEmpty) return null;
+    for (final info in _networkInterfaces) {
+      for (final address in info.ipv4Addresses) {
+        if (address.address.startsWith(prefix)) return address.address;
+      }
+    }
+    return null;
+  }
+
   void _handleConnectionRequest(Map<String, dynamic> data, String ipAddress) {
     final deviceId = data['deviceId'] as String;
     final deviceName = data['deviceName'] as String;
@@ -1006,6 +1220,17 @@ class DeviceDiscoveryService {
     );
 
     // DEDUPLICATION: Check if we've already received a request from this device recently
+    final native = _nativeDiscovery;
+    if (native != null) {
+      // Expired on the engine's timer wheel rather than swept here
+      if (!native.firstInWindow(deviceId, _requestDeduplicationWindow)) {
+        print('   ⏭️  IGNORING duplicate request (within deduplication window)');
+        return;
+      }
+      _emitConnectionRequest(data, ipAddress);
+      return;
+    }
+
     final now = DateTime.now();
     final lastRequestTime = _recentConnectionRequests[deviceId];
 
@@ -1031,9 +1256,13 @@ class DeviceDiscoveryService {
       return now.difference(timestamp) > _requestDeduplicationWindow;
     });
 
+    _emitConnectionRequest(data, ipAddress);
+  }
+
+  void _emitConnectionRequest(Map<String, dynamic> data, String ipAddress) {
     final request = ConnectionRequest(
-      deviceId: deviceId,
-      deviceName: deviceName,
+      deviceId: data['deviceId'] as String,
+      deviceName: data['deviceName'] as String,
       platform: data['platform'] as String,
       ipAddress: ipAddress,
       port: (data['port'] as int?) ?? 8080,
@@ -1042,6 +1271,8 @@ class DeviceDiscoveryService {
       totalSize: data['totalSize'] as int,
       timestamp: DateTime.fromMillisecondsSinceEpoch(data['timestamp'] as int),
     );
+    // Connect and fetch the file list while the user reads the dialog
+    NativeConnectionPool.shared?.warm(ipAddress, request.port, list: true);
 
     // Check if controller is closed before adding
     if (!_connectionRequestController.isClosed) {
@@ -1084,7 +1315,7 @@ class DeviceDiscoveryService {
     if (_sockets.isEmpty) return;
 
     try {
-      final message = jsonEncode({
+      final data = _encodeControl(targetIp, {
         'type': 'ZAPSHARE_CAST_URL',
         'deviceId': _myDeviceId,
         'deviceName': _myDeviceName,
@@ -1094,8 +1325,6 @@ class DeviceDiscoveryService {
         'timestamp': DateTime.now().millisecondsSinceEpoch,
       });
 
-      final data = utf8.encode(message);
-
       for (final socket in _sockets) {
         try {
           socket.send(data, InternetAddress(targetIp), DISCOVERY_PORT);
@@ -1208,7 +1437,7 @@ class DeviceDiscoveryService {
   }) async {
     if (_sockets.isEmpty) return;
     try {
-      final message = jsonEncode({
+      final data = _encodeControl(targetIp, {
         'type': 'ZAPSHARE_CAST_CONTROL',
         'deviceId': _myDeviceId,
         'action': action,
@@ -1216,7 +1445,6 @@ class DeviceDiscoveryService {
         if (volume != null) 'volume': volume,
         'timestamp': DateTime.now().millisecondsSinceEpoch,
       });
-      final data = utf8.encode(message);
       for (final socket in _sockets) {
         try {
           socket.send(data, InternetAddress(targetIp), DISCOVERY_PORT);
@@ -1238,7 +1466,7 @@ class DeviceDiscoveryService {
   }) async {
     if (_sockets.isEmpty) return;
     try {
-      final message = jsonEncode({
+      final data = _encodeControl(targetIp, {
         'type': 'ZAPSHARE_CAST_STATUS',
         'deviceId': _myDeviceId,
         'position': position,
@@ -1250,7 +1478,6 @@ class DeviceDiscoveryService {
         'fileName': fileName,
         'timestamp': DateTime.now().millisecondsSinceEpoch,
       });
-      final data = utf8.encode(message);
       for (final socket in _sockets) {
         try {
           socket.send(data, InternetAddress(targetIp), DISCOVERY_PORT);
@@ -1276,14 +1503,13 @@ class DeviceDiscoveryService {
   Future<void> sendCastAck(String targetIp, bool accepted) async {
     if (_sockets.isEmpty) return;
     try {
-      final message = jsonEncode({
+      final data = _encodeControl(targetIp, {
         'type': 'ZAPSHARE_CAST_ACK',
         'deviceId': _myDeviceId,
         'deviceName': _myDeviceName,
         'accepted': accepted,
         'timestamp': DateTime.now().millisecondsSinceEpoch,
       });
-      final data = utf8.encode(message);
       for (final socket in _sockets) {
         try {
           socket.send(data, InternetAddress(targetIp), DISCOVERY_PORT);
@@ -1321,11 +1547,8 @@ class DeviceDiscoveryService {
         'streamUrl': streamUrl,
         'timestamp': DateTime.now().millisecondsSinceEpoch,
       };
-      final message = jsonEncode(payload);
-      print(
-        '📡 [Discovery] Encoded message (${message.length} bytes): $message',
-      );
-      final data = utf8.encode(message);
+      final data = _encodeControl(targetIp, payload);
+      print('📡 [Discovery] Encoded message (${data.length} bytes): $payload');
       // Send 3 times with short delays for UDP reliability
       int totalSent = 0;
       int totalFailed = 0;
@@ -1463,7 +1686,7 @@ class DeviceDiscoveryService {
   }) async {
     if (_sockets.isEmpty) return;
     try {
-      final message = jsonEncode({
+      final data = _encodeControl(targetIp, {
         'type': 'ZAPSHARE_SCREEN_MIRROR_CONTROL',
         'deviceId': _myDeviceId,
         'action': action,
@@ -1476,7 +1699,6 @@ class DeviceDiscoveryService {
         if (duration != null) 'duration': duration,
         'timestamp': DateTime.now().millisecondsSinceEpoch,
       });
-      final data = utf8.encode(message);
       for (final socket in _sockets) {
         try {
           socket.send(data, InternetAddress(targetIp), DISCOVERY_PORT);
@@ -1512,7 +1734,8 @@ class DeviceDiscoveryService {
       return;
     }
 
-    if (_broadcastTimer == null || !_broadcastTimer!.isActive) {
+    if (_nativeDiscovery == null &&
+        (_broadcastTimer == null || !_broadcastTimer!.isActive)) {
       print('⚠️  Service health check failed: broadcast timer not active');
       _startBroadcasting();
     }
@@ -1529,6 +1752,12 @@ class DeviceDiscoveryService {
     final now = DateTime.now();
     final staleDevices = <String>[];
 
+    // The engine reports peers going, not peers staying
+    for (final deviceId in _nativePeers) {
+      _discoveredDevices[deviceId]?.lastSeen = now;
+      _peerAddresses[deviceId]?.updateAll((address, seen) => now);
+    }
+
     _discoveredDevices.forEach((id, device) {
       // Remove devices not seen in 30 seconds (unless they're favorites or Wi-Fi Direct)
       if (!device.isFavorite &&
@@ -1622,6 +1851,10 @@ class DeviceDiscoveryService {
     _broadcastTimer?.cancel();
     _cleanupTimer?.cancel();
     _keepAliveTimer?.cancel();
+    _nativeDiscovery?.dispose();
+    _nativeDiscovery = null;
+    _nativePeers.clear();
+    _binaryControlPeers.clear();
 
     // Cancel Wi-Fi Direct subscription
     // WiFi Direct removed - using Bluetooth + Hotspot instead
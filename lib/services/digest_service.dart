@@ -0,0 +1,132 @@
+import 'dart:async';
+import 'dart:typed_data';
+
+import '../native/content_hash.dart';
+
+/// Chunk digests of the files a sender shares, for LIST metadata and
+/// `/digest/<index>`.
+///
+/// 1. Every response that streams part of a file, whole or ranged, feeds
+///    that file's one hasher, so parallel Range downloads hash it as they
+///    go just like a plain GET does
+/// 2. Chunks no response covered in order from their first byte (a piece
+///    retried from the middle, ranges smaller than a chunk arriving out of
+///    order) are read back from storage when a receiver asks for the
+///    digests, and only then
+/// 3. Finished digests are kept per file until its size changes
+class DigestService {
+  final Map<String, ChunkDigests> _digests = {};
+  final Map<String, NativeChunkHasher> _hashers = {};
+  final Map<String, Future<ChunkDigests?>> _completing = {};
+
+  /// Digests of [key] (a path or content URI) if every chunk has been
+  /// hashed, dropped if the file changed size since.
+  ChunkDigests? digestsFor(String key, int size) {
+    final digests = _digests[key];
+    return digests != null && digests.fileSize == size ? digests : null;
+  }
+
+  /// Fields for a LIST / `/list` entry, empty until the file is hashed.
+  Map<String, dynamic> fieldsFor(String key, int size) =>
+      digestsFor(key, size)?.toJson() ?? const {};
+
+  /// Feeds bytes of [key] a response is sending from [offset].
+  void update(String key, int size, int offset, Uint8List bytes) {
+    if (digestsFor(key, size) != null) return;
+    final hasher = _hasherFor(key, size);
+    if (hasher == null) return;
+    hasher.update(offset, bytes);
+    _settle(key, hasher);
+  }
+
+  /// Digests of [key], reading the chunks that haven't been hashed yet
+  /// from [read], which streams the whole file from its start. Null when
+  /// the native engine is missing or the file can't be read.
+  Future<ChunkDigests?> complete(
+    String key,
+    int size,
+    Stream<List<int>> Function() read,
+  ) {
+    final known = digestsFor(key, size);
+    if (known != null) return Future.value(known);
+    return _completing[key] ??= _complete(key, size, read).whenComplete(
+      () => _completing.remove(key),
+    );
+  }
+
+  Future<ChunkDigests?> _complete(
+    String key,
+    int size,
+    Stream<List<int>> Function() read,
+  ) async {
+    final hasher = _hasherFor(key, size);
+    if (hasher == null) return null;
+    final chunkSize = hasher.chunkSize;
+    final pending = BytesBuilder(copy: false);
+    var index = 0;
+    var position = 0;
+    try {
+      await for (final data in read()) {
+        // Responses may have hashed the rest while this was reading
+        if (digestsFor(key, size) != null) break;
+        final bytes = data is Uint8List ? data : Uint8List.fromList(data);
+        var at = 0;
+        while (at < bytes.length && index < hasher.chunkCount) {
+          final chunkStart = index * chunkSize;
+          final chunkEnd = chunkStart + chunkSize < size
+              ? chunkStart + chunkSize
+              : size;
+          final take = chunkEnd - position < bytes.length - at
+              ? chunkEnd - position
+              : bytes.length - at;
+          // Chunks already hashed are skipped rather than kept
+          if (hasher.chunkDigest(index) == null) {
+            pending.add(Uint8List.sublistView(bytes, at, at + take));
+          }
+          at += take;
+          position += take;
+          if (position == chunkEnd) {
+            // In one call, from the chunk's first byte, so a response
+            // feeding the same chunk meanwhile can't interleave with it
+            if (pending.isNotEmpty) {
+              hasher.update(chunkStart, pending.takeBytes());
+            }
+            index++;
+          }
+        }
+      }
+    } catch (e) {
+      print('⚠️ Could not hash $key: $e');
+      return digestsFor(key, size);
+    }
+    _settle(key, hasher);
+    return digestsFor(key, size);
+  }
+
+  NativeChunkHasher? _hasherFor(String key, int size) {
+    final hasher = _hashers[key];
+    if (hasher != null && hasher.fileSize == size) return hasher;
+    hasher?.dispose();
+    _hashers.remove(key);
+    final created = NativeChunkHasher.create(size);
+    if (created != null) _hashers[key] = created;
+    return created;
+  }
+
+  void _settle(String key, NativeChunkHasher hasher) {
+    if (!hasher.isComplete) return;
+    final digests = hasher.digests();
+    if (digests == null) return;
+    _digests[key] = digests;
+    if (identical(_hashers[key], hasher)) _hashers.remove(key);
+    hasher.dispose();
+    print('🔐 Hashed $key: ${digests.fileDigest.substring(0, 16)}…');
+  }
+
+  void dispose() {
+    for (final hasher in _hashers.values) {
+      hasher.dispose();
+    }
+    _hashers.clear();
+  }
+}
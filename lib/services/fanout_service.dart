@@ -0,0 +1,116 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:flutter/services.dart';
+
+import '../native/fanout.dart';
+import '../native/native_wakeup.dart';
+import 'read_ahead_service.dart';
+
+/// One disk read of a shared file for every receiver downloading it at
+/// once, instead of a file handle and a read stream per request.
+///
+/// 1. HTTP `/file`, TCP GET and v2 streams on the sender read through a
+///    [SharedFileReader] when the native engine is available
+/// 2. Readers of the same file share one sequential read-ahead on a native
+///    thread; each block comes off storage once and is copied out to every
+///    connection that needs it
+/// 3. A receiver that joins late, or asks for a range further on, reads from
+///    disk on its own until it reaches the shared position, and the fastest
+///    receiver is never held back by the slowest for long
+///
+/// Android content URIs are opened as a descriptor by the platform side
+/// and handed to the native cache. See `native/src/fanout.h`.
+class FanoutService {
+  static const int CHUNK_SIZE = 256 * 1024; // One ring block
+  static const MethodChannel _channel = MethodChannel('zapshare.saf');
+
+  static NativeFanoutCache? _cache;
+  static bool _resolved = false;
+
+  static NativeFanoutCache? get _shared {
+    if (!_resolved) {
+      _resolved = true;
+      _cache = NativeFanoutCache.create();
+    }
+    return _cache;
+  }
+
+  static bool get isAvailable => NativeFanoutCache.isAvailable;
+
+  /// Disk and served byte counts since the app started, for logging.
+  static FanoutStats? get stats => _shared?.stats;
+
+  /// A shared reader of bytes [start, end) of [source], a path or an
+  /// Android content URI; null when that isn't possible and the caller
+  /// should read the file itself.
+  static Future<SharedFileReader?> open(
+    String source, {
+    int start = 0,
+    int? end,
+  }) async {
+    final cache = _shared;
+    if (cache == null) return null;
+    if (!source.startsWith('content://')) {
+      final reader = cache.open(source, start: start, end: end);
+      return reader == null ? null : SharedFileReader._(reader);
+    }
+    if (!Platform.isAndroid) return null;
+    try {
+      final fd = await _channel.invokeMethod<int>('openFd', {'uri': source});
+      if (fd == null) return null;
+      final reader = cache.openFd(source, fd, start: start, end: end);
+      return reader == null ? null : SharedFileReader._(reader);
+    } catch (e) {
+      print('⚠️ Fanout: could not open $source: $e');
+      return null;
+    }
+  }
+
+  /// [source] as a stream of chunks, through a shared reader when possible
+  /// and from [fallback] otherwise.
+  static Stream<Uint8List> openRead(
+    String source, {
+    int start = 0,
+    int? end,
+    required Stream<Uint8List> Function() fallback,
+  }) async* {
+    final reader = await open(source, start: start, end: end);
+    if (reader == null) {
+      yield* fallback();
+      return;
+    }
+    try {
+      while (true) {
+        final chunk = await reader.read(CHUNK_SIZE);
+        if (chunk.isEmpty) break;
+        yield chunk;
+      }
+    } finally {
+      reader.close();
+    }
+  }
+}
+
+/// One connection's reads from a file shared through [FanoutService].
+class SharedFileReader implements FileChunkReader {
+  final NativeFanoutReader _native;
+
+  SharedFileReader._(this._native);
+
+  @override
+  int get remaining => _native.remaining;
+
+  @override
+  Future<Uint8List> read(int max) async {
+    final chunk = await _native.readReady(max);
+    if (chunk == null) {
+      throw const FileSystemException('Shared file read failed');
+    }
+    return chunk;
+  }
+
+  @override
+  void close() => _native.dispose();
+}
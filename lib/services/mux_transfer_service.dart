@@ -0,0 +1,596 @@
+import 'dart:async';
+import 'dart:collection';
+import 'dart:convert';
+import 'dart:io';
+import 'dart:typed_data';
+
+import '../native/mux.dart';
+import 'secure_channel_service.dart';
+
+/// Transfer protocol v2 on the TCP port: every file and the file list over
+/// one connection as framed, flow-controlled, prioritised streams.
+///
+/// 1. Senders with the native engine mark LIST entries with `mux: 2`
+/// 2. A receiver that sees it opens one connection, sends the magic
+///    `ZSM2` and pipelines a request per file instead of a connection,
+///    size line and ACK per file. The sender tells the versions apart by
+///    the first byte, so v1 peers keep working on the same port
+/// 3. Each request carries a priority; the sender interleaves DATA frames
+///    between files, most urgent first, within flow-control windows that
+///    reopen as the receiver writes bytes to disk
+/// 4. When both sides have it, the session runs encrypted inside an
+///    [EncryptedChannel]; see SecureChannelService
+///
+/// See `native/src/mux.h` for the framing.
+class MuxTransferService {
+  static const String LIST_FIELD = 'mux';
+  static const int MAGIC_FIRST_BYTE = 0x5A; // 'Z'; v1 starts 'L', 'B' or 0
+  static const List<int> SECURE_MAGIC = [0x5A, 0x53, 0x45, 0x31]; // "ZSE1"
+  static const int PARALLEL_FILES = 4; // Receiver downloads at once
+  static const int MAX_OPEN_READERS = 16; // Sender files open at once
+  static const Duration IDLE_TIMEOUT = Duration(minutes: 5); // Paused too
+
+  static bool get isAvailable => NativeMuxSession.isAvailable;
+
+  /// LIST entry fields advertising v2.
+  static Map<String, dynamic> get listFields =>
+      isAvailable ? const {LIST_FIELD: NativeMuxSession.version} : const {};
+
+  /// Whether a sender that listed [entry] speaks v2.
+  static bool canMux(Map<String, dynamic> entry) =>
+      isAvailable && entry[LIST_FIELD] == NativeMuxSession.version;
+
+  /// Waits for the first bytes on [socket] and returns which protocol they
+  /// open, along with all of the socket's input, those bytes included.
+  static Future<(TcpProtocol, Stream<Uint8List>)> detect(
+    Socket socket,
+  ) async {
+    final controller = StreamController<Uint8List>();
+    final first = Completer<TcpProtocol>();
+    final prefix = <int>[];
+    final subscription = socket.listen(
+      (chunk) {
+        if (!first.isCompleted) {
+          prefix.addAll(chunk.take(SECURE_MAGIC.length - prefix.length));
+          final protocol = _classify(prefix);
+          if (protocol != null) first.complete(protocol);
+        }
+        controller.add(chunk);
+      },
+      onError: controller.addError,
+      onDone: () {
+        if (!first.isCompleted) first.complete(TcpProtocol.v1);
+        controller.close();
+      },
+    );
+    controller
+      ..onPause = subscription.pause
+      ..onResume = subscription.resume
+      ..onCancel = subscription.cancel;
+    return (await first.future, controller.stream);
+  }
+
+  /// Null until enough of the magic has arrived to tell.
+  static TcpProtocol? _classify(List<int> prefix) {
+    if (prefix.isEmpty) return null;
+    if (prefix[0] != MAGIC_FIRST_BYTE || !isAvailable) return TcpProtocol.v1;
+    if (prefix.length < SECURE_MAGIC.length) return null;
+    for (int i = 0; i < SECURE_MAGIC.length; i++) {
+      if (prefix[i] != SECURE_MAGIC[i]) return TcpProtocol.mux;
+    }
+    return SecureChannelService.isAvailable
+        ? TcpProtocol.secure
+        : TcpProtocol.v1;
+  }
+}
+
+/// What a TCP client opened with: v1 text, a v2 session, or a v2 session
+/// inside an encrypted channel.
+enum TcpProtocol { v1, mux, secure }
+
+// ═══════════════════════════════════════════════════════════
+//   Sender
+// ═══════════════════════════════════════════════════════════
+
+class _Outgoing {
+  final int stream;
+  final int index;
+  final int priority;
+  final int end; // Bytes to send
+  final Stream<List<int>> Function() open;
+  StreamIterator<List<int>>? reader;
+  Uint8List? chunk;
+  int chunkPos = 0;
+  int sent = 0;
+  bool reading = false;
+
+  _Outgoing(this.stream, this.index, this.priority, this.end, this.open);
+}
+
+/// Serves one v2 connection: the file list and every requested file.
+class MuxServer {
+  final ByteChannel _channel;
+  final NativeMuxSession _session;
+  final int Function() _fileCount;
+  final List<Map<String, dynamic>> Function() _list;
+  final String Function(int index) _nameOf;
+  final int Function(int index) _sizeOf;
+  final Stream<List<int>> Function(int index) _read;
+  final void Function(int index)? _onSent;
+  final Map<int, _Outgoing> _streams = {};
+  Completer<void>? _wake;
+  bool _closing = false;
+
+  MuxServer._(
+    this._channel,
+    this._session,
+    this._fileCount,
+    this._list,
+    this._nameOf,
+    this._sizeOf,
+    this._read,
+    this._onSent,
+  );
+
+  /// Answers requests on [channel] until the receiver hangs up. [read]
+  /// streams a whole file; [onSent] runs as each one finishes. Closes
+  /// [channel] when done.
+  static Future<void> serve(
+    ByteChannel channel, {
+    required int Function() fileCount,
+    required List<Map<String, dynamic>> Function() list,
+    required String Function(int index) nameOf,
+    required int Function(int index) sizeOf,
+    required Stream<List<int>> Function(int index) read,
+    void Function(int index)? onSent,
+  }) async {
+    final session = NativeMuxSession.create(server: true);
+    if (session == null) {
+      channel.destroy();
+      return;
+    }
+    final server = MuxServer._(
+      channel,
+      session,
+      fileCount,
+      list,
+      nameOf,
+      sizeOf,
+      read,
+      onSent,
+    );
+    try {
+      await server._run(channel.input);
+    } catch (e) {
+      print('⚠️ Mux: connection failed: $e');
+    } finally {
+      for (final s in server._streams.values) {
+        await s.reader?.cancel();
+      }
+      session.dispose();
+      channel.destroy();
+    }
+  }
+
+  Future<void> _run(Stream<Uint8List> input) async {
+    final subscription = input.timeout(MuxTransferService.IDLE_TIMEOUT).listen(
+      (chunk) {
+        if (!_session.receive(chunk)) _closing = true;
+        _handleEvents();
+        _poke();
+      },
+      onError: (e) {
+        print('⚠️ Mux: receive failed: $e');
+        _closing = true;
+        _poke();
+      },
+      onDone: () {
+        _closing = true;
+        _poke();
+      },
+    );
+    try {
+      while (true) {
+        _feed();
+        final out = _session.take(
+          headroom: _channel.headroom,
+          tailroom: _channel.tailroom,
+        );
+        if (out.isNotEmpty) {
+          _channel.send(out);
+          await _channel.flush();
+          continue;
+        }
+        if (_closing) break;
+        _wake = Completer<void>();
+        await _wake!.future;
+      }
+    } finally {
+      await subscription.cancel();
+    }
+  }
+
+  void _poke() {
+    final wake = _wake;
+    _wake = null;
+    if (wake != null && !wake.isCompleted) wake.complete();
+  }
+
+  void _handleEvents() {
+    for (final e in _session.takeEvents()) {
+      switch (e.type) {
+        case MuxEventType.request:
+          _open(e.stream, e.a, e.b, e.c, e.d);
+        case MuxEventType.reset:
+          _streams.remove(e.stream)?.reader?.cancel();
+        case MuxEventType.goAway:
+          _closing = true;
+        default:
+          break;
+      }
+    }
+  }
+
+  void _open(int stream, int index, int offset, int length, int priority) {
+    if (index == NativeMuxSession.listIndex) {
+      final body = Uint8List.fromList(utf8.encode(jsonEncode(_list())));
+      _session.respond(stream, body.length, const []);
+      _streams[stream] = _Outgoing(
+        stream,
+        index,
+        0,
+        body.length,
+        () => Stream.value(body),
+      );
+      return;
+    }
+    if (index < 0 || index >= _fileCount()) {
+      _session.reset(stream, MuxError.notFound);
+      return;
+    }
+    final size = _sizeOf(index);
+    if (offset < 0 || offset > size) offset = size;
+    final available = size - offset;
+    final end = length < 0 || length > available ? available : length;
+    _session.respond(
+      stream,
+      end,
+      utf8.encode(
+        jsonEncode({
+          'fileName': _nameOf(index),
+          'fileSize': size,
+          'fileIndex': index,
+          'offset': offset,
+        }),
+      ),
+    );
+    _streams[stream] = _Outgoing(
+      stream,
+      index,
+      priority,
+      end,
+      () => _slice(_read(index), offset, end),
+    );
+  }
+
+  /// Queues file bytes on every stream with room, reading ahead one chunk
+  /// per stream. Only the [MuxTransferService.MAX_OPEN_READERS] most
+  /// urgent requests have their files open.
+  void _feed() {
+    final ordered = _streams.values.toList()
+      ..sort((a, b) => a.priority.compareTo(b.priority));
+    int readers = 0;
+    for (final s in ordered) {
+      if (s.sent == s.end && s.chunk == null) {
+        _finish(s);
+        continue;
+      }
+      if (s.reader == null) {
+        if (readers >= MuxTransferService.MAX_OPEN_READERS) continue;
+        s.reader = StreamIterator(s.open());
+      }
+      readers++;
+      final chunk = s.chunk;
+      if (chunk != null) {
+        s.chunkPos += _session.write(
+          s.stream,
+          Uint8List.sublistView(chunk, s.chunkPos),
+        );
+        if (s.chunkPos < chunk.length) continue;
+        s.chunk = null;
+        if (s.sent == s.end) {
+          _finish(s);
+          continue;
+        }
+      }
+      if (!s.reading) _readNext(s);
+    }
+  }
+
+  void _readNext(_Outgoing s) {
+    s.reading = true;
+    s.reader!.moveNext().then(
+      (more) {
+        s.reading = false;
+        if (!_streams.containsKey(s.stream)) return;
+        if (!more) {
+          // Shorter than it claimed to be.
+          _session.reset(s.stream, MuxError.internal);
+          _streams.remove(s.stream);
+        } else {
+          final current = s.reader!.current;
+          var chunk = current is Uint8List
+              ? current
+              : Uint8List.fromList(current);
+          if (chunk.length > s.end - s.sent) {
+            chunk = Uint8List.sublistView(chunk, 0, s.end - s.sent);
+          }
+          s.sent += chunk.length;
+          s.chunk = chunk;
+          s.chunkPos = 0;
+        }
+        _poke();
+      },
+      onError: (e) {
+        s.reading = false;
+        print('⚠️ Mux: could not read file ${s.index}: $e');
+        _session.reset(s.stream, MuxError.internal);
+        _streams.remove(s.stream);
+        _poke();
+      },
+    );
+  }
+
+  void _finish(_Outgoing s) {
+    _session.end(s.stream);
+    _streams.remove(s.stream);
+    s.reader?.cancel();
+    if (s.index != NativeMuxSession.listIndex) _onSent?.call(s.index);
+  }
+
+  /// [length] bytes of [source] starting at [offset].
+  static Stream<List<int>> _slice(
+    Stream<List<int>> source,
+    int offset,
+    int length,
+  ) async* {
+    int skip = offset;
+    int left = length;
+    await for (final chunk in source) {
+      if (left == 0) break;
+      if (skip >= chunk.length) {
+        skip -= chunk.length;
+        continue;
+      }
+      final end = chunk.length - skip > left ? skip + left : chunk.length;
+      yield skip == 0 && end == chunk.length
+          ? chunk
+          : chunk.sublist(skip, end);
+      left -= end - skip;
+      skip = 0;
+    }
+  }
+}
+
+// ═══════════════════════════════════════════════════════════
+//   Receiver
+// ═══════════════════════════════════════════════════════════
+
+/// A file on its way: the size and metadata the sender answered with, and
+/// the body. Reading [body] is what lets the sender send more, so it
+/// should be consumed at the pace bytes reach disk.
+class MuxBody {
+  final int size;
+  final Map<String, dynamic> metadata;
+  final Stream<List<int>> body;
+
+  const MuxBody(this.size, this.metadata, this.body);
+}
+
+class _Incoming {
+  final Completer<MuxBody> headers = Completer();
+  final Queue<Uint8List> chunks = Queue();
+  Completer<void>? arrived;
+  bool ended = false;
+  Object? error;
+
+  void notify() {
+    final a = arrived;
+    arrived = null;
+    if (a != null && !a.isCompleted) a.complete();
+  }
+}
+
+/// One v2 connection to a sender, shared by every download from it.
+class MuxClient {
+  final ByteChannel _channel;
+  final NativeMuxSession _session;
+  final Map<int, _Incoming> _streams = {};
+  final List<Completer<void>> _waitingForSlot = [];
+  late final StreamSubscription<Uint8List> _subscription;
+  bool _closed = false;
+
+  MuxClient._(this._channel, this._session) {
+    _subscription = _channel.input.listen(
+      (chunk) {
+        final ok = _session.receive(chunk);
+        _handleEvents();
+        _flush();
+        if (!ok) _fail(StateError('Sender broke protocol v2'));
+      },
+      onError: (e) => _fail(e),
+      onDone: () => _fail(const SocketException('Sender closed')),
+    );
+  }
+
+  /// Opens a session with the sender's TCP port, or null if that fails.
+  /// With a [pairingCode] the session is encrypted, and fails unless the
+  /// sender derived the same code.
+  static Future<MuxClient?> connect(
+    String host,
+    int port, {
+    String? pairingCode,
+  }) async {
+    final session = NativeMuxSession.create(server: false);
+    if (session == null) return null;
+    try {
+      final socket = await Socket.connect(
+        host,
+        port,
+        timeout: const Duration(seconds: 10),
+      );
+      socket.setOption(SocketOption.tcpNoDelay, true);
+      final ByteChannel? channel = pairingCode == null
+          ? PlainChannel(socket, socket)
+          : await EncryptedChannel.connect(socket, pairingCode);
+      if (channel == null) {
+        socket.destroy();
+        session.dispose();
+        return null;
+      }
+      final client = MuxClient._(channel, session);
+      client._flush(); // Magic and HELLO.
+      return client;
+    } catch (e) {
+      print('⚠️ Mux: connect failed: $e');
+      session.dispose();
+      return null;
+    }
+  }
+
+  bool get isClosed => _closed;
+
+  /// Requests file [index]; completes once the sender answers. Lower
+  /// [priority] values are sent first. Throws if the sender refuses.
+  Future<MuxBody> get(
+    int index, {
+    int priority = NativeMuxSession.defaultPriority,
+  }) async {
+    while (!_closed &&
+        _session.openStreams >= NativeMuxSession.maxStreams) {
+      final slot = Completer<void>();
+      _waitingForSlot.add(slot);
+      await slot.future;
+    }
+    if (_closed) throw const SocketException('Mux session closed');
+    final id = _session.request(index, priority: priority);
+    if (id == 0) throw const SocketException('Mux session closing');
+    final incoming = _Incoming();
+    _streams[id] = incoming;
+    _flush();
+    return incoming.headers.future;
+  }
+
+  /// The sender's file list, as LIST returns it.
+  Future<List<Map<String, dynamic>>> list() async {
+    final response = await get(NativeMuxSession.listIndex, priority: 0);
+    final bytes = BytesBuilder(copy: false);
+    await for (final chunk in response.body) {
+      bytes.add(chunk);
+    }
+    return (jsonDecode(utf8.decode(bytes.takeBytes())) as List)
+        .cast<Map<String, dynamic>>();
+  }
+
+  void close() {
+    if (_closed) return;
+    _session.goAway(MuxError.none);
+    _flush();
+    _fail(const SocketException('Mux session closed'), graceful: true);
+  }
+
+  Stream<List<int>> _body(int id, _Incoming s) async* {
+    try {
+      while (true) {
+        if (s.chunks.isNotEmpty) {
+          final chunk = s.chunks.removeFirst();
+          yield chunk;
+          // Back here once the consumer is done with it.
+          _session.consumed(id, chunk.length);
+          _flush();
+          continue;
+        }
+        if (s.error != null) throw s.error!;
+        if (s.ended) return;
+        s.arrived = Completer<void>();
+        await s.arrived!.future;
+      }
+    } finally {
+      if (_streams.remove(id) != null && !s.ended && !_closed) {
+        _session.reset(id, MuxError.cancel);
+        _flush();
+      }
+      _releaseSlot();
+    }
+  }
+
+  void _handleEvents() {
+    for (final e in _session.takeEvents()) {
+      final s = _streams[e.stream];
+      switch (e.type) {
+        case MuxEventType.headers:
+          if (s == null || s.headers.isCompleted) break;
+          Map<String, dynamic> metadata = const {};
+          if (e.data.isNotEmpty) {
+            metadata = jsonDecode(utf8.decode(e.data)) as Map<String, dynamic>;
+          }
+          s.headers.complete(MuxBody(e.a, metadata, _body(e.stream, s)));
+        case MuxEventType.data:
+          s?.chunks.add(e.data);
+          s?.notify();
+        case MuxEventType.end:
+          s?.ended = true;
+          s?.notify();
+        case MuxEventType.reset:
+          if (s == null) break;
+          _streams.remove(e.stream);
+          final error = SocketException('Sender reset stream (${e.a})');
+          if (!s.headers.isCompleted) {
+            s.headers.completeError(error);
+            _releaseSlot();
+          }
+          s.error = error;
+          s.notify();
+        case MuxEventType.goAway:
+          _fail(SocketException('Sender going away (${e.a})'));
+        default:
+          break;
+      }
+    }
+  }
+
+  void _flush() {
+    if (_closed) return;
+    final out = _session.take(
+      headroom: _channel.headroom,
+      tailroom: _channel.tailroom,
+    );
+    if (out.isNotEmpty) _channel.send(out);
+  }
+
+  void _releaseSlot() {
+    if (_waitingForSlot.isNotEmpty) _waitingForSlot.removeAt(0).complete();
+  }
+
+  void _fail(Object error, {bool graceful = false}) {
+    if (_closed) return;
+    _closed = true;
+    for (final s in _streams.values) {
+      if (!s.headers.isCompleted) s.headers.completeError(error);
+      if (!s.ended) s.error = error;
+      s.notify();
+    }
+    _streams.clear();
+    for (final slot in _waitingForSlot) {
+      slot.complete();
+    }
+    _waitingForSlot.clear();
+    _subscription.cancel();
+    if (graceful) {
+      _channel.close().catchError((_) => _channel.destroy());
+    } else {
+      _channel.destroy();
+    }
+    _session.dispose();
+  }
+}
@@ -1,21 +1,56 @@
 import 'dart:io';
 import 'dart:async';
+import 'dart:convert';
 import 'package:http/http.dart' as http;
 
+import '../native/connection_pool.dart';
+import '../native/content_hash.dart';
+import '../native/path_manager.dart';
+import '../native/range_receiver.dart';
+import '../native/resume_journal.dart';
+import '../native/sparse_file.dart';
+import 'device_discovery_service.dart';
+import 'sparse_transfer_service.dart';
+
+/// What the integrity check could say about a finished download.
+///
+/// A download whose chunks can't be made to match the sender's digests
+/// throws instead.
+enum IntegrityResult {
+  /// Every chunk matched the sender's digests, after any repairs.
+  verified,
+
+  /// Nothing to check against: the sender published no digests, or the
+  /// native engine isn't available to hash what arrived.
+  unverified,
+}
+
 /// Advanced Parallel HTTP Transfer Service
 /// 
 /// This service implements multi-stream parallel downloading to dramatically
 /// increase file transfer speeds by:
 /// 1. Splitting files into chunks
 /// 2. Downloading multiple chunks simultaneously
-/// 3. Reassembling chunks in correct order
-/// 4. Using HTTP Range requests for resumable transfers
+/// 3. Writing every chunk straight to its offset in the destination
+/// 4. Using HTTP Range requests for resumable transfers, with a crash-safe
+///    journal so an interrupted download picks up where it stopped
+/// 5. Hashing every 4MB chunk inline and re-requesting only corrupted ones
+/// 6. Receiving natively where possible: the body goes from the socket to
+///    the preallocated file without passing through Dart (spliced on Linux
+///    and Android), and is synced every few chunks instead of per write
+/// 7. Skipping the holes of sparse files: only chunks holding data are
+///    requested and the rest of the part file stays unallocated
+/// 8. Bonding every network the sender is reachable on (Wi-Fi, Ethernet,
+///    Wi-Fi Direct): pieces go over each in proportion to its measured
+///    throughput, and a network that drops just hands its pieces back
 class ParallelTransferService {
   // Configuration
   static const int DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024; // 4MB chunks for maximum speed
   static const int DEFAULT_PARALLEL_STREAMS = 8; // default parallel connections increased
   static const int MAX_PARALLEL_STREAMS = 12; // Maximum parallel connections increased
   static const int MIN_FILE_SIZE_FOR_PARALLEL = 1024 * 1024; // 1MB minimum
+  static const String PART_SUFFIX = '.zspart'; // In-progress parallel download
+  static const Duration RECEIVE_POLL = Duration(milliseconds: 50);
   
   final int parallelStreams;
   final int chunkSize;
@@ -32,12 +67,20 @@ class ParallelTransferService {
   /// [onProgress] - Callback for progress updates (0.0 to 1.0)
   /// [onSpeedUpdate] - Callback for speed updates in Mbps
   /// [isPaused] - Function to check if download should pause
-  Future<void> downloadFile({
+  /// [expectedDigests] - Chunk digests from the sender's LIST metadata; when
+  /// omitted they are fetched from `/digest/<index>` after the download
+  /// [peerId] - Identifies the sender for resuming; defaults to [url]
+  ///
+  /// Returns whether the file could be checked against the sender's
+  /// digests; a file that fails the check throws.
+  Future<IntegrityResult> downloadFile({
     required String url,
     required String savePath,
     Function(double progress)? onProgress,
     Function(double speedMbps)? onSpeedUpdate,
     bool Function()? isPaused,
+    ChunkDigests? expectedDigests,
+    String? peerId,
   }) async {
     // Get file size using HEAD request
     final headResponse = await http.head(Uri.parse(url));
@@ -53,23 +96,83 @@ class ParallelTransferService {
     final acceptRanges = headResponse.headers['accept-ranges'];
     final supportsRanges = acceptRanges == 'bytes';
     
+    // Sparse files: only the extents holding data are fetched
+    final extents = supportsRanges
+        ? await SparseTransferService.fetch(url, contentLength)
+        : null;
+
     // Decide whether to use parallel download
-    final useParallel = supportsRanges && 
-                        contentLength >= MIN_FILE_SIZE_FOR_PARALLEL;
-    
-    if (!useParallel) {
-      // Fall back to single-stream download
-      await _downloadSingleStream(
+    final useParallel = supportsRanges &&
+        (contentLength >= MIN_FILE_SIZE_FOR_PARALLEL || extents != null);
+
+    // Part of the file identity a resumed download must match
+    int modifiedMs = 0;
+    final lastModified = headResponse.headers['last-modified'];
+    if (lastModified != null) {
+      try {
+        modifiedMs = HttpDate.parse(lastModified).millisecondsSinceEpoch;
+      } catch (_) {}
+    }
+
+    // Hashes every byte as it lands; null where the native engine is missing
+    final hasher = NativeChunkHasher.create(contentLength);
+
+    try {
+      if (!useParallel) {
+        // Fall back to single-stream download
+        await _downloadSingleStream(
+          url: url,
+          savePath: savePath,
+          contentLength: contentLength,
+          hasher: hasher,
+          onProgress: onProgress,
+          onSpeedUpdate: onSpeedUpdate,
+          isPaused: isPaused,
+        );
+      } else {
+        await _downloadParallel(
+          url: url,
+          savePath: savePath,
+          contentLength: contentLength,
+          peerId: peerId ?? url,
+          modifiedMs: modifiedMs,
+          expectedDigest: expectedDigests?.fileDigest,
+          extents: extents,
+          hasher: hasher,
+          onProgress: onProgress,
+          onSpeedUpdate: onSpeedUpdate,
+          isPaused: isPaused,
+        );
+      }
+
+      if (hasher == null || !supportsRanges) {
+        print('⚠️ $savePath is unverified: nothing to hash or repair with');
+        return IntegrityResult.unverified;
+      }
+      return await verify(
         url: url,
         savePath: savePath,
-        contentLength: contentLength,
-        onProgress: onProgress,
-        onSpeedUpdate: onSpeedUpdate,
-        isPaused: isPaused,
+        hasher: hasher,
+        expected: expectedDigests,
       );
-      return;
+    } finally {
+      hasher?.dispose();
     }
+  }
 
+  Future<void> _downloadParallel({
+    required String url,
+    required String savePath,
+    required int contentLength,
+    required String peerId,
+    int modifiedMs = 0,
+    String? expectedDigest,
+    ExtentMap? extents,
+    NativeChunkHasher? hasher,
+    Function(double progress)? onProgress,
+    Function(double speedMbps)? onSpeedUpdate,
+    bool Function()? isPaused,
+  }) async {
     // Calculate optimal number of streams based on file size
     final optimalStreams = _calculateOptimalStreams(contentLength);
     final actualStreams = optimalStreams < parallelStreams 
@@ -84,6 +187,11 @@ class ParallelTransferService {
       savePath: savePath,
       contentLength: contentLength,
       streams: actualStreams,
+      peerId: peerId,
+      modifiedMs: modifiedMs,
+      expectedDigest: expectedDigest,
+      extents: extents,
+      hasher: hasher,
       onProgress: onProgress,
       onSpeedUpdate: onSpeedUpdate,
       isPaused: isPaused,
@@ -116,11 +224,37 @@ class ParallelTransferService {
     required String url,
     required String savePath,
     required int contentLength,
+    NativeChunkHasher? hasher,
     Function(double progress)? onProgress,
     Function(double speedMbps)? onSpeedUpdate,
     bool Function()? isPaused,
   }) async {
     final file = File(savePath);
+    if (_canReceiveNatively(url)) {
+      await file.writeAsBytes(const []);
+      NativeRangeReceiver.preallocate(savePath, contentLength);
+      DateTime lastUpdate = DateTime.now();
+      final stats = await _receiveNative(
+        url: url,
+        start: 0,
+        end: contentLength - 1,
+        path: savePath,
+        ranged: false,
+        hasher: hasher,
+        isPaused: isPaused,
+        onProgress: (received, speedMbps) {
+          final now = DateTime.now();
+          if (now.difference(lastUpdate).inMilliseconds > 100) {
+            onProgress?.call(received / contentLength);
+            onSpeedUpdate?.call(speedMbps);
+            lastUpdate = now;
+          }
+        },
+      );
+      _logNativeReceive(stats.received, stats.cpuNs, stats.spliced);
+      return;
+    }
+
     final sink = file.openWrite();
     
     final client = http.Client();
@@ -138,6 +272,7 @@ class ParallelTransferService {
         await Future.delayed(Duration(milliseconds: 100));
       }
       
+      hasher?.update(received, chunk);
       sink.add(chunk);
       received += chunk.length;
       
@@ -166,131 +301,240 @@ class ParallelTransferService {
   }
 
   /// Parallel streams download
+  ///
+  /// Streams write straight into `<savePath>.zspart` at their own offsets.
+  /// A resume journal next to the destination records every chunk as it
+  /// lands, so if the app dies mid-transfer the next call with the same
+  /// peer and file fetches only the missing ranges. The part file is renamed
+  /// into place once every chunk is on disk. With the sender's [extents]
+  /// the part file gets the same holes, and chunks that are all hole count
+  /// as done before anything is fetched.
   Future<void> _downloadParallelStreams({
     required String url,
     required String savePath,
     required int contentLength,
     required int streams,
+    required String peerId,
+    int modifiedMs = 0,
+    String? expectedDigest,
+    ExtentMap? extents,
+    NativeChunkHasher? hasher,
     Function(double progress)? onProgress,
     Function(double speedMbps)? onSpeedUpdate,
     bool Function()? isPaused,
   }) async {
-    // Calculate chunk ranges for each stream
-    final chunkSize = contentLength ~/ streams;
-    final ranges = <Map<String, int>>[];
-    
-    for (int i = 0; i < streams; i++) {
-      final start = i * chunkSize;
-      final end = (i == streams - 1) 
-          ? contentLength - 1 
-          : (start + chunkSize - 1);
-      
-      ranges.add({'start': start, 'end': end, 'size': end - start + 1});
+    final partFile = File('$savePath$PART_SUFFIX');
+    final journal = NativeResumeJournal.open(
+      destination: savePath,
+      peerId: peerId,
+      fileSize: contentLength,
+      modifiedMs: modifiedMs,
+      digest: expectedDigest,
+    );
+
+    final resuming =
+        journal != null &&
+        journal.resumed &&
+        await partFile.exists() &&
+        await partFile.length() == contentLength;
+    const chunk = ChunkDigests.defaultChunkSize;
+    var holes = const <int>[];
+    if (!resuming) {
+      // Bits without their part file are worthless
+      for (final index in journal?.doneChunks() ?? const <int>[]) {
+        journal!.clearChunk(index);
+      }
+      final raf = await partFile.open(mode: FileMode.write);
+      if (extents != null && NativeSparseFile.prepare(partFile.path, extents)) {
+        holes = extents.holeChunks(chunk);
+      } else if (!NativeRangeReceiver.preallocate(
+        partFile.path,
+        contentLength,
+      )) {
+        // Reserved rather than left sparse, so the download can't run out
+        // of space halfway or end up scattered across the disk
+        await raf.truncate(contentLength);
+      }
+      await raf.close();
+      for (final index in holes) {
+        journal?.markChunk(index);
+        final start = index * chunk;
+        hasher?.updateZeros(
+          start,
+          start + chunk > contentLength ? contentLength - start : chunk,
+        );
+      }
+    } else {
+      print(
+        '♻️ Resuming: ${journal!.completedChunks}/${journal.chunkCount} chunks already on disk',
+      );
+      // Chunks from the earlier attempt still have to be covered by the
+      // integrity check; re-hashing them also catches pages lost to a crash
+      if (hasher != null) {
+        await _hashExistingChunks(
+          partFile.path,
+          journal,
+          hasher,
+          holes: extents?.holeChunks(chunk).toSet() ?? const {},
+        );
+      }
     }
-    
-    print('📊 Chunk ranges: ${ranges.map((r) => '${r["start"]}-${r["end"]}').join(", ")}');
-    
-    // Create temporary files for each chunk
-    final tempFiles = <int, RandomAccessFile>{};
-    final tempPaths = <int, String>{};
-    
-    for (int i = 0; i < streams; i++) {
-      final tempPath = '$savePath.part$i';
-      tempPaths[i] = tempPath;
-      final file = File(tempPath);
-      tempFiles[i] = await file.open(mode: FileMode.write);
+
+    final missing =
+        journal?.missingRanges() ??
+        (holes.isNotEmpty
+            ? extents!.chunkRanges(chunk)
+            : [(start: 0, end: contentLength - 1)]);
+    final missingBytes = missing.fold<int>(
+      0,
+      (n, r) => n + r.end - r.start + 1,
+    );
+    final alreadyOnDisk = contentLength - missingBytes;
+    final native = _canReceiveNatively(url);
+    // Over several networks pieces are single chunks, so the work can
+    // follow each network's speed
+    final paths = native ? _pathsFor(url) : null;
+    final pieces = _splitRanges(
+      missing,
+      paths != null ? missingBytes ~/ chunk + 1 : streams,
+    );
+    if (holes.isNotEmpty) {
+      print('🕳️ Skipping ${holes.length} hole chunk(s)');
     }
-    
+    final workers = pieces.length < streams ? pieces.length : streams;
+
+    print(
+      '📊 Fetching ${pieces.length} range(s) over $workers streams: '
+      '${pieces.map((r) => '${r.start}-${r.end}').join(", ")}',
+    );
+
     // Track progress for each stream
-    final streamProgress = List<int>.filled(streams, 0);
-    final streamSpeeds = List<double>.filled(streams, 0.0);
+    final streamProgress = List<int>.filled(workers, 0);
+    final streamSpeeds = List<double>.filled(workers, 0.0);
+    final openFiles = <RandomAccessFile>[];
     DateTime lastUpdate = DateTime.now();
-    
+    int nextPiece = 0;
+    int nativeBytes = 0;
+    int nativeCpuNs = 0;
+    bool spliced = false;
+
     try {
-      // Download all chunks in parallel
+      // Each worker keeps one handle and pulls ranges until none are left
       await Future.wait(
-        List.generate(streams, (index) async {
-          final range = ranges[index];
-          final start = range['start']!;
-          final end = range['end']!;
-          
-          await _downloadChunk(
-            url: url,
-            start: start,
-            end: end,
-            file: tempFiles[index]!,
-            onProgress: (bytesReceived, speed) {
-              streamProgress[index] = bytesReceived;
-              streamSpeeds[index] = speed;
-              
-              // Calculate overall progress
-              final now = DateTime.now();
-              if (now.difference(lastUpdate).inMilliseconds > 100) {
-                final totalReceived = streamProgress.reduce((a, b) => a + b);
-                // Cap at 95% during download, reserve 5% for merge
-                final downloadProgress = (totalReceived / contentLength) * 0.95;
-                onProgress?.call(downloadProgress);
-                
-                // Calculate combined speed
-                final totalSpeed = streamSpeeds.reduce((a, b) => a + b);
-                onSpeedUpdate?.call(totalSpeed);
-                
-                lastUpdate = now;
-              }
-            },
-            isPaused: isPaused,
-          );
+        List.generate(workers, (index) async {
+          final raf = native
+              ? null
+              : await partFile.open(mode: FileMode.append);
+          if (raf != null) openFiles.add(raf);
+          int finishedBytes = 0;
+
+          void progress(int bytesReceived, double speed) {
+            streamProgress[index] = finishedBytes + bytesReceived;
+            streamSpeeds[index] = speed;
+
+            // Calculate overall progress
+            final now = DateTime.now();
+            if (now.difference(lastUpdate).inMilliseconds > 100) {
+              final totalReceived =
+                  alreadyOnDisk + streamProgress.reduce((a, b) => a + b);
+              onProgress?.call(totalReceived / contentLength);
+
+              // Calculate combined speed
+              final totalSpeed = streamSpeeds.reduce((a, b) => a + b);
+              onSpeedUpdate?.call(totalSpeed);
+
+              lastUpdate = now;
+            }
+          }
+
+          while (nextPiece < pieces.length) {
+            final piece = pieces[nextPiece++];
+            if (raf == null) {
+              final stats = paths != null
+                  ? await _receiveOverPaths(
+                      paths,
+                      url: url,
+                      start: piece.start,
+                      end: piece.end,
+                      path: partFile.path,
+                      hasher: hasher,
+                      journal: journal,
+                      onProgress: progress,
+                      isPaused: isPaused,
+                    )
+                  : await _receiveNative(
+                      url: url,
+                      start: piece.start,
+                      end: piece.end,
+                      path: partFile.path,
+                      hasher: hasher,
+                      journal: journal,
+                      onProgress: progress,
+                      isPaused: isPaused,
+                    );
+              nativeBytes += stats.received;
+              nativeCpuNs += stats.cpuNs;
+              spliced |= stats.spliced;
+            } else {
+              await raf.setPosition(piece.start);
+              await _downloadChunk(
+                url: url,
+                start: piece.start,
+                end: piece.end,
+                file: raf,
+                hasher: hasher,
+                journal: journal,
+                onProgress: progress,
+                isPaused: isPaused,
+              );
+            }
+            finishedBytes += piece.end - piece.start + 1;
+          }
+          await raf?.flush();
         }),
       );
-      
-      // Close all temp files
-      for (final file in tempFiles.values) {
-        await file.flush();
-        await file.close();
-      }
-      
-      // Merge all chunks into final file
-      print('🔄 Merging chunks...');
-      if (onProgress != null) {
-        onProgress(0.95); // Start merge at 95%
-      }
-      
-      await _mergeChunks(
-        tempPaths, 
-        savePath, 
-        streams,
-        onProgress: onProgress,
-      );
-      
-      if (onProgress != null) {
-        onProgress(1.0); // Complete
+
+      for (final raf in openFiles) {
+        await raf.close();
       }
-      
+      openFiles.clear();
+      journal?.close();
+
+      // Move into place; the journal has served its purpose
+      final target = File(savePath);
+      if (await target.exists()) await target.delete();
+      await partFile.rename(savePath);
+      NativeResumeJournal.delete(savePath);
+
+      if (native) _logNativeReceive(nativeBytes, nativeCpuNs, spliced);
+      if (paths != null) _logPaths(paths);
+      onProgress?.call(1.0);
       print('✅ Download complete!');
-      
     } finally {
-      // Clean up temp files
-      for (final file in tempFiles.values) {
+      paths?.dispose();
+      for (final raf in openFiles) {
         try {
-          await file.close();
-        } catch (_) {}
-      }
-      
-      for (final path in tempPaths.values) {
-        try {
-          await File(path).delete();
+          await raf.close();
         } catch (_) {}
       }
+      // The part file and journal stay behind for the next attempt
+      journal?.sync();
+      journal?.close();
     }
   }
 
   /// Download a single chunk with range request
+  ///
+  /// [file] must already be positioned at [start]. Every digest chunk that
+  /// is fully written is marked in [journal].
   Future<void> _downloadChunk({
     required String url,
     required int start,
     required int end,
     required RandomAccessFile file,
     required Function(int bytesReceived, double speedMbps) onProgress,
+    NativeChunkHasher? hasher,
+    NativeResumeJournal? journal,
     bool Function()? isPaused,
   }) async {
     final client = http.Client();
@@ -306,6 +550,7 @@ class ParallelTransferService {
       }
       
       int received = 0;
+      int nextToMark = journal != null ? start ~/ journal.chunkSize : 0;
       DateTime lastSpeedTime = DateTime.now();
       int lastBytes = 0;
       
@@ -315,8 +560,19 @@ class ParallelTransferService {
           await Future.delayed(Duration(milliseconds: 100));
         }
         
+        hasher?.update(start + received, chunk);
         await file.writeFrom(chunk);
         received += chunk.length;
+
+        // Record chunks only once their bytes are written
+        if (journal != null) {
+          final written = start + received;
+          while (nextToMark < journal.chunkCount) {
+            final chunkEnd = (nextToMark + 1) * journal.chunkSize;
+            if (written < chunkEnd && written < journal.fileSize) break;
+            journal.markChunk(nextToMark++);
+          }
+        }
         
         // Calculate speed
         final now = DateTime.now();
@@ -332,63 +588,370 @@ class ParallelTransferService {
         
         onProgress(received, speedMbps);
       }
+
+      if (received != end - start + 1) {
+        throw Exception('Range $start-$end ended after $received bytes');
+      }
       
     } finally {
       client.close();
     }
   }
 
-  /// Merge downloaded chunks into final file
-  Future<void> _mergeChunks(
-    Map<int, String> tempPaths,
-    String finalPath,
-    int streams, {
-    Function(double progress)? onProgress,
+  /// Whether [url] can be fetched by a [NativeRangeReceiver]; it speaks
+  /// plain HTTP only, and isn't available on Windows
+  static bool _canReceiveNatively(String url) =>
+      NativeRangeReceiver.isAvailable && Uri.parse(url).scheme == 'http';
+
+  /// Download bytes [start, end] of [url] into [path] natively
+  ///
+  /// The receiver runs on its own thread and is polled for progress and
+  /// pauses. Digest chunks are marked in [journal] only once the receiver
+  /// reports them synced, so a crash can never leave a chunk recorded whose
+  /// bytes didn't reach storage. [via] sends the request over that network
+  /// path instead of to [url]'s host.
+  Future<ReceiveStats> _receiveNative({
+    required String url,
+    required int start,
+    required int end,
+    required String path,
+    required Function(int bytesReceived, double speedMbps) onProgress,
+    bool ranged = true,
+    NativeChunkHasher? hasher,
+    NativeResumeJournal? journal,
+    bool Function()? isPaused,
+    NetworkPath? via,
   }) async {
-    final finalFile = File(finalPath);
-    final sink = finalFile.openWrite();
-    
+    final uri = Uri.parse(url);
+    final receiver = NativeRangeReceiver.start(
+      url: via != null ? uri.replace(host: via.remote) : uri,
+      start: start,
+      end: end + 1,
+      path: path,
+      ranged: ranged,
+      hasher: hasher,
+      bindAddress: via == null || via.local.isEmpty ? null : via.local,
+      // Discovery warmed it when the sender asked to share
+      pool: NativeConnectionPool.shared,
+    );
+    if (receiver == null) throw Exception('Could not open $path');
+
     try {
-      int mergedBytes = 0;
-      int totalBytes = 0;
-      
-      // Calculate total size first
-      for (int i = 0; i < streams; i++) {
-        final tempPath = tempPaths[i]!;
-        final tempFile = File(tempPath);
-        if (await tempFile.exists()) {
-          totalBytes += await tempFile.length();
+      int nextToMark = journal != null ? start ~/ journal.chunkSize : 0;
+      DateTime lastSpeedTime = DateTime.now();
+      int lastBytes = 0;
+
+      while (true) {
+        // Read before the stats, which are final once it isn't running
+        final finished = receiver.state != ReceiveState.running;
+        receiver.paused = isPaused?.call() ?? false;
+        final stats = receiver.stats;
+
+        if (journal != null) {
+          final durable = start + stats.durable;
+          while (nextToMark < journal.chunkCount) {
+            final chunkEnd = (nextToMark + 1) * journal.chunkSize;
+            if (durable < chunkEnd && durable < journal.fileSize) break;
+            journal.markChunk(nextToMark++);
+          }
         }
+
+        final now = DateTime.now();
+        final elapsed = now.difference(lastSpeedTime).inMilliseconds;
+        double speedMbps = 0.0;
+        if (elapsed > 0) {
+          speedMbps = ((stats.received - lastBytes) * 8) / (elapsed * 1000);
+          lastBytes = stats.received;
+          lastSpeedTime = now;
+        }
+        onProgress(stats.received, speedMbps);
+
+        if (finished) break;
+        await Future.delayed(RECEIVE_POLL);
       }
-      
-      for (int i = 0; i < streams; i++) {
-        final tempPath = tempPaths[i]!;
-        final tempFile = File(tempPath);
-        
-        if (!await tempFile.exists()) {
-          throw Exception('Temp file $i does not exist');
+
+      if (receiver.state != ReceiveState.done) {
+        throw _ReceiveFailed(
+          'Range $start-$end failed: ${receiver.error.name} '
+          '(HTTP ${receiver.httpStatus})',
+          receiver.error,
+          receiver.stats,
+        );
+      }
+      return receiver.stats;
+    } finally {
+      receiver.dispose();
+    }
+  }
+
+  /// The network paths to [url]'s host, when discovery has seen it on more
+  /// than one network and the native engine is there to bond them
+  static NativePathManager? _pathsFor(String url) {
+    final found = DeviceDiscoveryService().pathsTo(Uri.parse(url).host);
+    if (found.length < 2) return null;
+    final paths = NativePathManager.create();
+    if (paths == null) return null;
+    for (final path in found) {
+      paths.add(path);
+    }
+    final described = found.map(
+      (p) => '${p.local.isEmpty ? '*' : p.local}->${p.remote}',
+    );
+    print('🛣️ Bonding ${found.length} paths: ${described.join(", ")}');
+    return paths;
+  }
+
+  /// Download bytes [start, end] of [url] natively over whichever of
+  /// [paths] would finish them soonest
+  ///
+  /// When the path drops mid-piece it's marked down and the rest of the
+  /// piece goes over another one, picking up at the first missing byte.
+  Future<ReceiveStats> _receiveOverPaths(
+    NativePathManager paths, {
+    required String url,
+    required int start,
+    required int end,
+    required String path,
+    required Function(int bytesReceived, double speedMbps) onProgress,
+    NativeChunkHasher? hasher,
+    NativeResumeJournal? journal,
+    bool Function()? isPaused,
+  }) async {
+    int from = start;
+    int cpuNs = 0;
+    bool spliced = false;
+    while (true) {
+      final id = paths.assign(end - from + 1);
+      if (id == NativePathManager.noPathsLeft) {
+        throw Exception('Range $from-$end failed: every network dropped');
+      }
+      if (id == NativePathManager.allPathsDown) {
+        await Future.delayed(RECEIVE_POLL);
+        continue;
+      }
+      int reported = 0;
+      try {
+        final stats = await _receiveNative(
+          url: url,
+          start: from,
+          end: end,
+          path: path,
+          hasher: hasher,
+          journal: journal,
+          isPaused: isPaused,
+          via: paths.path(id),
+          onProgress: (received, speed) {
+            paths.delivered(id, received - reported);
+            reported = received;
+            onProgress(from - start + received, speed);
+          },
+        );
+        paths.release(id, 0);
+        return ReceiveStats(
+          end - start + 1,
+          end - start + 1,
+          stats.syncs,
+          cpuNs + stats.cpuNs,
+          spliced || stats.spliced,
+          stats.warm,
+        );
+      } on _ReceiveFailed catch (e) {
+        // Only a broken connection says anything about the network
+        final dropped =
+            e.error == ReceiveError.connect || e.error == ReceiveError.closed;
+        paths.release(id, end - from + 1 - reported, failed: dropped);
+        if (!dropped) rethrow;
+        final via = paths.path(id);
+        print('🛣️ Path ${via.remote} dropped at byte ${from + reported}');
+        from += reported;
+        cpuNs += e.stats.cpuNs;
+        spliced |= e.stats.spliced;
+      }
+    }
+  }
+
+  static void _logPaths(NativePathManager paths) {
+    for (int id = 0; id < paths.length; id++) {
+      final stats = paths.stats(id);
+      print(
+        '🛣️ ${paths.path(id).remote}: '
+        '${stats.delivered ~/ (1024 * 1024)} MB at '
+        '${(stats.rate / (1024 * 1024)).toStringAsFixed(1)} MB/s'
+        '${stats.up ? '' : ' (down)'}',
+      );
+    }
+  }
+
+  static void _logNativeReceive(int bytes, int cpuNs, bool spliced) {
+    if (bytes == 0) return;
+    final msPerGb = cpuNs / 1e6 / (bytes / 1e9);
+    print(
+      '📊 Native receive: ${bytes ~/ (1024 * 1024)} MB, '
+      '${msPerGb.toStringAsFixed(0)} ms CPU/GB'
+      '${spliced ? ' (spliced)' : ''}',
+    );
+  }
+
+  /// Split missing ranges into chunk-aligned pieces of roughly equal size
+  List<({int start, int end})> _splitRanges(
+    List<({int start, int end})> missing,
+    int streams,
+  ) {
+    final totalBytes = missing.fold<int>(
+      0,
+      (sum, r) => sum + r.end - r.start + 1,
+    );
+    final pieceSize = _alignedRangeSize(totalBytes, streams);
+    return [
+      for (final r in missing)
+        for (int start = r.start; start <= r.end; start += pieceSize)
+          (
+            start: start,
+            end: start + pieceSize - 1 < r.end ? start + pieceSize - 1 : r.end,
+          ),
+    ];
+  }
+
+  /// Feed chunks kept from an earlier attempt to [hasher]
+  ///
+  /// Chunks in [holes] are all zeros and aren't read.
+  Future<void> _hashExistingChunks(
+    String partPath,
+    NativeResumeJournal journal,
+    NativeChunkHasher hasher, {
+    Set<int> holes = const {},
+  }) async {
+    final raf = await File(partPath).open();
+    try {
+      for (final index in journal.doneChunks()) {
+        final start = index * journal.chunkSize;
+        final length = start + journal.chunkSize > journal.fileSize
+            ? journal.fileSize - start
+            : journal.chunkSize;
+        if (holes.contains(index)) {
+          hasher.updateZeros(start, length);
+          continue;
         }
-        
-        // Read and write in chunks to avoid memory issues
-        final source = tempFile.openRead();
-        await for (var chunk in source) {
-          sink.add(chunk);
-          mergedBytes += chunk.length;
-          
-          // Report merge progress (starts at 95% and goes to 100%)
-          if (onProgress != null && totalBytes > 0) {
-            final mergeProgress = 0.95 + (0.05 * (mergedBytes / totalBytes));
-            onProgress(mergeProgress);
+        await raf.setPosition(start);
+        hasher.update(start, await raf.read(length));
+      }
+    } finally {
+      await raf.close();
+    }
+  }
+
+  /// Range size per stream, rounded up to whole digest chunks
+  int _alignedRangeSize(int contentLength, int streams) {
+    const align = ChunkDigests.defaultChunkSize;
+    final perStream = (contentLength + streams - 1) ~/ streams;
+    return ((perStream + align - 1) ~/ align) * align;
+  }
+
+  /// Checks a finished download against [expected], or the digests
+  /// fetched from the sender, re-fetching only the chunks that differ.
+  ///
+  /// Without digests to compare against the file is reported
+  /// [IntegrityResult.unverified] rather than passed; one that still
+  /// differs after repair throws.
+  static Future<IntegrityResult> verify({
+    required String url,
+    required String savePath,
+    required NativeChunkHasher hasher,
+    ChunkDigests? expected,
+  }) async {
+    final digests = expected ?? await fetchDigests(url, hasher.fileSize);
+    if (digests == null) {
+      print('⚠️ $savePath is unverified: the sender sent no digests');
+      return IntegrityResult.unverified;
+    }
+    final ok = await verifyAndRepair(
+      url: url,
+      savePath: savePath,
+      hasher: hasher,
+      expected: digests,
+    );
+    if (!ok) throw Exception('Integrity check failed for $savePath');
+    return IntegrityResult.verified;
+  }
+
+  /// Fetch the sender's chunk digests from `/digest/<index>`
+  ///
+  /// The sender hashes whatever its downloads didn't cover before it
+  /// answers, so the wait grows with the file. Returns null if the sender
+  /// doesn't publish digests (older versions) or couldn't read the file.
+  static Future<ChunkDigests?> fetchDigests(String fileUrl, int fileSize) async {
+    final digestUrl = fileUrl.replaceFirst('/file/', '/digest/');
+    if (digestUrl == fileUrl) return null;
+    // Allow for reading the whole file back at a slow phone's 20MB/s
+    final timeout = Duration(seconds: 3 + fileSize ~/ (20 * 1024 * 1024));
+    try {
+      final response = await http
+          .get(Uri.parse(digestUrl))
+          .timeout(timeout);
+      if (response.statusCode != 200) return null;
+      final json = jsonDecode(response.body) as Map<String, dynamic>;
+      return ChunkDigests.fromJson(json, fileSize);
+    } catch (e) {
+      print('⚠️ Could not fetch digests: $e');
+      return null;
+    }
+  }
+
+  /// Compare inline digests with the sender's and re-download bad chunks
+  ///
+  /// Only chunks whose digest differs are requested again (via Range) and
+  /// written in place. Returns true once every chunk matches.
+  static Future<bool> verifyAndRepair({
+    required String url,
+    required String savePath,
+    required NativeChunkHasher hasher,
+    required ChunkDigests expected,
+    int maxAttempts = 2,
+  }) async {
+    var bad = hasher.mismatchedChunks(expected);
+    if (bad.isEmpty) {
+      print('🔐 Integrity verified: ${expected.fileDigest.substring(0, 16)}…');
+      return true;
+    }
+
+    for (int attempt = 1; attempt <= maxAttempts && bad.isNotEmpty; attempt++) {
+      print('⚠️ ${bad.length} corrupted chunk(s), re-requesting (attempt $attempt)');
+      final raf = await File(savePath).open(mode: FileMode.append);
+      final client = http.Client();
+      try {
+        for (final index in bad) {
+          final start = index * hasher.chunkSize;
+          final end = (start + hasher.chunkSize > hasher.fileSize)
+              ? hasher.fileSize - 1
+              : start + hasher.chunkSize - 1;
+
+          hasher.resetChunk(index);
+          final request = http.Request('GET', Uri.parse(url));
+          request.headers['Range'] = 'bytes=$start-$end';
+          final response = await client.send(request);
+          if (response.statusCode != 206) {
+            throw Exception('Range request failed: ${response.statusCode}');
+          }
+
+          int offset = start;
+          await raf.setPosition(start);
+          await for (final chunk in response.stream) {
+            hasher.update(offset, chunk);
+            await raf.writeFrom(chunk);
+            offset += chunk.length;
           }
         }
-        
-        print('  Merged chunk $i (${mergedBytes}/${totalBytes} bytes)');
+        await raf.flush();
+      } catch (e) {
+        print('❌ Chunk repair failed: $e');
+      } finally {
+        await raf.close();
+        client.close();
       }
-      
-      await sink.flush();
-    } finally {
-      await sink.close();
+      bad = hasher.mismatchedChunks(expected);
     }
+
+    return bad.isEmpty;
   }
 
   /// Upload a file using parallel streams
@@ -435,7 +998,7 @@ class ParallelTransferService {
 /// Extension methods for easier integration
 extension ParallelTransferExtension on File {
   /// Download this file using parallel streams
-  Future<void> downloadFromUrlParallel(
+  Future<IntegrityResult> downloadFromUrlParallel(
     String url, {
     int parallelStreams = ParallelTransferService.DEFAULT_PARALLEL_STREAMS,
     Function(double progress)? onProgress,
@@ -443,7 +1006,7 @@ extension ParallelTransferExtension on File {
     bool Function()? isPaused,
   }) async {
     final service = ParallelTransferService(parallelStreams: parallelStreams);
-    await service.downloadFile(
+    return service.downloadFile(
       url: url,
       savePath: path,
       onProgress: onProgress,
@@ -452,3 +1015,15 @@ extension ParallelTransferExtension on File {
     );
   }
 }
+
+/// A native range download that didn't finish, with how far it got
+class _ReceiveFailed implements Exception {
+  final String message;
+  final ReceiveError error;
+  final ReceiveStats stats;
+
+  _ReceiveFailed(this.message, this.error, this.stats);
+
+  @override
+  String toString() => 'Exception: $message';
+}
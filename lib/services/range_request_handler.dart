@@ -2,6 +2,8 @@ import 'dart:io';
 import 'dart:async';
 import 'package:flutter/services.dart';
 
+import 'read_ahead_service.dart';
+
 /// HTTP Range Request Handler
 /// 
 /// Enables efficient parallel file transfers by supporting:
@@ -18,19 +20,23 @@ class RangeRequestHandler {
   /// - Multiple ranges: Range: bytes=0-1023,2048-3071
   /// - Open-ended ranges: Range: bytes=1024-
   /// - Suffix ranges: Range: bytes=-1024
+  ///
+  /// [onData] sees every buffer sent with its offset in the file, so the
+  /// caller can hash what goes out.
   static Future<void> handleRangeRequest({
     required HttpRequest request,
     required String uri,
     required String fileName,
     required int fileSize,
     Function(int bytesSent, double progress)? onProgress,
+    void Function(int offset, Uint8List bytes)? onData,
   }) async {
     final response = request.response;
     final rangeHeader = request.headers.value('range');
     
     // If no range header, serve full file
     if (rangeHeader == null || rangeHeader.isEmpty) {
-      await _serveFullFile(request, uri, fileName, fileSize);
+      await _serveFullFile(request, uri, fileName, fileSize, onData: onData);
       return;
     }
     
@@ -61,6 +67,7 @@ class RangeRequestHandler {
         range['start']!,
         range['end']!,
         onProgress: onProgress,
+        onData: onData,
       );
       
     } catch (e) {
@@ -75,8 +82,9 @@ class RangeRequestHandler {
     HttpRequest request,
     String uri,
     String fileName,
-    int fileSize,
-  ) async {
+    int fileSize, {
+    void Function(int offset, Uint8List bytes)? onData,
+  }) async {
     final response = request.response;
     
     response.statusCode = HttpStatus.ok;
@@ -85,7 +93,14 @@ class RangeRequestHandler {
     response.headers.set('Content-Disposition', 'attachment; filename="$fileName"');
     response.headers.set('Accept-Ranges', 'bytes');
     
-    await _streamFileContent(response, uri, 0, fileSize - 1, fileSize);
+    await _streamFileContent(
+      response,
+      uri,
+      0,
+      fileSize - 1,
+      fileSize,
+      onData: onData,
+    );
   }
   
   /// Serve a partial file (range request)
@@ -97,6 +112,7 @@ class RangeRequestHandler {
     int start,
     int end, {
     Function(int bytesSent, double progress)? onProgress,
+    void Function(int offset, Uint8List bytes)? onData,
   }) async {
     final response = request.response;
     final contentLength = end - start + 1;
@@ -110,7 +126,15 @@ class RangeRequestHandler {
     
     print('📦 Serving range: bytes $start-$end/$fileSize (${contentLength} bytes)');
     
-    await _streamFileContent(response, uri, start, end, fileSize, onProgress: onProgress);
+    await _streamFileContent(
+      response,
+      uri,
+      start,
+      end,
+      fileSize,
+      onProgress: onProgress,
+      onData: onData,
+    );
   }
   
   /// Stream file content for a specific byte range
@@ -121,13 +145,31 @@ class RangeRequestHandler {
     int end,
     int totalFileSize, {
     Function(int bytesSent, double progress)? onProgress,
+    void Function(int offset, Uint8List bytes)? onData,
   }) async {
     const int CHUNK_SIZE = 4 * 1024 * 1024; // 4MB chunks for maximum speed
     const channel = MethodChannel('zapshare.saf');
     
     String? streamId;
+    PipelinedFileReader? ahead;
     
     try {
+      // Read ahead natively when we can, so the next chunks load while this
+      // one is flushed instead of after it
+      ahead = await ReadAheadService.open(uri, start: start, end: end + 1);
+      if (ahead != null) {
+        await _streamReadAhead(
+          response,
+          ahead,
+          start,
+          end,
+          totalFileSize,
+          onProgress,
+          onData,
+        );
+        return;
+      }
+
       // Open a fresh stream with unique ID for this range request
       final result = await channel.invokeMethod('openReadStream', {
         'uri': uri,
@@ -190,11 +232,11 @@ class RangeRequestHandler {
         
         // Only send the exact number of bytes needed
         final bytesToSend = chunk.length > bytesToRead ? bytesToRead : chunk.length;
-        if (bytesToSend < chunk.length) {
-          response.add(chunk.sublist(0, bytesToSend));
-        } else {
-          response.add(chunk);
-        }
+        final sent = bytesToSend < chunk.length
+            ? Uint8List.sublistView(chunk, 0, bytesToSend)
+            : chunk;
+        onData?.call(currentPosition, sent);
+        response.add(sent);
         
         await response.flush();
         
@@ -222,6 +264,7 @@ class RangeRequestHandler {
       print('❌ Error streaming range $start-$end: $e');
       rethrow;
     } finally {
+      ahead?.close();
       // Always close stream if it was opened
       if (streamId != null) {
         try {
@@ -243,6 +286,36 @@ class RangeRequestHandler {
     }
   }
   
+  /// Stream a byte range from a [PipelinedFileReader]
+  static Future<void> _streamReadAhead(
+    HttpResponse response,
+    PipelinedFileReader reader,
+    int start,
+    int end,
+    int totalFileSize,
+    Function(int bytesSent, double progress)? onProgress,
+    void Function(int offset, Uint8List bytes)? onData,
+  ) async {
+    const int CHUNK_SIZE = 1024 * 1024; // One read-ahead buffer on phones
+    int totalSent = 0;
+
+    while (true) {
+      final chunk = await reader.read(CHUNK_SIZE);
+      if (chunk.isEmpty) break;
+      onData?.call(start + totalSent, chunk);
+      response.add(chunk);
+      await response.flush();
+      totalSent += chunk.length;
+      onProgress?.call(totalSent, (start + totalSent) / totalFileSize);
+    }
+
+    if (totalSent < end - start + 1) {
+      print('⚠️ End of file at position ${start + totalSent} (expected $end)');
+    } else {
+      print('✅ Completed range $start-$end: sent $totalSent bytes');
+    }
+  }
+
   /// Parse Range header
   /// 
   /// Examples:
@@ -0,0 +1,115 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:flutter/services.dart';
+
+import '../native/native_wakeup.dart';
+import '../native/read_ahead.dart';
+
+/// A file handed out chunk by chunk to a send loop.
+abstract class FileChunkReader {
+  /// Bytes left before the end of the requested range.
+  int get remaining;
+
+  /// Up to [max] bytes, waiting while they are loaded; empty at the end.
+  /// Throws [FileSystemException] if the file can't be read.
+  Future<Uint8List> read(int max);
+
+  void close();
+}
+
+/// Disk reads that run ahead of the socket instead of taking turns with
+/// it.
+///
+/// 1. A native thread keeps [depth] buffers of [bufferSize] loaded ahead
+///    of the send loop, so the next chunk is read while the last one is
+///    still being flushed
+/// 2. Paths and Android content URIs both work; a URI is opened as a
+///    descriptor by the platform side and may even be a pipe
+/// 3. Every reader logs its queue counters when closed, so the depth can
+///    be tuned per device class: mostly disk stalls mean storage is the
+///    bottleneck, mostly socket stalls with a full queue mean the network
+///    is
+///
+/// See `native/src/read_ahead.h`.
+class ReadAheadService {
+  static const MethodChannel _channel = MethodChannel('zapshare.saf');
+  static const int _logAbove = 16 * 1024 * 1024; // Only log real transfers
+
+  static bool get _mobile => Platform.isAndroid || Platform.isIOS;
+
+  /// Buffers in flight: phones have slower flash and less memory to spare.
+  static int get depth => _mobile ? 4 : 8;
+  static int get bufferSize => _mobile ? 1024 * 1024 : 2 * 1024 * 1024;
+
+  static bool get isAvailable => NativeReadAhead.isAvailable;
+
+  /// A read-ahead reader of bytes [start, end) of [source], a path or an
+  /// Android content URI; null when that isn't possible and the caller
+  /// should read the file itself.
+  static Future<PipelinedFileReader?> open(
+    String source, {
+    int start = 0,
+    int? end,
+  }) async {
+    if (!isAvailable) return null;
+    if (!source.startsWith('content://')) {
+      final reader = NativeReadAhead.open(
+        source,
+        start: start,
+        end: end,
+        depth: depth,
+        bufferSize: bufferSize,
+      );
+      return reader == null ? null : PipelinedFileReader._(reader);
+    }
+    if (!Platform.isAndroid) return null;
+    try {
+      final fd = await _channel.invokeMethod<int>('openFd', {'uri': source});
+      if (fd == null) return null;
+      final reader = NativeReadAhead.openFd(
+        fd,
+        start: start,
+        end: end,
+        depth: depth,
+        bufferSize: bufferSize,
+      );
+      return reader == null ? null : PipelinedFileReader._(reader);
+    } catch (e) {
+      print('⚠️ Read-ahead: could not open $source: $e');
+      return null;
+    }
+  }
+}
+
+/// One send loop's reads through [ReadAheadService].
+class PipelinedFileReader implements FileChunkReader {
+  final NativeReadAhead _native;
+  bool _closed = false;
+
+  PipelinedFileReader._(this._native);
+
+  @override
+  int get remaining => _native.remaining;
+
+  ReadAheadStats get stats => _native.stats;
+
+  @override
+  Future<Uint8List> read(int max) async {
+    final chunk = await _native.readReady(max);
+    if (chunk == null) throw const FileSystemException('Read-ahead failed');
+    return chunk;
+  }
+
+  @override
+  void close() {
+    if (_closed) return;
+    _closed = true;
+    final stats = _native.stats;
+    if (stats.diskBytes >= ReadAheadService._logAbove) {
+      print('📊 Read-ahead: $stats');
+    }
+    _native.dispose();
+  }
+}
@@ -0,0 +1,292 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:typed_data';
+
+import '../native/secure_channel.dart';
+
+/// Encryption for the multiplexed TCP protocol, keyed by the pairing code.
+///
+/// 1. Senders with the native engine mark LIST entries with `secure: 1`
+/// 2. A receiver that sees it opens with the handshake magic `ZSE1`
+///    instead of `ZSM2`; both sides derive keys from an X25519 exchange
+///    bound to the pairing code, and a peer that used a different code
+///    fails the handshake before any file data moves
+/// 3. The v2 session then runs inside AES-256-GCM records (ChaCha20-Poly1305
+///    on CPUs without AES instructions). Frames are read from the session
+///    straight into the record buffer and sealed there, and records are
+///    opened in the socket buffer they arrived in
+///
+/// The pairing code is the share code, which is derived from the sender's
+/// address: this keeps file contents away from anyone passively listening
+/// on the network, not from an attacker who already knows the address.
+/// See `native/src/secure_channel.h` for the wire format.
+class SecureChannelService {
+  static const String LIST_FIELD = 'secure';
+  static const Duration HANDSHAKE_TIMEOUT = Duration(seconds: 10);
+
+  static bool get isAvailable => NativeSecureChannel.isAvailable;
+
+  /// LIST entry fields advertising encryption.
+  static Map<String, dynamic> get listFields =>
+      isAvailable ? const {LIST_FIELD: NativeSecureChannel.version} : const {};
+
+  /// Whether a sender that listed [entry] accepts encrypted sessions.
+  static bool canSecure(Map<String, dynamic> entry) =>
+      isAvailable && entry[LIST_FIELD] == NativeSecureChannel.version;
+
+  /// The code both sides key the handshake with: the 11-character share
+  /// code of the sender at [ip] with its HTTP server on [port].
+  static String pairingCode(String ip, int port) {
+    final parts = ip.split('.').map(int.tryParse).toList();
+    if (parts.length != 4 || parts.contains(null)) return ip;
+    final ipNum =
+        (parts[0]! << 24) | (parts[1]! << 16) | (parts[2]! << 8) | parts[3]!;
+    final ipCode = ipNum.toRadixString(36).toUpperCase().padLeft(8, '0');
+    final portCode = port.toRadixString(36).toUpperCase().padLeft(3, '0');
+    return ipCode + portCode;
+  }
+}
+
+/// A byte stream to the peer, cleartext or encrypted. Writers leave
+/// [headroom] bytes in front of and [tailroom] bytes after what they send,
+/// so an encrypting channel can frame it without copying.
+abstract class ByteChannel {
+  Stream<Uint8List> get input;
+  int get headroom;
+  int get tailroom;
+
+  /// Sends the bytes of [buffer] between the headroom and the tailroom.
+  /// The buffer belongs to the channel afterwards.
+  void send(Uint8List buffer);
+  Future<void> flush();
+  Future<void> close();
+  void destroy();
+}
+
+/// A socket as it is.
+class PlainChannel implements ByteChannel {
+  final Socket _socket;
+  @override
+  final Stream<Uint8List> input;
+
+  PlainChannel(this._socket, this.input);
+
+  @override
+  int get headroom => 0;
+  @override
+  int get tailroom => 0;
+
+  @override
+  void send(Uint8List buffer) => _socket.add(buffer);
+  @override
+  Future<void> flush() => _socket.flush();
+  @override
+  Future<void> close() => _socket.close();
+  @override
+  void destroy() => _socket.destroy();
+}
+
+/// A socket carrying sealed records once the pairing handshake succeeds.
+class EncryptedChannel implements ByteChannel {
+  final Socket _socket;
+  final NativeSecureChannel _native;
+  final StreamController<Uint8List> _plain = StreamController();
+  final Completer<bool> _handshake = Completer();
+  late final StreamSubscription<Uint8List> _subscription;
+  // A record that straddles socket reads, or the start of its header.
+  Uint8List? _partial;
+  int _partialFill = 0;
+  final Uint8List _header = Uint8List(NativeSecureChannel.recordHeader);
+  int _headerFill = 0;
+  bool _closed = false;
+
+  EncryptedChannel._(this._socket, this._native, Stream<Uint8List> input) {
+    _subscription = input.listen(
+      _onData,
+      onError: (Object e) => _fail(e),
+      onDone: () => _fail(null),
+    );
+    _plain
+      ..onPause = _subscription.pause
+      ..onResume = _subscription.resume;
+  }
+
+  /// Runs the client side of the handshake on [socket]; null if it fails,
+  /// for instance because the sender was given a different code.
+  static Future<EncryptedChannel?> connect(Socket socket, String code) =>
+      _start(socket, socket, code, server: false);
+
+  /// Runs the server side on [socket], whose bytes arrive on [input] (as
+  /// returned by `MuxTransferService.detect`).
+  static Future<EncryptedChannel?> accept(
+    Socket socket,
+    Stream<Uint8List> input,
+    String code,
+  ) => _start(socket, input, code, server: true);
+
+  static Future<EncryptedChannel?> _start(
+    Socket socket,
+    Stream<Uint8List> input,
+    String code, {
+    required bool server,
+  }) async {
+    final native = NativeSecureChannel.create(server: server, code: code);
+    if (native == null) return null;
+    final channel = EncryptedChannel._(socket, native, input);
+    channel._sendHandshake();
+    final ok = await channel._handshake.future.timeout(
+      SecureChannelService.HANDSHAKE_TIMEOUT,
+      onTimeout: () => false,
+    );
+    if (!ok) {
+      print('⚠️ Secure: handshake failed');
+      channel.destroy();
+      return null;
+    }
+    return channel;
+  }
+
+  @override
+  Stream<Uint8List> get input => _plain.stream;
+  @override
+  int get headroom => NativeSecureChannel.recordHeader;
+  @override
+  int get tailroom => NativeSecureChannel.tagSize;
+
+  @override
+  void send(Uint8List buffer) {
+    if (_closed) return;
+    final length = buffer.length - headroom - tailroom;
+    if (length <= NativeSecureChannel.maxRecord) {
+      final size = _native.seal(buffer, length);
+      _socket.add(Uint8List.sublistView(buffer, 0, size));
+      return;
+    }
+    // Larger than a record: seal it in pieces, at the cost of a copy.
+    for (int off = 0; off < length; off += NativeSecureChannel.maxRecord) {
+      final n = length - off < NativeSecureChannel.maxRecord
+          ? length - off
+          : NativeSecureChannel.maxRecord;
+      final record = Uint8List(headroom + n + tailroom)
+        ..setRange(headroom, headroom + n, buffer, headroom + off);
+      _socket.add(Uint8List.sublistView(record, 0, _native.seal(record, n)));
+    }
+  }
+
+  @override
+  Future<void> flush() => _socket.flush();
+
+  @override
+  Future<void> close() async {
+    if (_closed) return;
+    await _socket.flush().catchError((_) {});
+    await _socket.close().catchError((_) => _socket.destroy());
+    _shutdown();
+  }
+
+  @override
+  void destroy() {
+    if (_closed) return;
+    _socket.destroy();
+    _shutdown();
+  }
+
+  void _sendHandshake() {
+    final out = _native.take();
+    if (out.isNotEmpty) _socket.add(out);
+  }
+
+  void _onData(Uint8List chunk) {
+    int offset = 0;
+    if (!_handshake.isCompleted) {
+      offset = _native.receive(chunk);
+      _sendHandshake();
+      if (_native.failed) {
+        _handshake.complete(false);
+        return;
+      }
+      if (!_native.established) return;
+      _handshake.complete(true);
+    }
+    _records(chunk, offset);
+  }
+
+  /// Opens every record in [chunk] from [offset] on. Records that sit
+  /// whole in the chunk are opened where they are; only records split
+  /// across socket reads are gathered into a buffer first.
+  void _records(Uint8List chunk, int offset) {
+    while (offset < chunk.length && !_closed) {
+      var partial = _partial;
+      if (partial == null) {
+        int size;
+        if (_headerFill == 0 && chunk.length - offset >= headroom) {
+          size = _native.recordSize(chunk, offset);
+          if (size > 0 && chunk.length - offset >= size) {
+            _deliver(Uint8List.sublistView(chunk, offset, offset + size));
+            offset += size;
+            continue;
+          }
+        } else {
+          final n = headroom - _headerFill < chunk.length - offset
+              ? headroom - _headerFill
+              : chunk.length - offset;
+          _header.setRange(_headerFill, _headerFill + n, chunk, offset);
+          _headerFill += n;
+          offset += n;
+          if (_headerFill < headroom) return;
+          size = _native.recordSize(_header, 0);
+        }
+        if (size == 0) {
+          _fail(const SocketException('Malformed record'));
+          return;
+        }
+        partial = _partial = Uint8List(size);
+        _partialFill = 0;
+        if (_headerFill > 0) {
+          partial.setAll(0, _header);
+          _partialFill = _headerFill;
+          _headerFill = 0;
+        }
+      }
+      final n = partial.length - _partialFill < chunk.length - offset
+          ? partial.length - _partialFill
+          : chunk.length - offset;
+      partial.setRange(_partialFill, _partialFill + n, chunk, offset);
+      _partialFill += n;
+      offset += n;
+      if (_partialFill == partial.length) {
+        _partial = null;
+        _deliver(partial);
+      }
+    }
+  }
+
+  void _deliver(Uint8List record) {
+    if (!_native.open(record)) {
+      _fail(const SocketException('Record failed authentication'));
+      return;
+    }
+    if (record.length > headroom + tailroom) {
+      _plain.add(
+        Uint8List.sublistView(record, headroom, record.length - tailroom),
+      );
+    }
+  }
+
+  /// Tears the channel down; [error] is null when the peer simply closed.
+  void _fail(Object? error) {
+    if (!_handshake.isCompleted) _handshake.complete(false);
+    if (_closed) return;
+    if (error != null && !_plain.isClosed) _plain.addError(error);
+    _socket.destroy();
+    _shutdown();
+  }
+
+  void _shutdown() {
+    if (_closed) return;
+    _closed = true;
+    _subscription.cancel();
+    if (!_plain.isClosed) _plain.close();
+    _native.dispose();
+  }
+}
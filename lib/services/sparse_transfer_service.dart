@@ -0,0 +1,66 @@
+import 'dart:async';
+import 'dart:io';
+
+import 'package:http/http.dart' as http;
+
+import '../native/sparse_file.dart';
+
+/// Sparse files over `/file/<index>` without their holes.
+///
+/// 1. Senders answer `/extents/<index>` with the file's extent map, found
+///    with SEEK_DATA/SEEK_HOLE; dense files, SAF URIs and file systems
+///    that can't report holes answer 404
+/// 2. Receivers fetch it before downloading, lay the part file out with
+///    the same holes and request only the digest chunks that hold data
+/// 3. Chunks that are all hole are hashed as zeros without reading
+///    anything, so the integrity check still covers the whole file
+/// 4. An older sender, or a receiver whose file system can't make holes,
+///    silently gets the dense download
+///
+/// See `native/src/sparse_file.h`.
+class SparseTransferService {
+  static const String PATH_SEGMENT = 'extents';
+
+  /// Answers `/extents/<index>` for the file at [path], which may be null
+  /// or a content URI when there is nothing to offer.
+  static Future<void> serve(HttpRequest request, String? path) async {
+    final map = path == null || path.startsWith('content://')
+        ? null
+        : NativeSparseFile.extentMap(path);
+    if (map == null) {
+      request.response.statusCode = HttpStatus.notFound;
+    } else {
+      request.response.headers.contentType = ContentType.binary;
+      request.response.contentLength = map.bytes.length;
+      request.response.add(map.bytes);
+    }
+    await request.response.close();
+  }
+
+  /// The sender's extent map for [fileUrl], or null to download densely.
+  static Future<ExtentMap?> fetch(String fileUrl, int fileSize) async {
+    if (!NativeSparseFile.isAvailable) return null;
+    final url = fileUrl.replaceFirst('/file/', '/$PATH_SEGMENT/');
+    if (url == fileUrl) return null;
+    try {
+      final response = await http
+          .get(Uri.parse(url))
+          .timeout(const Duration(seconds: 3));
+      if (response.statusCode != 200) return null;
+      final map = ExtentMap.parse(response.bodyBytes);
+      if (map == null ||
+          map.fileSize != fileSize ||
+          map.dataBytes >= fileSize) {
+        return null;
+      }
+      print(
+        '🕳️ Sparse file: ${map.dataBytes ~/ (1024 * 1024)} MB of data in '
+        '${fileSize ~/ (1024 * 1024)} MB, ${map.extents.length} extent(s)',
+      );
+      return map;
+    } catch (e) {
+      print('⚠️ Could not fetch extents: $e');
+      return null;
+    }
+  }
+}
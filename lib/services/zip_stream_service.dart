@@ -0,0 +1,270 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:math';
+import 'dart:typed_data';
+
+import '../native/zip_stream.dart';
+import 'range_request_handler.dart';
+
+/// Bytes [start, end) of entry [entry]'s file.
+typedef ZipRangeReader =
+    Stream<List<int>> Function(int entry, int start, int end);
+
+/// One archive being served, shared by every request for it so a CRC worked
+/// out while streaming one range is there for the others.
+class StreamedZip {
+  final NativeZipLayout layout;
+  final ZipRangeReader read;
+  final Map<int, int> _streaming = {}; // Entry -> responses sending its data
+
+  StreamedZip._(this.layout, this.read);
+
+  /// Null without the native engine.
+  static StreamedZip? create(List<ZipEntryInfo> entries, ZipRangeReader read) {
+    final layout = NativeZipLayout.create(entries);
+    return layout == null ? null : StreamedZip._(layout, read);
+  }
+
+  int get size => layout.size;
+  List<ZipEntryInfo> get entries => layout.entries;
+
+  void dispose() => layout.dispose();
+}
+
+/// ZIP archives written straight into the response instead of a temp file
+/// in the cache, so the first byte leaves as soon as the request arrives.
+///
+/// 1. Entries are stored (no compression) by default. Every offset then
+///    follows from the names and sizes, so the response has a
+///    Content-Length and Range requests work: parallel downloads and
+///    resume behave as they do for single files
+/// 2. CRCs go after each entry's data (data descriptors) and are computed
+///    from the bytes as they are sent. A range that needs the CRC of data
+///    another request is still sending waits for it; if nobody is sending
+///    it, or that request stalls for [CRC_STALL], it reads that data itself
+/// 3. `?deflate=1` without a Range header deflates compressible entries
+///    instead; that archive's length isn't known up front, so it goes out
+///    chunked and can't be resumed
+class ZipStreamService {
+  static const String ARCHIVE_PATH = '/zip';
+  static const Duration CRC_STALL = Duration(seconds: 3);
+  static const Duration _crcPoll = Duration(milliseconds: 50);
+  static const int _renderLimit = 1024 * 1024; // Metadata bytes per write
+
+  static bool get isAvailable => NativeCrc32.isAvailable;
+
+  /// Archive entries for shared files, renaming duplicates to `name (2).ext`
+  /// so every entry survives extraction. [modified] is fixed for the life
+  /// of the archive; it's part of the bytes a resumed download relies on.
+  static List<ZipEntryInfo> entriesFor(
+    List<String> names,
+    List<int> sizes,
+    DateTime modified,
+  ) {
+    final used = <String>{};
+    final entries = <ZipEntryInfo>[];
+    for (int i = 0; i < names.length; i++) {
+      final name = names[i].replaceAll('\\', '/');
+      var unique = name;
+      for (int n = 2; !used.add(unique.toLowerCase()); n++) {
+        final dot = name.lastIndexOf('.');
+        unique =
+            dot > name.lastIndexOf('/') + 1
+                ? '${name.substring(0, dot)} ($n)${name.substring(dot)}'
+                : '$name ($n)';
+      }
+      entries.add(
+        ZipEntryInfo(name: unique, size: sizes[i], modified: modified),
+      );
+    }
+    return entries;
+  }
+
+  /// Answers a GET for [zip], honouring Range and `?deflate=1`. Closes the
+  /// response; [onProgress] gets file bytes sent by this request so far.
+  static Future<void> serve(
+    HttpRequest request,
+    StreamedZip zip, {
+    required String archiveName,
+    void Function(int bytesSent)? onProgress,
+  }) async {
+    final response = request.response;
+    response.headers.contentType = ContentType('application', 'zip');
+    response.headers.set(
+      'Content-Disposition',
+      'attachment; filename="$archiveName"',
+    );
+    try {
+      if (!request.isRangeRequest &&
+          request.uri.queryParameters['deflate'] == '1') {
+        await write(response, zip, deflate: true, onProgress: onProgress);
+        return;
+      }
+
+      final size = zip.size;
+      int start = 0;
+      int end = size; // Exclusive
+      response.headers.set('Accept-Ranges', 'bytes');
+      if (request.isRangeRequest) {
+        final ranges = request.getRanges(size);
+        if (ranges.isEmpty) {
+          response.statusCode = HttpStatus.requestedRangeNotSatisfiable;
+          response.headers.set('Content-Range', 'bytes */$size');
+          return;
+        }
+        start = ranges.first['start']!;
+        end = ranges.first['end']! + 1;
+        response.statusCode = HttpStatus.partialContent;
+        response.headers.set('Content-Range', 'bytes $start-${end - 1}/$size');
+      }
+      response.contentLength = end - start;
+      await _writeRange(response, zip, start, end, onProgress);
+    } catch (e) {
+      print('❌ Error streaming archive: $e');
+    } finally {
+      try {
+        await response.close();
+      } catch (_) {}
+    }
+  }
+
+  /// Writes the whole archive front to back into [sink], an `HttpResponse`
+  /// or `Socket`. With [deflate] compressible entries are deflated and the
+  /// result no longer matches [zip]'s layout byte for byte.
+  static Future<void> write(
+    IOSink sink,
+    StreamedZip zip, {
+    bool deflate = false,
+    void Function(int bytesSent)? onProgress,
+  }) async {
+    if (!deflate) {
+      await _writeRange(sink, zip, 0, zip.size, onProgress);
+      return;
+    }
+    final writer = NativeZipWriter.create(deflate: true);
+    if (writer == null) throw StateError('ZIP streaming unavailable');
+    int sent = 0;
+    try {
+      for (int i = 0; i < zip.entries.length; i++) {
+        final entry = zip.entries[i];
+        sink.add(writer.beginEntry(entry));
+        await for (final chunk in zip.read(i, 0, entry.size)) {
+          final out = writer.update(chunk);
+          if (out.isNotEmpty) {
+            sink.add(out);
+            await sink.flush();
+          }
+          sent += chunk.length;
+          onProgress?.call(sent);
+        }
+        sink.add(writer.endEntry());
+      }
+      sink.add(writer.finish());
+      await sink.flush();
+    } finally {
+      writer.dispose();
+    }
+  }
+
+  static Future<void> _writeRange(
+    IOSink sink,
+    StreamedZip zip,
+    int pos,
+    int end,
+    void Function(int bytesSent)? onProgress,
+  ) async {
+    int sent = 0;
+    while (pos < end) {
+      final span = zip.layout.locate(pos);
+      final n = min(span.length, end - pos);
+      final entry = span.entry;
+      if (entry == null) {
+        for (int p = pos; p < pos + n; p += _renderLimit) {
+          sink.add(await _render(zip, p, min(_renderLimit, pos + n - p)));
+        }
+      } else {
+        zip._streaming[entry] = (zip._streaming[entry] ?? 0) + 1;
+        try {
+          int offset = span.offset;
+          await for (final chunk in zip.read(entry, offset, offset + n)) {
+            final bytes =
+                chunk is Uint8List ? chunk : Uint8List.fromList(chunk);
+            zip.layout.recordCrc(
+              entry,
+              offset,
+              bytes.length,
+              NativeCrc32.update(0, bytes),
+            );
+            offset += bytes.length;
+            sink.add(bytes);
+            await sink.flush();
+            sent += bytes.length;
+            onProgress?.call(sent);
+          }
+          if (offset != span.offset + n) {
+            throw StateError('${zip.entries[entry].name} changed size');
+          }
+        } finally {
+          zip._streaming[entry] = zip._streaming[entry]! - 1;
+        }
+      }
+      pos += n;
+    }
+    await sink.flush();
+  }
+
+  static Future<Uint8List> _render(StreamedZip zip, int pos, int len) async {
+    while (true) {
+      int? missing;
+      final bytes = zip.layout.render(pos, len, missingEntry: (e) {
+        missing = e;
+      });
+      if (bytes != null) return bytes;
+      await _awaitCrc(zip, missing!);
+    }
+  }
+
+  /// Waits until [entry]'s CRC is known, computing it here when no other
+  /// response is making progress on it.
+  static Future<void> _awaitCrc(StreamedZip zip, int entry) async {
+    int covered = zip.layout.crcCovered(entry);
+    final idle = Stopwatch()..start();
+    while (true) {
+      final gap = zip.layout.crcGap(entry);
+      if (gap == null) return;
+      if ((zip._streaming[entry] ?? 0) == 0 || idle.elapsed >= CRC_STALL) {
+        await _hashRange(zip, entry, gap.$1, gap.$2);
+        idle.reset();
+        continue;
+      }
+      await Future.delayed(_crcPoll);
+      final now = zip.layout.crcCovered(entry);
+      if (now != covered) {
+        covered = now;
+        idle.reset();
+      }
+    }
+  }
+
+  static Future<void> _hashRange(
+    StreamedZip zip,
+    int entry,
+    int start,
+    int end,
+  ) async {
+    int offset = start;
+    await for (final chunk in zip.read(entry, start, end)) {
+      final bytes = chunk is Uint8List ? chunk : Uint8List.fromList(chunk);
+      zip.layout.recordCrc(
+        entry,
+        offset,
+        bytes.length,
+        NativeCrc32.update(0, bytes),
+      );
+      offset += bytes.length;
+    }
+    if (offset != end) {
+      throw StateError('${zip.entries[entry].name} changed size');
+    }
+  }
+}
@@ -0,0 +1,173 @@
+#include "mirror_texture.h"
+
+#include "mirror_receiver.h"
+
+G_DECLARE_FINAL_TYPE(MirrorTexture, mirror_texture, MIRROR, TEXTURE,
+                     FlPixelBufferTexture)
+
+struct _MirrorTexture {
+  FlPixelBufferTexture parent_instance;
+  FlTextureRegistrar* registrar;
+  ZsMirrorReceiver* receiver;  // Holds a reference of its own.
+};
+
+G_DEFINE_TYPE(MirrorTexture, mirror_texture, fl_pixel_buffer_texture_get_type())
+
+// Called by the engine on its raster thread; the pixels stay put until the
+// next call, which is after it has uploaded them.
+static gboolean mirror_texture_copy_pixels(FlPixelBufferTexture* texture,
+                                           const uint8_t** buffer,
+                                           uint32_t* width, uint32_t* height,
+                                           GError** error) {
+  MirrorTexture* self = MIRROR_TEXTURE(texture);
+  int32_t w = 0;
+  int32_t h = 0;
+  const uint8_t* pixels = zs_mirror_receiver_acquire(self->receiver, &w, &h);
+  if (pixels == nullptr) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_PENDING, "No frame yet");
+    return FALSE;
+  }
+  *buffer = pixels;
+  *width = w;
+  *height = h;
+  return TRUE;
+}
+
+// Called on the receiver's decoder thread. Marking a frame available only
+// posts to the engine, which is safe from any thread.
+static void mirror_texture_on_frame(void* user_data) {
+  MirrorTexture* self = MIRROR_TEXTURE(user_data);
+  fl_texture_registrar_mark_texture_frame_available(self->registrar,
+                                                    FL_TEXTURE(self));
+}
+
+static void mirror_texture_dispose(GObject* object) {
+  MirrorTexture* self = MIRROR_TEXTURE(object);
+  if (self->receiver != nullptr) {
+    zs_mirror_receiver_set_frame_callback(self->receiver, nullptr, nullptr);
+    zs_mirror_receiver_free(self->receiver);
+    self->receiver = nullptr;
+  }
+  G_OBJECT_CLASS(mirror_texture_parent_class)->dispose(object);
+}
+
+static void mirror_texture_class_init(MirrorTextureClass* klass) {
+  FL_PIXEL_BUFFER_TEXTURE_CLASS(klass)->copy_pixels =
+      mirror_texture_copy_pixels;
+  G_OBJECT_CLASS(klass)->dispose = mirror_texture_dispose;
+}
+
+static void mirror_texture_init(MirrorTexture* self) {}
+
+static MirrorTexture* mirror_texture_new(FlTextureRegistrar* registrar,
+                                         ZsMirrorReceiver* receiver) {
+  MirrorTexture* self =
+      MIRROR_TEXTURE(g_object_new(mirror_texture_get_type(), nullptr));
+  self->registrar = registrar;
+  self->receiver = receiver;
+  zs_mirror_receiver_retain(receiver);
+  return self;
+}
+
+typedef struct {
+  FlMethodChannel* channel;
+  FlTextureRegistrar* registrar;
+  GHashTable* textures;  // Texture id to the MirrorTexture.
+} MirrorTexturePlugin;
+
+static void mirror_texture_plugin_free(gpointer data) {
+  MirrorTexturePlugin* plugin = static_cast<MirrorTexturePlugin*>(data);
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, plugin->textures);
+  while (g_hash_table_iter_next(&iter, nullptr, &value)) {
+    zs_mirror_receiver_set_frame_callback(MIRROR_TEXTURE(value)->receiver,
+                                          nullptr, nullptr);
+  }
+  g_hash_table_destroy(plugin->textures);
+  fl_method_channel_set_method_call_handler(plugin->channel, nullptr,
+                                            nullptr, nullptr);
+  g_clear_object(&plugin->channel);
+  g_free(plugin);
+}
+
+static int64_t lookup_int(FlValue* args, const char* key) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return 0;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_INT) {
+    return 0;
+  }
+  return fl_value_get_int(value);
+}
+
+static void mirror_texture_method_call_cb(FlMethodChannel* channel,
+                                          FlMethodCall* method_call,
+                                          gpointer user_data) {
+  MirrorTexturePlugin* plugin = static_cast<MirrorTexturePlugin*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* args = fl_method_call_get_args(method_call);
+
+  if (g_strcmp0(method, "create") == 0) {
+    ZsMirrorReceiver* receiver = reinterpret_cast<ZsMirrorReceiver*>(
+        static_cast<intptr_t>(lookup_int(args, "receiver")));
+    if (receiver == nullptr) {
+      fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                   "receiver address expected", nullptr,
+                                   nullptr);
+      return;
+    }
+    MirrorTexture* texture = mirror_texture_new(plugin->registrar, receiver);
+    if (!fl_texture_registrar_register_texture(plugin->registrar,
+                                               FL_TEXTURE(texture))) {
+      g_object_unref(texture);
+      fl_method_call_respond_error(method_call, "REGISTER_FAILED",
+                                   "texture could not be registered",
+                                   nullptr, nullptr);
+      return;
+    }
+    const int64_t id = fl_texture_get_id(FL_TEXTURE(texture));
+    gint64* key = g_new(gint64, 1);
+    *key = id;
+    g_hash_table_insert(plugin->textures, key, texture);
+    zs_mirror_receiver_set_frame_callback(receiver, mirror_texture_on_frame,
+                                          texture);
+    g_autoptr(FlValue) result = fl_value_new_int(id);
+    fl_method_call_respond_success(method_call, result, nullptr);
+  } else if (g_strcmp0(method, "dispose") == 0) {
+    const int64_t id = lookup_int(args, "textureId");
+    gpointer value = g_hash_table_lookup(plugin->textures, &id);
+    if (value != nullptr) {
+      MirrorTexture* texture = MIRROR_TEXTURE(value);
+      // No frame callback may run once the registrar lets go of it.
+      zs_mirror_receiver_set_frame_callback(texture->receiver, nullptr,
+                                            nullptr);
+      fl_texture_registrar_unregister_texture(plugin->registrar,
+                                              FL_TEXTURE(texture));
+      g_hash_table_remove(plugin->textures, &id);
+    }
+    fl_method_call_respond_success(method_call, nullptr, nullptr);
+  } else {
+    fl_method_call_respond_not_implemented(method_call, nullptr);
+  }
+}
+
+void mirror_texture_plugin_register(FlPluginRegistry* registry) {
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry,
+                                                  "MirrorTexturePlugin");
+  MirrorTexturePlugin* plugin = g_new0(MirrorTexturePlugin, 1);
+  plugin->registrar = fl_plugin_registrar_get_texture_registrar(registrar);
+  plugin->textures = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                           g_free, g_object_unref);
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  plugin->channel = fl_method_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), "zapshare/mirror_texture",
+      FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      plugin->channel, mirror_texture_method_call_cb, plugin, nullptr);
+  // Freed with the view, which outlives every call on the channel.
+  g_object_set_data_full(G_OBJECT(registry), "zapshare-mirror-texture",
+                         plugin, mirror_texture_plugin_free);
+}
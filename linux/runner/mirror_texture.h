@@ -0,0 +1,18 @@
+#ifndef RUNNER_MIRROR_TEXTURE_H_
+#define RUNNER_MIRROR_TEXTURE_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+/**
+ * mirror_texture_plugin_register:
+ * @registry: the view's plugin registry.
+ *
+ * Answers the "zapshare/mirror_texture" channel: "create" takes the address
+ * of a native mirror receiver (native/src/mirror_receiver.h) and returns
+ * the id of an external texture showing its frames; "dispose" takes that
+ * id back. Frames are decoded on the receiver's own thread and copied
+ * straight into the texture, without going through Dart.
+ */
+void mirror_texture_plugin_register(FlPluginRegistry* registry);
+
+#endif  // RUNNER_MIRROR_TEXTURE_H_
@@ -0,0 +1,166 @@
+// Many small files: one batch stream vs. a GET and ACK per file.
+//
+//   zapshare_bench batch [files] [size_kb] [dir]
+//
+// "frame" measures the sender side: framing plus hashing every file.
+// "receive_<n>t" parses the same stream with an n-thread BatchReceiver that
+// verifies and writes each file into |dir| (the system temp directory by
+// default), so it includes real file creation cost.
+//
+// The legacy protocol pays a connection, a metadata exchange and a blocking
+// ACK per file, about three round trips on top of the bytes. The "model_*"
+// lines put both protocols on a link of the given rate and RTT; the batch
+// pays its round trip once and then runs at the slower of link and disk.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+#include "bench_util.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+constexpr uint64_t kMaxInFlight = 64 * 1024 * 1024;
+constexpr int kLegacyRoundTrips = 3;
+
+std::vector<uint8_t> BuildStream(uint32_t files, size_t size,
+                                 const std::vector<uint8_t>& data) {
+  BatchWriter writer;
+  std::vector<uint8_t> stream;
+  stream.reserve(static_cast<size_t>(files) * (size + 80));
+  std::vector<uint8_t> buf(4096);
+  auto drain = [&] {
+    while (writer.Pending() > 0) {
+      size_t n = writer.Read(buf.data(), buf.size());
+      stream.insert(stream.end(), buf.begin(), buf.begin() + n);
+    }
+  };
+  for (uint32_t i = 0; i < files; i++) {
+    // Vary the content so no two files share a digest.
+    const size_t off = (i * 4099) % (data.size() - size + 1);
+    writer.BeginFile(i, "IMG_" + std::to_string(10000 + i) + ".jpg", size);
+    drain();
+    writer.Update(data.data() + off, size);
+    stream.insert(stream.end(), data.begin() + off,
+                  data.begin() + off + size);
+    writer.EndFile();
+    drain();
+  }
+  writer.Finish();
+  drain();
+  return stream;
+}
+
+// Returns the seconds until every file was on disk, or a negative value if
+// any file failed.
+double Receive(const std::vector<uint8_t>& stream, uint32_t files,
+               const std::string& dir, uint32_t threads) {
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  const double start = NowSeconds();
+  uint32_t done = 0;
+  bool ok = true;
+  {
+    BatchReceiver receiver(dir, threads);
+    BatchResult result;
+    auto collect = [&] {
+      while (receiver.NextResult(&result)) {
+        done++;
+        ok = ok && result.status == BatchFileStatus::kWritten;
+      }
+    };
+    const size_t piece = 256 * 1024;  // A generous socket read.
+    for (size_t pos = 0; pos < stream.size(); pos += piece) {
+      while (receiver.BytesInFlight() > kMaxInFlight) {
+        collect();
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+      receiver.Update(stream.data() + pos,
+                      std::min(piece, stream.size() - pos));
+      collect();
+    }
+    while (done < files) {
+      collect();
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    ok = ok && receiver.complete();
+  }
+  const double seconds = NowSeconds() - start;
+  std::filesystem::remove_all(dir);
+  return ok ? seconds : -1;
+}
+
+void Model(uint32_t files, size_t size, double link_mbps, double rtt_ms,
+           double disk_seconds) {
+  const double link = link_mbps * 1e6 / 8;
+  const double rtt = rtt_ms / 1000;
+  const double bytes = static_cast<double>(files) * size;
+  const double legacy = files * (kLegacyRoundTrips * rtt + size / link);
+  const double batch = rtt + std::max(bytes / link, disk_seconds);
+  char name[64];
+  std::snprintf(name, sizeof(name), "model_%.0fmbps_%.0fms", link_mbps,
+                rtt_ms);
+  char extra[160];
+  std::snprintf(extra, sizeof(extra),
+                ",\"legacy_seconds\":%.3f,\"legacy_files_per_s\":%.0f,"
+                "\"batch_files_per_s\":%.0f,\"speedup\":%.2f",
+                legacy, files / legacy, files / batch, legacy / batch);
+  Report("batch", name, static_cast<uint64_t>(bytes), batch, extra);
+}
+
+}  // namespace
+
+int RunBatchBench(int argc, char** argv) {
+  uint32_t files = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 10000;
+  size_t size_kb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100;
+  if (files == 0) files = 10000;
+  if (size_kb == 0) size_kb = 100;
+  const std::string dir =
+      argc > 2 ? argv[2]
+               : (std::filesystem::temp_directory_path() / "zs_batch_bench")
+                     .string();
+  const size_t size = size_kb * 1024;
+  const uint64_t bytes = static_cast<uint64_t>(files) * size;
+  const std::vector<uint8_t> data = RandomBytes(size + 4 * 1024 * 1024, 1);
+
+  double start = NowSeconds();
+  const std::vector<uint8_t> stream = BuildStream(files, size, data);
+  double seconds = NowSeconds() - start;
+  char extra[96];
+  std::snprintf(extra, sizeof(extra), ",\"files\":%u,\"files_per_s\":%.0f",
+                files, files / seconds);
+  Report("batch", "frame", bytes, seconds, extra);
+
+  double disk_seconds = -1;
+  for (uint32_t threads : {1u, 4u}) {
+    seconds = Receive(stream, files, dir, threads);
+    if (seconds < 0) {
+      std::fprintf(stderr, "batch: receive with %u threads failed\n",
+                   threads);
+      return 1;
+    }
+    std::snprintf(extra, sizeof(extra), ",\"files\":%u,\"files_per_s\":%.0f",
+                  files, files / seconds);
+    Report("batch", "receive_" + std::to_string(threads) + "t", bytes,
+           seconds, extra);
+    if (disk_seconds < 0 || seconds < disk_seconds) disk_seconds = seconds;
+  }
+
+  // Wi-Fi Direct and a good 5 GHz link, LAN-ish and hotspot-ish RTTs.
+  for (double link : {100.0, 400.0}) {
+    for (double rtt : {1.0, 5.0}) Model(files, size, link, rtt, disk_seconds);
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <cstring>
+
+namespace zapshare {
+namespace bench {
+
+int RunHashBench(int argc, char** argv);
+int RunDeltaBench(int argc, char** argv);
+int RunCompressBench(int argc, char** argv);
+int RunBatchBench(int argc, char** argv);
+int RunMuxBench(int argc, char** argv);
+int RunSecureBench(int argc, char** argv);
+int RunFanoutBench(int argc, char** argv);
+int RunReadAheadBench(int argc, char** argv);
+int RunRangeReceiverBench(int argc, char** argv);
+int RunTransferBench(int argc, char** argv);
+int RunProxyTool(int argc, char** argv);
+int RunDiscoveryBench(int argc, char** argv);
+int RunPeerTableBench(int argc, char** argv);
+int RunPrewarmBench(int argc, char** argv);
+int RunControlBench(int argc, char** argv);
+int RunMjpegBench(int argc, char** argv);
+int RunMirrorBench(int argc, char** argv);
+int RunCaptureBench(int argc, char** argv);
+int RunTilesBench(int argc, char** argv);
+
+namespace {
+
+struct Suite {
+  const char* name;
+  const char* description;
+  int (*run)(int argc, char** argv);
+};
+
+const Suite kSuites[] = {
+    {"hash", "BLAKE3 chunk digests vs. link rate", RunHashBench},
+    {"delta", "rsync-style delta on typical re-sends", RunDeltaBench},
+    {"compress", "adaptive compression vs. file type and link rate",
+     RunCompressBench},
+    {"batch", "many small files: batch stream vs. per-file GET/ACK",
+     RunBatchBench},
+    {"mux", "transfer protocol v1 vs. multiplexed v2 on loopback",
+     RunMuxBench},
+    {"secure", "AEAD records and pairing handshake vs. cleartext",
+     RunSecureBench},
+    {"fanout", "many receivers of one file: own reads vs. one shared read",
+     RunFanoutBench},
+    {"read_ahead", "disk and socket in turn vs. a read-ahead queue",
+     RunReadAheadBench},
+    {"range_receiver", "receiver CPU per GB: Dart-style copies vs. splice",
+     RunRangeReceiverBench},
+    {"transfer", "v1, HTTP and parallel downloads over impaired networks",
+     RunTransferBench},
+    {"proxy", "impairment proxy in front of a running sender (a tool)",
+     RunProxyTool},
+    {"discovery", "beacons on a busy LAN: Trickle vs. a fixed schedule",
+     RunDiscoveryBench},
+    {"peer_table", "10k peers: flat index and timer wheel vs. map and sweep",
+     RunPeerTableBench},
+    {"prewarm", "accepting a share: cold connects vs. pre-warmed ones",
+     RunPrewarmBench},
+    {"control", "control messages: binary codec vs. JSON, ns per message",
+     RunControlBench},
+    {"mjpeg", "mirror stream into frames: rescanning loop vs. demuxer",
+     RunMjpegBench},
+    {"mirror", "mirrored frames: decode at full size vs. scaled to the window",
+     RunMirrorBench},
+    {"capture", "mirroring a 1080p desktop: fps and CPU by screen activity",
+     RunCaptureBench},
+    {"tiles", "mirroring over hotspot: tile deltas vs. MJPEG, kb and latency",
+     RunTilesBench},
+};
+
+void PrintUsage() {
+  std::fprintf(stderr, "usage: zapshare_bench <suite> [args...]\n\nsuites:\n");
+  for (const Suite& s : kSuites) {
+    std::fprintf(stderr, "  %-12s %s\n", s.name, s.description);
+  }
+}
+
+}  // namespace
+}  // namespace bench
+}  // namespace zapshare
+
+int main(int argc, char** argv) {
+  using zapshare::bench::kSuites;
+  if (argc < 2) {
+    zapshare::bench::PrintUsage();
+    return 2;
+  }
+  for (const auto& s : kSuites) {
+    if (std::strcmp(argv[1], s.name) == 0) return s.run(argc - 2, argv + 2);
+  }
+  zapshare::bench::PrintUsage();
+  return 2;
+}
@@ -0,0 +1,51 @@
+#ifndef ZAPSHARE_NATIVE_BENCH_UTIL_H_
+#define ZAPSHARE_NATIVE_BENCH_UTIL_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace zapshare {
+namespace bench {
+
+inline double NowSeconds() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Deterministic, poorly compressible test data.
+inline std::vector<uint8_t> RandomBytes(size_t len, uint64_t seed = 1) {
+  std::vector<uint8_t> v(len);
+  uint64_t x = seed * 0x9E3779B97F4A7C15ull + 1;
+  for (size_t i = 0; i < len; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    v[i] = static_cast<uint8_t>(x >> 24);
+  }
+  return v;
+}
+
+// One result per line as a flat JSON object so runs can be collected and
+// diffed by scripts. |extra| is appended verbatim and must be either empty
+// or start with a comma.
+inline void Report(const std::string& suite, const std::string& name,
+                   uint64_t bytes, double seconds,
+                   const std::string& extra = "") {
+  double mb_per_s = seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0;
+  std::printf(
+      "{\"suite\":\"%s\",\"case\":\"%s\",\"bytes\":%llu,\"seconds\":%.6f,"
+      "\"mb_per_s\":%.1f,\"gbit_per_s\":%.2f%s}\n",
+      suite.c_str(), name.c_str(), static_cast<unsigned long long>(bytes),
+      seconds, mb_per_s, seconds > 0 ? bytes * 8 / seconds / 1e9 : 0,
+      extra.c_str());
+  std::fflush(stdout);
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_BENCH_UTIL_H_
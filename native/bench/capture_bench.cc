@@ -0,0 +1,276 @@
+// Mirroring a desktop: frame rate and CPU for typical kinds of screen
+// activity, with only the changed bands encoded.
+//
+//   zapshare_bench capture [seconds] [width] [height] [threads]
+//
+// Runs a ScreenMirrorSender uncapped (120 grabs a second) over a synthetic
+// desktop of |width| x |height| (default 1920 x 1080: windows of text on a
+// gradient) for |seconds| (default 3) per case, with one viewer on
+// loopback reading the stream, and |threads| encoder threads (default one
+// per core, up to 4):
+//
+//   static     nothing moves: grabs and diffs only, nothing is sent
+//   cursor     a pointer moves a few pixels every grab
+//   typing     a caret line gains a character every grab
+//   video      a 640 x 360 region plays noise
+//   scrolling  the whole screen moves every grab: every band encoded,
+//              which is what encoding each frame whole costs
+//
+// and reports fps sent to the viewer, grabs per second, cpu (cores busy,
+// from getrusage, grabbing included), encode_ms and the mean frame size.
+// With $DISPLAY set, "display" runs the same against the real screen for
+// however it's being used meanwhile.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "mirror_sender.h"
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+#if !defined(_WIN32)
+
+enum class Activity { kStatic, kCursor, kTyping, kVideo, kScrolling };
+
+// A desktop drawn twice over, so scrolling is a moving window onto it.
+class SyntheticDesktop : public ScreenSource {
+ public:
+  SyntheticDesktop(int width, int height, Activity activity)
+      : width_(width), height_(height), activity_(activity),
+        stride_(static_cast<size_t>(width) * 4),
+        canvas_(stride_ * height * 2),
+        noise_(RandomBytes(stride_ * height, 11)) {
+    for (int y = 0; y < height * 2; y++) {
+      for (int x = 0; x < width; x++) {
+        uint8_t* p = Pixel(x, y);
+        const int row = y % height;
+        const bool text = (row / 18) % 2 == 1 && (x / 7) % 9 != 0 &&
+                          ((x * 5 + row * 3) / 13) % 3 != 0 &&
+                          x % (width / 2) > 40;
+        p[0] = text ? 20 : static_cast<uint8_t>(200 + row * 40 / height);
+        p[1] = text ? 20 : static_cast<uint8_t>(190 + x * 40 / width);
+        p[2] = text ? 30 : 220;
+      }
+    }
+  }
+
+  bool Grab(ScreenFrame* frame) override {
+    const int n = grabs_++;
+    int top = 0;
+    switch (activity_) {
+      case Activity::kStatic:
+        break;
+      case Activity::kCursor: {
+        Restore();
+        const int x = (n * 5) % (width_ - 16);
+        const int y = (n * 3) % (height_ - 16);
+        Save(x, y, 16, 16);
+        Fill(x, y, 16, 16, 0);
+        break;
+      }
+      case Activity::kTyping: {
+        const int x = 60 + (n * 8) % (width_ - 120);
+        const int y = 180 + 18 * ((n * 8) / (width_ - 120) % 20);
+        Fill(x, y, 6, 12, 20);
+        break;
+      }
+      case Activity::kVideo: {
+        const size_t offset = (static_cast<size_t>(n) * 4099) %
+                              (noise_.size() - stride_ * 360);
+        for (int y = 0; y < 360; y++) {
+          std::memcpy(Pixel(200, 200 + y), &noise_[offset + stride_ * y],
+                      640 * 4);
+        }
+        break;
+      }
+      case Activity::kScrolling:
+        top = (n * 8) % height_;
+        break;
+    }
+    frame->pixels = Pixel(0, top);
+    frame->width = width_;
+    frame->height = height_;
+    frame->stride = stride_;
+    return true;
+  }
+
+ private:
+  uint8_t* Pixel(int x, int y) { return &canvas_[stride_ * y + x * 4]; }
+
+  void Fill(int x, int y, int w, int h, uint8_t value) {
+    for (int j = y; j < y + h; j++) std::memset(Pixel(x, j), value, w * 4);
+  }
+
+  // What the pointer covers, so it can be put back.
+  void Save(int x, int y, int w, int h) {
+    saved_x_ = x;
+    saved_y_ = y;
+    saved_w_ = w;
+    saved_.resize(static_cast<size_t>(w) * h * 4);
+    for (int j = 0; j < h; j++) {
+      std::memcpy(&saved_[static_cast<size_t>(j) * w * 4], Pixel(x, y + j),
+                  w * 4);
+    }
+  }
+
+  void Restore() {
+    const int h = saved_w_ == 0 ? 0 : saved_.size() / (saved_w_ * 4);
+    for (int j = 0; j < h; j++) {
+      std::memcpy(Pixel(saved_x_, saved_y_ + j),
+                  &saved_[static_cast<size_t>(j) * saved_w_ * 4],
+                  saved_w_ * 4);
+    }
+  }
+
+  const int width_;
+  const int height_;
+  const Activity activity_;
+  const size_t stride_;
+  std::vector<uint8_t> canvas_;
+  std::vector<uint8_t> noise_;
+  std::vector<uint8_t> saved_;
+  int saved_x_ = 0;
+  int saved_y_ = 0;
+  int saved_w_ = 0;
+  int grabs_ = 0;
+};
+
+double CpuSeconds() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Reads the stream on |port| and throws it away until |stop|.
+void View(uint16_t port, const std::atomic<bool>* stop) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return;
+  }
+  const char request[] = "GET /stream HTTP/1.1\r\n\r\n";
+  send(fd, request, sizeof(request) - 1, 0);
+  timeval timeout = {0, 200 * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::vector<char> buffer(256 * 1024);
+  while (!stop->load()) {
+    if (recv(fd, buffer.data(), buffer.size(), 0) == 0) break;
+  }
+  close(fd);
+}
+
+void Run(const char* name, std::unique_ptr<ScreenSource> source,
+         const ScreenMirrorConfig& config, double seconds) {
+  std::unique_ptr<ScreenMirrorSender> sender =
+      source != nullptr
+          ? ScreenMirrorSender::Start(std::move(source), config)
+          : ScreenMirrorSender::Start(config);
+  if (sender == nullptr) {
+    std::fprintf(stderr, "capture: %s could not start\n", name);
+    return;
+  }
+  std::atomic<bool> stop(false);
+  std::thread viewer(View, sender->port(), &stop);
+  // The first frame is encoded whole; measure from after it.
+  while (sender->stats().frames_sent == 0) std::this_thread::yield();
+  const ScreenMirrorStats before = sender->stats();
+  const double cpu_start = CpuSeconds();
+  const double start = NowSeconds();
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  const ScreenMirrorStats s = sender->stats();
+  const double elapsed = NowSeconds() - start;
+  const double cpu = CpuSeconds() - cpu_start;
+  stop = true;
+  viewer.join();
+  sender.reset();
+
+  const uint64_t sent = s.frames_sent - before.frames_sent;
+  const uint64_t encoded = s.encoded - before.encoded;
+  const uint64_t bytes = s.bytes_sent - before.bytes_sent;
+  char extra[320];
+  std::snprintf(
+      extra, sizeof(extra),
+      ",\"fps\":%.1f,\"grabs_per_s\":%.1f,\"cpu\":%.2f,\"encoded\":%llu,"
+      "\"unchanged\":%llu,\"encode_ms\":%.2f,\"capture_ms\":%.2f,"
+      "\"frame_kb\":%.1f",
+      sent / elapsed, (s.captured - before.captured) / elapsed,
+      cpu / elapsed, static_cast<unsigned long long>(encoded),
+      static_cast<unsigned long long>(s.unchanged - before.unchanged),
+      (s.encode_ns - before.encode_ns) / 1e6 /
+          std::max<uint64_t>(encoded, 1),
+      (s.capture_ns - before.capture_ns) / 1e6 /
+          std::max<uint64_t>(s.captured - before.captured, 1),
+      bytes / 1024.0 / std::max<uint64_t>(sent, 1));
+  Report("capture", name, bytes, elapsed, extra);
+}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace
+
+int RunCaptureBench(int argc, char** argv) {
+#if !defined(_WIN32)
+  if (!MjpegEncoder::Available()) {
+    std::fprintf(stderr, "capture: built without libjpeg\n");
+    return 1;
+  }
+  const double seconds = argc > 0 ? std::atof(argv[0]) : 3;
+  const int width = argc > 1 ? std::atoi(argv[1]) : 1920;
+  const int height = argc > 2 ? std::atoi(argv[2]) : 1080;
+  ScreenMirrorConfig config;
+  config.fps = 120;
+  config.threads = argc > 3 ? std::atoi(argv[3]) : 0;
+  if (seconds <= 0 || width < 1000 || height < 600) {
+    std::fprintf(stderr, "capture: seconds must be positive and the size "
+                         "at least 1000 x 600\n");
+    return 1;
+  }
+  const struct {
+    const char* name;
+    Activity activity;
+  } kCases[] = {
+      {"static", Activity::kStatic},     {"cursor", Activity::kCursor},
+      {"typing", Activity::kTyping},     {"video", Activity::kVideo},
+      {"scrolling", Activity::kScrolling},
+  };
+  for (const auto& c : kCases) {
+    Run(c.name, std::make_unique<SyntheticDesktop>(width, height, c.activity),
+        config, seconds);
+  }
+  if (ScreenMirrorSender::Available() && std::getenv("DISPLAY") != nullptr) {
+    Run("display", nullptr, config, seconds);
+  }
+  return 0;
+#else
+  (void)argc;
+  (void)argv;
+  std::fprintf(stderr, "capture: not supported on this platform\n");
+  return 1;
+#endif
+}
+
+}  // namespace bench
+}  // namespace zapshare
@@ -0,0 +1,142 @@
+// Adaptive compression across file types and link speeds.
+//
+//   zapshare_bench compress [size_mb]
+//
+// Each file type is pushed through a ChunkCompressor told the link rate, and
+// the frames are checked with a ChunkDecompressor. Compression and sending
+// overlap in the app, so the effective transfer time is
+// max(compress time, wire bytes / link rate); "speedup" compares it with
+// sending the raw bytes.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "bench_util.h"
+#include "compress.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+std::string Lines(size_t len, uint64_t seed,
+                  std::string (*line)(size_t i, uint8_t r)) {
+  std::vector<uint8_t> noise = RandomBytes(4096, seed);
+  std::string s;
+  s.reserve(len + 256);
+  for (size_t i = 0; s.size() < len; i++) s += line(i, noise[i % 4096]);
+  s.resize(len);
+  return s;
+}
+
+std::vector<uint8_t> FileType(const std::string& type, size_t len) {
+  std::string s;
+  if (type == "log") {
+    s = Lines(len, 1, [](size_t i, uint8_t r) {
+      return "2026-10-18T12:00:" + std::to_string(i % 60) +
+             " INFO transfer chunk=" + std::to_string(r * 4096 + i) +
+             " peer=192.168.1." + std::to_string(r) + "\n";
+    });
+  } else if (type == "source") {
+    s = Lines(len, 2, [](size_t i, uint8_t r) {
+      return "  if (chunk_" + std::to_string(r % 16) +
+             " != nullptr) {\n    total += chunk_" + std::to_string(r % 16) +
+             "->size();  // " + std::to_string(i) + "\n  }\n";
+    });
+  } else if (type == "json") {
+    s = Lines(len, 3, [](size_t i, uint8_t r) {
+      return "{\"fileName\":\"IMG_" + std::to_string(1000 + i) +
+             ".jpg\",\"fileSize\":" + std::to_string(r * 65537) +
+             ",\"fileIndex\":" + std::to_string(i) + "},\n";
+    });
+  } else if (type == "media") {
+    return RandomBytes(len, 4);  // JPEG/MP4/ZIP: already compressed.
+  } else if (type == "sparse") {
+    std::vector<uint8_t> v(len, 0);  // Disk image, VM snapshot.
+    std::vector<uint8_t> data = RandomBytes(len / 16, 5);
+    for (size_t i = 0; i < data.size(); i++) {
+      v[(i / 4096) * 65536 + i % 4096] = data[i];
+    }
+    return v;
+  } else {
+    // "mixed": a project folder zipped without compression.
+    std::vector<uint8_t> v = FileType("source", len / 2);
+    std::vector<uint8_t> media = RandomBytes(len - v.size(), 6);
+    v.insert(v.end(), media.begin(), media.end());
+    return v;
+  }
+  return std::vector<uint8_t>(s.begin(), s.end());
+}
+
+void RunCase(const std::string& type, const std::vector<uint8_t>& data,
+             double link_mbps) {
+  const double link = link_mbps * 1e6 / 8;
+  const double start = NowSeconds();
+  ChunkCompressor compressor(SupportedCodecs());
+  compressor.SetLinkRate(link);
+  ChunkDecompressor decompressor;
+  std::vector<uint8_t> buf(1024 * 1024);
+  std::vector<uint8_t> frames;
+  auto drain = [&] {
+    while (compressor.Pending() > 0) {
+      size_t n = compressor.Read(buf.data(), buf.size());
+      frames.insert(frames.end(), buf.begin(), buf.begin() + n);
+    }
+  };
+  const size_t piece = 1024 * 1024;
+  for (size_t pos = 0; pos < data.size(); pos += piece) {
+    size_t n = piece < data.size() - pos ? piece : data.size() - pos;
+    compressor.Update(data.data() + pos, n);
+    drain();
+  }
+  compressor.Finish();
+  drain();
+  const double cpu = NowSeconds() - start;
+
+  bool ok = decompressor.Update(frames.data(), frames.size());
+  std::vector<uint8_t> out(decompressor.Pending());
+  out.resize(decompressor.Read(out.data(), out.size()));
+  ok = ok && out == data;
+
+  const CompressStats& s = compressor.stats();
+  const double wire = s.wire_bytes / link;
+  const double effective = cpu > wire ? cpu : wire;
+  const double raw = data.size() / link;
+  char extra[320];
+  std::snprintf(extra, sizeof(extra),
+                ",\"link_mbps\":%.0f,\"cpu_seconds\":%.4f,\"wire_bytes\":%llu,"
+                "\"ratio\":%.3f,\"frames_store\":%llu,\"frames_lz4\":%llu,"
+                "\"frames_deflate1\":%llu,\"frames_deflate6\":%llu,"
+                "\"speedup\":%.2f,\"verified\":%s",
+                link_mbps, cpu,
+                static_cast<unsigned long long>(s.wire_bytes),
+                static_cast<double>(s.wire_bytes) / data.size(),
+                static_cast<unsigned long long>(s.frames[0]),
+                static_cast<unsigned long long>(s.frames[1]),
+                static_cast<unsigned long long>(s.frames[2]),
+                static_cast<unsigned long long>(s.frames[3]), raw / effective,
+                ok ? "true" : "false");
+  Report("compress", type, data.size(), effective, extra);
+}
+
+}  // namespace
+
+int RunCompressBench(int argc, char** argv) {
+  size_t size_mb = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 32;
+  if (size_mb == 0) size_mb = 32;
+  const size_t size = size_mb * 1024 * 1024;
+
+  // Bluetooth-ish hotspot, congested 2.4 GHz, typical Wi-Fi Direct, good
+  // 5 GHz, gigabit Ethernet.
+  const double links[] = {2, 10, 40, 100, 1000};
+  for (const char* type :
+       {"log", "source", "json", "media", "sparse", "mixed"}) {
+    const std::vector<uint8_t> data = FileType(type, size);
+    for (double link : links) RunCase(type, data, link);
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
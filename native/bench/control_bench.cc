@@ -0,0 +1,175 @@
+// Control messages: the binary codec vs. JSON, per message type.
+//
+//   zapshare_bench control [iterations]
+//
+// Builds one typical message of each control type, as the discovery
+// service sends them (a share of 12 photos, a cast status tick, a swipe on
+// a mirrored screen, ...), then encodes and decodes each |iterations|
+// times (default 200000). "binary" is the ZSC form; "json" is the same
+// message through the native JSON reader and writer, which is what old
+// peers exchange and stands in for Dart's jsonEncode/jsonDecode, so the
+// two differ only in the format. Reports encode_ns and decode_ns per
+// message and the encoded size.
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "control_codec.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+void Set(ControlMessage* m, const char* key, int64_t value) {
+  ControlValue* v = m->Find(key);
+  v->i = value;
+  v->present = true;
+}
+
+void SetDouble(ControlMessage* m, const char* key, double value) {
+  ControlValue* v = m->Find(key);
+  v->d = value;
+  v->present = true;
+}
+
+void SetString(ControlMessage* m, const char* key, const std::string& s) {
+  ControlValue* v = m->Find(key);
+  v->s = s;
+  v->present = true;
+}
+
+ControlMessage Typical(ControlType type) {
+  ControlMessage m;
+  m.Reset(type);
+  SetString(&m, "deviceId", "3f9c2a71-5be0-4d8e-9a61-c07d2e4b18f5");
+  SetString(&m, "deviceName", "Pixel 8 Pro");
+  Set(&m, "timestamp", 1760781234567);
+  switch (type) {
+    case ControlType::kConnectionRequest: {
+      SetString(&m, "platform", "android");
+      Set(&m, "port", 8080);
+      Set(&m, "fileCount", 12);
+      ControlValue* names = m.Find("fileNames");
+      for (int i = 0; i < 12; i++) {
+        names->list.push_back("IMG_2026101" + std::to_string(i) +
+                              "_183042.jpg");
+      }
+      names->present = true;
+      Set(&m, "totalSize", 48213377);
+      break;
+    }
+    case ControlType::kConnectionResponse:
+    case ControlType::kCastAck:
+      Set(&m, "accepted", 1);
+      break;
+    case ControlType::kCastUrl:
+      SetString(&m, "url", "http://192.168.1.23:8080/file/0");
+      SetString(&m, "fileName", "Holiday 2026.mp4");
+      break;
+    case ControlType::kCastControl:
+      SetString(&m, "action", "seek");
+      SetDouble(&m, "seekPosition", 754.25);
+      break;
+    case ControlType::kCastStatus:
+      SetDouble(&m, "position", 754.32);
+      SetDouble(&m, "duration", 3621.5);
+      SetDouble(&m, "buffered", 790.0);
+      Set(&m, "isPlaying", 1);
+      Set(&m, "isBuffering", 0);
+      SetDouble(&m, "volume", 0.8);
+      SetString(&m, "fileName", "Holiday 2026.mp4");
+      break;
+    case ControlType::kScreenMirror:
+      SetString(&m, "streamUrl", "http://192.168.1.23:8090/stream.mjpeg");
+      break;
+    case ControlType::kScreenMirrorControl:
+      SetString(&m, "action", "swipe");
+      SetDouble(&m, "tapX", 0.5);
+      SetDouble(&m, "tapY", 0.8);
+      SetDouble(&m, "endX", 0.5);
+      SetDouble(&m, "endY", 0.2);
+      Set(&m, "duration", 300);
+      break;
+    case ControlType::kNone:
+      break;
+  }
+  return m;
+}
+
+// Keeps the optimiser from dropping work whose result is unused.
+volatile size_t g_sink;
+
+template <typename Encode, typename Decode>
+void Run(const char* format, const ControlMessage& m, long iterations,
+         const Encode& encode, const Decode& decode) {
+  size_t size = 0;
+  double start = NowSeconds();
+  for (long i = 0; i < iterations; i++) size += encode(m);
+  const double encode_s = NowSeconds() - start;
+  g_sink = size;
+
+  ControlMessage out;
+  size_t decoded = 0;
+  start = NowSeconds();
+  for (long i = 0; i < iterations; i++) decoded += decode(&out);
+  const double decode_s = NowSeconds() - start;
+  g_sink = decoded;
+
+  char extra[160];
+  std::snprintf(extra, sizeof(extra),
+                ",\"encode_ns\":%.1f,\"decode_ns\":%.1f,\"size\":%zu,"
+                "\"ok\":%s",
+                encode_s * 1e9 / iterations, decode_s * 1e9 / iterations,
+                size / iterations,
+                decoded == static_cast<size_t>(iterations) ? "true"
+                                                           : "false");
+  Report("control", std::string(format) + "_" + m.schema->name,
+         size, encode_s + decode_s, extra);
+}
+
+}  // namespace
+
+int RunControlBench(int argc, char** argv) {
+  const long iterations = argc > 0 ? std::strtol(argv[0], nullptr, 10)
+                                   : 200000;
+  if (iterations <= 0) {
+    std::fprintf(stderr, "control: iterations must be positive\n");
+    return 1;
+  }
+  for (int t = 1; t <= kControlTypes; t++) {
+    const ControlMessage m = Typical(static_cast<ControlType>(t));
+    std::vector<uint8_t> binary;
+    std::string json;
+    EncodeControl(m, &binary);
+    EncodeControlJson(m, &json);
+
+    Run(
+        "binary", m, iterations,
+        [&](const ControlMessage& in) {
+          EncodeControl(in, &binary);
+          return binary.size();
+        },
+        [&](ControlMessage* out) {
+          return DecodeControlBinary(binary.data(), binary.size(), out);
+        });
+    Run(
+        "json", m, iterations,
+        [&](const ControlMessage& in) {
+          EncodeControlJson(in, &json);
+          return json.size();
+        },
+        [&](ControlMessage* out) {
+          return DecodeControlJson(
+              reinterpret_cast<const uint8_t*>(json.data()), json.size(),
+              out);
+        });
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
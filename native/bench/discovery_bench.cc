@@ -0,0 +1,170 @@
+// Discovery beacons: Trickle scheduling vs. the old fixed 8 s schedule.
+//
+//   zapshare_bench discovery [peers] [speedup]
+//
+// Runs |peers| DiscoveryEngines (10 and 50 by default) as one LAN on
+// loopback: each on its own 127.0.0.x, all on one port and in one
+// multicast group. Every interval is divided by |speedup| (16 by default)
+// so a run takes seconds; times and rates are reported scaled back to
+// what the app would see. "boot_ms" is until everyone knows everyone,
+// "newcomer_ms" until one more device and everyone know each other once
+// the LAN has settled, and "packets_per_min" is the whole LAN's beacons
+// while settled.
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "discovery.h"
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace bench {
+
+#if defined(_WIN32)
+
+int RunDiscoveryBench(int, char**) {
+  std::fprintf(stderr, "discovery: not available on Windows\n");
+  return 0;
+}
+
+#else
+
+namespace {
+
+struct Schedule {
+  const char* name;
+  uint32_t min_interval_ms;
+  uint32_t max_interval_ms;
+  uint32_t redundancy;
+};
+
+const Schedule kSchedules[] = {
+    {"fixed_8s", 8000, 8000, 0},
+    {"trickle", 250, 32000, 3},
+};
+
+uint16_t FreeUdpPort() {
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  socklen_t len = sizeof(addr);
+  bind(fd, reinterpret_cast<sockaddr*>(&addr), len);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  close(fd);
+  return ntohs(addr.sin_port);
+}
+
+class Lan {
+ public:
+  Lan(const Schedule& schedule, int speedup)
+      : schedule_(schedule), speedup_(speedup), port_(FreeUdpPort()) {}
+
+  bool Join() {
+    const int host = static_cast<int>(engines_.size()) + 2;
+    DiscoveryConfig config;
+    config.self.id = DeviceIdFromString("bench" + std::to_string(host));
+    config.self.name = "Peer " + std::to_string(host);
+    config.port = port_;
+    config.group = "239.255.67.2";
+    config.interfaces = {"127.0.0." + std::to_string(host)};
+    config.broadcast = false;
+    config.min_interval_ms = schedule_.min_interval_ms / speedup_;
+    config.max_interval_ms = schedule_.max_interval_ms / speedup_;
+    config.redundancy = schedule_.redundancy;
+    auto engine = DiscoveryEngine::Start(config);
+    if (!engine) return false;
+    engines_.push_back(std::move(engine));
+    return true;
+  }
+
+  // Seconds until everyone knew everyone else; negative after |timeout|.
+  double UntilAllKnown(double timeout) const {
+    const double start = NowSeconds();
+    for (;;) {
+      const bool all = std::all_of(
+          engines_.begin(), engines_.end(), [&](const auto& engine) {
+            return engine->stats().peers == engines_.size() - 1;
+          });
+      if (all) return NowSeconds() - start;
+      if (NowSeconds() - start > timeout) return -1;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  uint64_t Sent() const {
+    uint64_t sent = 0;
+    for (const auto& engine : engines_) sent += engine->stats().sent;
+    return sent;
+  }
+
+ private:
+  const Schedule schedule_;
+  const int speedup_;
+  const uint16_t port_;
+  std::vector<std::unique_ptr<DiscoveryEngine>> engines_;
+};
+
+void RunCase(const Schedule& schedule, int peers, int speedup) {
+  Lan lan(schedule, speedup);
+  for (int i = 0; i < peers; i++) {
+    if (!lan.Join()) {
+      std::fprintf(stderr, "discovery: could not start an engine\n");
+      return;
+    }
+  }
+  const double timeout = 4.0 * schedule.max_interval_ms / 1000 / speedup;
+  const double boot = lan.UntilAllKnown(timeout);
+  // Settled: every interval has grown to the longest.
+  std::this_thread::sleep_for(std::chrono::milliseconds(
+      2 * schedule.max_interval_ms / speedup));
+
+  const double window = 4.0 * schedule.max_interval_ms / 1000 / speedup;
+  const uint64_t before = lan.Sent();
+  std::this_thread::sleep_for(std::chrono::duration<double>(window));
+  const uint64_t sent = lan.Sent() - before;
+
+  lan.Join();
+  const double newcomer = lan.UntilAllKnown(timeout);
+
+  const double scaled_window = window * speedup;
+  char extra[256];
+  std::snprintf(extra, sizeof(extra),
+                ",\"peers\":%d,\"speedup\":%d,\"boot_ms\":%.0f,"
+                "\"newcomer_ms\":%.0f,\"packets_per_min\":%.1f",
+                peers, speedup, boot < 0 ? -1 : boot * speedup * 1000,
+                newcomer < 0 ? -1 : newcomer * speedup * 1000,
+                sent * 60 / scaled_window);
+  Report("discovery", std::string(schedule.name) + "_" +
+                          std::to_string(peers),
+         sent * kBeaconSize, scaled_window, extra);
+}
+
+}  // namespace
+
+int RunDiscoveryBench(int argc, char** argv) {
+  std::vector<int> sizes = {10, 50};
+  if (argc > 0) sizes = {std::max(2, std::atoi(argv[0]))};
+  const int speedup = argc > 1 ? std::max(1, std::atoi(argv[1])) : 16;
+  for (const int peers : sizes) {
+    for (const Schedule& schedule : kSchedules) {
+      RunCase(schedule, peers, speedup);
+    }
+  }
+  return 0;
+}
+
+#endif
+
+}  // namespace bench
+}  // namespace zapshare
@@ -0,0 +1,229 @@
+// Many receivers downloading the same file at once: every connection
+// reading the file on its own vs. one shared read fanned out to all.
+//
+//   zapshare_bench fanout [file_mb] [clients...]
+//
+// Each client is a loopback TCP connection drained by its own thread; each
+// sender thread reads the file and writes it to its socket. The file is
+// dropped from the page cache before every case (where the OS allows it),
+// so "disk_mb" is what really had to come off storage.
+
+#include "bench_util.h"
+
+#if defined(_WIN32)
+
+namespace zapshare {
+namespace bench {
+
+int RunFanoutBench(int, char**) {
+  std::fprintf(stderr, "fanout: loopback sockets are POSIX-only for now\n");
+  return 1;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#else
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+#include "fanout.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+bool SendAll(int fd, const uint8_t* p, size_t len) {
+  while (len > 0) {
+    const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// |count| connected loopback TCP pairs.
+bool LoopbackPairs(size_t count, std::vector<int>* tx, std::vector<int>* rx) {
+  const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  bool ok = bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), len) == 0 &&
+            listen(listen_fd, static_cast<int>(count)) == 0 &&
+            getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr),
+                        &len) == 0;
+  for (size_t i = 0; ok && i < count; i++) {
+    const int a = socket(AF_INET, SOCK_STREAM, 0);
+    ok = connect(a, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    const int b = ok ? accept(listen_fd, nullptr, nullptr) : -1;
+    tx->push_back(b);
+    rx->push_back(a);
+    ok = ok && b >= 0;
+  }
+  close(listen_fd);
+  return ok;
+}
+
+// Best effort: clean pages of the file leave the page cache.
+void DropFromCache(const std::string& path) {
+#if defined(POSIX_FADV_DONTNEED)
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+#else
+  (void)path;
+#endif
+}
+
+// Sends the whole file from its own descriptor, the way every request
+// was served before.
+bool SendIndependent(const std::string& path, int sock, size_t chunk) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  std::vector<uint8_t> buf(chunk);
+  bool ok = true;
+  for (;;) {
+    const ssize_t n = read(fd, buf.data(), buf.size());
+    if (n <= 0) {
+      ok = n == 0;
+      break;
+    }
+    if (!SendAll(sock, buf.data(), static_cast<size_t>(n))) {
+      ok = false;
+      break;
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+bool SendShared(FanoutCache* cache, const std::string& path, int sock,
+                size_t chunk) {
+  std::unique_ptr<FanoutReader> reader = cache->Open(path, 0, UINT64_MAX);
+  if (reader == nullptr) return false;
+  std::vector<uint8_t> buf(chunk);
+  while (reader->position() < reader->end()) {
+    const int64_t n = reader->Read(buf.data(), buf.size());
+    if (n < 0) return false;
+    if (n == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+    if (!SendAll(sock, buf.data(), static_cast<size_t>(n))) return false;
+  }
+  return true;
+}
+
+void Run(const std::string& path, uint64_t size, size_t clients,
+         bool shared) {
+  std::vector<int> tx;
+  std::vector<int> rx;
+  if (!LoopbackPairs(clients, &tx, &rx)) {
+    std::fprintf(stderr, "fanout: loopback setup failed\n");
+    return;
+  }
+  DropFromCache(path);
+  FanoutCache cache(0, 0);
+  std::atomic<bool> ok{true};
+  std::atomic<uint64_t> received{0};
+
+  const double start = NowSeconds();
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < clients; i++) {
+    threads.emplace_back([&, i] {
+      std::vector<uint8_t> buf(256 * 1024);
+      for (;;) {
+        const ssize_t n = recv(rx[i], buf.data(), buf.size(), 0);
+        if (n <= 0) break;
+        received += static_cast<uint64_t>(n);
+      }
+    });
+    threads.emplace_back([&, i] {
+      const bool sent = shared
+                            ? SendShared(&cache, path, tx[i], kFanoutBlockSize)
+                            : SendIndependent(path, tx[i], kFanoutBlockSize);
+      if (!sent) ok = false;
+      shutdown(tx[i], SHUT_WR);
+    });
+  }
+  for (auto& t : threads) t.join();
+  const double seconds = NowSeconds() - start;
+  for (size_t i = 0; i < clients; i++) {
+    close(tx[i]);
+    close(rx[i]);
+  }
+  if (!ok || received != size * clients) {
+    std::fprintf(stderr, "fanout: transfer failed\n");
+    return;
+  }
+
+  const uint64_t disk =
+      shared ? cache.stats().disk_bytes : size * clients;
+  char extra[96];
+  std::snprintf(extra, sizeof(extra), ",\"clients\":%zu,\"disk_mb\":%.1f",
+                clients, disk / (1024.0 * 1024.0));
+  Report("fanout",
+         std::string(shared ? "shared_" : "independent_") +
+             std::to_string(clients),
+         size * clients, seconds, extra);
+}
+
+}  // namespace
+
+int RunFanoutBench(int argc, char** argv) {
+  const size_t file_mb = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 64;
+  std::vector<size_t> counts;
+  for (int i = 1; i < argc; i++) {
+    counts.push_back(std::strtoul(argv[i], nullptr, 10));
+  }
+  if (counts.empty()) counts = {1, 8, 32};
+
+  const uint64_t size = uint64_t{file_mb} * 1024 * 1024;
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "zs_fanout_bench.bin")
+          .string();
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    const std::vector<uint8_t> chunk = RandomBytes(1024 * 1024, 7);
+    for (size_t i = 0; i < file_mb; i++) {
+      out.write(reinterpret_cast<const char*>(chunk.data()),
+                static_cast<std::streamsize>(chunk.size()));
+    }
+  }
+  {
+    // Written pages must be clean before they can be dropped.
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      fsync(fd);
+      close(fd);
+    }
+  }
+
+  for (size_t clients : counts) {
+    if (clients == 0) continue;
+    Run(path, size, clients, false);
+    Run(path, size, clients, true);
+  }
+  std::filesystem::remove(path);
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#endif
@@ -0,0 +1,95 @@
+// Hashing throughput for the inline digest stage.
+//
+//   zapshare_bench hash [size_mb]
+//
+// Feeds the same buffer through ChunkHasher in the piece sizes the transfer
+// paths use (64 KB socket reads on the TCP path, 4 MB SAF reads on Android)
+// and reports which link rates the hasher can keep up with. CRC-32, which
+// the streaming ZIP writer computes per entry, is measured the same way.
+
+#include <cstdlib>
+#include <string>
+
+#include "bench_util.h"
+#include "content_hash.h"
+#include "crc32.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+struct LinkRate {
+  const char* name;
+  double gbit_per_s;
+};
+
+const LinkRate kLinks[] = {
+    {"wifi5_866m", 0.866},
+    {"gige", 1.0},
+    {"wifi6_2400m", 2.4},
+    {"10gige", 10.0},
+};
+
+std::string KeepsUp(uint64_t bytes, double seconds) {
+  double gbit = bytes * 8 / seconds / 1e9;
+  std::string s = ",\"keeps_up_with\":[";
+  bool first = true;
+  for (const LinkRate& l : kLinks) {
+    if (gbit < l.gbit_per_s) continue;
+    if (!first) s += ",";
+    s += "\"";
+    s += l.name;
+    s += "\"";
+    first = false;
+  }
+  return s + "]";
+}
+
+}  // namespace
+
+int RunHashBench(int argc, char** argv) {
+  size_t size_mb = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 256;
+  if (size_mb == 0) size_mb = 256;
+  const std::vector<uint8_t> data = RandomBytes(size_mb * 1024 * 1024);
+  const std::string simd =
+      std::string(",\"simd\":") + (Blake3::HasSimd() ? "true" : "false");
+
+  {
+    double start = NowSeconds();
+    uint8_t out[kBlake3OutLen];
+    Blake3::Hash(data.data(), data.size(), out);
+    double secs = NowSeconds() - start;
+    Report("hash", "blake3_oneshot", data.size(), secs,
+           simd + KeepsUp(data.size(), secs));
+  }
+
+  for (size_t piece : {size_t{64 * 1024}, size_t{4 * 1024 * 1024}}) {
+    double start = NowSeconds();
+    ChunkHasher hasher(data.size(), kDefaultDigestChunkSize);
+    for (size_t pos = 0; pos < data.size(); pos += piece) {
+      size_t n = piece < data.size() - pos ? piece : data.size() - pos;
+      hasher.Update(pos, data.data() + pos, n);
+    }
+    Digest d;
+    hasher.FileDigest(&d);
+    double secs = NowSeconds() - start;
+    Report("hash", "chunk_hasher_piece_" + std::to_string(piece / 1024) + "k",
+           data.size(), secs, simd + KeepsUp(data.size(), secs));
+  }
+
+  for (bool accelerated : {true, false}) {
+    double start = NowSeconds();
+    const uint32_t crc = accelerated
+                             ? Crc32(0, data.data(), data.size())
+                             : Crc32Portable(0, data.data(), data.size());
+    double secs = NowSeconds() - start;
+    Report("hash", accelerated ? "crc32" : "crc32_portable", data.size(),
+           secs, ",\"crc\":" + std::to_string(crc) +
+                     KeepsUp(data.size(), secs));
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
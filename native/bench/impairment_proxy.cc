@@ -0,0 +1,295 @@
+#include "impairment_proxy.h"
+
+#if !defined(_WIN32)
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <sstream>
+#include <utility>
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kReadSize = 16 * 1024;
+constexpr size_t kSegmentSize = 1448;  // Ethernet MSS with timestamps.
+constexpr auto kWakeup = std::chrono::milliseconds(50);
+
+constexpr uint64_t Mbit(uint64_t mbit) { return mbit * 1000 * 1000 / 8; }
+
+void SetNoDelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+bool SendAll(int fd, const uint8_t* p, size_t len) {
+  while (len > 0) {
+    const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+int ConnectTo(const std::string& host, uint16_t port) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &addrs) != 0) {
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo* a = addrs; a != nullptr && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  return fd;
+}
+
+}  // namespace
+
+const std::vector<Impairment>& ImpairmentProfiles() {
+  static const std::vector<Impairment> profiles = {
+      {"none", 0, 0, 0, 0},
+      {"ethernet", Mbit(940), 1, 0, 0},
+      {"wifi", Mbit(200), 4, 3, 0.0005},
+      {"hotspot", Mbit(40), 30, 20, 0.005},
+      {"congested", Mbit(8), 120, 60, 0.02},
+  };
+  return profiles;
+}
+
+bool ParseImpairment(const std::string& spec, Impairment* out) {
+  for (const Impairment& p : ImpairmentProfiles()) {
+    if (p.name == spec) {
+      *out = p;
+      return true;
+    }
+  }
+  std::istringstream in(spec);
+  double mbit, rtt, jitter, loss_pct;
+  char c1, c2, c3;
+  if (!(in >> mbit >> c1 >> rtt >> c2 >> jitter >> c3 >> loss_pct) ||
+      c1 != ',' || c2 != ',' || c3 != ',' || mbit < 0 || rtt < 0 ||
+      jitter < 0 || loss_pct < 0 || loss_pct >= 100) {
+    return false;
+  }
+  *out = Impairment();
+  out->name = spec;
+  out->rate = static_cast<uint64_t>(mbit * 1e6 / 8);
+  out->rtt_ms = static_cast<uint32_t>(rtt);
+  out->jitter_ms = static_cast<uint32_t>(jitter);
+  out->loss = loss_pct / 100;
+  return true;
+}
+
+ImpairmentProxy::ImpairmentProxy(const Impairment& impairment,
+                                 std::string host, uint16_t port)
+    : impairment_(impairment), host_(std::move(host)), upstream_port_(port) {}
+
+ImpairmentProxy::~ImpairmentProxy() {
+  stop_ = true;
+  if (listen_ >= 0) {
+    shutdown(listen_, SHUT_RDWR);
+    close(listen_);
+  }
+  if (accept_thread_.joinable()) accept_thread_.join();
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (const int fd : sockets_) shutdown(fd, SHUT_RDWR);
+  }
+  // Relays close their own sockets on the way out.
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (active_ == 0) return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+bool ImpairmentProxy::Start(uint16_t listen_port) {
+  listen_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_ < 0) return false;
+  const int one = 1;
+  setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(listen_port);
+  addr.sin_addr.s_addr = htonl(listen_port == 0 ? INADDR_LOOPBACK
+                                                : INADDR_ANY);
+  socklen_t len = sizeof(addr);
+  if (bind(listen_, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+      listen(listen_, 64) != 0) {
+    return false;
+  }
+  getsockname(listen_, reinterpret_cast<sockaddr*>(&addr), &len);
+  port_ = ntohs(addr.sin_port);
+  accept_thread_ = std::thread(&ImpairmentProxy::Accept, this);
+  return true;
+}
+
+void ImpairmentProxy::Accept() {
+  for (uint64_t seed = 1;; seed++) {
+    const int client = accept(listen_, nullptr, nullptr);
+    if (client < 0) return;
+    const int upstream = ConnectTo(host_, upstream_port_);
+    if (upstream < 0) {
+      close(client);
+      continue;
+    }
+    SetNoDelay(client);
+    SetNoDelay(upstream);
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      sockets_.push_back(client);
+      sockets_.push_back(upstream);
+      active_++;
+    }
+    std::thread([this, client, upstream, seed] {
+      std::thread back(&ImpairmentProxy::Relay, this, upstream, client, 0,
+                       seed * 2 + 1);
+      Relay(client, upstream, 1, seed * 2);
+      back.join();
+      std::lock_guard<std::mutex> lock(mu_);
+      sockets_.erase(std::remove_if(sockets_.begin(), sockets_.end(),
+                                    [&](int fd) {
+                                      return fd == client || fd == upstream;
+                                    }),
+                     sockets_.end());
+      close(client);
+      close(upstream);
+      active_--;
+    }).detach();
+  }
+}
+
+void ImpairmentProxy::Relay(int from, int to, int dir, uint64_t seed) {
+  struct Segment {
+    std::vector<uint8_t> data;
+    Clock::time_point due;
+  };
+  const Impairment& link = impairment_;
+  const auto one_way = std::chrono::microseconds(link.rtt_ms * 500);
+  const auto retransmit =
+      std::chrono::milliseconds(std::max<uint32_t>(link.rtt_ms, 1));
+  // Bytes on the wire don't count against the bottleneck's queue.
+  const size_t limit = link.queue_bytes + link.rate * link.rtt_ms / 1000;
+
+  std::atomic<size_t>& queued = queued_[dir];
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<Segment> queue;
+  bool eof = false;
+  bool broken = false;
+
+  std::thread writer([&] {
+    for (;;) {
+      Segment segment;
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        while (queue.empty() && !eof && !broken) cv.wait_for(lock, kWakeup);
+        if (queue.empty() || broken) break;
+        segment = std::move(queue.front());
+        queue.pop_front();
+      }
+      std::this_thread::sleep_until(segment.due);
+      const bool sent =
+          SendAll(to, segment.data.data(), segment.data.size());
+      queued -= segment.data.size();
+      if (!sent) {
+        std::lock_guard<std::mutex> lock(mu);
+        broken = true;
+        break;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mu);
+    if (broken) {
+      shutdown(from, SHUT_RD);  // Unblocks the reader.
+    } else {
+      shutdown(to, SHUT_WR);
+    }
+  });
+
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> unit(0, 1);
+  Clock::time_point last_due = Clock::now();
+  std::vector<uint8_t> buf(kReadSize);
+  while (!stop_) {
+    // The queue is shared with the link's other connections.
+    while (queued >= limit && !stop_) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      if (broken) break;
+    }
+    const ssize_t n = recv(from, buf.data(), buf.size(), 0);
+    if (n <= 0) break;
+    Clock::time_point due;
+    {
+      std::lock_guard<std::mutex> lock(link_mu_);
+      due = std::max(Clock::now(), link_free_[dir]);
+      if (link.rate > 0) {
+        due += std::chrono::nanoseconds(static_cast<uint64_t>(n) *
+                                        1'000'000'000ull / link.rate);
+      }
+      link_free_[dir] = due;
+    }
+    due += one_way;
+    if (link.jitter_ms > 0) {
+      due += std::chrono::microseconds(
+          static_cast<int64_t>(unit(rng) * link.jitter_ms * 1000));
+    }
+    if (link.loss > 0) {
+      const double segments =
+          std::ceil(static_cast<double>(n) / kSegmentSize);
+      if (unit(rng) < 1 - std::pow(1 - link.loss, segments)) {
+        due += retransmit;
+        lost_++;
+      }
+    }
+    // TCP delivers in order, so nothing overtakes a late segment.
+    due = std::max(due, last_due);
+    last_due = due;
+    std::lock_guard<std::mutex> lock(mu);
+    queue.push_back({std::vector<uint8_t>(buf.begin(), buf.begin() + n), due});
+    queued += static_cast<size_t>(n);
+    cv.notify_all();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    eof = true;
+    cv.notify_all();
+  }
+  writer.join();
+  // What a broken connection never sent no longer holds up the link.
+  for (const Segment& segment : queue) queued -= segment.data.size();
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#endif  // !defined(_WIN32)
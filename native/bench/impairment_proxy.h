@@ -0,0 +1,91 @@
+#ifndef ZAPSHARE_NATIVE_BENCH_IMPAIRMENT_PROXY_H_
+#define ZAPSHARE_NATIVE_BENCH_IMPAIRMENT_PROXY_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace zapshare {
+namespace bench {
+
+// A TCP proxy that makes loopback behave like a bad network, without root
+// or tc: every byte is relayed through a userspace model of a bottleneck
+// link, separately in each direction.
+//
+// The link serialises bytes at |rate|, delays them by half the round trip
+// plus up to |jitter_ms|, and holds at most |queue_bytes| beyond what is in
+// flight; while that's full the proxy stops reading, so the sender sees
+// the backpressure a real bottleneck gives. All connections through one
+// proxy share the link, so parallel streams split its rate as they would
+// on a real network.
+//
+// The proxy relays a byte stream, so loss can't drop anything. A lost
+// segment is delivered one round trip late instead, as TCP's fast
+// retransmit would, and everything behind it waits. That head-of-line
+// stall is how loss looks to an app.
+struct Impairment {
+  std::string name;
+  uint64_t rate = 0;       // Bytes per second each way; 0 is unlimited.
+  uint32_t rtt_ms = 0;
+  uint32_t jitter_ms = 0;  // Extra one-way delay, uniform in [0, jitter].
+  double loss = 0;         // Per 1448-byte segment.
+  size_t queue_bytes = 256 * 1024;
+};
+
+// The profiles the transfer suite runs, from none to a congested hotspot.
+const std::vector<Impairment>& ImpairmentProfiles();
+// A profile by name, or "rate_mbit,rtt_ms,jitter_ms,loss_pct". False if
+// |spec| is neither.
+bool ParseImpairment(const std::string& spec, Impairment* out);
+
+class ImpairmentProxy {
+ public:
+  // Relays connections to |host|:|port| once started.
+  ImpairmentProxy(const Impairment& impairment, std::string host,
+                  uint16_t port);
+  // Cuts every connection.
+  ~ImpairmentProxy();
+
+  ImpairmentProxy(const ImpairmentProxy&) = delete;
+  ImpairmentProxy& operator=(const ImpairmentProxy&) = delete;
+
+  // Listens on |listen_port| of every interface, or a free loopback port
+  // when it's 0. False if that can't be bound.
+  bool Start(uint16_t listen_port = 0);
+  uint16_t port() const { return port_; }
+  // Segments delivered late as if lost, in both directions.
+  uint64_t lost() const { return lost_.load(); }
+
+ private:
+  void Accept();
+  // Moves bytes from |from| to |to| through direction |dir| of the link
+  // (0 towards the client) until either side closes.
+  void Relay(int from, int to, int dir, uint64_t seed);
+
+  const Impairment impairment_;
+  const std::string host_;
+  const uint16_t upstream_port_;
+  int listen_ = -1;
+  uint16_t port_ = 0;
+  std::atomic<bool> stop_{false};
+  std::atomic<uint64_t> lost_{0};
+  // The link, per direction: when it's next free to serialise, and the
+  // bytes queued on it.
+  std::mutex link_mu_;
+  std::chrono::steady_clock::time_point link_free_[2];
+  std::atomic<size_t> queued_[2] = {{0}, {0}};
+  std::mutex mu_;
+  std::vector<int> sockets_;  // Every relayed socket, to cut them on stop.
+  int active_ = 0;            // Connections still being relayed.
+  std::thread accept_thread_;
+};
+
+}  // namespace bench
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_BENCH_IMPAIRMENT_PROXY_H_
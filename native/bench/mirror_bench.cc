@@ -0,0 +1,168 @@
+// Decoding mirrored frames: full size vs. scaled to the window, and what
+// the receiver drops when frames come faster than it decodes.
+//
+//   zapshare_bench mirror [frames] [width] [height]
+//
+// Encodes one synthetic screen (lines of text on a gradient and a photo) of
+// |width| x |height| (default 1080 x 2400, a phone in portrait) at quality
+// 85, as the Android mirror server does, then decodes it |frames| times
+// (default 60) through MirrorReceiver, waiting for each:
+//
+//   full       target 0: every pixel, as Image.memory decodes it
+//   window     the frame letterboxed into a 1280 x 720 window
+//   thumbnail  the same into 640 x 360, a viewer not in full screen
+//
+// and reports decode_ms per frame and the output size. "burst" then
+// submits all |frames| at once, as a stalled connection delivers them,
+// and reports how many were decoded and how many dropped unseen.
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "mirror_receiver.h"
+
+#if __has_include(<jpeglib.h>)
+#include <jpeglib.h>
+#define ZS_BENCH_HAVE_JPEG 1
+#endif
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+#if defined(ZS_BENCH_HAVE_JPEG)
+
+std::vector<uint8_t> Screen(int width, int height) {
+  const std::vector<uint8_t> noise =
+      RandomBytes(static_cast<size_t>(width) * height, 7);
+  std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t* p = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+      const uint8_t n = noise[static_cast<size_t>(y) * width + x];
+      if (y > height / 4 && y < height / 2) {
+        // A photo.
+        p[0] = static_cast<uint8_t>(x * 255 / width) / 2 + n / 4;
+        p[1] = static_cast<uint8_t>(y * 255 / height) / 2 + n / 8;
+        p[2] = 96 + n / 8;
+        continue;
+      }
+      // Lines of text on a gradient.
+      const bool text = (y / 24) % 3 == 1 && (x / 6) % 5 != 0 &&
+                        ((x * 7 + y * 3) / 11) % 4 != 0;
+      p[0] = text ? 30 : static_cast<uint8_t>(x * 255 / width);
+      p[1] = text ? 30 : static_cast<uint8_t>(y * 255 / height);
+      p[2] = text ? 40 : 200;
+    }
+  }
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr error;
+  cinfo.err = jpeg_std_error(&error);
+  jpeg_create_compress(&cinfo);
+  unsigned char* out = nullptr;
+  unsigned long size = 0;
+  jpeg_mem_dest(&cinfo, &out, &size);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 85, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = &rgb[static_cast<size_t>(cinfo.next_scanline) * width * 3];
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  std::vector<uint8_t> jpeg(out, out + size);
+  std::free(out);
+  return jpeg;
+}
+
+void WaitDone(const MirrorReceiver& receiver, uint64_t done) {
+  for (;;) {
+    const MirrorStats s = receiver.stats();
+    if (s.decoded + s.failed >= done && s.queue_depth == 0) return;
+    std::this_thread::yield();
+  }
+}
+
+void Sequential(const char* name, const std::vector<uint8_t>& jpeg,
+                int frames, int target_width, int target_height) {
+  MirrorReceiver receiver;
+  receiver.SetTargetSize(target_width, target_height);
+  const double start = NowSeconds();
+  for (int i = 0; i < frames; i++) {
+    receiver.Submit(jpeg.data(), jpeg.size());
+    WaitDone(receiver, i + 1);
+    receiver.AcquireFrame();
+  }
+  const double seconds = NowSeconds() - start;
+  const MirrorStats s = receiver.stats();
+  char extra[200];
+  std::snprintf(extra, sizeof(extra),
+                ",\"frames\":%d,\"decode_ms\":%.2f,\"max_decode_ms\":%.2f,"
+                "\"output\":\"%llux%llu\"",
+                frames, s.decode_ns / 1e6 / std::max<uint64_t>(s.decoded, 1),
+                s.max_decode_ns / 1e6,
+                static_cast<unsigned long long>(s.width),
+                static_cast<unsigned long long>(s.height));
+  Report("mirror", name, jpeg.size() * frames, seconds, extra);
+}
+
+void Burst(const std::vector<uint8_t>& jpeg, int frames) {
+  MirrorReceiver receiver;
+  receiver.SetTargetSize(1280, 720);
+  const double start = NowSeconds();
+  for (int i = 0; i < frames; i++) receiver.Submit(jpeg.data(), jpeg.size());
+  WaitDone(receiver, 1);
+  const double seconds = NowSeconds() - start;
+  const MirrorStats s = receiver.stats();
+  char extra[200];
+  std::snprintf(extra, sizeof(extra),
+                ",\"frames\":%d,\"decoded\":%llu,\"dropped\":%llu,"
+                "\"max_queue_depth\":%llu",
+                frames, static_cast<unsigned long long>(s.decoded),
+                static_cast<unsigned long long>(s.dropped),
+                static_cast<unsigned long long>(s.max_queue_depth));
+  Report("mirror", "burst", jpeg.size() * frames, seconds, extra);
+}
+
+#endif  // defined(ZS_BENCH_HAVE_JPEG)
+
+}  // namespace
+
+int RunMirrorBench(int argc, char** argv) {
+#if defined(ZS_BENCH_HAVE_JPEG)
+  if (!MirrorReceiver::Available()) {
+    std::fprintf(stderr, "mirror: built without libjpeg\n");
+    return 1;
+  }
+  const int frames = argc > 0 ? std::atoi(argv[0]) : 60;
+  const int width = argc > 1 ? std::atoi(argv[1]) : 1080;
+  const int height = argc > 2 ? std::atoi(argv[2]) : 2400;
+  if (frames <= 0 || width <= 0 || height <= 0) {
+    std::fprintf(stderr, "mirror: frames and size must be positive\n");
+    return 1;
+  }
+  const std::vector<uint8_t> jpeg = Screen(width, height);
+  Sequential("full", jpeg, frames, 0, 0);
+  Sequential("window", jpeg, frames, 1280, 720);
+  Sequential("thumbnail", jpeg, frames, 640, 360);
+  Burst(jpeg, frames);
+  return 0;
+#else
+  (void)argc;
+  (void)argv;
+  std::fprintf(stderr, "mirror: built without libjpeg\n");
+  return 1;
+#endif
+}
+
+}  // namespace bench
+}  // namespace zapshare
@@ -0,0 +1,167 @@
+// Splitting a screen mirror stream into frames: the viewer's old Dart
+// loop vs. MjpegDemuxer.
+//
+//   zapshare_bench mjpeg [capture] [chunk]
+//
+// Replays |capture|, a saved multipart/x-mixed-replace body (e.g. `curl
+// -s <the stream URL> > capture.mjpeg`), or if it's empty or not given
+// 300 synthetic frames of 60 to 180 KiB framed exactly as the Android
+// mirror server frames them, |chunk| bytes at a time (default 8192, about
+// what a socket read hands HttpClient on Wi-Fi).
+//
+//   rescan   the old loop, in C++: append the chunk to one buffer, look
+//            for SOI and then EOI from the start of it, copy the frame
+//            out twice (sublist, Uint8List.fromList) and the rest of the
+//            buffer once (sublist), on every frame
+//   demuxer  MjpegDemuxer: each byte copied into the buffer once, frames
+//            handed out in place
+//
+// allocs_per_frame counts buffer growth and copies made. The rescan case
+// understates the Dart original, whose List<int> holds 8 bytes per byte.
+// The viewer still copies a frame it decides to show, once.
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "mjpeg_demuxer.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+std::vector<uint8_t> SyntheticStream() {
+  std::vector<uint8_t> stream;
+  for (int i = 0; i < 300; i++) {
+    const size_t size = (60 + (i * 37) % 120) * 1024;
+    std::vector<uint8_t> jpeg = RandomBytes(size, i + 1);
+    // No markers inside but the ones at the ends, as in real scan data,
+    // where every FF is followed by 00.
+    std::replace(jpeg.begin(), jpeg.end(), uint8_t{0xFF}, uint8_t{0xFE});
+    jpeg[0] = 0xFF;
+    jpeg[1] = 0xD8;
+    jpeg[size - 2] = 0xFF;
+    jpeg[size - 1] = 0xD9;
+    const std::string header =
+        "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " +
+        std::to_string(size) + "\r\n\r\n";
+    stream.insert(stream.end(), header.begin(), header.end());
+    stream.insert(stream.end(), jpeg.begin(), jpeg.end());
+    stream.push_back('\r');
+    stream.push_back('\n');
+  }
+  return stream;
+}
+
+struct Result {
+  double seconds = 0;
+  uint64_t frames = 0;
+  uint64_t frame_bytes = 0;
+  uint64_t allocations = 0;
+};
+
+long FindMarker(const std::vector<uint8_t>& data, uint8_t b1, uint8_t b2,
+                size_t start) {
+  for (size_t i = start; i + 1 < data.size(); i++) {
+    if (data[i] == b1 && data[i + 1] == b2) return static_cast<long>(i);
+  }
+  return -1;
+}
+
+Result Rescan(const std::vector<uint8_t>& stream, size_t chunk) {
+  Result r;
+  std::vector<uint8_t> buffer;
+  const double start = NowSeconds();
+  for (size_t at = 0; at < stream.size(); at += chunk) {
+    const size_t n = std::min(chunk, stream.size() - at);
+    const size_t capacity = buffer.capacity();
+    buffer.insert(buffer.end(), stream.begin() + at,
+                  stream.begin() + at + n);
+    if (buffer.capacity() != capacity) r.allocations++;
+    for (;;) {
+      const long soi = FindMarker(buffer, 0xFF, 0xD8, 0);
+      if (soi < 0) break;
+      const long eoi = FindMarker(buffer, 0xFF, 0xD9, soi + 2);
+      if (eoi < 0) break;
+      const size_t end = eoi + 2;
+      std::vector<uint8_t> sub(buffer.begin() + soi, buffer.begin() + end);
+      std::vector<uint8_t> frame(sub);
+      r.frames++;
+      r.frame_bytes += frame.size();
+      buffer = std::vector<uint8_t>(buffer.begin() + end, buffer.end());
+      r.allocations += 3;
+    }
+  }
+  r.seconds = NowSeconds() - start;
+  return r;
+}
+
+Result Demux(const std::vector<uint8_t>& stream, size_t chunk) {
+  Result r;
+  MjpegDemuxer demuxer;
+  const double start = NowSeconds();
+  for (size_t at = 0; at < stream.size(); at += chunk) {
+    demuxer.Feed(stream.data() + at, std::min(chunk, stream.size() - at));
+    MjpegFrame frame;
+    while (demuxer.Next(&frame)) {
+      r.frames++;
+      r.frame_bytes += frame.size;
+    }
+  }
+  r.seconds = NowSeconds() - start;
+  r.allocations = demuxer.stats().allocations;
+  return r;
+}
+
+void Print(const char* name, size_t chunk, uint64_t bytes, const Result& r) {
+  char extra[200];
+  std::snprintf(extra, sizeof(extra),
+                ",\"chunk\":%zu,\"frames\":%llu,\"frames_per_s\":%.0f,"
+                "\"allocs_per_frame\":%.3f",
+                chunk, static_cast<unsigned long long>(r.frames),
+                r.seconds > 0 ? r.frames / r.seconds : 0,
+                static_cast<double>(r.allocations) /
+                    std::max<uint64_t>(r.frames, 1));
+  Report("mjpeg", name, bytes, r.seconds, extra);
+}
+
+}  // namespace
+
+int RunMjpegBench(int argc, char** argv) {
+  std::vector<uint8_t> stream;
+  if (argc > 0 && argv[0][0] != '\0') {
+    std::ifstream in(argv[0], std::ios::binary);
+    if (!in) {
+      std::fprintf(stderr, "mjpeg: can't read %s\n", argv[0]);
+      return 1;
+    }
+    stream.assign(std::istreambuf_iterator<char>(in),
+                  std::istreambuf_iterator<char>());
+  } else {
+    stream = SyntheticStream();
+  }
+  const size_t chunk = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8192;
+  if (chunk == 0) {
+    std::fprintf(stderr, "mjpeg: chunk must be positive\n");
+    return 1;
+  }
+  const Result rescan = Rescan(stream, chunk);
+  const Result demux = Demux(stream, chunk);
+  if (rescan.frames != demux.frames ||
+      rescan.frame_bytes != demux.frame_bytes) {
+    std::fprintf(stderr, "mjpeg: rescan found %llu frames, demuxer %llu\n",
+                 static_cast<unsigned long long>(rescan.frames),
+                 static_cast<unsigned long long>(demux.frames));
+  }
+  Print("rescan", chunk, stream.size(), rescan);
+  Print("demuxer", chunk, stream.size(), demux);
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
@@ -0,0 +1,411 @@
+// Transfer protocol v1 (text, one file per connection) vs. v2 (binary
+// multiplexed streams) over real loopback sockets.
+//
+//   zapshare_bench mux [bulk_mb] [small_files] [small_kb]
+//
+// One server thread answers both versions on the same port, telling them
+// apart by the first byte like the app does.
+//
+// "bulk" moves one large file, which shows the cost of framing and flow
+// control. "small" fetches many small files: v1 pays a connect, GET, size
+// line and ACK for each, while v2 keeps 64 requests in flight on one
+// connection. "latency" asks for a small file while the bulk file is
+// transferring. v1 can only fetch it after the bulk file, but v2 requests it
+// at priority 0 and it overtakes the queued bulk data.
+
+#include "bench_util.h"
+
+#if defined(_WIN32)
+
+namespace zapshare {
+namespace bench {
+
+int RunMuxBench(int, char**) {
+  std::fprintf(stderr, "mux: loopback sockets are POSIX-only for now\n");
+  return 1;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#else
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "mux.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+constexpr size_t kIoChunk = 256 * 1024;
+constexpr uint32_t kPipelineDepth = 64;
+
+struct Files {
+  std::vector<uint8_t> data;          // Every file is a slice of this.
+  std::vector<std::pair<size_t, size_t>> slices;  // Offset, size.
+};
+
+void SetNoDelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+bool SendAll(int fd, const uint8_t* p, size_t len) {
+  while (len > 0) {
+    const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool SendLine(int fd, const std::string& line) {
+  return SendAll(fd, reinterpret_cast<const uint8_t*>(line.data()),
+                 line.size());
+}
+
+// Reads up to and including '\n', a byte at a time, the way a line reader
+// on an unbuffered socket would.
+bool ReadLine(int fd, std::string* line) {
+  line->clear();
+  char c;
+  while (recv(fd, &c, 1, 0) == 1) {
+    if (c == '\n') return true;
+    line->push_back(c);
+  }
+  return false;
+}
+
+bool RecvAll(int fd, uint8_t* p, size_t len) {
+  while (len > 0) {
+    const ssize_t n = recv(fd, p, std::min(len, kIoChunk), 0);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+int Connect(uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  SetNoDelay(fd);
+  return fd;
+}
+
+// v1: "GET n", a size line, the bytes, then the client's "ACK".
+void ServeV1(int fd, const Files& files, uint8_t first) {
+  std::string line;
+  if (!ReadLine(fd, &line)) return;
+  line.insert(line.begin(), static_cast<char>(first));
+  if (line.compare(0, 4, "GET ") != 0) return;
+  const size_t index = std::strtoul(line.c_str() + 4, nullptr, 10);
+  if (index >= files.slices.size()) return;
+  const auto [off, size] = files.slices[index];
+  if (!SendLine(fd, std::to_string(size) + "\n")) return;
+  if (!SendAll(fd, files.data.data() + off, size)) return;
+  ReadLine(fd, &line);
+}
+
+// Moves frames between |session| and |fd| until the peer closes or
+// |step| returns false. |step| runs after every wakeup to feed or drain
+// the session.
+template <typename Step>
+void Pump(int fd, MuxSession* session, Step step) {
+  std::vector<uint8_t> in(kIoChunk);
+  std::vector<uint8_t> out(kIoChunk);
+  size_t out_len = 0;
+  size_t out_pos = 0;
+  while (step()) {
+    if (out_pos == out_len && session->Pending() > 0) {
+      out_len = session->Read(out.data(), out.size());
+      out_pos = 0;
+    }
+    pollfd pfd{fd, POLLIN, 0};
+    if (out_pos < out_len) pfd.events |= POLLOUT;
+    if (poll(&pfd, 1, 1000) < 0) return;
+    if (pfd.revents & POLLOUT) {
+      const ssize_t n = send(fd, out.data() + out_pos, out_len - out_pos,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (n < 0) return;
+      out_pos += static_cast<size_t>(n);
+    }
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+      const ssize_t n = recv(fd, in.data(), in.size(), MSG_DONTWAIT);
+      if (n <= 0) return;
+      if (!session->Receive(in.data(), static_cast<size_t>(n))) return;
+    }
+  }
+}
+
+void ServeV2(int fd, const Files& files, uint8_t first) {
+  MuxSession session(MuxSession::Role::kServer);
+  if (!session.Receive(&first, 1)) return;
+  std::map<uint32_t, std::pair<size_t, size_t>> sending;  // Position, end.
+  MuxEvent e;
+  Pump(fd, &session, [&] {
+    while (session.NextEvent(&e)) {
+      if (e.type == MuxEventType::kRequest) {
+        if (e.a >= files.slices.size()) {
+          session.Reset(e.stream, MuxError::kNotFound);
+          continue;
+        }
+        const auto [off, size] = files.slices[e.a];
+        session.Respond(e.stream, size, nullptr, 0);
+        if (size == 0) {
+          session.End(e.stream);
+        } else {
+          sending[e.stream] = {off, off + size};
+        }
+      } else if (e.type == MuxEventType::kReset) {
+        sending.erase(e.stream);
+      }
+    }
+    for (auto it = sending.begin(); it != sending.end();) {
+      auto& [pos, end] = it->second;
+      pos += session.Write(it->first, files.data.data() + pos, end - pos);
+      if (pos < end) {
+        ++it;
+        continue;
+      }
+      session.End(it->first);
+      it = sending.erase(it);
+    }
+    return !session.failed();
+  });
+}
+
+class Server {
+ public:
+  explicit Server(const Files& files) : files_(files) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), len);
+    listen(listen_fd_, 64);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread([this] { Run(); });
+  }
+
+  ~Server() {
+    stop_ = true;
+    close(Connect(port_));  // Wakes accept().
+    thread_.join();
+    close(listen_fd_);
+  }
+
+  uint16_t port() const { return port_; }
+
+ private:
+  void Run() {
+    while (!stop_) {
+      const int fd = accept(listen_fd_, nullptr, nullptr);
+      if (fd < 0) continue;
+      SetNoDelay(fd);
+      uint8_t first;
+      if (!stop_ && recv(fd, &first, 1, 0) == 1) {
+        if (first == 'Z') {
+          ServeV2(fd, files_, first);
+        } else {
+          ServeV1(fd, files_, first);
+        }
+      }
+      close(fd);
+    }
+  }
+
+  const Files& files_;
+  int listen_fd_ = -1;
+  uint16_t port_ = 0;
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+// v1 client: a connection per file. Returns false on any error.
+bool FetchV1(uint16_t port, uint32_t index, std::vector<uint8_t>* buf) {
+  const int fd = Connect(port);
+  if (fd < 0) return false;
+  std::string line;
+  bool ok = SendLine(fd, "GET " + std::to_string(index) + "\n") &&
+            ReadLine(fd, &line);
+  if (ok) {
+    buf->resize(std::strtoull(line.c_str(), nullptr, 10));
+    ok = RecvAll(fd, buf->data(), buf->size()) && SendLine(fd, "ACK\n");
+  }
+  close(fd);
+  return ok;
+}
+
+// v2 client: fetches |indices| over one connection with up to
+// kPipelineDepth requests in flight. |priority_of| picks each request's
+// priority and |on_end| sees each finished stream's index.
+template <typename Priority, typename OnEnd>
+bool FetchV2(uint16_t port, const std::vector<uint32_t>& indices,
+             Priority priority_of, OnEnd on_end) {
+  const int fd = Connect(port);
+  if (fd < 0) return false;
+  MuxSession session(MuxSession::Role::kClient);
+  std::map<uint32_t, uint32_t> index_of;
+  size_t next = 0;
+  size_t done = 0;
+  bool ok = true;
+  MuxEvent e;
+  Pump(fd, &session, [&] {
+    while (next < indices.size() && index_of.size() < kPipelineDepth) {
+      const uint32_t index = indices[next];
+      const uint32_t stream =
+          session.Request(index, 0, kMuxToEnd, priority_of(index));
+      if (stream == 0) break;
+      index_of[stream] = index;
+      next++;
+    }
+    while (session.NextEvent(&e)) {
+      if (e.type == MuxEventType::kData) {
+        session.Consumed(e.stream, e.data.size());
+      } else if (e.type == MuxEventType::kEnd) {
+        on_end(index_of[e.stream]);
+        index_of.erase(e.stream);
+        done++;
+      } else if (e.type == MuxEventType::kReset ||
+                 e.type == MuxEventType::kGoAway) {
+        ok = false;
+      }
+    }
+    return ok && done < indices.size() && !session.failed();
+  });
+  close(fd);
+  return ok && done == indices.size();
+}
+
+}  // namespace
+
+int RunMuxBench(int argc, char** argv) {
+  size_t bulk_mb = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 256;
+  uint32_t small_files = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+  size_t small_kb = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+  if (bulk_mb == 0) bulk_mb = 256;
+  if (small_files == 0) small_files = 2000;
+  if (small_kb == 0) small_kb = 16;
+  const size_t bulk = bulk_mb * 1024 * 1024;
+  const size_t small = small_kb * 1024;
+
+  // Index 0 is the bulk file, the rest are small files.
+  Files files;
+  files.data = RandomBytes(bulk + small, 1);
+  files.slices.push_back({0, bulk});
+  for (uint32_t i = 0; i < small_files; i++) {
+    files.slices.push_back({(i * 4099) % bulk, small});
+  }
+  Server server(files);
+  std::vector<uint8_t> buf;
+  char extra[128];
+
+  // Bulk throughput.
+  double start = NowSeconds();
+  bool ok = FetchV1(server.port(), 0, &buf);
+  double seconds = NowSeconds() - start;
+  if (!ok) {
+    std::fprintf(stderr, "mux: v1 bulk fetch failed\n");
+    return 1;
+  }
+  Report("mux", "bulk_v1", bulk, seconds);
+  start = NowSeconds();
+  ok = FetchV2(server.port(), {0}, [](uint32_t) { return kMuxDefaultPriority; },
+               [](uint32_t) {});
+  seconds = NowSeconds() - start;
+  if (!ok) {
+    std::fprintf(stderr, "mux: v2 bulk fetch failed\n");
+    return 1;
+  }
+  Report("mux", "bulk_v2", bulk, seconds);
+
+  // Many small files.
+  std::vector<uint32_t> smalls;
+  for (uint32_t i = 1; i <= small_files; i++) smalls.push_back(i);
+  const uint64_t small_bytes = static_cast<uint64_t>(small_files) * small;
+  start = NowSeconds();
+  for (uint32_t index : smalls) {
+    if (!FetchV1(server.port(), index, &buf)) {
+      std::fprintf(stderr, "mux: v1 small fetch %u failed\n", index);
+      return 1;
+    }
+  }
+  seconds = NowSeconds() - start;
+  std::snprintf(extra, sizeof(extra), ",\"files\":%u,\"files_per_s\":%.0f",
+                small_files, small_files / seconds);
+  Report("mux", "small_v1", small_bytes, seconds, extra);
+  start = NowSeconds();
+  ok = FetchV2(server.port(), smalls,
+               [](uint32_t) { return kMuxDefaultPriority; }, [](uint32_t) {});
+  seconds = NowSeconds() - start;
+  if (!ok) {
+    std::fprintf(stderr, "mux: v2 small fetch failed\n");
+    return 1;
+  }
+  std::snprintf(extra, sizeof(extra), ",\"files\":%u,\"files_per_s\":%.0f",
+                small_files, small_files / seconds);
+  Report("mux", "small_v2", small_bytes, seconds, extra);
+
+  // A small file wanted while the bulk file is on its way. v1 has one file
+  // per connection in the app's queue, so it comes after the bulk file.
+  start = NowSeconds();
+  ok = FetchV1(server.port(), 0, &buf) && FetchV1(server.port(), 1, &buf);
+  seconds = NowSeconds() - start;
+  if (!ok) {
+    std::fprintf(stderr, "mux: v1 latency fetch failed\n");
+    return 1;
+  }
+  std::snprintf(extra, sizeof(extra), ",\"small_latency_ms\":%.2f",
+                seconds * 1000);
+  Report("mux", "latency_v1", bulk + small, seconds, extra);
+  double small_done = -1;
+  start = NowSeconds();
+  ok = FetchV2(
+      server.port(), {0, 1},
+      [](uint32_t index) { return index == 0 ? kMuxLowestPriority : 0; },
+      [&](uint32_t index) {
+        if (index == 1) small_done = NowSeconds() - start;
+      });
+  seconds = NowSeconds() - start;
+  if (!ok || small_done < 0) {
+    std::fprintf(stderr, "mux: v2 latency fetch failed\n");
+    return 1;
+  }
+  std::snprintf(extra, sizeof(extra), ",\"small_latency_ms\":%.2f",
+                small_done * 1000);
+  Report("mux", "latency_v2", bulk + small, seconds, extra);
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#endif  // defined(_WIN32)
@@ -0,0 +1,149 @@
+// The discovery peer table: FlatIndex and TimerWheel vs. a hash map swept.
+//
+//   zapshare_bench peer_table [peers]
+//
+// Simulates |peers| synthetic peers (100 to 100k by default) that each
+// beacon every 8 s and are kept for 30 s, over two simulated minutes
+// ticked once a second, as the discovery engine expires peers. Every
+// fourth peer goes quiet halfway through, to be expired.
+// "flat_wheel" looks peers up in a FlatIndex and expires them on a
+// TimerWheel, re-arming a timer only when it fires; "map_sweep" keeps
+// them in std::unordered_map and checks every one of them each tick, as
+// the app and the engine used to. ns_per_beacon covers a beacon's lookup
+// and its share of expiry; ns_per_tick is the expiry alone, and
+// ns_per_peer_tick that divided by the peers.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bench_util.h"
+#include "peer_table.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+constexpr uint64_t kBeaconEveryMs = 8000;
+constexpr uint64_t kTtlMs = 30000;
+constexpr uint64_t kTickMs = 1000;
+constexpr uint64_t kRunMs = 120000;
+
+struct Result {
+  double seconds = 0;
+  double expiry_seconds = 0;
+  uint64_t beacons = 0;
+  uint64_t ticks = 0;
+  size_t left = 0;
+};
+
+uint64_t PeerId(size_t i) { return (i + 1) * 0x9E3779B97F4A7C15ull; }
+
+// Peer |i| beacons at |i| * every / n into each period.
+template <typename Beacon, typename Tick>
+Result Simulate(size_t n, Beacon&& beacon, Tick&& tick) {
+  Result r;
+  const double start = NowSeconds();
+  for (uint64_t now = 0; now < kRunMs; now += kTickMs) {
+    const size_t from = static_cast<size_t>(now % kBeaconEveryMs * n /
+                                            kBeaconEveryMs);
+    const size_t to = static_cast<size_t>(
+        ((now % kBeaconEveryMs) + kTickMs) * n / kBeaconEveryMs);
+    for (size_t i = from; i < std::min(to, n); i++) {
+      if (i % 4 == 0 && now >= kRunMs / 2) continue;
+      beacon(PeerId(i), now);
+      r.beacons++;
+    }
+    const double expiry_start = NowSeconds();
+    r.left = tick(now);
+    r.expiry_seconds += NowSeconds() - expiry_start;
+    r.ticks++;
+  }
+  r.seconds = NowSeconds() - start;
+  return r;
+}
+
+Result FlatWheel(size_t n) {
+  struct Peer {
+    uint64_t id;
+    uint64_t seen_ms;
+  };
+  FlatIndex index;
+  std::vector<Peer> peers;
+  std::vector<uint32_t> free;
+  TimerWheel expiry(kTickMs, 0);
+  return Simulate(
+      n,
+      [&](uint64_t id, uint64_t now) {
+        uint32_t slot = index.Find(id);
+        if (slot != FlatIndex::kNone) {
+          peers[slot].seen_ms = now;
+          return;
+        }
+        if (free.empty()) {
+          slot = static_cast<uint32_t>(peers.size());
+          peers.push_back({id, now});
+        } else {
+          slot = free.back();
+          free.pop_back();
+          peers[slot] = {id, now};
+        }
+        index.Insert(id, slot);
+        expiry.Schedule(slot, now + kTtlMs);
+      },
+      [&](uint64_t now) {
+        expiry.Advance(now, [&](uint32_t slot) {
+          const uint64_t due = peers[slot].seen_ms + kTtlMs;
+          if (due > now) {
+            expiry.Schedule(slot, due);
+          } else {
+            index.Erase(peers[slot].id);
+            free.push_back(slot);
+          }
+        });
+        return index.size();
+      });
+}
+
+Result MapSweep(size_t n) {
+  std::unordered_map<uint64_t, uint64_t> seen;
+  return Simulate(
+      n, [&](uint64_t id, uint64_t now) { seen[id] = now; },
+      [&](uint64_t now) {
+        for (auto it = seen.begin(); it != seen.end();) {
+          it = now - it->second >= kTtlMs ? seen.erase(it) : std::next(it);
+        }
+        return seen.size();
+      });
+}
+
+void Print(const std::string& name, size_t n, const Result& r) {
+  const double ns_per_tick =
+      r.expiry_seconds * 1e9 / std::max<uint64_t>(r.ticks, 1);
+  char extra[200];
+  std::snprintf(extra, sizeof(extra),
+                ",\"peers\":%zu,\"ns_per_beacon\":%.1f,\"ns_per_tick\":%.0f,"
+                "\"ns_per_peer_tick\":%.2f,\"left\":%zu",
+                n, r.seconds * 1e9 / std::max<uint64_t>(r.beacons, 1),
+                ns_per_tick, ns_per_tick / std::max<size_t>(n, 1), r.left);
+  Report("peer_table", name + "_" + std::to_string(n), 0, r.seconds, extra);
+}
+
+}  // namespace
+
+int RunPeerTableBench(int argc, char** argv) {
+  std::vector<size_t> sizes = {100, 1000, 10000, 100000};
+  if (argc > 0) sizes = {std::strtoul(argv[0], nullptr, 10)};
+  for (const size_t n : sizes) {
+    Print("flat_wheel", n, FlatWheel(n));
+    Print("map_sweep", n, MapSweep(n));
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
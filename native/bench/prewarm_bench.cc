@@ -0,0 +1,379 @@
+// Accepting a share from a cold start vs. from pre-warmed connections.
+//
+//   zapshare_bench prewarm [profiles] [rounds]
+//
+// A built-in sender serves a file list over the v1 protocol (LIST on
+// port + 1) and a 1 MiB file over HTTP, both behind ImpairmentProxies
+// running each of |profiles| (default ethernet,wifi,hotspot). Each round
+// measures the moment a user accepts a share until its first byte lands:
+//
+//   cold  connect to port + 1, LIST, read the JSON; then a RangeReceiver
+//         connects and sends its GET, as the receive screen does today
+//   warm  a ConnectionPool was warmed with the list when the share
+//         request arrived; the list is already there and the
+//         RangeReceiver takes a connection from the pool
+//
+// ttfb_ms is the median of |rounds| (default 5) over the whole of that,
+// list_ms of getting the list alone. Cold pays for two connects and two
+// requests before the first byte, warm for the one request.
+
+#include "bench_util.h"
+
+#if defined(_WIN32)
+
+namespace zapshare {
+namespace bench {
+
+int RunPrewarmBench(int, char**) {
+  std::fprintf(stderr, "prewarm: loopback sockets are POSIX-only for now\n");
+  return 1;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#else
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "connection_pool.h"
+#include "impairment_proxy.h"
+#include "range_receiver.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+constexpr char kHost[] = "127.0.0.1";
+constexpr size_t kFileSize = 1024 * 1024;
+constexpr double kTimeoutSeconds = 30;
+
+bool SendAll(int fd, const void* data, size_t len) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (len > 0) {
+    const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+int Listen(uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, 64) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+uint16_t LocalPort(int fd) {
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+int Connect(uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// The list and the file, as the app serves them.
+class Sender {
+ public:
+  explicit Sender(const std::vector<uint8_t>& data) : data_(data) {
+    list_ = "[{\"fileName\":\"bench.bin\",\"fileSize\":" +
+            std::to_string(data.size()) + ",\"fileIndex\":0}]\n";
+  }
+
+  ~Sender() {
+    for (const int fd : {http_, tcp_}) {
+      if (fd < 0) continue;
+      shutdown(fd, SHUT_RDWR);
+      close(fd);
+    }
+    for (std::thread& t : threads_) t.join();
+    std::lock_guard<std::mutex> lock(mu_);
+    for (std::thread& t : connections_) t.join();
+  }
+
+  bool Start() {
+    for (int attempt = 0; attempt < 20 && tcp_ < 0; attempt++) {
+      if (http_ >= 0) close(http_);
+      http_ = Listen(0);
+      if (http_ < 0) return false;
+      tcp_ = Listen(static_cast<uint16_t>(LocalPort(http_) + 1));
+    }
+    if (tcp_ < 0) return false;
+    threads_.emplace_back(&Sender::Accept, this, http_, true);
+    threads_.emplace_back(&Sender::Accept, this, tcp_, false);
+    return true;
+  }
+
+  uint16_t port() const { return LocalPort(http_); }
+
+ private:
+  void Accept(int listen_fd, bool http) {
+    for (;;) {
+      const int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) return;
+      std::lock_guard<std::mutex> lock(mu_);
+      connections_.emplace_back([this, fd, http] {
+        if (http) {
+          ServeHttp(fd);
+        } else {
+          ServeList(fd);
+        }
+        close(fd);
+      });
+    }
+  }
+
+  // Only ranged GETs of /file/0 come here.
+  void ServeHttp(int fd) {
+    std::string req;
+    char buf[2048];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+      const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0) return;
+      req.append(buf, static_cast<size_t>(n));
+    }
+    const size_t range = req.find("Range: bytes=");
+    if (range == std::string::npos) return;
+    const uint64_t start = std::strtoull(req.c_str() + range + 13, nullptr,
+                                         10);
+    const uint64_t end = std::min<uint64_t>(
+        data_.size(), std::strtoull(req.c_str() + req.find('-', range) + 1,
+                                    nullptr, 10) + 1);
+    const std::string head = "HTTP/1.1 206 Partial Content\r\n"
+                             "content-length: " +
+                             std::to_string(end - start) + "\r\n\r\n";
+    if (SendAll(fd, head.data(), head.size())) {
+      SendAll(fd, data_.data() + start, end - start);
+    }
+  }
+
+  void ServeList(int fd) {
+    std::string command;
+    char c;
+    while (command.size() < 16 && recv(fd, &c, 1, 0) == 1 && c != '\n') {
+      command += c;
+    }
+    if (command == "LIST") SendAll(fd, list_.data(), list_.size());
+  }
+
+  const std::vector<uint8_t>& data_;
+  std::string list_;
+  int http_ = -1;
+  int tcp_ = -1;
+  std::mutex mu_;
+  std::vector<std::thread> connections_;
+  std::vector<std::thread> threads_;
+};
+
+// Proxies for both of |sender|'s ports, on two ports that follow each
+// other as well.
+struct Link {
+  std::unique_ptr<ImpairmentProxy> http;
+  std::unique_ptr<ImpairmentProxy> tcp;
+};
+
+bool Impair(const Impairment& impairment, uint16_t port, Link* link) {
+  for (int attempt = 0; attempt < 20; attempt++) {
+    link->http.reset(new ImpairmentProxy(impairment, kHost, port));
+    link->tcp.reset(new ImpairmentProxy(impairment, kHost, port + 1));
+    if (link->http->Start() &&
+        link->tcp->Start(static_cast<uint16_t>(link->http->port() + 1))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The list the way the receive screen fetches it.
+bool FetchList(uint16_t port, std::string* out) {
+  const int fd = Connect(static_cast<uint16_t>(port + 1));
+  if (fd < 0) return false;
+  out->clear();
+  bool ok = SendAll(fd, "LIST\n", 5);
+  char buf[4096];
+  while (ok && out->find('\n') == std::string::npos) {
+    const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) ok = false;
+    if (n > 0) out->append(buf, static_cast<size_t>(n));
+  }
+  close(fd);
+  return ok;
+}
+
+struct Round {
+  double list_s = 0;
+  double ttfb_s = 0;
+  bool ok = false;
+};
+
+// From accepting the share to the first byte of its first piece.
+Round Accept(uint16_t port, ConnectionPool* pool, const std::string& path) {
+  Round r;
+  const double start = NowSeconds();
+  std::string list;
+  const bool listed = pool != nullptr ? pool->Listing(kHost, port, &list)
+                                      : FetchList(port, &list);
+  r.list_s = NowSeconds() - start;
+  if (!listed) return r;
+
+  ReceiveRequest request;
+  request.host = kHost;
+  request.port = port;
+  request.target = "/file/0";
+  request.end = kFileSize;
+  request.path = path;
+  request.sync_every = 0;
+  request.pool = pool;
+  auto receiver = RangeReceiver::Start(request);
+  if (receiver == nullptr) return r;
+  while (receiver->stats().received == 0 &&
+         receiver->state() == ReceiveState::kRunning &&
+         NowSeconds() - start < kTimeoutSeconds) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  r.ttfb_s = NowSeconds() - start;
+  while (receiver->state() == ReceiveState::kRunning) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  r.ok = receiver->state() == ReceiveState::kDone &&
+         (pool == nullptr || receiver->stats().warm);
+  return r;
+}
+
+double Median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  return v.empty() ? 0 : v[v.size() / 2];
+}
+
+std::vector<std::string> Split(const std::string& s) {
+  std::vector<std::string> out;
+  size_t start = 0;
+  while (start <= s.size()) {
+    size_t comma = s.find(',', start);
+    if (comma == std::string::npos) comma = s.size();
+    if (comma > start) out.push_back(s.substr(start, comma - start));
+    start = comma + 1;
+  }
+  return out;
+}
+
+void RunProfile(const Impairment& impairment, uint16_t sender_port,
+                int rounds, const std::string& path) {
+  Link link;
+  if (!Impair(impairment, sender_port, &link)) {
+    std::fprintf(stderr, "prewarm: no proxy ports for %s\n",
+                 impairment.name.c_str());
+    return;
+  }
+  const uint16_t port = link.http->port();
+  for (const bool warm : {false, true}) {
+    std::vector<double> list_s;
+    std::vector<double> ttfb_s;
+    double total = 0;
+    int failed = 0;
+    for (int i = 0; i < rounds; i++) {
+      std::unique_ptr<ConnectionPool> pool;
+      if (warm) {
+        // The share request arrived; the user reads it and taps accept.
+        ConnectionPoolConfig config;
+        config.per_peer = 1;
+        pool = ConnectionPool::Start(config);
+        pool->Warm(kHost, port, true);
+        std::string list;
+        const double until = NowSeconds() + kTimeoutSeconds;
+        while ((!pool->Listing(kHost, port, &list) ||
+                pool->stats().ready == 0) &&
+               NowSeconds() < until) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+      const Round r = Accept(port, pool.get(), path);
+      if (!r.ok) {
+        failed++;
+        continue;
+      }
+      list_s.push_back(r.list_s);
+      ttfb_s.push_back(r.ttfb_s);
+      total += r.ttfb_s;
+    }
+    const std::string extra =
+        ",\"rtt_ms\":" + std::to_string(impairment.rtt_ms) +
+        ",\"list_ms\":" + std::to_string(Median(list_s) * 1e3) +
+        ",\"ttfb_ms\":" + std::to_string(Median(ttfb_s) * 1e3) +
+        ",\"failed\":" + std::to_string(failed);
+    Report("prewarm", std::string(warm ? "warm" : "cold") + "/" +
+                          impairment.name,
+           0, total, extra);
+  }
+}
+
+}  // namespace
+
+int RunPrewarmBench(int argc, char** argv) {
+  std::vector<Impairment> profiles;
+  for (const std::string& spec :
+       Split(argc > 0 ? argv[0] : "ethernet,wifi,hotspot")) {
+    Impairment p;
+    if (!ParseImpairment(spec, &p)) {
+      std::fprintf(stderr, "prewarm: unknown profile %s\n", spec.c_str());
+      return 2;
+    }
+    profiles.push_back(p);
+  }
+  const int rounds = argc > 1 ? std::max(1, std::atoi(argv[1])) : 5;
+
+  const std::vector<uint8_t> data = RandomBytes(kFileSize, 45);
+  Sender sender(data);
+  if (!sender.Start()) {
+    std::fprintf(stderr, "prewarm: can't listen on loopback\n");
+    return 1;
+  }
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "zapshare_prewarm.bin")
+          .string();
+  for (const Impairment& p : profiles) {
+    RunProfile(p, sender.port(), rounds, path);
+  }
+  std::filesystem::remove(path);
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#endif  // defined(_WIN32)
@@ -0,0 +1,245 @@
+// Receiver CPU per gigabyte: the Dart-style copy loop vs. RangeReceiver.
+//
+//   zapshare_bench range_receiver [file_mb]
+//
+// A loopback server answers one GET with |file_mb| of body. "dart_like"
+// stands in for the app's download loop: 64 KiB reads, one more copy for
+// the trip through the Dart heap, then a write at the offset. "copy" is a
+// RangeReceiver on its buffered path and "splice" on its zero-copy one.
+// Every case syncs once at the end, so cpu_ms_per_gb compares only how
+// the bytes get from the socket to the file.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "range_receiver.h"
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace bench {
+
+#if defined(_WIN32)
+
+int RunRangeReceiverBench(int, char**) {
+  std::fprintf(stderr, "range_receiver: not available on Windows\n");
+  return 0;
+}
+
+#else
+
+namespace {
+
+constexpr size_t kChunk = 1024 * 1024;
+
+uint64_t ThreadCpuNs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+// Answers a single GET with |size| bytes of |chunk| repeated.
+class OneShotServer {
+ public:
+  OneShotServer(const std::vector<uint8_t>& chunk, uint64_t size)
+      : chunk_(chunk), size_(size) {
+    listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(listen_, reinterpret_cast<sockaddr*>(&addr), len);
+    listen(listen_, 1);
+    getsockname(listen_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread(&OneShotServer::Serve, this);
+  }
+
+  ~OneShotServer() {
+    shutdown(listen_, SHUT_RDWR);
+    close(listen_);
+    thread_.join();
+  }
+
+  uint16_t port() const { return port_; }
+
+ private:
+  void Serve() {
+    const int fd = accept(listen_, nullptr, nullptr);
+    if (fd < 0) return;
+    std::string req;
+    char buf[1024];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+      const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0) {
+        close(fd);
+        return;
+      }
+      req.append(buf, static_cast<size_t>(n));
+    }
+    const std::string head = "HTTP/1.1 200 OK\r\ncontent-length: " +
+                             std::to_string(size_) + "\r\n\r\n";
+    bool ok = Send(fd, head.data(), head.size());
+    for (uint64_t sent = 0; ok && sent < size_;) {
+      const size_t n =
+          static_cast<size_t>(std::min<uint64_t>(chunk_.size(), size_ - sent));
+      ok = Send(fd, chunk_.data(), n);
+      sent += n;
+    }
+    close(fd);
+  }
+
+  static bool Send(int fd, const void* p, size_t len) {
+    const char* c = static_cast<const char*>(p);
+    while (len > 0) {
+      const ssize_t n = send(fd, c, len, MSG_NOSIGNAL);
+      if (n <= 0) return false;
+      c += n;
+      len -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  const std::vector<uint8_t>& chunk_;
+  const uint64_t size_;
+  int listen_;
+  uint16_t port_;
+  std::thread thread_;
+};
+
+void ReportCpu(const std::string& name, uint64_t size, double seconds,
+               uint64_t cpu_ns) {
+  char extra[64];
+  std::snprintf(extra, sizeof(extra), ",\"cpu_ms_per_gb\":%.1f",
+                cpu_ns / 1e6 / (size / 1e9));
+  Report("range_receiver", name, size, seconds, extra);
+}
+
+void DartLike(const std::vector<uint8_t>& chunk, uint64_t size,
+              const std::string& path) {
+  OneShotServer server(chunk, size);
+  const double start = NowSeconds();
+  const uint64_t cpu_start = ThreadCpuNs();
+  const int sock = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(server.port());
+  if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(sock);
+    return;
+  }
+  const std::string req = "GET /file/0 HTTP/1.1\r\n\r\n";
+  send(sock, req.data(), req.size(), MSG_NOSIGNAL);
+  const int file = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+  std::vector<uint8_t> socket_buf(64 * 1024);
+  std::string head;
+  uint64_t offset = 0;
+  bool in_body = false;
+  for (;;) {
+    const ssize_t n = recv(sock, socket_buf.data(), socket_buf.size(), 0);
+    if (n <= 0) break;
+    const uint8_t* p = socket_buf.data();
+    size_t len = static_cast<size_t>(n);
+    if (!in_body) {
+      head.append(reinterpret_cast<const char*>(p), len);
+      const size_t end = head.find("\r\n\r\n");
+      if (end == std::string::npos) continue;
+      in_body = true;
+      const size_t skip = len - (head.size() - end - 4);
+      p += skip;
+      len -= skip;
+    }
+    // The hand-off into the Dart heap.
+    std::vector<uint8_t> dart(p, p + len);
+    if (pwrite(file, dart.data(), dart.size(), static_cast<off_t>(offset)) !=
+        static_cast<ssize_t>(dart.size())) {
+      break;
+    }
+    offset += len;
+  }
+  fdatasync(file);
+  close(file);
+  close(sock);
+  const uint64_t cpu_ns = ThreadCpuNs() - cpu_start;
+  const double seconds = NowSeconds() - start;
+  if (offset != size) {
+    std::fprintf(stderr, "range_receiver: dart_like got %llu bytes\n",
+                 static_cast<unsigned long long>(offset));
+    return;
+  }
+  ReportCpu("dart_like", size, seconds, cpu_ns);
+}
+
+void Native(const std::vector<uint8_t>& chunk, uint64_t size,
+            const std::string& path, bool zero_copy) {
+  OneShotServer server(chunk, size);
+  ReceiveRequest r;
+  r.host = "127.0.0.1";
+  r.port = server.port();
+  r.target = "/file/0";
+  r.end = size;
+  r.ranged = false;
+  r.path = path;
+  r.sync_every = 0;
+  r.zero_copy = zero_copy;
+  const double start = NowSeconds();
+  std::unique_ptr<RangeReceiver> receiver = RangeReceiver::Start(r);
+  if (receiver == nullptr) return;
+  while (receiver->state() == ReceiveState::kRunning) {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  const double seconds = NowSeconds() - start;
+  if (receiver->state() != ReceiveState::kDone) {
+    std::fprintf(stderr, "range_receiver: failed with %d\n",
+                 static_cast<int>(receiver->error()));
+    return;
+  }
+  const ReceiveStats s = receiver->stats();
+  if (zero_copy && !s.spliced) {
+    std::fprintf(stderr, "range_receiver: splice unsupported here\n");
+  }
+  ReportCpu(zero_copy ? "splice" : "copy", size, seconds, s.cpu_ns);
+}
+
+}  // namespace
+
+int RunRangeReceiverBench(int argc, char** argv) {
+  const size_t file_mb = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 256;
+  const uint64_t size = uint64_t{file_mb} * 1024 * 1024;
+  const std::vector<uint8_t> chunk = RandomBytes(kChunk, 13);
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "zs_range_receiver_bench.bin")
+          .string();
+
+  for (int mode = 0; mode < 3; mode++) {
+    std::filesystem::remove(path);
+    PreallocateFile(path, size);
+    if (mode == 0) {
+      DartLike(chunk, size, path);
+    } else {
+      Native(chunk, size, path, mode == 2);
+    }
+  }
+  std::filesystem::remove(path);
+  return 0;
+}
+
+#endif
+
+}  // namespace bench
+}  // namespace zapshare
@@ -0,0 +1,158 @@
+// Reading a file in turn with sending it vs. through a read-ahead queue.
+//
+//   zapshare_bench read_ahead [file_mb] [link_mbps]
+//
+// The "socket" is a paced sink: handing it a chunk takes as long as the
+// link would need for it, like the app's `add` + `flush`. "in_turn" reads a
+// chunk, sends it and only then reads the next, so it takes disk time plus
+// link time; "depth_N" reads through a ReadAhead of N buffers and should
+// take the larger of the two. The file is dropped from the page cache
+// before every case where the OS allows it.
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include "bench_util.h"
+#include "read_ahead.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+constexpr size_t kChunk = 1024 * 1024;
+
+// Returns from Send() once the link has carried the chunk; a link left
+// idle doesn't bank the time.
+class PacedSink {
+ public:
+  explicit PacedSink(double link_bytes_per_s) : rate_(link_bytes_per_s) {}
+
+  void Send(size_t len) {
+    const double now = NowSeconds();
+    due_ = std::max(due_, now) + len / rate_;
+    std::this_thread::sleep_for(std::chrono::duration<double>(due_ - now));
+  }
+
+ private:
+  const double rate_;
+  double due_ = 0;
+};
+
+void DropFromCache(const std::string& path) {
+#if defined(POSIX_FADV_DONTNEED)
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+#else
+  (void)path;
+#endif
+}
+
+void InTurn(const std::string& path, uint64_t size, double link) {
+  DropFromCache(path);
+  std::ifstream in(path, std::ios::binary);
+  std::vector<char> buf(kChunk);
+  const double start = NowSeconds();
+  PacedSink sink(link);
+  uint64_t total = 0;
+  while (in) {
+    in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    const size_t n = static_cast<size_t>(in.gcount());
+    if (n == 0) break;
+    sink.Send(n);
+    total += n;
+  }
+  const double seconds = NowSeconds() - start;
+  if (total != size) {
+    std::fprintf(stderr, "read_ahead: short read\n");
+    return;
+  }
+  Report("read_ahead", "in_turn", size, seconds);
+}
+
+void Pipelined(const std::string& path, uint64_t size, double link,
+               size_t depth) {
+  DropFromCache(path);
+  const double start = NowSeconds();
+  std::unique_ptr<ReadAhead> reader =
+      ReadAhead::Open(path, 0, UINT64_MAX, depth, kChunk);
+  if (reader == nullptr) return;
+  std::vector<uint8_t> buf(kChunk);
+  PacedSink sink(link);
+  uint64_t total = 0;
+  while (reader->position() < reader->end()) {
+    const int64_t n = reader->Read(buf.data(), buf.size());
+    if (n < 0) break;
+    if (n == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+    sink.Send(static_cast<size_t>(n));
+    total += static_cast<uint64_t>(n);
+  }
+  const double seconds = NowSeconds() - start;
+  if (total != size) {
+    std::fprintf(stderr, "read_ahead: short read\n");
+    return;
+  }
+
+  const ReadAheadStats s = reader->stats();
+  char extra[160];
+  std::snprintf(
+      extra, sizeof(extra),
+      ",\"avg_depth\":%.2f,\"consumer_stalls\":%llu,\"reader_stalls\":%llu",
+      s.depth_samples ? double(s.depth_sum) / s.depth_samples : 0.0,
+      static_cast<unsigned long long>(s.consumer_stalls),
+      static_cast<unsigned long long>(s.reader_stalls));
+  Report("read_ahead", "depth_" + std::to_string(depth), size, seconds,
+         extra);
+}
+
+}  // namespace
+
+int RunReadAheadBench(int argc, char** argv) {
+  const size_t file_mb = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 64;
+  const double link_mbps = argc > 1 ? std::strtod(argv[1], nullptr) : 400;
+  const double link = link_mbps * 1e6 / 8;
+
+  const uint64_t size = uint64_t{file_mb} * 1024 * 1024;
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "zs_read_ahead_bench.bin")
+          .string();
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    const std::vector<uint8_t> chunk = RandomBytes(1024 * 1024, 11);
+    for (size_t i = 0; i < file_mb; i++) {
+      out.write(reinterpret_cast<const char*>(chunk.data()),
+                static_cast<std::streamsize>(chunk.size()));
+    }
+  }
+#if !defined(_WIN32)
+  {
+    // Written pages must be clean before they can be dropped.
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      fsync(fd);
+      close(fd);
+    }
+  }
+#endif
+
+  InTurn(path, size, link);
+  for (size_t depth : {1, 2, 4, 8}) Pipelined(path, size, link, depth);
+  std::filesystem::remove(path);
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
@@ -0,0 +1,261 @@
+// Cost of the encrypted transport: raw cipher speed, the pairing
+// handshake, and a bulk transfer over loopback in cleartext vs. sealed
+// records.
+//
+//   zapshare_bench secure [bulk_mb] [record_kb]
+//
+// The loopback cases mirror the app's data path: the sender reads each
+// chunk into the record buffer behind the header and seals it where it
+// lies, and the receiver opens each record in the buffer it was received
+// into, so encryption adds no copies on either side.
+
+#include "bench_util.h"
+
+#if defined(_WIN32)
+
+namespace zapshare {
+namespace bench {
+
+int RunSecureBench(int, char**) {
+  std::fprintf(stderr, "secure: loopback sockets are POSIX-only for now\n");
+  return 1;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#else
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "aead.h"
+#include "secure_channel.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+const char* CipherName(AeadCipher cipher) {
+  return cipher == AeadCipher::kAes256Gcm ? "aes256gcm" : "chacha20poly1305";
+}
+
+bool SendAll(int fd, const uint8_t* p, size_t len) {
+  while (len > 0) {
+    const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool RecvAll(int fd, uint8_t* p, size_t len) {
+  while (len > 0) {
+    const ssize_t n = recv(fd, p, len, 0);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// A connected loopback TCP pair.
+bool LoopbackPair(int* a, int* b) {
+  const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  bool ok = bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), len) == 0 &&
+            listen(listen_fd, 1) == 0 &&
+            getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr),
+                        &len) == 0;
+  *a = socket(AF_INET, SOCK_STREAM, 0);
+  ok = ok &&
+       connect(*a, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+  *b = ok ? accept(listen_fd, nullptr, nullptr) : -1;
+  close(listen_fd);
+  return ok && *b >= 0;
+}
+
+// Runs the handshake between two in-memory channels.
+bool Handshake(SecureChannel* client, SecureChannel* server) {
+  std::vector<uint8_t> buf;
+  for (int round = 0; round < 2; round++) {
+    for (auto [from, to] : {std::pair{client, server},
+                            std::pair{server, client}}) {
+      buf.resize(from->Pending());
+      from->Read(buf.data(), buf.size());
+      to->Receive(buf.data(), buf.size());
+    }
+  }
+  return client->established() && server->established();
+}
+
+void BenchCipher(AeadCipher cipher, size_t total, size_t record) {
+  const std::vector<uint8_t> key = RandomBytes(kAeadKeySize, 1);
+  Aead aead;
+  aead.Init(cipher, key.data());
+  std::vector<uint8_t> data = RandomBytes(record, 2);
+  uint8_t nonce[kAeadNonceSize] = {};
+  uint8_t header[4] = {};
+  uint8_t tag[kAeadTagSize];
+  const size_t rounds = std::max<size_t>(1, total / record);
+
+  double start = NowSeconds();
+  for (size_t i = 0; i < rounds; i++) {
+    aead.Seal(nonce, header, sizeof(header), data.data(), record, tag);
+  }
+  Report("secure", std::string("seal_") + CipherName(cipher),
+         rounds * record, NowSeconds() - start);
+
+  // Open needs a valid tag each time, so seal once and reopen a copy.
+  aead.Seal(nonce, header, sizeof(header), data.data(), record, tag);
+  const std::vector<uint8_t> sealed = data;
+  double seconds = 0;
+  for (size_t i = 0; i < rounds; i++) {
+    data = sealed;
+    start = NowSeconds();
+    aead.Open(nonce, header, sizeof(header), data.data(), record, tag);
+    seconds += NowSeconds() - start;
+  }
+  Report("secure", std::string("open_") + CipherName(cipher),
+         rounds * record, seconds);
+}
+
+// Sends |file| over loopback in |record|-sized chunks, sealed or not, and
+// returns the seconds until the receiver has every byte.
+double Transfer(const std::vector<uint8_t>& file, size_t record,
+                SecureChannel* sender, SecureChannel* receiver, bool* ok) {
+  int tx = -1;
+  int rx = -1;
+  *ok = LoopbackPair(&tx, &rx);
+  if (!*ok) return 0;
+  const double start = NowSeconds();
+  std::thread send_thread([&] {
+    std::vector<uint8_t> buf(record + kSecureRecordOverhead);
+    for (size_t off = 0; off < file.size(); off += record) {
+      const size_t n = std::min(record, file.size() - off);
+      if (sender == nullptr) {
+        std::memcpy(buf.data(), file.data() + off, n);
+        if (!SendAll(tx, buf.data(), n)) return;
+        continue;
+      }
+      std::memcpy(buf.data() + kSecureRecordHeader, file.data() + off, n);
+      const size_t size = sender->Seal(buf.data(), n);
+      if (!SendAll(tx, buf.data(), size)) return;
+    }
+  });
+
+  std::vector<uint8_t> buf(record + kSecureRecordOverhead);
+  size_t received = 0;
+  while (*ok && received < file.size()) {
+    if (receiver == nullptr) {
+      const ssize_t n = recv(rx, buf.data(), record, 0);
+      *ok = n > 0;
+      if (*ok) received += static_cast<size_t>(n);
+      continue;
+    }
+    *ok = RecvAll(rx, buf.data(), kSecureRecordHeader);
+    const size_t size = *ok ? SecureChannel::RecordSize(buf.data()) : 0;
+    *ok = size > 0 &&
+          RecvAll(rx, buf.data() + kSecureRecordHeader,
+                  size - kSecureRecordHeader) &&
+          receiver->Open(buf.data(), size);
+    received += size - kSecureRecordOverhead;
+  }
+  const double seconds = NowSeconds() - start;
+  send_thread.join();
+  close(tx);
+  close(rx);
+  return seconds;
+}
+
+}  // namespace
+
+int RunSecureBench(int argc, char** argv) {
+  size_t bulk_mb = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 1024;
+  size_t record_kb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+  if (bulk_mb == 0) bulk_mb = 1024;
+  if (record_kb == 0 || record_kb * 1024 > kSecureMaxRecord) record_kb = 256;
+  const size_t bulk = bulk_mb * 1024 * 1024;
+  const size_t record = record_kb * 1024;
+
+  const uint32_t supported = AeadSupportedCiphers();
+  std::vector<AeadCipher> ciphers;
+  for (AeadCipher c :
+       {AeadCipher::kAes256Gcm, AeadCipher::kChaCha20Poly1305}) {
+    if (supported & static_cast<uint32_t>(c)) ciphers.push_back(c);
+  }
+  for (AeadCipher c : ciphers) {
+    BenchCipher(c, std::min<size_t>(bulk, 256 * 1024 * 1024), record);
+  }
+
+  // Handshake: two X25519 and one Elligator map per side.
+  const char kCode[] = "0a1b2c3d4e5";
+  const auto* code = reinterpret_cast<const uint8_t*>(kCode);
+  const int handshakes = 50;
+  double start = NowSeconds();
+  for (int i = 0; i < handshakes; i++) {
+    SecureChannel client(SecureChannel::Role::kClient, code, sizeof(kCode),
+                         RandomBytes(kSecureEntropySize, 2 * i + 1).data(),
+                         ~0u);
+    SecureChannel server(SecureChannel::Role::kServer, code, sizeof(kCode),
+                         RandomBytes(kSecureEntropySize, 2 * i + 2).data(),
+                         ~0u);
+    if (!Handshake(&client, &server)) {
+      std::fprintf(stderr, "secure: handshake failed\n");
+      return 1;
+    }
+  }
+  char extra[128];
+  const double handshake_s = (NowSeconds() - start) / handshakes;
+  std::snprintf(extra, sizeof(extra), ",\"handshake_ms\":%.2f",
+                handshake_s * 1000);
+  Report("secure", "handshake", 0, handshake_s, extra);
+
+  // Loopback transfer, cleartext and then with each cipher.
+  const std::vector<uint8_t> file = RandomBytes(bulk, 3);
+  bool ok = false;
+  const double plain = Transfer(file, record, nullptr, nullptr, &ok);
+  if (!ok) {
+    std::fprintf(stderr, "secure: cleartext transfer failed\n");
+    return 1;
+  }
+  Report("secure", "loopback_plain", bulk, plain);
+  for (AeadCipher c : ciphers) {
+    const uint32_t mask = static_cast<uint32_t>(c);
+    SecureChannel client(SecureChannel::Role::kClient, code, sizeof(kCode),
+                         RandomBytes(kSecureEntropySize, 1).data(), mask);
+    SecureChannel server(SecureChannel::Role::kServer, code, sizeof(kCode),
+                         RandomBytes(kSecureEntropySize, 2).data(), mask);
+    if (!Handshake(&client, &server)) {
+      std::fprintf(stderr, "secure: handshake failed\n");
+      return 1;
+    }
+    const double sealed = Transfer(file, record, &server, &client, &ok);
+    if (!ok) {
+      std::fprintf(stderr, "secure: %s transfer failed\n", CipherName(c));
+      return 1;
+    }
+    std::snprintf(extra, sizeof(extra), ",\"overhead_pct\":%.1f",
+                  (sealed / plain - 1) * 100);
+    Report("secure", std::string("loopback_") + CipherName(c), bulk, sealed,
+           extra);
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#endif  // defined(_WIN32)
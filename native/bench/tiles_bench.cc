@@ -0,0 +1,432 @@
+// Mirroring over a slow link: the tile stream against MJPEG.
+//
+//   zapshare_bench tiles [seconds] [profile] [width] [height]
+//
+// Replays a scripted trace of desktop use, the same grab by grab on every
+// run, through a ScreenMirrorSender at 30 fps and an ImpairmentProxy
+// running |profile| (default hotspot; see ParseImpairment) into a
+// MirrorReceiver that decodes at full size, once as MJPEG and once as
+// tiles, for |seconds| (default 4) of each stretch of the trace:
+//
+//   typing  a caret line gains a character every grab
+//   cursor  a pointer moves a few pixels every grab
+//   drag    a 480 x 320 window is dragged 6 pixels a grab
+//   scroll  the whole screen moves 8 pixels a grab
+//   video   a 640 x 360 region plays noise
+//   mixed   the five in turn, a second each
+//
+// on a |width| x |height| desktop (default 1920 x 1080) of text windows
+// on a gradient. Every grab stamps its number into a 16-bit barcode of
+// 8 x 8 blocks at the bottom left, which the viewer reads back off each
+// picture it acquires, so latency is grab to AcquireFrame(): capture,
+// encode, the link and decode. The barcode changes every grab, so no
+// frame is ever still; it costs the tile stream two small tiles a frame.
+//
+// Reports frame_kb (bytes sent over frames sent, HTTP included), fps
+// shown, and latency_ms mean, p50 and p95 over the frames shown.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "impairment_proxy.h"
+#include "mirror_receiver.h"
+#include "mirror_sender.h"
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+#if !defined(_WIN32)
+
+constexpr char kHost[] = "127.0.0.1";
+constexpr int kFps = 30;
+constexpr int kBarcodeBits = 16;
+constexpr int kBarcodeBlock = 8;
+constexpr std::chrono::milliseconds kTick(10);
+
+enum class Activity { kTyping, kCursor, kDrag, kScroll, kVideo, kMixed };
+
+// The trace: a desktop drawn twice over, so scrolling is a moving window
+// onto it, changed by grab number alone.
+class TraceDesktop : public ScreenSource {
+ public:
+  TraceDesktop(int width, int height, Activity activity)
+      : width_(width), height_(height), activity_(activity),
+        stride_(static_cast<size_t>(width) * 4),
+        canvas_(stride_ * height * 2), frame_(stride_ * height),
+        noise_(RandomBytes(stride_ * height, 5)) {
+    for (int y = 0; y < height * 2; y++) {
+      for (int x = 0; x < width; x++) {
+        uint8_t* p = Pixel(x, y);
+        const int row = y % height;
+        const bool text = (row / 18) % 2 == 1 && (x / 7) % 9 != 0 &&
+                          ((x * 5 + row * 3) / 13) % 3 != 0 &&
+                          x % (width / 2) > 40;
+        p[0] = text ? 20 : static_cast<uint8_t>(200 + row * 40 / height);
+        p[1] = text ? 20 : static_cast<uint8_t>(190 + x * 40 / width);
+        p[2] = text ? 30 : 220;
+      }
+    }
+    background_ = canvas_;
+  }
+
+  bool Grab(ScreenFrame* frame) override {
+    const int n = grabs_;
+    Activity activity = activity_;
+    if (activity == Activity::kMixed) {
+      activity = static_cast<Activity>((n / kFps) % 5);
+    }
+    switch (activity) {
+      case Activity::kTyping: {
+        const int x = 60 + (n * 8) % (width_ - 120);
+        const int y = 180 + 18 * ((n * 8) / (width_ - 120) % 20);
+        Fill(canvas_, x, top_ + y, 6, 12, 20);
+        break;
+      }
+      case Activity::kCursor: {
+        const int x = (n * 5) % (width_ - 16);
+        const int y = (n * 3) % (height_ - 40);
+        Move(x, top_ + y, 16, 16, 0);
+        break;
+      }
+      case Activity::kDrag: {
+        const int x = (n * 6) % (width_ - 480);
+        const int y = 100 + (n * 2) % (height_ - 440);
+        Move(x, top_ + y, 480, 320, 245);
+        break;
+      }
+      case Activity::kScroll:
+        Move(0, 0, 0, 0, 0);
+        top_ = (top_ + 8) % height_;
+        break;
+      case Activity::kVideo: {
+        const size_t offset = (static_cast<size_t>(n) * 4099) %
+                              (noise_.size() - stride_ * 360);
+        for (int y = 0; y < 360; y++) {
+          std::memcpy(Pixel(200, top_ + 200 + y),
+                      &noise_[offset + stride_ * y], 640 * 4);
+        }
+        break;
+      }
+      case Activity::kMixed:
+        break;
+    }
+
+    std::memcpy(frame_.data(), Pixel(0, top_), frame_.size());
+    for (int bit = 0; bit < kBarcodeBits; bit++) {
+      const uint8_t value = (n >> bit) & 1 ? 0xFF : 0;
+      for (int y = height_ - kBarcodeBlock; y < height_; y++) {
+        std::memset(&frame_[stride_ * y + bit * kBarcodeBlock * 4], value,
+                    kBarcodeBlock * 4);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      grabbed_at_.push_back(NowSeconds());
+    }
+    grabs_++;
+    frame->pixels = frame_.data();
+    frame->width = width_;
+    frame->height = height_;
+    frame->stride = stride_;
+    return true;
+  }
+
+  // When grab |n| was taken, or 0 if it hasn't been.
+  double GrabbedAt(uint32_t n) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return n < grabbed_at_.size() ? grabbed_at_[n] : 0;
+  }
+
+ private:
+  uint8_t* Pixel(int x, int y) { return &canvas_[stride_ * y + x * 4]; }
+
+  void Fill(std::vector<uint8_t>& to, int x, int y, int w, int h,
+            uint8_t value) {
+    for (int j = y; j < y + h; j++) {
+      std::memset(&to[stride_ * j + x * 4], value, w * 4);
+    }
+  }
+
+  // Puts back what the last moved rect covered, then draws it at |x|, |y|.
+  void Move(int x, int y, int w, int h, uint8_t value) {
+    for (int j = moved_y_; j < moved_y_ + moved_h_; j++) {
+      std::memcpy(Pixel(moved_x_, j), &background_[stride_ * j + moved_x_ * 4],
+                  moved_w_ * 4);
+    }
+    Fill(canvas_, x, y, w, h, value);
+    if (w >= 480) {
+      // A title bar, so the window isn't one flat tile.
+      Fill(canvas_, x, y, w, 24, 90);
+    }
+    moved_x_ = x;
+    moved_y_ = y;
+    moved_w_ = w;
+    moved_h_ = h;
+  }
+
+  const int width_;
+  const int height_;
+  const Activity activity_;
+  const size_t stride_;
+  std::vector<uint8_t> canvas_;
+  std::vector<uint8_t> background_;  // The canvas before anything moved.
+  std::vector<uint8_t> frame_;
+  std::vector<uint8_t> noise_;
+  int top_ = 0;
+  int moved_x_ = 0;
+  int moved_y_ = 0;
+  int moved_w_ = 0;
+  int moved_h_ = 0;
+  int grabs_ = 0;
+  mutable std::mutex mu_;
+  std::vector<double> grabbed_at_;
+};
+
+// The grab number stamped on |picture|, or -1 if it's unreadable.
+int ReadBarcode(const MirrorPicture& picture) {
+  if (picture.width < kBarcodeBits * kBarcodeBlock) return -1;
+  const int y = picture.height - kBarcodeBlock / 2;
+  int n = 0;
+  for (int bit = 0; bit < kBarcodeBits; bit++) {
+    const int x = bit * kBarcodeBlock + kBarcodeBlock / 2;
+    const uint8_t green =
+        picture.pixels[(static_cast<size_t>(y) * picture.width + x) * 4 + 1];
+    if (green >= 0x80) n |= 1 << bit;
+  }
+  return n;
+}
+
+// Reads the stream through the proxy on |port| into a MirrorReceiver and
+// times every new grab it shows.
+class Viewer {
+ public:
+  Viewer(uint16_t port, bool tiles, const TraceDesktop* desktop)
+      : desktop_(desktop) {
+    receiver_.SetFrameCallback(&Viewer::OnFrame, this);
+    reader_ = std::thread(&Viewer::Read, this, port, tiles);
+    shower_ = std::thread(&Viewer::Show, this);
+  }
+
+  ~Viewer() {
+    stop_ = true;
+    reader_.join();
+    shower_.join();
+    receiver_.SetFrameCallback(nullptr, nullptr);
+  }
+
+  // Latencies in seconds, in the order shown.
+  std::vector<double> latencies() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return latencies_;
+  }
+
+  bool negotiated() const { return negotiated_.load(); }
+
+ private:
+  static void OnFrame(void* user_data) {
+    Viewer* viewer = static_cast<Viewer*>(user_data);
+    std::lock_guard<std::mutex> lock(viewer->mu_);
+    viewer->fresh_ = true;
+    viewer->cv_.notify_one();
+  }
+
+  void Read(uint16_t port, bool tiles) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      close(fd);
+      return;
+    }
+    std::string request = "GET /stream HTTP/1.1\r\n";
+    if (tiles) {
+      request += std::string(kTileStreamRequestHeader) + ": " +
+                 kTileStreamVersion + "\r\n";
+    }
+    request += "\r\n";
+    send(fd, request.data(), request.size(), 0);
+    timeval timeout = {0, 200 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::string head;
+    std::vector<uint8_t> buffer(256 * 1024);
+    while (!stop_.load()) {
+      const ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+      if (n == 0) break;
+      if (n < 0) continue;
+      size_t at = 0;
+      if (!negotiated_.load()) {
+        head.append(reinterpret_cast<char*>(buffer.data()), n);
+        const size_t end = head.find("\r\n\r\n");
+        if (end == std::string::npos) continue;
+        at = n - (head.size() - end - 4);
+        const bool got_tiles =
+            head.find(kTileStreamContentType) < end;
+        if (got_tiles != tiles) break;
+        negotiated_ = true;
+      }
+      receiver_.Feed(buffer.data() + at, n - at);
+    }
+    close(fd);
+  }
+
+  void Show() {
+    int last = -1;
+    while (!stop_.load()) {
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        while (!stop_.load() && !fresh_) cv_.wait_for(lock, kTick);
+        fresh_ = false;
+      }
+      const MirrorPicture* picture = receiver_.AcquireFrame();
+      if (picture == nullptr) continue;
+      const int n = ReadBarcode(*picture);
+      if (n <= last) continue;
+      const double grabbed = desktop_->GrabbedAt(n);
+      if (grabbed == 0) continue;  // Misread.
+      last = n;
+      std::lock_guard<std::mutex> lock(mu_);
+      latencies_.push_back(NowSeconds() - grabbed);
+    }
+  }
+
+  const TraceDesktop* desktop_;
+  MirrorReceiver receiver_;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> negotiated_{false};
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool fresh_ = false;
+  std::vector<double> latencies_;
+  std::thread reader_;
+  std::thread shower_;
+};
+
+double Percentile(std::vector<double> v, double q) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, static_cast<size_t>(q * v.size()))];
+}
+
+void Run(const char* name, Activity activity, bool tiles,
+         const Impairment& impairment, int width, int height,
+         double seconds) {
+  const std::string label =
+      std::string(tiles ? "tiles/" : "mjpeg/") + name;
+  auto source = std::make_unique<TraceDesktop>(width, height, activity);
+  const TraceDesktop* desktop = source.get();
+  ScreenMirrorConfig config;
+  config.fps = kFps;
+  auto sender = ScreenMirrorSender::Start(std::move(source), config);
+  if (sender == nullptr) {
+    std::fprintf(stderr, "tiles: %s could not start\n", label.c_str());
+    return;
+  }
+  ImpairmentProxy proxy(impairment, kHost, sender->port());
+  if (!proxy.Start()) {
+    std::fprintf(stderr, "tiles: the proxy could not start\n");
+    return;
+  }
+  Viewer viewer(proxy.port(), tiles, desktop);
+  // The first frame is the whole screen; measure from after it.
+  const double deadline = NowSeconds() + 30;
+  while (viewer.latencies().empty() && NowSeconds() < deadline) {
+    std::this_thread::sleep_for(kTick);
+  }
+  if (!viewer.negotiated() || viewer.latencies().empty()) {
+    std::fprintf(stderr, "tiles: %s showed nothing\n", label.c_str());
+    return;
+  }
+  const size_t skip = viewer.latencies().size();
+  const ScreenMirrorStats before = sender->stats();
+  const double start = NowSeconds();
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  const ScreenMirrorStats s = sender->stats();
+  const double elapsed = NowSeconds() - start;
+  std::vector<double> latencies = viewer.latencies();
+  latencies.erase(latencies.begin(), latencies.begin() + skip);
+
+  double sum = 0;
+  for (double l : latencies) sum += l;
+  const uint64_t sent = s.frames_sent - before.frames_sent;
+  const uint64_t bytes = s.bytes_sent - before.bytes_sent;
+  char extra[320];
+  std::snprintf(
+      extra, sizeof(extra),
+      ",\"profile\":\"%s\",\"frame_kb\":%.1f,\"fps_sent\":%.1f,"
+      "\"fps_shown\":%.1f,\"latency_ms\":%.1f,\"p50_ms\":%.1f,"
+      "\"p95_ms\":%.1f",
+      impairment.name.c_str(),
+      bytes / 1024.0 / std::max<uint64_t>(sent, 1), sent / elapsed,
+      latencies.size() / elapsed,
+      latencies.empty() ? 0 : sum / latencies.size() * 1000,
+      Percentile(latencies, 0.5) * 1000, Percentile(latencies, 0.95) * 1000);
+  Report("tiles", label, bytes, elapsed, extra);
+}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace
+
+int RunTilesBench(int argc, char** argv) {
+#if !defined(_WIN32)
+  if (!TileEncoder::Available()) {
+    std::fprintf(stderr, "tiles: built without libjpeg\n");
+    return 1;
+  }
+  const double seconds = argc > 0 ? std::atof(argv[0]) : 4;
+  Impairment impairment;
+  if (!ParseImpairment(argc > 1 ? argv[1] : "hotspot", &impairment)) {
+    std::fprintf(stderr, "tiles: unknown profile %s\n", argv[1]);
+    return 1;
+  }
+  const int width = argc > 2 ? std::atoi(argv[2]) : 1920;
+  const int height = argc > 3 ? std::atoi(argv[3]) : 1080;
+  if (seconds <= 0 || width < 1000 || height < 600) {
+    std::fprintf(stderr, "tiles: seconds must be positive and the size "
+                         "at least 1000 x 600\n");
+    return 1;
+  }
+  const struct {
+    const char* name;
+    Activity activity;
+  } kCases[] = {
+      {"typing", Activity::kTyping}, {"cursor", Activity::kCursor},
+      {"drag", Activity::kDrag},     {"scroll", Activity::kScroll},
+      {"video", Activity::kVideo},   {"mixed", Activity::kMixed},
+  };
+  for (const auto& c : kCases) {
+    for (bool tiles : {false, true}) {
+      Run(c.name, c.activity, tiles, impairment, width, height, seconds);
+    }
+  }
+  return 0;
+#else
+  (void)argc;
+  (void)argv;
+  std::fprintf(stderr, "tiles: not supported on this platform\n");
+  return 1;
+#endif
+}
+
+}  // namespace bench
+}  // namespace zapshare
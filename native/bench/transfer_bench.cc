@@ -0,0 +1,701 @@
+// End-to-end downloads through an impaired network, for the complaints we
+// couldn't reproduce ("slow over hotspot", "stalls at 95%").
+//
+//   zapshare_bench transfer [sizes_mb] [profiles] [host:port/index]
+//   zapshare_bench proxy <listen_port> <host:port> <profile>
+//
+// Every download goes through an ImpairmentProxy running one of the
+// profiles in impairment_proxy.cc, or a custom "mbit,rtt_ms,jitter_ms,
+// loss_pct" one. Three ways of fetching a file are measured:
+//
+//   tcp_v1    the port+1 binary protocol: 4-byte index, then a length-
+//             prefixed metadata JSON and the raw body
+//   http      one plain GET of /file/<index>
+//   parallel  what ParallelTransferService does where the native receiver
+//             is available: 4 MiB-aligned ranges over as many streams as
+//             it would pick for the size, each received by a RangeReceiver
+//
+// Without a sender argument a built-in one serves files of each size in
+// |sizes_mb| (default 1,16) over HTTP on a loopback port and the v1
+// protocol on the port after it, as the app does. Given host:port/index,
+// that file of a running app is fetched instead, so the real sender can
+// be measured too. |profiles| defaults to all of them.
+//
+// Besides MB/s each result has ttfb_ms, the time from connecting to the
+// first body byte, and p99_stall_ms / max_stall_ms: the gaps between
+// moments of progress, sampled every millisecond. A transfer that "stalls
+// at 95%" shows up as a max_stall_ms far above its p99.
+//
+// The proxy subcommand runs just the proxy in front of a real sender, for
+// trying the app itself over a bad network: point the receiver at
+// listen_port (and listen_port + 1 through a second proxy for v1).
+
+#include "bench_util.h"
+
+#if defined(_WIN32)
+
+namespace zapshare {
+namespace bench {
+
+int RunTransferBench(int, char**) {
+  std::fprintf(stderr, "transfer: loopback sockets are POSIX-only for now\n");
+  return 1;
+}
+
+int RunProxyTool(int, char**) {
+  std::fprintf(stderr, "proxy: POSIX-only for now\n");
+  return 1;
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#else
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "impairment_proxy.h"
+#include "range_receiver.h"
+
+namespace zapshare {
+namespace bench {
+
+namespace {
+
+constexpr size_t kIoChunk = 64 * 1024;
+constexpr uint64_t kMiB = 1024 * 1024;
+constexpr int kTimeoutSeconds = 60;
+
+// ParallelTransferService's defaults.
+constexpr uint64_t kPieceAlign = 4 * kMiB;
+constexpr int kDefaultStreams = 8;
+
+bool SendAll(int fd, const void* data, size_t len) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (len > 0) {
+    const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool RecvAll(int fd, void* data, size_t len) {
+  uint8_t* p = static_cast<uint8_t*>(data);
+  while (len > 0) {
+    const ssize_t n = recv(fd, p, len, 0);
+    if (n <= 0) return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+int Connect(const std::string& host, uint16_t port) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &addrs) != 0) {
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo* a = addrs; a != nullptr && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  if (fd >= 0) {
+    timeval idle = {kTimeoutSeconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+  }
+  return fd;
+}
+
+// Reads an HTTP response head. |*rest| gets any body bytes read with it.
+bool ReadHead(int fd, int* status, uint64_t* content_length,
+              std::string* rest) {
+  std::string head;
+  char buf[4096];
+  size_t end;
+  while ((end = head.find("\r\n\r\n")) == std::string::npos) {
+    if (head.size() > 64 * 1024) return false;
+    const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) return false;
+    head.append(buf, static_cast<size_t>(n));
+  }
+  *rest = head.substr(end + 4);
+  head.resize(end);
+  if (head.compare(0, 5, "HTTP/") != 0) return false;
+  *status = std::atoi(head.c_str() + head.find(' ') + 1);
+  std::string lower = head;
+  for (char& c : lower) c = static_cast<char>(std::tolower(c));
+  const size_t at = lower.find("\r\ncontent-length:");
+  if (at == std::string::npos) return false;
+  *content_length = std::strtoull(lower.c_str() + at + 17, nullptr, 10);
+  return true;
+}
+
+// Serves files as the app does: HTTP GET/HEAD of /file/<index> with
+// ranges on one port, the v1 binary protocol on the next.
+class Sender {
+ public:
+  Sender(const std::vector<uint8_t>& data, std::vector<uint64_t> sizes)
+      : data_(data), sizes_(std::move(sizes)) {}
+
+  ~Sender() {
+    stop_ = true;
+    for (const int fd : {http_, tcp_}) {
+      if (fd < 0) continue;
+      shutdown(fd, SHUT_RDWR);
+      close(fd);
+    }
+    for (std::thread& t : threads_) t.join();
+    std::lock_guard<std::mutex> lock(mu_);
+    for (std::thread& t : connections_) t.join();
+  }
+
+  // Finds a free pair of loopback ports.
+  bool Start() {
+    for (int attempt = 0; attempt < 20; attempt++) {
+      http_ = Listen(0);
+      if (http_ < 0) return false;
+      tcp_ = Listen(static_cast<uint16_t>(LocalPort(http_) + 1));
+      if (tcp_ >= 0) break;
+      close(http_);
+      http_ = -1;
+    }
+    if (tcp_ < 0) return false;
+    port_ = LocalPort(http_);
+    threads_.emplace_back(&Sender::Accept, this, http_, true);
+    threads_.emplace_back(&Sender::Accept, this, tcp_, false);
+    return true;
+  }
+
+  uint16_t port() const { return port_; }
+
+ private:
+  static int Listen(uint16_t port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(fd, 64) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  static uint16_t LocalPort(int fd) {
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    return ntohs(addr.sin_port);
+  }
+
+  void Accept(int listen_fd, bool http) {
+    for (;;) {
+      const int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) return;
+      std::lock_guard<std::mutex> lock(mu_);
+      connections_.emplace_back([this, fd, http] {
+        if (http) {
+          ServeHttp(fd);
+        } else {
+          ServeTcp(fd);
+        }
+        close(fd);
+      });
+    }
+  }
+
+  bool SendBody(int fd, uint64_t start, uint64_t end) {
+    for (uint64_t at = start; at < end && !stop_;) {
+      const size_t n = static_cast<size_t>(std::min<uint64_t>(kIoChunk,
+                                                              end - at));
+      if (!SendAll(fd, data_.data() + at, n)) return false;
+      at += n;
+    }
+    return true;
+  }
+
+  void ServeHttp(int fd) {
+    std::string req;
+    char buf[2048];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+      const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0) return;
+      req.append(buf, static_cast<size_t>(n));
+    }
+    const bool head = req.compare(0, 5, "HEAD ") == 0;
+    const size_t file = req.find(" /file/");
+    const size_t index = file == std::string::npos
+                             ? sizes_.size()
+                             : std::strtoul(req.c_str() + file + 7, nullptr,
+                                            10);
+    if (index >= sizes_.size()) {
+      const std::string r = "HTTP/1.1 404 Not Found\r\ncontent-length: 0"
+                            "\r\n\r\n";
+      SendAll(fd, r.data(), r.size());
+      return;
+    }
+    const uint64_t size = sizes_[index];
+    uint64_t start = 0;
+    uint64_t end = size;
+    const size_t range = req.find("Range: bytes=");
+    if (range != std::string::npos) {
+      start = std::strtoull(req.c_str() + range + 13, nullptr, 10);
+      end = std::min<uint64_t>(
+          size, std::strtoull(req.c_str() + req.find('-', range) + 1,
+                              nullptr, 10) + 1);
+    }
+    std::string r = range != std::string::npos
+                        ? "HTTP/1.1 206 Partial Content\r\n"
+                        : "HTTP/1.1 200 OK\r\n";
+    r += "content-length: " + std::to_string(end - start) +
+         "\r\naccept-ranges: bytes\r\n\r\n";
+    if (!SendAll(fd, r.data(), r.size()) || head) return;
+    SendBody(fd, start, end);
+  }
+
+  void ServeTcp(int fd) {
+    uint8_t word[4];
+    if (!RecvAll(fd, word, sizeof(word))) return;
+    const uint32_t index = (uint32_t{word[0]} << 24) |
+                           (uint32_t{word[1]} << 16) |
+                           (uint32_t{word[2]} << 8) | word[3];
+    if (index >= sizes_.size()) return;
+    const std::string meta = "{\"fileName\":\"bench.bin\",\"fileSize\":" +
+                             std::to_string(sizes_[index]) +
+                             ",\"fileIndex\":" + std::to_string(index) + "}";
+    const uint32_t len = static_cast<uint32_t>(meta.size());
+    const uint8_t prefix[4] = {
+        static_cast<uint8_t>(len >> 24), static_cast<uint8_t>(len >> 16),
+        static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len)};
+    if (!SendAll(fd, prefix, sizeof(prefix)) ||
+        !SendAll(fd, meta.data(), meta.size())) {
+      return;
+    }
+    SendBody(fd, 0, sizes_[index]);
+  }
+
+  const std::vector<uint8_t>& data_;
+  const std::vector<uint64_t> sizes_;
+  int http_ = -1;
+  int tcp_ = -1;
+  uint16_t port_ = 0;
+  std::atomic<bool> stop_{false};
+  std::mutex mu_;
+  std::vector<std::thread> connections_;
+  std::vector<std::thread> threads_;
+};
+
+// Watches a byte counter every millisecond for the first byte and the
+// gaps between moments of progress.
+class ProgressMonitor {
+ public:
+  explicit ProgressMonitor(std::function<uint64_t()> received)
+      : received_(std::move(received)),
+        start_(NowSeconds()),
+        thread_(&ProgressMonitor::Run, this) {}
+
+  ~ProgressMonitor() { Stop(); }
+
+  void Stop() {
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+  }
+
+  // -1 if nothing arrived.
+  double ttfb_ms() const {
+    return first_ < 0 ? -1 : (first_ - start_) * 1000;
+  }
+
+  // The |q| quantile and the largest of the gaps, in milliseconds.
+  double StallMs(double q) {
+    if (gaps_.empty()) return 0;
+    std::vector<double> sorted = gaps_;
+    std::sort(sorted.begin(), sorted.end());
+    const size_t at = std::min(sorted.size() - 1,
+                               static_cast<size_t>(q * sorted.size()));
+    return sorted[at] * 1000;
+  }
+
+ private:
+  void Run() {
+    uint64_t last = 0;
+    double last_at = 0;
+    for (;;) {
+      const bool stopping = stop_;
+      const uint64_t now_bytes = received_();
+      const double now = NowSeconds();
+      if (now_bytes > last) {
+        if (first_ < 0) {
+          first_ = now;
+        } else {
+          gaps_.push_back(now - last_at);
+        }
+        last = now_bytes;
+        last_at = now;
+      }
+      if (stopping) return;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  const std::function<uint64_t()> received_;
+  const double start_;
+  double first_ = -1;
+  std::vector<double> gaps_;
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+// The port+1 protocol. Returns the body bytes received.
+uint64_t FetchTcpV1(const std::string& host, uint16_t http_port,
+                    uint32_t index, std::atomic<uint64_t>* received) {
+  const int fd = Connect(host, static_cast<uint16_t>(http_port + 1));
+  if (fd < 0) return 0;
+  const uint8_t word[4] = {
+      static_cast<uint8_t>(index >> 24), static_cast<uint8_t>(index >> 16),
+      static_cast<uint8_t>(index >> 8), static_cast<uint8_t>(index)};
+  uint8_t prefix[4];
+  uint64_t size = 0;
+  if (SendAll(fd, word, sizeof(word)) &&
+      RecvAll(fd, prefix, sizeof(prefix))) {
+    const uint32_t len = (uint32_t{prefix[0]} << 24) |
+                         (uint32_t{prefix[1]} << 16) |
+                         (uint32_t{prefix[2]} << 8) | prefix[3];
+    std::string meta(len, '\0');
+    if (len < 64 * 1024 && RecvAll(fd, meta.data(), len)) {
+      const size_t at = meta.find("\"fileSize\":");
+      if (at != std::string::npos) {
+        size = std::strtoull(meta.c_str() + at + 11, nullptr, 10);
+      }
+    }
+  }
+  std::vector<uint8_t> buf(kIoChunk);
+  while (received->load() < size) {
+    const ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+    if (n <= 0) break;
+    *received += static_cast<uint64_t>(n);
+  }
+  close(fd);
+  return received->load();
+}
+
+// One plain GET. Returns the body bytes received.
+uint64_t FetchHttp(const std::string& host, uint16_t port, uint32_t index,
+                   std::atomic<uint64_t>* received) {
+  const int fd = Connect(host, port);
+  if (fd < 0) return 0;
+  const std::string req = "GET /file/" + std::to_string(index) +
+                          " HTTP/1.1\r\nHost: " + host +
+                          "\r\nConnection: close\r\n\r\n";
+  int status = 0;
+  uint64_t size = 0;
+  std::string rest;
+  if (SendAll(fd, req.data(), req.size()) &&
+      ReadHead(fd, &status, &size, &rest) && status == 200) {
+    *received += rest.size();
+    std::vector<uint8_t> buf(kIoChunk);
+    while (received->load() < size) {
+      const ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+      if (n <= 0) break;
+      *received += static_cast<uint64_t>(n);
+    }
+  }
+  close(fd);
+  return received->load();
+}
+
+// The size of /file/<index> from a HEAD, 0 if that fails.
+uint64_t HeadSize(const std::string& host, uint16_t port, uint32_t index) {
+  const int fd = Connect(host, port);
+  if (fd < 0) return 0;
+  const std::string req = "HEAD /file/" + std::to_string(index) +
+                          " HTTP/1.1\r\nHost: " + host +
+                          "\r\nConnection: close\r\n\r\n";
+  int status = 0;
+  uint64_t size = 0;
+  std::string rest;
+  const bool ok = SendAll(fd, req.data(), req.size()) &&
+                  ReadHead(fd, &status, &size, &rest) && status == 200;
+  close(fd);
+  return ok ? size : 0;
+}
+
+// ParallelTransferService._calculateOptimalStreams, capped at its default.
+int StreamsFor(uint64_t size) {
+  int streams = 12;
+  if (size < 1 * kMiB) {
+    streams = 1;
+  } else if (size < 5 * kMiB) {
+    streams = 2;
+  } else if (size < 20 * kMiB) {
+    streams = 6;
+  } else if (size < 100 * kMiB) {
+    streams = 8;
+  } else if (size < 500 * kMiB) {
+    streams = 10;
+  }
+  return std::min(streams, kDefaultStreams);
+}
+
+// Chunk-aligned ranges over the streams, each pulled by a worker with its
+// own RangeReceiver. Returns the bytes received.
+uint64_t FetchParallel(const std::string& host, uint16_t port, uint32_t index,
+                       uint64_t size, const std::string& path,
+                       std::vector<std::atomic<uint64_t>>* progress) {
+  const int streams = StreamsFor(size);
+  const uint64_t per_stream = (size + streams - 1) / streams;
+  const uint64_t piece = (per_stream + kPieceAlign - 1) / kPieceAlign *
+                         kPieceAlign;
+  std::vector<std::pair<uint64_t, uint64_t>> pieces;
+  for (uint64_t at = 0; at < size; at += piece) {
+    pieces.emplace_back(at, std::min(at + piece, size));
+  }
+  std::filesystem::remove(path);
+  PreallocateFile(path, size);
+
+  std::atomic<size_t> next{0};
+  std::atomic<uint64_t> total{0};
+  const size_t workers = std::min<size_t>(pieces.size(), streams);
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w < workers; w++) {
+    threads.emplace_back([&, w] {
+      uint64_t finished = 0;
+      for (size_t i; (i = next++) < pieces.size();) {
+        ReceiveRequest r;
+        r.host = host;
+        r.port = port;
+        r.target = "/file/" + std::to_string(index);
+        r.start = pieces[i].first;
+        r.end = pieces[i].second;
+        r.path = path;
+        auto receiver = RangeReceiver::Start(r);
+        if (receiver == nullptr) return;
+        while (receiver->state() == ReceiveState::kRunning) {
+          (*progress)[w] = finished + receiver->stats().received;
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        finished += receiver->stats().received;
+        (*progress)[w] = finished;
+        if (receiver->state() != ReceiveState::kDone) return;
+      }
+      total += finished;
+    });
+  }
+  for (std::thread& t : threads) t.join();
+  return total.load();
+}
+
+void Run(const std::string& protocol, const Impairment& impairment,
+         const std::string& host, uint16_t port, uint32_t index,
+         uint64_t size) {
+  ImpairmentProxy http_proxy(impairment, host, port);
+  ImpairmentProxy tcp_proxy(impairment, host,
+                            static_cast<uint16_t>(port + 1));
+  if (!http_proxy.Start()) {
+    std::fprintf(stderr, "transfer: proxy failed to start\n");
+    return;
+  }
+  // v1 connects to the HTTP port + 1, so that's where its proxy goes.
+  ImpairmentProxy* proxy = &http_proxy;
+  if (protocol == "tcp_v1") {
+    if (!tcp_proxy.Start(static_cast<uint16_t>(http_proxy.port() + 1))) {
+      std::fprintf(stderr, "transfer: port %u taken, skipping tcp_v1\n",
+                   http_proxy.port() + 1);
+      return;
+    }
+    proxy = &tcp_proxy;
+  }
+
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "zs_transfer_bench.bin")
+          .string();
+  std::atomic<uint64_t> received{0};
+  std::vector<std::atomic<uint64_t>> progress(kDefaultStreams);
+  for (auto& p : progress) p = 0;
+  ProgressMonitor monitor([&] {
+    uint64_t sum = received.load();
+    for (const auto& p : progress) sum += p.load();
+    return sum;
+  });
+  const double start = NowSeconds();
+  uint64_t got = 0;
+  if (protocol == "tcp_v1") {
+    got = FetchTcpV1("127.0.0.1", http_proxy.port(), index, &received);
+  } else if (protocol == "http") {
+    got = FetchHttp("127.0.0.1", http_proxy.port(), index, &received);
+  } else {
+    got = FetchParallel("127.0.0.1", http_proxy.port(), index, size, path,
+                        &progress);
+  }
+  const double seconds = NowSeconds() - start;
+  monitor.Stop();
+  std::filesystem::remove(path);
+
+  const uint64_t file_mb = size / kMiB;
+  char extra[320];
+  std::snprintf(extra, sizeof(extra),
+                ",\"protocol\":\"%s\",\"profile\":\"%s\",\"file_mb\":%llu,"
+                "\"complete\":%s,\"ttfb_ms\":%.1f,\"p99_stall_ms\":%.1f,"
+                "\"max_stall_ms\":%.1f,\"lost_segments\":%llu",
+                protocol.c_str(), impairment.name.c_str(),
+                static_cast<unsigned long long>(file_mb),
+                got == size ? "true" : "false", monitor.ttfb_ms(),
+                monitor.StallMs(0.99), monitor.StallMs(1.0),
+                static_cast<unsigned long long>(proxy->lost()));
+  Report("transfer",
+         protocol + "/" + impairment.name + "/" + std::to_string(file_mb) +
+             "MB",
+         got, seconds, extra);
+}
+
+std::vector<std::string> Split(const std::string& s) {
+  std::vector<std::string> out;
+  std::istringstream in(s);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    if (!item.empty()) out.push_back(item);
+  }
+  return out;
+}
+
+// "host:port" into its parts. False if it isn't one.
+bool SplitHostPort(const std::string& s, std::string* host, uint16_t* port) {
+  const size_t colon = s.rfind(':');
+  if (colon == std::string::npos || colon == 0) return false;
+  *host = s.substr(0, colon);
+  *port = static_cast<uint16_t>(std::strtoul(s.c_str() + colon + 1,
+                                             nullptr, 10));
+  return *port != 0;
+}
+
+}  // namespace
+
+int RunTransferBench(int argc, char** argv) {
+  std::vector<uint64_t> sizes;
+  for (const std::string& mb : Split(argc > 0 ? argv[0] : "1,16")) {
+    sizes.push_back(std::strtoull(mb.c_str(), nullptr, 10) * kMiB);
+  }
+  std::vector<Impairment> profiles;
+  if (argc > 1 && std::strcmp(argv[1], "all") != 0) {
+    for (const std::string& spec : Split(argv[1])) {
+      Impairment p;
+      if (!ParseImpairment(spec, &p)) {
+        std::fprintf(stderr, "transfer: unknown profile %s\n", spec.c_str());
+        return 2;
+      }
+      profiles.push_back(p);
+    }
+  } else {
+    profiles = ImpairmentProfiles();
+  }
+
+  const char* kProtocols[] = {"tcp_v1", "http", "parallel"};
+  if (argc > 2) {
+    // A running app: host:port/index.
+    const std::string target = argv[2];
+    const size_t slash = target.find('/');
+    std::string host;
+    uint16_t port = 0;
+    if (slash == std::string::npos ||
+        !SplitHostPort(target.substr(0, slash), &host, &port)) {
+      std::fprintf(stderr, "transfer: expected host:port/index\n");
+      return 2;
+    }
+    const uint32_t index =
+        static_cast<uint32_t>(std::strtoul(target.c_str() + slash + 1,
+                                           nullptr, 10));
+    const uint64_t size = HeadSize(host, port, index);
+    if (size == 0) {
+      std::fprintf(stderr, "transfer: no /file/%u at %s:%u\n", index,
+                   host.c_str(), port);
+      return 1;
+    }
+    for (const Impairment& p : profiles) {
+      for (const char* protocol : kProtocols) {
+        Run(protocol, p, host, port, index, size);
+      }
+    }
+    return 0;
+  }
+
+  uint64_t largest = 0;
+  for (const uint64_t s : sizes) largest = std::max(largest, s);
+  const std::vector<uint8_t> data = RandomBytes(largest, 41);
+  Sender sender(data, sizes);
+  if (!sender.Start()) {
+    std::fprintf(stderr, "transfer: sender failed to start\n");
+    return 1;
+  }
+  for (const Impairment& p : profiles) {
+    for (uint32_t i = 0; i < sizes.size(); i++) {
+      for (const char* protocol : kProtocols) {
+        Run(protocol, p, "127.0.0.1", sender.port(), i, sizes[i]);
+      }
+    }
+  }
+  return 0;
+}
+
+int RunProxyTool(int argc, char** argv) {
+  std::string host;
+  uint16_t port = 0;
+  Impairment impairment;
+  if (argc < 3 || !SplitHostPort(argv[1], &host, &port) ||
+      !ParseImpairment(argv[2], &impairment)) {
+    std::fprintf(stderr,
+                 "usage: zapshare_bench proxy <listen_port> <host:port> "
+                 "<profile|mbit,rtt_ms,jitter_ms,loss_pct>\n");
+    return 2;
+  }
+  const uint16_t listen_port =
+      static_cast<uint16_t>(std::strtoul(argv[0], nullptr, 10));
+  ImpairmentProxy proxy(impairment, host, port);
+  if (listen_port == 0 || !proxy.Start(listen_port)) {
+    std::fprintf(stderr, "proxy: can't listen on port %s\n", argv[0]);
+    return 1;
+  }
+  std::fprintf(stderr, "proxy: :%u -> %s:%u as %s, until interrupted\n",
+               proxy.port(), host.c_str(), port, impairment.name.c_str());
+  for (;;) {
+    std::this_thread::sleep_for(std::chrono::seconds(10));
+    std::fprintf(stderr, "proxy: %llu segments lost so far\n",
+                 static_cast<unsigned long long>(proxy.lost()));
+  }
+}
+
+}  // namespace bench
+}  // namespace zapshare
+
+#endif
@@ -0,0 +1,625 @@
+#include "aead.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)
+#define ZS_AEAD_X86 1
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define ZS_TARGET_AESNI
+#else
+#include <cpuid.h>
+#define ZS_TARGET_AESNI __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+#endif
+#endif
+
+namespace zapshare {
+
+namespace {
+
+inline uint32_t LoadLe32(const uint8_t* p) {
+  return uint32_t{p[0]} | uint32_t{p[1]} << 8 | uint32_t{p[2]} << 16 |
+         uint32_t{p[3]} << 24;
+}
+
+inline void StoreLe32(uint8_t* p, uint32_t v) {
+  p[0] = static_cast<uint8_t>(v);
+  p[1] = static_cast<uint8_t>(v >> 8);
+  p[2] = static_cast<uint8_t>(v >> 16);
+  p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+inline void StoreLe64(uint8_t* p, uint64_t v) {
+  StoreLe32(p, static_cast<uint32_t>(v));
+  StoreLe32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+// Compares tags without an early exit.
+bool TagsEqual(const uint8_t* a, const uint8_t* b) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < kAeadTagSize; i++) diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+constexpr uint32_t kSigma[4] = {0x61707865, 0x3320646E, 0x79622D32,
+                                0x6B206574};  // "expand 32-byte k"
+
+inline uint32_t Rotl(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+#define ZS_QUARTER(a, b, c, d) \
+  a += b;                      \
+  d = Rotl(d ^ a, 16);         \
+  c += d;                      \
+  b = Rotl(b ^ c, 12);         \
+  a += b;                      \
+  d = Rotl(d ^ a, 8);          \
+  c += d;                      \
+  b = Rotl(b ^ c, 7)
+
+void ChaChaBlock(const uint32_t in[16], uint8_t out[64]) {
+  uint32_t x[16];
+  std::memcpy(x, in, sizeof(x));
+  for (int i = 0; i < 10; i++) {
+    ZS_QUARTER(x[0], x[4], x[8], x[12]);
+    ZS_QUARTER(x[1], x[5], x[9], x[13]);
+    ZS_QUARTER(x[2], x[6], x[10], x[14]);
+    ZS_QUARTER(x[3], x[7], x[11], x[15]);
+    ZS_QUARTER(x[0], x[5], x[10], x[15]);
+    ZS_QUARTER(x[1], x[6], x[11], x[12]);
+    ZS_QUARTER(x[2], x[7], x[8], x[13]);
+    ZS_QUARTER(x[3], x[4], x[9], x[14]);
+  }
+  for (int i = 0; i < 16; i++) StoreLe32(out + 4 * i, x[i] + in[i]);
+}
+
+#if defined(ZS_AEAD_X86)
+
+inline __m128i Rotl16(__m128i x) {
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+}
+
+template <int kBits>
+inline __m128i RotlV(__m128i x) {
+  return _mm_or_si128(_mm_slli_epi32(x, kBits), _mm_srli_epi32(x, 32 - kBits));
+}
+
+#define ZS_QUARTER_V(a, b, c, d)               \
+  a = _mm_add_epi32(a, b);                     \
+  d = Rotl16(_mm_xor_si128(d, a));             \
+  c = _mm_add_epi32(c, d);                     \
+  b = RotlV<12>(_mm_xor_si128(b, c));          \
+  a = _mm_add_epi32(a, b);                     \
+  d = RotlV<8>(_mm_xor_si128(d, a));           \
+  c = _mm_add_epi32(c, d);                     \
+  b = RotlV<7>(_mm_xor_si128(b, c))
+
+inline void Transpose(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+  const __m128i t0 = _mm_unpacklo_epi32(a, b);
+  const __m128i t1 = _mm_unpacklo_epi32(c, d);
+  const __m128i t2 = _mm_unpackhi_epi32(a, b);
+  const __m128i t3 = _mm_unpackhi_epi32(c, d);
+  a = _mm_unpacklo_epi64(t0, t1);
+  b = _mm_unpackhi_epi64(t0, t1);
+  c = _mm_unpacklo_epi64(t2, t3);
+  d = _mm_unpackhi_epi64(t2, t3);
+}
+
+// XORs four consecutive blocks of keystream into |data|, one block per
+// SIMD lane, and advances the counter in |state| by four.
+void ChaChaXor4(uint32_t state[16], uint8_t* data) {
+  __m128i v[16];
+  __m128i in[16];
+  for (int i = 0; i < 16; i++) in[i] = _mm_set1_epi32(state[i]);
+  in[12] = _mm_add_epi32(in[12], _mm_setr_epi32(0, 1, 2, 3));
+  for (int i = 0; i < 16; i++) v[i] = in[i];
+  for (int i = 0; i < 10; i++) {
+    ZS_QUARTER_V(v[0], v[4], v[8], v[12]);
+    ZS_QUARTER_V(v[1], v[5], v[9], v[13]);
+    ZS_QUARTER_V(v[2], v[6], v[10], v[14]);
+    ZS_QUARTER_V(v[3], v[7], v[11], v[15]);
+    ZS_QUARTER_V(v[0], v[5], v[10], v[15]);
+    ZS_QUARTER_V(v[1], v[6], v[11], v[12]);
+    ZS_QUARTER_V(v[2], v[7], v[8], v[13]);
+    ZS_QUARTER_V(v[3], v[4], v[9], v[14]);
+  }
+  for (int i = 0; i < 16; i++) v[i] = _mm_add_epi32(v[i], in[i]);
+  // After the transpose v[4g + b] holds words 4g..4g+3 of block b.
+  for (int g = 0; g < 4; g++) {
+    Transpose(v[4 * g], v[4 * g + 1], v[4 * g + 2], v[4 * g + 3]);
+    for (int b = 0; b < 4; b++) {
+      auto* p = reinterpret_cast<__m128i*>(data + 64 * b + 16 * g);
+      _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), v[4 * g + b]));
+    }
+  }
+  state[12] += 4;
+}
+
+#endif  // defined(ZS_AEAD_X86)
+
+void ChaChaInit(uint32_t state[16], const uint8_t key[32],
+                const uint8_t nonce[12], uint32_t counter) {
+  for (int i = 0; i < 4; i++) state[i] = kSigma[i];
+  for (int i = 0; i < 8; i++) state[4 + i] = LoadLe32(key + 4 * i);
+  state[12] = counter;
+  for (int i = 0; i < 3; i++) state[13 + i] = LoadLe32(nonce + 4 * i);
+}
+
+void ChaChaXor(uint32_t state[16], uint8_t* data, size_t len) {
+#if defined(ZS_AEAD_X86)
+  for (; len >= 256; data += 256, len -= 256) ChaChaXor4(state, data);
+#endif
+  uint8_t block[64];
+  while (len > 0) {
+    ChaChaBlock(state, block);
+    state[12]++;
+    const size_t n = len < 64 ? len : 64;
+    for (size_t i = 0; i < n; i++) data[i] ^= block[i];
+    data += n;
+    len -= n;
+  }
+}
+
+// 26-bit limbs so every product fits in 64 bits on any target.
+class Poly1305 {
+ public:
+  explicit Poly1305(const uint8_t key[32]) {
+    r_[0] = LoadLe32(key) & 0x3FFFFFF;
+    r_[1] = (LoadLe32(key + 3) >> 2) & 0x3FFFF03;
+    r_[2] = (LoadLe32(key + 6) >> 4) & 0x3FFC0FF;
+    r_[3] = (LoadLe32(key + 9) >> 6) & 0x3F03FFF;
+    r_[4] = (LoadLe32(key + 12) >> 8) & 0x00FFFFF;
+    for (int i = 0; i < 4; i++) pad_[i] = LoadLe32(key + 16 + 4 * i);
+  }
+
+  // Absorbs |data| zero-padded to a whole number of blocks, which is all
+  // the AEAD construction ever needs.
+  void UpdatePadded(const uint8_t* data, size_t len) {
+    const size_t whole = len & ~size_t{15};
+    Blocks(data, whole);
+    if (len > whole) {
+      uint8_t block[16] = {};
+      std::memcpy(block, data + whole, len - whole);
+      Blocks(block, 16);
+    }
+  }
+
+  void Final(uint8_t tag[16]) {
+    uint32_t h0 = h_[0], h1 = h_[1], h2 = h_[2], h3 = h_[3], h4 = h_[4];
+    uint32_t c = h1 >> 26;
+    h1 &= 0x3FFFFFF;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= 0x3FFFFFF;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= 0x3FFFFFF;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= 0x3FFFFFF;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= 0x3FFFFFF;
+    h1 += c;
+
+    // h - p, kept only if it didn't go negative.
+    uint32_t g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= 0x3FFFFFF;
+    uint32_t g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= 0x3FFFFFF;
+    uint32_t g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= 0x3FFFFFF;
+    uint32_t g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= 0x3FFFFFF;
+    const uint32_t g4 = h4 + c - (1u << 26);
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    // h + pad mod 2^128.
+    const uint32_t w0 = h0 | h1 << 26;
+    const uint32_t w1 = h1 >> 6 | h2 << 20;
+    const uint32_t w2 = h2 >> 12 | h3 << 14;
+    const uint32_t w3 = h3 >> 18 | h4 << 8;
+    uint64_t f = uint64_t{w0} + pad_[0];
+    StoreLe32(tag, static_cast<uint32_t>(f));
+    f = uint64_t{w1} + pad_[1] + (f >> 32);
+    StoreLe32(tag + 4, static_cast<uint32_t>(f));
+    f = uint64_t{w2} + pad_[2] + (f >> 32);
+    StoreLe32(tag + 8, static_cast<uint32_t>(f));
+    f = uint64_t{w3} + pad_[3] + (f >> 32);
+    StoreLe32(tag + 12, static_cast<uint32_t>(f));
+  }
+
+ private:
+  void Blocks(const uint8_t* m, size_t len) {
+    const uint64_t r0 = r_[0], r1 = r_[1], r2 = r_[2], r3 = r_[3],
+                   r4 = r_[4];
+    const uint64_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint64_t h0 = h_[0], h1 = h_[1], h2 = h_[2], h3 = h_[3], h4 = h_[4];
+    for (; len >= 16; m += 16, len -= 16) {
+      h0 += LoadLe32(m) & 0x3FFFFFF;
+      h1 += (LoadLe32(m + 3) >> 2) & 0x3FFFFFF;
+      h2 += (LoadLe32(m + 6) >> 4) & 0x3FFFFFF;
+      h3 += (LoadLe32(m + 9) >> 6) & 0x3FFFFFF;
+      h4 += (LoadLe32(m + 12) >> 8) | (1u << 24);
+
+      const uint64_t d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+      uint64_t d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + h4 * s2;
+      uint64_t d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + h4 * s3;
+      uint64_t d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + h4 * s4;
+      uint64_t d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + h4 * r0;
+
+      uint64_t c = d0 >> 26;
+      h0 = d0 & 0x3FFFFFF;
+      d1 += c;
+      c = d1 >> 26;
+      h1 = d1 & 0x3FFFFFF;
+      d2 += c;
+      c = d2 >> 26;
+      h2 = d2 & 0x3FFFFFF;
+      d3 += c;
+      c = d3 >> 26;
+      h3 = d3 & 0x3FFFFFF;
+      d4 += c;
+      c = d4 >> 26;
+      h4 = d4 & 0x3FFFFFF;
+      h0 += c * 5;
+      c = h0 >> 26;
+      h0 &= 0x3FFFFFF;
+      h1 += c;
+    }
+    h_[0] = static_cast<uint32_t>(h0);
+    h_[1] = static_cast<uint32_t>(h1);
+    h_[2] = static_cast<uint32_t>(h2);
+    h_[3] = static_cast<uint32_t>(h3);
+    h_[4] = static_cast<uint32_t>(h4);
+  }
+
+  uint32_t r_[5];
+  uint32_t pad_[4];
+  uint32_t h_[5] = {};
+};
+
+void ChaChaPolyTag(const uint8_t poly_key[32], const uint8_t* aad,
+                   size_t aad_len, const uint8_t* data, size_t len,
+                   uint8_t tag[16]) {
+  Poly1305 poly(poly_key);
+  poly.UpdatePadded(aad, aad_len);
+  poly.UpdatePadded(data, len);
+  uint8_t lengths[16];
+  StoreLe64(lengths, aad_len);
+  StoreLe64(lengths + 8, len);
+  poly.UpdatePadded(lengths, 16);
+  poly.Final(tag);
+}
+
+#if defined(ZS_AEAD_X86)
+
+bool CpuHasAesGcm() {
+  unsigned int ecx = 0;
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  ecx = static_cast<unsigned int>(info[2]);
+#else
+  unsigned int eax, ebx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+#endif
+  const unsigned int kPclmul = 1u << 1;
+  const unsigned int kSsse3 = 1u << 9;
+  const unsigned int kSse41 = 1u << 19;
+  const unsigned int kAes = 1u << 25;
+  const unsigned int want = kPclmul | kSsse3 | kSse41 | kAes;
+  return (ecx & want) == want;
+}
+
+constexpr int kAesRounds = 14;
+constexpr int kHPowers = 15;  // Offset of H^1 in the key area, in blocks.
+constexpr int kHCount = 8;
+
+ZS_TARGET_AESNI inline __m128i ByteSwap(__m128i x) {
+  return _mm_shuffle_epi8(
+      x, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+ZS_TARGET_AESNI inline __m128i ExpandLow(__m128i key, __m128i assist) {
+  assist = _mm_shuffle_epi32(assist, 0xFF);
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+ZS_TARGET_AESNI inline __m128i ExpandHigh(__m128i key, __m128i low) {
+  const __m128i assist =
+      _mm_shuffle_epi32(_mm_aeskeygenassist_si128(low, 0), 0xAA);
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+// Two more round keys; the round constant has to be an immediate.
+template <int kRcon>
+ZS_TARGET_AESNI inline void ExpandPair(__m128i* rk, int i) {
+  rk[i] = ExpandLow(rk[i - 2], _mm_aeskeygenassist_si128(rk[i - 1], kRcon));
+  if (i + 1 <= kAesRounds) rk[i + 1] = ExpandHigh(rk[i - 1], rk[i]);
+}
+
+ZS_TARGET_AESNI inline __m128i AesEncrypt(const __m128i* rk, __m128i x) {
+  x = _mm_xor_si128(x, rk[0]);
+  for (int r = 1; r < kAesRounds; r++) x = _mm_aesenc_si128(x, rk[r]);
+  return _mm_aesenclast_si128(x, rk[kAesRounds]);
+}
+
+// 256-bit carry-less product of two byte-reflected blocks, before the
+// shift and reduction. Products can be XORed together and reduced once.
+ZS_TARGET_AESNI inline void ClMul(__m128i a, __m128i b, __m128i* lo,
+                                  __m128i* hi) {
+  __m128i t3 = _mm_clmulepi64_si128(a, b, 0x00);
+  __m128i t4 = _mm_clmulepi64_si128(a, b, 0x10);
+  const __m128i t5 = _mm_clmulepi64_si128(a, b, 0x01);
+  __m128i t6 = _mm_clmulepi64_si128(a, b, 0x11);
+  t4 = _mm_xor_si128(t4, t5);
+  t3 = _mm_xor_si128(t3, _mm_slli_si128(t4, 8));
+  t6 = _mm_xor_si128(t6, _mm_srli_si128(t4, 8));
+  *lo = _mm_xor_si128(*lo, t3);
+  *hi = _mm_xor_si128(*hi, t6);
+}
+
+// Reduces modulo the GCM polynomial, in the bit-reflected convention of
+// Intel's carry-less multiplication white paper.
+ZS_TARGET_AESNI inline __m128i Reduce(__m128i lo, __m128i hi) {
+  __m128i t7 = _mm_srli_epi32(lo, 31);
+  __m128i t8 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  const __m128i t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  lo = _mm_or_si128(lo, t7);
+  hi = _mm_or_si128(_mm_or_si128(hi, t8), t9);
+
+  t7 = _mm_xor_si128(
+      _mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)),
+      _mm_slli_epi32(lo, 25));
+  t8 = _mm_srli_si128(t7, 4);
+  lo = _mm_xor_si128(lo, _mm_slli_si128(t7, 12));
+  __m128i t2 = _mm_xor_si128(
+      _mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)),
+      _mm_srli_epi32(lo, 7));
+  t2 = _mm_xor_si128(t2, t8);
+  lo = _mm_xor_si128(lo, t2);
+  return _mm_xor_si128(hi, lo);
+}
+
+ZS_TARGET_AESNI inline __m128i GfMul(__m128i a, __m128i b) {
+  __m128i lo = _mm_setzero_si128();
+  __m128i hi = _mm_setzero_si128();
+  ClMul(a, b, &lo, &hi);
+  return Reduce(lo, hi);
+}
+
+ZS_TARGET_AESNI void AesGcmSetup(const uint8_t key[32], uint8_t* area) {
+  auto* rk = reinterpret_cast<__m128i*>(area);
+  rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+  rk[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+  ExpandPair<0x01>(rk, 2);
+  ExpandPair<0x02>(rk, 4);
+  ExpandPair<0x04>(rk, 6);
+  ExpandPair<0x08>(rk, 8);
+  ExpandPair<0x10>(rk, 10);
+  ExpandPair<0x20>(rk, 12);
+  ExpandPair<0x40>(rk, 14);
+  const __m128i h = ByteSwap(AesEncrypt(rk, _mm_setzero_si128()));
+  rk[kHPowers] = h;
+  for (int i = 1; i < kHCount; i++) {
+    rk[kHPowers + i] = GfMul(rk[kHPowers + i - 1], h);
+  }
+}
+
+// Folds whole blocks into the GHASH state |x|, eight per reduction.
+ZS_TARGET_AESNI inline __m128i Ghash8(const __m128i* h, __m128i x,
+                                      const uint8_t* p) {
+  const auto* b = reinterpret_cast<const __m128i*>(p);
+  __m128i lo = _mm_setzero_si128();
+  __m128i hi = _mm_setzero_si128();
+  ClMul(_mm_xor_si128(x, ByteSwap(_mm_loadu_si128(b))), h[7], &lo, &hi);
+  for (int i = 1; i < 8; i++) {
+    ClMul(ByteSwap(_mm_loadu_si128(b + i)), h[7 - i], &lo, &hi);
+  }
+  return Reduce(lo, hi);
+}
+
+// Folds |len| bytes into |x|; a partial last block is zero-padded.
+ZS_TARGET_AESNI __m128i Ghash(const __m128i* h, __m128i x, const uint8_t* p,
+                              size_t len) {
+  for (; len >= 128; p += 128, len -= 128) x = Ghash8(h, x, p);
+  for (; len >= 16; p += 16, len -= 16) {
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    x = GfMul(_mm_xor_si128(x, ByteSwap(b)), h[0]);
+  }
+  if (len > 0) {
+    alignas(16) uint8_t block[16] = {};
+    std::memcpy(block, p, len);
+    const __m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+    x = GfMul(_mm_xor_si128(x, ByteSwap(b)), h[0]);
+  }
+  return x;
+}
+
+// CTR mode from the block after J0, hashing the ciphertext into |x| in the
+// same pass: eight counter blocks go through the AES units while the
+// carry-less multiplier works on the eight ciphertext blocks next to them,
+// so the data is touched once. |x| can be null to only apply the
+// keystream.
+ZS_TARGET_AESNI void AesGcmCrypt(const __m128i* rk, __m128i j0, __m128i* x,
+                                 uint8_t* p, size_t len, bool encrypt) {
+  const __m128i* h = rk + kHPowers;
+  const __m128i one = _mm_setr_epi32(1, 0, 0, 0);
+  __m128i counter = _mm_add_epi32(j0, one);
+  for (; len >= 128; p += 128, len -= 128) {
+    __m128i c[8];
+    for (int i = 0; i < 8; i++) {
+      c[i] = _mm_xor_si128(ByteSwap(counter), rk[0]);
+      counter = _mm_add_epi32(counter, one);
+    }
+    if (x != nullptr && !encrypt) *x = Ghash8(h, *x, p);
+    for (int r = 1; r < kAesRounds; r++) {
+      for (int i = 0; i < 8; i++) c[i] = _mm_aesenc_si128(c[i], rk[r]);
+    }
+    auto* b = reinterpret_cast<__m128i*>(p);
+    for (int i = 0; i < 8; i++) {
+      c[i] = _mm_aesenclast_si128(c[i], rk[kAesRounds]);
+      _mm_storeu_si128(b + i, _mm_xor_si128(_mm_loadu_si128(b + i), c[i]));
+    }
+    if (x != nullptr && encrypt) *x = Ghash8(h, *x, p);
+  }
+  if (x != nullptr && !encrypt) *x = Ghash(h, *x, p, len);
+  uint8_t* tail = p;
+  const size_t tail_len = len;
+  for (; len > 0;) {
+    alignas(16) uint8_t ks[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(ks),
+                    AesEncrypt(rk, ByteSwap(counter)));
+    counter = _mm_add_epi32(counter, one);
+    const size_t n = len < 16 ? len : 16;
+    for (size_t i = 0; i < n; i++) p[i] ^= ks[i];
+    p += n;
+    len -= n;
+  }
+  if (x != nullptr && encrypt) *x = Ghash(h, *x, tail, tail_len);
+}
+
+ZS_TARGET_AESNI __m128i GcmCounter(const uint8_t nonce[12]) {
+  alignas(16) uint8_t j0[16] = {};
+  std::memcpy(j0, nonce, 12);
+  j0[15] = 1;
+  return ByteSwap(_mm_load_si128(reinterpret_cast<const __m128i*>(j0)));
+}
+
+// Encrypts or decrypts |data| in place and returns the tag.
+ZS_TARGET_AESNI __m128i AesGcm(const uint8_t* area, const uint8_t nonce[12],
+                               const uint8_t* aad, size_t aad_len,
+                               uint8_t* data, size_t len, bool encrypt) {
+  const auto* rk = reinterpret_cast<const __m128i*>(area);
+  const __m128i* h = rk + kHPowers;
+  const __m128i j0 = GcmCounter(nonce);
+  __m128i x = Ghash(h, _mm_setzero_si128(), aad, aad_len);
+  AesGcmCrypt(rk, j0, &x, data, len, encrypt);
+  const __m128i lengths = _mm_set_epi64x(
+      static_cast<int64_t>(uint64_t{aad_len} * 8),
+      static_cast<int64_t>(uint64_t{len} * 8));
+  x = GfMul(_mm_xor_si128(x, lengths), h[0]);
+  return _mm_xor_si128(ByteSwap(x), AesEncrypt(rk, ByteSwap(j0)));
+}
+
+ZS_TARGET_AESNI void AesGcmSeal(const uint8_t* area, const uint8_t nonce[12],
+                                const uint8_t* aad, size_t aad_len,
+                                uint8_t* data, size_t len, uint8_t tag[16]) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(tag),
+                   AesGcm(area, nonce, aad, aad_len, data, len, true));
+}
+
+ZS_TARGET_AESNI bool AesGcmOpen(const uint8_t* area, const uint8_t nonce[12],
+                                const uint8_t* aad, size_t aad_len,
+                                uint8_t* data, size_t len,
+                                const uint8_t tag[16]) {
+  alignas(16) uint8_t expected[16];
+  _mm_store_si128(reinterpret_cast<__m128i*>(expected),
+                  AesGcm(area, nonce, aad, aad_len, data, len, false));
+  if (TagsEqual(expected, tag)) return true;
+  // Decrypting and verifying in one pass saves a trip over the data; on a
+  // bad tag the keystream is applied again to put the ciphertext back.
+  const auto* rk = reinterpret_cast<const __m128i*>(area);
+  AesGcmCrypt(rk, GcmCounter(nonce), nullptr, data, len, true);
+  return false;
+}
+
+#else
+
+bool CpuHasAesGcm() { return false; }
+
+#endif  // defined(ZS_AEAD_X86)
+
+}  // namespace
+
+uint32_t AeadSupportedCiphers() {
+  static const bool aes = CpuHasAesGcm();
+  uint32_t mask = static_cast<uint32_t>(AeadCipher::kChaCha20Poly1305);
+  if (aes) mask |= static_cast<uint32_t>(AeadCipher::kAes256Gcm);
+  return mask;
+}
+
+Aead::~Aead() {
+  // Best effort: keep keys from lingering in freed memory.
+  volatile uint8_t* p = key_;
+  for (size_t i = 0; i < sizeof(key_); i++) p[i] = 0;
+  p = aes_;
+  for (size_t i = 0; i < sizeof(aes_); i++) p[i] = 0;
+}
+
+bool Aead::Init(AeadCipher cipher, const uint8_t key[kAeadKeySize]) {
+  if ((AeadSupportedCiphers() & static_cast<uint32_t>(cipher)) == 0 ||
+      cipher == AeadCipher::kNone) {
+    return false;
+  }
+  cipher_ = cipher;
+  std::memcpy(key_, key, kAeadKeySize);
+#if defined(ZS_AEAD_X86)
+  if (cipher == AeadCipher::kAes256Gcm) AesGcmSetup(key, aes_);
+#endif
+  return true;
+}
+
+void Aead::Seal(const uint8_t nonce[kAeadNonceSize], const uint8_t* aad,
+                size_t aad_len, uint8_t* data, size_t len,
+                uint8_t tag[kAeadTagSize]) const {
+#if defined(ZS_AEAD_X86)
+  if (cipher_ == AeadCipher::kAes256Gcm) {
+    AesGcmSeal(aes_, nonce, aad, aad_len, data, len, tag);
+    return;
+  }
+#endif
+  uint32_t state[16];
+  uint8_t poly_key[64];
+  ChaChaInit(state, key_, nonce, 0);
+  ChaChaBlock(state, poly_key);
+  state[12] = 1;
+  ChaChaXor(state, data, len);
+  ChaChaPolyTag(poly_key, aad, aad_len, data, len, tag);
+}
+
+bool Aead::Open(const uint8_t nonce[kAeadNonceSize], const uint8_t* aad,
+                size_t aad_len, uint8_t* data, size_t len,
+                const uint8_t tag[kAeadTagSize]) const {
+#if defined(ZS_AEAD_X86)
+  if (cipher_ == AeadCipher::kAes256Gcm) {
+    return AesGcmOpen(aes_, nonce, aad, aad_len, data, len, tag);
+  }
+#endif
+  if (cipher_ != AeadCipher::kChaCha20Poly1305) return false;
+  uint32_t state[16];
+  uint8_t poly_key[64];
+  ChaChaInit(state, key_, nonce, 0);
+  ChaChaBlock(state, poly_key);
+  uint8_t expected[kAeadTagSize];
+  ChaChaPolyTag(poly_key, aad, aad_len, data, len, expected);
+  if (!TagsEqual(expected, tag)) return false;
+  state[12] = 1;
+  ChaChaXor(state, data, len);
+  return true;
+}
+
+}  // namespace zapshare
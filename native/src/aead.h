@@ -0,0 +1,63 @@
+#ifndef ZAPSHARE_NATIVE_AEAD_H_
+#define ZAPSHARE_NATIVE_AEAD_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace zapshare {
+
+constexpr size_t kAeadKeySize = 32;
+constexpr size_t kAeadNonceSize = 12;
+constexpr size_t kAeadTagSize = 16;
+
+// Cipher ids, also used as bits in the mask peers offer during the
+// handshake.
+enum class AeadCipher : uint32_t {
+  kNone = 0,
+  kAes256Gcm = 1,         // Only where the CPU has AES and carry-less multiply.
+  kChaCha20Poly1305 = 2,  // Everywhere else.
+};
+
+// Ciphers this machine can run at line rate: ChaCha20-Poly1305 always,
+// AES-256-GCM when the CPU has AES-NI and PCLMULQDQ.
+uint32_t AeadSupportedCiphers();
+
+// AES-256-GCM or ChaCha20-Poly1305 (RFC 8439) over a buffer in place: the
+// ciphertext overwrites the plaintext and the 16-byte tag goes to a
+// separate pointer, so a record can be sealed inside the buffer it was
+// read into.
+//
+// AES-GCM runs eight counter blocks at a time through AES-NI and hashes the
+// eight ciphertext blocks beside them with PCLMULQDQ, so the data is read
+// once. ChaCha20 does four blocks at a time with SSE2 on x86-64 and
+// Poly1305 uses 26-bit limbs, so both stay portable to 32-bit ARM and MSVC.
+class Aead {
+ public:
+  Aead() = default;
+  ~Aead();
+  Aead(const Aead&) = delete;
+  Aead& operator=(const Aead&) = delete;
+
+  // False if |cipher| isn't supported here.
+  bool Init(AeadCipher cipher, const uint8_t key[kAeadKeySize]);
+
+  void Seal(const uint8_t nonce[kAeadNonceSize], const uint8_t* aad,
+            size_t aad_len, uint8_t* data, size_t len,
+            uint8_t tag[kAeadTagSize]) const;
+  // Verifies before decrypting; on failure |data| is left untouched.
+  bool Open(const uint8_t nonce[kAeadNonceSize], const uint8_t* aad,
+            size_t aad_len, uint8_t* data, size_t len,
+            const uint8_t tag[kAeadTagSize]) const;
+
+  AeadCipher cipher() const { return cipher_; }
+
+ private:
+  AeadCipher cipher_ = AeadCipher::kNone;
+  uint8_t key_[kAeadKeySize] = {};
+  // AES-GCM: 15 round keys, then H^1..H^8 byte-reflected for GHASH.
+  alignas(16) uint8_t aes_[23 * 16] = {};
+};
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_AEAD_H_
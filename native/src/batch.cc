@@ -0,0 +1,479 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint8_t kMagic[4] = {'Z', 'S', 'B', '1'};
+constexpr uint8_t kTagFile = 'F';
+constexpr uint8_t kTagSkip = 'S';
+constexpr uint8_t kTagEnd = 'E';
+constexpr size_t kFileHeaderSize = 4 + 8 + 2;
+constexpr uint32_t kMaxThreads = 4;
+constexpr int kMaxRenames = 10000;
+constexpr std::chrono::seconds kIdleWake(1);
+
+#if defined(_WIN32)
+constexpr char kSeparator = '\\';
+#else
+constexpr char kSeparator = '/';
+#endif
+
+uint32_t LoadLe32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+uint64_t LoadLe64(const uint8_t* p) {
+  return LoadLe32(p) | static_cast<uint64_t>(LoadLe32(p + 4)) << 32;
+}
+
+void PutLe(std::vector<uint8_t>* out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out->push_back(static_cast<uint8_t>(v >> 8 * i));
+  }
+}
+
+// Last path component, with characters Windows rejects replaced, so a
+// sender can't write outside the destination or produce an unopenable name.
+std::string SafeName(const std::string& name) {
+  const size_t slash = name.find_last_of("/\\");
+  std::string out = slash == std::string::npos ? name : name.substr(slash + 1);
+  for (char& c : out) {
+    if (static_cast<unsigned char>(c) < 0x20 || std::strchr("<>:\"|?*", c)) {
+      c = '_';
+    }
+  }
+  while (!out.empty() && (out.back() == '.' || out.back() == ' ')) {
+    out.pop_back();
+  }
+  return out.empty() ? "file" : out;
+}
+
+// `name`, `name_1`, `name_2`… keeping the extension, like the app's own
+// save-path logic.
+std::string Candidate(const std::string& name, int n) {
+  if (n == 0) return name;
+  const size_t dot = name.find_last_of('.');
+  const std::string suffix = "_" + std::to_string(n);
+  if (dot == std::string::npos || dot == 0) return name + suffix;
+  return name.substr(0, dot) + suffix + name.substr(dot);
+}
+
+enum class CreateResult { kOk, kExists, kFailed };
+
+// Creates |path| only if it doesn't exist yet and writes |data| to it.
+CreateResult WriteNewFile(const std::string& path, const uint8_t* data,
+                          size_t len) {
+#if defined(_WIN32)
+  HANDLE file = CreateFileW(WidenPath(path).c_str(), GENERIC_WRITE, 0,
+                            nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError() == ERROR_FILE_EXISTS ? CreateResult::kExists
+                                               : CreateResult::kFailed;
+  }
+  bool ok = true;
+  while (ok && len > 0) {
+    const DWORD want = static_cast<DWORD>(std::min<size_t>(len, 1 << 30));
+    DWORD wrote = 0;
+    ok = WriteFile(file, data, want, &wrote, nullptr) && wrote > 0;
+    data += wrote;
+    len -= wrote;
+  }
+  ok = CloseHandle(file) && ok;
+#else
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                      0644);
+  if (fd < 0) {
+    return errno == EEXIST ? CreateResult::kExists : CreateResult::kFailed;
+  }
+  bool ok = true;
+  while (ok && len > 0) {
+    const ssize_t wrote = write(fd, data, len);
+    if (wrote < 0 && errno == EINTR) continue;
+    ok = wrote > 0;
+    if (ok) {
+      data += wrote;
+      len -= static_cast<size_t>(wrote);
+    }
+  }
+  ok = close(fd) == 0 && ok;
+#endif
+  if (ok) return CreateResult::kOk;
+  RemoveFile(path);
+  return CreateResult::kFailed;
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// BatchWriter
+
+BatchWriter::BatchWriter() { out_.assign(kMagic, kMagic + 4); }
+
+void BatchWriter::BeginFile(uint32_t index, const std::string& name,
+                            uint64_t size) {
+  const size_t name_len = std::min<size_t>(name.size(), 0xFFFF);
+  out_.push_back(kTagFile);
+  PutLe(&out_, index, 4);
+  PutLe(&out_, size, 8);
+  PutLe(&out_, name_len, 2);
+  out_.insert(out_.end(), name.begin(), name.begin() + name_len);
+  hasher_.reset(new ChunkHasher(size, kDefaultDigestChunkSize));
+  size_ = size;
+  fed_ = 0;
+}
+
+void BatchWriter::Update(const uint8_t* data, size_t len) {
+  if (hasher_ == nullptr) return;
+  hasher_->Update(fed_, data, len);
+  fed_ += len;
+}
+
+bool BatchWriter::EndFile() {
+  Digest digest;
+  const bool ok =
+      hasher_ != nullptr && fed_ == size_ && hasher_->FileDigest(&digest);
+  hasher_.reset();
+  if (!ok) return false;
+  out_.insert(out_.end(), digest.begin(), digest.end());
+  sent_++;
+  return true;
+}
+
+void BatchWriter::SkipFile(uint32_t index) {
+  out_.push_back(kTagSkip);
+  PutLe(&out_, index, 4);
+  sent_++;
+}
+
+void BatchWriter::Finish() {
+  out_.push_back(kTagEnd);
+  PutLe(&out_, sent_, 4);
+}
+
+size_t BatchWriter::Read(uint8_t* out, size_t cap) {
+  const size_t n = std::min(cap, Pending());
+  std::memcpy(out, out_.data() + out_read_, n);
+  out_read_ += n;
+  if (out_read_ == out_.size()) {
+    out_.clear();
+    out_read_ = 0;
+  }
+  return n;
+}
+
+// ---------------------------------------------------------------------------
+// BatchReceiver
+
+BatchReceiver::BatchReceiver(const std::string& dir, uint32_t threads)
+    : dir_(dir) {
+  if (threads == 0) {
+    threads = std::clamp(std::thread::hardware_concurrency(), 1u, kMaxThreads);
+  }
+  for (uint32_t i = 0; i < threads; i++) {
+    workers_.emplace_back(&BatchReceiver::Work, this);
+  }
+}
+
+BatchReceiver::~BatchReceiver() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& t : workers_) t.join();
+}
+
+bool BatchReceiver::Update(const uint8_t* data, size_t len) {
+  while (!failed_ && (len > 0 || (state_ != State::kData &&
+                                  state_ != State::kDone &&
+                                  field_.size() == field_need_))) {
+    if (state_ == State::kData) {
+      Job& job = *current_;
+      const size_t take = std::min(len, job.size - job.data.size());
+      job.data.insert(job.data.end(), data, data + take);
+      data += take;
+      len -= take;
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        in_flight_ += take;
+      }
+      if (job.data.size() == job.size) {
+        state_ = State::kDigest;
+        field_need_ = job.digest.size();
+      }
+      continue;
+    }
+    if (state_ == State::kDone) {
+      Fail();  // Bytes after the end record.
+      break;
+    }
+
+    const size_t take = std::min(len, field_need_ - field_.size());
+    field_.insert(field_.end(), data, data + take);
+    data += take;
+    len -= take;
+    if (field_.size() < field_need_) break;
+
+    const uint8_t* f = field_.data();
+    switch (state_) {
+      case State::kMagic:
+        if (std::memcmp(f, kMagic, 4) != 0) Fail();
+        state_ = State::kTag;
+        field_need_ = 1;
+        break;
+      case State::kTag:
+        if (f[0] == kTagFile) {
+          state_ = State::kHeader;
+          field_need_ = kFileHeaderSize;
+        } else if (f[0] == kTagSkip) {
+          state_ = State::kSkip;
+          field_need_ = 4;
+        } else if (f[0] == kTagEnd) {
+          state_ = State::kEnd;
+          field_need_ = 4;
+        } else {
+          Fail();
+        }
+        break;
+      case State::kHeader: {
+        const uint64_t size = LoadLe64(f + 4);
+        if (size > kBatchMaxFileSize) {
+          Fail();
+          break;
+        }
+        current_.reset(new Job);
+        current_->index = LoadLe32(f);
+        current_->size = static_cast<size_t>(size);
+        current_->data.reserve(current_->size);
+        state_ = State::kName;
+        field_need_ = static_cast<size_t>(f[12]) | static_cast<size_t>(f[13])
+                                                       << 8;
+        break;
+      }
+      case State::kName:
+        current_->name.assign(field_.begin(), field_.end());
+        if (current_->size == 0) {
+          state_ = State::kDigest;
+          field_need_ = current_->digest.size();
+        } else {
+          state_ = State::kData;
+        }
+        break;
+      case State::kDigest: {
+        std::memcpy(current_->digest.data(), f, current_->digest.size());
+        {
+          std::lock_guard<std::mutex> lock(mu_);
+          queue_.push_back(std::move(current_));
+        }
+        work_cv_.notify_one();
+        files_++;
+        state_ = State::kTag;
+        field_need_ = 1;
+        break;
+      }
+      case State::kSkip: {
+        std::lock_guard<std::mutex> lock(mu_);
+        results_.push_back({LoadLe32(f), BatchFileStatus::kSkipped, "", {}});
+        files_++;
+        state_ = State::kTag;
+        field_need_ = 1;
+        break;
+      }
+      case State::kEnd:
+        if (LoadLe32(f) != files_) Fail();
+        complete_ = !failed_;
+        state_ = State::kDone;
+        break;
+      case State::kData:
+      case State::kDone:
+        break;
+    }
+    field_.clear();
+  }
+  return !failed_;
+}
+
+uint64_t BatchReceiver::BytesInFlight() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return in_flight_;
+}
+
+bool BatchReceiver::Busy() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return !queue_.empty() || active_ > 0;
+}
+
+bool BatchReceiver::NextResult(BatchResult* out) {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (results_.empty()) return false;
+  *out = std::move(results_.front());
+  results_.pop_front();
+  return true;
+}
+
+void BatchReceiver::Work() {
+  while (true) {
+    std::unique_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      if (!work_cv_.wait_for(lock, kIdleWake,
+                             [this] { return stop_ || !queue_.empty(); })) {
+        continue;
+      }
+      if (stop_) return;
+      job = std::move(queue_.front());
+      queue_.pop_front();
+      active_++;
+    }
+    Process(job.get());
+  }
+}
+
+void BatchReceiver::Process(Job* job) {
+  BatchResult result{job->index, BatchFileStatus::kCorrupt, "", {}};
+  ChunkHasher hasher(job->data.size(), kDefaultDigestChunkSize);
+  hasher.Update(0, job->data.data(), job->data.size());
+  Digest digest;
+  if (hasher.FileDigest(&digest) && digest == job->digest) {
+    result.status = BatchFileStatus::kIoError;
+    const std::string name = SafeName(job->name);
+    std::string base = dir_;
+    if (!base.empty() && base.back() != '/' && base.back() != kSeparator) {
+      base += kSeparator;
+    }
+    for (int n = 0; n < kMaxRenames; n++) {
+      const std::string path = base + Candidate(name, n);
+      const CreateResult r =
+          WriteNewFile(path, job->data.data(), job->data.size());
+      if (r == CreateResult::kExists) continue;
+      if (r == CreateResult::kOk) {
+        result.status = BatchFileStatus::kWritten;
+        result.path = path;
+        result.digest = digest;
+      }
+      break;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mu_);
+  active_--;
+  in_flight_ -= job->data.size();
+  results_.push_back(std::move(result));
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::BatchWriter* Unwrap(ZsBatchWriter* w) {
+  return reinterpret_cast<zapshare::BatchWriter*>(w);
+}
+
+const zapshare::BatchWriter* Unwrap(const ZsBatchWriter* w) {
+  return reinterpret_cast<const zapshare::BatchWriter*>(w);
+}
+
+zapshare::BatchReceiver* Unwrap(ZsBatchReceiver* r) {
+  return reinterpret_cast<zapshare::BatchReceiver*>(r);
+}
+
+const zapshare::BatchReceiver* Unwrap(const ZsBatchReceiver* r) {
+  return reinterpret_cast<const zapshare::BatchReceiver*>(r);
+}
+
+}  // namespace
+
+ZsBatchWriter* zs_batch_writer_new(void) {
+  return reinterpret_cast<ZsBatchWriter*>(new zapshare::BatchWriter());
+}
+
+void zs_batch_writer_free(ZsBatchWriter* writer) { delete Unwrap(writer); }
+
+void zs_batch_writer_begin_file(ZsBatchWriter* writer, uint32_t index,
+                                const char* name, uint64_t size) {
+  Unwrap(writer)->BeginFile(index, name, size);
+}
+
+void zs_batch_writer_update(ZsBatchWriter* writer, const uint8_t* data,
+                            size_t len) {
+  Unwrap(writer)->Update(data, len);
+}
+
+int32_t zs_batch_writer_end_file(ZsBatchWriter* writer) {
+  return Unwrap(writer)->EndFile() ? 1 : 0;
+}
+
+void zs_batch_writer_skip_file(ZsBatchWriter* writer, uint32_t index) {
+  Unwrap(writer)->SkipFile(index);
+}
+
+void zs_batch_writer_finish(ZsBatchWriter* writer) {
+  Unwrap(writer)->Finish();
+}
+
+size_t zs_batch_writer_pending(const ZsBatchWriter* writer) {
+  return Unwrap(writer)->Pending();
+}
+
+size_t zs_batch_writer_read(ZsBatchWriter* writer, uint8_t* out,
+                            size_t cap) {
+  return Unwrap(writer)->Read(out, cap);
+}
+
+ZsBatchReceiver* zs_batch_receiver_new(const char* dir, uint32_t threads) {
+  return reinterpret_cast<ZsBatchReceiver*>(
+      new zapshare::BatchReceiver(dir, threads));
+}
+
+void zs_batch_receiver_free(ZsBatchReceiver* receiver) {
+  delete Unwrap(receiver);
+}
+
+int32_t zs_batch_receiver_update(ZsBatchReceiver* receiver,
+                                 const uint8_t* data, size_t len) {
+  return Unwrap(receiver)->Update(data, len) ? 1 : 0;
+}
+
+uint64_t zs_batch_receiver_in_flight(const ZsBatchReceiver* receiver) {
+  return Unwrap(receiver)->BytesInFlight();
+}
+
+int32_t zs_batch_receiver_state(const ZsBatchReceiver* receiver) {
+  const zapshare::BatchReceiver* r = Unwrap(receiver);
+  return (r->Busy() ? 1 : 0) | (r->complete() ? 2 : 0) |
+         (r->failed() ? 4 : 0);
+}
+
+int32_t zs_batch_receiver_next(ZsBatchReceiver* receiver, uint32_t* index,
+                               int32_t* status, uint8_t digest[32],
+                               char* path, size_t path_cap) {
+  zapshare::BatchResult result;
+  if (!Unwrap(receiver)->NextResult(&result)) return 0;
+  *index = result.index;
+  *status = static_cast<int32_t>(result.status);
+  std::memcpy(digest, result.digest.data(), result.digest.size());
+  if (path_cap > 0) {
+    const size_t n = std::min(result.path.size(), path_cap - 1);
+    std::memcpy(path, result.path.data(), n);
+    path[n] = '\0';
+  }
+  return 1;
+}
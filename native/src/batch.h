@@ -0,0 +1,179 @@
+#ifndef ZAPSHARE_NATIVE_BATCH_H_
+#define ZAPSHARE_NATIVE_BATCH_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "content_hash.h"
+#include "export.h"
+
+namespace zapshare {
+
+// Many small files streamed back to back over one connection.
+//
+// A plain GET costs a connection, a metadata exchange and a stop-and-wait
+// ACK per file, which for a few thousand photos adds up to more time than
+// the bytes themselves. A batch answers one request for a list of files
+// with a single stream and no per-file acknowledgement; each file carries
+// its digest, so the receiver checks files individually instead.
+//
+// Container, little-endian:
+//   "ZSB1" | record* | 'E' | le32 files sent
+//   record = 'F' le32 index, le64 size, le16 name length, name, data,
+//                32-byte ChunkHasher file digest (default chunk size)
+//          | 'S' le32 index                      (unreadable on the sender)
+
+constexpr uint64_t kBatchMaxFileSize = 64 * 1024 * 1024;
+
+// Sender side. File data goes to the socket directly; the writer only
+// produces the framing and hashes the bytes on their way past.
+class BatchWriter {
+ public:
+  BatchWriter();
+
+  void BeginFile(uint32_t index, const std::string& name, uint64_t size);
+  void Update(const uint8_t* data, size_t len);
+  // False if the file didn't have the announced size; the stream is then
+  // unusable and the connection should be dropped.
+  bool EndFile();
+  void SkipFile(uint32_t index);
+  void Finish();
+
+  size_t Pending() const { return out_.size() - out_read_; }
+  size_t Read(uint8_t* out, size_t cap);
+
+ private:
+  std::unique_ptr<ChunkHasher> hasher_;
+  uint64_t size_ = 0;
+  uint64_t fed_ = 0;
+  uint32_t sent_ = 0;
+  std::vector<uint8_t> out_;
+  size_t out_read_ = 0;
+};
+
+enum class BatchFileStatus : int32_t {
+  kWritten = 0,
+  kCorrupt = 1,   // Digest mismatch; nothing was written.
+  kIoError = 2,   // Could not create or write the file.
+  kSkipped = 3,   // The sender couldn't read it.
+};
+
+struct BatchResult {
+  uint32_t index;
+  BatchFileStatus status;
+  std::string path;  // Where the file was written, when kWritten.
+  Digest digest;     // Verified file digest, when kWritten.
+};
+
+// Receiver side. Parses the container on the caller's thread and hands
+// each complete file to a pool of threads that verify its digest, create
+// it in the destination directory (as `name_1.ext` etc. if taken) and
+// write it. Names are reduced to a single path component.
+class BatchReceiver {
+ public:
+  // |threads| 0 picks one per core, up to 4.
+  BatchReceiver(const std::string& dir, uint32_t threads);
+  ~BatchReceiver();
+
+  BatchReceiver(const BatchReceiver&) = delete;
+  BatchReceiver& operator=(const BatchReceiver&) = delete;
+
+  // False once the stream is malformed; later calls are ignored.
+  bool Update(const uint8_t* data, size_t len);
+
+  // File bytes received but not yet on disk. Callers stop reading from the
+  // socket while this is high.
+  uint64_t BytesInFlight() const;
+  // True while files are queued or being written.
+  bool Busy() const;
+  // True once the end record arrived and matched the files received.
+  bool complete() const { return complete_; }
+  bool failed() const { return failed_; }
+
+  // Pops the next finished file; false if none is ready.
+  bool NextResult(BatchResult* out);
+
+ private:
+  struct Job {
+    uint32_t index;
+    std::string name;
+    size_t size;
+    std::vector<uint8_t> data;
+    Digest digest;
+  };
+
+  enum class State { kMagic, kTag, kHeader, kName, kData, kDigest, kSkip,
+                     kEnd, kDone };
+
+  void Work();
+  void Process(Job* job);
+  void Fail() { failed_ = true; }
+
+  const std::string dir_;
+  std::vector<std::thread> workers_;
+
+  State state_ = State::kMagic;
+  std::vector<uint8_t> field_;  // Partial fixed-size field.
+  size_t field_need_ = 4;
+  std::unique_ptr<Job> current_;
+  uint32_t files_ = 0;
+  bool complete_ = false;
+  bool failed_ = false;
+
+  mutable std::mutex mu_;
+  std::condition_variable work_cv_;
+  std::deque<std::unique_ptr<Job>> queue_;
+  std::deque<BatchResult> results_;
+  uint64_t in_flight_ = 0;
+  uint32_t active_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsBatchWriter ZsBatchWriter;
+typedef struct ZsBatchReceiver ZsBatchReceiver;
+
+ZS_EXPORT ZsBatchWriter* zs_batch_writer_new(void);
+ZS_EXPORT void zs_batch_writer_free(ZsBatchWriter* writer);
+ZS_EXPORT void zs_batch_writer_begin_file(ZsBatchWriter* writer,
+                                          uint32_t index, const char* name,
+                                          uint64_t size);
+ZS_EXPORT void zs_batch_writer_update(ZsBatchWriter* writer,
+                                      const uint8_t* data, size_t len);
+ZS_EXPORT int32_t zs_batch_writer_end_file(ZsBatchWriter* writer);
+ZS_EXPORT void zs_batch_writer_skip_file(ZsBatchWriter* writer,
+                                         uint32_t index);
+ZS_EXPORT void zs_batch_writer_finish(ZsBatchWriter* writer);
+ZS_EXPORT size_t zs_batch_writer_pending(const ZsBatchWriter* writer);
+ZS_EXPORT size_t zs_batch_writer_read(ZsBatchWriter* writer, uint8_t* out,
+                                      size_t cap);
+
+ZS_EXPORT ZsBatchReceiver* zs_batch_receiver_new(const char* dir,
+                                                 uint32_t threads);
+ZS_EXPORT void zs_batch_receiver_free(ZsBatchReceiver* receiver);
+ZS_EXPORT int32_t zs_batch_receiver_update(ZsBatchReceiver* receiver,
+                                           const uint8_t* data, size_t len);
+ZS_EXPORT uint64_t zs_batch_receiver_in_flight(
+    const ZsBatchReceiver* receiver);
+// Bit 0: busy, bit 1: complete, bit 2: failed.
+ZS_EXPORT int32_t zs_batch_receiver_state(const ZsBatchReceiver* receiver);
+// Returns 1 and fills |index|, |status|, |digest| and the NUL-terminated
+// |path| (cut to |path_cap|) when a result was ready.
+ZS_EXPORT int32_t zs_batch_receiver_next(ZsBatchReceiver* receiver,
+                                         uint32_t* index, int32_t* status,
+                                         uint8_t digest[32], char* path,
+                                         size_t path_cap);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_BATCH_H_
@@ -0,0 +1,381 @@
+#include "blake3.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define ZS_BLAKE3_SSE2 1
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint32_t kIv[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                             0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+constexpr uint8_t kChunkStart = 1 << 0;
+constexpr uint8_t kChunkEnd = 1 << 1;
+constexpr uint8_t kParent = 1 << 2;
+constexpr uint8_t kRoot = 1 << 3;
+
+constexpr uint8_t kMsgPermutation[16] = {2, 6,  3,  10, 7, 0,  4,  13,
+                                         1, 11, 12, 5,  9, 14, 15, 8};
+
+using Schedule = std::array<std::array<uint8_t, 16>, 7>;
+
+// Round r reads message word kSchedule[r][i] where the reference
+// implementation would permute the message in place between rounds.
+constexpr Schedule MakeSchedule() {
+  Schedule s{};
+  for (uint8_t i = 0; i < 16; i++) s[0][i] = i;
+  for (size_t r = 1; r < 7; r++) {
+    for (size_t i = 0; i < 16; i++) s[r][i] = s[r - 1][kMsgPermutation[i]];
+  }
+  return s;
+}
+
+constexpr Schedule kSchedule = MakeSchedule();
+
+inline uint32_t Load32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline void Store32(uint8_t* p, uint32_t v) {
+  p[0] = static_cast<uint8_t>(v);
+  p[1] = static_cast<uint8_t>(v >> 8);
+  p[2] = static_cast<uint8_t>(v >> 16);
+  p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+inline uint32_t Rotr(uint32_t x, int c) { return (x >> c) | (x << (32 - c)); }
+
+inline void G(uint32_t* s, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+  s[a] = s[a] + s[b] + x;
+  s[d] = Rotr(s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = Rotr(s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + y;
+  s[d] = Rotr(s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = Rotr(s[b] ^ s[c], 7);
+}
+
+void CompressState(uint32_t state[16], const uint32_t cv[8],
+                   const uint8_t block[kBlake3BlockLen], uint8_t block_len,
+                   uint64_t counter, uint8_t flags) {
+  uint32_t m[16];
+  for (int i = 0; i < 16; i++) m[i] = Load32(block + 4 * i);
+
+  for (int i = 0; i < 8; i++) state[i] = cv[i];
+  state[8] = kIv[0];
+  state[9] = kIv[1];
+  state[10] = kIv[2];
+  state[11] = kIv[3];
+  state[12] = static_cast<uint32_t>(counter);
+  state[13] = static_cast<uint32_t>(counter >> 32);
+  state[14] = block_len;
+  state[15] = flags;
+
+  for (const auto& s : kSchedule) {
+    G(state, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    G(state, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    G(state, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    G(state, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    G(state, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    G(state, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    G(state, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    G(state, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+}
+
+void CompressInPlace(uint32_t cv[8], const uint8_t block[kBlake3BlockLen],
+                     uint8_t block_len, uint64_t counter, uint8_t flags) {
+  uint32_t state[16];
+  CompressState(state, cv, block, block_len, counter, flags);
+  for (int i = 0; i < 8; i++) cv[i] = state[i] ^ state[i + 8];
+}
+
+void ParentCv(const uint32_t left[8], const uint32_t right[8],
+              uint32_t out[8]) {
+  uint8_t block[kBlake3BlockLen];
+  for (int i = 0; i < 8; i++) {
+    Store32(block + 4 * i, left[i]);
+    Store32(block + 32 + 4 * i, right[i]);
+  }
+  std::memcpy(out, kIv, sizeof(kIv));
+  CompressInPlace(out, block, kBlake3BlockLen, 0, kParent);
+}
+
+// Chaining value of one complete 1 KB chunk that is known not to be the root.
+void HashChunkPortable(const uint8_t* chunk, uint64_t counter,
+                       uint32_t out[8]) {
+  std::memcpy(out, kIv, sizeof(kIv));
+  for (size_t b = 0; b < kBlake3ChunkLen / kBlake3BlockLen; b++) {
+    int flags = 0;
+    if (b == 0) flags |= kChunkStart;
+    if (b == kBlake3ChunkLen / kBlake3BlockLen - 1) flags |= kChunkEnd;
+    CompressInPlace(out, chunk + b * kBlake3BlockLen, kBlake3BlockLen,
+                    counter, static_cast<uint8_t>(flags));
+  }
+}
+
+#if defined(ZS_BLAKE3_SSE2)
+
+inline __m128i Add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+inline __m128i Xor(__m128i a, __m128i b) { return _mm_xor_si128(a, b); }
+
+inline __m128i Rot16(__m128i x) {
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+}
+inline __m128i Rot12(__m128i x) {
+  return _mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 20));
+}
+inline __m128i Rot8(__m128i x) {
+  return _mm_or_si128(_mm_srli_epi32(x, 8), _mm_slli_epi32(x, 24));
+}
+inline __m128i Rot7(__m128i x) {
+  return _mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25));
+}
+
+inline void G4(__m128i* v, int a, int b, int c, int d, __m128i x, __m128i y) {
+  v[a] = Add(Add(v[a], v[b]), x);
+  v[d] = Rot16(Xor(v[d], v[a]));
+  v[c] = Add(v[c], v[d]);
+  v[b] = Rot12(Xor(v[b], v[c]));
+  v[a] = Add(Add(v[a], v[b]), y);
+  v[d] = Rot8(Xor(v[d], v[a]));
+  v[c] = Add(v[c], v[d]);
+  v[b] = Rot7(Xor(v[b], v[c]));
+}
+
+inline void Transpose4(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+  __m128i t0 = _mm_unpacklo_epi32(a, b);
+  __m128i t1 = _mm_unpacklo_epi32(c, d);
+  __m128i t2 = _mm_unpackhi_epi32(a, b);
+  __m128i t3 = _mm_unpackhi_epi32(c, d);
+  a = _mm_unpacklo_epi64(t0, t1);
+  b = _mm_unpackhi_epi64(t0, t1);
+  c = _mm_unpacklo_epi64(t2, t3);
+  d = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Chaining values of four consecutive, complete chunks. Each vector lane
+// carries one chunk through the compression function.
+void HashFourChunks(const uint8_t* input, uint64_t counter, uint32_t out[4][8]) {
+  __m128i h[8];
+  for (int i = 0; i < 8; i++) h[i] = _mm_set1_epi32(static_cast<int>(kIv[i]));
+
+  uint32_t lo[4];
+  uint32_t hi[4];
+  for (int lane = 0; lane < 4; lane++) {
+    uint64_t c = counter + lane;
+    lo[lane] = static_cast<uint32_t>(c);
+    hi[lane] = static_cast<uint32_t>(c >> 32);
+  }
+  const __m128i counter_lo = _mm_setr_epi32(
+      static_cast<int>(lo[0]), static_cast<int>(lo[1]),
+      static_cast<int>(lo[2]), static_cast<int>(lo[3]));
+  const __m128i counter_hi = _mm_setr_epi32(
+      static_cast<int>(hi[0]), static_cast<int>(hi[1]),
+      static_cast<int>(hi[2]), static_cast<int>(hi[3]));
+  const __m128i block_len = _mm_set1_epi32(kBlake3BlockLen);
+
+  for (size_t b = 0; b < kBlake3ChunkLen / kBlake3BlockLen; b++) {
+    __m128i m[16];
+    for (int j = 0; j < 4; j++) {
+      const uint8_t* p = input + b * kBlake3BlockLen + 16 * j;
+      m[4 * j + 0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      m[4 * j + 1] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(p + kBlake3ChunkLen));
+      m[4 * j + 2] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(p + 2 * kBlake3ChunkLen));
+      m[4 * j + 3] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(p + 3 * kBlake3ChunkLen));
+      Transpose4(m[4 * j + 0], m[4 * j + 1], m[4 * j + 2], m[4 * j + 3]);
+    }
+
+    int flags = 0;
+    if (b == 0) flags |= kChunkStart;
+    if (b == kBlake3ChunkLen / kBlake3BlockLen - 1) flags |= kChunkEnd;
+
+    __m128i v[16];
+    for (int i = 0; i < 8; i++) v[i] = h[i];
+    for (int i = 0; i < 4; i++) {
+      v[8 + i] = _mm_set1_epi32(static_cast<int>(kIv[i]));
+    }
+    v[12] = counter_lo;
+    v[13] = counter_hi;
+    v[14] = block_len;
+    v[15] = _mm_set1_epi32(flags);
+
+    for (const auto& s : kSchedule) {
+      G4(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+      G4(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+      G4(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+      G4(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+      G4(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+      G4(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+      G4(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+      G4(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; i++) h[i] = Xor(v[i], v[i + 8]);
+  }
+
+  Transpose4(h[0], h[1], h[2], h[3]);
+  Transpose4(h[4], h[5], h[6], h[7]);
+  for (int lane = 0; lane < 4; lane++) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&out[lane][0]), h[lane]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&out[lane][4]), h[4 + lane]);
+  }
+}
+
+#endif  // ZS_BLAKE3_SSE2
+
+}  // namespace
+
+void Blake3::ChunkState::Init(uint64_t chunk_counter) {
+  std::memcpy(cv, kIv, sizeof(kIv));
+  counter = chunk_counter;
+  std::memset(block, 0, sizeof(block));
+  block_len = 0;
+  blocks_compressed = 0;
+}
+
+uint8_t Blake3::ChunkState::StartFlag() const {
+  return blocks_compressed == 0 ? kChunkStart : 0;
+}
+
+void Blake3::ChunkState::Update(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    if (block_len == kBlake3BlockLen) {
+      CompressInPlace(cv, block, kBlake3BlockLen, counter, StartFlag());
+      blocks_compressed++;
+      std::memset(block, 0, sizeof(block));
+      block_len = 0;
+    }
+    size_t take = kBlake3BlockLen - block_len;
+    if (take > len) take = len;
+    std::memcpy(block + block_len, data, take);
+    block_len = static_cast<uint8_t>(block_len + take);
+    data += take;
+    len -= take;
+  }
+}
+
+Blake3::Blake3() { Reset(); }
+
+void Blake3::Reset() {
+  chunk_.Init(0);
+  cv_stack_len_ = 0;
+}
+
+bool Blake3::HasSimd() {
+#if defined(ZS_BLAKE3_SSE2)
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Blake3::PushCv(const uint32_t cv[8], uint64_t total_chunks) {
+  uint32_t merged[8];
+  std::memcpy(merged, cv, sizeof(merged));
+  // Every trailing zero bit in the chunk count completes one subtree.
+  while ((total_chunks & 1) == 0) {
+    cv_stack_len_--;
+    ParentCv(cv_stack_[cv_stack_len_], merged, merged);
+    total_chunks >>= 1;
+  }
+  std::memcpy(cv_stack_[cv_stack_len_], merged, sizeof(merged));
+  cv_stack_len_++;
+}
+
+void Blake3::Update(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    if (chunk_.Len() == kBlake3ChunkLen) {
+      uint32_t cv[8];
+      std::memcpy(cv, chunk_.cv, sizeof(cv));
+      CompressInPlace(cv, chunk_.block, chunk_.block_len, chunk_.counter,
+                      static_cast<uint8_t>(chunk_.StartFlag() | kChunkEnd));
+      uint64_t total = chunk_.counter + 1;
+      PushCv(cv, total);
+      chunk_.Init(total);
+    }
+
+    // Whole chunks that are definitely not the last one skip the chunk
+    // buffer. At least one byte is always left so the final chunk stays
+    // in chunk_ and can become the root.
+    if (chunk_.Len() == 0 && len > kBlake3ChunkLen) {
+      size_t chunks = (len - 1) / kBlake3ChunkLen;
+      uint64_t counter = chunk_.counter;
+      size_t i = 0;
+#if defined(ZS_BLAKE3_SSE2)
+      for (; i + 4 <= chunks; i += 4) {
+        uint32_t cvs[4][8];
+        HashFourChunks(data + i * kBlake3ChunkLen, counter + i, cvs);
+        for (int lane = 0; lane < 4; lane++) {
+          PushCv(cvs[lane], counter + i + lane + 1);
+        }
+      }
+#endif
+      for (; i < chunks; i++) {
+        uint32_t cv[8];
+        HashChunkPortable(data + i * kBlake3ChunkLen, counter + i, cv);
+        PushCv(cv, counter + i + 1);
+      }
+      data += chunks * kBlake3ChunkLen;
+      len -= chunks * kBlake3ChunkLen;
+      chunk_.Init(counter + chunks);
+      continue;
+    }
+
+    size_t take = kBlake3ChunkLen - chunk_.Len();
+    if (take > len) take = len;
+    chunk_.Update(data, take);
+    data += take;
+    len -= take;
+  }
+}
+
+void Blake3::Final(uint8_t out[kBlake3OutLen]) const {
+  // The last node is compressed with the ROOT flag; everything above the
+  // current chunk is folded in from the stack first.
+  uint32_t input_cv[8];
+  uint8_t block[kBlake3BlockLen];
+  uint8_t block_len = chunk_.block_len;
+  uint8_t flags = static_cast<uint8_t>(chunk_.StartFlag() | kChunkEnd);
+  uint64_t counter = chunk_.counter;
+  std::memcpy(input_cv, chunk_.cv, sizeof(input_cv));
+  std::memcpy(block, chunk_.block, sizeof(block));
+
+  for (int i = cv_stack_len_ - 1; i >= 0; i--) {
+    uint32_t right[8];
+    std::memcpy(right, input_cv, sizeof(right));
+    CompressInPlace(right, block, block_len, counter, flags);
+    for (int w = 0; w < 8; w++) {
+      Store32(block + 4 * w, cv_stack_[i][w]);
+      Store32(block + 32 + 4 * w, right[w]);
+    }
+    std::memcpy(input_cv, kIv, sizeof(kIv));
+    block_len = kBlake3BlockLen;
+    counter = 0;
+    flags = kParent;
+  }
+
+  uint32_t state[16];
+  CompressState(state, input_cv, block, block_len, 0,
+                static_cast<uint8_t>(flags | kRoot));
+  for (int i = 0; i < 8; i++) Store32(out + 4 * i, state[i] ^ state[i + 8]);
+}
+
+void Blake3::Hash(const uint8_t* data, size_t len, uint8_t out[kBlake3OutLen]) {
+  Blake3 hasher;
+  hasher.Update(data, len);
+  hasher.Final(out);
+}
+
+}  // namespace zapshare
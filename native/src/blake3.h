@@ -0,0 +1,59 @@
+#ifndef ZAPSHARE_NATIVE_BLAKE3_H_
+#define ZAPSHARE_NATIVE_BLAKE3_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace zapshare {
+
+constexpr size_t kBlake3OutLen = 32;
+constexpr size_t kBlake3BlockLen = 64;
+constexpr size_t kBlake3ChunkLen = 1024;
+
+// Incremental BLAKE3 (unkeyed, 256-bit output).
+//
+// Whole 1 KB chunks are compressed several at a time with SSE2 on x86-64,
+// which is where most of the throughput comes from; the tail of each update
+// goes through the portable compression function.
+class Blake3 {
+ public:
+  Blake3();
+
+  void Reset();
+  void Update(const uint8_t* data, size_t len);
+  // Does not modify the hasher, so a running digest can be read mid-stream.
+  void Final(uint8_t out[kBlake3OutLen]) const;
+
+  // One-shot helper.
+  static void Hash(const uint8_t* data, size_t len, uint8_t out[kBlake3OutLen]);
+
+  // True if Update() uses the SIMD chunk path on this build.
+  static bool HasSimd();
+
+ private:
+  struct ChunkState {
+    uint32_t cv[8];
+    uint64_t counter;
+    uint8_t block[kBlake3BlockLen];
+    uint8_t block_len;
+    uint8_t blocks_compressed;
+
+    void Init(uint64_t chunk_counter);
+    size_t Len() const {
+      return kBlake3BlockLen * blocks_compressed + block_len;
+    }
+    uint8_t StartFlag() const;
+    void Update(const uint8_t* data, size_t len);
+  };
+
+  void PushCv(const uint32_t cv[8], uint64_t total_chunks);
+
+  ChunkState chunk_;
+  // 54 levels is enough for 2^64 bytes of input.
+  uint32_t cv_stack_[54][8];
+  uint8_t cv_stack_len_;
+};
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_BLAKE3_H_
@@ -0,0 +1,581 @@
+#include "compress.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#if defined(ZS_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+// Above this many bits per byte a chunk is treated as already compressed.
+constexpr double kIncompressibleEntropy = 7.2;
+constexpr size_t kEntropyWindows = 16;
+constexpr size_t kEntropyWindowSize = 256;
+// Every kProbeInterval-th compressible chunk is also encoded with another
+// codec so the estimates for codecs the policy isn't picking stay current.
+constexpr uint64_t kProbeInterval = 64;
+constexpr double kEwma = 0.2;
+// A codec has to beat store by this factor; the estimates are rough and a
+// wrong guess costs CPU on both ends.
+constexpr double kStoreMargin = 0.95;
+constexpr double kDefaultLinkRate = 100e6 / 8;
+
+// LZ4 block format constants.
+constexpr int kLz4HashLog = 12;
+constexpr size_t kLz4MinMatch = 4;
+constexpr size_t kLz4LastLiterals = 5;
+constexpr size_t kLz4MfLimit = 12;
+constexpr size_t kLz4MaxOffset = 65535;
+
+uint32_t LoadLe32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+uint32_t Read32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+uint32_t Lz4Hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - kLz4HashLog);
+}
+
+// Writes the 255-continued tail of a length that overflowed its nibble.
+bool PutLength(size_t len, uint8_t** op, uint8_t* end) {
+  for (; len >= 255; len -= 255) {
+    if (*op == end) return false;
+    *(*op)++ = 255;
+  }
+  if (*op == end) return false;
+  *(*op)++ = static_cast<uint8_t>(len);
+  return true;
+}
+
+// Emits a sequence; |match_len| 0 means the final literals-only one.
+bool PutSequence(const uint8_t* literals, size_t lit_len, size_t offset,
+                 size_t match_len, uint8_t** op, uint8_t* end) {
+  if (*op == end) return false;
+  uint8_t* token = (*op)++;
+  *token = static_cast<uint8_t>(std::min<size_t>(lit_len, 15) << 4);
+  if (lit_len >= 15 && !PutLength(lit_len - 15, op, end)) return false;
+  if (static_cast<size_t>(end - *op) < lit_len) return false;
+  std::memcpy(*op, literals, lit_len);
+  *op += lit_len;
+  if (match_len == 0) return true;
+
+  if (end - *op < 2) return false;
+  *(*op)++ = static_cast<uint8_t>(offset);
+  *(*op)++ = static_cast<uint8_t>(offset >> 8);
+  const size_t ml = match_len - kLz4MinMatch;
+  *token |= static_cast<uint8_t>(std::min<size_t>(ml, 15));
+  return ml < 15 || PutLength(ml - 15, op, end);
+}
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+uint32_t SupportedCodecs() {
+  uint32_t mask = CodecBit(Codec::kStore) | CodecBit(Codec::kLz4);
+#if defined(ZS_HAVE_ZLIB)
+  mask |= CodecBit(Codec::kDeflate1) | CodecBit(Codec::kDeflate6);
+#endif
+  return mask;
+}
+
+double SampleEntropy(const uint8_t* data, size_t len) {
+  if (len == 0) return 0;
+  uint32_t counts[256] = {0};
+  size_t sampled = 0;
+  if (len <= kEntropyWindows * kEntropyWindowSize) {
+    for (size_t i = 0; i < len; i++) counts[data[i]]++;
+    sampled = len;
+  } else {
+    const size_t stride = (len - kEntropyWindowSize) / (kEntropyWindows - 1);
+    for (size_t w = 0; w < kEntropyWindows; w++) {
+      const uint8_t* p = data + w * stride;
+      for (size_t i = 0; i < kEntropyWindowSize; i++) counts[p[i]]++;
+    }
+    sampled = kEntropyWindows * kEntropyWindowSize;
+  }
+  double bits = 0;
+  for (uint32_t c : counts) {
+    if (c == 0) continue;
+    const double p = static_cast<double>(c) / sampled;
+    bits -= p * std::log2(p);
+  }
+  return bits;
+}
+
+// Greedy single-probe matcher, the same shape as the reference LZ4 fast
+// path: one hash table of positions, skipping ahead faster the longer it
+// goes without a match.
+size_t Lz4Compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+  uint8_t* op = dst;
+  uint8_t* const end = dst + cap;
+  const uint8_t* anchor = src;
+  const uint8_t* const iend = src + len;
+
+  if (len > kLz4MfLimit) {
+    uint32_t table[1 << kLz4HashLog] = {0};
+    const uint8_t* const mflimit = iend - kLz4MfLimit;
+    const uint8_t* const matchlimit = iend - kLz4LastLiterals;
+    const uint8_t* ip = src + 1;
+    while (true) {
+      const uint8_t* ref = nullptr;
+      while (ip < mflimit) {
+        const uint32_t h = Lz4Hash(Read32(ip));
+        const uint8_t* candidate = src + table[h];
+        table[h] = static_cast<uint32_t>(ip - src);
+        if (static_cast<size_t>(ip - candidate) <= kLz4MaxOffset &&
+            candidate < ip && Read32(candidate) == Read32(ip)) {
+          ref = candidate;
+          break;
+        }
+        ip += 1 + ((ip - anchor) >> 6);
+      }
+      if (ref == nullptr) break;
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      size_t match_len = kLz4MinMatch;
+      while (ip + match_len < matchlimit && ip[match_len] == ref[match_len]) {
+        match_len++;
+      }
+      if (!PutSequence(anchor, ip - anchor, ip - ref, match_len, &op, end)) {
+        return 0;
+      }
+      ip += match_len;
+      anchor = ip;
+      if (ip < mflimit) {
+        table[Lz4Hash(Read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+      }
+    }
+  }
+  if (!PutSequence(anchor, iend - anchor, 0, 0, &op, end)) return 0;
+  return op - dst;
+}
+
+size_t Lz4Decompress(const uint8_t* src, size_t len, uint8_t* dst,
+                     size_t cap) {
+  const uint8_t* ip = src;
+  const uint8_t* const iend = src + len;
+  uint8_t* op = dst;
+  uint8_t* const oend = dst + cap;
+  auto read_length = [&](size_t* value) {
+    uint8_t b;
+    do {
+      if (ip == iend) return false;
+      b = *ip++;
+      *value += b;
+    } while (b == 255);
+    return true;
+  };
+
+  while (ip < iend) {
+    const uint8_t token = *ip++;
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && !read_length(&lit_len)) return SIZE_MAX;
+    if (lit_len > static_cast<size_t>(iend - ip) ||
+        lit_len > static_cast<size_t>(oend - op)) {
+      return SIZE_MAX;
+    }
+    std::memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == iend) return op - dst;  // Final sequence has no match.
+
+    if (iend - ip < 2) return SIZE_MAX;
+    const size_t offset = ip[0] | static_cast<size_t>(ip[1]) << 8;
+    ip += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15 && !read_length(&match_len)) return SIZE_MAX;
+    match_len += kLz4MinMatch;
+    if (offset == 0 || offset > static_cast<size_t>(op - dst) ||
+        match_len > static_cast<size_t>(oend - op)) {
+      return SIZE_MAX;
+    }
+    const uint8_t* ref = op - offset;
+    if (offset >= match_len) {
+      std::memcpy(op, ref, match_len);
+      op += match_len;
+    } else {
+      // Overlapping copy repeats the last |offset| bytes.
+      for (size_t i = 0; i < match_len; i++) *op++ = ref[i];
+    }
+  }
+  return SIZE_MAX;  // Empty input or a stream ending in a match.
+}
+
+// ---------------------------------------------------------------------------
+// ChunkCompressor
+
+// One raw-deflate stream per level, reset between chunks so every frame
+// decodes on its own.
+struct ChunkCompressor::Deflater {
+#if defined(ZS_HAVE_ZLIB)
+  z_stream streams[2];
+  bool ready[2] = {false, false};
+
+  ~Deflater() {
+    for (int i = 0; i < 2; i++) {
+      if (ready[i]) deflateEnd(&streams[i]);
+    }
+  }
+
+  z_stream* Get(int level) {
+    const int i = level == 1 ? 0 : 1;
+    if (!ready[i]) {
+      std::memset(&streams[i], 0, sizeof(z_stream));
+      if (deflateInit2(&streams[i], level, Z_DEFLATED, -15, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nullptr;
+      }
+      ready[i] = true;
+    } else {
+      deflateReset(&streams[i]);
+    }
+    return &streams[i];
+  }
+#endif
+};
+
+ChunkCompressor::ChunkCompressor(uint32_t codecs)
+    : codecs_((codecs & SupportedCodecs()) | CodecBit(Codec::kStore)),
+      link_rate_(kDefaultLinkRate),
+      // Conservative phone-class starting points; both are learned per
+      // connection as chunks go through.
+      speed_{0, 400e6, 60e6, 20e6},
+      ratio_factor_{1, 0.9, 0.65, 0.55},
+      deflater_(new Deflater) {
+  pending_.reserve(kCompressChunkSize);
+}
+
+ChunkCompressor::~ChunkCompressor() = default;
+
+void ChunkCompressor::SetLinkRate(double bytes_per_second) {
+  if (bytes_per_second > 0) link_rate_ = bytes_per_second;
+}
+
+Codec ChunkCompressor::Choose(double entropy) const {
+  if (entropy >= kIncompressibleEntropy) return Codec::kStore;
+  // Store costs the wire time of the raw bytes; the memcpy is free.
+  Codec best = Codec::kStore;
+  double best_cost = kStoreMargin / link_rate_;
+  for (Codec c : {Codec::kLz4, Codec::kDeflate1, Codec::kDeflate6}) {
+    if (!(codecs_ & CodecBit(c))) continue;
+    const int i = static_cast<int>(c);
+    const double ratio =
+        std::clamp(ratio_factor_[i] * entropy / 8, 0.01, 1.0);
+    const double cost = std::max(1 / speed_[i], ratio / link_rate_);
+    if (cost < best_cost) {
+      best = c;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+void ChunkCompressor::Update(const uint8_t* data, size_t len) {
+  if (pending_.empty()) {
+    while (len >= kCompressChunkSize) {
+      EncodeChunk(data, kCompressChunkSize);
+      data += kCompressChunkSize;
+      len -= kCompressChunkSize;
+    }
+  }
+  while (len > 0) {
+    const size_t take = std::min(len, kCompressChunkSize - pending_.size());
+    pending_.insert(pending_.end(), data, data + take);
+    data += take;
+    len -= take;
+    if (pending_.size() == kCompressChunkSize) {
+      EncodeChunk(pending_.data(), pending_.size());
+      pending_.clear();
+    }
+  }
+}
+
+void ChunkCompressor::Finish() {
+  if (!pending_.empty()) {
+    EncodeChunk(pending_.data(), pending_.size());
+    pending_.clear();
+  }
+}
+
+size_t ChunkCompressor::Read(uint8_t* out, size_t cap) {
+  const size_t n = std::min(cap, Pending());
+  std::memcpy(out, out_.data() + out_read_, n);
+  out_read_ += n;
+  if (out_read_ == out_.size()) {
+    out_.clear();
+    out_read_ = 0;
+  }
+  return n;
+}
+
+void ChunkCompressor::EncodeChunk(const uint8_t* data, size_t len) {
+  stats_.raw_bytes += len;
+  const double entropy = SampleEntropy(data, len);
+  const Codec chosen = Choose(entropy);
+
+  Codec probe = Codec::kStore;
+  if (entropy < kIncompressibleEntropy && ++chunks_ % kProbeInterval == 0) {
+    for (int step = 0; step < 3 && probe == Codec::kStore; step++) {
+      probe_cursor_ = probe_cursor_ % 3 + 1;
+      const Codec c = static_cast<Codec>(probe_cursor_);
+      if (c != chosen && (codecs_ & CodecBit(c))) probe = c;
+    }
+  }
+
+  Codec best = Codec::kStore;
+  size_t best_len = len;
+  for (Codec c : {chosen, probe}) {
+    if (c == Codec::kStore) continue;
+    const int i = static_cast<int>(c);
+    const auto start = std::chrono::steady_clock::now();
+    const size_t n = Encode(c, data, len, &probe_scratch_);
+    const double secs = Seconds(start);
+    if (secs > 0) speed_[i] += kEwma * (len / secs - speed_[i]);
+    const double observed = n == 0 ? 1.0 : static_cast<double>(n) / len;
+    const double factor =
+        std::clamp(observed / std::max(entropy / 8, 0.01), 0.05, 2.0);
+    ratio_factor_[i] += kEwma * (factor - ratio_factor_[i]);
+    if (n != 0 && n < best_len) {
+      std::swap(scratch_, probe_scratch_);
+      best = c;
+      best_len = n;
+    }
+  }
+
+  if (best == Codec::kStore) {
+    PutFrame(Codec::kStore, static_cast<uint32_t>(len), data, len);
+  } else {
+    PutFrame(best, static_cast<uint32_t>(len), scratch_.data(), best_len);
+  }
+}
+
+size_t ChunkCompressor::Encode(Codec codec, const uint8_t* data, size_t len,
+                               std::vector<uint8_t>* out) {
+  if (len < 2) return 0;
+  if (out->size() < len) out->resize(len);
+  if (codec == Codec::kLz4) {
+    return Lz4Compress(data, len, out->data(), len - 1);
+  }
+#if defined(ZS_HAVE_ZLIB)
+  z_stream* z = deflater_->Get(codec == Codec::kDeflate1 ? 1 : 6);
+  if (z == nullptr) return 0;
+  z->next_in = const_cast<Bytef*>(data);
+  z->avail_in = static_cast<uInt>(len);
+  z->next_out = out->data();
+  z->avail_out = static_cast<uInt>(len - 1);
+  if (deflate(z, Z_FINISH) != Z_STREAM_END) return 0;
+  return len - 1 - z->avail_out;
+#else
+  return 0;
+#endif
+}
+
+void ChunkCompressor::PutFrame(Codec codec, uint32_t raw_len,
+                               const uint8_t* payload, size_t payload_len) {
+  uint8_t header[kFrameHeaderSize];
+  header[0] = static_cast<uint8_t>(codec);
+  const uint32_t plen = static_cast<uint32_t>(payload_len);
+  for (int i = 0; i < 4; i++) {
+    header[1 + i] = static_cast<uint8_t>(raw_len >> (8 * i));
+    header[5 + i] = static_cast<uint8_t>(plen >> (8 * i));
+  }
+  out_.insert(out_.end(), header, header + kFrameHeaderSize);
+  out_.insert(out_.end(), payload, payload + payload_len);
+  stats_.wire_bytes += kFrameHeaderSize + payload_len;
+  stats_.frames[static_cast<int>(codec)]++;
+}
+
+// ---------------------------------------------------------------------------
+// ChunkDecompressor
+
+struct ChunkDecompressor::Inflater {
+#if defined(ZS_HAVE_ZLIB)
+  z_stream stream;
+  bool ready = false;
+
+  ~Inflater() {
+    if (ready) inflateEnd(&stream);
+  }
+
+  z_stream* Get() {
+    if (!ready) {
+      std::memset(&stream, 0, sizeof(z_stream));
+      if (inflateInit2(&stream, -15) != Z_OK) return nullptr;
+      ready = true;
+    } else {
+      inflateReset(&stream);
+    }
+    return &stream;
+  }
+#endif
+};
+
+ChunkDecompressor::ChunkDecompressor() : inflater_(new Inflater) {}
+
+ChunkDecompressor::~ChunkDecompressor() = default;
+
+bool ChunkDecompressor::Update(const uint8_t* data, size_t len) {
+  if (failed_) return false;
+  in_.insert(in_.end(), data, data + len);
+  size_t pos = 0;
+  while (in_.size() - pos >= kFrameHeaderSize) {
+    const uint8_t* frame = in_.data() + pos;
+    const uint8_t codec = frame[0];
+    const uint32_t raw_len = LoadLe32(frame + 1);
+    const uint32_t payload_len = LoadLe32(frame + 5);
+    if (codec > static_cast<uint8_t>(Codec::kDeflate6) ||
+        raw_len > kCompressChunkSize || payload_len > raw_len ||
+        (codec == 0 && payload_len != raw_len)) {
+      failed_ = true;
+      return false;
+    }
+    if (in_.size() - pos - kFrameHeaderSize < payload_len) break;
+    if (!DecodeFrame(static_cast<Codec>(codec), frame + kFrameHeaderSize,
+                     payload_len, raw_len)) {
+      failed_ = true;
+      return false;
+    }
+    pos += kFrameHeaderSize + payload_len;
+  }
+  in_.erase(in_.begin(), in_.begin() + pos);
+  return true;
+}
+
+size_t ChunkDecompressor::Read(uint8_t* out, size_t cap) {
+  const size_t n = std::min(cap, Pending());
+  std::memcpy(out, out_.data() + out_read_, n);
+  out_read_ += n;
+  if (out_read_ == out_.size()) {
+    out_.clear();
+    out_read_ = 0;
+  }
+  return n;
+}
+
+bool ChunkDecompressor::DecodeFrame(Codec codec, const uint8_t* payload,
+                                    size_t payload_len, uint32_t raw_len) {
+  const size_t base = out_.size();
+  if (codec == Codec::kStore) {
+    out_.insert(out_.end(), payload, payload + payload_len);
+    return true;
+  }
+  out_.resize(base + raw_len);
+  if (codec == Codec::kLz4) {
+    return Lz4Decompress(payload, payload_len, out_.data() + base, raw_len) ==
+           raw_len;
+  }
+#if defined(ZS_HAVE_ZLIB)
+  z_stream* z = inflater_->Get();
+  if (z == nullptr) return false;
+  z->next_in = const_cast<Bytef*>(payload);
+  z->avail_in = static_cast<uInt>(payload_len);
+  z->next_out = out_.data() + base;
+  z->avail_out = raw_len;
+  return inflate(z, Z_FINISH) == Z_STREAM_END && z->avail_out == 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::ChunkCompressor* Unwrap(ZsCompressor* c) {
+  return reinterpret_cast<zapshare::ChunkCompressor*>(c);
+}
+
+const zapshare::ChunkCompressor* Unwrap(const ZsCompressor* c) {
+  return reinterpret_cast<const zapshare::ChunkCompressor*>(c);
+}
+
+zapshare::ChunkDecompressor* Unwrap(ZsDecompressor* d) {
+  return reinterpret_cast<zapshare::ChunkDecompressor*>(d);
+}
+
+const zapshare::ChunkDecompressor* Unwrap(const ZsDecompressor* d) {
+  return reinterpret_cast<const zapshare::ChunkDecompressor*>(d);
+}
+
+}  // namespace
+
+uint32_t zs_compress_supported(void) { return zapshare::SupportedCodecs(); }
+
+ZsCompressor* zs_compressor_new(uint32_t codecs) {
+  return reinterpret_cast<ZsCompressor*>(
+      new zapshare::ChunkCompressor(codecs));
+}
+
+void zs_compressor_free(ZsCompressor* compressor) { delete Unwrap(compressor); }
+
+void zs_compressor_set_link_rate(ZsCompressor* compressor,
+                                 double bytes_per_second) {
+  Unwrap(compressor)->SetLinkRate(bytes_per_second);
+}
+
+void zs_compressor_update(ZsCompressor* compressor, const uint8_t* data,
+                          size_t len) {
+  Unwrap(compressor)->Update(data, len);
+}
+
+void zs_compressor_finish(ZsCompressor* compressor) {
+  Unwrap(compressor)->Finish();
+}
+
+size_t zs_compressor_pending(const ZsCompressor* compressor) {
+  return Unwrap(compressor)->Pending();
+}
+
+size_t zs_compressor_read(ZsCompressor* compressor, uint8_t* out,
+                          size_t cap) {
+  return Unwrap(compressor)->Read(out, cap);
+}
+
+void zs_compressor_stats(const ZsCompressor* compressor, uint64_t stats[6]) {
+  const zapshare::CompressStats& s = Unwrap(compressor)->stats();
+  stats[0] = s.raw_bytes;
+  stats[1] = s.wire_bytes;
+  for (int i = 0; i < 4; i++) stats[2 + i] = s.frames[i];
+}
+
+ZsDecompressor* zs_decompressor_new(void) {
+  return reinterpret_cast<ZsDecompressor*>(new zapshare::ChunkDecompressor());
+}
+
+void zs_decompressor_free(ZsDecompressor* decompressor) {
+  delete Unwrap(decompressor);
+}
+
+int32_t zs_decompressor_update(ZsDecompressor* decompressor,
+                               const uint8_t* data, size_t len) {
+  return Unwrap(decompressor)->Update(data, len) ? 1 : 0;
+}
+
+size_t zs_decompressor_pending(const ZsDecompressor* decompressor) {
+  return Unwrap(decompressor)->Pending();
+}
+
+size_t zs_decompressor_read(ZsDecompressor* decompressor, uint8_t* out,
+                            size_t cap) {
+  return Unwrap(decompressor)->Read(out, cap);
+}
@@ -0,0 +1,182 @@
+#ifndef ZAPSHARE_NATIVE_COMPRESS_H_
+#define ZAPSHARE_NATIVE_COMPRESS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// Adaptive per-chunk compression for the transfer paths.
+//
+// The sender cuts the file into kCompressChunkSize chunks and, for each one,
+// samples its byte entropy and picks whichever codec is expected to get the
+// chunk across fastest given the measured link rate and how fast each codec
+// has been compressing on this device. Compression and sending overlap, so a
+// codec's cost per input byte is max(1 / compress speed, ratio / link rate);
+// on a fast link nothing beats store, on slow Wi-Fi Direct the denser codec
+// wins for text. Chunks that look random (JPEG, MP4, ZIP) are stored after a
+// 4 KB sample, without ever being run through a compressor.
+//
+// Stream of frames, little-endian:
+//   u8 codec | le32 raw length | le32 payload length | payload
+// Store frames carry the raw bytes; a chunk that a codec failed to shrink is
+// sent as a store frame too.
+
+enum class Codec : uint8_t {
+  kStore = 0,
+  kLz4 = 1,      // LZ4 block format.
+  kDeflate1 = 2,  // Raw deflate, level 1 (zlib builds only).
+  kDeflate6 = 3,  // Raw deflate, level 6 (zlib builds only).
+};
+
+constexpr size_t kCompressChunkSize = 128 * 1024;
+constexpr size_t kFrameHeaderSize = 9;
+constexpr uint32_t CodecBit(Codec c) { return 1u << static_cast<int>(c); }
+
+// Codecs this build can encode and decode, as CodecBit()s. A connection uses
+// the intersection of both peers' masks.
+uint32_t SupportedCodecs();
+
+// Shannon entropy in bits per byte of up to 16 evenly spaced 256-byte
+// windows of |data|.
+double SampleEntropy(const uint8_t* data, size_t len);
+
+// LZ4 block format. Compress returns 0 if the output would exceed |cap|;
+// Decompress returns the number of bytes written, or SIZE_MAX on malformed
+// input or overflow.
+size_t Lz4Compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+size_t Lz4Decompress(const uint8_t* src, size_t len, uint8_t* dst,
+                     size_t cap);
+
+struct CompressStats {
+  uint64_t raw_bytes = 0;
+  uint64_t wire_bytes = 0;  // Including frame headers.
+  uint64_t frames[4] = {0, 0, 0, 0};  // Indexed by Codec.
+};
+
+// Streams |raw| data into frames, choosing a codec per chunk.
+class ChunkCompressor {
+ public:
+  // |codecs| is the negotiated mask; store is always allowed.
+  explicit ChunkCompressor(uint32_t codecs);
+  ~ChunkCompressor();
+
+  ChunkCompressor(const ChunkCompressor&) = delete;
+  ChunkCompressor& operator=(const ChunkCompressor&) = delete;
+
+  // Measured link throughput in bytes per second; 0 keeps the default guess
+  // of 100 Mbit/s until the caller has a measurement.
+  void SetLinkRate(double bytes_per_second);
+
+  void Update(const uint8_t* data, size_t len);
+  // Flushes a trailing partial chunk.
+  void Finish();
+
+  size_t Pending() const { return out_.size() - out_read_; }
+  size_t Read(uint8_t* out, size_t cap);
+
+  const CompressStats& stats() const { return stats_; }
+
+  // The codec the policy would pick for a chunk of this entropy right now.
+  Codec Choose(double entropy) const;
+
+ private:
+  struct Deflater;
+
+  void EncodeChunk(const uint8_t* data, size_t len);
+  // Returns the payload size written to |out|, 0 if it didn't shrink.
+  size_t Encode(Codec codec, const uint8_t* data, size_t len,
+                std::vector<uint8_t>* out);
+  void PutFrame(Codec codec, uint32_t raw_len, const uint8_t* payload,
+                size_t payload_len);
+
+  uint32_t codecs_;
+  double link_rate_;
+  // Per codec: input bytes per second, and ratio relative to entropy / 8.
+  double speed_[4];
+  double ratio_factor_[4];
+
+  uint64_t chunks_ = 0;
+  int probe_cursor_ = 0;
+
+  std::vector<uint8_t> pending_;
+  // Payload of the best encoding so far, and the one being tried.
+  std::vector<uint8_t> scratch_;
+  std::vector<uint8_t> probe_scratch_;
+  std::vector<uint8_t> out_;
+  size_t out_read_ = 0;
+  std::unique_ptr<Deflater> deflater_;
+  CompressStats stats_;
+};
+
+// Parses a frame stream back into raw bytes.
+class ChunkDecompressor {
+ public:
+  ChunkDecompressor();
+  ~ChunkDecompressor();
+
+  ChunkDecompressor(const ChunkDecompressor&) = delete;
+  ChunkDecompressor& operator=(const ChunkDecompressor&) = delete;
+
+  // False once the stream is found to be malformed; later calls are ignored.
+  bool Update(const uint8_t* data, size_t len);
+
+  size_t Pending() const { return out_.size() - out_read_; }
+  size_t Read(uint8_t* out, size_t cap);
+
+  // True when no partial frame is buffered.
+  bool AtFrameBoundary() const { return in_.empty(); }
+  bool failed() const { return failed_; }
+
+ private:
+  struct Inflater;
+
+  bool DecodeFrame(Codec codec, const uint8_t* payload, size_t payload_len,
+                   uint32_t raw_len);
+
+  std::vector<uint8_t> in_;
+  std::vector<uint8_t> out_;
+  size_t out_read_ = 0;
+  std::unique_ptr<Inflater> inflater_;
+  bool failed_ = false;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsCompressor ZsCompressor;
+typedef struct ZsDecompressor ZsDecompressor;
+
+ZS_EXPORT uint32_t zs_compress_supported(void);
+
+ZS_EXPORT ZsCompressor* zs_compressor_new(uint32_t codecs);
+ZS_EXPORT void zs_compressor_free(ZsCompressor* compressor);
+ZS_EXPORT void zs_compressor_set_link_rate(ZsCompressor* compressor,
+                                           double bytes_per_second);
+ZS_EXPORT void zs_compressor_update(ZsCompressor* compressor,
+                                    const uint8_t* data, size_t len);
+ZS_EXPORT void zs_compressor_finish(ZsCompressor* compressor);
+ZS_EXPORT size_t zs_compressor_pending(const ZsCompressor* compressor);
+ZS_EXPORT size_t zs_compressor_read(ZsCompressor* compressor, uint8_t* out,
+                                    size_t cap);
+// |stats| receives raw bytes, wire bytes, then frames per codec (4 values).
+ZS_EXPORT void zs_compressor_stats(const ZsCompressor* compressor,
+                                   uint64_t stats[6]);
+
+ZS_EXPORT ZsDecompressor* zs_decompressor_new(void);
+ZS_EXPORT void zs_decompressor_free(ZsDecompressor* decompressor);
+// Returns 0 once the stream is malformed.
+ZS_EXPORT int32_t zs_decompressor_update(ZsDecompressor* decompressor,
+                                         const uint8_t* data, size_t len);
+ZS_EXPORT size_t zs_decompressor_pending(const ZsDecompressor* decompressor);
+ZS_EXPORT size_t zs_decompressor_read(ZsDecompressor* decompressor,
+                                      uint8_t* out, size_t cap);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_COMPRESS_H_
@@ -0,0 +1,505 @@
+#include "connection_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace zapshare {
+
+#if defined(_WIN32)
+
+std::unique_ptr<ConnectionPool> ConnectionPool::Start(
+    const ConnectionPoolConfig&) {
+  return nullptr;
+}
+
+ConnectionPool::~ConnectionPool() = default;
+
+void ConnectionPool::Warm(const std::string&, uint16_t, bool) {}
+
+void ConnectionPool::Forget(const std::string&, uint16_t) {}
+
+int ConnectionPool::Take(const std::string&, uint16_t) { return -1; }
+
+bool ConnectionPool::Listing(const std::string&, uint16_t,
+                             std::string*) const {
+  return false;
+}
+
+ConnectionPoolStats ConnectionPool::stats() const {
+  return ConnectionPoolStats();
+}
+
+#else
+
+namespace {
+
+constexpr char kListCommand[] = "LIST\n";
+constexpr uint64_t kListTimeoutMs = 10000;
+constexpr size_t kMaxListing = 16 * 1024 * 1024;
+constexpr uint64_t kFirstRetryMs = 250;
+
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+#if defined(SOCK_CLOEXEC)
+constexpr int kSocketFlags = SOCK_CLOEXEC;
+#else
+constexpr int kSocketFlags = 0;
+#endif
+
+uint64_t NowMs() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+void SetBlocking(int fd, bool blocking) {
+  const int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+}
+
+// The error a non-blocking connect() finished with.
+int ConnectError(int fd) {
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) return errno;
+  return error;
+}
+
+}  // namespace
+
+ConnectionPool::ConnectionPool(const ConnectionPoolConfig& config)
+    : config_(config) {}
+
+std::unique_ptr<ConnectionPool> ConnectionPool::Start(
+    const ConnectionPoolConfig& config) {
+  std::unique_ptr<ConnectionPool> pool(new ConnectionPool(config));
+  if (pipe(pool->wake_) != 0) return nullptr;
+  for (const int fd : pool->wake_) {
+    SetBlocking(fd, false);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  pool->thread_ = std::thread(&ConnectionPool::Run, pool.get());
+  return pool;
+}
+
+ConnectionPool::~ConnectionPool() {
+  stop_ = true;
+  if (thread_.joinable()) {
+    Wake();
+    thread_.join();
+  }
+  for (Peer& peer : peers_) Close(&peer);
+  for (const int fd : wake_) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+void ConnectionPool::Warm(const std::string& host, uint16_t port,
+                          bool list) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    Peer* peer = Find(host, port);
+    if (peer == nullptr) {
+      if (!peers_.empty() &&
+          peers_.size() >= std::max<uint32_t>(config_.max_peers, 1)) {
+        auto oldest = std::min_element(
+            peers_.begin(), peers_.end(), [](const Peer& a, const Peer& b) {
+              return a.warmed_ms < b.warmed_ms;
+            });
+        Close(&*oldest);
+        peers_.erase(oldest);
+      }
+      peers_.emplace_back();
+      peer = &peers_.back();
+      peer->host = host;
+      peer->port = port;
+    }
+    peer->warmed_ms = NowMs();
+    if (list) {
+      // A new share: whatever was fetched before is out of date, and it's
+      // worth trying again now.
+      EndList(peer);
+      peer->listed = false;
+      peer->listing.clear();
+      peer->want_list = true;
+      peer->retry_at_ms = 0;
+    }
+  }
+  Wake();
+}
+
+void ConnectionPool::Forget(const std::string& host, uint16_t port) {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (auto it = peers_.begin(); it != peers_.end(); ++it) {
+    if (it->host == host && it->port == port) {
+      Close(&*it);
+      peers_.erase(it);
+      return;
+    }
+  }
+}
+
+int ConnectionPool::Take(const std::string& host, uint16_t port) {
+  int fd = -1;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    Peer* peer = Find(host, port);
+    while (peer != nullptr && fd < 0) {
+      auto it = std::find_if(
+          peer->connections.begin(), peer->connections.end(),
+          [](const Connection& c) { return c.connected; });
+      if (it == peer->connections.end()) break;
+      const int candidate = it->fd;
+      peer->connections.erase(it);
+      // Idle, a connection has nothing to read; anything else means the
+      // sender closed it or is about to.
+      uint8_t byte;
+      const ssize_t n = recv(candidate, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        fd = candidate;
+      } else {
+        close(candidate);
+        stale_++;
+      }
+    }
+    if (fd < 0) {
+      missed_++;
+      return -1;
+    }
+    taken_++;
+    peer->warmed_ms = NowMs();
+  }
+  SetBlocking(fd, true);
+  Wake();  // For its replacement.
+  return fd;
+}
+
+bool ConnectionPool::Listing(const std::string& host, uint16_t port,
+                             std::string* out) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  const Peer* peer = Find(host, port);
+  if (peer == nullptr || !peer->listed) return false;
+  *out = peer->listing;
+  return true;
+}
+
+ConnectionPoolStats ConnectionPool::stats() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  ConnectionPoolStats s;
+  s.connects = connects_;
+  s.failures = failures_;
+  s.taken = taken_;
+  s.missed = missed_;
+  s.stale = stale_;
+  s.listings = listings_;
+  for (const Peer& peer : peers_) {
+    for (const Connection& c : peer.connections) s.ready += c.connected;
+  }
+  return s;
+}
+
+void ConnectionPool::Run() {
+  std::vector<pollfd> fds;
+  while (!stop_) {
+    fds.assign(1, {wake_[0], POLLIN, 0});
+    uint64_t next;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      next = Tend(NowMs());
+      for (const Peer& peer : peers_) {
+        // Idle ones too, so one the sender closes goes at once.
+        for (const Connection& c : peer.connections) {
+          fds.push_back({c.fd, c.connected ? short{POLLIN} : short{POLLOUT},
+                         0});
+        }
+        if (peer.list_fd >= 0) {
+          fds.push_back({peer.list_fd,
+                         peer.list_sent ? short{POLLIN} : short{POLLOUT}, 0});
+        }
+      }
+    }
+    const uint64_t now = NowMs();
+    const int timeout = static_cast<int>(next > now ? next - now : 0);
+    if (poll(fds.data(), fds.size(), timeout) <= 0) continue;
+    if (fds[0].revents != 0) {
+      uint8_t drain[64];
+      while (read(wake_[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+    // Take() and Forget() may have closed some of these meanwhile; Ready()
+    // only acts on descriptors it still finds.
+    std::lock_guard<std::mutex> lock(mu_);
+    for (size_t i = 1; i < fds.size(); i++) {
+      if (fds[i].revents != 0) Ready(fds[i].fd, fds[i].revents, NowMs());
+    }
+  }
+}
+
+void ConnectionPool::Wake() {
+  const uint8_t byte = 0;
+  (void)!write(wake_[1], &byte, 1);
+}
+
+uint64_t ConnectionPool::Tend(uint64_t now) {
+  uint64_t next = now + config_.idle_ms;
+  for (auto it = peers_.begin(); it != peers_.end();) {
+    if (now - it->warmed_ms >= config_.idle_ms) {
+      Close(&*it);
+      it = peers_.erase(it);
+      continue;
+    }
+    Peer& peer = *it++;
+    next = std::min(next, peer.warmed_ms + config_.idle_ms);
+    for (auto c = peer.connections.begin(); c != peer.connections.end();) {
+      const uint64_t limit =
+          c->connected ? config_.max_age_ms : config_.connect_timeout_ms;
+      if (now - c->since_ms < limit) {
+        next = std::min(next, c->since_ms + limit);
+        ++c;
+        continue;
+      }
+      close(c->fd);
+      if (!c->connected) Fail(&peer, now);
+      c = peer.connections.erase(c);
+    }
+    if (peer.list_fd >= 0 && now - peer.list_since_ms >= kListTimeoutMs) {
+      EndList(&peer);
+      Fail(&peer, now);
+    }
+    if (now >= peer.retry_at_ms) {
+      while (peer.connections.size() < config_.per_peer) {
+        const int fd = Connect(peer, peer.port);
+        if (fd < 0) {
+          Fail(&peer, now);
+          break;
+        }
+        peer.connections.push_back({fd, now, false});
+      }
+    }
+    if (now >= peer.retry_at_ms && peer.want_list && peer.list_fd < 0 &&
+        peer.port < UINT16_MAX) {
+      // The v1 protocol listens on the port after the HTTP one.
+      const int fd = Connect(peer, static_cast<uint16_t>(peer.port + 1));
+      if (fd < 0) {
+        Fail(&peer, now);
+      } else {
+        peer.list_fd = fd;
+        peer.list_since_ms = now;
+        peer.list_sent = false;
+      }
+    }
+    if (peer.list_fd >= 0) {
+      next = std::min(next, peer.list_since_ms + kListTimeoutMs);
+    }
+    if (peer.retry_at_ms > now) next = std::min(next, peer.retry_at_ms);
+  }
+  return next;
+}
+
+void ConnectionPool::Ready(int fd, short revents, uint64_t now) {
+  (void)revents;
+  for (Peer& peer : peers_) {
+    if (fd == peer.list_fd) {
+      if (peer.list_sent) {
+        ReadList(&peer, now);
+      } else if (ConnectError(fd) == 0 &&
+                 send(fd, kListCommand, sizeof(kListCommand) - 1,
+                      kSendFlags) ==
+                     static_cast<ssize_t>(sizeof(kListCommand) - 1)) {
+        peer.list_sent = true;
+      } else {
+        EndList(&peer);
+        Fail(&peer, now);
+      }
+      return;
+    }
+    for (auto c = peer.connections.begin(); c != peer.connections.end();
+         ++c) {
+      if (c->fd != fd) continue;
+      if (c->connected) {
+        // Readable while idle: the sender closed it.
+        stale_++;
+      } else if (ConnectError(fd) == 0) {
+        c->connected = true;
+        c->since_ms = now;
+        connects_++;
+        peer.failures = 0;
+        return;
+      } else {
+        Fail(&peer, now);
+      }
+      close(fd);
+      peer.connections.erase(c);
+      return;
+    }
+  }
+}
+
+void ConnectionPool::ReadList(Peer* peer, uint64_t now) {
+  char buf[16 * 1024];
+  bool closed = false;
+  for (;;) {
+    const ssize_t n = recv(peer->list_fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      peer->list_in.append(buf, static_cast<size_t>(n));
+      if (peer->list_in.size() > kMaxListing) {
+        closed = true;
+        break;
+      }
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    break;
+  }
+  const size_t newline = peer->list_in.find('\n');
+  if (newline != std::string::npos) {
+    peer->listing = peer->list_in.substr(0, newline);
+    peer->listed = true;
+    peer->want_list = false;
+    listings_++;
+    EndList(peer);
+  } else if (closed) {
+    EndList(peer);
+    Fail(peer, now);
+  }
+}
+
+void ConnectionPool::EndList(Peer* peer) {
+  if (peer->list_fd >= 0) close(peer->list_fd);
+  peer->list_fd = -1;
+  peer->list_sent = false;
+  peer->list_in.clear();
+}
+
+void ConnectionPool::Fail(Peer* peer, uint64_t now) {
+  failures_++;
+  const uint32_t doublings = std::min<uint32_t>(peer->failures++, 16);
+  peer->retry_at_ms =
+      now + std::min<uint64_t>(kFirstRetryMs << doublings, config_.idle_ms);
+}
+
+void ConnectionPool::Close(Peer* peer) {
+  for (const Connection& c : peer->connections) close(c.fd);
+  peer->connections.clear();
+  EndList(peer);
+}
+
+int ConnectionPool::Connect(const Peer& peer, uint16_t port) const {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  addrinfo* addrs = nullptr;
+  if (getaddrinfo(peer.host.c_str(), std::to_string(port).c_str(), &hints,
+                  &addrs) != 0) {
+    return -1;
+  }
+  const int fd = socket(addrs->ai_family, addrs->ai_socktype | kSocketFlags,
+                        addrs->ai_protocol);
+  if (fd >= 0) {
+    SetBlocking(fd, false);
+#if defined(SO_NOSIGPIPE)
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    if (connect(fd, addrs->ai_addr, addrs->ai_addrlen) != 0 &&
+        errno != EINPROGRESS) {
+      close(fd);
+      freeaddrinfo(addrs);
+      return -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  return fd;
+}
+
+ConnectionPool::Peer* ConnectionPool::Find(const std::string& host,
+                                           uint16_t port) {
+  for (Peer& peer : peers_) {
+    if (peer.host == host && peer.port == port) return &peer;
+  }
+  return nullptr;
+}
+
+const ConnectionPool::Peer* ConnectionPool::Find(const std::string& host,
+                                                 uint16_t port) const {
+  for (const Peer& peer : peers_) {
+    if (peer.host == host && peer.port == port) return &peer;
+  }
+  return nullptr;
+}
+
+#endif  // defined(_WIN32)
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::ConnectionPool* Unwrap(ZsConnectionPool* pool) {
+  return reinterpret_cast<zapshare::ConnectionPool*>(pool);
+}
+
+const zapshare::ConnectionPool* Unwrap(const ZsConnectionPool* pool) {
+  return reinterpret_cast<const zapshare::ConnectionPool*>(pool);
+}
+
+}  // namespace
+
+ZsConnectionPool* zs_connection_pool_start(uint32_t per_peer,
+                                           uint32_t idle_ms) {
+  zapshare::ConnectionPoolConfig config;
+  config.per_peer = per_peer;
+  config.idle_ms = idle_ms;
+  return reinterpret_cast<ZsConnectionPool*>(
+      zapshare::ConnectionPool::Start(config).release());
+}
+
+void zs_connection_pool_free(ZsConnectionPool* pool) { delete Unwrap(pool); }
+
+void zs_connection_pool_warm(ZsConnectionPool* pool, const char* host,
+                             uint16_t port, int32_t list) {
+  Unwrap(pool)->Warm(host, port, list != 0);
+}
+
+void zs_connection_pool_forget(ZsConnectionPool* pool, const char* host,
+                               uint16_t port) {
+  Unwrap(pool)->Forget(host, port);
+}
+
+int64_t zs_connection_pool_listing(const ZsConnectionPool* pool,
+                                   const char* host, uint16_t port,
+                                   uint8_t* out, size_t cap) {
+  std::string listing;
+  if (!Unwrap(pool)->Listing(host, port, &listing)) return -1;
+  if (listing.size() <= cap) {
+    std::copy(listing.begin(), listing.end(), out);
+  }
+  return static_cast<int64_t>(listing.size());
+}
+
+void zs_connection_pool_stats(const ZsConnectionPool* pool,
+                              uint64_t out[7]) {
+  const zapshare::ConnectionPoolStats s = Unwrap(pool)->stats();
+  out[0] = s.connects;
+  out[1] = s.failures;
+  out[2] = s.taken;
+  out[3] = s.missed;
+  out[4] = s.stale;
+  out[5] = s.listings;
+  out[6] = s.ready;
+}
@@ -0,0 +1,168 @@
+#ifndef ZAPSHARE_NATIVE_CONNECTION_POOL_H_
+#define ZAPSHARE_NATIVE_CONNECTION_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// Connections made ahead of time to the peers a transfer is likely to
+// come from, so that accepting one starts with a request instead of a
+// string of handshakes.
+//
+// Before the first byte of an accepted share moved, the receiver
+// connected to the sender's port + 1, sent LIST, waited for the JSON,
+// then connected again for every range stream and sent its GET: four
+// round trips or more. A ConnectionPool does all but the last ahead of
+// time, on a thread of its own. Warm() a peer as discovery sees it, a
+// favourite or one that just asked to send us something, and the pool
+// keeps |per_peer| connections to its HTTP port open; with |list| it also
+// fetches the file list over the v1 protocol, once, for Listing(). A
+// RangeReceiver given the pool Take()s a warm connection and sends its
+// GET at once, so its first byte is one round trip away.
+//
+// A connection carries one request, as the receiver closes it after the
+// body, and is handed out oldest first. Take() peeks at it without
+// blocking first, so one the sender closed in the meantime is dropped
+// for the next. Connections older than |max_age_ms| are replaced before
+// the sender's server times them out, and a peer not warmed or taken from
+// within |idle_ms| is let go with all of its connections. A peer that
+// refuses is retried after a backoff that doubles up to |idle_ms|.
+//
+// Hosts are numeric addresses, as discovery reports them.
+
+struct ConnectionPoolConfig {
+  uint32_t per_peer = 2;
+  uint32_t max_peers = 8;  // Beyond that the least recently warmed goes.
+  uint32_t idle_ms = 30000;
+  // Dart's HttpServer closes a connection idle for 120 s.
+  uint32_t max_age_ms = 60000;
+  uint32_t connect_timeout_ms = 3000;
+};
+
+struct ConnectionPoolStats {
+  uint64_t connects = 0;  // Connections made.
+  uint64_t failures = 0;  // Connects and list fetches that failed.
+  uint64_t taken = 0;     // Handed out warm.
+  uint64_t missed = 0;    // Take()s that found none warm.
+  uint64_t stale = 0;     // Found closed by the sender.
+  uint64_t listings = 0;  // Lists fetched.
+  uint64_t ready = 0;     // Warm connections right now.
+};
+
+class ConnectionPool {
+ public:
+  // Null on Windows, where the Dart path is used.
+  static std::unique_ptr<ConnectionPool> Start(
+      const ConnectionPoolConfig& config);
+  // Closes every connection.
+  ~ConnectionPool();
+
+  ConnectionPool(const ConnectionPool&) = delete;
+  ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+  // Keeps connections to |host|:|port| warm for another |idle_ms|, and
+  // with |list| fetches the peer's file list again.
+  void Warm(const std::string& host, uint16_t port, bool list);
+  void Forget(const std::string& host, uint16_t port);
+  // A connected, blocking socket to |host|:|port| that is now the
+  // caller's to close, or -1 if none is warm.
+  int Take(const std::string& host, uint16_t port);
+  // The peer's answer to LIST, without its newline. False until it has
+  // arrived.
+  bool Listing(const std::string& host, uint16_t port,
+               std::string* out) const;
+  ConnectionPoolStats stats() const;
+
+ private:
+  struct Connection {
+    int fd;
+    uint64_t since_ms;
+    bool connected;
+  };
+  struct Peer {
+    std::string host;
+    uint16_t port = 0;
+    uint64_t warmed_ms = 0;
+    std::deque<Connection> connections;
+    uint32_t failures = 0;   // In a row.
+    uint64_t retry_at_ms = 0;
+    bool want_list = false;
+    // The LIST fetch in progress.
+    int list_fd = -1;
+    uint64_t list_since_ms = 0;
+    bool list_sent = false;
+    std::string list_in;
+    bool listed = false;
+    std::string listing;
+  };
+
+  explicit ConnectionPool(const ConnectionPoolConfig& config);
+
+  void Run();
+  void Wake();
+  // Opens and closes connections as the peers need; |mu_| held. Returns
+  // when it next has something to do.
+  uint64_t Tend(uint64_t now);
+  // Completes whatever |fd| was waiting on; |mu_| held.
+  void Ready(int fd, short revents, uint64_t now);
+  void ReadList(Peer* peer, uint64_t now);
+  void EndList(Peer* peer);
+  // A connect or fetch failed: backs off.
+  void Fail(Peer* peer, uint64_t now);
+  void Close(Peer* peer);
+  // Non-blocking connect to |peer| on |port|; -1 on failure.
+  int Connect(const Peer& peer, uint16_t port) const;
+  Peer* Find(const std::string& host, uint16_t port);
+  const Peer* Find(const std::string& host, uint16_t port) const;
+
+  const ConnectionPoolConfig config_;
+  mutable std::mutex mu_;
+  std::vector<Peer> peers_;
+  int wake_[2] = {-1, -1};
+  std::atomic<bool> stop_{false};
+  uint64_t connects_ = 0;
+  uint64_t failures_ = 0;
+  uint64_t taken_ = 0;
+  uint64_t missed_ = 0;
+  uint64_t stale_ = 0;
+  uint64_t listings_ = 0;
+  std::thread thread_;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsConnectionPool ZsConnectionPool;
+
+// Null on Windows.
+ZS_EXPORT ZsConnectionPool* zs_connection_pool_start(uint32_t per_peer,
+                                                     uint32_t idle_ms);
+ZS_EXPORT void zs_connection_pool_free(ZsConnectionPool* pool);
+ZS_EXPORT void zs_connection_pool_warm(ZsConnectionPool* pool,
+                                       const char* host, uint16_t port,
+                                       int32_t list);
+ZS_EXPORT void zs_connection_pool_forget(ZsConnectionPool* pool,
+                                         const char* host, uint16_t port);
+// The size of the fetched list, which is copied to |out| if it fits, or
+// -1 if there's none yet.
+ZS_EXPORT int64_t zs_connection_pool_listing(const ZsConnectionPool* pool,
+                                             const char* host, uint16_t port,
+                                             uint8_t* out, size_t cap);
+// connects, failures, taken, missed, stale, listings, ready.
+ZS_EXPORT void zs_connection_pool_stats(const ZsConnectionPool* pool,
+                                        uint64_t out[7]);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_CONNECTION_POOL_H_
@@ -0,0 +1,188 @@
+#include "content_hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace zapshare {
+
+ChunkHasher::ChunkHasher(uint64_t file_size, uint32_t chunk_size)
+    : file_size_(file_size),
+      chunk_size_(chunk_size == 0 ? kDefaultDigestChunkSize : chunk_size) {
+  size_t count =
+      static_cast<size_t>((file_size_ + chunk_size_ - 1) / chunk_size_);
+  digests_.resize(count);
+  done_.assign(count, 0);
+}
+
+void ChunkHasher::Update(uint64_t offset, const uint8_t* data, size_t len) {
+  while (len > 0 && offset < file_size_) {
+    uint32_t index = static_cast<uint32_t>(offset / chunk_size_);
+    uint64_t chunk_start = static_cast<uint64_t>(index) * chunk_size_;
+    uint64_t chunk_end = std::min(chunk_start + chunk_size_, file_size_);
+    size_t take =
+        static_cast<size_t>(std::min<uint64_t>(len, chunk_end - offset));
+
+    if (!done_[index]) {
+      auto it = pending_.find(index);
+      if (offset == chunk_start) {
+        // A chunk's first byte always (re)starts it.
+        if (it == pending_.end()) {
+          it = pending_.emplace(index, std::make_unique<Pending>()).first;
+        }
+        it->second->hasher.Reset();
+        it->second->next_offset = chunk_start;
+      }
+      if (it != pending_.end()) {
+        Pending* p = it->second.get();
+        if (p->next_offset != offset) {
+          pending_.erase(it);
+        } else {
+          p->hasher.Update(data, take);
+          p->next_offset += take;
+          if (p->next_offset == chunk_end) {
+            p->hasher.Final(digests_[index].data());
+            done_[index] = 1;
+            completed_++;
+            pending_.erase(it);
+          }
+        }
+      }
+    }
+
+    offset += take;
+    data += take;
+    len -= take;
+  }
+}
+
+void ChunkHasher::UpdateZeros(uint64_t offset, uint64_t len) {
+  static const uint8_t kZeros[64 * 1024] = {};
+  const uint64_t end = std::min(file_size_, offset + len);
+  while (offset < end) {
+    const uint32_t index = static_cast<uint32_t>(offset / chunk_size_);
+    const uint64_t chunk_start = static_cast<uint64_t>(index) * chunk_size_;
+    if (offset == chunk_start && end - offset >= chunk_size_) {
+      if (!done_[index]) {
+        if (zero_chunk_ == nullptr) {
+          zero_chunk_ = std::make_unique<Digest>();
+          Blake3 hasher;
+          for (uint32_t i = 0; i < chunk_size_; i += sizeof(kZeros)) {
+            hasher.Update(kZeros, std::min<size_t>(sizeof(kZeros),
+                                                   chunk_size_ - i));
+          }
+          hasher.Final(zero_chunk_->data());
+        }
+        pending_.erase(index);
+        digests_[index] = *zero_chunk_;
+        done_[index] = 1;
+        completed_++;
+      }
+      offset += chunk_size_;
+      continue;
+    }
+    const size_t take =
+        static_cast<size_t>(std::min<uint64_t>(end - offset, sizeof(kZeros)));
+    Update(offset, kZeros, take);
+    offset += take;
+  }
+}
+
+void ChunkHasher::ResetChunk(uint32_t index) {
+  if (index >= done_.size()) return;
+  if (done_[index]) {
+    done_[index] = 0;
+    completed_--;
+  }
+  pending_.erase(index);
+}
+
+bool ChunkHasher::ChunkDigest(uint32_t index, Digest* out) const {
+  if (index >= done_.size() || !done_[index]) return false;
+  *out = digests_[index];
+  return true;
+}
+
+bool ChunkHasher::FileDigest(Digest* out) const {
+  if (completed_ != done_.size()) return false;
+  CombineDigests(file_size_, chunk_size_, digests_, out);
+  return true;
+}
+
+void ChunkHasher::CombineDigests(uint64_t file_size, uint32_t chunk_size,
+                                 const std::vector<Digest>& chunks,
+                                 Digest* out) {
+  uint8_t header[16] = {'Z', 'S', 'C', 'D'};
+  for (int i = 0; i < 8; i++) {
+    header[4 + i] = static_cast<uint8_t>(file_size >> (8 * i));
+  }
+  for (int i = 0; i < 4; i++) {
+    header[12 + i] = static_cast<uint8_t>(chunk_size >> (8 * i));
+  }
+  Blake3 hasher;
+  hasher.Update(header, sizeof(header));
+  for (const Digest& d : chunks) hasher.Update(d.data(), d.size());
+  hasher.Final(out->data());
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::ChunkHasher* Unwrap(ZsChunkHasher* h) {
+  return reinterpret_cast<zapshare::ChunkHasher*>(h);
+}
+
+const zapshare::ChunkHasher* Unwrap(const ZsChunkHasher* h) {
+  return reinterpret_cast<const zapshare::ChunkHasher*>(h);
+}
+
+}  // namespace
+
+ZsChunkHasher* zs_chunk_hasher_new(uint64_t file_size, uint32_t chunk_size) {
+  return reinterpret_cast<ZsChunkHasher*>(
+      new zapshare::ChunkHasher(file_size, chunk_size));
+}
+
+void zs_chunk_hasher_free(ZsChunkHasher* hasher) { delete Unwrap(hasher); }
+
+void zs_chunk_hasher_update(ZsChunkHasher* hasher, uint64_t offset,
+                            const uint8_t* data, size_t len) {
+  Unwrap(hasher)->Update(offset, data, len);
+}
+
+void zs_chunk_hasher_update_zeros(ZsChunkHasher* hasher, uint64_t offset,
+                                  uint64_t len) {
+  Unwrap(hasher)->UpdateZeros(offset, len);
+}
+
+void zs_chunk_hasher_reset_chunk(ZsChunkHasher* hasher, uint32_t index) {
+  Unwrap(hasher)->ResetChunk(index);
+}
+
+uint32_t zs_chunk_hasher_chunk_count(const ZsChunkHasher* hasher) {
+  return Unwrap(hasher)->ChunkCount();
+}
+
+uint32_t zs_chunk_hasher_completed(const ZsChunkHasher* hasher) {
+  return Unwrap(hasher)->CompletedChunks();
+}
+
+int32_t zs_chunk_hasher_chunk_digest(const ZsChunkHasher* hasher,
+                                     uint32_t index, uint8_t* out) {
+  zapshare::Digest d;
+  if (!Unwrap(hasher)->ChunkDigest(index, &d)) return 0;
+  std::memcpy(out, d.data(), d.size());
+  return 1;
+}
+
+int32_t zs_chunk_hasher_file_digest(const ZsChunkHasher* hasher,
+                                    uint8_t* out) {
+  zapshare::Digest d;
+  if (!Unwrap(hasher)->FileDigest(&d)) return 0;
+  std::memcpy(out, d.data(), d.size());
+  return 1;
+}
+
+void zs_blake3(const uint8_t* data, size_t len, uint8_t* out) {
+  zapshare::Blake3::Hash(data, len, out);
+}
@@ -0,0 +1,100 @@
+#ifndef ZAPSHARE_NATIVE_CONTENT_HASH_H_
+#define ZAPSHARE_NATIVE_CONTENT_HASH_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "blake3.h"
+#include "export.h"
+
+namespace zapshare {
+
+// Matches ParallelTransferService.DEFAULT_CHUNK_SIZE on the Dart side.
+constexpr uint32_t kDefaultDigestChunkSize = 4 * 1024 * 1024;
+
+using Digest = std::array<uint8_t, kBlake3OutLen>;
+
+// Computes a BLAKE3 digest for every fixed-size chunk of a file while the
+// bytes stream past, plus a file digest derived from the chunk digests, so
+// nothing has to be read twice.
+//
+// Bytes may arrive out of order (one parallel range stream per chunk group);
+// each chunk is hashed as long as its own bytes arrive in sequence starting at
+// the chunk boundary. A chunk whose stream skips or rewinds is dropped and
+// picked up again the next time its first byte is fed.
+//
+// The file digest is BLAKE3("ZSCD" || le64 size || le32 chunk size ||
+// chunk digest 0 || ... || chunk digest n-1).
+class ChunkHasher {
+ public:
+  ChunkHasher(uint64_t file_size, uint32_t chunk_size);
+
+  // Feeds bytes that start at |offset| in the file.
+  void Update(uint64_t offset, const uint8_t* data, size_t len);
+  // Feeds |len| zero bytes, as a sparse file's holes read. Whole chunks
+  // cost one cached digest rather than hashing them.
+  void UpdateZeros(uint64_t offset, uint64_t len);
+
+  // Forgets a chunk's digest so a re-download can hash it again.
+  void ResetChunk(uint32_t index);
+
+  uint32_t ChunkCount() const { return static_cast<uint32_t>(done_.size()); }
+  uint32_t CompletedChunks() const { return completed_; }
+  uint64_t file_size() const { return file_size_; }
+  uint32_t chunk_size() const { return chunk_size_; }
+
+  // False if the chunk has not been fully hashed yet.
+  bool ChunkDigest(uint32_t index, Digest* out) const;
+  // False until every chunk has been hashed.
+  bool FileDigest(Digest* out) const;
+
+  static void CombineDigests(uint64_t file_size, uint32_t chunk_size,
+                             const std::vector<Digest>& chunks, Digest* out);
+
+ private:
+  struct Pending {
+    Blake3 hasher;
+    uint64_t next_offset;
+  };
+
+  uint64_t file_size_;
+  uint32_t chunk_size_;
+  uint32_t completed_ = 0;
+  std::vector<Digest> digests_;
+  std::vector<uint8_t> done_;
+  std::unordered_map<uint32_t, std::unique_ptr<Pending>> pending_;
+  std::unique_ptr<Digest> zero_chunk_;  // Digest of a whole chunk of zeros.
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsChunkHasher ZsChunkHasher;
+
+ZS_EXPORT ZsChunkHasher* zs_chunk_hasher_new(uint64_t file_size,
+                                             uint32_t chunk_size);
+ZS_EXPORT void zs_chunk_hasher_free(ZsChunkHasher* hasher);
+ZS_EXPORT void zs_chunk_hasher_update(ZsChunkHasher* hasher, uint64_t offset,
+                                      const uint8_t* data, size_t len);
+ZS_EXPORT void zs_chunk_hasher_update_zeros(ZsChunkHasher* hasher,
+                                            uint64_t offset, uint64_t len);
+ZS_EXPORT void zs_chunk_hasher_reset_chunk(ZsChunkHasher* hasher,
+                                           uint32_t index);
+ZS_EXPORT uint32_t zs_chunk_hasher_chunk_count(const ZsChunkHasher* hasher);
+ZS_EXPORT uint32_t zs_chunk_hasher_completed(const ZsChunkHasher* hasher);
+// Both return 1 and write 32 bytes to |out| when the digest is available.
+ZS_EXPORT int32_t zs_chunk_hasher_chunk_digest(const ZsChunkHasher* hasher,
+                                               uint32_t index, uint8_t* out);
+ZS_EXPORT int32_t zs_chunk_hasher_file_digest(const ZsChunkHasher* hasher,
+                                              uint8_t* out);
+
+ZS_EXPORT void zs_blake3(const uint8_t* data, size_t len, uint8_t* out);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_CONTENT_HASH_H_
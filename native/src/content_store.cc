@@ -0,0 +1,347 @@
+#include "content_store.h"
+
+#include <cstring>
+
+#if defined(_WIN32)
+#include <intrin.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+#if defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint32_t kStoreMagic = 0x5343535A;  // "ZSCS"
+constexpr uint32_t kStoreVersion = 1;
+constexpr uint32_t kInitialCapacity = 256;
+
+constexpr uint8_t kSlotEmpty = 0;
+constexpr uint8_t kSlotLive = 1;
+constexpr uint8_t kSlotDead = 2;
+
+// On-disk layout, little-endian (every target the app ships on).
+struct StoreHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity;  // Slots; a power of two.
+  uint8_t reserved[52];
+};
+static_assert(sizeof(StoreHeader) == 64, "store header layout changed");
+
+struct StoreRecord {
+  uint64_t size;
+  int64_t mtime_ms;
+  uint8_t digest[32];
+  uint16_t path_len;
+  uint8_t state;
+  uint8_t reserved[5];
+  char path[ContentStore::kMaxPath + 1];
+};
+static_assert(sizeof(StoreRecord) == 512, "store record layout changed");
+
+size_t TableBytes(uint32_t capacity) {
+  return sizeof(StoreHeader) + static_cast<size_t>(capacity) *
+                                   sizeof(StoreRecord);
+}
+
+StoreRecord* Records(uint8_t* data) {
+  return reinterpret_cast<StoreRecord*>(data + sizeof(StoreHeader));
+}
+
+// Publishes a slot's state after its fields, so a reader (or a reopen after
+// a crash) never sees a live slot with a half-written record.
+void StoreState(StoreRecord* record, uint8_t state) {
+#if defined(_MSC_VER)
+  _InterlockedExchange8(reinterpret_cast<volatile char*>(&record->state),
+                        static_cast<char>(state));
+#else
+  __atomic_store_n(&record->state, state, __ATOMIC_RELEASE);
+#endif
+}
+
+uint32_t SlotHash(uint64_t size, const uint8_t* digest) {
+  // The digest is already uniformly distributed; mix in the size so equal
+  // prefixes of different lengths don't collide.
+  uint64_t h;
+  std::memcpy(&h, digest, sizeof(h));
+  h ^= size * 0x9E3779B97F4A7C15ull;
+  return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+bool SameKey(const StoreRecord& r, uint64_t size, const uint8_t* digest) {
+  return r.size == size && std::memcmp(r.digest, digest, 32) == 0;
+}
+
+int64_t ProbeTable(const StoreRecord* records, uint32_t capacity,
+                   uint64_t size, const uint8_t* digest, bool for_insert) {
+  const uint32_t mask = capacity - 1;
+  int64_t free_slot = -1;
+  uint32_t slot = SlotHash(size, digest) & mask;
+  for (uint32_t i = 0; i < capacity; i++, slot = (slot + 1) & mask) {
+    const StoreRecord& r = records[slot];
+    if (r.state == kSlotEmpty) {
+      if (!for_insert) return -1;
+      return free_slot >= 0 ? free_slot : slot;
+    }
+    if (r.state == kSlotLive && SameKey(r, size, digest)) return slot;
+    if (r.state == kSlotDead && free_slot < 0) free_slot = slot;
+  }
+  return for_insert ? free_slot : -1;
+}
+
+void InitTable(uint8_t* data, uint32_t capacity) {
+  std::memset(data, 0, TableBytes(capacity));
+  auto* header = reinterpret_cast<StoreHeader*>(data);
+  header->version = kStoreVersion;
+  header->capacity = capacity;
+  header->magic = kStoreMagic;
+}
+
+}  // namespace
+
+ContentStore::ContentStore(std::string path) : path_(std::move(path)) {}
+
+ContentStore::~ContentStore() = default;
+
+std::unique_ptr<ContentStore> ContentStore::Open(const std::string& path) {
+  std::unique_ptr<ContentStore> store(new ContentStore(path));
+  uint64_t bytes = 0;
+  int64_t mtime_ms = 0;
+  uint32_t capacity = kInitialCapacity;
+  if (StatFile(path, &bytes, &mtime_ms) && bytes > sizeof(StoreHeader)) {
+    const uint64_t slots =
+        (bytes - sizeof(StoreHeader)) / sizeof(StoreRecord);
+    if (slots >= kInitialCapacity && slots <= UINT32_MAX &&
+        (slots & (slots - 1)) == 0 &&
+        TableBytes(static_cast<uint32_t>(slots)) == bytes) {
+      capacity = static_cast<uint32_t>(slots);
+    }
+  }
+  if (!store->Map(capacity)) return nullptr;
+  return store;
+}
+
+bool ContentStore::Map(uint32_t capacity) {
+  mapping_.reset();
+  bool fresh = false;
+  mapping_ = MappedFile::Open(path_, TableBytes(capacity), &fresh);
+  if (mapping_ == nullptr) return false;
+
+  const auto* header = reinterpret_cast<const StoreHeader*>(mapping_->data());
+  if (fresh || header->magic != kStoreMagic ||
+      header->version != kStoreVersion || header->capacity != capacity) {
+    InitTable(mapping_->data(), capacity);
+    if (!mapping_->Sync()) return false;
+  }
+  capacity_ = capacity;
+
+  // Counts aren't stored, so they can't drift from the slots after a crash.
+  live_ = 0;
+  used_ = 0;
+  const StoreRecord* records = Records(mapping_->data());
+  for (uint32_t i = 0; i < capacity_; i++) {
+    if (records[i].state != kSlotEmpty) used_++;
+    if (records[i].state == kSlotLive) live_++;
+  }
+  return true;
+}
+
+bool ContentStore::Grow() {
+  // Double when mostly live; otherwise just rebuild to drop tombstones.
+  const uint32_t capacity =
+      live_ * 4 >= capacity_ ? capacity_ * 2 : capacity_;
+  if (capacity < capacity_) return false;
+
+  const std::string tmp = path_ + ".tmp";
+  RemoveFile(tmp);
+  bool fresh = false;
+  auto next = MappedFile::Open(tmp, TableBytes(capacity), &fresh);
+  if (next == nullptr) return false;
+  InitTable(next->data(), capacity);
+
+  const StoreRecord* from = Records(mapping_->data());
+  StoreRecord* to = Records(next->data());
+  for (uint32_t i = 0; i < capacity_; i++) {
+    if (from[i].state != kSlotLive) continue;
+    const int64_t slot =
+        ProbeTable(to, capacity, from[i].size, from[i].digest, true);
+    if (slot < 0) return false;
+    to[slot] = from[i];
+  }
+  if (!next->Sync()) return false;
+
+  // Both mappings must be closed before the rename on Windows.
+  next.reset();
+  mapping_.reset();
+  if (!RenameFile(tmp, path_)) {
+    RemoveFile(tmp);
+    return Map(capacity_);
+  }
+  return Map(capacity);
+}
+
+int64_t ContentStore::Probe(uint64_t size, const Digest& digest,
+                            bool for_insert) const {
+  return ProbeTable(Records(mapping_->data()), capacity_, size, digest.data(),
+                    for_insert);
+}
+
+bool ContentStore::Add(const std::string& file_path, const Digest& digest) {
+  if (file_path.empty() || file_path.size() > kMaxPath) return false;
+  uint64_t size = 0;
+  int64_t mtime_ms = 0;
+  if (!StatFile(file_path, &size, &mtime_ms)) return false;
+
+  int64_t slot = Probe(size, digest, true);
+  StoreRecord* records = Records(mapping_->data());
+  const bool claims_empty = slot >= 0 && records[slot].state == kSlotEmpty;
+  if (slot < 0 || (claims_empty && (used_ + 1) * 2 > capacity_)) {
+    if (!Grow()) return false;
+    slot = Probe(size, digest, true);
+    if (slot < 0) return false;
+    records = Records(mapping_->data());
+  }
+
+  StoreRecord* r = &records[slot];
+  const uint8_t before = r->state;
+  // Retire the slot while it is rewritten.
+  if (before == kSlotLive) StoreState(r, kSlotDead);
+  r->size = size;
+  r->mtime_ms = mtime_ms;
+  std::memcpy(r->digest, digest.data(), sizeof(r->digest));
+  r->path_len = static_cast<uint16_t>(file_path.size());
+  std::memset(r->path, 0, sizeof(r->path));
+  std::memcpy(r->path, file_path.data(), file_path.size());
+  StoreState(r, kSlotLive);
+
+  if (before == kSlotEmpty) used_++;
+  if (before != kSlotLive) live_++;
+  return true;
+}
+
+bool ContentStore::Find(uint64_t size, const Digest& digest,
+                        std::string* file_path) {
+  const int64_t slot = Probe(size, digest, false);
+  if (slot < 0) return false;
+  StoreRecord* r = &Records(mapping_->data())[slot];
+  std::string path(r->path, r->path_len);
+
+  // The file may have been edited, replaced or deleted since it was indexed.
+  uint64_t now_size = 0;
+  int64_t now_mtime = 0;
+  if (!StatFile(path, &now_size, &now_mtime) || now_size != r->size ||
+      now_mtime != r->mtime_ms) {
+    StoreState(r, kSlotDead);
+    live_--;
+    return false;
+  }
+  *file_path = std::move(path);
+  return true;
+}
+
+void ContentStore::Remove(uint64_t size, const Digest& digest) {
+  const int64_t slot = Probe(size, digest, false);
+  if (slot < 0) return;
+  StoreState(&Records(mapping_->data())[slot], kSlotDead);
+  live_--;
+}
+
+LinkKind CloneOrLink(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+  // Block cloning needs ReFS and a same-volume handle dance; NTFS, which
+  // nearly every receiver uses, only has hard links.
+  return CreateHardLinkW(WidenPath(to).c_str(), WidenPath(from).c_str(),
+                         nullptr)
+             ? LinkKind::kHardLinked
+             : LinkKind::kFailed;
+#else
+#if defined(__APPLE__)
+  if (clonefile(from.c_str(), to.c_str(), 0) == 0) return LinkKind::kCloned;
+#elif defined(__linux__)
+  const int src = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src < 0) return LinkKind::kFailed;
+  const int dst =
+      open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (dst < 0) {
+    close(src);
+    return LinkKind::kFailed;
+  }
+  const bool cloned = ioctl(dst, FICLONE, src) == 0;
+  close(dst);
+  close(src);
+  if (cloned) return LinkKind::kCloned;
+  unlink(to.c_str());
+#endif
+  return link(from.c_str(), to.c_str()) == 0 ? LinkKind::kHardLinked
+                                             : LinkKind::kFailed;
+#endif
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::ContentStore* Unwrap(ZsContentStore* s) {
+  return reinterpret_cast<zapshare::ContentStore*>(s);
+}
+
+const zapshare::ContentStore* Unwrap(const ZsContentStore* s) {
+  return reinterpret_cast<const zapshare::ContentStore*>(s);
+}
+
+zapshare::Digest ToDigest(const uint8_t* bytes) {
+  zapshare::Digest digest;
+  std::memcpy(digest.data(), bytes, digest.size());
+  return digest;
+}
+
+}  // namespace
+
+ZsContentStore* zs_store_open(const char* path) {
+  return reinterpret_cast<ZsContentStore*>(
+      zapshare::ContentStore::Open(path).release());
+}
+
+void zs_store_close(ZsContentStore* store) { delete Unwrap(store); }
+
+int32_t zs_store_add(ZsContentStore* store, const char* file_path,
+                     const uint8_t* digest) {
+  return Unwrap(store)->Add(file_path, ToDigest(digest)) ? 1 : 0;
+}
+
+int32_t zs_store_find(ZsContentStore* store, uint64_t size,
+                      const uint8_t* digest, char* out, size_t cap) {
+  std::string path;
+  if (!Unwrap(store)->Find(size, ToDigest(digest), &path)) return 0;
+  if (path.size() + 1 > cap) return -static_cast<int32_t>(path.size() + 1);
+  std::memcpy(out, path.c_str(), path.size() + 1);
+  return static_cast<int32_t>(path.size());
+}
+
+void zs_store_remove(ZsContentStore* store, uint64_t size,
+                     const uint8_t* digest) {
+  Unwrap(store)->Remove(size, ToDigest(digest));
+}
+
+uint32_t zs_store_count(const ZsContentStore* store) {
+  return Unwrap(store)->count();
+}
+
+int32_t zs_clone_or_link(const char* from, const char* to) {
+  return static_cast<int32_t>(zapshare::CloneOrLink(from, to));
+}
@@ -0,0 +1,105 @@
+#ifndef ZAPSHARE_NATIVE_CONTENT_STORE_H_
+#define ZAPSHARE_NATIVE_CONTENT_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "content_hash.h"
+#include "export.h"
+#include "mapped_file.h"
+
+namespace zapshare {
+
+// Index of files this device has already received, keyed by size plus the
+// ChunkHasher file digest senders advertise in their LIST metadata. Before
+// downloading, a receiver looks each offered file up here and, on a hit,
+// links the existing copy into place instead of transferring it again.
+//
+// The index is an open-addressing hash table in a memory-mapped file: a
+// 64-byte header followed by fixed 512-byte records. A record is filled in
+// before its state byte is published, so a crash leaves either the old entry
+// or the new one. Entries are checked against the file's current size and
+// modification time on lookup; stale ones are dropped. Not thread-safe; the
+// app keeps one instance per process.
+class ContentStore {
+ public:
+  // Longest path, in UTF-8 bytes, a record can hold.
+  static constexpr size_t kMaxPath = 455;
+
+  // Opens or creates the index at |path|. Returns null on I/O failure.
+  static std::unique_ptr<ContentStore> Open(const std::string& path);
+  ~ContentStore();
+
+  ContentStore(const ContentStore&) = delete;
+  ContentStore& operator=(const ContentStore&) = delete;
+
+  // Records |file_path| as holding content |digest|. The size and
+  // modification time are read from the file. False if it can't be stat'ed,
+  // the path is too long, or the index can't grow.
+  bool Add(const std::string& file_path, const Digest& digest);
+
+  // Finds a still-valid file with this size and digest.
+  bool Find(uint64_t size, const Digest& digest, std::string* file_path);
+
+  // Drops the entry for this size and digest, if any.
+  void Remove(uint64_t size, const Digest& digest);
+
+  uint32_t count() const { return live_; }
+  uint32_t capacity() const { return capacity_; }
+
+ private:
+  explicit ContentStore(std::string path);
+
+  bool Map(uint32_t capacity);
+  bool Grow();
+  // Slot holding this key, or the first free slot of its probe sequence when
+  // |for_insert| is set. -1 if neither was found.
+  int64_t Probe(uint64_t size, const Digest& digest, bool for_insert) const;
+
+  std::string path_;
+  std::unique_ptr<MappedFile> mapping_;
+  uint32_t capacity_ = 0;
+  uint32_t live_ = 0;
+  uint32_t used_ = 0;  // Live plus tombstoned slots.
+};
+
+enum class LinkKind : int32_t {
+  kFailed = 0,
+  kCloned = 1,      // Copy-on-write clone (reflink); independent afterwards.
+  kHardLinked = 2,  // Same inode; edits to one show in the other.
+};
+
+// Makes |to|, which must not exist, hold the same content as |from| without
+// copying: a reflink where the filesystem supports it (Btrfs, XFS, APFS),
+// otherwise a hard link. Both fail across volumes and on most Android
+// shared storage, in which case the caller copies.
+LinkKind CloneOrLink(const std::string& from, const std::string& to);
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsContentStore ZsContentStore;
+
+ZS_EXPORT ZsContentStore* zs_store_open(const char* path);
+ZS_EXPORT void zs_store_close(ZsContentStore* store);
+// |digest| is 32 bytes. Returns 1 on success.
+ZS_EXPORT int32_t zs_store_add(ZsContentStore* store, const char* file_path,
+                               const uint8_t* digest);
+// Writes the NUL-terminated path of a matching file into |out| and returns
+// its length, 0 when there is no valid match, or the required buffer size
+// (length + 1) as a negative number when |cap| is too small.
+ZS_EXPORT int32_t zs_store_find(ZsContentStore* store, uint64_t size,
+                                const uint8_t* digest, char* out,
+                                size_t cap);
+ZS_EXPORT void zs_store_remove(ZsContentStore* store, uint64_t size,
+                               const uint8_t* digest);
+ZS_EXPORT uint32_t zs_store_count(const ZsContentStore* store);
+// Returns a LinkKind.
+ZS_EXPORT int32_t zs_clone_or_link(const char* from, const char* to);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_CONTENT_STORE_H_
@@ -0,0 +1,894 @@
+#include "control_codec.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace zapshare {
+
+namespace {
+
+using K = ControlKind;
+
+// Every message starts with who sent it and when.
+#define ZS_CONTROL_COMMON                                          \
+  {1, K::kString, "deviceId"}, {2, K::kString, "deviceName"},      \
+      {3, K::kInt, "timestamp"}
+
+constexpr ControlField kConnectionRequestFields[] = {
+    ZS_CONTROL_COMMON,
+    {4, K::kString, "platform"},
+    {5, K::kInt, "port"},
+    {6, K::kInt, "fileCount"},
+    {7, K::kStrings, "fileNames"},
+    {8, K::kInt, "totalSize"},
+};
+
+constexpr ControlField kConnectionResponseFields[] = {
+    ZS_CONTROL_COMMON,
+    {4, K::kBool, "accepted"},
+};
+
+constexpr ControlField kCastUrlFields[] = {
+    ZS_CONTROL_COMMON,
+    {4, K::kString, "url"},
+    {5, K::kString, "fileName"},
+    {6, K::kString, "subtitleUrl"},
+};
+
+constexpr ControlField kCastControlFields[] = {
+    ZS_CONTROL_COMMON,
+    {4, K::kString, "action"},
+    {5, K::kDouble, "seekPosition"},
+    {6, K::kDouble, "volume"},
+};
+
+constexpr ControlField kCastStatusFields[] = {
+    ZS_CONTROL_COMMON,
+    {4, K::kDouble, "position"},
+    {5, K::kDouble, "duration"},
+    {6, K::kDouble, "buffered"},
+    {7, K::kBool, "isPlaying"},
+    {8, K::kBool, "isBuffering"},
+    {9, K::kDouble, "volume"},
+    {10, K::kString, "fileName"},
+};
+
+constexpr ControlField kCastAckFields[] = {
+    ZS_CONTROL_COMMON,
+    {4, K::kBool, "accepted"},
+};
+
+constexpr ControlField kScreenMirrorFields[] = {
+    ZS_CONTROL_COMMON,
+    {4, K::kString, "streamUrl"},
+};
+
+constexpr ControlField kScreenMirrorControlFields[] = {
+    ZS_CONTROL_COMMON,
+    {4, K::kString, "action"},
+    {5, K::kDouble, "tapX"},
+    {6, K::kDouble, "tapY"},
+    {7, K::kDouble, "endX"},
+    {8, K::kDouble, "endY"},
+    {9, K::kString, "text"},
+    {10, K::kDouble, "scrollDelta"},
+    {11, K::kInt, "duration"},
+};
+
+#undef ZS_CONTROL_COMMON
+
+template <size_t N>
+constexpr ControlSchema Schema(ControlType type, const char* name,
+                               const ControlField (&fields)[N]) {
+  return {type, name, fields, N};
+}
+
+// Indexed by type - 1.
+constexpr ControlSchema kSchemas[kControlTypes] = {
+    Schema(ControlType::kConnectionRequest, "ZAPSHARE_CONNECTION_REQUEST",
+           kConnectionRequestFields),
+    Schema(ControlType::kConnectionResponse, "ZAPSHARE_CONNECTION_RESPONSE",
+           kConnectionResponseFields),
+    Schema(ControlType::kCastUrl, "ZAPSHARE_CAST_URL", kCastUrlFields),
+    Schema(ControlType::kCastControl, "ZAPSHARE_CAST_CONTROL",
+           kCastControlFields),
+    Schema(ControlType::kCastStatus, "ZAPSHARE_CAST_STATUS",
+           kCastStatusFields),
+    Schema(ControlType::kCastAck, "ZAPSHARE_CAST_ACK", kCastAckFields),
+    Schema(ControlType::kScreenMirror, "ZAPSHARE_SCREEN_MIRROR",
+           kScreenMirrorFields),
+    Schema(ControlType::kScreenMirrorControl,
+           "ZAPSHARE_SCREEN_MIRROR_CONTROL", kScreenMirrorControlFields),
+};
+
+constexpr bool SameKey(const char* a, const char* b) {
+  while (*a != '\0' && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+// Numbers fit the tag byte and, like keys, are unique; "type" and "zsc"
+// belong to the envelope.
+constexpr bool ValidSchemas() {
+  for (int t = 0; t < kControlTypes; t++) {
+    const ControlSchema& s = kSchemas[t];
+    if (static_cast<int>(s.type) != t + 1) return false;
+    for (size_t i = 0; i < s.count; i++) {
+      const ControlField& f = s.fields[i];
+      if (f.number < 1 || f.number > 31 || SameKey(f.key, "type") ||
+          SameKey(f.key, "zsc")) {
+        return false;
+      }
+      for (size_t j = 0; j < i; j++) {
+        if (s.fields[j].number == f.number ||
+            SameKey(s.fields[j].key, f.key)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+static_assert(ValidSchemas(), "control schemas must have unique fields");
+
+constexpr uint8_t kWireVarint = 0;
+constexpr uint8_t kWireDouble = 1;
+constexpr uint8_t kWireBytes = 2;
+
+constexpr uint8_t WireOf(ControlKind kind) {
+  return kind == K::kDouble   ? kWireDouble
+         : kind == K::kString || kind == K::kStrings ? kWireBytes
+                                                     : kWireVarint;
+}
+
+int IndexOf(const ControlSchema& schema, uint8_t number) {
+  for (size_t i = 0; i < schema.count; i++) {
+    if (schema.fields[i].number == number) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+void PutVarint(std::vector<uint8_t>* out, uint64_t v) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<uint8_t>(v));
+}
+
+bool GetVarint(const uint8_t* data, size_t len, size_t* pos, uint64_t* v) {
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*pos >= len) return false;
+    const uint8_t b = data[(*pos)++];
+    *v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+void PutBytes(std::vector<uint8_t>* out, const std::string& s) {
+  PutVarint(out, s.size());
+  out->insert(out->end(), s.begin(), s.end());
+}
+
+// ---- JSON ----
+
+// A value as far as the schemas care.
+struct JsonValue {
+  enum Kind { kNull, kString, kNumber, kBool, kStrings, kOther } kind = kNull;
+  std::string s;
+  double d = 0;
+  int64_t i = 0;
+  bool integral = false;
+  std::vector<std::string> list;
+};
+
+class JsonReader {
+ public:
+  JsonReader(const uint8_t* data, size_t len)
+      : p_(reinterpret_cast<const char*>(data)), end_(p_ + len) {}
+
+  bool AtEnd() {
+    Space();
+    return p_ == end_;
+  }
+
+  bool Eat(char c) {
+    Space();
+    if (p_ == end_ || *p_ != c) return false;
+    p_++;
+    return true;
+  }
+
+  bool String(std::string* out) {
+    if (!Eat('"')) return false;
+    out->clear();
+    while (p_ != end_) {
+      const char c = *p_++;
+      if (c == '"') return true;
+      if (static_cast<uint8_t>(c) < 0x20) return false;
+      if (c != '\\') {
+        out->push_back(c);
+        continue;
+      }
+      if (p_ == end_) return false;
+      switch (*p_++) {
+        case '"': out->push_back('"'); break;
+        case '\\': out->push_back('\\'); break;
+        case '/': out->push_back('/'); break;
+        case 'b': out->push_back('\b'); break;
+        case 'f': out->push_back('\f'); break;
+        case 'n': out->push_back('\n'); break;
+        case 'r': out->push_back('\r'); break;
+        case 't': out->push_back('\t'); break;
+        case 'u': {
+          uint32_t cp;
+          if (!Hex4(&cp)) return false;
+          if (cp >= 0xd800 && cp < 0xdc00) {
+            uint32_t low;
+            if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') return false;
+            p_ += 2;
+            if (!Hex4(&low) || low < 0xdc00 || low >= 0xe000) return false;
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+          } else if (cp >= 0xdc00 && cp < 0xe000) {
+            return false;
+          }
+          Utf8(cp, out);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  bool Value(JsonValue* out, int depth) {
+    Space();
+    if (p_ == end_) return false;
+    *out = JsonValue();
+    switch (*p_) {
+      case '"':
+        out->kind = JsonValue::kString;
+        return String(&out->s);
+      case 't':
+        out->kind = JsonValue::kBool;
+        out->i = 1;
+        return Word("true");
+      case 'f':
+        out->kind = JsonValue::kBool;
+        return Word("false");
+      case 'n':
+        return Word("null");
+      case '[':
+        return Array(out, depth);
+      case '{':
+        out->kind = JsonValue::kOther;
+        return Skip(depth);
+      default:
+        out->kind = JsonValue::kNumber;
+        return Number(out);
+    }
+  }
+
+ private:
+  static constexpr int kMaxDepth = 16;
+
+  void Space() {
+    while (p_ != end_ &&
+           (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+      p_++;
+    }
+  }
+
+  bool Word(const char* word) {
+    const size_t n = std::strlen(word);
+    if (static_cast<size_t>(end_ - p_) < n || std::memcmp(p_, word, n) != 0) {
+      return false;
+    }
+    p_ += n;
+    return true;
+  }
+
+  bool Hex4(uint32_t* out) {
+    if (end_ - p_ < 4) return false;
+    *out = 0;
+    for (int i = 0; i < 4; i++) {
+      const char c = *p_++;
+      *out <<= 4;
+      if (c >= '0' && c <= '9') {
+        *out |= static_cast<uint32_t>(c - '0');
+      } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        *out |= static_cast<uint32_t>((c | 0x20) - 'a' + 10);
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static void Utf8(uint32_t cp, std::string* out) {
+    if (cp < 0x80) {
+      out->push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+      out->push_back(static_cast<char>(0xc0 | cp >> 6));
+      out->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+      out->push_back(static_cast<char>(0xe0 | cp >> 12));
+      out->push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3f)));
+      out->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else {
+      out->push_back(static_cast<char>(0xf0 | cp >> 18));
+      out->push_back(static_cast<char>(0x80 | (cp >> 12 & 0x3f)));
+      out->push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3f)));
+      out->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    }
+  }
+
+  bool Number(JsonValue* out) {
+    char token[64];
+    size_t n = 0;
+    bool integral = true;
+    while (p_ != end_ && n < sizeof(token) - 1 &&
+           std::strchr("+-0123456789.eE", *p_) != nullptr && *p_ != '\0') {
+      if (*p_ == '.' || *p_ == 'e' || *p_ == 'E') integral = false;
+      token[n++] = *p_++;
+    }
+    token[n] = '\0';
+    if (n == 0) return false;
+    char* end = nullptr;
+    out->d = std::strtod(token, &end);
+    if (end != token + n || !std::isfinite(out->d)) return false;
+    if (integral && std::fabs(out->d) < 9e18) {
+      out->i = std::strtoll(token, nullptr, 10);
+      out->integral = true;
+    }
+    return true;
+  }
+
+  // Only lists of strings mean anything to us; others are skipped.
+  bool Array(JsonValue* out, int depth) {
+    if (depth >= kMaxDepth || !Eat('[')) return false;
+    out->kind = JsonValue::kStrings;
+    if (Eat(']')) return true;
+    do {
+      JsonValue item;
+      if (!Value(&item, depth + 1)) return false;
+      if (item.kind == JsonValue::kString) {
+        out->list.push_back(std::move(item.s));
+      } else {
+        out->kind = JsonValue::kOther;
+      }
+    } while (Eat(','));
+    return Eat(']');
+  }
+
+  bool Skip(int depth) {
+    if (depth >= kMaxDepth || !Eat('{')) return false;
+    if (Eat('}')) return true;
+    do {
+      std::string key;
+      JsonValue value;
+      if (!String(&key) || !Eat(':') || !Value(&value, depth + 1)) {
+        return false;
+      }
+    } while (Eat(','));
+    return Eat('}');
+  }
+
+  const char* p_;
+  const char* const end_;
+};
+
+bool Assign(const ControlField& field, JsonValue* json, ControlValue* out) {
+  if (json->kind == JsonValue::kNull) return true;
+  switch (field.kind) {
+    case K::kString:
+      if (json->kind != JsonValue::kString) return false;
+      out->s = std::move(json->s);
+      break;
+    case K::kInt:
+      if (json->kind != JsonValue::kNumber || !json->integral) return false;
+      out->i = json->i;
+      break;
+    case K::kDouble:
+      if (json->kind != JsonValue::kNumber) return false;
+      out->d = json->d;
+      break;
+    case K::kBool:
+      if (json->kind != JsonValue::kBool) return false;
+      out->i = json->i;
+      break;
+    case K::kStrings:
+      if (json->kind != JsonValue::kStrings) return false;
+      out->list = std::move(json->list);
+      break;
+  }
+  out->present = true;
+  return true;
+}
+
+void PutJsonString(std::string* out, const std::string& s) {
+  out->push_back('"');
+  for (const char c : s) {
+    switch (c) {
+      case '"': *out += "\\\""; break;
+      case '\\': *out += "\\\\"; break;
+      case '\n': *out += "\\n"; break;
+      case '\r': *out += "\\r"; break;
+      case '\t': *out += "\\t"; break;
+      default:
+        if (static_cast<uint8_t>(c) < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x",
+                        static_cast<unsigned>(c));
+          *out += escaped;
+        } else {
+          out->push_back(c);
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+// The shortest of 15 or 17 digits that reads back the same, always with a
+// point or exponent, as Dart writes doubles.
+void PutJsonDouble(std::string* out, double d) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.15g", d);
+  if (std::strtod(buf, nullptr) != d) {
+    std::snprintf(buf, sizeof(buf), "%.17g", d);
+  }
+  *out += buf;
+  if (std::strpbrk(buf, ".e") == nullptr) *out += ".0";
+}
+
+}  // namespace
+
+const ControlSchema* FindControlSchema(ControlType type) {
+  const int t = static_cast<int>(type);
+  return t >= 1 && t <= kControlTypes ? &kSchemas[t - 1] : nullptr;
+}
+
+const ControlSchema* FindControlSchema(const std::string& name) {
+  for (const ControlSchema& s : kSchemas) {
+    if (name == s.name) return &s;
+  }
+  return nullptr;
+}
+
+bool ControlMessage::Reset(ControlType t) {
+  schema = FindControlSchema(t);
+  version = 0;
+  if (schema == nullptr) {
+    values.clear();
+    return false;
+  }
+  // Keeps the strings' capacity for the next message.
+  values.resize(schema->count);
+  for (ControlValue& v : values) {
+    v.present = false;
+    v.i = 0;
+    v.d = 0;
+    v.s.clear();
+    v.list.clear();
+  }
+  return true;
+}
+
+ControlValue* ControlMessage::Find(const char* key) {
+  return const_cast<ControlValue*>(
+      static_cast<const ControlMessage*>(this)->Find(key));
+}
+
+const ControlValue* ControlMessage::Find(const char* key) const {
+  if (schema == nullptr) return nullptr;
+  for (size_t i = 0; i < schema->count; i++) {
+    if (std::strcmp(schema->fields[i].key, key) == 0) return &values[i];
+  }
+  return nullptr;
+}
+
+bool DecodeControl(const uint8_t* data, size_t len, ControlMessage* out) {
+  return IsBinaryControl(data, len) ? DecodeControlBinary(data, len, out)
+                                    : DecodeControlJson(data, len, out);
+}
+
+bool DecodeControlBinary(const uint8_t* data, size_t len,
+                         ControlMessage* out) {
+  if (!IsBinaryControl(data, len) || data[3] == 0 ||
+      !out->Reset(static_cast<ControlType>(data[4]))) {
+    return false;
+  }
+  out->version = data[3];
+  const ControlSchema& schema = *out->schema;
+  size_t pos = kControlHeaderSize;
+  while (pos < len) {
+    const uint8_t tag = data[pos++];
+    const uint8_t wire = tag & 7;
+    uint64_t v = 0;
+    size_t at = pos;
+    switch (wire) {
+      case kWireVarint:
+        if (!GetVarint(data, len, &pos, &v)) return false;
+        break;
+      case kWireDouble:
+        if (len - pos < 8) return false;
+        for (int i = 7; i >= 0; i--) v = v << 8 | data[pos + i];
+        pos += 8;
+        break;
+      case kWireBytes:
+        if (!GetVarint(data, len, &pos, &v) || v > len - pos) return false;
+        at = pos;
+        pos += static_cast<size_t>(v);
+        break;
+      default:
+        return false;
+    }
+    const int index = IndexOf(schema, static_cast<uint8_t>(tag >> 3));
+    if (index < 0) continue;  // A later version's.
+    const ControlField& field = schema.fields[index];
+    ControlValue& value = out->values[static_cast<size_t>(index)];
+    if (WireOf(field.kind) != wire ||
+        (value.present && field.kind != K::kStrings)) {
+      return false;
+    }
+    value.present = true;
+    switch (field.kind) {
+      case K::kInt:
+        value.i = static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+        break;
+      case K::kBool:
+        value.i = v != 0;
+        break;
+      case K::kDouble:
+        std::memcpy(&value.d, &v, sizeof(v));
+        break;
+      case K::kString:
+        value.s.assign(reinterpret_cast<const char*>(data + at),
+                       static_cast<size_t>(v));
+        break;
+      case K::kStrings:
+        value.list.emplace_back(reinterpret_cast<const char*>(data + at),
+                                static_cast<size_t>(v));
+        break;
+    }
+  }
+  return true;
+}
+
+bool DecodeControlJson(const uint8_t* data, size_t len, ControlMessage* out) {
+  JsonReader in(data, len);
+  if (!in.Eat('{')) return false;
+  // The type may come after fields, so they wait until it's known.
+  std::vector<std::pair<std::string, JsonValue>> fields;
+  std::string type;
+  uint8_t version = 0;
+  if (!in.Eat('}')) {
+    do {
+      std::string key;
+      JsonValue value;
+      if (!in.String(&key) || !in.Eat(':') || !in.Value(&value, 1)) {
+        return false;
+      }
+      if (key == "type") {
+        if (value.kind != JsonValue::kString) return false;
+        type = std::move(value.s);
+      } else if (key == "zsc") {
+        if (value.kind == JsonValue::kNumber && value.integral) {
+          version = static_cast<uint8_t>(
+              value.i < 1 ? 0 : value.i > 255 ? 255 : value.i);
+        }
+      } else {
+        fields.emplace_back(std::move(key), std::move(value));
+      }
+    } while (in.Eat(','));
+    if (!in.Eat('}')) return false;
+  }
+  if (!in.AtEnd()) return false;
+  const ControlSchema* schema = FindControlSchema(type);
+  if (schema == nullptr || !out->Reset(schema->type)) return false;
+  out->version = version;
+  for (auto& [key, value] : fields) {
+    for (size_t i = 0; i < schema->count; i++) {
+      if (key != schema->fields[i].key) continue;
+      if (!Assign(schema->fields[i], &value, &out->values[i])) return false;
+      break;
+    }
+  }
+  return true;
+}
+
+void EncodeControl(const ControlMessage& message,
+                   std::vector<uint8_t>* out) {
+  out->clear();
+  if (message.schema == nullptr) return;
+  const ControlSchema& schema = *message.schema;
+  out->insert(out->end(), {'Z', 'S', 'C', kControlVersion,
+                           static_cast<uint8_t>(schema.type)});
+  for (size_t i = 0; i < schema.count; i++) {
+    const ControlField& field = schema.fields[i];
+    const ControlValue& value = message.values[i];
+    if (!value.present) continue;
+    const uint8_t tag =
+        static_cast<uint8_t>(field.number << 3 | WireOf(field.kind));
+    switch (field.kind) {
+      case K::kInt:
+        out->push_back(tag);
+        PutVarint(out, static_cast<uint64_t>(value.i) << 1 ^
+                           static_cast<uint64_t>(value.i >> 63));
+        break;
+      case K::kBool:
+        out->push_back(tag);
+        out->push_back(value.i != 0);
+        break;
+      case K::kDouble: {
+        out->push_back(tag);
+        uint64_t bits;
+        std::memcpy(&bits, &value.d, sizeof(bits));
+        for (int b = 0; b < 8; b++) {
+          out->push_back(static_cast<uint8_t>(bits >> (8 * b)));
+        }
+        break;
+      }
+      case K::kString:
+        out->push_back(tag);
+        PutBytes(out, value.s);
+        break;
+      case K::kStrings:
+        for (const std::string& s : value.list) {
+          out->push_back(tag);
+          PutBytes(out, s);
+        }
+        break;
+    }
+  }
+}
+
+void EncodeControlJson(const ControlMessage& message, std::string* out) {
+  out->clear();
+  if (message.schema == nullptr) return;
+  const ControlSchema& schema = *message.schema;
+  *out += "{\"type\":";
+  PutJsonString(out, schema.name);
+  for (size_t i = 0; i < schema.count; i++) {
+    const ControlField& field = schema.fields[i];
+    const ControlValue& value = message.values[i];
+    if (!value.present ||
+        (field.kind == K::kDouble && !std::isfinite(value.d))) {
+      continue;
+    }
+    out->push_back(',');
+    PutJsonString(out, field.key);
+    out->push_back(':');
+    switch (field.kind) {
+      case K::kInt:
+        *out += std::to_string(value.i);
+        break;
+      case K::kBool:
+        *out += value.i != 0 ? "true" : "false";
+        break;
+      case K::kDouble:
+        PutJsonDouble(out, value.d);
+        break;
+      case K::kString:
+        PutJsonString(out, value.s);
+        break;
+      case K::kStrings:
+        out->push_back('[');
+        for (size_t j = 0; j < value.list.size(); j++) {
+          if (j > 0) out->push_back(',');
+          PutJsonString(out, value.list[j]);
+        }
+        out->push_back(']');
+        break;
+    }
+  }
+  *out += ",\"zsc\":" + std::to_string(kControlVersion) + "}";
+}
+
+}  // namespace zapshare
+
+namespace {
+
+// What Dart holds: the message and its last encoding.
+struct Handle {
+  zapshare::ControlMessage message;
+  std::vector<uint8_t> encoded;
+  std::string json;
+  bool encoded_json = false;
+};
+
+Handle* Unwrap(ZsControlMessage* message) {
+  return reinterpret_cast<Handle*>(message);
+}
+
+const Handle* Unwrap(const ZsControlMessage* message) {
+  return reinterpret_cast<const Handle*>(message);
+}
+
+const zapshare::ControlField* FieldOf(int32_t type, int32_t index) {
+  const zapshare::ControlSchema* schema = zapshare::FindControlSchema(
+      static_cast<zapshare::ControlType>(type));
+  if (schema == nullptr || index < 0 ||
+      static_cast<size_t>(index) >= schema->count) {
+    return nullptr;
+  }
+  return &schema->fields[index];
+}
+
+// Null unless field |index| of |message| is of |kind|.
+zapshare::ControlValue* ValueOf(ZsControlMessage* message, int32_t index,
+                                zapshare::ControlKind kind) {
+  zapshare::ControlMessage& m = Unwrap(message)->message;
+  const zapshare::ControlField* field =
+      FieldOf(static_cast<int32_t>(m.type()), index);
+  if (field == nullptr || field->kind != kind) return nullptr;
+  return &m.values[static_cast<size_t>(index)];
+}
+
+const zapshare::ControlValue* ValueOf(const ZsControlMessage* message,
+                                      int32_t index) {
+  const zapshare::ControlMessage& m = Unwrap(message)->message;
+  if (index < 0 || static_cast<size_t>(index) >= m.values.size()) {
+    return nullptr;
+  }
+  return &m.values[static_cast<size_t>(index)];
+}
+
+}  // namespace
+
+const char* zs_control_type_name(int32_t type) {
+  const zapshare::ControlSchema* schema = zapshare::FindControlSchema(
+      static_cast<zapshare::ControlType>(type));
+  return schema != nullptr ? schema->name : nullptr;
+}
+
+int32_t zs_control_field_count(int32_t type) {
+  const zapshare::ControlSchema* schema = zapshare::FindControlSchema(
+      static_cast<zapshare::ControlType>(type));
+  return schema != nullptr ? static_cast<int32_t>(schema->count) : -1;
+}
+
+const char* zs_control_field_key(int32_t type, int32_t index) {
+  const zapshare::ControlField* field = FieldOf(type, index);
+  return field != nullptr ? field->key : nullptr;
+}
+
+int32_t zs_control_field_kind(int32_t type, int32_t index) {
+  const zapshare::ControlField* field = FieldOf(type, index);
+  return field != nullptr ? static_cast<int32_t>(field->kind) : -1;
+}
+
+int32_t zs_control_type_of(const char* name) {
+  const zapshare::ControlSchema* schema = zapshare::FindControlSchema(name);
+  return schema != nullptr ? static_cast<int32_t>(schema->type) : 0;
+}
+
+ZsControlMessage* zs_control_new(void) {
+  return reinterpret_cast<ZsControlMessage*>(new Handle());
+}
+
+void zs_control_free(ZsControlMessage* message) { delete Unwrap(message); }
+
+int32_t zs_control_reset(ZsControlMessage* message, int32_t type) {
+  return Unwrap(message)->message.Reset(
+             static_cast<zapshare::ControlType>(type))
+             ? 1
+             : 0;
+}
+
+int32_t zs_control_decode(ZsControlMessage* message, const uint8_t* data,
+                          size_t len) {
+  zapshare::ControlMessage& m = Unwrap(message)->message;
+  if (!zapshare::DecodeControl(data, len, &m)) {
+    m.Reset(zapshare::ControlType::kNone);
+    return 0;
+  }
+  return static_cast<int32_t>(m.type());
+}
+
+int32_t zs_control_version(const ZsControlMessage* message) {
+  return Unwrap(message)->message.version;
+}
+
+void zs_control_set_int(ZsControlMessage* message, int32_t index,
+                        int64_t value) {
+  zapshare::ControlValue* v =
+      ValueOf(message, index, zapshare::ControlKind::kInt);
+  if (v == nullptr) v = ValueOf(message, index, zapshare::ControlKind::kBool);
+  if (v == nullptr) return;
+  v->i = value;
+  v->present = true;
+}
+
+void zs_control_set_double(ZsControlMessage* message, int32_t index,
+                           double value) {
+  zapshare::ControlValue* v =
+      ValueOf(message, index, zapshare::ControlKind::kDouble);
+  if (v == nullptr) return;
+  v->d = value;
+  v->present = true;
+}
+
+void zs_control_set_string(ZsControlMessage* message, int32_t index,
+                           const uint8_t* data, size_t len) {
+  zapshare::ControlValue* v =
+      ValueOf(message, index, zapshare::ControlKind::kString);
+  if (v == nullptr) return;
+  v->s.assign(reinterpret_cast<const char*>(data), len);
+  v->present = true;
+}
+
+void zs_control_add_string(ZsControlMessage* message, int32_t index,
+                           const uint8_t* data, size_t len) {
+  zapshare::ControlValue* v =
+      ValueOf(message, index, zapshare::ControlKind::kStrings);
+  if (v == nullptr) return;
+  v->list.emplace_back(reinterpret_cast<const char*>(data), len);
+  v->present = true;
+}
+
+int32_t zs_control_present(const ZsControlMessage* message, int32_t index) {
+  const zapshare::ControlValue* v = ValueOf(message, index);
+  return v != nullptr && v->present ? 1 : 0;
+}
+
+int64_t zs_control_get_int(const ZsControlMessage* message, int32_t index) {
+  const zapshare::ControlValue* v = ValueOf(message, index);
+  return v != nullptr ? v->i : 0;
+}
+
+double zs_control_get_double(const ZsControlMessage* message,
+                             int32_t index) {
+  const zapshare::ControlValue* v = ValueOf(message, index);
+  return v != nullptr ? v->d : 0;
+}
+
+const uint8_t* zs_control_get_string(const ZsControlMessage* message,
+                                     int32_t index, int32_t item,
+                                     size_t* len) {
+  const zapshare::ControlValue* v = ValueOf(message, index);
+  if (v == nullptr || !v->present) return nullptr;
+  const std::string* s = nullptr;
+  if (!v->list.empty()) {
+    if (item < 0 || static_cast<size_t>(item) >= v->list.size()) {
+      return nullptr;
+    }
+    s = &v->list[static_cast<size_t>(item)];
+  } else if (item == 0) {
+    s = &v->s;
+  } else {
+    return nullptr;
+  }
+  *len = s->size();
+  return reinterpret_cast<const uint8_t*>(s->data());
+}
+
+int32_t zs_control_list_size(const ZsControlMessage* message,
+                             int32_t index) {
+  const zapshare::ControlValue* v = ValueOf(message, index);
+  return v != nullptr ? static_cast<int32_t>(v->list.size()) : 0;
+}
+
+size_t zs_control_encode(ZsControlMessage* message, int32_t json) {
+  Handle* h = Unwrap(message);
+  h->encoded_json = json != 0;
+  if (h->encoded_json) {
+    zapshare::EncodeControlJson(h->message, &h->json);
+    return h->json.size();
+  }
+  zapshare::EncodeControl(h->message, &h->encoded);
+  return h->encoded.size();
+}
+
+const uint8_t* zs_control_encoded(const ZsControlMessage* message) {
+  const Handle* h = Unwrap(message);
+  return h->encoded_json ? reinterpret_cast<const uint8_t*>(h->json.data())
+                         : h->encoded.data();
+}
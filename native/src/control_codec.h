@@ -0,0 +1,185 @@
+#ifndef ZAPSHARE_NATIVE_CONTROL_CODEC_H_
+#define ZAPSHARE_NATIVE_CONTROL_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// The control messages peers exchange over the discovery port (share
+// requests, casting and its remote, screen mirroring), in a compact binary
+// form described by constexpr schemas, and in the JSON that older peers
+// send and expect.
+//
+// Each message type has a table of fields: a number that identifies it on
+// the wire, its kind and its JSON key. The tables are checked at compile
+// time, and one encoder and one decoder walk them for every type, so a
+// field added to a table is encoded, decoded, bounds-checked and given its
+// JSON form with nothing else to write.
+//
+// Binary, fields in any order and each at most once (a list repeats its
+// field):
+//   0  "ZSC"    magic
+//   3  version  kControlVersion; a later one only adds fields
+//   4  type     ControlType
+//   5  field*   a byte (number << 3 | wire), then the value
+//        wire 0  varint: ints zigzagged, bools 0/1
+//        wire 1  8 bytes: a little-endian IEEE double
+//        wire 2  varint length, bytes: a UTF-8 string
+// A field number the schema doesn't know is skipped by its wire kind, so
+// an older peer reads what it understands of a newer message. Anything
+// that runs past the end or repeats a single field is rejected.
+//
+// JSON is what `jsonEncode` made of the same maps: {"type":
+// "ZAPSHARE_CAST_STATUS", "position": 12.5, ...}. Keys the schema doesn't
+// know are skipped, nulls are absent fields. JSON we write carries "zsc":
+// kControlVersion, which tells the peer it may answer in binary.
+
+constexpr uint8_t kControlVersion = 1;
+constexpr size_t kControlHeaderSize = 5;
+
+enum class ControlType : uint8_t {
+  kNone = 0,
+  kConnectionRequest = 1,
+  kConnectionResponse = 2,
+  kCastUrl = 3,
+  kCastControl = 4,
+  kCastStatus = 5,
+  kCastAck = 6,
+  kScreenMirror = 7,
+  kScreenMirrorControl = 8,
+};
+constexpr int kControlTypes = 8;
+
+enum class ControlKind : uint8_t {
+  kString = 0,
+  kInt = 1,
+  kDouble = 2,
+  kBool = 3,
+  kStrings = 4,  // A list of strings.
+};
+
+struct ControlField {
+  uint8_t number;  // 1 to 31, unique within the message.
+  ControlKind kind;
+  const char* key;
+};
+
+struct ControlSchema {
+  ControlType type;
+  const char* name;  // The JSON "type".
+  const ControlField* fields;
+  size_t count;
+};
+
+// Null for kNone or an unknown type.
+const ControlSchema* FindControlSchema(ControlType type);
+const ControlSchema* FindControlSchema(const std::string& name);
+
+struct ControlValue {
+  bool present = false;
+  int64_t i = 0;   // kInt, kBool.
+  double d = 0;    // kDouble.
+  std::string s;   // kString.
+  std::vector<std::string> list;  // kStrings.
+};
+
+// One message: a value per field of its schema, in the schema's order.
+struct ControlMessage {
+  const ControlSchema* schema = nullptr;
+  std::vector<ControlValue> values;
+  // The sender's kControlVersion, or 0 for plain JSON.
+  uint8_t version = 0;
+
+  // Empties every field; false for an unknown type.
+  bool Reset(ControlType type);
+  ControlType type() const {
+    return schema != nullptr ? schema->type : ControlType::kNone;
+  }
+  // Null if the schema has no such key.
+  ControlValue* Find(const char* key);
+  const ControlValue* Find(const char* key) const;
+};
+
+inline bool IsBinaryControl(const uint8_t* data, size_t len) {
+  return len >= kControlHeaderSize && data[0] == 'Z' && data[1] == 'S' &&
+         data[2] == 'C';
+}
+
+// Binary or JSON, whichever |data| is. False if it isn't a well-formed
+// message of a known type.
+bool DecodeControl(const uint8_t* data, size_t len, ControlMessage* out);
+bool DecodeControlBinary(const uint8_t* data, size_t len,
+                         ControlMessage* out);
+bool DecodeControlJson(const uint8_t* data, size_t len, ControlMessage* out);
+
+// Replace |out|. Absent fields are left out; so are doubles JSON can't
+// represent.
+void EncodeControl(const ControlMessage& message, std::vector<uint8_t>* out);
+void EncodeControlJson(const ControlMessage& message, std::string* out);
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsControlMessage ZsControlMessage;
+
+// The schemas, for building maps: field |index| of message |type|. Null
+// or -1 past the end.
+ZS_EXPORT const char* zs_control_type_name(int32_t type);
+ZS_EXPORT int32_t zs_control_field_count(int32_t type);
+ZS_EXPORT const char* zs_control_field_key(int32_t type, int32_t index);
+ZS_EXPORT int32_t zs_control_field_kind(int32_t type, int32_t index);
+// The type named |name|, or 0.
+ZS_EXPORT int32_t zs_control_type_of(const char* name);
+
+ZS_EXPORT ZsControlMessage* zs_control_new(void);
+ZS_EXPORT void zs_control_free(ZsControlMessage* message);
+// Empties the message for |type|; 0 if it's unknown.
+ZS_EXPORT int32_t zs_control_reset(ZsControlMessage* message, int32_t type);
+// The decoded type, or 0 if |data| isn't a control message.
+ZS_EXPORT int32_t zs_control_decode(ZsControlMessage* message,
+                                    const uint8_t* data, size_t len);
+// The sender's codec version, 0 for plain JSON.
+ZS_EXPORT int32_t zs_control_version(const ZsControlMessage* message);
+
+// Fields by their index in the schema. Setting one of another kind, or
+// past the end, does nothing.
+ZS_EXPORT void zs_control_set_int(ZsControlMessage* message, int32_t index,
+                                  int64_t value);
+ZS_EXPORT void zs_control_set_double(ZsControlMessage* message,
+                                     int32_t index, double value);
+ZS_EXPORT void zs_control_set_string(ZsControlMessage* message,
+                                     int32_t index, const uint8_t* data,
+                                     size_t len);
+// Appends to a list field.
+ZS_EXPORT void zs_control_add_string(ZsControlMessage* message,
+                                     int32_t index, const uint8_t* data,
+                                     size_t len);
+ZS_EXPORT int32_t zs_control_present(const ZsControlMessage* message,
+                                     int32_t index);
+// Ints and bools.
+ZS_EXPORT int64_t zs_control_get_int(const ZsControlMessage* message,
+                                     int32_t index);
+ZS_EXPORT double zs_control_get_double(const ZsControlMessage* message,
+                                       int32_t index);
+// A string field, or item |item| of a list; null if there's none. Valid
+// until the message changes.
+ZS_EXPORT const uint8_t* zs_control_get_string(
+    const ZsControlMessage* message, int32_t index, int32_t item,
+    size_t* len);
+ZS_EXPORT int32_t zs_control_list_size(const ZsControlMessage* message,
+                                       int32_t index);
+
+// Encodes the message, binary unless |json|, and returns its size; the
+// bytes are at zs_control_encoded() until the next encode.
+ZS_EXPORT size_t zs_control_encode(ZsControlMessage* message, int32_t json);
+ZS_EXPORT const uint8_t* zs_control_encoded(const ZsControlMessage* message);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_CONTROL_CODEC_H_
@@ -0,0 +1,237 @@
+#include "crc32.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define ZS_CRC32_PCLMUL 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define ZS_CRC32_ARMV8 1
+#endif
+
+// MSVC allows the intrinsics anywhere; GCC and Clang need the functions
+// that use them compiled for the extension.
+#if defined(ZS_CRC32_PCLMUL) && !defined(_MSC_VER)
+#define ZS_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#else
+#define ZS_TARGET_PCLMUL
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint32_t kPoly = 0xEDB88320;
+
+struct Tables {
+  uint32_t t[8][256];
+
+  Tables() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ kPoly : c >> 1;
+      t[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int s = 1; s < 8; s++) {
+        t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+      }
+    }
+  }
+};
+
+const Tables& GetTables() {
+  static const Tables tables;
+  return tables;
+}
+
+// Works on the inverted register, like the hardware paths.
+uint32_t SliceBy8(uint32_t c, const uint8_t* p, size_t len) {
+  const Tables& tb = GetTables();
+  while (len >= 8) {
+    const uint32_t lo = c ^ (static_cast<uint32_t>(p[0]) |
+                             static_cast<uint32_t>(p[1]) << 8 |
+                             static_cast<uint32_t>(p[2]) << 16 |
+                             static_cast<uint32_t>(p[3]) << 24);
+    c = tb.t[7][lo & 0xFF] ^ tb.t[6][(lo >> 8) & 0xFF] ^
+        tb.t[5][(lo >> 16) & 0xFF] ^ tb.t[4][lo >> 24] ^ tb.t[3][p[4]] ^
+        tb.t[2][p[5]] ^ tb.t[1][p[6]] ^ tb.t[0][p[7]];
+    p += 8;
+    len -= 8;
+  }
+  while (len--) c = (c >> 8) ^ tb.t[0][(c ^ *p++) & 0xFF];
+  return c;
+}
+
+#if defined(ZS_CRC32_PCLMUL)
+
+bool HavePclmul() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 1)) != 0 && (info[2] & (1 << 19)) != 0;
+#else
+  return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+ZS_TARGET_PCLMUL inline __m128i Load128(const uint8_t* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// Folds |acc| forward by 128 bits with constants |k| and adds |next|.
+ZS_TARGET_PCLMUL inline __m128i Fold128(__m128i acc, __m128i k,
+                                        __m128i next) {
+  const __m128i lo = _mm_clmulepi64_si128(acc, k, 0x00);
+  const __m128i hi = _mm_clmulepi64_si128(acc, k, 0x11);
+  return _mm_xor_si128(_mm_xor_si128(hi, next), lo);
+}
+
+// Four-way folding over 64-byte blocks followed by a Barrett reduction, as
+// in Intel's "Fast CRC Computation Using PCLMULQDQ". |len| must be a
+// multiple of 16 and at least 64.
+ZS_TARGET_PCLMUL uint32_t FoldPclmul(uint32_t c, const uint8_t* p,
+                                     size_t len) {
+  alignas(16) static const uint64_t k1k2[2] = {0x0154442bd4, 0x01c6e41596};
+  alignas(16) static const uint64_t k3k4[2] = {0x01751997d0, 0x00ccaa009e};
+  alignas(16) static const uint64_t k5k0[2] = {0x0163cd6124, 0x0000000000};
+  alignas(16) static const uint64_t poly[2] = {0x01db710641, 0x01f7011641};
+
+  __m128i x1 = Load128(p);
+  __m128i x2 = Load128(p + 16);
+  __m128i x3 = Load128(p + 32);
+  __m128i x4 = Load128(p + 48);
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(c)));
+  __m128i x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+  p += 64;
+  len -= 64;
+
+  while (len >= 64) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    const __m128i x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    const __m128i x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    const __m128i x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), Load128(p));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), Load128(p + 16));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), Load128(p + 32));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), Load128(p + 48));
+    p += 64;
+    len -= 64;
+  }
+
+  // Fold the four lanes into one.
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+  x1 = Fold128(x1, x0, x2);
+  x1 = Fold128(x1, x0, x3);
+  x1 = Fold128(x1, x0, x4);
+  while (len >= 16) {
+    x1 = Fold128(x1, x0, Load128(p));
+    p += 16;
+    len -= 16;
+  }
+
+  // 128 -> 64 bits.
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x00), x2);
+
+  // Barrett reduction to 32 bits.
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+  x2 = _mm_and_si128(x1, mask);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, mask);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+#endif  // ZS_CRC32_PCLMUL
+
+// Multiplies two polynomials modulo the CRC polynomial (reflected).
+uint32_t MultModP(uint32_t a, uint32_t b) {
+  uint32_t m = 1u << 31;
+  uint32_t p = 0;
+  while (true) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) break;
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ kPoly : b >> 1;
+  }
+  return p;
+}
+
+// x^(n * 2^k) modulo the CRC polynomial.
+uint32_t X2nModP(uint64_t n, int k) {
+  static const auto table = [] {
+    struct {
+      uint32_t v[32];
+    } t;
+    uint32_t p = 1u << 30;  // x^1
+    t.v[0] = p;
+    for (int i = 1; i < 32; i++) t.v[i] = p = MultModP(p, p);
+    return t;
+  }();
+  uint32_t p = 1u << 31;  // x^0
+  for (; n != 0; n >>= 1, k++) {
+    if (n & 1) p = MultModP(table.v[k & 31], p);
+  }
+  return p;
+}
+
+}  // namespace
+
+uint32_t Crc32Portable(uint32_t crc, const uint8_t* data, size_t len) {
+  return ~SliceBy8(~crc, data, len);
+}
+
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t len) {
+  uint32_t c = ~crc;
+#if defined(ZS_CRC32_PCLMUL)
+  static const bool have_pclmul = HavePclmul();
+  if (have_pclmul && len >= 64) {
+    const size_t bulk = len & ~static_cast<size_t>(15);
+    c = FoldPclmul(c, data, bulk);
+    data += bulk;
+    len -= bulk;
+  }
+#elif defined(ZS_CRC32_ARMV8)
+  for (; len >= 8; data += 8, len -= 8) {
+    uint64_t v;
+    std::memcpy(&v, data, 8);
+    c = __crc32d(c, v);
+  }
+  for (; len > 0; data++, len--) c = __crc32b(c, *data);
+#endif
+  return ~SliceBy8(c, data, len);
+}
+
+uint32_t Crc32Combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b) {
+  return MultModP(X2nModP(len_b, 3), crc_a) ^ crc_b;
+}
+
+}  // namespace zapshare
+
+uint32_t zs_crc32(uint32_t crc, const uint8_t* data, size_t len) {
+  return zapshare::Crc32(crc, data, len);
+}
+
+uint32_t zs_crc32_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b) {
+  return zapshare::Crc32Combine(crc_a, crc_b, len_b);
+}
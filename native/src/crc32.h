@@ -0,0 +1,34 @@
+#ifndef ZAPSHARE_NATIVE_CRC32_H_
+#define ZAPSHARE_NATIVE_CRC32_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "export.h"
+
+namespace zapshare {
+
+// CRC-32 as used by ZIP, gzip and zlib (reflected polynomial 0xEDB88320).
+// Start with crc = 0 and feed the previous result back in to continue:
+// Crc32(Crc32(0, a, n), b, m) == Crc32(0, a || b, n + m).
+//
+// Folds with PCLMULQDQ on x86 CPUs that have it (checked at run time), uses
+// the ARMv8 CRC32 instructions when the build targets them, and falls back
+// to slicing-by-8 tables elsewhere.
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t len);
+uint32_t Crc32Portable(uint32_t crc, const uint8_t* data, size_t len);
+
+// CRC of A || B given CRC(A), CRC(B) and the length of B, in O(log len).
+uint32_t Crc32Combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+
+}  // namespace zapshare
+
+extern "C" {
+
+ZS_EXPORT uint32_t zs_crc32(uint32_t crc, const uint8_t* data, size_t len);
+ZS_EXPORT uint32_t zs_crc32_combine(uint32_t crc_a, uint32_t crc_b,
+                                    uint64_t len_b);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_CRC32_H_
@@ -0,0 +1,567 @@
+#include "delta.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define ZS_DELTA_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ZS_DELTA_NEON 1
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint8_t kSignatureMagic[4] = {'Z', 'S', 'S', '1'};
+constexpr uint8_t kDeltaMagic[4] = {'Z', 'S', 'D', '1'};
+constexpr size_t kSignatureHeaderLen = 20;
+constexpr size_t kSignatureEntryLen = 4 + kDeltaStrongLen;
+constexpr size_t kDeltaHeaderLen = 16;
+
+uint32_t LoadLe32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+uint64_t LoadLe64(const uint8_t* p) {
+  return static_cast<uint64_t>(LoadLe32(p)) |
+         static_cast<uint64_t>(LoadLe32(p + 4)) << 32;
+}
+
+void AppendLe32(std::vector<uint8_t>* out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out->push_back(static_cast<uint8_t>(v >> (8 * i)));
+  }
+}
+
+void AppendLe64(std::vector<uint8_t>* out, uint64_t v) {
+  AppendLe32(out, static_cast<uint32_t>(v));
+  AppendLe32(out, static_cast<uint32_t>(v >> 32));
+}
+
+void StrongHash(const uint8_t* data, size_t len, uint8_t out[kDeltaStrongLen]) {
+  uint8_t full[kBlake3OutLen];
+  Blake3::Hash(data, len, full);
+  std::memcpy(out, full, kDeltaStrongLen);
+}
+
+uint32_t Pack(uint32_t a, uint32_t b) {
+  return (b & 0xFFFF) << 16 | (a & 0xFFFF);
+}
+
+uint32_t ExpectedBlocks(uint64_t size, uint32_t block_size) {
+  return static_cast<uint32_t>((size + block_size - 1) / block_size);
+}
+
+}  // namespace
+
+uint32_t DeltaWeakChecksumPortable(const uint8_t* data, size_t len) {
+  uint32_t a = 0;
+  uint32_t b = 0;
+  for (size_t i = 0; i < len; i++) {
+    a += data[i];
+    b += a;
+  }
+  return Pack(a, b);
+}
+
+// Both vector paths process 16 bytes per step: b grows by 16 times the sum
+// of all earlier bytes (accumulated lazily in |ps|) plus the bytes weighted
+// 16..1, and a by their plain sum. Everything wraps mod 2^32, which is
+// consistent with the final mod 2^16.
+uint32_t DeltaWeakChecksum(const uint8_t* data, size_t len) {
+  size_t i = 0;
+  uint32_t a = 0;
+  uint32_t b = 0;
+#if defined(ZS_DELTA_SSE2)
+  if (len >= 16) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i w_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i va = zero;
+    __m128i vps = zero;
+    __m128i vb = zero;
+    for (; i + 16 <= len; i += 16) {
+      const __m128i x =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      vps = _mm_add_epi32(vps, va);
+      va = _mm_add_epi32(va, _mm_sad_epu8(x, zero));
+      vb = _mm_add_epi32(vb,
+                         _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), w_lo));
+      vb = _mm_add_epi32(vb,
+                         _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), w_hi));
+    }
+    alignas(16) uint32_t la[4];
+    alignas(16) uint32_t lps[4];
+    alignas(16) uint32_t lb[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(la), va);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lps), vps);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lb), vb);
+    a = la[0] + la[1] + la[2] + la[3];
+    b = 16 * (lps[0] + lps[1] + lps[2] + lps[3]) + lb[0] + lb[1] + lb[2] +
+        lb[3];
+  }
+#elif defined(ZS_DELTA_NEON)
+  if (len >= 16) {
+    static const uint16_t kWeights[16] = {16, 15, 14, 13, 12, 11, 10, 9,
+                                          8,  7,  6,  5,  4,  3,  2,  1};
+    const uint16x4_t w0 = vld1_u16(kWeights);
+    const uint16x4_t w1 = vld1_u16(kWeights + 4);
+    const uint16x4_t w2 = vld1_u16(kWeights + 8);
+    const uint16x4_t w3 = vld1_u16(kWeights + 12);
+    uint32x4_t va = vdupq_n_u32(0);
+    uint32x4_t vps = vdupq_n_u32(0);
+    uint32x4_t vb = vdupq_n_u32(0);
+    for (; i + 16 <= len; i += 16) {
+      const uint8x16_t x = vld1q_u8(data + i);
+      vps = vaddq_u32(vps, va);
+      va = vaddq_u32(va, vpaddlq_u16(vpaddlq_u8(x)));
+      const uint16x8_t lo = vmovl_u8(vget_low_u8(x));
+      const uint16x8_t hi = vmovl_u8(vget_high_u8(x));
+      vb = vmlal_u16(vb, vget_low_u16(lo), w0);
+      vb = vmlal_u16(vb, vget_high_u16(lo), w1);
+      vb = vmlal_u16(vb, vget_low_u16(hi), w2);
+      vb = vmlal_u16(vb, vget_high_u16(hi), w3);
+    }
+    a = vaddvq_u32(va);
+    b = 16 * vaddvq_u32(vps) + vaddvq_u32(vb);
+  }
+#endif
+  for (; i < len; i++) {
+    a += data[i];
+    b += a;
+  }
+  return Pack(a, b);
+}
+
+uint32_t DeltaBlockSize(uint64_t basis_size) {
+  uint32_t block = kDeltaMinBlockSize;
+  while (block < kDeltaMaxBlockSize &&
+         static_cast<uint64_t>(block) * block < basis_size) {
+    block <<= 1;
+  }
+  return block;
+}
+
+SignatureBuilder::SignatureBuilder(uint64_t basis_size, uint32_t block_size)
+    : basis_size_(basis_size),
+      block_size_(block_size == 0 ? DeltaBlockSize(basis_size) : block_size) {
+  out_.insert(out_.end(), kSignatureMagic, kSignatureMagic + 4);
+  AppendLe32(&out_, block_size_);
+  AppendLe64(&out_, basis_size_);
+  AppendLe32(&out_, 0);  // Block count, patched by Finish().
+  out_.reserve(kSignatureHeaderLen +
+               ExpectedBlocks(basis_size_, block_size_) * kSignatureEntryLen);
+}
+
+void SignatureBuilder::Update(const uint8_t* data, size_t len) {
+  if (!partial_.empty()) {
+    size_t take = std::min(len, block_size_ - partial_.size());
+    partial_.insert(partial_.end(), data, data + take);
+    data += take;
+    len -= take;
+    if (partial_.size() < block_size_) return;
+    AddBlock(partial_.data(), partial_.size());
+    partial_.clear();
+  }
+  while (len >= block_size_) {
+    AddBlock(data, block_size_);
+    data += block_size_;
+    len -= block_size_;
+  }
+  partial_.assign(data, data + len);
+}
+
+const std::vector<uint8_t>& SignatureBuilder::Finish() {
+  if (!finished_) {
+    finished_ = true;
+    if (!partial_.empty()) AddBlock(partial_.data(), partial_.size());
+    partial_.clear();
+    for (int i = 0; i < 4; i++) {
+      out_[16 + i] = static_cast<uint8_t>(blocks_ >> (8 * i));
+    }
+  }
+  return out_;
+}
+
+void SignatureBuilder::AddBlock(const uint8_t* data, size_t len) {
+  AppendLe32(&out_, DeltaWeakChecksum(data, len));
+  uint8_t strong[kDeltaStrongLen];
+  StrongHash(data, len, strong);
+  out_.insert(out_.end(), strong, strong + kDeltaStrongLen);
+  blocks_++;
+}
+
+DeltaEncoder::DeltaEncoder(uint64_t target_size)
+    : target_size_(target_size),
+      target_hash_(target_size, kDefaultDigestChunkSize) {}
+
+std::unique_ptr<DeltaEncoder> DeltaEncoder::Create(const uint8_t* signature,
+                                                   size_t len,
+                                                   uint64_t target_size) {
+  std::unique_ptr<DeltaEncoder> encoder(new DeltaEncoder(target_size));
+  if (!encoder->ParseSignature(signature, len)) return nullptr;
+
+  encoder->Put(kDeltaMagic, sizeof(kDeltaMagic));
+  uint8_t size[8];
+  for (int i = 0; i < 8; i++) {
+    size[i] = static_cast<uint8_t>(target_size >> (8 * i));
+  }
+  encoder->Put(size, sizeof(size));
+  encoder->PutLe32(encoder->block_size_);
+  // Nothing to match against: skip straight to literals.
+  if (encoder->block_count_ == 0) encoder->literal_only_ = true;
+  return encoder;
+}
+
+bool DeltaEncoder::ParseSignature(const uint8_t* sig, size_t len) {
+  if (len < kSignatureHeaderLen ||
+      std::memcmp(sig, kSignatureMagic, sizeof(kSignatureMagic)) != 0) {
+    return false;
+  }
+  block_size_ = LoadLe32(sig + 4);
+  basis_size_ = LoadLe64(sig + 8);
+  block_count_ = LoadLe32(sig + 16);
+  if (block_size_ < 16 || block_size_ > kDeltaMaxBlockSize ||
+      block_count_ != ExpectedBlocks(basis_size_, block_size_) ||
+      len != kSignatureHeaderLen + block_count_ * kSignatureEntryLen) {
+    return false;
+  }
+
+  weak_.resize(block_count_);
+  strong_.resize(static_cast<size_t>(block_count_) * kDeltaStrongLen);
+  const uint8_t* p = sig + kSignatureHeaderLen;
+  for (uint32_t i = 0; i < block_count_; i++, p += kSignatureEntryLen) {
+    weak_[i] = LoadLe32(p);
+    std::memcpy(&strong_[static_cast<size_t>(i) * kDeltaStrongLen], p + 4,
+                kDeltaStrongLen);
+  }
+
+  // Only full-size blocks can match a sliding window; a short last block is
+  // checked against the tail of the target in Process().
+  uint32_t table_size = 16;
+  while (table_size < block_count_ * 2) table_size <<= 1;
+  table_mask_ = table_size - 1;
+  heads_.assign(table_size, -1);
+  next_.assign(block_count_, -1);
+  for (uint32_t i = block_count_; i-- > 0;) {
+    if (static_cast<uint64_t>(i + 1) * block_size_ > basis_size_) continue;
+    uint32_t slot = (weak_[i] * 2654435761u) & table_mask_;
+    next_[i] = heads_[slot];
+    heads_[slot] = static_cast<int32_t>(i);
+  }
+  return true;
+}
+
+int64_t DeltaEncoder::Lookup(uint32_t weak, const uint8_t* window,
+                             size_t len) const {
+  uint8_t strong[kDeltaStrongLen];
+  bool have_strong = false;
+  auto matches = [&](uint32_t i) {
+    if (weak_[i] != weak) return false;
+    if (!have_strong) {
+      StrongHash(window, len, strong);
+      have_strong = true;
+    }
+    return std::memcmp(&strong_[static_cast<size_t>(i) * kDeltaStrongLen],
+                       strong, kDeltaStrongLen) == 0;
+  };
+
+  // Prefer the block right after the current copy run, so runs stay long.
+  if (copy_count_ > 0) {
+    uint32_t want = copy_first_ + copy_count_;
+    if (static_cast<uint64_t>(want + 1) * block_size_ <= basis_size_ &&
+        matches(want)) {
+      return want;
+    }
+  }
+  for (int32_t i = heads_[(weak * 2654435761u) & table_mask_]; i >= 0;
+       i = next_[i]) {
+    if (matches(static_cast<uint32_t>(i))) return i;
+  }
+  return -1;
+}
+
+void DeltaEncoder::Update(const uint8_t* data, size_t len) {
+  if (finished_ || len == 0) return;
+  target_hash_.Update(fed_, data, len);
+  fed_ += len;
+  stats_.target_bytes = fed_;
+  if (literal_only_) {
+    EmitLiteral(data, len);
+    return;
+  }
+  buf_.insert(buf_.end(), data, data + len);
+  Process(false);
+}
+
+void DeltaEncoder::Finish() {
+  if (finished_) return;
+  Process(true);
+  FlushCopy();
+  finished_ = true;
+
+  // A short target leaves the digest zeroed, which the receiver rejects.
+  Digest digest{};
+  if (fed_ == target_size_) target_hash_.FileDigest(&digest);
+  const uint8_t end = 'E';
+  Put(&end, 1);
+  Put(digest.data(), digest.size());
+}
+
+void DeltaEncoder::Process(bool final) {
+  const size_t bs = block_size_;
+  while (!literal_only_) {
+    const size_t avail = buf_.size() - pos_;
+    if (avail < bs) break;
+    if (!have_sum_) {
+      uint32_t w = DeltaWeakChecksum(buf_.data() + pos_, bs);
+      a_ = w & 0xFFFF;
+      b_ = w >> 16;
+      have_sum_ = true;
+    }
+
+    int64_t match = Lookup(Pack(a_, b_), buf_.data() + pos_, bs);
+    if (match >= 0) {
+      EmitLiteral(buf_.data() + lit_start_, pos_ - lit_start_);
+      EmitCopy(static_cast<uint32_t>(match));
+      pos_ += bs;
+      lit_start_ = pos_;
+      have_sum_ = false;
+      continue;
+    }
+
+    // Roll the window one byte; wait for more input at the buffer's end.
+    if (avail == bs) break;
+    const uint32_t out = buf_[pos_];
+    const uint32_t in = buf_[pos_ + bs];
+    a_ = a_ - out + in;
+    b_ = b_ - static_cast<uint32_t>(bs) * out + a_;
+    pos_++;
+    if (pos_ - lit_start_ >= kDeltaMaxLiteral) {
+      EmitLiteral(buf_.data() + lit_start_, pos_ - lit_start_);
+      lit_start_ = pos_;
+    }
+  }
+
+  if (!literal_only_ && final && pos_ < buf_.size() && block_count_ > 0) {
+    // The basis's short last block can only match the target's tail.
+    const uint32_t last = block_count_ - 1;
+    const uint64_t last_len =
+        basis_size_ - static_cast<uint64_t>(last) * block_size_;
+    const size_t tail = buf_.size() - pos_;
+    if (last_len < bs && tail == last_len &&
+        DeltaWeakChecksum(buf_.data() + pos_, tail) == weak_[last]) {
+      uint8_t strong[kDeltaStrongLen];
+      StrongHash(buf_.data() + pos_, tail, strong);
+      if (std::memcmp(&strong_[static_cast<size_t>(last) * kDeltaStrongLen],
+                      strong, kDeltaStrongLen) == 0) {
+        EmitLiteral(buf_.data() + lit_start_, pos_ - lit_start_);
+        EmitCopy(last);
+        pos_ = lit_start_ = buf_.size();
+      }
+    }
+  }
+
+  if (literal_only_ || final) {
+    EmitLiteral(buf_.data() + lit_start_, buf_.size() - lit_start_);
+    pos_ = lit_start_ = buf_.size();
+    have_sum_ = false;
+  }
+
+  if (lit_start_ > 0) {
+    buf_.erase(buf_.begin(), buf_.begin() + static_cast<ptrdiff_t>(lit_start_));
+    pos_ -= lit_start_;
+    lit_start_ = 0;
+  }
+}
+
+void DeltaEncoder::EmitLiteral(const uint8_t* data, size_t len) {
+  if (len == 0) return;
+  FlushCopy();
+  while (len > 0) {
+    uint32_t n = static_cast<uint32_t>(std::min<size_t>(len, kDeltaMaxLiteral));
+    const uint8_t op = 'L';
+    Put(&op, 1);
+    PutLe32(n);
+    Put(data, n);
+    data += n;
+    len -= n;
+    stats_.literal_bytes += n;
+  }
+
+  const uint64_t seen = stats_.copied_bytes + stats_.literal_bytes;
+  if (!literal_only_ && seen >= kDeltaProbeBytes &&
+      stats_.copied_bytes * 8 < seen) {
+    literal_only_ = true;
+    stats_.gave_up = true;
+  }
+}
+
+void DeltaEncoder::EmitCopy(uint32_t block) {
+  if (copy_count_ > 0 && block == copy_first_ + copy_count_) {
+    copy_count_++;
+  } else {
+    FlushCopy();
+    copy_first_ = block;
+    copy_count_ = 1;
+  }
+  const uint64_t start = static_cast<uint64_t>(block) * block_size_;
+  stats_.copied_bytes += std::min<uint64_t>(block_size_, basis_size_ - start);
+}
+
+void DeltaEncoder::FlushCopy() {
+  if (copy_count_ == 0) return;
+  const uint8_t op = 'C';
+  Put(&op, 1);
+  PutLe32(copy_first_);
+  PutLe32(copy_count_);
+  copy_count_ = 0;
+}
+
+void DeltaEncoder::Put(const void* data, size_t len) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  out_.insert(out_.end(), p, p + len);
+  stats_.output_bytes += len;
+}
+
+void DeltaEncoder::PutLe32(uint32_t v) {
+  uint8_t b[4];
+  for (int i = 0; i < 4; i++) b[i] = static_cast<uint8_t>(v >> (8 * i));
+  Put(b, sizeof(b));
+}
+
+size_t DeltaEncoder::Read(uint8_t* out, size_t cap) {
+  size_t n = std::min(cap, Pending());
+  std::memcpy(out, out_.data() + out_read_, n);
+  out_read_ += n;
+  if (out_read_ == out_.size()) {
+    out_.clear();
+    out_read_ = 0;
+  }
+  return n;
+}
+
+bool ApplyDelta(const uint8_t* basis, size_t basis_len, const uint8_t* delta,
+                size_t delta_len, std::vector<uint8_t>* out) {
+  out->clear();
+  if (delta_len < kDeltaHeaderLen ||
+      std::memcmp(delta, kDeltaMagic, sizeof(kDeltaMagic)) != 0) {
+    return false;
+  }
+  const uint64_t target_size = LoadLe64(delta + 4);
+  const uint32_t block_size = LoadLe32(delta + 12);
+  size_t p = kDeltaHeaderLen;
+  while (p < delta_len) {
+    const uint8_t op = delta[p++];
+    if (op == 'C') {
+      if (delta_len - p < 8) return false;
+      const uint64_t first = LoadLe32(delta + p);
+      const uint64_t count = LoadLe32(delta + p + 4);
+      p += 8;
+      const uint64_t start = first * block_size;
+      const uint64_t end = std::min<uint64_t>((first + count) * block_size,
+                                              basis_len);
+      if (start >= end) return false;
+      out->insert(out->end(), basis + start, basis + end);
+    } else if (op == 'L') {
+      if (delta_len - p < 4) return false;
+      const uint32_t n = LoadLe32(delta + p);
+      p += 4;
+      if (delta_len - p < n) return false;
+      out->insert(out->end(), delta + p, delta + p + n);
+      p += n;
+    } else if (op == 'E') {
+      if (delta_len - p != kBlake3OutLen || out->size() != target_size) {
+        return false;
+      }
+      ChunkHasher hasher(out->size(), kDefaultDigestChunkSize);
+      hasher.Update(0, out->data(), out->size());
+      Digest digest;
+      hasher.FileDigest(&digest);
+      return std::memcmp(digest.data(), delta + p, digest.size()) == 0;
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::SignatureBuilder* Unwrap(ZsSignatureBuilder* b) {
+  return reinterpret_cast<zapshare::SignatureBuilder*>(b);
+}
+
+zapshare::DeltaEncoder* Unwrap(ZsDeltaEncoder* e) {
+  return reinterpret_cast<zapshare::DeltaEncoder*>(e);
+}
+
+const zapshare::DeltaEncoder* Unwrap(const ZsDeltaEncoder* e) {
+  return reinterpret_cast<const zapshare::DeltaEncoder*>(e);
+}
+
+}  // namespace
+
+uint32_t zs_delta_block_size(uint64_t basis_size) {
+  return zapshare::DeltaBlockSize(basis_size);
+}
+
+ZsSignatureBuilder* zs_signature_new(uint64_t basis_size,
+                                     uint32_t block_size) {
+  return reinterpret_cast<ZsSignatureBuilder*>(
+      new zapshare::SignatureBuilder(basis_size, block_size));
+}
+
+void zs_signature_free(ZsSignatureBuilder* builder) { delete Unwrap(builder); }
+
+void zs_signature_update(ZsSignatureBuilder* builder, const uint8_t* data,
+                         size_t len) {
+  Unwrap(builder)->Update(data, len);
+}
+
+const uint8_t* zs_signature_finish(ZsSignatureBuilder* builder, size_t* len) {
+  const std::vector<uint8_t>& sig = Unwrap(builder)->Finish();
+  *len = sig.size();
+  return sig.data();
+}
+
+ZsDeltaEncoder* zs_delta_encoder_new(const uint8_t* signature, size_t len,
+                                     uint64_t target_size) {
+  return reinterpret_cast<ZsDeltaEncoder*>(
+      zapshare::DeltaEncoder::Create(signature, len, target_size).release());
+}
+
+void zs_delta_encoder_free(ZsDeltaEncoder* encoder) { delete Unwrap(encoder); }
+
+void zs_delta_encoder_update(ZsDeltaEncoder* encoder, const uint8_t* data,
+                             size_t len) {
+  Unwrap(encoder)->Update(data, len);
+}
+
+void zs_delta_encoder_finish(ZsDeltaEncoder* encoder) {
+  Unwrap(encoder)->Finish();
+}
+
+size_t zs_delta_encoder_pending(const ZsDeltaEncoder* encoder) {
+  return Unwrap(encoder)->Pending();
+}
+
+size_t zs_delta_encoder_read(ZsDeltaEncoder* encoder, uint8_t* out,
+                             size_t cap) {
+  return Unwrap(encoder)->Read(out, cap);
+}
+
+void zs_delta_encoder_stats(const ZsDeltaEncoder* encoder, uint64_t stats[5]) {
+  const zapshare::DeltaStats& s = Unwrap(encoder)->stats();
+  stats[0] = s.target_bytes;
+  stats[1] = s.copied_bytes;
+  stats[2] = s.literal_bytes;
+  stats[3] = s.output_bytes;
+  stats[4] = s.gave_up ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#ifndef ZAPSHARE_NATIVE_DELTA_H_
+#define ZAPSHARE_NATIVE_DELTA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "content_hash.h"
+#include "export.h"
+
+namespace zapshare {
+
+// rsync-style delta transfer.
+//
+// The receiver, which already holds an older copy of a file (the basis),
+// sends a signature: one weak rolling checksum and one truncated BLAKE3 per
+// fixed-size block. The sender slides a window over the new file (the
+// target), looks each position up by weak checksum, confirms with the strong
+// hash and answers with a stream of copy-block and literal instructions.
+//
+// Signature, little-endian:
+//   "ZSS1" | le32 block size | le64 basis size | le32 block count |
+//   block count x (le32 weak | 16-byte strong)
+//
+// Delta stream, little-endian:
+//   "ZSD1" | le64 target size | le32 block size | op* | 'E' | 32-byte digest
+//   op = 'C' le32 first block, le32 block count    (copy from basis)
+//      | 'L' le32 length, bytes                    (literal)
+// The digest is the ChunkHasher file digest of the target, so the receiver
+// can verify the rebuilt file the same way it verifies a normal download.
+
+constexpr uint32_t kDeltaMinBlockSize = 2 * 1024;
+constexpr uint32_t kDeltaMaxBlockSize = 64 * 1024;
+constexpr size_t kDeltaStrongLen = 16;
+constexpr uint32_t kDeltaMaxLiteral = 1024 * 1024;
+
+// Weak checksum of a block: a = sum of bytes, b = sum of running a, packed as
+// (b << 16) | a, both mod 2^16 (the rsync/Adler construction without the
+// prime modulus). SSE2 or NEON where available.
+uint32_t DeltaWeakChecksum(const uint8_t* data, size_t len);
+uint32_t DeltaWeakChecksumPortable(const uint8_t* data, size_t len);
+
+// Roughly sqrt(size), rounded up to a power of two and clamped, which keeps
+// the signature under ~1.3 MB up to 4 GB files.
+uint32_t DeltaBlockSize(uint64_t basis_size);
+
+// Builds the signature of a basis file fed sequentially.
+class SignatureBuilder {
+ public:
+  // |block_size| 0 picks DeltaBlockSize(basis_size).
+  SignatureBuilder(uint64_t basis_size, uint32_t block_size);
+
+  void Update(const uint8_t* data, size_t len);
+  // Call once every basis byte has been fed.
+  const std::vector<uint8_t>& Finish();
+
+  uint32_t block_size() const { return block_size_; }
+
+ private:
+  void AddBlock(const uint8_t* data, size_t len);
+
+  uint64_t basis_size_;
+  uint32_t block_size_;
+  uint32_t blocks_ = 0;
+  std::vector<uint8_t> partial_;
+  std::vector<uint8_t> out_;
+  bool finished_ = false;
+};
+
+struct DeltaStats {
+  uint64_t target_bytes = 0;   // Target bytes consumed so far.
+  uint64_t copied_bytes = 0;   // Covered by copy instructions.
+  uint64_t literal_bytes = 0;  // Sent as literals.
+  uint64_t output_bytes = 0;   // Encoded stream size.
+  bool gave_up = false;        // Matching abandoned; rest sent as literals.
+};
+
+// Streams the delta of a target file against a parsed signature.
+//
+// When the first kDeltaProbeBytes of the target match less than 1/8 of the
+// time (a re-encoded video, a compressed archive), the encoder stops looking
+// for matches and the rest goes out as plain literals, which costs the same
+// as a full send plus a few bytes per MB of framing.
+class DeltaEncoder {
+ public:
+  static constexpr uint64_t kDeltaProbeBytes = 16 * 1024 * 1024;
+
+  // Null if |signature| is malformed.
+  static std::unique_ptr<DeltaEncoder> Create(const uint8_t* signature,
+                                              size_t len,
+                                              uint64_t target_size);
+
+  void Update(const uint8_t* data, size_t len);
+  void Finish();
+
+  // Encoded bytes not yet taken with Read().
+  size_t Pending() const { return out_.size() - out_read_; }
+  size_t Read(uint8_t* out, size_t cap);
+
+  const DeltaStats& stats() const { return stats_; }
+
+ private:
+  explicit DeltaEncoder(uint64_t target_size);
+
+  bool ParseSignature(const uint8_t* sig, size_t len);
+  void Process(bool final);
+  int64_t Lookup(uint32_t weak, const uint8_t* window, size_t len) const;
+  void EmitLiteral(const uint8_t* data, size_t len);
+  void EmitCopy(uint32_t block);
+  void FlushCopy();
+  void Put(const void* data, size_t len);
+  void PutLe32(uint32_t v);
+
+  uint64_t target_size_;
+  uint32_t block_size_ = 0;
+  uint64_t basis_size_ = 0;
+  uint32_t block_count_ = 0;
+  std::vector<uint32_t> weak_;
+  std::vector<uint8_t> strong_;
+  // Chained hash table over full-size blocks, keyed by weak checksum.
+  std::vector<int32_t> heads_;
+  std::vector<int32_t> next_;
+  uint32_t table_mask_ = 0;
+
+  // Unconsumed target bytes; |pos_| is the window start, |lit_start_| the
+  // first byte not yet emitted.
+  std::vector<uint8_t> buf_;
+  size_t pos_ = 0;
+  size_t lit_start_ = 0;
+  bool have_sum_ = false;
+  uint32_t a_ = 0;
+  uint32_t b_ = 0;
+
+  uint32_t copy_first_ = 0;
+  uint32_t copy_count_ = 0;
+  bool literal_only_ = false;
+  bool finished_ = false;
+
+  ChunkHasher target_hash_;
+  uint64_t fed_ = 0;
+  std::vector<uint8_t> out_;
+  size_t out_read_ = 0;
+  DeltaStats stats_;
+};
+
+// Reference decoder: rebuilds the target from an in-memory basis and delta,
+// checking the trailing digest. Used by the tests and the benchmark; the app
+// applies deltas with its own streaming reader.
+bool ApplyDelta(const uint8_t* basis, size_t basis_len, const uint8_t* delta,
+                size_t delta_len, std::vector<uint8_t>* out);
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsSignatureBuilder ZsSignatureBuilder;
+typedef struct ZsDeltaEncoder ZsDeltaEncoder;
+
+ZS_EXPORT uint32_t zs_delta_block_size(uint64_t basis_size);
+
+ZS_EXPORT ZsSignatureBuilder* zs_signature_new(uint64_t basis_size,
+                                               uint32_t block_size);
+ZS_EXPORT void zs_signature_free(ZsSignatureBuilder* builder);
+ZS_EXPORT void zs_signature_update(ZsSignatureBuilder* builder,
+                                   const uint8_t* data, size_t len);
+// Returns the signature, owned by |builder|, and stores its length.
+ZS_EXPORT const uint8_t* zs_signature_finish(ZsSignatureBuilder* builder,
+                                             size_t* len);
+
+// Null if the signature is malformed.
+ZS_EXPORT ZsDeltaEncoder* zs_delta_encoder_new(const uint8_t* signature,
+                                               size_t len,
+                                               uint64_t target_size);
+ZS_EXPORT void zs_delta_encoder_free(ZsDeltaEncoder* encoder);
+ZS_EXPORT void zs_delta_encoder_update(ZsDeltaEncoder* encoder,
+                                       const uint8_t* data, size_t len);
+ZS_EXPORT void zs_delta_encoder_finish(ZsDeltaEncoder* encoder);
+ZS_EXPORT size_t zs_delta_encoder_pending(const ZsDeltaEncoder* encoder);
+ZS_EXPORT size_t zs_delta_encoder_read(ZsDeltaEncoder* encoder, uint8_t* out,
+                                       size_t cap);
+// |stats| receives target, copied, literal and output bytes, then gave_up.
+ZS_EXPORT void zs_delta_encoder_stats(const ZsDeltaEncoder* encoder,
+                                      uint64_t stats[5]);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_DELTA_H_
@@ -0,0 +1,1082 @@
+#include "discovery.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <ifaddrs.h>
+#include <poll.h>
+#endif
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr char kBeaconMagic[] = "ZSB";
+constexpr char kLegacyBeaconType[] = "\"ZAPSHARE_DISCOVERY\"";
+constexpr size_t kMaxQueuedMessages = 256;
+constexpr size_t kMaxDatagram = 64 * 1024;
+constexpr uint64_t kExpireEveryMs = 1000;
+constexpr size_t kMaxMdnsMessage = 9000;  // RFC 6762 section 17.
+// FirstSeen() keys, apart from device id hashes: a peer's address that
+// asked us with a query beacon, and our multicast mDNS answers.
+constexpr uint64_t kQueryKey = 1ull << 63;
+constexpr uint64_t kMdnsKey = 1ull << 62;
+// RFC 6762 section 6: a record is multicast at most once a second.
+constexpr uint32_t kMdnsAnswerEveryMs = 1000;
+
+void Put16(uint8_t* p, uint16_t v) {
+  p[0] = static_cast<uint8_t>(v >> 8);
+  p[1] = static_cast<uint8_t>(v);
+}
+
+void Put32(uint8_t* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = static_cast<uint8_t>(v >> (24 - 8 * i));
+}
+
+void Put64(uint8_t* p, uint64_t v) {
+  for (int i = 0; i < 8; i++) p[i] = static_cast<uint8_t>(v >> (56 - 8 * i));
+}
+
+uint16_t Get16(const uint8_t* p) {
+  return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+uint64_t Get64(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v = v << 8 | p[i];
+  return v;
+}
+
+// The longest prefix of |s| of at most |max| bytes that doesn't split a
+// UTF-8 sequence.
+size_t Utf8Prefix(const std::string& s, size_t max) {
+  if (s.size() <= max) return s.size();
+  size_t n = max;
+  while (n > 0 && (static_cast<uint8_t>(s[n]) & 0xc0) == 0x80) n--;
+  return n;
+}
+
+std::string Field(const uint8_t* p, size_t len) {
+  const void* nul = memchr(p, 0, len);
+  return std::string(reinterpret_cast<const char*>(p),
+                     nul ? static_cast<const uint8_t*>(nul) - p : len);
+}
+
+bool SameBeacon(const Beacon& a, const Beacon& b) {
+  return a.port == b.port && a.platform == b.platform &&
+         a.flags == b.flags && a.name == b.name && a.avatar == b.avatar &&
+         a.device_id == b.device_id;
+}
+
+}  // namespace
+
+void EncodeBeacon(const Beacon& beacon, uint8_t* out) {
+  memset(out, 0, kBeaconSize);
+  memcpy(out, kBeaconMagic, 3);
+  out[3] = kBeaconVersion;
+  out[4] = beacon.flags;
+  out[5] = beacon.platform;
+  Put16(out + 6, beacon.port);
+  Put64(out + 8, beacon.id);
+  memcpy(out + 16, beacon.name.data(),
+         Utf8Prefix(beacon.name, kBeaconNameSize));
+  if (beacon.avatar.size() <= kBeaconAvatarSize) {
+    memcpy(out + 48, beacon.avatar.data(), beacon.avatar.size());
+  }
+  Put16(out + 64, beacon.ttl_s);
+  if (beacon.device_id.size() <= kBeaconDeviceIdSize) {
+    memcpy(out + 68, beacon.device_id.data(), beacon.device_id.size());
+  }
+}
+
+bool DecodeBeacon(const uint8_t* data, size_t len, Beacon* out) {
+  if (len < kBeaconV1Size || memcmp(data, kBeaconMagic, 3) != 0 ||
+      data[3] < 1) {
+    return false;
+  }
+  out->flags = data[4];
+  out->platform = data[5];
+  out->port = Get16(data + 6);
+  out->id = Get64(data + 8);
+  out->name = Field(data + 16, kBeaconNameSize);
+  out->avatar = Field(data + 48, kBeaconAvatarSize);
+  out->ttl_s = data[3] >= 2 && len >= kBeaconV2Size ? Get16(data + 64) : 0;
+  out->device_id.clear();
+  if (data[3] >= 3 && len >= kBeaconSize) {
+    out->device_id = Field(data + 68, kBeaconDeviceIdSize);
+    if (DeviceIdFromString(out->device_id) != out->id) {
+      out->device_id.clear();
+    }
+  }
+  return out->id != 0;
+}
+
+uint64_t DeviceIdFromString(const std::string& id) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (const char c : id) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ull;
+  }
+  return hash != 0 ? hash : 1;
+}
+
+#if defined(_WIN32)
+
+std::unique_ptr<DiscoveryEngine> DiscoveryEngine::Start(
+    const DiscoveryConfig&) {
+  return nullptr;
+}
+
+DiscoveryEngine::~DiscoveryEngine() = default;
+
+size_t DiscoveryEngine::Poll(uint8_t*, size_t) { return 0; }
+
+void DiscoveryEngine::Notify(std::function<void()>) {}
+
+void DiscoveryEngine::Announce() {}
+
+void DiscoveryEngine::Query() {}
+
+bool DiscoveryEngine::FirstInWindow(const std::string&, uint32_t) {
+  return true;
+}
+
+void DiscoveryEngine::SetPaused(bool) {}
+
+DiscoveryStats DiscoveryEngine::stats() const { return DiscoveryStats(); }
+
+#else
+
+namespace {
+
+uint64_t NowMs() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// How often peers are expired, which is also the expiry wheels' tick.
+uint64_t ExpireEveryMs(const DiscoveryConfig& config) {
+  return std::min<uint64_t>(kExpireEveryMs, config.ttl_ms / 4 + 1);
+}
+
+uint64_t ThreadCpuNs() {
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Host order; 0 if |s| isn't a dotted quad.
+uint32_t ParseIp(const std::string& s) {
+  in_addr addr;
+  if (inet_pton(AF_INET, s.c_str(), &addr) != 1) return 0;
+  return ntohl(addr.s_addr);
+}
+
+void SetNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+struct LocalAddress {
+  uint32_t ip;
+  uint32_t netmask;
+  bool loopback;
+};
+
+// Every IPv4 address on an interface that's up. SIOCGIFCONF rather than
+// getifaddrs() on Linux, which older Android doesn't have.
+std::vector<LocalAddress> LocalAddresses(int fd) {
+  std::vector<LocalAddress> out;
+#if defined(__linux__)
+  ifreq reqs[64];
+  ifconf conf;
+  conf.ifc_len = sizeof(reqs);
+  conf.ifc_req = reqs;
+  if (ioctl(fd, SIOCGIFCONF, &conf) != 0) return out;
+  const int n = conf.ifc_len / static_cast<int>(sizeof(ifreq));
+  for (int i = 0; i < n; i++) {
+    ifreq req = reqs[i];
+    if (req.ifr_addr.sa_family != AF_INET) continue;
+    const uint32_t ip = ntohl(
+        reinterpret_cast<const sockaddr_in*>(&req.ifr_addr)->sin_addr.s_addr);
+    if (ioctl(fd, SIOCGIFFLAGS, &req) != 0 || !(req.ifr_flags & IFF_UP)) {
+      continue;
+    }
+    const bool loopback = (req.ifr_flags & IFF_LOOPBACK) != 0;
+    uint32_t netmask = 0xffffff00;
+    if (ioctl(fd, SIOCGIFNETMASK, &req) == 0) {
+      netmask = ntohl(reinterpret_cast<const sockaddr_in*>(&req.ifr_netmask)
+                          ->sin_addr.s_addr);
+    }
+    out.push_back({ip, netmask, loopback});
+  }
+#else
+  (void)fd;
+  ifaddrs* addrs = nullptr;
+  if (getifaddrs(&addrs) != 0) return out;
+  for (ifaddrs* a = addrs; a != nullptr; a = a->ifa_next) {
+    if (a->ifa_addr == nullptr || a->ifa_addr->sa_family != AF_INET ||
+        !(a->ifa_flags & IFF_UP)) {
+      continue;
+    }
+    uint32_t netmask = 0xffffff00;
+    if (a->ifa_netmask != nullptr) {
+      netmask = ntohl(reinterpret_cast<const sockaddr_in*>(a->ifa_netmask)
+                          ->sin_addr.s_addr);
+    }
+    out.push_back(
+        {ntohl(reinterpret_cast<const sockaddr_in*>(a->ifa_addr)
+                   ->sin_addr.s_addr),
+         netmask, (a->ifa_flags & IFF_LOOPBACK) != 0});
+  }
+  freeifaddrs(addrs);
+#endif
+  return out;
+}
+
+// Our _zapshare._tcp instance. Its label can't hold a dot, as it's
+// written uncompressed.
+MdnsService ServiceFor(const Beacon& self) {
+  char id[17];
+  snprintf(id, sizeof(id), "%016llx",
+           static_cast<unsigned long long>(self.id));
+  std::string name = self.name.substr(0, Utf8Prefix(self.name, 40));
+  std::replace(name.begin(), name.end(), '.', ' ');
+  MdnsService service;
+  service.instance = (name.empty() ? "ZapShare" : name) + " (" +
+                     std::string(id + 12, 4) + ")";
+  service.host = std::string("zapshare-") + id + ".local";
+  service.port = self.port;
+  service.txt = {std::string("id=") + id, "name=" + name,
+                 "platform=" + std::to_string(self.platform),
+                 "avatar=" + self.avatar, "v=2"};
+  return service;
+}
+
+}  // namespace
+
+DiscoveryEngine::DiscoveryEngine(const DiscoveryConfig& config)
+    : config_(config),
+      expiry_(ExpireEveryMs(config), NowMs()),
+      recent_expiry_(ExpireEveryMs(config), NowMs()) {
+  // Ours can be two of the longest intervals apart when one is left out;
+  // allow for one more lost.
+  Beacon self = config_.self;
+  self.ttl_s = static_cast<uint16_t>(
+      std::min<uint64_t>((3ull * config_.max_interval_ms + 999) / 1000,
+                         UINT16_MAX));
+  EncodeBeacon(self, beacon_);
+  rng_ = self.id ^ static_cast<uint64_t>(
+                       std::chrono::steady_clock::now()
+                           .time_since_epoch()
+                           .count());
+  if (rng_ == 0) rng_ = 1;
+}
+
+std::unique_ptr<DiscoveryEngine> DiscoveryEngine::Start(
+    const DiscoveryConfig& config) {
+  std::unique_ptr<DiscoveryEngine> engine(new DiscoveryEngine(config));
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return nullptr;
+  engine->fd_ = fd;
+  SetNonBlocking(fd);
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+  // Room for a crowded LAN's beacons to land at once.
+  const int rcvbuf = 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  socklen_t len = sizeof(addr);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0 ||
+      pipe(engine->wake_) != 0) {
+    return nullptr;
+  }
+  SetNonBlocking(engine->wake_[0]);
+  SetNonBlocking(engine->wake_[1]);
+  engine->port_ = ntohs(addr.sin_port);
+
+  if (config.mdns_port != 0) {
+    // Shared with the system's responder, if it lets us. Without it we
+    // still find each other through query beacons.
+    const int mdns = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in any{};
+    any.sin_family = AF_INET;
+    any.sin_port = htons(config.mdns_port);
+    any.sin_addr.s_addr = htonl(INADDR_ANY);
+    setsockopt(mdns, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#if defined(SO_REUSEPORT)
+    setsockopt(mdns, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+    if (mdns >= 0 &&
+        bind(mdns, reinterpret_cast<sockaddr*>(&any), sizeof(any)) == 0) {
+      SetNonBlocking(mdns);
+      const int ttl = 255;
+      setsockopt(mdns, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+      engine->mdns_fd_ = mdns;
+      engine->mdns_port_ = config.mdns_port;
+      engine->mdns_ = ServiceFor(config.self);
+    } else if (mdns >= 0) {
+      close(mdns);
+    }
+  }
+
+  engine->group_ = ParseIp(config.group);
+  for (const std::string& target : config.targets) {
+    const size_t colon = target.find(':');
+    const uint32_t ip = ParseIp(target.substr(0, colon));
+    const uint16_t port =
+        colon == std::string::npos
+            ? engine->port_
+            : static_cast<uint16_t>(atoi(target.c_str() + colon + 1));
+    if (ip != 0 && port != 0) engine->targets_.push_back({ip, port});
+  }
+  engine->RefreshInterfaces();
+  engine->thread_ = std::thread(&DiscoveryEngine::Run, engine.get());
+  return engine;
+}
+
+DiscoveryEngine::~DiscoveryEngine() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    Wake();
+  }
+  stop_ = true;
+  if (wake_[1] >= 0) {
+    const uint8_t byte = 0;
+    (void)!write(wake_[1], &byte, 1);
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+    // Peers drop us now rather than when our ttl runs out.
+    if (last_sent_ != 0) {
+      uint8_t bye[kBeaconSize];
+      memcpy(bye, beacon_, kBeaconSize);
+      bye[4] |= kBeaconBye;
+      SendBeacons(bye);
+    }
+  }
+  if (fd_ >= 0) close(fd_);
+  if (mdns_fd_ >= 0) close(mdns_fd_);
+  if (wake_[0] >= 0) close(wake_[0]);
+  if (wake_[1] >= 0) close(wake_[1]);
+}
+
+void DiscoveryEngine::Announce() {
+  announce_ = true;
+  const uint8_t byte = 0;
+  (void)!write(wake_[1], &byte, 1);
+}
+
+void DiscoveryEngine::Query() {
+  query_ = true;
+  const uint8_t byte = 0;
+  (void)!write(wake_[1], &byte, 1);
+}
+
+void DiscoveryEngine::SetPaused(bool paused) {
+  if (paused_.exchange(paused) && !paused) Announce();
+}
+
+DiscoveryStats DiscoveryEngine::stats() const {
+  DiscoveryStats s;
+  s.datagrams = datagrams_.load();
+  s.beacons = beacons_.load();
+  s.sent = sent_.load();
+  s.suppressed = suppressed_.load();
+  s.answered = answered_.load();
+  s.cpu_ns = cpu_ns_.load();
+  std::lock_guard<std::mutex> lock(mu_);
+  s.messages = messages_total_;
+  s.dropped = dropped_;
+  s.peers = peer_index_.size();
+  return s;
+}
+
+void DiscoveryEngine::Run() {
+  const uint64_t cpu_start = ThreadCpuNs();
+#if defined(__linux__)
+  const int epoll = epoll_create1(EPOLL_CLOEXEC);
+  for (const int fd : {fd_, wake_[0], mdns_fd_}) {
+    if (fd < 0) continue;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev);
+  }
+#endif
+  const uint64_t expire_every = ExpireEveryMs(config_);
+  StartInterval(NowMs(), config_.min_interval_ms, true);
+  uint64_t next_expire = NowMs() + expire_every;
+  while (!stop_) {
+    const uint64_t now = NowMs();
+    if (announce_.exchange(false)) {
+      StartInterval(now, config_.min_interval_ms, true);
+    }
+    if (query_.exchange(false)) {
+      uint8_t query[kBeaconSize];
+      memcpy(query, beacon_, kBeaconSize);
+      query[4] |= kBeaconQuery;
+      SendBeacons(query);
+      last_sent_ = now;
+    }
+    if (send_at_ != 0 && now >= send_at_) {
+      send_at_ = 0;
+      if (paused_) {
+      } else if (Redundant(now)) {
+        suppressed_++;
+      } else {
+        SendBeacons(beacon_);
+        last_sent_ = now;
+      }
+    }
+    if (now >= interval_end_) {
+      StartInterval(now,
+                    std::min<uint64_t>(interval_ms_ * 2,
+                                       config_.max_interval_ms),
+                    false);
+    }
+    if (now >= next_expire) {
+      Expire(now);
+      next_expire = now + expire_every;
+    }
+    const uint64_t wake = std::min(
+        {send_at_ != 0 ? send_at_ : interval_end_, interval_end_,
+         next_expire});
+    const int timeout = static_cast<int>(wake > now ? wake - now : 0);
+    bool readable = false;
+    bool woken = false;
+    bool mdns = false;
+#if defined(__linux__)
+    epoll_event events[3];
+    const int n = epoll_wait(epoll, events, 3, timeout);
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.fd == fd_) readable = true;
+      if (events[i].data.fd == wake_[0]) woken = true;
+      if (events[i].data.fd == mdns_fd_) mdns = true;
+    }
+#else
+    // poll() skips a negative fd, so mDNS may be off.
+    pollfd fds[3] = {
+        {fd_, POLLIN, 0}, {wake_[0], POLLIN, 0}, {mdns_fd_, POLLIN, 0}};
+    if (poll(fds, 3, timeout) > 0) {
+      readable = (fds[0].revents & POLLIN) != 0;
+      woken = (fds[1].revents & POLLIN) != 0;
+      mdns = (fds[2].revents & POLLIN) != 0;
+    }
+#endif
+    if (woken) {
+      uint8_t drain[64];
+      while (read(wake_[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+    if (readable) Receive();
+    if (mdns) ReceiveMdns();
+    cpu_ns_ = ThreadCpuNs() - cpu_start;
+  }
+#if defined(__linux__)
+  close(epoll);
+#endif
+}
+
+void DiscoveryEngine::Receive() {
+#if defined(__linux__)
+  constexpr int kBatch = 16;
+  // Beacons are small but requests can be large; the slots are left
+  // uninitialised so only the pages datagrams fill get committed.
+  if (!buffer_) buffer_.reset(new uint8_t[kBatch * kMaxDatagram]);
+  mmsghdr msgs[kBatch];
+  iovec iovs[kBatch];
+  sockaddr_in from[kBatch];
+  for (;;) {
+    for (int i = 0; i < kBatch; i++) {
+      iovs[i] = {buffer_.get() + i * kMaxDatagram, kMaxDatagram};
+      msgs[i] = {};
+      msgs[i].msg_hdr.msg_name = &from[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    const int n = recvmmsg(fd_, msgs, kBatch, 0, nullptr);
+    if (n <= 0) return;
+    const uint64_t now = NowMs();
+    datagrams_ += static_cast<uint64_t>(n);
+    for (int i = 0; i < n; i++) {
+      Handle(ntohl(from[i].sin_addr.s_addr), ntohs(from[i].sin_port),
+             static_cast<const uint8_t*>(iovs[i].iov_base), msgs[i].msg_len,
+             now);
+    }
+    if (n < kBatch) return;
+  }
+#else
+  if (!buffer_) buffer_.reset(new uint8_t[kMaxDatagram]);
+  for (;;) {
+    sockaddr_in from{};
+    socklen_t len = sizeof(from);
+    const ssize_t n =
+        recvfrom(fd_, buffer_.get(), kMaxDatagram, 0,
+                 reinterpret_cast<sockaddr*>(&from), &len);
+    if (n < 0) return;
+    datagrams_++;
+    Handle(ntohl(from.sin_addr.s_addr), ntohs(from.sin_port), buffer_.get(),
+           static_cast<size_t>(n), NowMs());
+  }
+#endif
+}
+
+void DiscoveryEngine::StartInterval(uint64_t now, uint64_t interval_ms,
+                                    bool burst) {
+  rng_ ^= rng_ << 13;
+  rng_ ^= rng_ >> 7;
+  rng_ ^= rng_ << 17;
+  interval_ms_ = std::max<uint64_t>(interval_ms, 1);
+  interval_end_ = now + interval_ms_;
+  send_at_ = now + interval_ms_ / 2 + rng_ % (interval_ms_ / 2 + 1);
+  heard_ = 0;
+  burst_ = burst;
+}
+
+void DiscoveryEngine::Restart(uint64_t now) {
+  if (interval_ms_ > config_.min_interval_ms || send_at_ == 0) {
+    StartInterval(now, config_.min_interval_ms, true);
+  } else {
+    burst_ = true;
+  }
+}
+
+bool DiscoveryEngine::Redundant(uint64_t now) const {
+  return config_.redundancy > 0 && !burst_ &&
+         heard_ >= config_.redundancy &&
+         now - last_sent_ < config_.max_interval_ms;
+}
+
+void DiscoveryEngine::Handle(uint32_t from, uint16_t from_port,
+                             const uint8_t* data, size_t len, uint64_t now) {
+  Beacon beacon;
+  if (DecodeBeacon(data, len, &beacon)) {
+    if (beacon.id == config_.self.id) return;
+    beacons_++;
+    bool query = (beacon.flags & kBeaconQuery) != 0;
+    beacon.flags &= static_cast<uint8_t>(~kBeaconQuery);
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      uint32_t peer = peer_index_.Find(beacon.id);
+      if (beacon.flags & kBeaconBye) {
+        if (peer != FlatIndex::kNone) DropPeer(peer);
+        return;
+      }
+      const uint64_t ttl_ms =
+          beacon.ttl_s == 0
+              ? config_.ttl_ms
+              : std::max<uint64_t>(beacon.ttl_s * 1000ull, kExpireEveryMs);
+      bool changed = peer == FlatIndex::kNone;
+      if (changed) {
+        peer = AddPeer(beacon, ttl_ms);
+      } else {
+        changed = !SameBeacon(peers_[peer].beacon, beacon);
+        peers_[peer].beacon = beacon;
+        peers_[peer].ttl_ms = ttl_ms;
+      }
+      const uint32_t address = address_index_.Find(from);
+      if (address != FlatIndex::kNone && addresses_[address].peer == peer) {
+        // Expiry only looks at this when the timer fires.
+        addresses_[address].seen_ms = now;
+        if (!changed) heard_++;
+      } else {
+        // Someone new on this network, who hasn't heard from us yet.
+        Restart(now);
+        // A device that came back with a new id takes its address along.
+        if (address != FlatIndex::kNone) DropAddress(address);
+        AddAddress(peer, from, now);
+        changed = true;
+      }
+      if (changed) {
+        gone_.erase(beacon.id);
+        MarkDirty(peer);
+      }
+      // Once per address per shortest interval, however often it asks.
+      query = query && !paused_ &&
+              FirstSeen(kQueryKey | from, config_.min_interval_ms, now);
+    }
+    if (query) Answer(from, from_port);
+    return;
+  }
+
+  const bool legacy_beacon =
+      std::search(data, data + len, kLegacyBeaconType,
+                  kLegacyBeaconType + sizeof(kLegacyBeaconType) - 1) !=
+      data + len;
+  if (legacy_beacon) {
+    for (const Interface& local : interfaces_) {
+      if (local.ip == from) return;  // Our own, looped back.
+    }
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  if (legacy_beacon && address_index_.Find(from) != FlatIndex::kNone) {
+    return;
+  }
+  if (messages_.size() >= kMaxQueuedMessages) {
+    dropped_++;
+    return;
+  }
+  messages_.push_back({from, std::vector<uint8_t>(data, data + len)});
+  messages_total_++;
+  Wake();
+}
+
+void DiscoveryEngine::Expire(uint64_t now) {
+  std::lock_guard<std::mutex> lock(mu_);
+  expiry_.Advance(now, [&](uint32_t address) {
+    const Address& a = addresses_[address];
+    const uint64_t due = a.seen_ms + peers_[a.peer].ttl_ms;
+    if (due > now) {
+      expiry_.Schedule(address, due);
+    } else {
+      DropAddress(address);
+    }
+  });
+  recent_expiry_.Advance(now, [&](uint32_t slot) {
+    recent_index_.Erase(recent_[slot].key);
+    free_recent_.push_back(slot);
+  });
+}
+
+uint32_t DiscoveryEngine::AddPeer(const Beacon& beacon, uint64_t ttl_ms) {
+  uint32_t peer;
+  if (free_peers_.empty()) {
+    peer = static_cast<uint32_t>(peers_.size());
+    peers_.emplace_back();
+  } else {
+    peer = free_peers_.back();
+    free_peers_.pop_back();
+  }
+  // |dirty| stays: a slot in dirty_ from its last peer still is.
+  Peer& p = peers_[peer];
+  p.beacon = beacon;
+  p.ttl_ms = ttl_ms;
+  p.addresses.clear();
+  p.live = true;
+  peer_index_.Insert(beacon.id, peer);
+  return peer;
+}
+
+void DiscoveryEngine::DropPeer(uint32_t peer) {
+  Peer& p = peers_[peer];
+  for (const uint32_t address : p.addresses) {
+    address_index_.Erase(addresses_[address].ip);
+    expiry_.Cancel(address);
+    free_addresses_.push_back(address);
+  }
+  p.addresses.clear();
+  p.live = false;
+  peer_index_.Erase(p.beacon.id);
+  gone_.insert(p.beacon.id);
+  free_peers_.push_back(peer);
+  Wake();
+}
+
+void DiscoveryEngine::AddAddress(uint32_t peer, uint32_t ip, uint64_t now) {
+  uint32_t address;
+  if (free_addresses_.empty()) {
+    address = static_cast<uint32_t>(addresses_.size());
+    addresses_.emplace_back();
+  } else {
+    address = free_addresses_.back();
+    free_addresses_.pop_back();
+  }
+  addresses_[address] = {ip, peer, now};
+  address_index_.Insert(ip, address);
+  peers_[peer].addresses.push_back(address);
+  expiry_.Schedule(address, now + peers_[peer].ttl_ms);
+}
+
+void DiscoveryEngine::DropAddress(uint32_t address) {
+  const uint32_t peer = addresses_[address].peer;
+  std::vector<uint32_t>& left = peers_[peer].addresses;
+  if (left.size() == 1) {
+    DropPeer(peer);
+    return;
+  }
+  left.erase(std::find(left.begin(), left.end(), address));
+  address_index_.Erase(addresses_[address].ip);
+  expiry_.Cancel(address);
+  free_addresses_.push_back(address);
+  MarkDirty(peer);
+}
+
+void DiscoveryEngine::MarkDirty(uint32_t peer) {
+  if (peers_[peer].dirty) return;
+  peers_[peer].dirty = true;
+  dirty_.push_back(peer);
+  Wake();
+}
+
+void DiscoveryEngine::Wake() {
+  if (ready_) std::exchange(ready_, nullptr)();
+}
+
+bool DiscoveryEngine::FirstInWindow(const std::string& key,
+                                    uint32_t window_ms) {
+  const uint64_t now = NowMs();
+  std::lock_guard<std::mutex> lock(mu_);
+  return FirstSeen(DeviceIdFromString(key), window_ms, now);
+}
+
+bool DiscoveryEngine::FirstSeen(uint64_t key, uint64_t window_ms,
+                                uint64_t now) {
+  uint32_t slot = recent_index_.Find(key);
+  bool first = true;
+  if (slot != FlatIndex::kNone) {
+    first = now - recent_[slot].seen_ms >= recent_[slot].window_ms;
+  } else if (free_recent_.empty()) {
+    slot = static_cast<uint32_t>(recent_.size());
+    recent_.emplace_back();
+  } else {
+    slot = free_recent_.back();
+    free_recent_.pop_back();
+  }
+  recent_[slot] = {key, now, window_ms};
+  recent_index_.Insert(key, slot);
+  recent_expiry_.Schedule(slot, now + window_ms);
+  return first;
+}
+
+void DiscoveryEngine::Answer(uint32_t ip, uint16_t port) {
+  sockaddr_in to{};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  to.sin_addr.s_addr = htonl(ip);
+  if (sendto(fd_, beacon_, kBeaconSize, 0,
+             reinterpret_cast<const sockaddr*>(&to), sizeof(to)) > 0) {
+    sent_++;
+    answered_++;
+  }
+}
+
+void DiscoveryEngine::ReceiveMdns() {
+  uint8_t data[kMaxMdnsMessage];
+  for (;;) {
+    sockaddr_in from{};
+    socklen_t len = sizeof(from);
+    const ssize_t n = recvfrom(mdns_fd_, data, sizeof(data), 0,
+                               reinterpret_cast<sockaddr*>(&from), &len);
+    if (n < 0) return;
+    datagrams_++;
+    // From any port but 5353 it's a one-shot resolver, which only
+    // listens for a unicast answer (RFC 6762 section 6.7).
+    const bool legacy = ntohs(from.sin_port) != mdns_port_;
+    MdnsMessage query;
+    MdnsMessage answer;
+    if (paused_ || !ParseMdns(data, static_cast<size_t>(n), &query)) {
+      continue;
+    }
+    // Every interface's address, rather than just the one it came in
+    // on; the asker tries them in turn.
+    mdns_.addresses.clear();
+    for (const Interface& local : interfaces_) {
+      mdns_.addresses.push_back(local.ip);
+    }
+    if (!AnswerMdns(query, mdns_, legacy, &answer)) continue;
+    const std::vector<uint8_t> out = EncodeMdns(answer);
+    if (out.empty()) continue;
+    const bool unicast =
+        legacy || std::any_of(query.questions.begin(), query.questions.end(),
+                              [](const MdnsQuestion& q) {
+                                return q.unicast_response;
+                              });
+    if (unicast) {
+      if (sendto(mdns_fd_, out.data(), out.size(), 0,
+                 reinterpret_cast<const sockaddr*>(&from), len) > 0) {
+        sent_++;
+        answered_++;
+      }
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (!FirstSeen(kMdnsKey, kMdnsAnswerEveryMs, NowMs())) continue;
+    }
+    answered_++;
+    sockaddr_in to{};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(mdns_port_);
+    to.sin_addr.s_addr = htonl(ParseIp(kMdnsGroup));
+    for (const Interface& local : interfaces_) {
+      in_addr via;
+      via.s_addr = htonl(local.ip);
+      setsockopt(mdns_fd_, IPPROTO_IP, IP_MULTICAST_IF, &via, sizeof(via));
+      if (sendto(mdns_fd_, out.data(), out.size(), 0,
+                 reinterpret_cast<const sockaddr*>(&to), sizeof(to)) > 0) {
+        sent_++;
+      }
+    }
+  }
+}
+
+void DiscoveryEngine::SendBeacons(const uint8_t* beacon) {
+  if (config_.interfaces.empty()) RefreshInterfaces();
+  const bool bye = (beacon[4] & kBeaconBye) != 0;
+  auto send_to = [&](uint32_t ip, uint16_t port) {
+    sockaddr_in to{};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = htonl(ip);
+    const sockaddr* addr = reinterpret_cast<const sockaddr*>(&to);
+    if (sendto(fd_, beacon, kBeaconSize, 0, addr, sizeof(to)) > 0) sent_++;
+    if (!bye && !config_.legacy_beacon.empty() &&
+        sendto(fd_, config_.legacy_beacon.data(),
+               config_.legacy_beacon.size(), 0, addr, sizeof(to)) > 0) {
+      sent_++;
+    }
+  };
+  if (!targets_.empty()) {
+    for (const auto& target : targets_) send_to(target.first, target.second);
+    return;
+  }
+  for (const Interface& local : interfaces_) {
+    in_addr via;
+    via.s_addr = htonl(local.ip);
+    setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_IF, &via, sizeof(via));
+    if (group_ != 0) send_to(group_, port_);
+    // The hotspot case: some phones don't forward multicast to clients.
+    if (config_.broadcast && local.broadcast != local.ip) {
+      send_to(local.broadcast, port_);
+    }
+  }
+  if (config_.broadcast && !interfaces_.empty()) {
+    send_to(INADDR_BROADCAST, port_);
+  }
+}
+
+void DiscoveryEngine::RefreshInterfaces() {
+  std::vector<Interface> now;
+  const std::vector<LocalAddress> locals = LocalAddresses(fd_);
+  if (config_.interfaces.empty()) {
+    for (const LocalAddress& local : locals) {
+      if (!local.loopback) {
+        now.push_back({local.ip, local.ip | ~local.netmask});
+      }
+    }
+  } else {
+    for (const std::string& name : config_.interfaces) {
+      const uint32_t ip = ParseIp(name);
+      if (ip == 0) continue;
+      uint32_t netmask = 0xffffff00;  // As the Dart side assumes.
+      for (const LocalAddress& local : locals) {
+        if (local.ip == ip) netmask = local.netmask;
+      }
+      now.push_back({ip, ip | ~netmask});
+    }
+  }
+  const uint32_t mdns_group = ParseIp(kMdnsGroup);
+  auto membership = [&](uint32_t ip, int option) {
+    ip_mreq req{};
+    req.imr_interface.s_addr = htonl(ip);
+    if (group_ != 0) {
+      req.imr_multiaddr.s_addr = htonl(group_);
+      setsockopt(fd_, IPPROTO_IP, option, &req, sizeof(req));
+    }
+    if (mdns_fd_ >= 0) {
+      req.imr_multiaddr.s_addr = htonl(mdns_group);
+      setsockopt(mdns_fd_, IPPROTO_IP, option, &req, sizeof(req));
+    }
+  };
+  auto has = [](const std::vector<Interface>& list, uint32_t ip) {
+    return std::any_of(list.begin(), list.end(),
+                       [&](const Interface& i) { return i.ip == ip; });
+  };
+  for (const Interface& old : interfaces_) {
+    if (!has(now, old.ip)) membership(old.ip, IP_DROP_MEMBERSHIP);
+  }
+  for (const Interface& added : now) {
+    if (!has(interfaces_, added.ip)) membership(added.ip, IP_ADD_MEMBERSHIP);
+  }
+  interfaces_ = std::move(now);
+}
+
+size_t DiscoveryEngine::Poll(uint8_t* out, size_t cap) {
+  std::lock_guard<std::mutex> lock(mu_);
+  size_t pos = 0;
+  for (auto it = gone_.begin(); it != gone_.end() && pos + 9 <= cap;) {
+    out[pos] = kGoneEvent;
+    Put64(out + pos + 1, *it);
+    pos += 9;
+    it = gone_.erase(it);
+  }
+  if (!gone_.empty()) return pos;
+  size_t done = 0;
+  for (; done < dirty_.size(); done++) {
+    Peer& peer = peers_[dirty_[done]];
+    if (peer.live && !AppendPeer(peer, out, cap, &pos)) break;
+    peer.dirty = false;
+  }
+  dirty_.erase(dirty_.begin(), dirty_.begin() + done);
+  if (!dirty_.empty()) return pos;
+  while (!messages_.empty()) {
+    const Message& m = messages_.front();
+    if (pos + 7 + m.data.size() > cap) break;
+    out[pos] = kMessageEvent;
+    Put32(out + pos + 1, m.from);
+    Put16(out + pos + 5, static_cast<uint16_t>(m.data.size()));
+    memcpy(out + pos + 7, m.data.data(), m.data.size());
+    pos += 7 + m.data.size();
+    messages_.pop_front();
+  }
+  return pos;
+}
+
+void DiscoveryEngine::Notify(std::function<void()> ready) {
+  std::lock_guard<std::mutex> lock(mu_);
+  ready_ = std::move(ready);
+  if (!gone_.empty() || !dirty_.empty() || !messages_.empty()) Wake();
+}
+
+bool DiscoveryEngine::AppendPeer(const Peer& peer, uint8_t* out, size_t cap,
+                                 size_t* pos) const {
+  const Beacon& b = peer.beacon;
+  const size_t addresses = std::min<size_t>(peer.addresses.size(), 255);
+  const size_t size = 15 + b.name.size() + 1 + b.avatar.size() + 1 +
+                      b.device_id.size() + 1 + 4 * addresses;
+  if (*pos + size > cap) return false;
+  uint8_t* p = out + *pos;
+  p[0] = kPeerEvent;
+  p[1] = b.platform;
+  Put16(p + 2, b.port);
+  Put64(p + 4, b.id);
+  p[12] = b.flags;
+  p += 13;
+  *p++ = static_cast<uint8_t>(b.name.size());
+  memcpy(p, b.name.data(), b.name.size());
+  p += b.name.size();
+  *p++ = static_cast<uint8_t>(b.avatar.size());
+  memcpy(p, b.avatar.data(), b.avatar.size());
+  p += b.avatar.size();
+  *p++ = static_cast<uint8_t>(b.device_id.size());
+  memcpy(p, b.device_id.data(), b.device_id.size());
+  p += b.device_id.size();
+  // The app talks to the first, so it should be the one still in use.
+  std::vector<uint32_t> latest(peer.addresses.begin(),
+                               peer.addresses.begin() + addresses);
+  std::stable_sort(latest.begin(), latest.end(),
+                   [this](uint32_t a, uint32_t b) {
+                     return addresses_[a].seen_ms > addresses_[b].seen_ms;
+                   });
+  *p++ = static_cast<uint8_t>(addresses);
+  for (const uint32_t address : latest) {
+    Put32(p, addresses_[address].ip);
+    p += 4;
+  }
+  *pos = static_cast<size_t>(p - out);
+  return true;
+}
+
+#endif  // defined(_WIN32)
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::DiscoveryEngine* Unwrap(ZsDiscovery* discovery) {
+  return reinterpret_cast<zapshare::DiscoveryEngine*>(discovery);
+}
+
+const zapshare::DiscoveryEngine* Unwrap(const ZsDiscovery* discovery) {
+  return reinterpret_cast<const zapshare::DiscoveryEngine*>(discovery);
+}
+
+}  // namespace
+
+ZsDiscovery* zs_discovery_start(const char* device_id, const char* name,
+                                const char* avatar, int32_t platform,
+                                uint16_t service_port, uint16_t port,
+                                const char* group, uint32_t min_interval_ms,
+                                uint32_t max_interval_ms, uint16_t mdns_port,
+                                const uint8_t* legacy_beacon,
+                                size_t legacy_len) {
+  zapshare::DiscoveryConfig config;
+  config.self.id = zapshare::DeviceIdFromString(device_id);
+  config.self.name = name;
+  config.self.avatar = avatar;
+  config.self.device_id = device_id;
+  config.self.platform = static_cast<uint8_t>(platform);
+  config.self.port = service_port;
+  config.port = port;
+  config.group = group;
+  config.min_interval_ms = min_interval_ms;
+  config.max_interval_ms = max_interval_ms;
+  config.mdns_port = mdns_port;
+  if (legacy_beacon != nullptr) {
+    config.legacy_beacon.assign(legacy_beacon, legacy_beacon + legacy_len);
+  }
+  return reinterpret_cast<ZsDiscovery*>(
+      zapshare::DiscoveryEngine::Start(config).release());
+}
+
+void zs_discovery_free(ZsDiscovery* discovery) { delete Unwrap(discovery); }
+
+size_t zs_discovery_poll(ZsDiscovery* discovery, uint8_t* out, size_t cap) {
+  return Unwrap(discovery)->Poll(out, cap);
+}
+
+void zs_discovery_notify(ZsDiscovery* discovery, void (*ready)(int64_t),
+                         int64_t token) {
+  Unwrap(discovery)->Notify([ready, token] { ready(token); });
+}
+
+void zs_discovery_announce(ZsDiscovery* discovery) {
+  Unwrap(discovery)->Announce();
+}
+
+void zs_discovery_query(ZsDiscovery* discovery) {
+  Unwrap(discovery)->Query();
+}
+
+int32_t zs_discovery_first_in_window(ZsDiscovery* discovery,
+                                     const char* key, uint32_t window_ms) {
+  return Unwrap(discovery)->FirstInWindow(key, window_ms) ? 1 : 0;
+}
+
+void zs_discovery_set_paused(ZsDiscovery* discovery, int32_t paused) {
+  Unwrap(discovery)->SetPaused(paused != 0);
+}
+
+uint64_t zs_discovery_device_id(const char* device_id) {
+  return zapshare::DeviceIdFromString(device_id);
+}
+
+void zs_discovery_stats(const ZsDiscovery* discovery, uint64_t out[9]) {
+  const zapshare::DiscoveryStats s = Unwrap(discovery)->stats();
+  out[0] = s.datagrams;
+  out[1] = s.beacons;
+  out[2] = s.sent;
+  out[3] = s.messages;
+  out[4] = s.dropped;
+  out[5] = s.peers;
+  out[6] = s.cpu_ns;
+  out[7] = s.suppressed;
+  out[8] = s.answered;
+}
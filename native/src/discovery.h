@@ -0,0 +1,366 @@
+#ifndef ZAPSHARE_NATIVE_DISCOVERY_H_
+#define ZAPSHARE_NATIVE_DISCOVERY_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "export.h"
+#include "mdns.h"
+#include "peer_table.h"
+
+namespace zapshare {
+
+// LAN discovery on one thread: a single socket on the discovery port that
+// is a member of the multicast group on every interface, driven by one
+// epoll loop (poll() off Linux), which both sends our beacons and keeps
+// the table of peers heard from.
+//
+// Beacons are scheduled the way Trickle (RFC 6206) schedules routing
+// updates. Each interval picks a random moment in its second half to
+// beacon at, and doubles from |min_interval_ms| up to |max_interval_ms|
+// while nothing new happens. A new peer, or the app calling Announce()
+// because a screen that lists peers opened, starts over at the shortest
+// interval, so everyone answers a newcomer within |min_interval_ms|. Once
+// settled, a beacon is left out when |redundancy| known peers beaconed
+// earlier in the same interval and ours went out recently enough that
+// nobody will time us out. Beacons carry how long to wait for the next
+// one, so peers that beacon rarely aren't expired early, and a last one
+// flagged kBeaconBye when the engine stops.
+//
+// Beacons are kBeaconSize bytes of fixed layout instead of JSON. They're
+// decoded where they arrive and folded into the table; the app only ever
+// sees the table change. A peer that keeps beaconing with nothing new is
+// never reported again until it has been silent for |ttl_ms| on every
+// address and is reported gone. Poll() hands those changes over, and any
+// datagram that isn't a beacon (connection requests, cast control, the
+// JSON beacons of older versions) as it came, for the app to parse, and
+// Notify() wakes the app when there is any of that to hand over, so a LAN
+// where nothing changes costs it nothing.
+// Peers and their addresses are kept in FlatIndex tables and expire on a
+// TimerWheel, so neither a beacon nor the passing of time costs more on
+// a LAN of thousands.
+//
+// Query() asks instead of waiting: a beacon flagged kBeaconQuery, which
+// every peer that hears it answers at once with its own beacon, straight
+// back to the sender. With |mdns_port| set the engine also answers
+// DNS-SD queries for _zapshare._tcp (see mdns.h), so other tools can
+// find us too.
+//
+// Older versions only understand JSON, so the app can hand over its JSON
+// beacon once to be sent alongside ours. JSON beacons from a peer that
+// also sends ours are dropped here.
+//
+// Windows isn't supported yet; Start() returns null there and the app
+// keeps discovering in Dart.
+
+constexpr uint16_t kDiscoveryPort = 37020;
+constexpr char kDiscoveryGroup[] = "224.0.0.167";
+
+// Wire layout, all integers big-endian:
+//   0  "ZSB"       magic
+//   3  version     kBeaconVersion; later versions only append fields
+//   4  flags       kBeaconBye, kBeaconQuery
+//   5  platform    BeaconPlatform
+//   6  port        the sender's HTTP file server
+//   8  id          DeviceIdFromString() of the sender's device id
+//  16  name        UTF-8, NUL padded, cut at a character boundary
+//  48  avatar      avatar id, NUL padded; longer ones aren't sent
+// Version 2:
+//  64  ttl         seconds to keep the sender without another beacon; 0
+//                  leaves it to the receiver, as for version 1
+//  66  reserved
+// Version 3:
+//  68  device id   the app's own, UTF-8, NUL padded; longer ones aren't
+//                  sent
+constexpr size_t kBeaconSize = 100;
+constexpr size_t kBeaconV1Size = 64;
+constexpr size_t kBeaconV2Size = 68;
+constexpr uint8_t kBeaconVersion = 3;
+constexpr size_t kBeaconNameSize = 32;
+constexpr size_t kBeaconAvatarSize = 16;
+constexpr size_t kBeaconDeviceIdSize = 32;
+constexpr uint8_t kBeaconBye = 0x01;    // Flag: the sender is going away.
+constexpr uint8_t kBeaconQuery = 0x02;  // Flag: answer with your beacon.
+
+enum class BeaconPlatform : uint8_t {
+  kUnknown = 0,
+  kAndroid = 1,
+  kIos = 2,
+  kWindows = 3,
+  kMacos = 4,
+  kLinux = 5,
+};
+
+struct Beacon {
+  uint64_t id = 0;
+  uint16_t port = 0;
+  uint8_t platform = 0;
+  uint8_t flags = 0;
+  uint16_t ttl_s = 0;
+  std::string name;
+  std::string avatar;
+  // The string |id| is hashed from; empty when the sender predates
+  // version 3 or its id is too long to send.
+  std::string device_id;
+};
+
+// Writes exactly kBeaconSize bytes.
+void EncodeBeacon(const Beacon& beacon, uint8_t* out);
+// False unless |data| starts with a beacon of version 1 or later. A
+// device id that doesn't hash to the beacon's id is dropped.
+bool DecodeBeacon(const uint8_t* data, size_t len, Beacon* out);
+// A stable 64-bit id for the app's string device id (FNV-1a); never 0.
+uint64_t DeviceIdFromString(const std::string& id);
+
+// Poll() output: records back to back, integers big-endian.
+//   kPeerEvent     u8 kind, u8 platform, u16 port, u64 id, u8 flags,
+//                  u8 n + name, u8 n + avatar, u8 n + device id,
+//                  u8 n + n u32 IPv4 addresses, the one most recently
+//                  heard from first
+//   kGoneEvent     u8 kind, u64 id
+//   kMessageEvent  u8 kind, u32 IPv4 source, u16 n + n bytes
+constexpr uint8_t kPeerEvent = 1;
+constexpr uint8_t kGoneEvent = 2;
+constexpr uint8_t kMessageEvent = 3;
+// Fits any one record.
+constexpr size_t kDiscoveryPollBufferSize = 128 * 1024;
+
+struct DiscoveryConfig {
+  Beacon self;
+  uint16_t port = kDiscoveryPort;  // 0 picks a free one.
+  std::string group = kDiscoveryGroup;
+  // Local IPv4 addresses to beacon from and join the group on. Empty
+  // follows every IPv4 interface that's up, rechecked before each beacon.
+  std::vector<std::string> interfaces;
+  // "host" or "host:port" to send beacons to instead of the group and the
+  // broadcast addresses, for tests.
+  std::vector<std::string> targets;
+  // Also beacon to the broadcast addresses, for networks that drop
+  // multicast.
+  bool broadcast = true;
+  uint32_t min_interval_ms = 250;
+  uint32_t max_interval_ms = 32000;
+  // Peers heard in an interval that make our beacon redundant; 0 never
+  // leaves one out.
+  uint32_t redundancy = 3;
+  // Per address, for peers whose beacons don't say.
+  uint32_t ttl_ms = 30000;
+  std::vector<uint8_t> legacy_beacon;  // Sent after ours when not empty.
+  // Answers mDNS queries on this port (kMdnsPort) when not 0, if it can
+  // be bound alongside the system's responder.
+  uint16_t mdns_port = 0;
+};
+
+struct DiscoveryStats {
+  uint64_t datagrams = 0;  // Received.
+  uint64_t beacons = 0;    // Received from peers.
+  uint64_t sent = 0;       // Datagrams.
+  uint64_t suppressed = 0; // Beacons left out as redundant.
+  uint64_t answered = 0;   // Query beacons and mDNS queries.
+  uint64_t messages = 0;   // Handed to Poll().
+  uint64_t dropped = 0;    // Messages that found the queue full.
+  uint64_t peers = 0;
+  uint64_t cpu_ns = 0;     // Of the engine's thread.
+};
+
+class DiscoveryEngine {
+ public:
+  // Null if the port can't be bound, or on Windows.
+  static std::unique_ptr<DiscoveryEngine> Start(const DiscoveryConfig& config);
+  ~DiscoveryEngine();
+
+  DiscoveryEngine(const DiscoveryEngine&) = delete;
+  DiscoveryEngine& operator=(const DiscoveryEngine&) = delete;
+
+  // Moves as many whole records as fit in |out| and returns their size;
+  // 0 when nothing changed. Needs kDiscoveryPollBufferSize to be sure of
+  // making progress.
+  size_t Poll(uint8_t* out, size_t cap);
+  // Calls |ready| once Poll() has something: right away if it already
+  // has, otherwise on the engine's thread when a peer is added, changes or
+  // is gone, or a message arrives, or when the engine is destroyed.
+  // Beacons that say nothing new don't call it. It runs with the table
+  // locked, so it must hand off rather than call back in. A second call
+  // before the first fires replaces it.
+  void Notify(std::function<void()> ready);
+  // Beacons within |min_interval_ms| and restarts the backoff, for when
+  // the app wants the peer list fresh.
+  void Announce();
+  // Has every peer that hears it answer with its beacon right away.
+  void Query();
+  // True unless |key| was seen here less than |window_ms| ago, for
+  // dropping requests the sender repeated. Either way it counts as seen
+  // now.
+  bool FirstInWindow(const std::string& key, uint32_t window_ms);
+  // Stops sending beacons while paused; still listens.
+  void SetPaused(bool paused);
+  uint16_t port() const { return port_; }
+  uint16_t mdns_port() const { return mdns_port_; }
+  DiscoveryStats stats() const;
+
+ private:
+  struct Address {
+    uint32_t ip;    // Host order.
+    uint32_t peer;  // Into peers_.
+    uint64_t seen_ms;
+  };
+  struct Peer {
+    Beacon beacon;
+    uint64_t ttl_ms = 0;
+    // Into addresses_, in the order they were first heard from.
+    std::vector<uint32_t> addresses;
+    bool live = false;
+    bool dirty = false;  // In dirty_.
+  };
+  struct Recent {
+    uint64_t key;
+    uint64_t seen_ms;
+    uint64_t window_ms;
+  };
+  struct Interface {
+    uint32_t ip;
+    uint32_t broadcast;
+  };
+  struct Message {
+    uint32_t from;
+    std::vector<uint8_t> data;
+  };
+
+  explicit DiscoveryEngine(const DiscoveryConfig& config);
+
+  void Run();
+  void Receive();
+  void Handle(uint32_t from, uint16_t from_port, const uint8_t* data,
+              size_t len, uint64_t now);
+  // Our beacon, straight to a peer that asked.
+  void Answer(uint32_t ip, uint16_t port);
+  void ReceiveMdns();
+  void Expire(uint64_t now);
+  // The peer table; all with |mu_| held.
+  uint32_t AddPeer(const Beacon& beacon, uint64_t ttl_ms);
+  void DropPeer(uint32_t peer);
+  void AddAddress(uint32_t peer, uint32_t ip, uint64_t now);
+  // Drops the peer too once it has no address left.
+  void DropAddress(uint32_t address);
+  void MarkDirty(uint32_t peer);
+  // Calls the Notify() callback, if any; |mu_| is held.
+  void Wake();
+  // FirstInWindow() for a hashed key, with |mu_| held.
+  bool FirstSeen(uint64_t key, uint64_t window_ms, uint64_t now);
+  // Starts a Trickle interval of |interval_ms|; |burst| ones never leave
+  // our beacon out.
+  void StartInterval(uint64_t now, uint64_t interval_ms, bool burst);
+  // Back to the shortest interval, for a newcomer to hear from us.
+  void Restart(uint64_t now);
+  bool Redundant(uint64_t now) const;
+  void SendBeacons(const uint8_t* beacon);
+  void RefreshInterfaces();
+  // Appends |peer|'s record to |out| if it fits.
+  bool AppendPeer(const Peer& peer, uint8_t* out, size_t cap,
+                  size_t* pos) const;
+
+  const DiscoveryConfig config_;
+  uint8_t beacon_[kBeaconSize];
+  uint32_t group_ = 0;  // Host order, as are the targets.
+  std::vector<std::pair<uint32_t, uint16_t>> targets_;
+  int fd_ = -1;
+  int mdns_fd_ = -1;
+  int wake_[2] = {-1, -1};
+  uint16_t port_ = 0;
+  uint16_t mdns_port_ = 0;
+  // Engine thread only.
+  std::vector<Interface> interfaces_;
+  MdnsService mdns_;  // Addresses filled in as it answers.
+  std::unique_ptr<uint8_t[]> buffer_;
+  uint64_t interval_ms_ = 0;
+  uint64_t interval_end_ = 0;
+  uint64_t send_at_ = 0;  // 0 once this interval's moment has passed.
+  uint32_t heard_ = 0;    // Known peers' beacons this interval.
+  bool burst_ = false;
+  uint64_t last_sent_ = 0;
+  uint64_t rng_;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> paused_{false};
+  std::atomic<bool> announce_{false};  // Start over at the shortest.
+  std::atomic<bool> query_{false};
+  std::atomic<uint64_t> datagrams_{0};
+  std::atomic<uint64_t> beacons_{0};
+  std::atomic<uint64_t> sent_{0};
+  std::atomic<uint64_t> suppressed_{0};
+  std::atomic<uint64_t> answered_{0};
+  std::atomic<uint64_t> cpu_ns_{0};
+
+  mutable std::mutex mu_;
+  // Dense arrays with free lists, indexed by id and address; an address
+  // slot is also its timer on |expiry_|.
+  std::vector<Peer> peers_;
+  std::vector<uint32_t> free_peers_;
+  FlatIndex peer_index_;
+  std::vector<Address> addresses_;
+  std::vector<uint32_t> free_addresses_;
+  FlatIndex address_index_;
+  TimerWheel expiry_;
+  std::vector<Recent> recent_;
+  std::vector<uint32_t> free_recent_;
+  FlatIndex recent_index_;
+  TimerWheel recent_expiry_;
+  // Changed or gone since the last Poll().
+  std::vector<uint32_t> dirty_;
+  std::unordered_set<uint64_t> gone_;
+  std::deque<Message> messages_;
+  std::function<void()> ready_;  // Set by Notify() until it is called.
+  uint64_t messages_total_ = 0;
+  uint64_t dropped_ = 0;
+
+  std::thread thread_;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsDiscovery ZsDiscovery;
+
+// Listens on |port| and beacons on every interface, between every
+// |min_interval_ms| and |max_interval_ms|. Answers mDNS on |mdns_port|
+// unless 0. |legacy_beacon| may be null. Null if the port can't be bound.
+ZS_EXPORT ZsDiscovery* zs_discovery_start(
+    const char* device_id, const char* name, const char* avatar,
+    int32_t platform, uint16_t service_port, uint16_t port,
+    const char* group, uint32_t min_interval_ms, uint32_t max_interval_ms,
+    uint16_t mdns_port, const uint8_t* legacy_beacon, size_t legacy_len);
+ZS_EXPORT void zs_discovery_free(ZsDiscovery* discovery);
+ZS_EXPORT size_t zs_discovery_poll(ZsDiscovery* discovery, uint8_t* out,
+                                   size_t cap);
+// Calls |ready| with |token| once there is something to poll, as
+// DiscoveryEngine::Notify() does.
+ZS_EXPORT void zs_discovery_notify(ZsDiscovery* discovery,
+                                   void (*ready)(int64_t token),
+                                   int64_t token);
+ZS_EXPORT void zs_discovery_announce(ZsDiscovery* discovery);
+ZS_EXPORT void zs_discovery_query(ZsDiscovery* discovery);
+// 1 unless |key| was passed here less than |window_ms| ago.
+ZS_EXPORT int32_t zs_discovery_first_in_window(ZsDiscovery* discovery,
+                                               const char* key,
+                                               uint32_t window_ms);
+ZS_EXPORT void zs_discovery_set_paused(ZsDiscovery* discovery,
+                                       int32_t paused);
+ZS_EXPORT uint64_t zs_discovery_device_id(const char* device_id);
+// datagrams, beacons, sent, messages, dropped, peers, cpu_ns, suppressed,
+// answered.
+ZS_EXPORT void zs_discovery_stats(const ZsDiscovery* discovery,
+                                  uint64_t out[9]);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_DISCOVERY_H_
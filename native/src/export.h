@@ -0,0 +1,16 @@
+#ifndef ZAPSHARE_NATIVE_EXPORT_H_
+#define ZAPSHARE_NATIVE_EXPORT_H_
+
+// Marks a function as part of the C ABI that lib/native/*.dart binds to.
+// Everything else in the library is hidden.
+#if defined(_WIN32)
+#if defined(ZS_BUILDING_LIBRARY)
+#define ZS_EXPORT __declspec(dllexport)
+#else
+#define ZS_EXPORT
+#endif
+#else
+#define ZS_EXPORT __attribute__((visibility("default")))
+#endif
+
+#endif  // ZAPSHARE_NATIVE_EXPORT_H_
@@ -0,0 +1,590 @@
+#include "fanout.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr std::chrono::seconds kIdleWake(1);
+constexpr std::chrono::milliseconds kLagGrace(20);
+
+}  // namespace
+
+struct FanoutCounters {
+  std::atomic<uint64_t> disk_bytes{0};
+  std::atomic<uint64_t> served_bytes{0};
+  std::atomic<uint64_t> joined{0};
+};
+
+// A file read at explicit offsets, so reads never depend on a shared seek
+// position.
+class FanoutSource {
+ public:
+  static std::unique_ptr<FanoutSource> Open(const std::string& path) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(
+        WidenPath(path).c_str(), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    return std::unique_ptr<FanoutSource>(new FanoutSource(file));
+#else
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    return std::unique_ptr<FanoutSource>(new FanoutSource(fd));
+#endif
+  }
+
+#if defined(_WIN32)
+  explicit FanoutSource(HANDLE file) : file_(file) {}
+  ~FanoutSource() { CloseHandle(file_); }
+#else
+  explicit FanoutSource(int fd) : fd_(fd) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+  ~FanoutSource() { close(fd_); }
+#endif
+
+  FanoutSource(const FanoutSource&) = delete;
+  FanoutSource& operator=(const FanoutSource&) = delete;
+
+  // False on an error, or if the file ends before |len| bytes.
+  bool ReadAt(uint64_t offset, uint8_t* out, size_t len) const {
+    while (len > 0) {
+#if defined(_WIN32)
+      OVERLAPPED at = {};
+      at.Offset = static_cast<DWORD>(offset);
+      at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      const DWORD want = static_cast<DWORD>(std::min<size_t>(len, 1 << 30));
+      DWORD got = 0;
+      if (!ReadFile(file_, out, want, &got, &at) || got == 0) return false;
+#else
+      const ssize_t got = pread(fd_, out, len, static_cast<off_t>(offset));
+      if (got < 0 && errno == EINTR) continue;
+      if (got <= 0) return false;
+#endif
+      out += got;
+      offset += static_cast<uint64_t>(got);
+      len -= static_cast<size_t>(got);
+    }
+    return true;
+  }
+
+ private:
+#if defined(_WIN32)
+  HANDLE file_;
+#else
+  int fd_;
+#endif
+};
+
+struct FanoutCursor {
+  uint64_t pos;
+  uint64_t end;
+  bool attached = false;  // Reading from the shared ring.
+  bool failed = false;
+  // Catch-up block, read for this reader alone while it isn't attached.
+  std::vector<uint8_t> own;
+  uint64_t own_pos = 0;
+  size_t own_len = 0;
+  bool own_wanted = false;
+  bool own_busy = false;  // Being filled on the stream's thread.
+  std::function<void()> ready;  // Set by Notify() until it is called.
+};
+
+// The shared state of one file: its ring, its readers and the thread that
+// does all of its disk reads.
+class FanoutStream {
+ public:
+  FanoutStream(std::unique_ptr<FanoutSource> source, uint64_t size,
+               int64_t mtime_ms, size_t block_size, size_t blocks,
+               std::shared_ptr<FanoutCounters> counters)
+      : source_(std::move(source)),
+        size_(size),
+        mtime_ms_(mtime_ms),
+        block_size_(block_size),
+        block_count_((size + block_size - 1) / block_size),
+        counters_(std::move(counters)),
+        ring_(blocks) {
+    thread_ = std::thread(&FanoutStream::Run, this);
+  }
+
+  ~FanoutStream() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  bool Matches(uint64_t size, int64_t mtime_ms) const {
+    return size == size_ && mtime_ms == mtime_ms_;
+  }
+
+  FanoutCursor* Add(uint64_t offset, uint64_t end) {
+    std::lock_guard<std::mutex> lock(mu_);
+    cursors_.emplace_back(new FanoutCursor());
+    FanoutCursor* c = cursors_.back().get();
+    c->pos = offset;
+    c->end = end;
+    return c;
+  }
+
+  void Remove(FanoutCursor* c) {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (c->own_busy) cv_.wait_for(lock, kIdleWake);
+    if (c->ready) std::exchange(c->ready, nullptr)();
+    if (c->attached) Detach(c);
+    for (size_t i = 0; i < cursors_.size(); i++) {
+      if (cursors_[i].get() == c) {
+        cursors_.erase(cursors_.begin() + static_cast<ptrdiff_t>(i));
+        break;
+      }
+    }
+  }
+
+  int64_t Read(FanoutCursor* c, uint8_t* out, size_t cap) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (c->failed) return -1;
+    if (c->pos >= c->end || cap == 0) return 0;
+    const uint64_t b = BlockOf(c->pos);
+    if (!c->attached && !failed_) {
+      if (b >= first_ && b <= first_ + count_) {
+        Attach(c);
+      } else if (attached_ == 0) {
+        // Nobody is on the ring: move it to this reader.
+        first_ = b;
+        count_ = 0;
+        Attach(c);
+      }
+    }
+
+    const uint8_t* from;
+    size_t avail;
+    if (c->attached) {
+      if (!Ready(b)) {
+        cv_.notify_all();  // The thread may be waiting for someone to wait.
+        return 0;
+      }
+      const size_t off = static_cast<size_t>(c->pos - b * block_size_);
+      from = ring_[b % ring_.size()].data.data() + off;
+      avail = BlockLength(b) - off;
+    } else {
+      if (c->own_busy) return 0;
+      if (c->pos < c->own_pos || c->pos >= c->own_pos + c->own_len) {
+        c->own_wanted = true;
+        cv_.notify_all();
+        return 0;
+      }
+      const size_t off = static_cast<size_t>(c->pos - c->own_pos);
+      from = c->own.data() + off;
+      avail = c->own_len - off;
+    }
+    const size_t n = static_cast<size_t>(
+        std::min<uint64_t>({cap, avail, c->end - c->pos}));
+    std::memcpy(out, from, n);
+    Advance(c, n);
+    counters_->served_bytes += n;
+    return static_cast<int64_t>(n);
+  }
+
+  void Notify(FanoutCursor* c, std::function<void()> ready) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (Blocked(c)) {
+      c->ready = std::move(ready);
+    } else {
+      ready();
+    }
+  }
+
+ private:
+  struct Slot {
+    std::vector<uint8_t> data;
+    uint32_t refs = 0;  // Attached readers positioned in this block.
+  };
+
+  uint64_t BlockOf(uint64_t pos) const { return pos / block_size_; }
+
+  size_t BlockLength(uint64_t block) const {
+    return static_cast<size_t>(
+        std::min<uint64_t>(block_size_, size_ - block * block_size_));
+  }
+
+  bool Ready(uint64_t block) const {
+    return block >= first_ && block < first_ + count_;
+  }
+
+  Slot& SlotOf(uint64_t block) { return ring_[block % ring_.size()]; }
+
+  // True while the reader is waiting on this thread: for its block to come
+  // into the ring, or for its own read. Anything else, including having
+  // been dropped from the ring, needs another Read() to move on.
+  bool Blocked(const FanoutCursor* c) const {
+    if (c->failed || c->pos >= c->end) return false;
+    if (c->attached) return !Ready(BlockOf(c->pos));
+    return c->own_busy || c->own_wanted;
+  }
+
+  void WakeReady() {
+    for (const auto& c : cursors_) {
+      if (c->ready && !Blocked(c.get())) std::exchange(c->ready, nullptr)();
+    }
+  }
+
+  void Attach(FanoutCursor* c) {
+    c->attached = true;
+    attached_++;
+    const uint64_t b = BlockOf(c->pos);
+    if (Ready(b)) SlotOf(b).refs++;
+  }
+
+  void Detach(FanoutCursor* c) {
+    const uint64_t b = BlockOf(c->pos);
+    if (Ready(b)) SlotOf(b).refs--;
+    c->attached = false;
+    attached_--;
+    cv_.notify_all();
+  }
+
+  void Advance(FanoutCursor* c, size_t n) {
+    if (!c->attached) {
+      c->pos += n;
+      return;
+    }
+    const uint64_t old_block = BlockOf(c->pos);
+    SlotOf(old_block).refs--;
+    c->pos += n;
+    const uint64_t block = BlockOf(c->pos);
+    if (c->pos >= c->end) {
+      c->attached = false;
+      attached_--;
+      cv_.notify_all();
+      return;
+    }
+    if (Ready(block)) SlotOf(block).refs++;
+    if (block != old_block) cv_.notify_all();
+  }
+
+  // True if an attached reader is held up on the block after the ring.
+  bool Waiting() const {
+    const uint64_t next = first_ + count_;
+    for (const auto& c : cursors_) {
+      if (c->attached && BlockOf(c->pos) == next) return true;
+    }
+    return false;
+  }
+
+  // Whether the next block can be read now. With the ring full and a
+  // straggler still on its oldest block, a reader waiting for more gives
+  // the straggler kLagGrace to move on before it is dropped.
+  bool CanLoad() {
+    if (attached_ == 0 || failed_ || first_ + count_ >= block_count_) {
+      return false;
+    }
+    if (count_ < ring_.size() || SlotOf(first_).refs == 0) {
+      stalled_ = false;
+      return true;
+    }
+    if (!Waiting()) {
+      stalled_ = false;
+      return false;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (!stalled_) {
+      stalled_ = true;
+      stalled_since_ = now;
+    }
+    return now - stalled_since_ >= kLagGrace;
+  }
+
+  // Frees the oldest slot if the ring is full, dropping readers that are
+  // still on it back to catch-up reads.
+  void MakeRoom() {
+    if (count_ < ring_.size()) return;
+    if (SlotOf(first_).refs > 0) {
+      for (const auto& c : cursors_) {
+        if (c->attached && BlockOf(c->pos) == first_) Detach(c.get());
+      }
+    }
+    first_++;
+    count_--;
+  }
+
+  FanoutCursor* NextCatchUp() {
+    for (size_t i = 0; i < cursors_.size(); i++) {
+      const size_t at = (next_own_ + i) % cursors_.size();
+      if (cursors_[at]->own_wanted) {
+        next_own_ = at + 1;
+        return cursors_[at].get();
+      }
+    }
+    return nullptr;
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (!stop_) {
+      WakeReady();
+      const bool share = CanLoad();
+      // Alternate when both kinds of read are wanted, so neither the
+      // shared stream nor a straggler starves.
+      FanoutCursor* c = share && !own_turn_ ? nullptr : NextCatchUp();
+      if (c != nullptr) {
+        own_turn_ = false;
+        c->own_wanted = false;
+        c->own_busy = true;
+        const uint64_t at = c->pos;
+        const size_t len =
+            static_cast<size_t>(std::min<uint64_t>(block_size_, c->end - at));
+        if (c->own.size() < len) c->own.resize(block_size_);
+        lock.unlock();
+        const bool ok = source_->ReadAt(at, c->own.data(), len);
+        lock.lock();
+        c->own_busy = false;
+        c->own_pos = at;
+        c->own_len = ok ? len : 0;
+        c->failed = !ok;
+        if (ok) counters_->disk_bytes += len;
+        cv_.notify_all();
+        continue;
+      }
+      if (!share) {
+        if (stalled_) {
+          cv_.wait_for(lock, kLagGrace);
+        } else {
+          cv_.wait_for(lock, kIdleWake);
+        }
+        continue;
+      }
+
+      own_turn_ = true;
+      MakeRoom();
+      WakeReady();  // Readers it dropped.
+      const uint64_t next = first_ + count_;
+      Slot& slot = SlotOf(next);
+      if (slot.data.empty()) slot.data.resize(block_size_);
+      const size_t len = BlockLength(next);
+      lock.unlock();
+      const bool ok = source_->ReadAt(next * block_size_, slot.data.data(),
+                                      len);
+      lock.lock();
+      if (!ok) {
+        // Leave it to each reader's own reads to fail or not.
+        failed_ = true;
+        for (const auto& r : cursors_) {
+          if (r->attached) Detach(r.get());
+        }
+        continue;
+      }
+      counters_->disk_bytes += len;
+      // The ring may have moved to another reader meanwhile.
+      if (next != first_ + count_ || count_ >= ring_.size()) continue;
+      slot.refs = 0;
+      for (const auto& r : cursors_) {
+        if (r->attached && BlockOf(r->pos) == next) slot.refs++;
+      }
+      count_++;
+    }
+  }
+
+  const std::unique_ptr<FanoutSource> source_;
+  const uint64_t size_;
+  const int64_t mtime_ms_;
+  const size_t block_size_;
+  const uint64_t block_count_;
+  const std::shared_ptr<FanoutCounters> counters_;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::vector<Slot> ring_;
+  uint64_t first_ = 0;  // Oldest block in the ring.
+  uint64_t count_ = 0;  // Blocks ready from first_ on.
+  size_t attached_ = 0;
+  bool failed_ = false;  // A shared read failed; no one attaches again.
+  std::vector<std::unique_ptr<FanoutCursor>> cursors_;
+  size_t next_own_ = 0;
+  bool own_turn_ = false;
+  bool stalled_ = false;
+  std::chrono::steady_clock::time_point stalled_since_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+FanoutReader::FanoutReader(std::shared_ptr<FanoutStream> stream,
+                           FanoutCursor* cursor)
+    : stream_(std::move(stream)), cursor_(cursor) {}
+
+FanoutReader::~FanoutReader() { stream_->Remove(cursor_); }
+
+int64_t FanoutReader::Read(uint8_t* out, size_t cap) {
+  return stream_->Read(cursor_, out, cap);
+}
+
+void FanoutReader::Notify(std::function<void()> ready) {
+  stream_->Notify(cursor_, std::move(ready));
+}
+
+uint64_t FanoutReader::position() const { return cursor_->pos; }
+
+uint64_t FanoutReader::end() const { return cursor_->end; }
+
+FanoutCache::FanoutCache(size_t block_size, size_t blocks)
+    : block_size_(block_size > 0 ? block_size : kFanoutBlockSize),
+      blocks_(blocks > 0 ? blocks : kFanoutBlocks),
+      counters_(std::make_shared<FanoutCounters>()) {}
+
+FanoutCache::~FanoutCache() = default;
+
+std::unique_ptr<FanoutReader> FanoutCache::Open(const std::string& path,
+                                                uint64_t offset,
+                                                uint64_t end) {
+  uint64_t size;
+  int64_t mtime_ms;
+  if (!StatFile(path, &size, &mtime_ms)) return nullptr;
+  return Join(path, size, mtime_ms, [&] { return FanoutSource::Open(path); },
+              offset, end);
+}
+
+#if !defined(_WIN32)
+std::unique_ptr<FanoutReader> FanoutCache::OpenFd(const std::string& key,
+                                                  int fd, uint64_t offset,
+                                                  uint64_t end) {
+  std::unique_ptr<FanoutSource> source(new FanoutSource(fd));
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+  const int64_t mtime_ms = static_cast<int64_t>(st.st_mtime) * 1000;
+  return Join(key, static_cast<uint64_t>(st.st_size), mtime_ms,
+              [&] { return std::move(source); }, offset, end);
+}
+#endif
+
+std::unique_ptr<FanoutReader> FanoutCache::Join(
+    const std::string& key, uint64_t size, int64_t mtime_ms,
+    const std::function<std::unique_ptr<FanoutSource>()>& open,
+    uint64_t offset, uint64_t end) {
+  end = std::min(end, size);
+  offset = std::min(offset, end);
+  std::shared_ptr<FanoutStream> stream;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = streams_.find(key);
+    if (it != streams_.end()) stream = it->second.lock();
+    if (stream != nullptr && stream->Matches(size, mtime_ms)) {
+      counters_->joined++;
+    } else {
+      std::unique_ptr<FanoutSource> source = open();
+      if (source == nullptr) return nullptr;
+      for (auto i = streams_.begin(); i != streams_.end();) {
+        i = i->second.expired() ? streams_.erase(i) : std::next(i);
+      }
+      stream = std::make_shared<FanoutStream>(std::move(source), size,
+                                              mtime_ms, block_size_, blocks_,
+                                              counters_);
+      streams_[key] = stream;
+    }
+  }
+  FanoutCursor* cursor = stream->Add(offset, end);
+  return std::unique_ptr<FanoutReader>(
+      new FanoutReader(std::move(stream), cursor));
+}
+
+FanoutStats FanoutCache::stats() const {
+  FanoutStats s;
+  s.disk_bytes = counters_->disk_bytes.load();
+  s.served_bytes = counters_->served_bytes.load();
+  s.joined = counters_->joined.load();
+  return s;
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::FanoutCache* Unwrap(ZsFanoutCache* c) {
+  return reinterpret_cast<zapshare::FanoutCache*>(c);
+}
+
+const zapshare::FanoutCache* Unwrap(const ZsFanoutCache* c) {
+  return reinterpret_cast<const zapshare::FanoutCache*>(c);
+}
+
+zapshare::FanoutReader* Unwrap(ZsFanoutReader* r) {
+  return reinterpret_cast<zapshare::FanoutReader*>(r);
+}
+
+const zapshare::FanoutReader* Unwrap(const ZsFanoutReader* r) {
+  return reinterpret_cast<const zapshare::FanoutReader*>(r);
+}
+
+ZsFanoutReader* Wrap(std::unique_ptr<zapshare::FanoutReader> r) {
+  return reinterpret_cast<ZsFanoutReader*>(r.release());
+}
+
+}  // namespace
+
+ZsFanoutCache* zs_fanout_new(uint32_t block_size, uint32_t blocks) {
+  return reinterpret_cast<ZsFanoutCache*>(
+      new zapshare::FanoutCache(block_size, blocks));
+}
+
+void zs_fanout_free(ZsFanoutCache* cache) { delete Unwrap(cache); }
+
+ZsFanoutReader* zs_fanout_open(ZsFanoutCache* cache, const char* path,
+                               uint64_t offset, uint64_t end) {
+  return Wrap(Unwrap(cache)->Open(path, offset, end));
+}
+
+ZsFanoutReader* zs_fanout_open_fd(ZsFanoutCache* cache, const char* key,
+                                  int32_t fd, uint64_t offset, uint64_t end) {
+#if defined(_WIN32)
+  return nullptr;
+#else
+  return Wrap(Unwrap(cache)->OpenFd(key, fd, offset, end));
+#endif
+}
+
+void zs_fanout_reader_free(ZsFanoutReader* reader) { delete Unwrap(reader); }
+
+int64_t zs_fanout_read(ZsFanoutReader* reader, uint8_t* out, size_t cap) {
+  return Unwrap(reader)->Read(out, cap);
+}
+
+void zs_fanout_notify(ZsFanoutReader* reader, void (*ready)(int64_t),
+                      int64_t token) {
+  Unwrap(reader)->Notify([ready, token] { ready(token); });
+}
+
+uint64_t zs_fanout_remaining(const ZsFanoutReader* reader) {
+  const zapshare::FanoutReader* r = Unwrap(reader);
+  return r->end() - r->position();
+}
+
+void zs_fanout_stats(const ZsFanoutCache* cache, uint64_t* disk_bytes,
+                     uint64_t* served_bytes, uint64_t* joined) {
+  const zapshare::FanoutStats s = Unwrap(cache)->stats();
+  *disk_bytes = s.disk_bytes;
+  *served_bytes = s.served_bytes;
+  *joined = s.joined;
+}
@@ -0,0 +1,147 @@
+#ifndef ZAPSHARE_NATIVE_FANOUT_H_
+#define ZAPSHARE_NATIVE_FANOUT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "export.h"
+
+namespace zapshare {
+
+// One disk read of a file shared by every receiver downloading it at once.
+//
+// When a room full of receivers scans the same QR code, each request used
+// to open the file and read it on its own: N streams seeking over the same
+// flash, which on phones and SD cards is slower in total than one. Readers
+// opened through a FanoutCache instead share, per file, one thread reading
+// sequentially ahead into a ring of blocks. A block stays in the ring while
+// any reader still has to pass it, so it is read from disk once and copied
+// out to every connection that wants it.
+//
+// A reader whose position isn't in the ring (one that joined late, asked
+// for a range further on, or fell a whole ring behind the others) reads its
+// own blocks from disk on the same thread, and joins the shared stream as
+// soon as its position comes into the ring. The fastest reader never waits
+// for the slowest: when the ring is full and someone needs the next block,
+// readers still on the oldest one drop back to their own reads.
+//
+// Read() never blocks on the disk; it returns 0 while the block a reader
+// needs is being loaded, and Notify() says when to try again.
+
+constexpr size_t kFanoutBlockSize = 256 * 1024;
+constexpr size_t kFanoutBlocks = 32;  // 8 MiB of ring per shared file.
+
+struct FanoutStats {
+  uint64_t disk_bytes = 0;    // Read from storage, shared and catch-up.
+  uint64_t served_bytes = 0;  // Copied out to readers.
+  uint64_t joined = 0;        // Readers that found their file already open.
+};
+
+class FanoutSource;
+class FanoutStream;
+struct FanoutCursor;
+struct FanoutCounters;
+
+class FanoutReader {
+ public:
+  ~FanoutReader();
+  FanoutReader(const FanoutReader&) = delete;
+  FanoutReader& operator=(const FanoutReader&) = delete;
+
+  // Copies up to |cap| bytes from the reader's position. Returns how many,
+  // 0 at the end or while the data is still on its way, or -1 if the file
+  // couldn't be read.
+  int64_t Read(uint8_t* out, size_t cap);
+
+  // Calls |ready| once, when the next Read() won't be another 0 for data
+  // on its way: right away if that is already so, otherwise on the
+  // stream's thread, or when the reader is destroyed. It runs with the
+  // stream locked, so it must hand off rather than call into the reader.
+  // A second call before the first fires replaces it.
+  void Notify(std::function<void()> ready);
+
+  uint64_t position() const;
+  uint64_t end() const;
+
+ private:
+  friend class FanoutCache;
+  FanoutReader(std::shared_ptr<FanoutStream> stream, FanoutCursor* cursor);
+
+  std::shared_ptr<FanoutStream> stream_;
+  FanoutCursor* cursor_;
+};
+
+class FanoutCache {
+ public:
+  // |block_size| and |blocks| size each file's ring; 0 takes the defaults.
+  FanoutCache(size_t block_size, size_t blocks);
+  ~FanoutCache();
+  FanoutCache(const FanoutCache&) = delete;
+  FanoutCache& operator=(const FanoutCache&) = delete;
+
+  // A reader of bytes [offset, end) of the file at |path|, clamped to its
+  // size. Readers of the same path share a stream while the file's size
+  // and modification time stay the same. Null if it can't be opened.
+  std::unique_ptr<FanoutReader> Open(const std::string& path,
+                                     uint64_t offset, uint64_t end);
+#if !defined(_WIN32)
+  // The same for a file the caller opened, such as an Android content URI,
+  // shared under |key|. Takes ownership of |fd|.
+  std::unique_ptr<FanoutReader> OpenFd(const std::string& key, int fd,
+                                       uint64_t offset, uint64_t end);
+#endif
+
+  FanoutStats stats() const;
+
+ private:
+  std::unique_ptr<FanoutReader> Join(
+      const std::string& key, uint64_t size, int64_t mtime_ms,
+      const std::function<std::unique_ptr<FanoutSource>()>& open,
+      uint64_t offset, uint64_t end);
+
+  const size_t block_size_;
+  const size_t blocks_;
+  // Streams can outlive the cache through their readers.
+  std::shared_ptr<FanoutCounters> counters_;
+  std::mutex mu_;
+  std::unordered_map<std::string, std::weak_ptr<FanoutStream>> streams_;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsFanoutCache ZsFanoutCache;
+typedef struct ZsFanoutReader ZsFanoutReader;
+
+ZS_EXPORT ZsFanoutCache* zs_fanout_new(uint32_t block_size, uint32_t blocks);
+ZS_EXPORT void zs_fanout_free(ZsFanoutCache* cache);
+// |end| past the file's size reads to the end.
+ZS_EXPORT ZsFanoutReader* zs_fanout_open(ZsFanoutCache* cache,
+                                         const char* path, uint64_t offset,
+                                         uint64_t end);
+// Takes ownership of |fd|. Always null on Windows.
+ZS_EXPORT ZsFanoutReader* zs_fanout_open_fd(ZsFanoutCache* cache,
+                                            const char* key, int32_t fd,
+                                            uint64_t offset, uint64_t end);
+ZS_EXPORT void zs_fanout_reader_free(ZsFanoutReader* reader);
+ZS_EXPORT int64_t zs_fanout_read(ZsFanoutReader* reader, uint8_t* out,
+                                 size_t cap);
+// Calls |ready| with |token| once the next read is worth trying, as
+// FanoutReader::Notify() does.
+ZS_EXPORT void zs_fanout_notify(ZsFanoutReader* reader,
+                                void (*ready)(int64_t token), int64_t token);
+// Bytes left before the reader's end.
+ZS_EXPORT uint64_t zs_fanout_remaining(const ZsFanoutReader* reader);
+ZS_EXPORT void zs_fanout_stats(const ZsFanoutCache* cache,
+                               uint64_t* disk_bytes, uint64_t* served_bytes,
+                               uint64_t* joined);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_FANOUT_H_
@@ -0,0 +1,139 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+
+#if defined(_WIN32)
+std::wstring WidenPath(const std::string& utf8) {
+  int n = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, nullptr, 0);
+  if (n <= 0) return std::wstring();
+  std::wstring out(static_cast<size_t>(n), L'\0');
+  MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, &out[0], n);
+  out.resize(static_cast<size_t>(n - 1));
+  return out;
+}
+#endif
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path,
+                                             size_t size, bool* fresh) {
+  std::unique_ptr<MappedFile> m(new MappedFile());
+  m->size_ = size;
+#if defined(_WIN32)
+  HANDLE file = CreateFileW(
+      WidenPath(path).c_str(), GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return nullptr;
+  m->file_ = file;
+  LARGE_INTEGER current;
+  if (!GetFileSizeEx(m->file_, &current)) return nullptr;
+  *fresh = static_cast<uint64_t>(current.QuadPart) != size;
+  if (*fresh) {
+    LARGE_INTEGER target;
+    target.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFilePointerEx(m->file_, target, nullptr, FILE_BEGIN) ||
+        !SetEndOfFile(m->file_)) {
+      return nullptr;
+    }
+  }
+  m->map_ = CreateFileMappingW(m->file_, nullptr, PAGE_READWRITE, 0, 0,
+                               nullptr);
+  if (m->map_ == nullptr) return nullptr;
+  m->data_ = static_cast<uint8_t*>(
+      MapViewOfFile(m->map_, FILE_MAP_ALL_ACCESS, 0, 0, size));
+  if (m->data_ == nullptr) return nullptr;
+#else
+  m->fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (m->fd_ < 0) return nullptr;
+  struct stat st;
+  if (fstat(m->fd_, &st) != 0) return nullptr;
+  *fresh = static_cast<uint64_t>(st.st_size) != size;
+  if (*fresh && ftruncate(m->fd_, static_cast<off_t>(size)) != 0) {
+    return nullptr;
+  }
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd_, 0);
+  if (p == MAP_FAILED) return nullptr;
+  m->data_ = static_cast<uint8_t*>(p);
+#endif
+  return m;
+}
+
+MappedFile::~MappedFile() {
+#if defined(_WIN32)
+  if (data_ != nullptr) UnmapViewOfFile(data_);
+  if (map_ != nullptr) CloseHandle(map_);
+  if (file_ != nullptr) CloseHandle(file_);
+#else
+  if (data_ != nullptr) munmap(data_, size_);
+  if (fd_ >= 0) close(fd_);
+#endif
+}
+
+bool MappedFile::Sync() {
+#if defined(_WIN32)
+  return FlushViewOfFile(data_, size_) && FlushFileBuffers(file_);
+#else
+  return msync(data_, size_, MS_SYNC) == 0;
+#endif
+}
+
+bool RemoveFile(const std::string& path) {
+#if defined(_WIN32)
+  return DeleteFileW(WidenPath(path).c_str()) != 0 ||
+         GetLastError() == ERROR_FILE_NOT_FOUND;
+#else
+  return unlink(path.c_str()) == 0 || errno == ENOENT;
+#endif
+}
+
+bool StatFile(const std::string& path, uint64_t* size, int64_t* mtime_ms) {
+#if defined(_WIN32)
+  WIN32_FILE_ATTRIBUTE_DATA info;
+  if (!GetFileAttributesExW(WidenPath(path).c_str(), GetFileExInfoStandard,
+                            &info) ||
+      (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+    return false;
+  }
+  *size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) |
+          info.nFileSizeLow;
+  const uint64_t ticks =
+      (static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) |
+      info.ftLastWriteTime.dwLowDateTime;
+  // 100ns ticks since 1601 to ms since 1970.
+  *mtime_ms = static_cast<int64_t>(ticks / 10000) - 11644473600000LL;
+  return true;
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+  *size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+  const long nsec = st.st_mtimespec.tv_nsec;
+#else
+  const long nsec = st.st_mtim.tv_nsec;
+#endif
+  *mtime_ms = static_cast<int64_t>(st.st_mtime) * 1000 + nsec / 1000000;
+  return true;
+#endif
+}
+
+bool RenameFile(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+  return MoveFileExW(WidenPath(from).c_str(), WidenPath(to).c_str(),
+                     MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+}  // namespace zapshare
@@ -0,0 +1,61 @@
+#ifndef ZAPSHARE_NATIVE_MAPPED_FILE_H_
+#define ZAPSHARE_NATIVE_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace zapshare {
+
+// A read-write shared mapping of a whole file, used for the small on-disk
+// tables (resume journals, the received-content index) that are updated in
+// place and must survive the app being killed. Paths are UTF-8 everywhere.
+class MappedFile {
+ public:
+  // Maps |path| at exactly |size| bytes, creating or resizing the file as
+  // needed. |*fresh| is set when that happened, i.e. the contents can't be
+  // trusted. Returns null on I/O failure.
+  static std::unique_ptr<MappedFile> Open(const std::string& path, size_t size,
+                                          bool* fresh);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Flushes the mapped pages to storage.
+  bool Sync();
+
+ private:
+  MappedFile() = default;
+
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+#if defined(_WIN32)
+  void* file_ = nullptr;  // HANDLE
+  void* map_ = nullptr;   // HANDLE
+#else
+  int fd_ = -1;
+#endif
+};
+
+// True if |path| is gone afterwards, including when it never existed.
+bool RemoveFile(const std::string& path);
+
+// Size and modification time (ms since the epoch) of the file at |path|.
+// False if it doesn't exist or isn't a regular file.
+bool StatFile(const std::string& path, uint64_t* size, int64_t* mtime_ms);
+
+// Atomically replaces |to| with |from|.
+bool RenameFile(const std::string& from, const std::string& to);
+
+#if defined(_WIN32)
+std::wstring WidenPath(const std::string& utf8);
+#endif
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_MAPPED_FILE_H_
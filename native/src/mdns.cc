@@ -0,0 +1,302 @@
+#include "mdns.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint16_t kClassIn = 1;
+// QU in questions, cache flush in records.
+constexpr uint16_t kTopBit = 0x8000;
+constexpr uint16_t kResponseFlags = 0x8400;  // QR, AA.
+constexpr size_t kMaxName = 255;
+constexpr int kMaxPointers = 16;
+// RFC 6762 section 10: host records for 2 minutes, the rest for 75.
+constexpr uint32_t kHostTtl = 120;
+constexpr uint32_t kOtherTtl = 4500;
+constexpr uint32_t kLegacyTtl = 10;
+
+class Reader {
+ public:
+  Reader(const uint8_t* data, size_t len) : data_(data), len_(len) {}
+
+  bool ok() const { return ok_; }
+  size_t pos() const { return pos_; }
+  void Seek(size_t pos) {
+    if (pos > len_) ok_ = false;
+    pos_ = pos;
+  }
+
+  uint16_t U16() {
+    if (!Need(2)) return 0;
+    pos_ += 2;
+    return static_cast<uint16_t>(data_[pos_ - 2] << 8 | data_[pos_ - 1]);
+  }
+
+  uint32_t U32() {
+    const uint32_t high = U16();
+    return high << 16 | U16();
+  }
+
+  std::string Name() {
+    std::string name;
+    size_t p = pos_;
+    bool jumped = false;
+    int pointers = 0;
+    for (;;) {
+      if (p >= len_) return Fail();
+      const uint8_t b = data_[p];
+      if (b == 0) {
+        p++;
+        break;
+      }
+      if ((b & 0xc0) == 0xc0) {
+        if (p + 1 >= len_ || ++pointers > kMaxPointers) return Fail();
+        if (!jumped) pos_ = p + 2;
+        jumped = true;
+        p = static_cast<size_t>((b & 0x3f) << 8 | data_[p + 1]);
+        continue;
+      }
+      if ((b & 0xc0) != 0 || p + 1 + b > len_) return Fail();
+      if (!name.empty()) name += '.';
+      name.append(reinterpret_cast<const char*>(data_ + p + 1), b);
+      if (name.size() > kMaxName) return Fail();
+      p += 1 + b;
+    }
+    if (!jumped) pos_ = p;
+    return name;
+  }
+
+  std::string Bytes(size_t n) {
+    if (!Need(n)) return "";
+    pos_ += n;
+    return std::string(reinterpret_cast<const char*>(data_ + pos_ - n), n);
+  }
+
+ private:
+  bool Need(size_t n) {
+    if (pos_ + n > len_) ok_ = false;
+    return ok_;
+  }
+  std::string Fail() {
+    ok_ = false;
+    return "";
+  }
+
+  const uint8_t* data_;
+  size_t len_;
+  size_t pos_ = 0;
+  bool ok_ = true;
+};
+
+void Put16(std::vector<uint8_t>* out, uint16_t v) {
+  out->push_back(static_cast<uint8_t>(v >> 8));
+  out->push_back(static_cast<uint8_t>(v));
+}
+
+void Put32(std::vector<uint8_t>* out, uint32_t v) {
+  Put16(out, static_cast<uint16_t>(v >> 16));
+  Put16(out, static_cast<uint16_t>(v));
+}
+
+bool PutName(std::vector<uint8_t>* out, const std::string& name) {
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t dot = name.find('.', start);
+    if (dot == std::string::npos) dot = name.size();
+    const size_t n = dot - start;
+    if (n == 0 || n > 63) return false;
+    out->push_back(static_cast<uint8_t>(n));
+    out->insert(out->end(), name.begin() + start, name.begin() + dot);
+    start = dot + 1;
+  }
+  out->push_back(0);
+  return true;
+}
+
+bool PutRecord(std::vector<uint8_t>* out, const MdnsRecord& r) {
+  if (!PutName(out, r.name)) return false;
+  Put16(out, r.type);
+  Put16(out, r.unique ? kClassIn | kTopBit : kClassIn);
+  Put32(out, r.ttl);
+  const size_t length_at = out->size();
+  Put16(out, 0);
+  switch (r.type) {
+    case kMdnsA:
+      Put32(out, r.ipv4);
+      break;
+    case kMdnsPtr:
+      if (!PutName(out, r.target)) return false;
+      break;
+    case kMdnsSrv:
+      Put16(out, 0);  // Priority.
+      Put16(out, 0);  // Weight.
+      Put16(out, r.port);
+      if (!PutName(out, r.target)) return false;
+      break;
+    case kMdnsTxt:
+      // Never empty: a TXT record holds at least one string.
+      if (r.txt.empty()) out->push_back(0);
+      for (const std::string& s : r.txt) {
+        const size_t n = std::min<size_t>(s.size(), 255);
+        out->push_back(static_cast<uint8_t>(n));
+        out->insert(out->end(), s.begin(), s.begin() + n);
+      }
+      break;
+  }
+  const size_t length = out->size() - length_at - 2;
+  (*out)[length_at] = static_cast<uint8_t>(length >> 8);
+  (*out)[length_at + 1] = static_cast<uint8_t>(length);
+  return true;
+}
+
+// DNS names compare without regard to ASCII case.
+bool SameName(const std::string& a, const std::string& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (std::tolower(static_cast<unsigned char>(a[i])) !=
+        std::tolower(static_cast<unsigned char>(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ParseMdns(const uint8_t* data, size_t len, MdnsMessage* out) {
+  Reader in(data, len);
+  *out = MdnsMessage();
+  out->id = in.U16();
+  out->response = (in.U16() & kTopBit) != 0;
+  const uint16_t questions = in.U16();
+  const uint16_t answers = in.U16();
+  const uint16_t authorities = in.U16();
+  const size_t records = answers + authorities + in.U16();
+  for (uint16_t i = 0; i < questions && in.ok(); i++) {
+    MdnsQuestion q;
+    q.name = in.Name();
+    q.type = in.U16();
+    q.unicast_response = (in.U16() & kTopBit) != 0;
+    out->questions.push_back(q);
+  }
+  for (size_t i = 0; i < records && in.ok(); i++) {
+    MdnsRecord r;
+    r.name = in.Name();
+    r.type = in.U16();
+    r.unique = (in.U16() & kTopBit) != 0;
+    r.ttl = in.U32();
+    const uint16_t rdlen = in.U16();
+    const size_t end = in.pos() + rdlen;
+    if (end > len) return false;
+    switch (r.type) {
+      case kMdnsA:
+        if (rdlen != 4) return false;
+        r.ipv4 = in.U32();
+        break;
+      case kMdnsPtr:
+        r.target = in.Name();
+        break;
+      case kMdnsSrv:
+        in.U32();  // Priority, weight.
+        r.port = in.U16();
+        r.target = in.Name();
+        break;
+      case kMdnsTxt:
+        while (in.ok() && in.pos() < end) {
+          const std::string n = in.Bytes(1);
+          if (!n.empty() && n[0] != 0) {
+            r.txt.push_back(in.Bytes(static_cast<uint8_t>(n[0])));
+          }
+        }
+        break;
+      default:
+        in.Seek(end);
+        continue;
+    }
+    if (in.pos() > end) return false;
+    in.Seek(end);
+    out->records.push_back(r);
+  }
+  return in.ok();
+}
+
+std::vector<uint8_t> EncodeMdns(const MdnsMessage& message) {
+  std::vector<uint8_t> out;
+  Put16(&out, message.id);
+  Put16(&out, message.response ? kResponseFlags : 0);
+  Put16(&out, static_cast<uint16_t>(message.questions.size()));
+  Put16(&out, static_cast<uint16_t>(message.records.size()));
+  Put16(&out, 0);
+  Put16(&out, 0);
+  for (const MdnsQuestion& q : message.questions) {
+    if (!PutName(&out, q.name)) return {};
+    Put16(&out, q.type);
+    Put16(&out, q.unicast_response ? kClassIn | kTopBit : kClassIn);
+  }
+  for (const MdnsRecord& r : message.records) {
+    if (!PutRecord(&out, r)) return {};
+  }
+  return out;
+}
+
+bool AnswerMdns(const MdnsMessage& query, const MdnsService& service,
+                bool legacy_unicast, MdnsMessage* answer) {
+  if (query.response) return false;
+  const std::string instance = service.instance + "." + kMdnsServiceType;
+  bool types = false, ptr = false, srv = false, txt = false, a = false;
+  for (const MdnsQuestion& q : query.questions) {
+    auto asks = [&](uint16_t type) {
+      return q.type == type || q.type == kMdnsAny;
+    };
+    if (SameName(q.name, kMdnsServiceType) && asks(kMdnsPtr)) {
+      ptr = srv = txt = a = true;
+    } else if (SameName(q.name, kMdnsServiceEnumeration) && asks(kMdnsPtr)) {
+      types = true;
+    } else if (SameName(q.name, instance)) {
+      srv |= asks(kMdnsSrv);
+      txt |= asks(kMdnsTxt);
+      a |= asks(kMdnsSrv);
+    } else if (SameName(q.name, service.host) && asks(kMdnsA)) {
+      a = true;
+    }
+  }
+  if (!types && !ptr && !srv && !txt && !a) return false;
+
+  *answer = MdnsMessage();
+  answer->response = true;
+  if (legacy_unicast) {
+    answer->id = query.id;
+    answer->questions = query.questions;
+  }
+  auto add = [&](const std::string& name, uint16_t type, uint32_t ttl) {
+    MdnsRecord r;
+    r.name = name;
+    r.type = type;
+    r.unique = type != kMdnsPtr && !legacy_unicast;
+    r.ttl = legacy_unicast ? kLegacyTtl : ttl;
+    answer->records.push_back(r);
+    return &answer->records.back();
+  };
+  if (types) {
+    add(kMdnsServiceEnumeration, kMdnsPtr, kOtherTtl)->target =
+        kMdnsServiceType;
+  }
+  if (ptr) add(kMdnsServiceType, kMdnsPtr, kOtherTtl)->target = instance;
+  if (srv) {
+    MdnsRecord* r = add(instance, kMdnsSrv, kHostTtl);
+    r->port = service.port;
+    r->target = service.host;
+  }
+  if (txt) add(instance, kMdnsTxt, kOtherTtl)->txt = service.txt;
+  if (a) {
+    for (const uint32_t ip : service.addresses) {
+      add(service.host, kMdnsA, kHostTtl)->ipv4 = ip;
+    }
+  }
+  return true;
+}
+
+}  // namespace zapshare
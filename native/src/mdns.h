@@ -0,0 +1,80 @@
+#ifndef ZAPSHARE_NATIVE_MDNS_H_
+#define ZAPSHARE_NATIVE_MDNS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace zapshare {
+
+// DNS-SD over multicast DNS (RFC 6762, RFC 6763), as much of it as the
+// discovery engine needs to answer for _zapshare._tcp. Browsers such as
+// dns-sd, avahi-browse and Bonjour apps find us through it; ZapShare
+// itself asks with a query beacon instead (see discovery.h).
+//
+// The codec handles the questions and the A, PTR, SRV and TXT records of
+// a message, and reads compressed names. It writes names uncompressed,
+// which every resolver accepts, and skips records of any other type.
+
+constexpr uint16_t kMdnsPort = 5353;
+constexpr char kMdnsGroup[] = "224.0.0.251";
+constexpr char kMdnsServiceType[] = "_zapshare._tcp.local";
+constexpr char kMdnsServiceEnumeration[] = "_services._dns-sd._udp.local";
+
+constexpr uint16_t kMdnsA = 1;
+constexpr uint16_t kMdnsPtr = 12;
+constexpr uint16_t kMdnsTxt = 16;
+constexpr uint16_t kMdnsSrv = 33;
+constexpr uint16_t kMdnsAny = 255;
+
+struct MdnsQuestion {
+  std::string name;  // Dotted, without the trailing dot.
+  uint16_t type = 0;
+  bool unicast_response = false;  // The QU bit.
+};
+
+struct MdnsRecord {
+  std::string name;
+  uint16_t type = 0;
+  bool unique = false;  // The cache-flush bit.
+  uint32_t ttl = 0;
+  std::string target;  // PTR, SRV.
+  uint16_t port = 0;   // SRV.
+  uint32_t ipv4 = 0;   // A, host order.
+  std::vector<std::string> txt;
+};
+
+struct MdnsMessage {
+  uint16_t id = 0;
+  bool response = false;
+  std::vector<MdnsQuestion> questions;
+  // Answers and additional records alike.
+  std::vector<MdnsRecord> records;
+};
+
+bool ParseMdns(const uint8_t* data, size_t len, MdnsMessage* out);
+// Records go in the answer section. Empty if a name has a label longer
+// than 63 bytes.
+std::vector<uint8_t> EncodeMdns(const MdnsMessage& message);
+
+// One instance of _zapshare._tcp.
+struct MdnsService {
+  std::string instance;  // A single label, such as "Pixel 8 (3fa2)".
+  std::string host;      // Such as "zapshare-3fa2c0ffee.local".
+  uint16_t port = 0;
+  std::vector<std::string> txt;  // "key=value".
+  std::vector<uint32_t> addresses;  // IPv4, host order.
+};
+
+// Fills |answer| with what |query| asks of |service|: the PTR for a
+// browse, with the SRV, TXT and A records it leads to, and any of those
+// asked for by name. False if it asks for nothing of ours. A
+// |legacy_unicast| query (RFC 6762 section 6.7) gets its id and
+// questions back, short TTLs and no cache-flush bits.
+bool AnswerMdns(const MdnsMessage& query, const MdnsService& service,
+                bool legacy_unicast, MdnsMessage* answer);
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_MDNS_H_
@@ -0,0 +1,499 @@
+#include "mirror_receiver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <utility>
+
+#if defined(ZS_HAVE_JPEG)
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr std::chrono::seconds kIdleWake(1);
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+#if defined(ZS_HAVE_JPEG)
+
+// The smallest M/8 at which a |width| x |height| frame still covers what
+// it's shown at inside |target_width| x |target_height|, letterboxed.
+int ScaleEighths(int width, int height, int target_width,
+                 int target_height) {
+  if (target_width <= 0 || target_height <= 0 || width <= 0 ||
+      height <= 0) {
+    return 8;
+  }
+  const int by_width = (8 * target_width + width - 1) / width;
+  const int by_height = (8 * target_height + height - 1) / height;
+  int eighths = std::clamp(std::min(by_width, by_height), 1, 8);
+#if !defined(JCS_EXTENSIONS)
+  // Plain libjpeg only scales by 1/8, 1/4 and 1/2.
+  while ((eighths & (eighths - 1)) != 0) eighths++;
+#endif
+  return eighths;
+}
+
+struct ErrorManager {
+  jpeg_error_mgr base;
+  jmp_buf jump;
+};
+
+void OnError(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+// Corrupt-data warnings would otherwise go to stderr once per frame.
+void OnMessage(j_common_ptr, int) {}
+
+#endif  // defined(ZS_HAVE_JPEG)
+
+}  // namespace
+
+#if defined(ZS_HAVE_JPEG)
+
+// One decompressor for the life of the receiver: libjpeg keeps its tables
+// and work buffers between frames instead of setting them up for each.
+struct MirrorReceiver::Decoder {
+  jpeg_decompress_struct cinfo;
+  ErrorManager error;
+  std::vector<JSAMPROW> rows;
+#if !defined(JCS_EXTENSIONS)
+  std::vector<uint8_t> rgb;
+#endif
+
+  Decoder() {
+    cinfo.err = jpeg_std_error(&error.base);
+    error.base.error_exit = OnError;
+    error.base.emit_message = OnMessage;
+    jpeg_create_decompress(&cinfo);
+  }
+
+  ~Decoder() { jpeg_destroy_decompress(&cinfo); }
+
+  // Nothing in here may own memory: a corrupt frame longjmps out of any
+  // libjpeg call.
+  bool Decode(const uint8_t* jpeg, size_t size, int target_width,
+              int target_height, MirrorPicture* out) {
+    if (setjmp(error.jump) != 0) {
+      jpeg_abort_decompress(&cinfo);
+      return false;
+    }
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(jpeg),
+                 static_cast<unsigned long>(size));
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+      jpeg_abort_decompress(&cinfo);
+      return false;
+    }
+    cinfo.scale_num = ScaleEighths(cinfo.image_width, cinfo.image_height,
+                                   target_width, target_height);
+    cinfo.scale_denom = 8;
+    cinfo.dct_method = JDCT_IFAST;
+#if defined(JCS_EXTENSIONS)
+    cinfo.out_color_space = JCS_EXT_RGBA;
+#else
+    cinfo.out_color_space = JCS_RGB;
+#endif
+    jpeg_start_decompress(&cinfo);
+    const int width = cinfo.output_width;
+    const int height = cinfo.output_height;
+    const size_t stride = static_cast<size_t>(width) * 4;
+    out->pixels.resize(stride * height);
+    out->width = width;
+    out->height = height;
+#if defined(JCS_EXTENSIONS)
+    rows.resize(height);
+    for (int y = 0; y < height; y++) rows[y] = &out->pixels[stride * y];
+    while (cinfo.output_scanline < cinfo.output_height) {
+      jpeg_read_scanlines(&cinfo, rows.data() + cinfo.output_scanline,
+                          cinfo.output_height - cinfo.output_scanline);
+    }
+#else
+    rgb.resize(static_cast<size_t>(width) * 3);
+    JSAMPROW row = rgb.data();
+    while (cinfo.output_scanline < cinfo.output_height) {
+      uint8_t* dst = &out->pixels[stride * cinfo.output_scanline];
+      jpeg_read_scanlines(&cinfo, &row, 1);
+      for (int x = 0; x < width; x++) {
+        dst[x * 4] = rgb[x * 3];
+        dst[x * 4 + 1] = rgb[x * 3 + 1];
+        dst[x * 4 + 2] = rgb[x * 3 + 2];
+        dst[x * 4 + 3] = 0xFF;
+      }
+    }
+#endif
+    jpeg_finish_decompress(&cinfo);
+    return true;
+  }
+};
+
+bool MirrorReceiver::Available() { return true; }
+
+#else
+
+struct MirrorReceiver::Decoder {
+  bool Decode(const uint8_t*, size_t, int, int, MirrorPicture*) {
+    return false;
+  }
+};
+
+bool MirrorReceiver::Available() { return false; }
+
+#endif  // defined(ZS_HAVE_JPEG)
+
+MirrorReceiver::MirrorReceiver(const std::string& boundary)
+    : demuxer_(boundary),
+      decoder_(new Decoder),
+      thread_(&MirrorReceiver::Run, this) {}
+
+MirrorReceiver::~MirrorReceiver() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void MirrorReceiver::Feed(const uint8_t* data, size_t len) {
+  if (stream_ == Stream::kUnknown) {
+    sniffed_.insert(sniffed_.end(), data, data + len);
+    if (sniffed_.size() < kTileStreamMagicSize) return;
+    stream_ = LooksLikeTileStream(sniffed_.data(), sniffed_.size())
+                  ? Stream::kTiles
+                  : Stream::kMjpeg;
+    std::vector<uint8_t> head;
+    head.swap(sniffed_);
+    Feed(head.data(), head.size());
+    return;
+  }
+  if (stream_ == Stream::kTiles) {
+    FeedTiles(data, len);
+    return;
+  }
+  demuxer_.Feed(data, len);
+  MjpegFrame frame;
+  MjpegFrame last;
+  uint64_t skipped = 0;
+  while (demuxer_.Next(&frame)) {
+    if (last.data != nullptr) skipped++;
+    last = frame;
+  }
+  if (skipped > 0) {
+    // Already behind the stream: never worth copying, let alone decoding.
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.received += skipped;
+    stats_.dropped += skipped;
+  }
+  if (last.data != nullptr) Submit(last.data, last.size);
+}
+
+void MirrorReceiver::Submit(const uint8_t* jpeg, size_t size) {
+  spare_.assign(jpeg, jpeg + size);
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.received++;
+    if (has_pending_) {
+      stats_.dropped++;
+    } else {
+      has_pending_ = true;
+      stats_.queue_depth++;
+      stats_.max_queue_depth =
+          std::max(stats_.max_queue_depth, stats_.queue_depth);
+    }
+    tiles_ = false;
+    // The replaced frame's buffer is the next one filled.
+    pending_.swap(spare_);
+  }
+  cv_.notify_one();
+}
+
+void MirrorReceiver::FeedTiles(const uint8_t* data, size_t len) {
+  tile_reader_.Feed(data, len);
+  TileFrame frame;
+  while (tile_reader_.Next(&frame)) {
+    const bool reset = frame.base == 0;
+    if (reset) {
+      synced_ = true;
+    } else if (!synced_ || frame.base != last_sequence_) {
+      // Its tiles go on a screen this receiver doesn't have.
+      synced_ = false;
+      std::lock_guard<std::mutex> lock(mu_);
+      stats_.received++;
+      stats_.failed++;
+      continue;
+    }
+    last_sequence_ = frame.sequence;
+    std::vector<PendingTile> tiles(frame.tiles.size());
+    for (size_t i = 0; i < tiles.size(); i++) {
+      const TileRecord& record = frame.tiles[i];
+      tiles[i].column = record.column;
+      tiles[i].row = record.row;
+      tiles[i].tile.encoding = record.encoding;
+      tiles[i].tile.payload.assign(record.data, record.data + record.size);
+    }
+    QueueTiles(frame, reset, std::move(tiles));
+  }
+}
+
+void MirrorReceiver::QueueTiles(const TileFrame& frame, bool reset,
+                                std::vector<PendingTile> tiles) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.received++;
+    if (!tables_queued_) {
+      pending_tables_ = tile_reader_.tables();
+      tables_queued_ = true;
+    }
+    // A frame still waiting isn't lost: its tiles are drawn with these,
+    // but it's never shown as itself.
+    if (has_pending_) {
+      stats_.dropped++;
+    } else {
+      has_pending_ = true;
+      stats_.queue_depth++;
+      stats_.max_queue_depth =
+          std::max(stats_.max_queue_depth, stats_.queue_depth);
+    }
+    tiles_ = true;
+    if (reset) {
+      pending_tiles_.clear();
+      pending_reset_ = true;
+    }
+    pending_width_ = frame.width;
+    pending_height_ = frame.height;
+    if (pending_tiles_.empty()) {
+      pending_tiles_.swap(tiles);
+    } else {
+      std::move(tiles.begin(), tiles.end(),
+                std::back_inserter(pending_tiles_));
+    }
+  }
+  cv_.notify_one();
+}
+
+bool MirrorReceiver::DrawTiles(std::vector<PendingTile>* tiles, bool reset,
+                               int width, int height, int target_width,
+                               int target_height, MirrorPicture* out) {
+  for (size_t i = 0; i < tiles->size(); i++) {
+    PendingTile& pending = (*tiles)[i];
+    canvas_.Put(width, height, reset && i == 0, pending.column, pending.row,
+                std::move(pending.tile));
+  }
+  tiles->clear();
+  const size_t failed = canvas_.Draw(target_width, target_height);
+  const std::vector<uint8_t>& pixels = canvas_.pixels();
+  out->pixels.assign(pixels.begin(), pixels.end());
+  out->width = canvas_.width();
+  out->height = canvas_.height();
+  return failed == 0;
+}
+
+void MirrorReceiver::SetTargetSize(int width, int height) {
+  std::lock_guard<std::mutex> lock(mu_);
+  target_width_ = std::max(width, 0);
+  target_height_ = std::max(height, 0);
+}
+
+void MirrorReceiver::SetFrameCallback(FrameCallback callback,
+                                      void* user_data) {
+  std::lock_guard<std::mutex> lock(callback_mu_);
+  callback_ = callback;
+  user_data_ = user_data;
+}
+
+const MirrorPicture* MirrorReceiver::AcquireFrame() {
+  std::lock_guard<std::mutex> lock(picture_mu_);
+  if (fresh_) {
+    std::swap(reading_, ready_);
+    fresh_ = false;
+    std::lock_guard<std::mutex> stats_lock(mu_);
+    stats_.presented++;
+  }
+  return has_frame_ ? &pictures_[reading_] : nullptr;
+}
+
+MirrorStats MirrorReceiver::stats() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return stats_;
+}
+
+void MirrorReceiver::Run() {
+  std::vector<uint8_t> jpeg;
+  std::vector<uint8_t> tables;
+  std::vector<PendingTile> tiles;
+  for (;;) {
+    int target_width;
+    int target_height;
+    bool tile_frame;
+    bool reset = false;
+    int width = 0;
+    int height = 0;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      while (!stop_ && !has_pending_) cv_.wait_for(lock, kIdleWake);
+      if (stop_) return;
+      tile_frame = tiles_;
+      if (tile_frame) {
+        tables.swap(pending_tables_);
+        tiles.swap(pending_tiles_);
+        reset = pending_reset_;
+        pending_reset_ = false;
+        width = pending_width_;
+        height = pending_height_;
+      } else {
+        jpeg.swap(pending_);
+      }
+      has_pending_ = false;
+      target_width = target_width_;
+      target_height = target_height_;
+    }
+    if (!tables.empty()) {
+      canvas_.SetTables(tables);
+      tables.clear();
+    }
+    MirrorPicture* picture = &pictures_[writing_];
+    const uint64_t start = NowNs();
+    const bool ok =
+        tile_frame
+            ? DrawTiles(&tiles, reset, width, height, target_width,
+                        target_height, picture)
+            : decoder_->Decode(jpeg.data(), jpeg.size(), target_width,
+                               target_height, picture);
+    // A tile that failed leaves the rest of the screen worth showing.
+    const bool shown = ok || (tile_frame && picture->width > 0);
+    const uint64_t took = NowNs() - start;
+    bool replaced = false;
+    if (shown) {
+      std::lock_guard<std::mutex> lock(picture_mu_);
+      replaced = fresh_;
+      std::swap(writing_, ready_);
+      fresh_ = true;
+      has_frame_ = true;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stats_.queue_depth--;
+      (ok ? stats_.decoded : stats_.failed)++;
+      if (replaced) stats_.unshown++;
+      stats_.decode_ns += took;
+      stats_.last_decode_ns = took;
+      stats_.max_decode_ns = std::max(stats_.max_decode_ns, took);
+      if (shown) {
+        stats_.width = picture->width;
+        stats_.height = picture->height;
+      }
+    }
+    if (shown) {
+      // Under the lock, so the callback's owner can free what |user_data_|
+      // points at as soon as SetFrameCallback() has returned.
+      std::lock_guard<std::mutex> lock(callback_mu_);
+      if (callback_ != nullptr) callback_(user_data_);
+    }
+  }
+}
+
+}  // namespace zapshare
+
+namespace {
+
+// The C handle counts references: the app and the runner's texture each
+// hold one, and whichever lets go last frees the receiver.
+struct Handle {
+  explicit Handle(const std::string& boundary) : receiver(boundary) {}
+
+  zapshare::MirrorReceiver receiver;
+  std::atomic<int> refs{1};
+};
+
+Handle* Unwrap(ZsMirrorReceiver* receiver) {
+  return reinterpret_cast<Handle*>(receiver);
+}
+
+const Handle* Unwrap(const ZsMirrorReceiver* receiver) {
+  return reinterpret_cast<const Handle*>(receiver);
+}
+
+}  // namespace
+
+int32_t zs_mirror_receiver_available(void) {
+  return zapshare::MirrorReceiver::Available() ? 1 : 0;
+}
+
+ZsMirrorReceiver* zs_mirror_receiver_new(const char* boundary) {
+  if (!zapshare::MirrorReceiver::Available()) return nullptr;
+  return reinterpret_cast<ZsMirrorReceiver*>(
+      new Handle(boundary != nullptr ? boundary : ""));
+}
+
+void zs_mirror_receiver_retain(ZsMirrorReceiver* receiver) {
+  Unwrap(receiver)->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void zs_mirror_receiver_free(ZsMirrorReceiver* receiver) {
+  if (receiver == nullptr) return;
+  Handle* handle = Unwrap(receiver);
+  if (handle->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete handle;
+  }
+}
+
+void zs_mirror_receiver_feed(ZsMirrorReceiver* receiver, const uint8_t* data,
+                             size_t len) {
+  Unwrap(receiver)->receiver.Feed(data, len);
+}
+
+void zs_mirror_receiver_submit(ZsMirrorReceiver* receiver,
+                               const uint8_t* jpeg, size_t size) {
+  Unwrap(receiver)->receiver.Submit(jpeg, size);
+}
+
+void zs_mirror_receiver_set_target_size(ZsMirrorReceiver* receiver,
+                                        int32_t width, int32_t height) {
+  Unwrap(receiver)->receiver.SetTargetSize(width, height);
+}
+
+void zs_mirror_receiver_set_frame_callback(ZsMirrorReceiver* receiver,
+                                           ZsMirrorFrameCallback callback,
+                                           void* user_data) {
+  Unwrap(receiver)->receiver.SetFrameCallback(callback, user_data);
+}
+
+const uint8_t* zs_mirror_receiver_acquire(ZsMirrorReceiver* receiver,
+                                          int32_t* width, int32_t* height) {
+  const zapshare::MirrorPicture* picture =
+      Unwrap(receiver)->receiver.AcquireFrame();
+  if (picture == nullptr) return nullptr;
+  *width = picture->width;
+  *height = picture->height;
+  return picture->pixels.data();
+}
+
+void zs_mirror_receiver_stats(const ZsMirrorReceiver* receiver,
+                              uint64_t out[13]) {
+  const zapshare::MirrorStats s = Unwrap(receiver)->receiver.stats();
+  out[0] = s.received;
+  out[1] = s.decoded;
+  out[2] = s.dropped;
+  out[3] = s.failed;
+  out[4] = s.unshown;
+  out[5] = s.presented;
+  out[6] = s.decode_ns;
+  out[7] = s.last_decode_ns;
+  out[8] = s.max_decode_ns;
+  out[9] = s.queue_depth;
+  out[10] = s.max_queue_depth;
+  out[11] = s.width;
+  out[12] = s.height;
+}
@@ -0,0 +1,208 @@
+#ifndef ZAPSHARE_NATIVE_MIRROR_RECEIVER_H_
+#define ZAPSHARE_NATIVE_MIRROR_RECEIVER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "export.h"
+#include "mjpeg_demuxer.h"
+#include "tile_stream.h"
+
+namespace zapshare {
+
+// Decodes a screen mirror stream off the UI thread, for a Flutter texture.
+//
+// The viewer used to hand every frame it kept to Image.memory: each one was
+// copied, decoded at full size on the engine's image pipeline and rebuilt
+// the widget tree, and the frame rate cap only applied after the copy. A
+// MirrorReceiver takes the stream's chunks as they arrive, cuts them with a
+// MjpegDemuxer, and keeps one frame waiting for its decoder thread: a frame
+// that arrives while another is waiting replaces it, so a frame that would
+// be late is dropped before anything is spent decoding it, and the queue is
+// never deeper than the frame waiting plus the one being decoded.
+//
+// Decoding uses libjpeg's scaled IDCT: the output is the smallest multiple
+// of 1/8 of the frame that still covers the size it's shown at, so a phone
+// screen shown in a window is decoded at a fraction of the work. Pixels are
+// RGBA, in three buffers: the decoder writes one, the newest finished frame
+// waits in another, and AcquireFrame() hands the texture the third. Neither
+// side ever waits for the other's copy.
+//
+// A tile stream (see tile_stream.h) is told from MJPEG by its first bytes.
+// Its frames are checked against the sequence they build on and merged
+// while they wait, newest tile winning, so a late frame still costs only
+// the tiles that changed; the decoder thread draws them onto a TileCanvas
+// and publishes a copy of the whole picture. A frame built on one this
+// receiver never had (it lost sync) is dropped, as is every frame after
+// it until the next keyframe.
+//
+// Built without libjpeg, Available() is false and the viewer keeps showing
+// frames through Image.memory.
+
+struct MirrorStats {
+  uint64_t received = 0;   // Frames cut from the stream or submitted.
+  uint64_t decoded = 0;
+  uint64_t dropped = 0;    // Replaced by a newer frame before decoding.
+  uint64_t failed = 0;     // Not a JPEG libjpeg could decode, a tile frame
+                           // with tiles that failed, or one out of sync.
+  uint64_t unshown = 0;    // Decoded, but replaced before AcquireFrame().
+  uint64_t presented = 0;  // Handed to the texture.
+  uint64_t decode_ns = 0;  // Spent decoding, over decoded + failed.
+  uint64_t last_decode_ns = 0;
+  uint64_t max_decode_ns = 0;
+  uint64_t queue_depth = 0;  // Frames waiting or being decoded now.
+  uint64_t max_queue_depth = 0;
+  uint64_t width = 0;  // Of the newest decoded frame, after scaling.
+  uint64_t height = 0;
+};
+
+struct MirrorPicture {
+  std::vector<uint8_t> pixels;  // RGBA, rows of width * 4 bytes.
+  int width = 0;
+  int height = 0;
+};
+
+class MirrorReceiver {
+ public:
+  // Called on the decoder thread each time a frame is ready; not called
+  // again once SetFrameCallback() has replaced it.
+  using FrameCallback = void (*)(void* user_data);
+
+  // Whether frames can be decoded at all in this build.
+  static bool Available();
+
+  // |boundary| is the stream's multipart boundary; see MjpegDemuxer.
+  explicit MirrorReceiver(const std::string& boundary = "");
+  ~MirrorReceiver();
+
+  MirrorReceiver(const MirrorReceiver&) = delete;
+  MirrorReceiver& operator=(const MirrorReceiver&) = delete;
+
+  // Appends a chunk of the stream, MJPEG or tiles. Of the frames it
+  // completes, only the last is queued. Call from one thread.
+  void Feed(const uint8_t* data, size_t len);
+  // Queues one whole JPEG, replacing any frame still waiting. Call from
+  // the thread that calls Feed().
+  void Submit(const uint8_t* jpeg, size_t size);
+
+  // The size, in pixels, the frame is shown at; frames are scaled down
+  // towards it. 0 decodes them at full size.
+  void SetTargetSize(int width, int height);
+  void SetFrameCallback(FrameCallback callback, void* user_data);
+
+  // The newest decoded frame, or null before the first. It stays valid and
+  // unchanged until the next call. Call from one thread.
+  const MirrorPicture* AcquireFrame();
+
+  MirrorStats stats() const;
+
+ private:
+  struct Decoder;
+
+  enum class Stream { kUnknown, kMjpeg, kTiles };
+
+  struct PendingTile {
+    int column = 0;
+    int row = 0;
+    TileCanvas::Tile tile;
+  };
+
+  void FeedTiles(const uint8_t* data, size_t len);
+  // Queues |tiles| on top of whatever tile frame is still waiting.
+  void QueueTiles(const TileFrame& frame, bool reset,
+                  std::vector<PendingTile> tiles);
+  // Draws the waiting tiles; false if any failed.
+  bool DrawTiles(std::vector<PendingTile>* tiles, bool reset, int width,
+                 int height, int target_width, int target_height,
+                 MirrorPicture* out);
+  void Run();
+
+  // Only Feed() touches these.
+  Stream stream_ = Stream::kUnknown;
+  std::vector<uint8_t> sniffed_;  // The first bytes, until they tell.
+  TileStreamReader tile_reader_;
+  bool tables_queued_ = false;
+  bool synced_ = false;  // A keyframe arrived and nothing since was lost.
+  uint32_t last_sequence_ = 0;
+
+  MjpegDemuxer demuxer_;
+  std::vector<uint8_t> spare_;  // Filled by Submit() outside the lock.
+  std::unique_ptr<Decoder> decoder_;
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::vector<uint8_t> pending_;
+  bool has_pending_ = false;
+  bool tiles_ = false;  // |pending_tiles_| is what waits, not |pending_|.
+  std::vector<uint8_t> pending_tables_;
+  std::vector<PendingTile> pending_tiles_;
+  bool pending_reset_ = false;
+  int pending_width_ = 0;
+  int pending_height_ = 0;
+  bool stop_ = false;
+  int target_width_ = 0;
+  int target_height_ = 0;
+  MirrorStats stats_;
+
+  TileCanvas canvas_;  // The decoder thread's alone.
+
+  // The decoder writes |pictures_[writing_]| alone; the newest finished
+  // frame is |ready_|, and AcquireFrame() owns |reading_|.
+  MirrorPicture pictures_[3];
+  std::mutex picture_mu_;
+  int writing_ = 0;
+  int ready_ = 1;
+  int reading_ = 2;
+  bool fresh_ = false;  // |ready_| holds a frame not yet acquired.
+  bool has_frame_ = false;
+
+  std::mutex callback_mu_;
+  FrameCallback callback_ = nullptr;
+  void* user_data_ = nullptr;
+
+  std::thread thread_;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsMirrorReceiver ZsMirrorReceiver;
+typedef void (*ZsMirrorFrameCallback)(void* user_data);
+
+// 1 when frames can be decoded in this build, 0 otherwise.
+ZS_EXPORT int32_t zs_mirror_receiver_available(void);
+// |boundary| may be null. Null when zs_mirror_receiver_available() is 0.
+// The receiver starts with one reference.
+ZS_EXPORT ZsMirrorReceiver* zs_mirror_receiver_new(const char* boundary);
+// The runner takes a reference for its texture, so the app can let go of
+// the receiver while the engine may still be copying a frame out of it.
+ZS_EXPORT void zs_mirror_receiver_retain(ZsMirrorReceiver* receiver);
+// Drops a reference; the last one stops the decoder and frees it.
+ZS_EXPORT void zs_mirror_receiver_free(ZsMirrorReceiver* receiver);
+ZS_EXPORT void zs_mirror_receiver_feed(ZsMirrorReceiver* receiver,
+                                      const uint8_t* data, size_t len);
+ZS_EXPORT void zs_mirror_receiver_submit(ZsMirrorReceiver* receiver,
+                                        const uint8_t* jpeg, size_t size);
+ZS_EXPORT void zs_mirror_receiver_set_target_size(ZsMirrorReceiver* receiver,
+                                                 int32_t width,
+                                                 int32_t height);
+ZS_EXPORT void zs_mirror_receiver_set_frame_callback(
+    ZsMirrorReceiver* receiver, ZsMirrorFrameCallback callback,
+    void* user_data);
+// The newest frame's RGBA pixels, valid until the next call, or null.
+ZS_EXPORT const uint8_t* zs_mirror_receiver_acquire(
+    ZsMirrorReceiver* receiver, int32_t* width, int32_t* height);
+// Fills |out| with the MirrorStats fields in declaration order.
+ZS_EXPORT void zs_mirror_receiver_stats(const ZsMirrorReceiver* receiver,
+                                       uint64_t out[13]);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_MIRROR_RECEIVER_H_
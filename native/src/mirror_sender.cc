@@ -0,0 +1,544 @@
+#include "mirror_sender.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace zapshare {
+
+#if defined(_WIN32)
+
+bool ScreenMirrorSender::Available() { return false; }
+
+std::unique_ptr<ScreenMirrorSender> ScreenMirrorSender::Start(
+    const ScreenMirrorConfig&) {
+  return nullptr;
+}
+
+std::unique_ptr<ScreenMirrorSender> ScreenMirrorSender::Start(
+    std::unique_ptr<ScreenSource>, const ScreenMirrorConfig&) {
+  return nullptr;
+}
+
+ScreenMirrorSender::~ScreenMirrorSender() = default;
+
+ScreenMirrorStats ScreenMirrorSender::stats() const {
+  return ScreenMirrorStats();
+}
+
+#else
+
+namespace {
+
+constexpr std::chrono::seconds kIdleWake(1);
+// The viewer reconnects after eight seconds without a frame.
+constexpr std::chrono::seconds kResendInterval(2);
+constexpr std::chrono::seconds kKeyframeInterval(kTileKeyframeIntervalSec);
+constexpr int kAcceptPollMs = 250;
+constexpr int kSocketTimeoutSec = 5;
+constexpr size_t kMaxRequest = 8 * 1024;
+
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+#if defined(SOCK_CLOEXEC)
+constexpr int kSocketFlags = SOCK_CLOEXEC;
+#else
+constexpr int kSocketFlags = 0;
+#endif
+
+constexpr char kMjpegContentType[] =
+    "multipart/x-mixed-replace; boundary=frame";
+constexpr char kNotFound[] =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Sends every byte of |iov|, which it consumes.
+bool SendAll(int fd, iovec* iov, int count) {
+  while (count > 0) {
+    msghdr message = {};
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    const ssize_t n = sendmsg(fd, &message, kSendFlags);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    size_t left = static_cast<size_t>(n);
+    while (count > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+  return true;
+}
+
+bool SendAll(int fd, const char* data, size_t len) {
+  iovec iov = {const_cast<char*>(data), len};
+  return SendAll(fd, &iov, 1);
+}
+
+std::string StreamHeader(const char* content_type) {
+  return std::string("HTTP/1.1 200 OK\r\nContent-Type: ") + content_type +
+         "\r\n"
+         "Access-Control-Allow-Origin: *\r\n"
+         "Cache-Control: no-store, no-cache\r\n"
+         "Pragma: no-cache\r\n"
+         "Connection: keep-alive\r\n\r\n";
+}
+
+std::string Lowered(std::string text) {
+  for (char& c : text) {
+    if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+  }
+  return text;
+}
+
+// Whether the request |head| has a kTileStreamRequestHeader that lists
+// kTileStreamVersion.
+bool WantsTiles(const std::string& head) {
+  const std::string lower = Lowered(head);
+  const std::string name =
+      Lowered(std::string("\r\n") + kTileStreamRequestHeader + ":");
+  const size_t at = lower.find(name);
+  if (at == std::string::npos) return false;
+  const size_t begin = at + name.size();
+  std::string value = lower.substr(begin, lower.find("\r\n", begin) - begin);
+  value.erase(std::remove(value.begin(), value.end(), ' '), value.end());
+  return ("," + value + ",").find(std::string(",") + kTileStreamVersion +
+                                  ",") != std::string::npos;
+}
+
+// The path of the request on |fd|, or empty if it isn't a GET. |tiles|
+// is set if it asks for a tile stream.
+std::string ReadRequestPath(int fd, bool* tiles) {
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    if (request.size() >= kMaxRequest) return "";
+    const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return "";
+    request.append(buffer, n);
+  }
+  if (request.compare(0, 4, "GET ") != 0) return "";
+  *tiles = WantsTiles(request.substr(0, request.find("\r\n\r\n") + 2));
+  const size_t end = request.find(' ', 4);
+  if (end == std::string::npos) return "";
+  std::string path = request.substr(4, end - 4);
+  const size_t query = path.find('?');
+  if (query != std::string::npos) path.resize(query);
+  return path;
+}
+
+}  // namespace
+
+bool ScreenMirrorSender::Available() {
+  return ScreenSource::Available() && MjpegEncoder::Available();
+}
+
+std::unique_ptr<ScreenMirrorSender> ScreenMirrorSender::Start(
+    const ScreenMirrorConfig& config) {
+  if (!Available()) return nullptr;
+  std::unique_ptr<ScreenSource> source =
+      ScreenSource::OpenDisplay(config.display);
+  if (source == nullptr) return nullptr;
+  return Start(std::move(source), config);
+}
+
+std::unique_ptr<ScreenMirrorSender> ScreenMirrorSender::Start(
+    std::unique_ptr<ScreenSource> source, const ScreenMirrorConfig& config) {
+  if (source == nullptr || !MjpegEncoder::Available()) return nullptr;
+  const int fd = socket(AF_INET, SOCK_STREAM | kSocketFlags, 0);
+  if (fd < 0) return nullptr;
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(config.port);
+  socklen_t length = sizeof(address);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(fd, 8) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  std::unique_ptr<ScreenMirrorSender> sender(
+      new ScreenMirrorSender(std::move(source), config));
+  sender->listen_fd_ = fd;
+  sender->port_ = ntohs(address.sin_port);
+  sender->capture_thread_ = std::thread(&ScreenMirrorSender::Capture,
+                                        sender.get());
+  sender->accept_thread_ = std::thread(&ScreenMirrorSender::Accept,
+                                       sender.get());
+  return sender;
+}
+
+ScreenMirrorSender::ScreenMirrorSender(std::unique_ptr<ScreenSource> source,
+                                       const ScreenMirrorConfig& config)
+    : source_(std::move(source)),
+      encoder_(config.quality, config.threads),
+      tile_encoder_(config.quality),
+      fps_(std::clamp(config.fps, 1, 120)) {}
+
+ScreenMirrorSender::~ScreenMirrorSender() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  frame_cv_.notify_all();
+  capture_cv_.notify_all();
+  if (accept_thread_.joinable()) accept_thread_.join();
+  {
+    // A viewer blocked in send() only notices the stop this way.
+    std::lock_guard<std::mutex> lock(clients_mu_);
+    for (Client& client : clients_) shutdown(client.fd, SHUT_RDWR);
+  }
+  for (Client& client : clients_) {
+    client.thread.join();
+    close(client.fd);
+  }
+  if (capture_thread_.joinable()) capture_thread_.join();
+  if (listen_fd_ >= 0) close(listen_fd_);
+}
+
+ScreenMirrorStats ScreenMirrorSender::stats() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return stats_;
+}
+
+void ScreenMirrorSender::Capture() {
+  using Clock = std::chrono::steady_clock;
+  const auto interval = std::chrono::nanoseconds(1000000000 / fps_);
+  Clock::time_point next = Clock::now();
+  Clock::time_point published;
+  std::vector<uint8_t> jpeg;
+  bool mjpeg_live = false;
+  bool tiles_live = false;
+  while (true) {
+    bool mjpeg;
+    bool tiles;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      // Nothing is captured while nobody watches.
+      while (!stop_ && stats_.clients == 0) {
+        capture_cv_.wait_for(lock, kIdleWake);
+        next = Clock::now();
+      }
+      while (!stop_ && Clock::now() < next) {
+        capture_cv_.wait_for(lock, next - Clock::now());
+      }
+      if (stop_) return;
+      tiles = tile_clients_ > 0;
+      mjpeg = stats_.clients > tile_clients_;
+      // Not kept up to date without viewers, so not to be sent to one.
+      if (!mjpeg) frame_.reset();
+      if (!tiles) tiles_.reset();
+    }
+    // An encoder that sat idle missed the diffs since: start it over.
+    if ((mjpeg && !mjpeg_live) || (tiles && !tiles_live)) {
+      differ_.Invalidate();
+    }
+    mjpeg_live = mjpeg;
+    tiles_live = tiles;
+    // A grab that overruns its slot delays the next one instead of
+    // queueing a burst behind it.
+    next = std::max(next + interval, Clock::now());
+
+    const uint64_t start = NowNs();
+    ScreenFrame frame;
+    const bool grabbed = source_->Grab(&frame);
+    const size_t dirty = grabbed ? differ_.Diff(frame) : 0;
+    const uint64_t captured = NowNs();
+
+    bool encoded = false;
+    bool failed = !grabbed;
+    std::shared_ptr<const TileSnapshot> snapshot;
+    if (dirty > 0) {
+      encoded = !mjpeg || encoder_.Encode(frame, differ_, &jpeg);
+      if (encoded && tiles) {
+        snapshot = tile_encoder_.Update(frame, differ_);
+        encoded = snapshot != nullptr;
+      }
+      failed = !encoded;
+      // Whatever didn't make it out must be sent with the next frame.
+      if (failed) differ_.Invalidate();
+    }
+    const uint64_t finished = NowNs();
+    const bool resend = !encoded && !failed &&
+                        (frame_ != nullptr || tiles_ != nullptr) &&
+                        Clock::now() - published >= kResendInterval;
+
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.captured += grabbed;
+    stats_.capture_ns += captured - start;
+    if (failed) stats_.failed++;
+    if (grabbed && dirty == 0) stats_.unchanged++;
+    if (encoded) {
+      stats_.encoded++;
+      stats_.encode_ns += finished - captured;
+      if (mjpeg) {
+        const MjpegEncoderStats encoder = encoder_.stats();
+        stats_.bands_encoded = encoder.bands_encoded;
+        stats_.bands_reused = encoder.bands_reused;
+        stats_.last_frame_bytes = encoder.last_bytes;
+        frame_ = std::make_shared<const std::vector<uint8_t>>(jpeg);
+        sequence_++;
+      }
+      if (tiles) {
+        tiles_ = std::move(snapshot);
+        tiles_published_++;
+      }
+    } else if (resend) {
+      stats_.resent++;
+      if (frame_ != nullptr) sequence_++;
+      if (tiles_ != nullptr) tiles_published_++;
+    } else {
+      continue;
+    }
+    published = Clock::now();
+    frame_cv_.notify_all();
+  }
+}
+
+void ScreenMirrorSender::Accept() {
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (stop_) return;
+    }
+    Reap();
+    pollfd poll_fd = {listen_fd_, POLLIN, 0};
+    if (poll(&poll_fd, 1, kAcceptPollMs) <= 0) continue;
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) continue;
+#if !defined(SOCK_CLOEXEC)
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+#if defined(SO_NOSIGPIPE)
+    const int one_nosigpipe = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one_nosigpipe,
+               sizeof(one_nosigpipe));
+#endif
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    timeval timeout = {kSocketTimeoutSec, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::lock_guard<std::mutex> lock(clients_mu_);
+    clients_.emplace_back();
+    Client* client = &clients_.back();
+    client->fd = fd;
+    client->thread = std::thread(&ScreenMirrorSender::Serve, this, client);
+  }
+}
+
+void ScreenMirrorSender::Reap() {
+  std::lock_guard<std::mutex> lock(clients_mu_);
+  for (auto it = clients_.begin(); it != clients_.end();) {
+    if (!it->done.load(std::memory_order_acquire)) {
+      ++it;
+      continue;
+    }
+    it->thread.join();
+    close(it->fd);
+    it = clients_.erase(it);
+  }
+}
+
+void ScreenMirrorSender::Serve(Client* client) {
+  const int fd = client->fd;
+  bool tiles = false;
+  const std::string path = ReadRequestPath(fd, &tiles);
+  if (path != "/stream" && path != "/") {
+    if (!path.empty()) SendAll(fd, kNotFound, sizeof(kNotFound) - 1);
+    client->done.store(true, std::memory_order_release);
+    return;
+  }
+  const std::string header =
+      StreamHeader(tiles ? kTileStreamContentType : kMjpegContentType);
+  if (!SendAll(fd, header.data(), header.size())) {
+    client->done.store(true, std::memory_order_release);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.clients++;
+    tile_clients_ += tiles;
+  }
+  capture_cv_.notify_all();
+
+  if (tiles) {
+    StreamTiles(fd);
+  } else {
+    StreamMjpeg(fd);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.clients--;
+    tile_clients_ -= tiles;
+  }
+  client->done.store(true, std::memory_order_release);
+}
+
+void ScreenMirrorSender::StreamMjpeg(int fd) {
+  uint64_t sent = 0;
+  while (true) {
+    std::shared_ptr<const std::vector<uint8_t>> frame;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      while (!stop_ && (frame_ == nullptr || sequence_ == sent)) {
+        frame_cv_.wait_for(lock, kIdleWake);
+      }
+      if (stop_) return;
+      if (sent != 0) stats_.frames_skipped += sequence_ - sent - 1;
+      frame = frame_;
+      sent = sequence_;
+    }
+    char header[96];
+    const int header_len = std::snprintf(
+        header, sizeof(header),
+        "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n",
+        frame->size());
+    iovec iov[3] = {
+        {header, static_cast<size_t>(header_len)},
+        {const_cast<uint8_t*>(frame->data()), frame->size()},
+        {const_cast<char*>("\r\n"), 2},
+    };
+    if (!SendAll(fd, iov, 3)) return;
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.frames_sent++;
+    stats_.bytes_sent += header_len + frame->size() + 2;
+  }
+}
+
+void ScreenMirrorSender::StreamTiles(int fd) {
+  const std::vector<uint8_t>& header = tile_encoder_.header();
+  if (!SendAll(fd, reinterpret_cast<const char*>(header.data()),
+               header.size())) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.bytes_sent += header.size();
+  }
+  uint64_t seen = 0;
+  uint32_t base = 0;  // The sequence the viewer holds; 0 for none.
+  std::chrono::steady_clock::time_point keyframe_at;
+  std::vector<uint8_t> out;
+  while (true) {
+    std::shared_ptr<const TileSnapshot> snapshot;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      while (!stop_ && (tiles_ == nullptr || tiles_published_ == seen)) {
+        frame_cv_.wait_for(lock, kIdleWake);
+      }
+      if (stop_) return;
+      if (seen != 0) stats_.frames_skipped += tiles_published_ - seen - 1;
+      snapshot = tiles_;
+      seen = tiles_published_;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (base != 0 && now - keyframe_at >= kKeyframeInterval) base = 0;
+    if (base == 0) keyframe_at = now;
+    out.clear();
+    WriteTileFrame(*snapshot, base, &out);
+    if (!SendAll(fd, reinterpret_cast<const char*>(out.data()), out.size())) {
+      return;
+    }
+    base = snapshot->sequence;
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.frames_sent++;
+    stats_.bytes_sent += out.size();
+  }
+}
+
+#endif  // defined(_WIN32)
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::ScreenMirrorSender* Unwrap(ZsScreenMirror* mirror) {
+  return reinterpret_cast<zapshare::ScreenMirrorSender*>(mirror);
+}
+
+const zapshare::ScreenMirrorSender* Unwrap(const ZsScreenMirror* mirror) {
+  return reinterpret_cast<const zapshare::ScreenMirrorSender*>(mirror);
+}
+
+}  // namespace
+
+int32_t zs_screen_mirror_available(void) {
+  return zapshare::ScreenMirrorSender::Available() ? 1 : 0;
+}
+
+ZsScreenMirror* zs_screen_mirror_start(const char* display, uint16_t port,
+                                       int32_t fps, int32_t quality,
+                                       int32_t threads) {
+  zapshare::ScreenMirrorConfig config;
+  if (display != nullptr) config.display = display;
+  config.port = port;
+  if (fps > 0) config.fps = fps;
+  if (quality > 0) config.quality = quality;
+  config.threads = threads;
+  return reinterpret_cast<ZsScreenMirror*>(
+      zapshare::ScreenMirrorSender::Start(config).release());
+}
+
+uint16_t zs_screen_mirror_port(const ZsScreenMirror* mirror) {
+  return Unwrap(mirror)->port();
+}
+
+void zs_screen_mirror_stats(const ZsScreenMirror* mirror, uint64_t out[14]) {
+  const zapshare::ScreenMirrorStats s = Unwrap(mirror)->stats();
+  out[0] = s.captured;
+  out[1] = s.unchanged;
+  out[2] = s.encoded;
+  out[3] = s.resent;
+  out[4] = s.failed;
+  out[5] = s.bands_encoded;
+  out[6] = s.bands_reused;
+  out[7] = s.capture_ns;
+  out[8] = s.encode_ns;
+  out[9] = s.last_frame_bytes;
+  out[10] = s.clients;
+  out[11] = s.frames_sent;
+  out[12] = s.frames_skipped;
+  out[13] = s.bytes_sent;
+}
+
+void zs_screen_mirror_stop(ZsScreenMirror* mirror) { delete Unwrap(mirror); }
@@ -0,0 +1,163 @@
+#ifndef ZAPSHARE_NATIVE_MIRROR_SENDER_H_
+#define ZAPSHARE_NATIVE_MIRROR_SENDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "export.h"
+#include "mjpeg_encoder.h"
+#include "screen_capture.h"
+#include "tile_stream.h"
+
+namespace zapshare {
+
+// Mirrors this desktop's screen to a viewer, in the stream format the
+// Android sender serves and ScreenMirrorViewerScreen reads:
+//
+//   GET /stream  ->  200, multipart/x-mixed-replace; boundary=frame
+//   part = "--frame\r\nContent-Type: image/jpeg\r\n"
+//          "Content-Length: N\r\n\r\n" jpeg "\r\n"
+//
+// One thread captures at the configured rate, but only while a viewer is
+// connected. Each grab goes through a TileDiffer: when no tile changed,
+// nothing is encoded or sent, so a static screen costs one grab and a
+// memcmp per frame. Otherwise the MjpegEncoder compresses only the bands
+// that changed, on its own pool, and the frame is published. A frame is
+// sent again every two seconds of stillness all the same, since the viewer
+// reconnects after eight without one.
+//
+// Each viewer has its own thread, which sends the newest frame whenever
+// it's done with the last: a viewer that falls behind skips frames instead
+// of queueing them, and can't hold the others back.
+//
+// A viewer that asks for a tile stream (see tile_stream.h) gets one
+// instead, from a TileEncoder fed the same diffs. Each encoder only runs
+// while a viewer of its kind is connected, and the first of a kind starts
+// it off with a whole frame. A tile viewer is sent, each time, the tiles
+// changed since the sequence it was last sent, so skipping costs it
+// nothing but latency; a keyframe every kTileKeyframeIntervalSec, and an
+// empty frame every two seconds of stillness.
+
+struct ScreenMirrorConfig {
+  std::string display;  // X display; empty for $DISPLAY.
+  uint16_t port = 0;    // 0 picks a free one; see port().
+  int fps = 30;
+  int quality = 70;
+  int threads = 0;  // Encoder threads; see MjpegEncoder.
+};
+
+struct ScreenMirrorStats {
+  uint64_t captured = 0;
+  uint64_t unchanged = 0;  // Captured, but no tile changed: not encoded.
+  uint64_t encoded = 0;    // Into MJPEG, tiles or both.
+  uint64_t resent = 0;     // Published again to keep viewers alive.
+  uint64_t failed = 0;     // Grabs or encodes that failed.
+  uint64_t bands_encoded = 0;
+  uint64_t bands_reused = 0;
+  uint64_t capture_ns = 0;  // Spent grabbing and diffing, over captured.
+  uint64_t encode_ns = 0;   // Spent encoding, over encoded.
+  uint64_t last_frame_bytes = 0;  // Of the last MJPEG frame.
+  uint64_t clients = 0;     // Viewers connected now.
+  uint64_t frames_sent = 0;  // Over all viewers.
+  uint64_t frames_skipped = 0;  // Published while a viewer was busy.
+  uint64_t bytes_sent = 0;
+};
+
+class ScreenMirrorSender {
+ public:
+  // Whether this build can capture and encode a screen.
+  static bool Available();
+
+  // Opens |config.display| and listens on every interface. Null if the
+  // display can't be captured or the port can't be bound.
+  static std::unique_ptr<ScreenMirrorSender> Start(
+      const ScreenMirrorConfig& config);
+  // The same, capturing from |source| instead of a display.
+  static std::unique_ptr<ScreenMirrorSender> Start(
+      std::unique_ptr<ScreenSource> source, const ScreenMirrorConfig& config);
+
+  ~ScreenMirrorSender();
+
+  ScreenMirrorSender(const ScreenMirrorSender&) = delete;
+  ScreenMirrorSender& operator=(const ScreenMirrorSender&) = delete;
+
+  uint16_t port() const { return port_; }
+  ScreenMirrorStats stats() const;
+
+ private:
+  struct Client {
+    int fd = -1;
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+
+  ScreenMirrorSender(std::unique_ptr<ScreenSource> source,
+                     const ScreenMirrorConfig& config);
+
+  void Capture();
+  void Accept();
+  void Serve(Client* client);
+  // Send the stream until the viewer goes or the sender stops.
+  void StreamMjpeg(int fd);
+  void StreamTiles(int fd);
+  // Joins the threads of viewers that have gone.
+  void Reap();
+
+  std::unique_ptr<ScreenSource> source_;
+  TileDiffer differ_;
+  MjpegEncoder encoder_;
+  TileEncoder tile_encoder_;
+  const int fps_;
+  int listen_fd_ = -1;
+  uint16_t port_ = 0;
+
+  mutable std::mutex mu_;
+  std::condition_variable frame_cv_;    // A frame was published, or stop.
+  std::condition_variable capture_cv_;  // A viewer connected, or stop.
+  std::shared_ptr<const std::vector<uint8_t>> frame_;
+  uint64_t sequence_ = 0;  // Of |frame_|.
+  std::shared_ptr<const TileSnapshot> tiles_;
+  uint64_t tiles_published_ = 0;  // Keepalives included.
+  uint64_t tile_clients_ = 0;     // Of stats_.clients.
+  bool stop_ = false;
+  ScreenMirrorStats stats_;
+
+  std::mutex clients_mu_;
+  std::list<Client> clients_;
+
+  std::thread capture_thread_;
+  std::thread accept_thread_;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsScreenMirror ZsScreenMirror;
+
+// 1 when this build can mirror the screen, 0 otherwise.
+ZS_EXPORT int32_t zs_screen_mirror_available(void);
+// Starts capturing |display| (null or empty for $DISPLAY) and serving it on
+// |port| (0 for any). |threads| 0 picks a default. Null on failure.
+ZS_EXPORT ZsScreenMirror* zs_screen_mirror_start(const char* display,
+                                                 uint16_t port, int32_t fps,
+                                                 int32_t quality,
+                                                 int32_t threads);
+ZS_EXPORT uint16_t zs_screen_mirror_port(const ZsScreenMirror* mirror);
+// Fills |out| with the ScreenMirrorStats fields in declaration order.
+ZS_EXPORT void zs_screen_mirror_stats(const ZsScreenMirror* mirror,
+                                     uint64_t out[14]);
+// Disconnects every viewer and frees the mirror.
+ZS_EXPORT void zs_screen_mirror_stop(ZsScreenMirror* mirror);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_MIRROR_SENDER_H_
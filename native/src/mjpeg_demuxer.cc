@@ -0,0 +1,332 @@
+#include "mjpeg_demuxer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace zapshare {
+
+namespace {
+
+constexpr size_t kNpos = static_cast<size_t>(-1);
+// Longer than any boundary line or part header a server sends; past it
+// the bytes aren't what we think they are.
+constexpr size_t kMaxBoundaryLine = 256;
+constexpr size_t kMaxHeaders = 16 * 1024;
+constexpr char kContentLength[] = "content-length:";
+
+bool IsJpeg(const uint8_t* data, size_t size) {
+  return size >= 4 && data[0] == 0xFF && data[1] == 0xD8;
+}
+
+char Lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+// The Content-Length among |size| bytes of header lines, or kNpos.
+size_t ContentLength(const char* headers, size_t size) {
+  const size_t key = sizeof(kContentLength) - 1;
+  size_t line = 0;
+  while (line < size) {
+    const char* end = static_cast<const char*>(
+        std::memchr(headers + line, '\n', size - line));
+    const size_t line_end = end != nullptr ? end - headers : size;
+    if (line_end - line > key) {
+      size_t i = 0;
+      while (i < key && Lower(headers[line + i]) == kContentLength[i]) i++;
+      if (i == key) {
+        size_t p = line + key;
+        while (p < line_end && headers[p] == ' ') p++;
+        size_t value = 0;
+        const size_t digits = p;
+        while (p < line_end && headers[p] >= '0' && headers[p] <= '9' &&
+               value < (size_t{1} << 40)) {
+          value = value * 10 + static_cast<size_t>(headers[p++] - '0');
+        }
+        if (p > digits) return value;
+      }
+    }
+    line = line_end + 1;
+  }
+  return kNpos;
+}
+
+}  // namespace
+
+MjpegDemuxer::MjpegDemuxer(const std::string& boundary, size_t max_buffer)
+    : max_buffer_(max_buffer) {
+  if (!boundary.empty()) SetDelimiter("--" + boundary);
+}
+
+void MjpegDemuxer::SetDelimiter(const std::string& delimiter) {
+  delimiter_ = delimiter;
+  part_end_ = "\r\n" + delimiter;
+}
+
+void MjpegDemuxer::Feed(const uint8_t* data, size_t len) {
+  stats_.bytes += len;
+  if (buffered() + len > max_buffer_) {
+    // Nothing that large is a frame; start over from what comes next.
+    head_ = tail_ = 0;
+    scan_ = 0;
+    if (state_ != State::kMarkers) {
+      state_ = delimiter_.empty() ? State::kStart : State::kBoundary;
+    }
+    stats_.resyncs++;
+  }
+  if (tail_ + len > buffer_.size()) {
+    if (head_ > 0) {
+      std::memmove(buffer_.data(), buffer_.data() + head_, tail_ - head_);
+      tail_ -= head_;
+      head_ = 0;
+      stats_.compactions++;
+    }
+    if (tail_ + len > buffer_.size()) {
+      buffer_.resize(std::max(buffer_.size() * 2, tail_ + len));
+      stats_.allocations++;
+    }
+  }
+  if (len > 0) std::memcpy(buffer_.data() + tail_, data, len);
+  tail_ += len;
+}
+
+bool MjpegDemuxer::Next(MjpegFrame* out) {
+  for (;;) {
+    bool progress = false;
+    switch (state_) {
+      case State::kStart:
+        progress = Start();
+        break;
+      case State::kBoundary:
+        progress = Boundary();
+        break;
+      case State::kHeaders:
+        progress = Headers();
+        break;
+      case State::kBody:
+        if (Body(out)) return true;
+        progress = state_ != State::kBody;
+        break;
+      case State::kMarkers:
+        // Every SOI it finds is a frame, so false means waiting for more.
+        return Markers(out);
+    }
+    if (!progress) return false;
+  }
+}
+
+size_t MjpegDemuxer::Find(const char* pattern, size_t size, size_t from,
+                          size_t* resume) const {
+  const uint8_t* base = buffer_.data() + head_;
+  const size_t unread = buffered();
+  const uint8_t first = static_cast<uint8_t>(pattern[0]);
+  size_t at = from;
+  while (at + size <= unread) {
+    const void* hit = std::memchr(base + at, first, unread - size + 1 - at);
+    if (hit == nullptr) break;
+    at = static_cast<const uint8_t*>(hit) - base;
+    if (std::memcmp(base + at, pattern, size) == 0) return at;
+    at++;
+  }
+  // A match may yet start in the last size - 1 bytes.
+  *resume = std::max(from, unread >= size ? unread - size + 1 : 0);
+  return kNpos;
+}
+
+// Works out what kind of stream this is from its first bytes.
+bool MjpegDemuxer::Start() {
+  while (buffered() > 0 && std::memchr("\r\n ", buffer_[head_], 3) != nullptr) {
+    Consume(1);
+  }
+  if (buffered() < 2) return false;
+  if (buffer_[head_] != '-' || buffer_[head_ + 1] != '-') {
+    state_ = State::kMarkers;
+    scan_ = 0;
+    return true;
+  }
+  size_t resume = 0;
+  size_t end = Find("\r\n", 2, 2, &resume);
+  if (end == kNpos) {
+    if (buffered() <= kMaxBoundaryLine) return false;
+    end = 0;  // Not a boundary line after all.
+  }
+  while (end > 2 && buffer_[head_ + end - 1] == ' ') end--;
+  if (end <= 2 || end > kMaxBoundaryLine) {
+    state_ = State::kMarkers;
+    scan_ = 0;
+    return true;
+  }
+  SetDelimiter(
+      std::string(reinterpret_cast<const char*>(&buffer_[head_]), end));
+  state_ = State::kBoundary;
+  scan_ = 0;
+  return true;
+}
+
+// Skips to the next delimiter line and past it.
+bool MjpegDemuxer::Boundary() {
+  size_t resume = 0;
+  const size_t at =
+      Find(delimiter_.data(), delimiter_.size(), scan_, &resume);
+  if (at == kNpos) {
+    // Whatever came before a delimiter is of no use.
+    Consume(resume);
+    scan_ = 0;
+    return false;
+  }
+  Consume(at);
+  scan_ = 0;
+  const size_t end = Find("\r\n", 2, delimiter_.size(), &resume);
+  if (end == kNpos) {
+    if (buffered() > kMaxBoundaryLine) {
+      Consume(delimiter_.size());
+      return true;
+    }
+    return false;
+  }
+  // "--boundary--" closes the stream; a part may still follow on a
+  // server that didn't mean it, so carry on looking.
+  const size_t dashes = delimiter_.size();
+  const bool closing = end == dashes + 2 && buffer_[head_ + dashes] == '-' &&
+                       buffer_[head_ + dashes + 1] == '-';
+  Consume(end + 2);
+  if (!closing) state_ = State::kHeaders;
+  return true;
+}
+
+bool MjpegDemuxer::Headers() {
+  size_t end;
+  size_t resume = 0;
+  if (buffered() >= 2 && buffer_[head_] == '\r' &&
+      buffer_[head_ + 1] == '\n') {
+    end = 0;  // No headers at all.
+  } else {
+    end = Find("\r\n\r\n", 4, scan_, &resume);
+    if (end == kNpos) {
+      scan_ = resume;
+      if (buffered() > kMaxHeaders) {
+        state_ = State::kBoundary;
+        scan_ = 0;
+        return true;
+      }
+      return false;
+    }
+    end += 2;
+  }
+  length_ = ContentLength(reinterpret_cast<const char*>(&buffer_[head_]),
+                          end);
+  if (length_ != kNpos && length_ > max_buffer_) length_ = kNpos;
+  Consume(end + 2);
+  state_ = State::kBody;
+  scan_ = 0;
+  return true;
+}
+
+bool MjpegDemuxer::Body(MjpegFrame* out) {
+  if (length_ != kNpos) {
+    if (buffered() < length_) return false;
+    const size_t size = length_;
+    state_ = State::kBoundary;
+    scan_ = 0;
+    return Emit(size, true, out);
+  }
+  // No length: the part runs to the CRLF before the next delimiter.
+  size_t resume = 0;
+  const size_t at = Find(part_end_.data(), part_end_.size(), scan_, &resume);
+  if (at == kNpos) {
+    scan_ = resume;
+    return false;
+  }
+  state_ = State::kBoundary;
+  scan_ = 0;
+  return Emit(at, false, out);
+}
+
+bool MjpegDemuxer::Markers(MjpegFrame* out) {
+  size_t resume = 0;
+  if (scan_ == 0) {
+    const size_t soi = Find("\xFF\xD8", 2, 0, &resume);
+    if (soi == kNpos) {
+      Consume(resume);
+      return false;
+    }
+    Consume(soi);
+    scan_ = 2;
+  }
+  const size_t eoi = Find("\xFF\xD9", 2, scan_, &resume);
+  if (eoi == kNpos) {
+    scan_ = std::max<size_t>(resume, 2);
+    return false;
+  }
+  scan_ = 0;
+  return Emit(eoi + 2, false, out);
+}
+
+// Hands out the next |size| bytes and consumes them.
+bool MjpegDemuxer::Emit(size_t size, bool by_length, MjpegFrame* out) {
+  const uint8_t* data = buffer_.data() + head_;
+  Consume(size);
+  if (!IsJpeg(data, size)) {
+    stats_.skipped++;
+    return false;
+  }
+  out->data = data;
+  out->size = size;
+  stats_.frames++;
+  (by_length ? stats_.by_length : stats_.by_marker)++;
+  return true;
+}
+
+void MjpegDemuxer::Consume(size_t n) {
+  head_ += n;
+  // Frames handed out stay where they are until the next Feed() either
+  // way; starting from the front spares it a compaction.
+  if (head_ == tail_) head_ = tail_ = 0;
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::MjpegDemuxer* Unwrap(ZsMjpegDemuxer* demuxer) {
+  return reinterpret_cast<zapshare::MjpegDemuxer*>(demuxer);
+}
+
+const zapshare::MjpegDemuxer* Unwrap(const ZsMjpegDemuxer* demuxer) {
+  return reinterpret_cast<const zapshare::MjpegDemuxer*>(demuxer);
+}
+
+}  // namespace
+
+ZsMjpegDemuxer* zs_mjpeg_demuxer_new(const char* boundary) {
+  return reinterpret_cast<ZsMjpegDemuxer*>(
+      new zapshare::MjpegDemuxer(boundary != nullptr ? boundary : ""));
+}
+
+void zs_mjpeg_demuxer_free(ZsMjpegDemuxer* demuxer) {
+  delete Unwrap(demuxer);
+}
+
+void zs_mjpeg_demuxer_feed(ZsMjpegDemuxer* demuxer, const uint8_t* data,
+                           size_t len) {
+  Unwrap(demuxer)->Feed(data, len);
+}
+
+const uint8_t* zs_mjpeg_demuxer_next(ZsMjpegDemuxer* demuxer,
+                                     size_t* size) {
+  zapshare::MjpegFrame frame;
+  if (!Unwrap(demuxer)->Next(&frame)) return nullptr;
+  *size = frame.size;
+  return frame.data;
+}
+
+void zs_mjpeg_demuxer_stats(const ZsMjpegDemuxer* demuxer,
+                            uint64_t out[8]) {
+  const zapshare::MjpegStats& s = Unwrap(demuxer)->stats();
+  out[0] = s.frames;
+  out[1] = s.by_length;
+  out[2] = s.by_marker;
+  out[3] = s.bytes;
+  out[4] = s.skipped;
+  out[5] = s.resyncs;
+  out[6] = s.allocations;
+  out[7] = s.compactions;
+}
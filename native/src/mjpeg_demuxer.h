@@ -0,0 +1,115 @@
+#ifndef ZAPSHARE_NATIVE_MJPEG_DEMUXER_H_
+#define ZAPSHARE_NATIVE_MJPEG_DEMUXER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// Splits an MJPEG stream into JPEG frames as it arrives.
+//
+// The screen mirror server sends multipart/x-mixed-replace, each part
+//   --frame\r\nContent-Type: image/jpeg\r\nContent-Length: N\r\n\r\n
+//   <N bytes of JPEG>\r\n
+// and a part with a Content-Length is cut by it without looking at the
+// JPEG at all. A part without one ends at the next boundary, and a part
+// that isn't a JPEG is skipped. A stream that isn't multipart is cut at
+// SOI (FF D8) and EOI (FF D9) markers instead, as the viewer did before.
+//
+// Every search resumes where the previous one stopped and uses memchr, so
+// each byte is looked at about once however it's split into chunks. Bytes
+// live in one buffer that is compacted rather than wrapped when it fills,
+// so a frame is always contiguous and handed out in place: a frame from
+// Next() points into the buffer and stays valid until the next Feed(). In
+// a steady stream the buffer stops growing after the first few frames.
+
+constexpr size_t kMjpegDefaultMaxBuffer = 8 * 1024 * 1024;
+
+struct MjpegFrame {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+struct MjpegStats {
+  uint64_t frames = 0;
+  uint64_t by_length = 0;   // Cut by Content-Length.
+  uint64_t by_marker = 0;   // Cut at the next boundary or at EOI.
+  uint64_t bytes = 0;       // Fed in.
+  uint64_t skipped = 0;     // Parts that weren't a JPEG.
+  uint64_t resyncs = 0;     // Buffer dropped for exceeding its limit.
+  uint64_t allocations = 0; // Times the buffer grew.
+  uint64_t compactions = 0; // Times the unread bytes moved to the front.
+};
+
+class MjpegDemuxer {
+ public:
+  // |boundary| is the Content-Type's boundary parameter, without the
+  // dashes; empty learns it from the first part, or finds the stream
+  // isn't multipart. No frame is larger than |max_buffer|.
+  explicit MjpegDemuxer(const std::string& boundary = "",
+                        size_t max_buffer = kMjpegDefaultMaxBuffer);
+
+  // Appends |data|. Frames returned by Next() before are invalid after.
+  void Feed(const uint8_t* data, size_t len);
+  // The next complete frame; false until more is fed.
+  bool Next(MjpegFrame* out);
+
+  const MjpegStats& stats() const { return stats_; }
+  // Bytes held for frames still incomplete.
+  size_t buffered() const { return tail_ - head_; }
+
+ private:
+  enum class State { kStart, kBoundary, kHeaders, kBody, kMarkers };
+
+  void SetDelimiter(const std::string& delimiter);
+
+  // Where |pattern| starts at or after |from| in the unread bytes, or
+  // npos; |*resume| is where the next search can pick up.
+  size_t Find(const char* pattern, size_t size, size_t from,
+              size_t* resume) const;
+  bool Start();
+  bool Boundary();
+  bool Headers();
+  bool Body(MjpegFrame* out);
+  bool Markers(MjpegFrame* out);
+  bool Emit(size_t size, bool by_length, MjpegFrame* out);
+  void Consume(size_t n);
+
+  std::string delimiter_;  // "--" + the boundary.
+  std::string part_end_;   // CRLF + delimiter_, which ends a part.
+  const size_t max_buffer_;
+  std::vector<uint8_t> buffer_;
+  size_t head_ = 0;  // Unread bytes are [head_, tail_).
+  size_t tail_ = 0;
+  State state_ = State::kStart;
+  size_t scan_ = 0;  // Offset from head_ the current search resumes at.
+  size_t length_ = 0;  // The part's Content-Length, or npos.
+  MjpegStats stats_;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsMjpegDemuxer ZsMjpegDemuxer;
+
+// |boundary| may be null.
+ZS_EXPORT ZsMjpegDemuxer* zs_mjpeg_demuxer_new(const char* boundary);
+ZS_EXPORT void zs_mjpeg_demuxer_free(ZsMjpegDemuxer* demuxer);
+ZS_EXPORT void zs_mjpeg_demuxer_feed(ZsMjpegDemuxer* demuxer,
+                                     const uint8_t* data, size_t len);
+// The next frame's bytes, valid until the next feed, or null.
+ZS_EXPORT const uint8_t* zs_mjpeg_demuxer_next(ZsMjpegDemuxer* demuxer,
+                                               size_t* size);
+// |out|: frames, by_length, by_marker, bytes, skipped, resyncs,
+// allocations, compactions.
+ZS_EXPORT void zs_mjpeg_demuxer_stats(const ZsMjpegDemuxer* demuxer,
+                                      uint64_t out[8]);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_MJPEG_DEMUXER_H_
@@ -0,0 +1,365 @@
+#include "mjpeg_encoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#if defined(ZS_HAVE_JPEG)
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr std::chrono::seconds kIdleWake(1);
+constexpr int kMaxThreads = 4;
+// Luma rows per MCU at 4:2:0; a restart marker follows each MCU row.
+constexpr int kMcuRows = 16;
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+#if defined(ZS_HAVE_JPEG)
+
+struct ErrorManager {
+  jpeg_error_mgr base;
+  jmp_buf jump;
+};
+
+void OnError(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void OnMessage(j_common_ptr, int) {}
+
+// Writes into a vector that keeps its capacity from band to band.
+struct VectorDestination {
+  jpeg_destination_mgr base;
+  std::vector<uint8_t>* out;
+};
+
+void InitDestination(j_compress_ptr cinfo) {
+  auto* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  dest->out->resize(std::max<size_t>(dest->out->capacity(), 64 * 1024));
+  dest->base.next_output_byte = dest->out->data();
+  dest->base.free_in_buffer = dest->out->size();
+}
+
+boolean EmptyOutputBuffer(j_compress_ptr cinfo) {
+  auto* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  const size_t used = dest->out->size();
+  dest->out->resize(used * 2);
+  dest->base.next_output_byte = dest->out->data() + used;
+  dest->base.free_in_buffer = dest->out->size() - used;
+  return TRUE;
+}
+
+void TermDestination(j_compress_ptr cinfo) {
+  auto* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  dest->out->resize(dest->out->size() - dest->base.free_in_buffer);
+}
+
+#endif  // defined(ZS_HAVE_JPEG)
+
+}  // namespace
+
+#if defined(ZS_HAVE_JPEG)
+
+// One compressor per thread, kept for the life of the encoder.
+struct MjpegEncoder::Compressor {
+  jpeg_compress_struct cinfo;
+  ErrorManager error;
+  VectorDestination dest;
+  std::vector<uint8_t> jpeg;
+  std::vector<JSAMPROW> rows;
+#if !defined(JCS_EXTENSIONS)
+  std::vector<uint8_t> rgb;
+#endif
+  // The header of the last band, which every band of a frame shares but
+  // for the height.
+  std::vector<uint8_t> header;
+  size_t height_offset = 0;
+  int header_width = 0;
+
+  Compressor() {
+    cinfo.err = jpeg_std_error(&error.base);
+    error.base.error_exit = OnError;
+    error.base.emit_message = OnMessage;
+    jpeg_create_compress(&cinfo);
+    dest.base.init_destination = InitDestination;
+    dest.base.empty_output_buffer = EmptyOutputBuffer;
+    dest.base.term_destination = TermDestination;
+    dest.out = &jpeg;
+    cinfo.dest = &dest.base;
+  }
+
+  ~Compressor() { jpeg_destroy_compress(&cinfo); }
+
+  bool Encode(const ScreenFrame& frame, int top, int height, int quality,
+              Band* band) {
+    if (!Compress(frame, top, height, quality)) return false;
+    return Split(frame.width, band);
+  }
+
+  // Nothing in here may own memory: an error longjmps out of libjpeg.
+  bool Compress(const ScreenFrame& frame, int top, int height,
+                int quality) {
+    if (setjmp(error.jump) != 0) {
+      jpeg_abort_compress(&cinfo);
+      return false;
+    }
+    cinfo.image_width = frame.width;
+    cinfo.image_height = height;
+#if defined(JCS_EXTENSIONS)
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_BGRX;
+#else
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+#endif
+    jpeg_set_defaults(&cinfo);  // Standard tables, 4:2:0.
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.optimize_coding = FALSE;  // Every band must share the tables.
+    cinfo.restart_in_rows = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+#if defined(JCS_EXTENSIONS)
+    rows.resize(height);
+    for (int y = 0; y < height; y++) {
+      rows[y] = const_cast<JSAMPROW>(frame.pixels + frame.stride * (top + y));
+    }
+    while (cinfo.next_scanline < cinfo.image_height) {
+      jpeg_write_scanlines(&cinfo, rows.data() + cinfo.next_scanline,
+                           cinfo.image_height - cinfo.next_scanline);
+    }
+#else
+    rgb.resize(static_cast<size_t>(frame.width) * 3);
+    JSAMPROW row = rgb.data();
+    while (cinfo.next_scanline < cinfo.image_height) {
+      const uint8_t* src =
+          frame.pixels + frame.stride * (top + cinfo.next_scanline);
+      for (int x = 0; x < frame.width; x++) {
+        rgb[x * 3] = src[x * 4 + 2];
+        rgb[x * 3 + 1] = src[x * 4 + 1];
+        rgb[x * 3 + 2] = src[x * 4];
+      }
+      jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+#endif
+    jpeg_finish_compress(&cinfo);
+    return true;
+  }
+
+  // Cuts the band's JPEG into its header and one entropy-coded segment per
+  // MCU row.
+  bool Split(int width, Band* band) {
+    const uint8_t* p = jpeg.data();
+    const size_t size = jpeg.size();
+    size_t pos = 2;  // Past SOI.
+    size_t sof = 0;
+    size_t scan = 0;
+    while (pos + 4 <= size && p[pos] == 0xFF) {
+      const uint8_t marker = p[pos + 1];
+      const size_t length = (p[pos + 2] << 8) | p[pos + 3];
+      if (marker == 0xC0) sof = pos;
+      pos += 2 + length;
+      if (marker == 0xDA) {
+        scan = pos;
+        break;
+      }
+    }
+    if (sof == 0 || scan == 0 || scan > size) return false;
+    if (header_width != width) {
+      header.assign(p, p + scan);
+      height_offset = sof + 5;
+      header_width = width;
+    }
+
+    band->data.clear();
+    band->ends.clear();
+    size_t i = scan;
+    while (i + 1 < size) {
+      const uint8_t* mark = static_cast<const uint8_t*>(
+          std::memchr(p + i, 0xFF, size - 1 - i));
+      if (mark == nullptr) break;
+      const size_t at = mark - p;
+      const uint8_t next = p[at + 1];
+      if ((next >= 0xD0 && next <= 0xD7) || next == 0xD9) {
+        band->data.insert(band->data.end(), p + i, p + at);
+        band->ends.push_back(band->data.size());
+        if (next == 0xD9) return true;
+      } else {
+        // 0xFF 0x00 stays stuffed.
+        band->data.insert(band->data.end(), p + i, p + at + 2);
+      }
+      i = at + 2;
+    }
+    return false;
+  }
+};
+
+bool MjpegEncoder::Available() { return true; }
+
+#else
+
+struct MjpegEncoder::Compressor {
+  std::vector<uint8_t> header;
+  size_t height_offset = 0;
+  int header_width = 0;
+
+  bool Encode(const ScreenFrame&, int, int, int, Band*) { return false; }
+};
+
+bool MjpegEncoder::Available() { return false; }
+
+#endif  // defined(ZS_HAVE_JPEG)
+
+MjpegEncoder::MjpegEncoder(int quality, int threads)
+    : quality_(std::clamp(quality, 1, 100)) {
+  if (threads <= 0) {
+    threads = std::clamp(static_cast<int>(std::thread::hardware_concurrency()),
+                         1, kMaxThreads);
+  }
+  for (int i = 0; i < threads; i++) {
+    compressors_.push_back(std::make_unique<Compressor>());
+  }
+  for (size_t i = 1; i < compressors_.size(); i++) {
+    workers_.emplace_back(&MjpegEncoder::Work, this, i);
+  }
+}
+
+MjpegEncoder::~MjpegEncoder() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& worker : workers_) worker.join();
+}
+
+bool MjpegEncoder::Encode(const ScreenFrame& frame, const TileDiffer& differ,
+                          std::vector<uint8_t>* out) {
+  const uint64_t start = NowNs();
+  const int band_count = (frame.height + kScreenTileSize - 1) / kScreenTileSize;
+  const int columns = (frame.width + kScreenTileSize - 1) / kScreenTileSize;
+  const bool whole = !valid_ || frame.width != width_ ||
+                     frame.height != height_ ||
+                     differ.columns() != columns || differ.rows() != band_count;
+  if (whole) {
+    width_ = frame.width;
+    height_ = frame.height;
+    bands_.assign(band_count, Band());
+    header_.clear();
+  }
+
+  std::vector<int> job;
+  for (int row = 0; row < band_count; row++) {
+    bool dirty = whole;
+    for (int column = 0; !dirty && column < differ.columns(); column++) {
+      dirty = differ.dirty(column, row);
+    }
+    if (dirty) job.push_back(row);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    frame_ = &frame;
+    job_ = std::move(job);
+    next_ = 0;
+    pending_ = job_.size();
+    failed_ = false;
+    generation_++;
+  }
+  work_cv_.notify_all();
+  RunJob(compressors_[0].get());
+  bool failed;
+  size_t encoded;
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (pending_ > 0) done_cv_.wait_for(lock, kIdleWake);
+    frame_ = nullptr;
+    failed = failed_;
+    encoded = job_.size();
+  }
+  valid_ = !failed;
+  if (failed) return false;
+
+  if (header_.empty()) {
+    for (const auto& compressor : compressors_) {
+      if (compressor->header_width == width_) {
+        header_ = compressor->header;
+        height_offset_ = compressor->height_offset;
+        break;
+      }
+    }
+  }
+
+  out->clear();
+  out->insert(out->end(), header_.begin(), header_.end());
+  (*out)[height_offset_] = static_cast<uint8_t>(height_ >> 8);
+  (*out)[height_offset_ + 1] = static_cast<uint8_t>(height_);
+  const size_t mcu_rows = (height_ + kMcuRows - 1) / kMcuRows;
+  size_t mcu_row = 0;
+  for (const Band& band : bands_) {
+    size_t begin = 0;
+    for (size_t end : band.ends) {
+      out->insert(out->end(), band.data.begin() + begin,
+                  band.data.begin() + end);
+      begin = end;
+      if (++mcu_row < mcu_rows) {
+        out->push_back(0xFF);
+        out->push_back(static_cast<uint8_t>(0xD0 + (mcu_row - 1) % 8));
+      }
+    }
+  }
+  out->push_back(0xFF);
+  out->push_back(0xD9);
+
+  const uint64_t elapsed = NowNs() - start;
+  stats_.frames++;
+  stats_.bands_encoded += encoded;
+  stats_.bands_reused += bands_.size() - encoded;
+  stats_.encode_ns += elapsed;
+  stats_.last_encode_ns = elapsed;
+  stats_.last_bytes = out->size();
+  return true;
+}
+
+void MjpegEncoder::Work(size_t index) {
+  uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      while (!stop_ && generation_ == seen) work_cv_.wait_for(lock, kIdleWake);
+      if (stop_) return;
+      seen = generation_;
+    }
+    RunJob(compressors_[index].get());
+  }
+}
+
+void MjpegEncoder::RunJob(Compressor* compressor) {
+  std::unique_lock<std::mutex> lock(mu_);
+  while (next_ < job_.size()) {
+    const int row = job_[next_++];
+    const ScreenFrame& frame = *frame_;
+    const int top = row * kScreenTileSize;
+    const int height = std::min(kScreenTileSize, frame.height - top);
+    Band* band = &bands_[row];
+    lock.unlock();
+    const bool ok = compressor->Encode(frame, top, height, quality_, band);
+    lock.lock();
+    if (!ok) failed_ = true;
+    if (--pending_ == 0) done_cv_.notify_all();
+  }
+}
+
+}  // namespace zapshare
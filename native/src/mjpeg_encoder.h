@@ -0,0 +1,100 @@
+#ifndef ZAPSHARE_NATIVE_MJPEG_ENCODER_H_
+#define ZAPSHARE_NATIVE_MJPEG_ENCODER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "screen_capture.h"
+
+namespace zapshare {
+
+// Encodes captured screens as the whole-frame JPEGs an MJPEG stream
+// carries, re-encoding only the parts of the screen that changed.
+//
+// The frame is cut into bands one tile (64 rows) high. Each band is its own
+// small baseline JPEG with the standard tables, 4:2:0 sampling and a
+// restart marker after every MCU row (16 pixel rows), so its entropy-coded
+// data splits at the markers into segments that each start from a reset
+// decoder state. Segments of one band are as valid in the full frame as
+// they are in the band: a frame is the shared header with the full height
+// patched in, every band's segments in order with the restart markers
+// renumbered, and EOI. Assembling it is a memcpy per band.
+//
+// So only bands holding a dirty tile are compressed again, spread over a
+// small pool of threads, and the rest are copied from the previous frame.
+// The result is an ordinary JPEG: every viewer decodes it, the native
+// receiver included, and no part of the stream format changes.
+
+struct MjpegEncoderStats {
+  uint64_t frames = 0;
+  uint64_t bands_encoded = 0;
+  uint64_t bands_reused = 0;  // Copied from the previous frame.
+  uint64_t encode_ns = 0;     // Spent in Encode(), over frames.
+  uint64_t last_encode_ns = 0;
+  uint64_t last_bytes = 0;    // Of the newest frame.
+};
+
+class MjpegEncoder {
+ public:
+  // Whether this build can encode JPEG at all.
+  static bool Available();
+
+  // |quality| is libjpeg's 1-100. |threads| encode bands alongside the
+  // caller; 0 picks one per core, up to 4 in all.
+  explicit MjpegEncoder(int quality = 70, int threads = 0);
+  ~MjpegEncoder();
+
+  MjpegEncoder(const MjpegEncoder&) = delete;
+  MjpegEncoder& operator=(const MjpegEncoder&) = delete;
+
+  // Encodes |frame| into |out|, compressing again only the bands with a
+  // tile |differ| marked dirty for it; the first frame, and any after a
+  // size change, are compressed whole. False if libjpeg failed, in which
+  // case the next frame is compressed whole.
+  bool Encode(const ScreenFrame& frame, const TileDiffer& differ,
+              std::vector<uint8_t>* out);
+
+  MjpegEncoderStats stats() const { return stats_; }
+
+ private:
+  struct Compressor;
+  struct Band {
+    std::vector<uint8_t> data;      // Entropy-coded, restart markers cut.
+    std::vector<size_t> ends;       // Where each MCU row's segment ends.
+  };
+
+  void Work(size_t index);
+  // Encodes bands of the current job until there are none left.
+  void RunJob(Compressor* compressor);
+
+  int quality_;
+  std::vector<std::unique_ptr<Compressor>> compressors_;  // [0]: caller's.
+  std::vector<Band> bands_;
+  std::vector<uint8_t> header_;  // Up to and including SOS.
+  size_t height_offset_ = 0;     // Of the frame height in |header_|.
+  int width_ = 0;
+  int height_ = 0;
+  bool valid_ = false;
+  MjpegEncoderStats stats_;
+
+  std::mutex mu_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  const ScreenFrame* frame_ = nullptr;
+  std::vector<int> job_;  // Bands to encode.
+  size_t next_ = 0;
+  size_t pending_ = 0;
+  uint64_t generation_ = 0;
+  bool failed_ = false;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_MJPEG_ENCODER_H_
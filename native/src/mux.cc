@@ -0,0 +1,537 @@
+#include "mux.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint8_t kMagic[4] = {'Z', 'S', 'M', '2'};
+constexpr int64_t kMaxWindow = 0x7FFFFFFF;
+constexpr size_t kRequestSize = 1 + 4 + 8 + 8;
+
+uint32_t LoadLe32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+uint64_t LoadLe64(const uint8_t* p) {
+  return LoadLe32(p) | static_cast<uint64_t>(LoadLe32(p + 4)) << 32;
+}
+
+void StoreLe32(uint8_t* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = static_cast<uint8_t>(v >> 8 * i);
+}
+
+void StoreLe64(uint8_t* p, uint64_t v) {
+  StoreLe32(p, static_cast<uint32_t>(v));
+  StoreLe32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+void AppendHeader(std::vector<uint8_t>* out, MuxFrame type, uint8_t flags,
+                  uint32_t stream, size_t len) {
+  uint8_t h[kMuxHeaderSize];
+  StoreLe32(h, static_cast<uint32_t>(len));
+  h[4] = static_cast<uint8_t>(type);
+  h[5] = flags;
+  StoreLe32(h + 6, stream);
+  out->insert(out->end(), h, h + kMuxHeaderSize);
+}
+
+}  // namespace
+
+MuxSession::MuxSession(Role role)
+    : role_(role), magic_left_(role == Role::kServer ? 4 : 0) {
+  if (role_ == Role::kClient) {
+    control_.assign(kMagic, kMagic + 4);
+  }
+  uint8_t hello[8];
+  StoreLe32(hello, kMuxVersion);
+  StoreLe32(hello + 4, kMuxStreamWindow);
+  PutFrame(MuxFrame::kHello, 0, 0, hello, sizeof(hello));
+}
+
+bool MuxSession::Receive(const uint8_t* data, size_t len) {
+  if (failed_) return false;
+  for (; len > 0 && magic_left_ > 0; data++, len--, magic_left_--) {
+    if (*data != kMagic[4 - magic_left_]) return Fail(MuxError::kProtocol);
+  }
+  // Whole frames are handled straight from |data|; only a trailing partial
+  // frame is copied.
+  const uint8_t* p = data;
+  size_t avail = len;
+  if (!in_.empty()) {
+    in_.insert(in_.end(), data, data + len);
+    p = in_.data();
+    avail = in_.size();
+  }
+  size_t pos = 0;
+  while (!failed_ && avail - pos >= kMuxHeaderSize) {
+    const uint8_t* h = p + pos;
+    const uint32_t payload = LoadLe32(h);
+    if (payload > kMuxMaxPayload) return Fail(MuxError::kProtocol);
+    if (avail - pos < kMuxHeaderSize + payload) break;
+    ProcessFrame(h[4], h[5], LoadLe32(h + 6), h + kMuxHeaderSize, payload);
+    pos += kMuxHeaderSize + payload;
+  }
+  if (failed_) return false;
+  if (p == in_.data()) {
+    in_.erase(in_.begin(), in_.begin() + pos);
+  } else {
+    in_.assign(data + pos, data + len);
+  }
+  return true;
+}
+
+bool MuxSession::ProcessFrame(uint8_t type, uint8_t flags, uint32_t stream,
+                              const uint8_t* p, size_t len) {
+  const MuxFrame frame = static_cast<MuxFrame>(type);
+  if (!hello_received_ && frame != MuxFrame::kHello) {
+    return Fail(MuxError::kProtocol);
+  }
+  const bool server = role_ == Role::kServer;
+  auto it = streams_.find(stream);
+
+  switch (frame) {
+    case MuxFrame::kHello: {
+      if (hello_received_ || len < 8) return Fail(MuxError::kProtocol);
+      const uint32_t version = LoadLe32(p);
+      const uint32_t window = LoadLe32(p + 4);
+      if (version < kMuxVersion || window == 0 || window > kMaxWindow) {
+        return Fail(MuxError::kProtocol);
+      }
+      hello_received_ = true;
+      peer_window_ = window;
+      Emit(MuxEventType::kHello, 0, version);
+      break;
+    }
+    case MuxFrame::kRequest: {
+      if (!server || len < kRequestSize || stream % 2 == 0 ||
+          stream <= last_stream_) {
+        return Fail(MuxError::kProtocol);
+      }
+      last_stream_ = stream;
+      if (going_away_ || streams_.size() >= kMuxMaxStreams) {
+        uint8_t code[4];
+        StoreLe32(code, static_cast<uint32_t>(MuxError::kRefused));
+        PutFrame(MuxFrame::kReset, 0, stream, code, sizeof(code));
+        break;
+      }
+      Stream& s = streams_[stream];
+      s.priority = std::min(p[0], kMuxLowestPriority);
+      s.send_window = peer_window_;
+      Emit(MuxEventType::kRequest, stream, LoadLe32(p + 1), LoadLe64(p + 5),
+           LoadLe64(p + 13), s.priority);
+      break;
+    }
+    case MuxFrame::kHeaders:
+      if (server || len < 8 || stream == 0 || stream > last_stream_) {
+        return Fail(MuxError::kProtocol);
+      }
+      if (it == streams_.end()) break;  // We reset it.
+      Emit(MuxEventType::kHeaders, stream, LoadLe64(p));
+      events_.back().data.assign(p + 8, p + len);
+      break;
+    case MuxFrame::kData:
+      if (server || stream == 0 || stream > last_stream_) {
+        return Fail(MuxError::kProtocol);
+      }
+      if (static_cast<int64_t>(len) > conn_recv_window_) {
+        return Fail(MuxError::kFlowControl);
+      }
+      conn_recv_window_ -= len;
+      if (it == streams_.end()) {
+        // Still in flight when we reset the stream; nobody will consume
+        // it, so hand the connection window back now.
+        Consumed(stream, len);
+        break;
+      }
+      if (static_cast<int64_t>(len) > it->second.recv_window) {
+        return Fail(MuxError::kFlowControl);
+      }
+      it->second.recv_window -= len;
+      if (len > 0) {
+        Emit(MuxEventType::kData, stream);
+        events_.back().data.assign(p, p + len);
+      }
+      if (flags & kMuxFlagEnd) {
+        Emit(MuxEventType::kEnd, stream);
+        streams_.erase(it);
+      }
+      break;
+    case MuxFrame::kWindow: {
+      if (len < 4 || LoadLe32(p) == 0) return Fail(MuxError::kProtocol);
+      const int64_t increment = LoadLe32(p);
+      int64_t* window = nullptr;
+      if (stream == 0) {
+        window = &conn_send_window_;
+      } else if (it != streams_.end()) {
+        window = &it->second.send_window;
+      }
+      if (window == nullptr) break;
+      if (*window + increment > kMaxWindow) {
+        return Fail(MuxError::kFlowControl);
+      }
+      *window += increment;
+      break;
+    }
+    case MuxFrame::kPriority:
+      if (!server || len < 1) return Fail(MuxError::kProtocol);
+      if (it != streams_.end()) {
+        it->second.priority = std::min(p[0], kMuxLowestPriority);
+      }
+      break;
+    case MuxFrame::kReset:
+      if (len < 4) return Fail(MuxError::kProtocol);
+      if (it != streams_.end()) {
+        streams_.erase(it);
+        Emit(MuxEventType::kReset, stream, LoadLe32(p));
+      }
+      break;
+    case MuxFrame::kPing:
+      if (len < 8) return Fail(MuxError::kProtocol);
+      if (flags & kMuxFlagAck) {
+        Emit(MuxEventType::kPong, 0, LoadLe64(p));
+      } else {
+        PutFrame(MuxFrame::kPing, kMuxFlagAck, 0, p, 8);
+      }
+      break;
+    case MuxFrame::kGoAway:
+      if (len < 4) return Fail(MuxError::kProtocol);
+      going_away_ = true;
+      Emit(MuxEventType::kGoAway, 0, LoadLe32(p));
+      break;
+    default:
+      break;  // Unknown frame types are skipped, for later extensions.
+  }
+  return !failed_;
+}
+
+bool MuxSession::NextEvent(MuxEvent* out) {
+  if (events_.empty()) return false;
+  *out = std::move(events_.front());
+  events_.pop_front();
+  return true;
+}
+
+uint32_t MuxSession::Request(uint32_t index, uint64_t offset, uint64_t length,
+                             uint8_t priority) {
+  if (role_ != Role::kClient || failed_ || going_away_ ||
+      streams_.size() >= kMuxMaxStreams) {
+    return 0;
+  }
+  const uint32_t stream = last_stream_ == 0 ? 1 : last_stream_ + 2;
+  last_stream_ = stream;
+  Stream& s = streams_[stream];
+  s.priority = std::min(priority, kMuxLowestPriority);
+  uint8_t payload[kRequestSize];
+  payload[0] = s.priority;
+  StoreLe32(payload + 1, index);
+  StoreLe64(payload + 5, offset);
+  StoreLe64(payload + 13, length);
+  PutFrame(MuxFrame::kRequest, 0, stream, payload, sizeof(payload));
+  return stream;
+}
+
+void MuxSession::SetPriority(uint32_t stream, uint8_t priority) {
+  auto it = streams_.find(stream);
+  if (role_ != Role::kClient || it == streams_.end()) return;
+  it->second.priority = std::min(priority, kMuxLowestPriority);
+  PutFrame(MuxFrame::kPriority, 0, stream, &it->second.priority, 1);
+}
+
+void MuxSession::Consumed(uint32_t stream, size_t len) {
+  if (role_ != Role::kClient || len == 0) return;
+  conn_unacked_ += len;
+  if (conn_unacked_ >= kMuxConnectionWindow / 2) {
+    PutWindow(0, static_cast<uint32_t>(conn_unacked_));
+    conn_recv_window_ += conn_unacked_;
+    conn_unacked_ = 0;
+  }
+  auto it = streams_.find(stream);
+  if (it == streams_.end()) return;
+  Stream& s = it->second;
+  s.unacked += len;
+  if (s.unacked >= kMuxStreamWindow / 2) {
+    PutWindow(stream, static_cast<uint32_t>(s.unacked));
+    s.recv_window += s.unacked;
+    s.unacked = 0;
+  }
+}
+
+void MuxSession::Respond(uint32_t stream, uint64_t size,
+                         const uint8_t* metadata, size_t len) {
+  if (role_ != Role::kServer || streams_.count(stream) == 0) return;
+  len = std::min<size_t>(len, kMuxMaxPayload - 8);
+  std::vector<uint8_t> payload(8 + len);
+  StoreLe64(payload.data(), size);
+  if (len > 0) std::memcpy(payload.data() + 8, metadata, len);
+  PutFrame(MuxFrame::kHeaders, 0, stream, payload.data(), payload.size());
+}
+
+size_t MuxSession::Writable(uint32_t stream) const {
+  auto it = streams_.find(stream);
+  if (it == streams_.end() || it->second.end_queued) return 0;
+  return kMuxStreamBuffer - Buffered(it->second);
+}
+
+size_t MuxSession::Write(uint32_t stream, const uint8_t* data, size_t len) {
+  const size_t n = std::min(len, Writable(stream));
+  if (n == 0) return 0;
+  Stream& s = streams_[stream];
+  if (s.buf_read > 0 && s.buf_read * 2 >= s.buf.size()) {
+    s.buf.erase(s.buf.begin(), s.buf.begin() + s.buf_read);
+    s.buf_read = 0;
+  }
+  s.buf.insert(s.buf.end(), data, data + n);
+  return n;
+}
+
+void MuxSession::End(uint32_t stream) {
+  auto it = streams_.find(stream);
+  if (role_ == Role::kServer && it != streams_.end()) {
+    it->second.end_queued = true;
+  }
+}
+
+void MuxSession::Reset(uint32_t stream, MuxError code) {
+  if (streams_.erase(stream) == 0) return;
+  uint8_t payload[4];
+  StoreLe32(payload, static_cast<uint32_t>(code));
+  PutFrame(MuxFrame::kReset, 0, stream, payload, sizeof(payload));
+}
+
+void MuxSession::Ping(uint64_t value) {
+  uint8_t payload[8];
+  StoreLe64(payload, value);
+  PutFrame(MuxFrame::kPing, 0, 0, payload, sizeof(payload));
+}
+
+void MuxSession::GoAway(MuxError code) {
+  going_away_ = true;
+  uint8_t payload[4];
+  StoreLe32(payload, static_cast<uint32_t>(code));
+  PutFrame(MuxFrame::kGoAway, 0, 0, payload, sizeof(payload));
+}
+
+size_t MuxSession::Pending() const {
+  size_t n = out_.size() - out_read_ + control_.size();
+  int64_t conn = conn_send_window_;
+  for (const auto& entry : streams_) {
+    if (n >= kMuxOutputLimit) break;
+    const Stream& s = entry.second;
+    const size_t buffered = Buffered(s);
+    size_t sendable = 0;
+    if (conn > 0 && s.send_window > 0) {
+      sendable = static_cast<size_t>(
+          std::min<int64_t>(buffered, std::min(s.send_window, conn)));
+    }
+    conn -= sendable;
+    if (sendable > 0) {
+      n += sendable + kMuxHeaderSize * ((sendable + kMuxDataFrame - 1) /
+                                        kMuxDataFrame);
+    } else if (s.end_queued && buffered == 0) {
+      n += kMuxHeaderSize;
+    }
+  }
+  return std::min(n, kMuxOutputLimit);
+}
+
+size_t MuxSession::Read(uint8_t* out, size_t cap) {
+  size_t n = 0;
+  while (n < cap) {
+    if (out_read_ == out_.size()) {
+      out_.clear();
+      out_read_ = 0;
+      if (!control_.empty()) {
+        out_.swap(control_);
+      } else if (!NextDataFrame()) {
+        break;
+      }
+    }
+    const size_t take = std::min(cap - n, out_.size() - out_read_);
+    std::memcpy(out + n, out_.data() + out_read_, take);
+    out_read_ += take;
+    n += take;
+  }
+  return n;
+}
+
+bool MuxSession::NextDataFrame() {
+  auto can_send = [this](const Stream& s) {
+    const size_t buffered = Buffered(s);
+    if (buffered == 0) return s.end_queued;
+    return s.send_window > 0 && conn_send_window_ > 0;
+  };
+  int best = kMuxLowestPriority + 1;
+  for (const auto& entry : streams_) {
+    if (entry.second.priority < best && can_send(entry.second)) {
+      best = entry.second.priority;
+    }
+  }
+  if (best > kMuxLowestPriority) return false;
+
+  // Equal priorities take turns, starting after the last stream served.
+  auto it = streams_.upper_bound(rr_cursor_);
+  while (true) {
+    if (it == streams_.end()) it = streams_.begin();
+    if (it->second.priority == best && can_send(it->second)) break;
+    ++it;
+  }
+  Stream& s = it->second;
+  const size_t n = static_cast<size_t>(std::min<int64_t>(
+      std::min<int64_t>(Buffered(s), kMuxDataFrame),
+      std::min(s.send_window, conn_send_window_)));
+  const bool end = s.end_queued && Buffered(s) == n;
+  AppendHeader(&out_, MuxFrame::kData, end ? kMuxFlagEnd : 0, it->first, n);
+  out_.insert(out_.end(), s.buf.begin() + s.buf_read,
+              s.buf.begin() + s.buf_read + n);
+  s.buf_read += n;
+  if (s.buf_read == s.buf.size()) {
+    s.buf.clear();
+    s.buf_read = 0;
+  }
+  s.send_window -= n;
+  conn_send_window_ -= n;
+  rr_cursor_ = it->first;
+  if (end) streams_.erase(it);
+  return true;
+}
+
+void MuxSession::PutFrame(MuxFrame type, uint8_t flags, uint32_t stream,
+                          const uint8_t* payload, size_t len) {
+  AppendHeader(&control_, type, flags, stream, len);
+  control_.insert(control_.end(), payload, payload + len);
+}
+
+void MuxSession::PutWindow(uint32_t stream, uint32_t increment) {
+  uint8_t payload[4];
+  StoreLe32(payload, increment);
+  PutFrame(MuxFrame::kWindow, 0, stream, payload, sizeof(payload));
+}
+
+bool MuxSession::Fail(MuxError code) {
+  if (!failed_) {
+    failed_ = true;
+    GoAway(code);
+  }
+  return false;
+}
+
+void MuxSession::Emit(MuxEventType type, uint32_t stream, uint64_t a,
+                      uint64_t b, uint64_t c, uint64_t d) {
+  MuxEvent event;
+  event.type = type;
+  event.stream = stream;
+  event.a = a;
+  event.b = b;
+  event.c = c;
+  event.d = d;
+  events_.push_back(std::move(event));
+}
+
+}  // namespace zapshare
+
+namespace {
+
+// The C API keeps the last event alive so its bytes can be handed out
+// without a copy.
+struct MuxHandle {
+  explicit MuxHandle(bool server)
+      : session(server ? zapshare::MuxSession::Role::kServer
+                       : zapshare::MuxSession::Role::kClient) {}
+  zapshare::MuxSession session;
+  zapshare::MuxEvent event;
+};
+
+MuxHandle* Unwrap(ZsMuxSession* s) { return reinterpret_cast<MuxHandle*>(s); }
+
+const MuxHandle* Unwrap(const ZsMuxSession* s) {
+  return reinterpret_cast<const MuxHandle*>(s);
+}
+
+}  // namespace
+
+ZsMuxSession* zs_mux_new(int32_t server) {
+  return reinterpret_cast<ZsMuxSession*>(new MuxHandle(server != 0));
+}
+
+void zs_mux_free(ZsMuxSession* session) { delete Unwrap(session); }
+
+int32_t zs_mux_receive(ZsMuxSession* session, const uint8_t* data,
+                       size_t len) {
+  return Unwrap(session)->session.Receive(data, len) ? 1 : 0;
+}
+
+int32_t zs_mux_next_event(ZsMuxSession* session, uint64_t fields[5],
+                          const uint8_t** data, size_t* len) {
+  MuxHandle* h = Unwrap(session);
+  if (!h->session.NextEvent(&h->event)) return -1;
+  fields[0] = h->event.stream;
+  fields[1] = h->event.a;
+  fields[2] = h->event.b;
+  fields[3] = h->event.c;
+  fields[4] = h->event.d;
+  *data = h->event.data.data();
+  *len = h->event.data.size();
+  return static_cast<int32_t>(h->event.type);
+}
+
+uint32_t zs_mux_request(ZsMuxSession* session, uint32_t index,
+                        uint64_t offset, uint64_t length, uint8_t priority) {
+  return Unwrap(session)->session.Request(index, offset, length, priority);
+}
+
+void zs_mux_set_priority(ZsMuxSession* session, uint32_t stream,
+                         uint8_t priority) {
+  Unwrap(session)->session.SetPriority(stream, priority);
+}
+
+void zs_mux_consumed(ZsMuxSession* session, uint32_t stream, size_t len) {
+  Unwrap(session)->session.Consumed(stream, len);
+}
+
+void zs_mux_respond(ZsMuxSession* session, uint32_t stream, uint64_t size,
+                    const uint8_t* metadata, size_t len) {
+  Unwrap(session)->session.Respond(stream, size, metadata, len);
+}
+
+size_t zs_mux_writable(const ZsMuxSession* session, uint32_t stream) {
+  return Unwrap(session)->session.Writable(stream);
+}
+
+size_t zs_mux_write(ZsMuxSession* session, uint32_t stream,
+                    const uint8_t* data, size_t len) {
+  return Unwrap(session)->session.Write(stream, data, len);
+}
+
+void zs_mux_end(ZsMuxSession* session, uint32_t stream) {
+  Unwrap(session)->session.End(stream);
+}
+
+void zs_mux_reset(ZsMuxSession* session, uint32_t stream, uint32_t code) {
+  Unwrap(session)->session.Reset(stream,
+                                 static_cast<zapshare::MuxError>(code));
+}
+
+void zs_mux_ping(ZsMuxSession* session, uint64_t value) {
+  Unwrap(session)->session.Ping(value);
+}
+
+void zs_mux_go_away(ZsMuxSession* session, uint32_t code) {
+  Unwrap(session)->session.GoAway(static_cast<zapshare::MuxError>(code));
+}
+
+size_t zs_mux_pending(const ZsMuxSession* session) {
+  return Unwrap(session)->session.Pending();
+}
+
+size_t zs_mux_read(ZsMuxSession* session, uint8_t* out, size_t cap) {
+  return Unwrap(session)->session.Read(out, cap);
+}
+
+uint32_t zs_mux_open_streams(const ZsMuxSession* session) {
+  return static_cast<uint32_t>(Unwrap(session)->session.open_streams());
+}
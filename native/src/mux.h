@@ -0,0 +1,235 @@
+#ifndef ZAPSHARE_NATIVE_MUX_H_
+#define ZAPSHARE_NATIVE_MUX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// Version 2 of the TCP transfer protocol: many files and control messages
+// over one connection as framed, flow-controlled, prioritised streams.
+//
+// Version 1 is the line protocol (LIST, GET n, ACK) with one file per
+// connection. A v2 client opens with the magic "ZSM2", which can't start a
+// v1 request, so both versions share the port and old peers keep working.
+// Both sides then send HELLO. Frames, little-endian:
+//
+//   le32 payload length | u8 type | u8 flags | le32 stream id | payload
+//
+//   HELLO     stream 0  le32 version, le32 initial stream window
+//   REQUEST   client    u8 priority, le32 file index, le64 offset,
+//                       le64 length (kMuxToEnd for the rest of the file)
+//   HEADERS   server    le64 body size, metadata (JSON, up to the app)
+//   DATA      server    body bytes; kMuxFlagEnd on the last frame
+//   WINDOW    either    le32 increment; stream 0 is the connection window
+//   PRIORITY  client    u8 priority
+//   RESET     either    le32 MuxError; abandons the stream
+//   PING      either    le64 value; kMuxFlagAck on the answer
+//   GOAWAY    either    le32 MuxError; no new streams, close after
+//
+// Client stream ids are odd and increasing. Requests aren't flow
+// controlled, so a client can pipeline up to kMuxMaxStreams of them; index
+// kMuxListIndex asks for the file list instead of a file. DATA is limited
+// by a per-stream window and a connection window, both reopened by WINDOW
+// frames as the client writes bytes out. Among streams that may send, the
+// lowest priority value goes first and equal priorities take turns a frame
+// at a time, so a thumbnail or the file list isn't stuck behind a video.
+//
+// MuxSession does no I/O: socket bytes go in with Receive(), frames to
+// send come out of Read(), and what happened is polled with NextEvent().
+
+constexpr uint32_t kMuxVersion = 2;
+constexpr size_t kMuxHeaderSize = 10;
+constexpr uint32_t kMuxMaxPayload = 64 * 1024;
+constexpr uint32_t kMuxDataFrame = 32 * 1024;
+constexpr uint32_t kMuxStreamWindow = 1024 * 1024;
+constexpr uint32_t kMuxConnectionWindow = 16 * 1024 * 1024;
+constexpr uint32_t kMuxMaxStreams = 256;
+constexpr size_t kMuxStreamBuffer = 256 * 1024;  // Queued body per stream.
+constexpr size_t kMuxOutputLimit = 256 * 1024;   // Cap on Pending().
+constexpr uint32_t kMuxListIndex = 0xFFFFFFFF;
+constexpr uint64_t kMuxToEnd = ~0ull;
+constexpr uint8_t kMuxDefaultPriority = 3;
+constexpr uint8_t kMuxLowestPriority = 7;
+constexpr uint8_t kMuxFlagEnd = 1;
+constexpr uint8_t kMuxFlagAck = 1;
+
+enum class MuxFrame : uint8_t {
+  kHello = 0,
+  kRequest = 1,
+  kHeaders = 2,
+  kData = 3,
+  kWindow = 4,
+  kPriority = 5,
+  kReset = 6,
+  kPing = 7,
+  kGoAway = 8,
+};
+
+enum class MuxError : uint32_t {
+  kNone = 0,
+  kProtocol = 1,
+  kFlowControl = 2,
+  kRefused = 3,   // Too many open streams; retry later.
+  kCancel = 4,
+  kNotFound = 5,  // No such file.
+  kInternal = 6,  // The file couldn't be read.
+};
+
+enum class MuxEventType : int32_t {
+  kHello = 0,    // a: peer version
+  kRequest = 1,  // a: file index, b: offset, c: length, d: priority
+  kHeaders = 2,  // a: body size, data: metadata
+  kData = 3,     // data: body bytes
+  kEnd = 4,      // Body complete.
+  kReset = 5,    // a: MuxError
+  kPong = 6,     // a: value of our PING
+  kGoAway = 7,   // a: MuxError
+};
+
+struct MuxEvent {
+  MuxEventType type = MuxEventType::kHello;
+  uint32_t stream = 0;
+  uint64_t a = 0;
+  uint64_t b = 0;
+  uint64_t c = 0;
+  uint64_t d = 0;
+  std::vector<uint8_t> data;
+};
+
+class MuxSession {
+ public:
+  enum class Role { kClient, kServer };
+
+  explicit MuxSession(Role role);
+
+  // Socket input. False once the peer broke the protocol; a GOAWAY is
+  // queued and the connection should be closed once it's sent.
+  bool Receive(const uint8_t* data, size_t len);
+  bool NextEvent(MuxEvent* out);
+
+  // Client: opens a stream and returns its id, or 0 when kMuxMaxStreams
+  // are open or the session is closing.
+  uint32_t Request(uint32_t index, uint64_t offset, uint64_t length,
+                   uint8_t priority);
+  void SetPriority(uint32_t stream, uint8_t priority);
+  // Client: body bytes the app has written out, which reopens the windows.
+  void Consumed(uint32_t stream, size_t len);
+
+  // Server: answers a request. Call before the first Write().
+  void Respond(uint32_t stream, uint64_t size, const uint8_t* metadata,
+               size_t len);
+  // Server: body bytes the app may still queue on |stream|.
+  size_t Writable(uint32_t stream) const;
+  // Server: queues up to Writable(stream) bytes and returns how many.
+  size_t Write(uint32_t stream, const uint8_t* data, size_t len);
+  void End(uint32_t stream);
+
+  void Reset(uint32_t stream, MuxError code);
+  void Ping(uint64_t value);
+  void GoAway(MuxError code);
+
+  // Frames ready to send, capped at kMuxOutputLimit; 0 means nothing can
+  // go out until more input or data arrives. Control frames overtake
+  // queued DATA at the next frame boundary.
+  size_t Pending() const;
+  size_t Read(uint8_t* out, size_t cap);
+
+  size_t open_streams() const { return streams_.size(); }
+  bool failed() const { return failed_; }
+
+ private:
+  struct Stream {
+    uint8_t priority = kMuxDefaultPriority;
+    // Server side.
+    std::vector<uint8_t> buf;
+    size_t buf_read = 0;
+    int64_t send_window = 0;
+    bool end_queued = false;
+    // Client side.
+    int64_t recv_window = kMuxStreamWindow;
+    uint64_t unacked = 0;
+  };
+
+  bool ProcessFrame(uint8_t type, uint8_t flags, uint32_t stream,
+                    const uint8_t* p, size_t len);
+  bool NextDataFrame();
+  size_t Buffered(const Stream& s) const { return s.buf.size() - s.buf_read; }
+  void PutFrame(MuxFrame type, uint8_t flags, uint32_t stream,
+                const uint8_t* payload, size_t len);
+  void PutWindow(uint32_t stream, uint32_t increment);
+  bool Fail(MuxError code);
+  void Emit(MuxEventType type, uint32_t stream, uint64_t a = 0,
+            uint64_t b = 0, uint64_t c = 0, uint64_t d = 0);
+
+  const Role role_;
+  bool failed_ = false;
+  bool going_away_ = false;
+  bool hello_received_ = false;
+
+  // Input: the client's magic, then a header and payload per frame.
+  size_t magic_left_;
+  std::vector<uint8_t> in_;
+
+  std::map<uint32_t, Stream> streams_;
+  uint32_t last_stream_ = 0;   // Highest stream id opened so far.
+  uint32_t rr_cursor_ = 0;     // Last stream that sent DATA.
+  int64_t peer_window_ = kMuxStreamWindow;  // From the peer's HELLO.
+  int64_t conn_send_window_ = kMuxConnectionWindow;
+  int64_t conn_recv_window_ = kMuxConnectionWindow;
+  uint64_t conn_unacked_ = 0;
+
+  std::deque<MuxEvent> events_;
+  std::vector<uint8_t> control_;  // Whole control frames, sent first.
+  std::vector<uint8_t> out_;      // Frame being handed out by Read().
+  size_t out_read_ = 0;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsMuxSession ZsMuxSession;
+
+ZS_EXPORT ZsMuxSession* zs_mux_new(int32_t server);
+ZS_EXPORT void zs_mux_free(ZsMuxSession* session);
+ZS_EXPORT int32_t zs_mux_receive(ZsMuxSession* session, const uint8_t* data,
+                                 size_t len);
+// Returns the MuxEventType of the next event, or -1 if none is ready.
+// |fields| receives stream, a, b, c and d; |data| points at the event's
+// bytes, owned by |session| and valid until the next call.
+ZS_EXPORT int32_t zs_mux_next_event(ZsMuxSession* session,
+                                    uint64_t fields[5], const uint8_t** data,
+                                    size_t* len);
+ZS_EXPORT uint32_t zs_mux_request(ZsMuxSession* session, uint32_t index,
+                                  uint64_t offset, uint64_t length,
+                                  uint8_t priority);
+ZS_EXPORT void zs_mux_set_priority(ZsMuxSession* session, uint32_t stream,
+                                   uint8_t priority);
+ZS_EXPORT void zs_mux_consumed(ZsMuxSession* session, uint32_t stream,
+                               size_t len);
+ZS_EXPORT void zs_mux_respond(ZsMuxSession* session, uint32_t stream,
+                              uint64_t size, const uint8_t* metadata,
+                              size_t len);
+ZS_EXPORT size_t zs_mux_writable(const ZsMuxSession* session,
+                                 uint32_t stream);
+ZS_EXPORT size_t zs_mux_write(ZsMuxSession* session, uint32_t stream,
+                              const uint8_t* data, size_t len);
+ZS_EXPORT void zs_mux_end(ZsMuxSession* session, uint32_t stream);
+ZS_EXPORT void zs_mux_reset(ZsMuxSession* session, uint32_t stream,
+                            uint32_t code);
+ZS_EXPORT void zs_mux_ping(ZsMuxSession* session, uint64_t value);
+ZS_EXPORT void zs_mux_go_away(ZsMuxSession* session, uint32_t code);
+ZS_EXPORT size_t zs_mux_pending(const ZsMuxSession* session);
+ZS_EXPORT size_t zs_mux_read(ZsMuxSession* session, uint8_t* out,
+                             size_t cap);
+ZS_EXPORT uint32_t zs_mux_open_streams(const ZsMuxSession* session);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_MUX_H_
@@ -0,0 +1,207 @@
+#include "path_manager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace zapshare {
+namespace {
+
+uint64_t SteadyNowNs() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Weight of the newest window in a path's rate.
+constexpr double kRateSmoothing = 0.5;
+
+}  // namespace
+
+PathManager::PathManager(Clock now)
+    : now_(now ? std::move(now) : Clock(SteadyNowNs)) {}
+
+int32_t PathManager::AddPath(const std::string& local,
+                             const std::string& remote) {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (size_t i = 0; i < paths_.size(); i++) {
+    if (paths_[i].local == local && paths_[i].remote == remote) {
+      return static_cast<int32_t>(i);
+    }
+  }
+  Path p;
+  p.local = local;
+  p.remote = remote;
+  paths_.push_back(std::move(p));
+  return static_cast<int32_t>(paths_.size() - 1);
+}
+
+size_t PathManager::size() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return paths_.size();
+}
+
+std::string PathManager::local(int32_t path) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return paths_[path].local;
+}
+
+std::string PathManager::remote(int32_t path) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return paths_[path].remote;
+}
+
+bool PathManager::Up(const Path& p, uint64_t now) const {
+  return p.failures < kMaxPathFailures && p.retry_at <= now;
+}
+
+void PathManager::Account(Path* p, uint64_t now) {
+  if (p->in_flight > 0) p->window_ns += now - p->busy_since;
+  p->busy_since = now;
+  if (p->window_ns < kPathRateWindowNs) return;
+  const double sample = static_cast<double>(p->window_bytes) * 1e9 /
+                        static_cast<double>(p->window_ns);
+  p->rate = p->measured
+                ? p->rate + kRateSmoothing * (sample - p->rate)
+                : sample;
+  p->measured = true;
+  p->window_ns = 0;
+  p->window_bytes = 0;
+}
+
+int32_t PathManager::Assign(uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(mu_);
+  const uint64_t now = now_();
+  double best_rate = 0;
+  for (Path& p : paths_) {
+    Account(&p, now);
+    if (p.measured) best_rate = std::max(best_rate, p.rate);
+  }
+  // Unmeasured paths are assumed as fast as the best; with none measured
+  // every path counts the same and the least loaded wins.
+  if (best_rate <= 0) best_rate = 1;
+
+  int32_t best = -1;
+  double best_finish = 0;
+  bool any_left = false;
+  for (size_t i = 0; i < paths_.size(); i++) {
+    const Path& p = paths_[i];
+    if (p.failures >= kMaxPathFailures) continue;
+    any_left = true;
+    if (!Up(p, now)) continue;
+    const double rate = std::max(p.measured ? p.rate : best_rate, 1.0);
+    const double finish = static_cast<double>(p.queued + bytes) / rate;
+    if (best < 0 || finish < best_finish) {
+      best = static_cast<int32_t>(i);
+      best_finish = finish;
+    }
+  }
+  if (best < 0) return any_left ? kAllPathsDown : kNoPathsLeft;
+  Path& p = paths_[best];
+  p.queued += bytes;
+  p.in_flight++;
+  return best;
+}
+
+void PathManager::Delivered(int32_t path, uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(mu_);
+  Path& p = paths_[path];
+  p.queued -= std::min(bytes, p.queued);
+  p.delivered += bytes;
+  p.window_bytes += bytes;
+  Account(&p, now_());
+}
+
+void PathManager::Release(int32_t path, uint64_t undelivered, bool failed) {
+  std::lock_guard<std::mutex> lock(mu_);
+  const uint64_t now = now_();
+  Path& p = paths_[path];
+  Account(&p, now);
+  p.queued -= std::min(undelivered, p.queued);
+  if (p.in_flight > 0) p.in_flight--;
+  // Pieces from before a drop may still finish, or end late; neither says
+  // anything about the path as it is now.
+  const bool stale = p.stale > 0;
+  if (stale) p.stale--;
+  if (!failed) {
+    if (!stale) p.failures = 0;
+    return;
+  }
+  // Every stream on a path that drops fails at once; that's one failure.
+  if (p.retry_at > now) return;
+  p.failures++;
+  p.drops++;
+  p.stale = p.in_flight;
+  const uint64_t backoff = std::min(
+      kPathRetryAfterNs << std::min<uint32_t>(p.failures - 1, 16),
+      kPathMaxRetryAfterNs);
+  p.retry_at = now + backoff;
+  p.window_ns = 0;
+  p.window_bytes = 0;
+}
+
+PathStats PathManager::Stats(int32_t path) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  const Path& p = paths_[path];
+  PathStats s;
+  s.rate = p.measured ? static_cast<uint64_t>(p.rate) : 0;
+  s.queued = p.queued;
+  s.delivered = p.delivered;
+  s.in_flight = p.in_flight;
+  s.failures = p.failures;
+  s.drops = p.drops;
+  s.up = Up(p, now_());
+  return s;
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::PathManager* Unwrap(ZsPathManager* m) {
+  return reinterpret_cast<zapshare::PathManager*>(m);
+}
+
+const zapshare::PathManager* Unwrap(const ZsPathManager* m) {
+  return reinterpret_cast<const zapshare::PathManager*>(m);
+}
+
+}  // namespace
+
+ZsPathManager* zs_path_manager_new(void) {
+  return reinterpret_cast<ZsPathManager*>(new zapshare::PathManager());
+}
+
+void zs_path_manager_free(ZsPathManager* manager) { delete Unwrap(manager); }
+
+int32_t zs_path_manager_add(ZsPathManager* manager, const char* local,
+                            const char* remote) {
+  return Unwrap(manager)->AddPath(local, remote);
+}
+
+int32_t zs_path_manager_assign(ZsPathManager* manager, uint64_t bytes) {
+  return Unwrap(manager)->Assign(bytes);
+}
+
+void zs_path_manager_delivered(ZsPathManager* manager, int32_t path,
+                               uint64_t bytes) {
+  Unwrap(manager)->Delivered(path, bytes);
+}
+
+void zs_path_manager_release(ZsPathManager* manager, int32_t path,
+                             uint64_t undelivered, int32_t failed) {
+  Unwrap(manager)->Release(path, undelivered, failed != 0);
+}
+
+void zs_path_manager_stats(const ZsPathManager* manager, int32_t path,
+                           uint64_t out[7]) {
+  const zapshare::PathStats s = Unwrap(manager)->Stats(path);
+  out[0] = s.rate;
+  out[1] = s.queued;
+  out[2] = s.delivered;
+  out[3] = s.in_flight;
+  out[4] = s.failures;
+  out[5] = s.up ? 1 : 0;
+  out[6] = s.drops;
+}
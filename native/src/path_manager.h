@@ -0,0 +1,135 @@
+#ifndef ZAPSHARE_NATIVE_PATH_MANAGER_H_
+#define ZAPSHARE_NATIVE_PATH_MANAGER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// Spreads one download over every network path to a peer: Wi-Fi,
+// Ethernet, a Wi-Fi Direct group, whichever it has beacons arriving on.
+//
+// A path is a local address to bind to plus the peer's address on the
+// same network, as learnt from discovery. Range streams ask Assign() for
+// a path before each piece; it picks the one that would finish the piece
+// soonest given the bytes already queued on it and its measured rate, so
+// a 300 Mbit/s Ethernet link takes about three times the work of a
+// 100 Mbit/s Wi-Fi one and stays busy as long as the slower link does.
+//
+// Rates are the path's aggregate throughput, bytes delivered over the
+// time it had at least one piece in flight, smoothed over windows of
+// kPathRateWindowNs. A path not measured yet is assumed as fast as the
+// best one so it gets tried.
+//
+// A path that drops is Fail()ed: its in-flight pieces are retried
+// elsewhere from where they stopped, and it's left alone for a backoff
+// that doubles with each failure in a row. After kMaxPathFailures in a
+// row it's given up on. A piece assigned after the drop going through in
+// full clears the count; bytes still trickling in from before it don't.
+
+constexpr uint64_t kPathRateWindowNs = 100'000'000;      // 100 ms
+constexpr uint64_t kPathRetryAfterNs = 1'000'000'000;    // 1 s, doubling
+constexpr uint64_t kPathMaxRetryAfterNs = 30'000'000'000;
+constexpr uint32_t kMaxPathFailures = 4;
+
+// What Assign() returns when there's no path to use.
+constexpr int32_t kAllPathsDown = -1;  // Until one's backoff runs out.
+constexpr int32_t kNoPathsLeft = -2;   // Every path was given up on.
+
+struct PathStats {
+  uint64_t rate = 0;        // Bytes per second; 0 until measured.
+  uint64_t queued = 0;      // Assigned bytes not delivered yet.
+  uint64_t delivered = 0;
+  uint32_t in_flight = 0;   // Pieces.
+  uint32_t failures = 0;    // In a row.
+  uint32_t drops = 0;       // Ever; never cleared.
+  bool up = true;           // False while backing off or given up.
+};
+
+class PathManager {
+ public:
+  // Nanoseconds on a monotonic clock; injectable for tests.
+  using Clock = std::function<uint64_t()>;
+
+  explicit PathManager(Clock now = nullptr);
+
+  PathManager(const PathManager&) = delete;
+  PathManager& operator=(const PathManager&) = delete;
+
+  // Adds the path from |local| (empty for any) to |remote| and returns its
+  // id, or the id it already has.
+  int32_t AddPath(const std::string& local, const std::string& remote);
+  size_t size() const;
+  std::string local(int32_t path) const;
+  std::string remote(int32_t path) const;
+
+  // The path to fetch the next |bytes| over, which are counted as queued
+  // on it until delivered or released, or kAllPathsDown/kNoPathsLeft.
+  int32_t Assign(uint64_t bytes);
+  // |bytes| more of |path|'s work arrived.
+  void Delivered(int32_t path, uint64_t bytes);
+  // A piece on |path| is over; |undelivered| of its bytes never arrived.
+  // |failed| marks the path down; a piece assigned since the last drop
+  // finishing without it brings the path's failure count back to 0.
+  void Release(int32_t path, uint64_t undelivered, bool failed);
+
+  PathStats Stats(int32_t path) const;
+
+ private:
+  struct Path {
+    std::string local;
+    std::string remote;
+    double rate = 0;  // Bytes per second, once |measured|.
+    bool measured = false;
+    uint64_t queued = 0;
+    uint64_t delivered = 0;
+    uint32_t in_flight = 0;
+    uint32_t failures = 0;
+    uint32_t drops = 0;
+    uint32_t stale = 0;  // Of in_flight, pieces assigned before a drop.
+    uint64_t retry_at = 0;
+    uint64_t busy_since = 0;   // While in_flight > 0.
+    uint64_t window_ns = 0;    // Busy time and bytes since the last sample.
+    uint64_t window_bytes = 0;
+  };
+
+  bool Up(const Path& p, uint64_t now) const;
+  // Adds the busy time up to |now| to |p|'s window and, once it spans
+  // kPathRateWindowNs, folds the window into its rate.
+  void Account(Path* p, uint64_t now);
+
+  const Clock now_;
+  mutable std::mutex mu_;
+  std::vector<Path> paths_;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsPathManager ZsPathManager;
+
+ZS_EXPORT ZsPathManager* zs_path_manager_new(void);
+ZS_EXPORT void zs_path_manager_free(ZsPathManager* manager);
+// |local| may be empty to use any interface.
+ZS_EXPORT int32_t zs_path_manager_add(ZsPathManager* manager,
+                                      const char* local, const char* remote);
+ZS_EXPORT int32_t zs_path_manager_assign(ZsPathManager* manager,
+                                         uint64_t bytes);
+ZS_EXPORT void zs_path_manager_delivered(ZsPathManager* manager,
+                                         int32_t path, uint64_t bytes);
+ZS_EXPORT void zs_path_manager_release(ZsPathManager* manager, int32_t path,
+                                       uint64_t undelivered, int32_t failed);
+// rate, queued, delivered, in_flight, failures, up, drops.
+ZS_EXPORT void zs_path_manager_stats(const ZsPathManager* manager,
+                                     int32_t path, uint64_t out[7]);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_PATH_MANAGER_H_
@@ -0,0 +1,176 @@
+#include "peer_table.h"
+
+#include <algorithm>
+
+namespace zapshare {
+
+namespace {
+
+constexpr size_t kInitialCapacity = 16;
+
+// splitmix64's finalizer: device ids are hashes already, but addresses on
+// one subnet differ only in their low bits.
+uint64_t Mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+}  // namespace
+
+FlatIndex::FlatIndex()
+    : entries_(kInitialCapacity, Entry{0, 0}), mask_(kInitialCapacity - 1) {}
+
+size_t FlatIndex::Home(uint64_t key) const {
+  return static_cast<size_t>(Mix(key)) & mask_;
+}
+
+uint32_t FlatIndex::Find(uint64_t key) const {
+  if (key == 0) return kNone;
+  for (size_t i = Home(key);; i = (i + 1) & mask_) {
+    const Entry& e = entries_[i];
+    if (e.key == key) return e.value;
+    if (e.key == 0) return kNone;
+  }
+}
+
+void FlatIndex::Insert(uint64_t key, uint32_t value) {
+  // At most three quarters full, so probe runs stay short.
+  if ((size_ + 1) * 4 > entries_.size() * 3) Grow();
+  size_t i = Home(key);
+  while (entries_[i].key != 0 && entries_[i].key != key) {
+    i = (i + 1) & mask_;
+  }
+  if (entries_[i].key == 0) size_++;
+  entries_[i] = {key, value};
+}
+
+bool FlatIndex::Erase(uint64_t key) {
+  if (key == 0) return false;
+  size_t hole = Home(key);
+  while (entries_[hole].key != key) {
+    if (entries_[hole].key == 0) return false;
+    hole = (hole + 1) & mask_;
+  }
+  // Moves back every later entry of the run that may sit in the hole,
+  // which is any whose home isn't cyclically in (hole, i].
+  for (size_t i = (hole + 1) & mask_; entries_[i].key != 0;
+       i = (i + 1) & mask_) {
+    const size_t home = Home(entries_[i].key);
+    const bool stays = hole < i ? hole < home && home <= i
+                                : hole < home || home <= i;
+    if (!stays) {
+      entries_[hole] = entries_[i];
+      hole = i;
+    }
+  }
+  entries_[hole].key = 0;
+  size_--;
+  return true;
+}
+
+void FlatIndex::Grow() {
+  std::vector<Entry> old(entries_.size() * 2, Entry{0, 0});
+  old.swap(entries_);
+  mask_ = entries_.size() - 1;
+  for (const Entry& e : old) {
+    if (e.key == 0) continue;
+    size_t i = Home(e.key);
+    while (entries_[i].key != 0) i = (i + 1) & mask_;
+    entries_[i] = e;
+  }
+}
+
+TimerWheel::TimerWheel(uint64_t tick_ms, uint64_t now_ms)
+    : tick_ms_(std::max<uint64_t>(tick_ms, 1)),
+      current_(now_ms / tick_ms_),
+      slots_(kLevels * kSlots, kNone) {}
+
+void TimerWheel::Schedule(uint32_t timer, uint64_t at_ms) {
+  if (timer >= nodes_.size()) nodes_.resize(timer + 1);
+  if (armed(timer)) Unlink(timer);
+  // Rounded up, so a timer never fires before |at_ms|.
+  const uint64_t tick = at_ms / tick_ms_ + (at_ms % tick_ms_ != 0);
+  nodes_[timer].tick = std::max(tick, current_);
+  Place(timer);
+}
+
+void TimerWheel::Cancel(uint32_t timer) {
+  if (armed(timer)) Unlink(timer);
+}
+
+bool TimerWheel::Pop(uint64_t now_ms, uint32_t* timer) {
+  const uint64_t target = now_ms / tick_ms_;
+  for (;;) {
+    const uint32_t head = slots_[current_ & (kSlots - 1)];
+    if (head != kNone) {
+      Unlink(head);
+      *timer = head;
+      return true;
+    }
+    if (current_ >= target) return false;
+    if (size_ == 0) {
+      current_ = target;
+      return false;
+    }
+    current_++;
+    // Every level whose slot just came round, the outermost first, as
+    // its timers may land in a slot of the next level in.
+    int level = 0;
+    while (level + 1 < kLevels &&
+           (current_ & ((1ull << (kSlotBits * (level + 1))) - 1)) == 0) {
+      level++;
+    }
+    for (; level > 0; level--) Cascade(level);
+  }
+}
+
+void TimerWheel::Place(uint32_t timer) {
+  Node& n = nodes_[timer];
+  const uint64_t delta = n.tick - current_;
+  int level = 0;
+  while (level + 1 < kLevels &&
+         delta >= 1ull << (kSlotBits * (level + 1))) {
+    level++;
+  }
+  // Beyond the outermost level: parked at its far end, and placed again
+  // from there.
+  const uint64_t span = 1ull << (kSlotBits * kLevels);
+  const uint64_t tick = delta < span ? n.tick : current_ + span - 1;
+  n.slot = level * kSlots + ((tick >> (kSlotBits * level)) & (kSlots - 1));
+  n.prev = kNone;
+  n.next = slots_[n.slot];
+  if (n.next != kNone) nodes_[n.next].prev = timer;
+  slots_[n.slot] = timer;
+  size_++;
+}
+
+void TimerWheel::Unlink(uint32_t timer) {
+  Node& n = nodes_[timer];
+  if (n.prev != kNone) {
+    nodes_[n.prev].next = n.next;
+  } else {
+    slots_[n.slot] = n.next;
+  }
+  if (n.next != kNone) nodes_[n.next].prev = n.prev;
+  n.slot = kNone;
+  size_--;
+}
+
+void TimerWheel::Cascade(int level) {
+  const size_t slot =
+      level * kSlots + ((current_ >> (kSlotBits * level)) & (kSlots - 1));
+  uint32_t timer = slots_[slot];
+  slots_[slot] = kNone;
+  while (timer != kNone) {
+    const uint32_t next = nodes_[timer].next;
+    nodes_[timer].slot = kNone;
+    size_--;
+    Place(timer);
+    timer = next;
+  }
+}
+
+}  // namespace zapshare
@@ -0,0 +1,106 @@
+#ifndef ZAPSHARE_NATIVE_PEER_TABLE_H_
+#define ZAPSHARE_NATIVE_PEER_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace zapshare {
+
+// The discovery engine's peer table is built from these two, so that
+// hearing a beacon and expiring a peer both cost the same with ten peers
+// on the LAN as with ten thousand.
+//
+// FlatIndex maps 64-bit keys (device ids, IPv4 addresses) to the slot of
+// the record in a dense array. It is open addressing with linear probing
+// in one flat array of 16-byte entries, four to a cache line, so a lookup
+// is one hash and usually one cache miss. Deletion shifts the rest of the
+// probe run back instead of leaving tombstones, so lookups never slow
+// down with churn.
+//
+// TimerWheel is a hierarchical timing wheel: four levels of 64 slots,
+// each slot an intrusive list of timers. Arming, re-arming and cancelling
+// a timer are O(1), and so is advancing past a tick with nothing due;
+// timers further out are cascaded down a level at a time as their tick
+// comes closer. There is no sweep over everything that's armed.
+
+class FlatIndex {
+ public:
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  FlatIndex();
+
+  // The value for |key|, or kNone. Key 0 is never present.
+  uint32_t Find(uint64_t key) const;
+  // Inserts or overwrites; |key| must not be 0.
+  void Insert(uint64_t key, uint32_t value);
+  // False if |key| wasn't there.
+  bool Erase(uint64_t key);
+  size_t size() const { return size_; }
+
+ private:
+  struct Entry {
+    uint64_t key;  // 0 when empty.
+    uint32_t value;
+  };
+
+  size_t Home(uint64_t key) const;
+  void Grow();
+
+  std::vector<Entry> entries_;
+  size_t mask_;
+  size_t size_ = 0;
+};
+
+class TimerWheel {
+ public:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 6;
+  static constexpr uint32_t kSlots = 1u << kSlotBits;
+
+  // Ticks every |tick_ms|, starting at |now_ms|.
+  TimerWheel(uint64_t tick_ms, uint64_t now_ms);
+
+  // (Re-)arms |timer|, any small integer the caller picks (an index in
+  // its own array), to fire at the first tick at or after |at_ms|.
+  void Schedule(uint32_t timer, uint64_t at_ms);
+  void Cancel(uint32_t timer);
+  bool armed(uint32_t timer) const {
+    return timer < nodes_.size() && nodes_[timer].slot != kNone;
+  }
+  size_t size() const { return size_; }
+
+  // Calls |fire(timer)| for every timer due by |now_ms|, tick by tick.
+  // |fire| may schedule or cancel any timer, the one firing included.
+  template <typename Fire>
+  void Advance(uint64_t now_ms, Fire&& fire) {
+    uint32_t timer;
+    while (Pop(now_ms, &timer)) fire(timer);
+  }
+
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  struct Node {
+    uint64_t tick = 0;  // Due.
+    uint32_t prev = kNone;
+    uint32_t next = kNone;
+    uint32_t slot = kNone;  // Into slots_; kNone when not armed.
+  };
+
+  // Detaches and returns one timer due by |now_ms|.
+  bool Pop(uint64_t now_ms, uint32_t* timer);
+  void Place(uint32_t timer);
+  void Unlink(uint32_t timer);
+  void Cascade(int level);
+
+  const uint64_t tick_ms_;
+  uint64_t current_;  // The tick being fired.
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> slots_;  // List heads, level by level.
+  size_t size_ = 0;
+};
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_PEER_TABLE_H_
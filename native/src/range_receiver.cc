@@ -0,0 +1,598 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // splice(), fallocate()
+#endif
+
+#include "range_receiver.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <windows.h>
+
+#include "mapped_file.h"
+#else
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace zapshare {
+
+#if defined(_WIN32)
+
+std::unique_ptr<RangeReceiver> RangeReceiver::Start(const ReceiveRequest&) {
+  return nullptr;
+}
+
+RangeReceiver::~RangeReceiver() = default;
+
+ReceiveStats RangeReceiver::stats() const { return ReceiveStats(); }
+
+bool PreallocateFile(const std::string& path, uint64_t size) {
+  HANDLE file = CreateFileW(WidenPath(path).c_str(), GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER current;
+  bool ok = GetFileSizeEx(file, &current) != 0;
+  if (ok && static_cast<uint64_t>(current.QuadPart) < size) {
+    FILE_ALLOCATION_INFO alloc;
+    alloc.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+    SetFileInformationByHandle(file, FileAllocationInfo, &alloc,
+                               sizeof(alloc));
+    LARGE_INTEGER to;
+    to.QuadPart = static_cast<LONGLONG>(size);
+    ok = SetFilePointerEx(file, to, nullptr, FILE_BEGIN) &&
+         SetEndOfFile(file);
+  }
+  CloseHandle(file);
+  return ok;
+}
+
+#else
+
+namespace {
+
+constexpr size_t kBufferSize = 1024 * 1024;
+constexpr size_t kMaxHeaderBytes = 64 * 1024;
+constexpr int kIdleTimeoutSeconds = 30;
+constexpr std::chrono::milliseconds kPausePoll(50);
+
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+#if defined(SOCK_CLOEXEC)
+constexpr int kSocketFlags = SOCK_CLOEXEC;
+#else
+constexpr int kSocketFlags = 0;
+#endif
+
+// ChunkHasher isn't thread-safe and every stream of a file feeds the same
+// one. Hashing is far faster than the link, so one lock costs nothing.
+std::mutex g_hash_mu;
+
+uint64_t ThreadCpuNs() {
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+bool SendAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t n =
+        send(fd, data.data() + sent, data.size() - sent, kSendFlags);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    sent += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool PwriteAll(int fd, const uint8_t* data, size_t len, uint64_t offset) {
+  while (len > 0) {
+    const ssize_t n = pwrite(fd, data, len, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    len -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+bool PreadAll(int fd, uint8_t* out, size_t len, uint64_t offset) {
+  while (len > 0) {
+    const ssize_t n = pread(fd, out, len, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    out += n;
+    len -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+bool DataSync(int fd) {
+#if defined(__APPLE__)
+  return fsync(fd) == 0;
+#else
+  return fdatasync(fd) == 0;
+#endif
+}
+
+std::string Lower(std::string s) {
+  for (char& c : s) c = static_cast<char>(std::tolower(c));
+  return s;
+}
+
+}  // namespace
+
+std::unique_ptr<RangeReceiver> RangeReceiver::Start(
+    const ReceiveRequest& request) {
+  const bool valid = request.ranged ? request.end > request.start
+                                    : request.start == 0;
+  if (!valid) return nullptr;
+  // Spliced bytes are read back for the hasher.
+  const int file =
+      open(request.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (file < 0) return nullptr;
+  return std::unique_ptr<RangeReceiver>(new RangeReceiver(request, file));
+}
+
+RangeReceiver::RangeReceiver(const ReceiveRequest& request, int file)
+    : request_(request), file_(file), buffer_(kBufferSize) {
+  if (request_.sync_every > 0) {
+    next_sync_ = (request_.start / request_.sync_every + 1) *
+                 request_.sync_every;
+  }
+  thread_ = std::thread(&RangeReceiver::Run, this);
+}
+
+RangeReceiver::~RangeReceiver() {
+  {
+    std::lock_guard<std::mutex> lock(socket_mu_);
+    stop_ = true;
+    if (socket_ >= 0) shutdown(socket_, SHUT_RDWR);
+  }
+  thread_.join();
+  if (socket_ >= 0) close(socket_);
+  close(file_);
+}
+
+ReceiveStats RangeReceiver::stats() const {
+  ReceiveStats s;
+  s.received = received_.load();
+  s.durable = durable_.load();
+  s.syncs = syncs_.load();
+  s.cpu_ns = cpu_ns_.load();
+  s.spliced = spliced_.load();
+  s.warm = warm_.load();
+  return s;
+}
+
+void RangeReceiver::Run() {
+  const uint64_t cpu_start = ThreadCpuNs();
+  ReceiveError error = Receive();
+  if (error != ReceiveError::kNone && stop_) error = ReceiveError::kCancelled;
+  cpu_ns_ = ThreadCpuNs() - cpu_start;
+  error_ = error;
+  state_ = error == ReceiveError::kNone ? ReceiveState::kDone
+                                        : ReceiveState::kFailed;
+}
+
+bool RangeReceiver::WaitWhilePaused() const {
+  while (paused_ && !stop_) std::this_thread::sleep_for(kPausePoll);
+  return !stop_;
+}
+
+bool RangeReceiver::TakeWarm() {
+  // A warm connection comes from wherever the routing table chose.
+  if (request_.pool == nullptr || !request_.bind_address.empty()) {
+    return false;
+  }
+  const int fd = request_.pool->Take(request_.host, request_.port);
+  if (fd < 0) return false;
+  std::lock_guard<std::mutex> lock(socket_mu_);
+  if (stop_) {
+    close(fd);
+    return false;
+  }
+  socket_ = fd;
+  warm_ = true;
+  return true;
+}
+
+void RangeReceiver::Disconnect() {
+  std::lock_guard<std::mutex> lock(socket_mu_);
+  close(socket_);
+  socket_ = -1;
+}
+
+bool RangeReceiver::Connect() {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs = nullptr;
+  const std::string port = std::to_string(request_.port);
+  if (getaddrinfo(request_.host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+    return false;
+  }
+  addrinfo* local = nullptr;
+  if (!request_.bind_address.empty()) {
+    addrinfo local_hints = {};
+    local_hints.ai_family = AF_UNSPEC;
+    local_hints.ai_socktype = SOCK_STREAM;
+    local_hints.ai_flags = AI_NUMERICHOST | AI_PASSIVE;
+    if (getaddrinfo(request_.bind_address.c_str(), "0", &local_hints,
+                    &local) != 0) {
+      freeaddrinfo(addrs);
+      return false;
+    }
+  }
+  bool connected = false;
+  for (addrinfo* a = addrs; a != nullptr && !connected; a = a->ai_next) {
+    // Only the peer's addresses of the bound address's family will do.
+    if (local != nullptr && a->ai_family != local->ai_family) continue;
+    const int fd = socket(a->ai_family, a->ai_socktype | kSocketFlags,
+                          a->ai_protocol);
+    if (fd < 0) continue;
+    if (local != nullptr && bind(fd, local->ai_addr, local->ai_addrlen) != 0) {
+      close(fd);
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(socket_mu_);
+      if (stop_) {
+        close(fd);
+        break;
+      }
+      socket_ = fd;
+    }
+    connected = connect(fd, a->ai_addr, a->ai_addrlen) == 0;
+    if (!connected) {
+      std::lock_guard<std::mutex> lock(socket_mu_);
+      socket_ = -1;
+      close(fd);
+    }
+  }
+  freeaddrinfo(addrs);
+  if (local != nullptr) freeaddrinfo(local);
+  return connected;
+}
+
+ReceiveError RangeReceiver::Receive() {
+  const std::string port = std::to_string(request_.port);
+  std::string head = "GET " + request_.target + " HTTP/1.1\r\nHost: " +
+                     request_.host + ":" + port + "\r\n";
+  if (request_.ranged) {
+    head += "Range: bytes=" + std::to_string(request_.start) + "-" +
+            std::to_string(request_.end - 1) + "\r\n";
+  }
+  head += "Accept-Encoding: identity\r\nConnection: close\r\n\r\n";
+
+  std::string body_start;
+  bool warm = TakeWarm();
+  for (;;) {
+    if (!warm && !Connect()) return ReceiveError::kConnect;
+    const int sock = socket_;
+    timeval idle = {kIdleTimeoutSeconds, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+#if defined(SO_NOSIGPIPE)
+    const int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    const ReceiveError headers = SendAll(sock, head)
+                                     ? ReadHeaders(&body_start)
+                                     : ReceiveError::kConnect;
+    // The sender may have let a warm connection go just as it was taken,
+    // before answering anything; a GET is safe to make again.
+    if (warm && !stop_ && http_status_ == 0 &&
+        (headers == ReceiveError::kConnect ||
+         headers == ReceiveError::kClosed)) {
+      Disconnect();
+      warm = false;
+      warm_ = false;
+      continue;
+    }
+    if (headers != ReceiveError::kNone) return headers;
+    break;
+  }
+
+  uint64_t offset = request_.start;
+  if (!body_start.empty()) {
+    const size_t n = static_cast<size_t>(
+        std::min<uint64_t>(body_start.size(), request_.end - offset));
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(body_start.data());
+    if (!PwriteAll(file_, data, n, offset)) return ReceiveError::kIo;
+    const ReceiveError landed = Landed(offset, offset + n, data);
+    if (landed != ReceiveError::kNone) return landed;
+    offset += n;
+  }
+
+  if (offset < request_.end) {
+    bool unsupported = false;
+    ReceiveError body = ReceiveError::kNone;
+    if (request_.zero_copy) body = Splice(&offset, &unsupported);
+    if (!request_.zero_copy || unsupported) body = Copy(&offset);
+    if (body != ReceiveError::kNone) return body;
+  }
+
+  if (durable_ < received_) {
+    if (!DataSync(file_)) return ReceiveError::kIo;
+    syncs_++;
+    durable_ = received_.load();
+  }
+  return ReceiveError::kNone;
+}
+
+ReceiveError RangeReceiver::ReadHeaders(std::string* body_start) {
+  std::string in;
+  size_t end;
+  while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+    if (in.size() > kMaxHeaderBytes) return ReceiveError::kStatus;
+    char buf[4096];
+    const ssize_t n = recv(socket_, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return ReceiveError::kClosed;
+    in.append(buf, static_cast<size_t>(n));
+  }
+  body_start->assign(in, end + 4, std::string::npos);
+
+  // "HTTP/1.1 206 Partial Content"
+  const size_t space = in.find(' ');
+  if (in.compare(0, 5, "HTTP/") != 0 || space == std::string::npos) {
+    return ReceiveError::kStatus;
+  }
+  const int status = std::atoi(in.c_str() + space + 1);
+  http_status_ = status;
+  // A server without range support answers 200 with the whole file, which
+  // is only what we asked for when the range starts at 0.
+  const bool ok = status == 206 ? request_.ranged
+                                : status == 200 && request_.start == 0;
+  if (!ok) return ReceiveError::kStatus;
+
+  int64_t length = -1;
+  size_t line = in.find("\r\n") + 2;
+  while (line < end) {
+    const size_t next = in.find("\r\n", line);
+    const size_t colon = in.find(':', line);
+    if (colon != std::string::npos && colon < next) {
+      const std::string name = Lower(in.substr(line, colon - line));
+      size_t v = colon + 1;
+      while (v < next && (in[v] == ' ' || in[v] == '\t')) v++;
+      const std::string value = Lower(in.substr(v, next - v));
+      if (name == "content-length") {
+        length = std::strtoll(value.c_str(), nullptr, 10);
+      } else if ((name == "transfer-encoding" ||
+                  name == "content-encoding") &&
+                 value != "identity") {
+        return ReceiveError::kStatus;
+      }
+    }
+    line = next + 2;
+  }
+  if (length < 0 ||
+      static_cast<uint64_t>(length) != request_.end - request_.start) {
+    return ReceiveError::kLength;
+  }
+  return ReceiveError::kNone;
+}
+
+ReceiveError RangeReceiver::Splice(uint64_t* offset, bool* unsupported) {
+#if defined(__linux__)
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+    *unsupported = true;
+    return ReceiveError::kNone;
+  }
+  // A bigger pipe means fewer round trips; the default is 64 KiB.
+  fcntl(pipe_fds[1], F_SETPIPE_SZ, static_cast<int>(kBufferSize));
+  const int pipe_size = fcntl(pipe_fds[1], F_GETPIPE_SZ);
+  const size_t chunk =
+      pipe_size > 0 ? static_cast<size_t>(pipe_size) : 64 * 1024;
+
+  const int sock = socket_;
+  ReceiveError error = ReceiveError::kNone;
+  bool first = true;
+  while (*offset < request_.end) {
+    if (!WaitWhilePaused()) {
+      error = ReceiveError::kCancelled;
+      break;
+    }
+    const size_t want =
+        static_cast<size_t>(std::min<uint64_t>(chunk, request_.end - *offset));
+    const ssize_t in = splice(sock, nullptr, pipe_fds[1], nullptr, want,
+                              SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in < 0 && errno == EINTR) continue;
+    if (in < 0 && first && (errno == EINVAL || errno == ENOSYS)) {
+      *unsupported = true;
+      break;
+    }
+    if (in <= 0) {
+      error = ReceiveError::kClosed;
+      break;
+    }
+    first = false;
+    spliced_ = true;
+
+    loff_t at = static_cast<loff_t>(*offset);
+    size_t left = static_cast<size_t>(in);
+    while (left > 0) {
+      const ssize_t out =
+          splice(pipe_fds[0], nullptr, file_, &at, left, SPLICE_F_MOVE);
+      if (out < 0 && errno == EINTR) continue;
+      if (out <= 0) {
+        error = ReceiveError::kIo;
+        break;
+      }
+      left -= static_cast<size_t>(out);
+    }
+    if (error != ReceiveError::kNone) break;
+    error = Landed(*offset, *offset + static_cast<uint64_t>(in), nullptr);
+    if (error != ReceiveError::kNone) break;
+    *offset += static_cast<uint64_t>(in);
+  }
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+  return error;
+#else
+  (void)offset;
+  *unsupported = true;
+  return ReceiveError::kNone;
+#endif
+}
+
+ReceiveError RangeReceiver::Copy(uint64_t* offset) {
+  const int sock = socket_;
+  while (*offset < request_.end) {
+    if (!WaitWhilePaused()) return ReceiveError::kCancelled;
+    const size_t want = static_cast<size_t>(
+        std::min<uint64_t>(buffer_.size(), request_.end - *offset));
+    const ssize_t n = recv(sock, buffer_.data(), want, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return ReceiveError::kClosed;
+    if (!PwriteAll(file_, buffer_.data(), static_cast<size_t>(n), *offset)) {
+      return ReceiveError::kIo;
+    }
+    const ReceiveError landed =
+        Landed(*offset, *offset + static_cast<uint64_t>(n), buffer_.data());
+    if (landed != ReceiveError::kNone) return landed;
+    *offset += static_cast<uint64_t>(n);
+  }
+  return ReceiveError::kNone;
+}
+
+ReceiveError RangeReceiver::Landed(uint64_t from, uint64_t to,
+                                   const uint8_t* data) {
+  if (request_.hasher != nullptr) {
+    // Spliced bytes are read back while they're still in the page cache.
+    for (uint64_t at = from; at < to;) {
+      const size_t n =
+          static_cast<size_t>(std::min<uint64_t>(to - at, buffer_.size()));
+      const uint8_t* bytes = data != nullptr ? data + (at - from) : nullptr;
+      if (bytes == nullptr) {
+        if (!PreadAll(file_, buffer_.data(), n, at)) return ReceiveError::kIo;
+        bytes = buffer_.data();
+      }
+      std::lock_guard<std::mutex> lock(g_hash_mu);
+      request_.hasher->Update(at, bytes, n);
+      at += n;
+    }
+  }
+  received_ += to - from;
+  if (request_.sync_every > 0 && to >= next_sync_) {
+    if (!DataSync(file_)) return ReceiveError::kIo;
+    syncs_++;
+    durable_ = received_.load();
+    next_sync_ = (to / request_.sync_every + 1) * request_.sync_every;
+  }
+  return ReceiveError::kNone;
+}
+
+bool PreallocateFile(const std::string& path, uint64_t size) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  if (ok && static_cast<uint64_t>(st.st_size) < size) {
+#if defined(__linux__)
+    // Not posix_fallocate: glibc emulates that by writing zeros where the
+    // filesystem can't, which is slower than not preallocating at all.
+    if (fallocate(fd, 0, 0, static_cast<off_t>(size)) != 0) {
+      ok = ftruncate(fd, static_cast<off_t>(size)) == 0;
+    }
+#elif defined(__APPLE__)
+    fstore_t store = {F_ALLOCATEALL, F_PEOFPOSMODE, 0,
+                      static_cast<off_t>(size - st.st_size), 0};
+    fcntl(fd, F_PREALLOCATE, &store);
+    ok = ftruncate(fd, static_cast<off_t>(size)) == 0;
+#else
+    ok = ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+  }
+  close(fd);
+  return ok;
+}
+
+#endif
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::RangeReceiver* Unwrap(ZsRangeReceiver* r) {
+  return reinterpret_cast<zapshare::RangeReceiver*>(r);
+}
+
+const zapshare::RangeReceiver* Unwrap(const ZsRangeReceiver* r) {
+  return reinterpret_cast<const zapshare::RangeReceiver*>(r);
+}
+
+}  // namespace
+
+ZsRangeReceiver* zs_range_receiver_start(const char* host, uint16_t port,
+                                         const char* target, uint64_t start,
+                                         uint64_t end, int32_t ranged,
+                                         const char* path,
+                                         ZsChunkHasher* hasher,
+                                         uint64_t sync_every,
+                                         const char* bind_address,
+                                         ZsConnectionPool* pool) {
+  zapshare::ReceiveRequest request;
+  request.host = host;
+  request.port = port;
+  if (bind_address != nullptr) request.bind_address = bind_address;
+  request.target = target;
+  request.start = start;
+  request.end = end;
+  request.ranged = ranged != 0;
+  request.path = path;
+  request.hasher = reinterpret_cast<zapshare::ChunkHasher*>(hasher);
+  request.sync_every = sync_every;
+  request.pool = reinterpret_cast<zapshare::ConnectionPool*>(pool);
+  return reinterpret_cast<ZsRangeReceiver*>(
+      zapshare::RangeReceiver::Start(request).release());
+}
+
+void zs_range_receiver_free(ZsRangeReceiver* receiver) {
+  delete Unwrap(receiver);
+}
+
+void zs_range_receiver_set_paused(ZsRangeReceiver* receiver, int32_t paused) {
+  Unwrap(receiver)->SetPaused(paused != 0);
+}
+
+int32_t zs_range_receiver_state(const ZsRangeReceiver* receiver) {
+  const zapshare::RangeReceiver* r = Unwrap(receiver);
+  return static_cast<int32_t>(r->state()) |
+         static_cast<int32_t>(r->error()) << 8 | r->http_status() << 16;
+}
+
+void zs_range_receiver_stats(const ZsRangeReceiver* receiver,
+                             uint64_t out[6]) {
+  const zapshare::ReceiveStats s = Unwrap(receiver)->stats();
+  out[0] = s.received;
+  out[1] = s.durable;
+  out[2] = s.syncs;
+  out[3] = s.cpu_ns;
+  out[4] = s.spliced ? 1 : 0;
+  out[5] = s.warm ? 1 : 0;
+}
+
+int32_t zs_preallocate_file(const char* path, uint64_t size) {
+  return zapshare::PreallocateFile(path, size) ? 1 : 0;
+}
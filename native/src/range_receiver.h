@@ -0,0 +1,185 @@
+#ifndef ZAPSHARE_NATIVE_RANGE_RECEIVER_H_
+#define ZAPSHARE_NATIVE_RANGE_RECEIVER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "connection_pool.h"
+#include "content_hash.h"
+#include "export.h"
+
+namespace zapshare {
+
+// One HTTP GET whose body goes from the socket straight into the
+// destination file, for the receiver's download streams.
+//
+// The Dart path copies every byte from the socket into the Dart heap, hands
+// it through the http package's stream and copies it back into the kernel
+// with a write. A RangeReceiver makes the request on a thread of its own
+// and, on Linux and Android, moves the body socket -> pipe -> file with
+// splice(), so it never enters user space. Elsewhere, or when the kernel
+// refuses, it reads into one large buffer and writes it at its offset.
+//
+// When a ChunkHasher is given, each piece is read back from the page cache
+// after it lands and fed to it; that is one copy instead of the two a
+// write() path costs. The hasher is shared with other receivers of the same
+// file, so every receiver feeds it under one process-wide lock.
+//
+// Writes are made durable in batches: the file is fdatasync'ed whenever the
+// stream crosses a multiple of |sync_every| and at the end, never per
+// write. stats().durable says how far that got, so the resume journal only ever
+// records bytes that are really on storage.
+//
+// Given a ConnectionPool, it takes a connection already made to the peer
+// when there is one and sends its request at once (see
+// connection_pool.h); if the sender turns out to have just closed it, it
+// connects afresh.
+//
+// Only plain HTTP/1.1 with a Content-Length body is understood, which is
+// what the sender's HttpServer answers.
+
+constexpr uint64_t kReceiveSyncEvery = 4ull * kDefaultDigestChunkSize;
+
+enum class ReceiveState : int32_t {
+  kRunning = 0,
+  kDone = 1,
+  kFailed = 2,
+};
+
+enum class ReceiveError : int32_t {
+  kNone = 0,
+  kConnect = 1,    // Couldn't connect or send the request.
+  kStatus = 2,     // Not the expected 200/206, or a body we can't take.
+  kLength = 3,     // Content-Length doesn't match the range.
+  kClosed = 4,     // The sender hung up early, or went quiet too long.
+  kIo = 5,         // Couldn't write the destination.
+  kCancelled = 6,
+};
+
+struct ReceiveRequest {
+  std::string host;
+  uint16_t port = 0;
+  // Numeric local address to connect from, which picks the interface when
+  // a peer is reachable over several; empty lets the routing table choose.
+  std::string bind_address;
+  std::string target;  // Path and query, e.g. "/file/3".
+  // Bytes [start, end) of the file. |ranged| false sends a plain GET and
+  // expects the whole file (then |start| must be 0).
+  uint64_t start = 0;
+  uint64_t end = 0;
+  bool ranged = true;
+  std::string path;  // Written at the same offsets; created if missing.
+  ChunkHasher* hasher = nullptr;  // Optional; must outlive the receiver.
+  uint64_t sync_every = kReceiveSyncEvery;  // 0 syncs only at the end.
+  bool zero_copy = true;  // False always takes the buffered path.
+  // Optional, and only used without |bind_address|; must outlive the
+  // receiver.
+  ConnectionPool* pool = nullptr;
+};
+
+struct ReceiveStats {
+  uint64_t received = 0;  // Body bytes written to the file.
+  uint64_t durable = 0;   // Of those, synced to storage.
+  uint64_t syncs = 0;
+  uint64_t cpu_ns = 0;    // CPU time of the receiving thread.
+  bool spliced = false;   // The zero-copy path was used.
+  bool warm = false;      // A pooled connection carried the request.
+};
+
+class RangeReceiver {
+ public:
+  // Starts the download. Null if the destination can't be opened, or on
+  // Windows, where the Dart path is used.
+  static std::unique_ptr<RangeReceiver> Start(const ReceiveRequest& request);
+  // Cancels a download still running.
+  ~RangeReceiver();
+
+  RangeReceiver(const RangeReceiver&) = delete;
+  RangeReceiver& operator=(const RangeReceiver&) = delete;
+
+  ReceiveState state() const { return state_.load(); }
+  ReceiveError error() const { return error_.load(); }
+  // The sender's status code once the headers arrived.
+  int32_t http_status() const { return http_status_.load(); }
+  ReceiveStats stats() const;
+
+  // While paused nothing is read, so TCP flow control stops the sender.
+  void SetPaused(bool paused) { paused_ = paused; }
+
+ private:
+  RangeReceiver(const ReceiveRequest& request, int file);
+
+  void Run();
+  // Set |socket_| to a connection from the pool or a new one.
+  bool TakeWarm();
+  bool Connect();
+  void Disconnect();
+  ReceiveError Receive();
+  ReceiveError ReadHeaders(std::string* body_start);
+  // |*unsupported| is set, with nothing received, when the kernel can't
+  // splice this socket or file.
+  ReceiveError Splice(uint64_t* offset, bool* unsupported);
+  ReceiveError Copy(uint64_t* offset);
+  // Hashes, counts and, at a sync boundary, syncs bytes [from, to) that
+  // were just written.
+  ReceiveError Landed(uint64_t from, uint64_t to, const uint8_t* data);
+  bool WaitWhilePaused() const;
+
+  const ReceiveRequest request_;
+  const int file_;
+  std::vector<uint8_t> buffer_;  // The thread's; reads and hash read-back.
+
+  std::mutex socket_mu_;  // So a cancel never shuts down a reused fd.
+  int socket_ = -1;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> paused_{false};
+  std::atomic<ReceiveState> state_{ReceiveState::kRunning};
+  std::atomic<ReceiveError> error_{ReceiveError::kNone};
+  std::atomic<int32_t> http_status_{0};
+  std::atomic<uint64_t> received_{0};
+  std::atomic<uint64_t> durable_{0};
+  std::atomic<uint64_t> syncs_{0};
+  std::atomic<uint64_t> cpu_ns_{0};
+  std::atomic<bool> spliced_{false};
+  std::atomic<bool> warm_{false};
+  uint64_t next_sync_ = 0;
+  std::thread thread_;
+};
+
+// Reserves |size| bytes of storage for the file at |path|, creating it if
+// needed, so a download can't run out of space halfway or end up
+// fragmented. The file's size is at least |size| afterwards.
+bool PreallocateFile(const std::string& path, uint64_t size);
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsRangeReceiver ZsRangeReceiver;
+
+// |end| is exclusive; |ranged| 0 sends a plain GET for the whole file.
+// |hasher|, |bind_address| and |pool| may be null. 0 |sync_every| syncs
+// only at the end. Null on failure and always on Windows.
+ZS_EXPORT ZsRangeReceiver* zs_range_receiver_start(
+    const char* host, uint16_t port, const char* target, uint64_t start,
+    uint64_t end, int32_t ranged, const char* path, ZsChunkHasher* hasher,
+    uint64_t sync_every, const char* bind_address, ZsConnectionPool* pool);
+ZS_EXPORT void zs_range_receiver_free(ZsRangeReceiver* receiver);
+ZS_EXPORT void zs_range_receiver_set_paused(ZsRangeReceiver* receiver,
+                                            int32_t paused);
+// State in the low byte, error in the next, HTTP status above.
+ZS_EXPORT int32_t zs_range_receiver_state(const ZsRangeReceiver* receiver);
+// received, durable, syncs, cpu_ns, spliced, warm.
+ZS_EXPORT void zs_range_receiver_stats(const ZsRangeReceiver* receiver,
+                                       uint64_t out[6]);
+ZS_EXPORT int32_t zs_preallocate_file(const char* path, uint64_t size);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_RANGE_RECEIVER_H_
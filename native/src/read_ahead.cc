@@ -0,0 +1,354 @@
+#include "read_ahead.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr std::chrono::seconds kIdleWake(1);
+constexpr size_t kAlign = 4096;
+
+size_t AlignUp(size_t n) { return (n + kAlign - 1) / kAlign * kAlign; }
+
+}  // namespace
+
+std::unique_ptr<ReadAhead> ReadAhead::Open(const std::string& path,
+                                           uint64_t offset, uint64_t end,
+                                           size_t depth, size_t buffer_size) {
+  uint64_t size;
+  int64_t mtime_ms;
+  if (!StatFile(path, &size, &mtime_ms)) return nullptr;
+  end = std::min(end, size);
+  offset = std::min(offset, end);
+#if defined(_WIN32)
+  HANDLE file = CreateFileW(
+      WidenPath(path).c_str(), GENERIC_READ,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return nullptr;
+  const intptr_t handle = reinterpret_cast<intptr_t>(file);
+#else
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  const intptr_t handle = fd;
+#endif
+  return std::unique_ptr<ReadAhead>(
+      new ReadAhead(handle, offset, end, true, depth, buffer_size));
+}
+
+#if !defined(_WIN32)
+std::unique_ptr<ReadAhead> ReadAhead::OpenFd(int fd, uint64_t offset,
+                                             uint64_t end, size_t depth,
+                                             size_t buffer_size) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  const bool sized = S_ISREG(st.st_mode);
+  if (sized) {
+    end = std::min(end, static_cast<uint64_t>(st.st_size));
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+  offset = std::min(offset, end);
+  return std::unique_ptr<ReadAhead>(
+      new ReadAhead(fd, offset, end, sized, depth, buffer_size));
+}
+#endif
+
+ReadAhead::ReadAhead(intptr_t handle, uint64_t offset, uint64_t end,
+                     bool sized, size_t depth, size_t buffer_size)
+    : handle_(handle),
+      sized_(sized),
+      buffer_size_(AlignUp(buffer_size ? buffer_size : kReadAheadBufferSize)),
+      ring_(depth ? depth : kReadAheadDepth),
+      pos_(offset),
+      end_(end) {
+  storage_.resize(ring_.size() * buffer_size_ + kAlign);
+  const uintptr_t base = reinterpret_cast<uintptr_t>(storage_.data());
+  uint8_t* aligned = storage_.data() + (AlignUp(base) - base);
+  for (size_t i = 0; i < ring_.size(); i++) {
+    ring_[i].data = aligned + i * buffer_size_;
+  }
+  thread_ = std::thread(&ReadAhead::Run, this);
+}
+
+ReadAhead::~ReadAhead() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+    Wake();
+  }
+  cv_.notify_all();
+  thread_.join();
+#if defined(_WIN32)
+  CloseHandle(reinterpret_cast<HANDLE>(handle_));
+#else
+  close(static_cast<int>(handle_));
+#endif
+}
+
+int64_t ReadAhead::ReadSome(uint8_t* out, size_t len) {
+#if defined(_WIN32)
+  DWORD got = 0;
+  const DWORD want = static_cast<DWORD>(std::min<size_t>(len, 1 << 30));
+  if (!ReadFile(reinterpret_cast<HANDLE>(handle_), out, want, &got,
+                nullptr)) {
+    return -1;
+  }
+  return got;
+#else
+  for (;;) {
+    const ssize_t got = read(static_cast<int>(handle_), out, len);
+    if (got < 0 && errno == EINTR) continue;
+    return got;
+  }
+#endif
+}
+
+bool ReadAhead::Skip(uint64_t len) {
+#if defined(_WIN32)
+  LARGE_INTEGER to;
+  to.QuadPart = static_cast<LONGLONG>(len);
+  return SetFilePointerEx(reinterpret_cast<HANDLE>(handle_), to, nullptr,
+                          FILE_BEGIN) != 0;
+#else
+  if (lseek(static_cast<int>(handle_), static_cast<off_t>(len), SEEK_SET) >=
+      0) {
+    return true;
+  }
+  // A pipe: read up to the offset and drop the bytes.
+  while (len > 0) {
+    const int64_t got =
+        ReadSome(ring_[0].data, std::min<uint64_t>(len, buffer_size_));
+    if (got <= 0) return false;
+    len -= static_cast<uint64_t>(got);
+  }
+  return true;
+#endif
+}
+
+void ReadAhead::Run() {
+  uint64_t next = pos_;
+  if (next > 0 && !Skip(next)) {
+    std::lock_guard<std::mutex> lock(mu_);
+    failed_ = true;
+    Wake();
+    return;
+  }
+  for (;;) {
+    size_t tail;
+    size_t want;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      bool counted = false;
+      while (!stop_ && count_ == ring_.size()) {
+        if (!counted) {
+          stats_.reader_stalls++;
+          counted = true;
+        }
+        cv_.wait_for(lock, kIdleWake);
+      }
+      if (stop_) return;
+      if (next >= end_) {
+        done_ = true;
+        Wake();
+        return;
+      }
+      tail = (head_ + count_) % ring_.size();
+      want = static_cast<size_t>(
+          std::min<uint64_t>(buffer_size_, end_ - next));
+    }
+
+    // The tail buffer is the thread's until it is counted as filled.
+    uint8_t* out = ring_[tail].data;
+    size_t got = 0;
+    uint64_t reads = 0;
+    bool eof = false;
+    bool error = false;
+    while (got < want) {
+      const int64_t n = ReadSome(out + got, want - got);
+      reads++;
+      if (n < 0) {
+        error = true;
+        break;
+      }
+      if (n == 0) {
+        eof = true;
+        break;
+      }
+      got += static_cast<size_t>(n);
+    }
+
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.disk_bytes += got;
+    stats_.disk_reads += reads;
+    // Whatever happened below, the consumer has something to find.
+    Wake();
+    // A file that ends early has shrunk since it was opened, unless its
+    // size was never known.
+    if (error || (eof && sized_)) {
+      failed_ = true;
+      return;
+    }
+    if (got > 0) {
+      ring_[tail].len = got;
+      count_++;
+      stats_.max_depth = std::max<uint64_t>(stats_.max_depth, count_);
+      next += got;
+    }
+    if (eof) {
+      end_ = next;
+      done_ = true;
+      return;
+    }
+  }
+}
+
+int64_t ReadAhead::Read(uint8_t* out, size_t cap) {
+  size_t ready;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_.depth_sum += count_;
+    stats_.depth_samples++;
+    if (count_ == 0) {
+      if (failed_) return -1;
+      if (!done_ && pos_ < end_ && !starving_) {
+        starving_ = true;
+        stats_.consumer_stalls++;
+      }
+      return 0;
+    }
+    starving_ = false;
+    ready = count_;
+  }
+
+  // Filled buffers are the consumer's until they are handed back.
+  size_t copied = 0;
+  size_t drained = 0;
+  size_t index = head_;
+  while (copied < cap && drained < ready) {
+    const Buffer& b = ring_[index];
+    const size_t n = std::min(cap - copied, b.len - head_offset_);
+    std::memcpy(out + copied, b.data + head_offset_, n);
+    copied += n;
+    head_offset_ += n;
+    if (head_offset_ < b.len) break;
+    head_offset_ = 0;
+    drained++;
+    index = (index + 1) % ring_.size();
+  }
+  pos_ += copied;
+
+  if (drained > 0) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      head_ = index;
+      count_ -= drained;
+    }
+    cv_.notify_all();
+  }
+  return static_cast<int64_t>(copied);
+}
+
+void ReadAhead::Notify(std::function<void()> ready) {
+  std::lock_guard<std::mutex> lock(mu_);
+  ready_ = std::move(ready);
+  if (count_ > 0 || done_ || failed_) Wake();
+}
+
+void ReadAhead::Wake() {
+  if (ready_) std::exchange(ready_, nullptr)();
+}
+
+uint64_t ReadAhead::end() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return end_;
+}
+
+ReadAheadStats ReadAhead::stats() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return stats_;
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::ReadAhead* Unwrap(ZsReadAhead* r) {
+  return reinterpret_cast<zapshare::ReadAhead*>(r);
+}
+
+const zapshare::ReadAhead* Unwrap(const ZsReadAhead* r) {
+  return reinterpret_cast<const zapshare::ReadAhead*>(r);
+}
+
+ZsReadAhead* Wrap(std::unique_ptr<zapshare::ReadAhead> r) {
+  return reinterpret_cast<ZsReadAhead*>(r.release());
+}
+
+}  // namespace
+
+ZsReadAhead* zs_read_ahead_open(const char* path, uint64_t offset,
+                                uint64_t end, uint32_t depth,
+                                uint32_t buffer_size) {
+  return Wrap(
+      zapshare::ReadAhead::Open(path, offset, end, depth, buffer_size));
+}
+
+ZsReadAhead* zs_read_ahead_open_fd(int32_t fd, uint64_t offset, uint64_t end,
+                                   uint32_t depth, uint32_t buffer_size) {
+#if defined(_WIN32)
+  return nullptr;
+#else
+  return Wrap(
+      zapshare::ReadAhead::OpenFd(fd, offset, end, depth, buffer_size));
+#endif
+}
+
+void zs_read_ahead_free(ZsReadAhead* reader) { delete Unwrap(reader); }
+
+int64_t zs_read_ahead_read(ZsReadAhead* reader, uint8_t* out, size_t cap) {
+  return Unwrap(reader)->Read(out, cap);
+}
+
+void zs_read_ahead_notify(ZsReadAhead* reader, void (*ready)(int64_t),
+                          int64_t token) {
+  Unwrap(reader)->Notify([ready, token] { ready(token); });
+}
+
+uint64_t zs_read_ahead_remaining(const ZsReadAhead* reader) {
+  const zapshare::ReadAhead* r = Unwrap(reader);
+  return r->end() - r->position();
+}
+
+void zs_read_ahead_stats(const ZsReadAhead* reader, uint64_t out[7]) {
+  const zapshare::ReadAheadStats s = Unwrap(reader)->stats();
+  out[0] = s.disk_bytes;
+  out[1] = s.disk_reads;
+  out[2] = s.depth_sum;
+  out[3] = s.depth_samples;
+  out[4] = s.max_depth;
+  out[5] = s.consumer_stalls;
+  out[6] = s.reader_stalls;
+}
@@ -0,0 +1,161 @@
+#ifndef ZAPSHARE_NATIVE_READ_AHEAD_H_
+#define ZAPSHARE_NATIVE_READ_AHEAD_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// A file read ahead of its consumer, so the disk and the socket work at
+// the same time.
+//
+// The send loops read a chunk, hand it to the socket, wait for the flush
+// and only then read the next one: the socket idles while the disk works
+// and the other way round. A ReadAhead instead keeps |depth| buffers in
+// flight, filled in order by a thread of its own. The consumer takes bytes
+// from the oldest filled buffer, which goes back to the thread as soon as
+// it's drained. Buffers are page-aligned, and the thread reads with plain
+// sequential reads, so descriptors that can't seek (pipes from a content
+// provider) work too.
+//
+// Read() never blocks on the disk; it returns 0 while the next buffer is
+// being filled, and Notify() says when to try again. The stats say which side waited: many
+// consumer stalls mean storage is the bottleneck and more depth won't
+// help; many reader stalls with a full queue mean the network is, and the
+// buffers could be fewer or smaller.
+
+constexpr size_t kReadAheadDepth = 4;
+constexpr size_t kReadAheadBufferSize = 1024 * 1024;
+
+struct ReadAheadStats {
+  uint64_t disk_bytes = 0;
+  uint64_t disk_reads = 0;
+  // Filled buffers waiting for the consumer, summed over every Read() so
+  // the average depth is depth_sum / depth_samples.
+  uint64_t depth_sum = 0;
+  uint64_t depth_samples = 0;
+  uint64_t max_depth = 0;
+  uint64_t consumer_stalls = 0;  // Read() found nothing ready.
+  uint64_t reader_stalls = 0;    // Every buffer was full; the thread waited.
+};
+
+class ReadAhead {
+ public:
+  // Reads bytes [offset, end) of the file at |path|, clamped to its size,
+  // through |depth| buffers of |buffer_size|; 0 takes the defaults. Null
+  // if it can't be opened.
+  static std::unique_ptr<ReadAhead> Open(const std::string& path,
+                                         uint64_t offset, uint64_t end,
+                                         size_t depth, size_t buffer_size);
+#if !defined(_WIN32)
+  // The same for a descriptor the caller opened. Takes ownership of |fd|.
+  // |end| is taken as is when the size can't be known; the stream then
+  // ends where the file does.
+  static std::unique_ptr<ReadAhead> OpenFd(int fd, uint64_t offset,
+                                           uint64_t end, size_t depth,
+                                           size_t buffer_size);
+#endif
+  ~ReadAhead();
+
+  ReadAhead(const ReadAhead&) = delete;
+  ReadAhead& operator=(const ReadAhead&) = delete;
+
+  // Copies up to |cap| bytes from the reader's position. Returns how many,
+  // 0 at the end or while the data is still on its way, or -1 if the file
+  // couldn't be read.
+  int64_t Read(uint8_t* out, size_t cap);
+
+  // Calls |ready| once, when the next Read() won't be another 0 for data
+  // on its way: right away if a buffer is already filled or the stream is
+  // over, otherwise on the reader's thread, or when it is destroyed. It
+  // runs with the reader locked, so it must hand off rather than call
+  // back in. A second call before the first fires replaces it.
+  void Notify(std::function<void()> ready);
+
+  uint64_t position() const { return pos_; }
+  // The end of the range; moves down to the file's end if that comes
+  // first on a descriptor of unknown size.
+  uint64_t end() const;
+
+  ReadAheadStats stats() const;
+
+ private:
+  struct Buffer {
+    uint8_t* data = nullptr;
+    size_t len = 0;
+  };
+
+  ReadAhead(intptr_t handle, uint64_t offset, uint64_t end, bool sized,
+            size_t depth, size_t buffer_size);
+
+  void Run();
+  // One read into |out|; the byte count, 0 at the end of the file or -1.
+  int64_t ReadSome(uint8_t* out, size_t len);
+  bool Skip(uint64_t len);
+  // Calls the Notify() callback, if any; |mu_| is held.
+  void Wake();
+
+  const intptr_t handle_;  // HANDLE on Windows, a descriptor elsewhere.
+  const bool sized_;       // |end_| is known to be inside the file.
+  const size_t buffer_size_;
+  std::vector<uint8_t> storage_;
+  std::vector<Buffer> ring_;
+
+  uint64_t pos_;
+  size_t head_offset_ = 0;  // Bytes of the head buffer already taken.
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  uint64_t end_;
+  size_t head_ = 0;
+  size_t count_ = 0;  // Filled buffers, from |head_|.
+  bool done_ = false;
+  bool failed_ = false;
+  bool stop_ = false;
+  bool starving_ = false;  // The consumer is waiting; counted once.
+  std::function<void()> ready_;
+  ReadAheadStats stats_;
+  std::thread thread_;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsReadAhead ZsReadAhead;
+
+// |end| past the file's size reads to the end; 0 |depth| or |buffer_size|
+// takes the defaults.
+ZS_EXPORT ZsReadAhead* zs_read_ahead_open(const char* path, uint64_t offset,
+                                          uint64_t end, uint32_t depth,
+                                          uint32_t buffer_size);
+// Takes ownership of |fd|. Always null on Windows.
+ZS_EXPORT ZsReadAhead* zs_read_ahead_open_fd(int32_t fd, uint64_t offset,
+                                             uint64_t end, uint32_t depth,
+                                             uint32_t buffer_size);
+ZS_EXPORT void zs_read_ahead_free(ZsReadAhead* reader);
+ZS_EXPORT int64_t zs_read_ahead_read(ZsReadAhead* reader, uint8_t* out,
+                                     size_t cap);
+// Calls |ready| with |token| once the next read is worth trying, as
+// ReadAhead::Notify() does.
+ZS_EXPORT void zs_read_ahead_notify(ZsReadAhead* reader,
+                                    void (*ready)(int64_t token),
+                                    int64_t token);
+// Bytes left before the reader's end.
+ZS_EXPORT uint64_t zs_read_ahead_remaining(const ZsReadAhead* reader);
+// Fills |out| with the ReadAheadStats fields in declaration order.
+ZS_EXPORT void zs_read_ahead_stats(const ZsReadAhead* reader,
+                                   uint64_t out[7]);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_READ_AHEAD_H_
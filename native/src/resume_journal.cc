@@ -0,0 +1,240 @@
+#include "resume_journal.h"
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint32_t kJournalMagic = 0x4A52535A;  // "ZSRJ"
+constexpr uint32_t kJournalVersion = 1;
+
+// On-disk header, little-endian (every target the app ships on).
+struct JournalHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t file_size;
+  int64_t mtime_ms;
+  uint32_t chunk_size;
+  uint32_t chunk_count;
+  uint8_t digest[32];
+  // BLAKE3 of the peer id, so arbitrarily long ids fit.
+  uint8_t peer_hash[32];
+  uint8_t reserved[32];
+};
+static_assert(sizeof(JournalHeader) == 128, "journal header layout changed");
+
+uint8_t AtomicOr(uint8_t* p, uint8_t mask) {
+#if defined(_MSC_VER)
+  return static_cast<uint8_t>(_InterlockedOr8(
+      reinterpret_cast<volatile char*>(p), static_cast<char>(mask)));
+#else
+  return __atomic_fetch_or(p, mask, __ATOMIC_ACQ_REL);
+#endif
+}
+
+uint8_t AtomicAnd(uint8_t* p, uint8_t mask) {
+#if defined(_MSC_VER)
+  return static_cast<uint8_t>(_InterlockedAnd8(
+      reinterpret_cast<volatile char*>(p), static_cast<char>(mask)));
+#else
+  return __atomic_fetch_and(p, mask, __ATOMIC_ACQ_REL);
+#endif
+}
+
+void StoreMagic(JournalHeader* header, uint32_t magic) {
+#if defined(_MSC_VER)
+  _InterlockedExchange(reinterpret_cast<volatile long*>(&header->magic),
+                       static_cast<long>(magic));
+#else
+  __atomic_store_n(&header->magic, magic, __ATOMIC_RELEASE);
+#endif
+}
+
+bool DigestKnown(const uint8_t* digest) {
+  for (size_t i = 0; i < 32; i++) {
+    if (digest[i] != 0) return true;
+  }
+  return false;
+}
+
+// Whether |stored| was left by a download of the file |want| describes.
+bool SameFile(const JournalHeader& stored, const JournalHeader& want) {
+  if (std::memcmp(&stored, &want, offsetof(JournalHeader, digest)) != 0 ||
+      std::memcmp(stored.peer_hash, want.peer_hash,
+                  sizeof(want.peer_hash)) != 0) {
+    return false;
+  }
+  return !DigestKnown(stored.digest) || !DigestKnown(want.digest) ||
+         std::memcmp(stored.digest, want.digest, sizeof(want.digest)) == 0;
+}
+
+}  // namespace
+
+std::unique_ptr<ResumeJournal> ResumeJournal::Open(
+    const std::string& path, const JournalIdentity& identity, bool* resumed) {
+  *resumed = false;
+  const uint32_t chunk_size =
+      identity.chunk_size == 0 ? kDefaultDigestChunkSize : identity.chunk_size;
+  const uint64_t count64 =
+      (identity.file_size + chunk_size - 1) / chunk_size;
+  if (count64 > UINT32_MAX) return nullptr;
+  const uint32_t chunk_count = static_cast<uint32_t>(count64);
+  const size_t bitmap_bytes = (static_cast<size_t>(chunk_count) + 7) / 8;
+
+  bool fresh = false;
+  auto mapping =
+      MappedFile::Open(path, sizeof(JournalHeader) + bitmap_bytes, &fresh);
+  if (mapping == nullptr) return nullptr;
+
+  JournalHeader want;
+  std::memset(&want, 0, sizeof(want));
+  want.magic = kJournalMagic;
+  want.version = kJournalVersion;
+  want.file_size = identity.file_size;
+  want.mtime_ms = identity.mtime_ms;
+  want.chunk_size = chunk_size;
+  want.chunk_count = chunk_count;
+  std::memcpy(want.digest, identity.digest.data(), sizeof(want.digest));
+  Blake3::Hash(reinterpret_cast<const uint8_t*>(identity.peer_id.data()),
+               identity.peer_id.size(), want.peer_hash);
+
+  auto* header = reinterpret_cast<JournalHeader*>(mapping->data());
+  if (!fresh && SameFile(*header, want)) {
+    *resumed = true;
+    if (!DigestKnown(header->digest) && DigestKnown(want.digest)) {
+      std::memcpy(header->digest, want.digest, sizeof(want.digest));
+      if (!mapping->Sync()) return nullptr;
+    }
+  } else {
+    // Clear the magic first so a crash mid-rewrite can't leave a header
+    // that matches with a stale bitmap.
+    StoreMagic(header, 0);
+    std::memset(mapping->data() + sizeof(JournalHeader), 0, bitmap_bytes);
+    std::memcpy(reinterpret_cast<uint8_t*>(header) + sizeof(uint32_t),
+                reinterpret_cast<const uint8_t*>(&want) + sizeof(uint32_t),
+                sizeof(want) - sizeof(uint32_t));
+    if (!mapping->Sync()) return nullptr;
+    StoreMagic(header, kJournalMagic);
+    if (!mapping->Sync()) return nullptr;
+  }
+
+  std::unique_ptr<ResumeJournal> journal(
+      new ResumeJournal(std::move(mapping), chunk_size, chunk_count));
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    if (journal->IsChunkDone(i)) journal->completed_++;
+  }
+  return journal;
+}
+
+ResumeJournal::ResumeJournal(std::unique_ptr<MappedFile> mapping,
+                             uint32_t chunk_size, uint32_t chunk_count)
+    : mapping_(std::move(mapping)),
+      chunk_size_(chunk_size),
+      chunk_count_(chunk_count) {}
+
+ResumeJournal::~ResumeJournal() = default;
+
+uint8_t* ResumeJournal::Bitmap() const {
+  return mapping_->data() + sizeof(JournalHeader);
+}
+
+bool ResumeJournal::IsChunkDone(uint32_t index) const {
+  if (index >= chunk_count_) return false;
+  return (Bitmap()[index / 8] >> (index % 8)) & 1;
+}
+
+void ResumeJournal::MarkChunk(uint32_t index) {
+  if (index >= chunk_count_) return;
+  const uint8_t bit = static_cast<uint8_t>(1u << (index % 8));
+  if ((AtomicOr(&Bitmap()[index / 8], bit) & bit) == 0) completed_++;
+}
+
+void ResumeJournal::ClearChunk(uint32_t index) {
+  if (index >= chunk_count_) return;
+  const uint8_t bit = static_cast<uint8_t>(1u << (index % 8));
+  if (AtomicAnd(&Bitmap()[index / 8], static_cast<uint8_t>(~bit)) & bit) {
+    completed_--;
+  }
+}
+
+bool ResumeJournal::Sync() { return mapping_->Sync(); }
+
+bool ResumeJournal::Remove(const std::string& path) {
+  return RemoveFile(path);
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::ResumeJournal* Unwrap(ZsResumeJournal* j) {
+  return reinterpret_cast<zapshare::ResumeJournal*>(j);
+}
+
+const zapshare::ResumeJournal* Unwrap(const ZsResumeJournal* j) {
+  return reinterpret_cast<const zapshare::ResumeJournal*>(j);
+}
+
+}  // namespace
+
+ZsResumeJournal* zs_journal_open(const char* path, const char* peer_id,
+                                 size_t peer_id_len, uint64_t file_size,
+                                 int64_t mtime_ms, uint32_t chunk_size,
+                                 const uint8_t* digest, int32_t* resumed) {
+  zapshare::JournalIdentity identity;
+  identity.peer_id.assign(peer_id, peer_id_len);
+  identity.file_size = file_size;
+  identity.mtime_ms = mtime_ms;
+  identity.chunk_size = chunk_size;
+  if (digest != nullptr) {
+    std::memcpy(identity.digest.data(), digest, identity.digest.size());
+  }
+  bool kept = false;
+  auto journal = zapshare::ResumeJournal::Open(path, identity, &kept);
+  if (resumed != nullptr) *resumed = kept ? 1 : 0;
+  return reinterpret_cast<ZsResumeJournal*>(journal.release());
+}
+
+void zs_journal_close(ZsResumeJournal* journal) { delete Unwrap(journal); }
+
+uint32_t zs_journal_chunk_count(const ZsResumeJournal* journal) {
+  return Unwrap(journal)->ChunkCount();
+}
+
+uint32_t zs_journal_completed(const ZsResumeJournal* journal) {
+  return Unwrap(journal)->CompletedChunks();
+}
+
+int32_t zs_journal_is_done(const ZsResumeJournal* journal, uint32_t index) {
+  return Unwrap(journal)->IsChunkDone(index) ? 1 : 0;
+}
+
+void zs_journal_mark(ZsResumeJournal* journal, uint32_t index) {
+  Unwrap(journal)->MarkChunk(index);
+}
+
+void zs_journal_clear(ZsResumeJournal* journal, uint32_t index) {
+  Unwrap(journal)->ClearChunk(index);
+}
+
+void zs_journal_copy_bitmap(const ZsResumeJournal* journal, uint8_t* out) {
+  const zapshare::ResumeJournal* j = Unwrap(journal);
+  std::memset(out, 0, (static_cast<size_t>(j->ChunkCount()) + 7) / 8);
+  for (uint32_t i = 0; i < j->ChunkCount(); i++) {
+    if (j->IsChunkDone(i)) out[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+  }
+}
+
+int32_t zs_journal_sync(ZsResumeJournal* journal) {
+  return Unwrap(journal)->Sync() ? 1 : 0;
+}
+
+int32_t zs_journal_remove(const char* path) {
+  return zapshare::ResumeJournal::Remove(path) ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+#ifndef ZAPSHARE_NATIVE_RESUME_JOURNAL_H_
+#define ZAPSHARE_NATIVE_RESUME_JOURNAL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "content_hash.h"
+#include "export.h"
+#include "mapped_file.h"
+
+namespace zapshare {
+
+// What a partial download belongs to. A journal left by an earlier attempt is
+// only reused when peer, size, mtime and chunk size match; otherwise it is
+// reset. The digest is recorded once known but only tells files apart when
+// both attempts knew it: a sender that hasn't hashed a file yet has no
+// digest to offer, and that alone mustn't throw away progress.
+struct JournalIdentity {
+  std::string peer_id;
+  uint64_t file_size = 0;
+  // Source modification time in ms since the epoch, 0 if unknown.
+  int64_t mtime_ms = 0;
+  uint32_t chunk_size = kDefaultDigestChunkSize;
+  // Whole-file digest from the sender, all zero if unknown.
+  Digest digest{};
+};
+
+// Crash-safe record of which chunks of a download are on disk.
+//
+// The journal is a small sidecar file (by convention `<dest>.zsj`) that is
+// memory-mapped for its whole lifetime: a fixed 128-byte header holding the
+// identity, followed by one bit per chunk. Marking a chunk is a single atomic
+// OR on the mapped page, so a process that is killed between two writes
+// leaves either the old or the new bit, never a torn header. The header is
+// written before its magic, so a journal whose creation was interrupted is
+// simply rebuilt on the next open.
+//
+// Bits survive process death as soon as they are set (the page cache owns
+// them); Sync() additionally pushes them to storage. Callers should mark a
+// chunk only after its bytes have been written to the destination.
+class ResumeJournal {
+ public:
+  // Opens the journal at |path|, creating or resetting it when it is missing,
+  // damaged or describes a different file. A digest the journal didn't have
+  // yet is stored in it. Returns null on I/O failure.
+  // |*resumed| is set when existing progress was kept.
+  static std::unique_ptr<ResumeJournal> Open(const std::string& path,
+                                             const JournalIdentity& identity,
+                                             bool* resumed);
+  ~ResumeJournal();
+
+  ResumeJournal(const ResumeJournal&) = delete;
+  ResumeJournal& operator=(const ResumeJournal&) = delete;
+
+  uint32_t ChunkCount() const { return chunk_count_; }
+  uint32_t CompletedChunks() const { return completed_.load(); }
+  uint32_t chunk_size() const { return chunk_size_; }
+  bool IsChunkDone(uint32_t index) const;
+
+  // Safe to call from several writer threads at once.
+  void MarkChunk(uint32_t index);
+  // Used when a chunk fails verification and has to be fetched again.
+  void ClearChunk(uint32_t index);
+
+  // Flushes the mapped bitmap to storage.
+  bool Sync();
+
+  static bool Remove(const std::string& path);
+
+ private:
+  ResumeJournal(std::unique_ptr<MappedFile> mapping, uint32_t chunk_size,
+                uint32_t chunk_count);
+
+  uint8_t* Bitmap() const;
+
+  std::unique_ptr<MappedFile> mapping_;
+  uint32_t chunk_size_;
+  uint32_t chunk_count_;
+  std::atomic<uint32_t> completed_{0};
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsResumeJournal ZsResumeJournal;
+
+// |peer_id| is UTF-8 and need not be NUL-terminated; |digest| may be null.
+// |*resumed| is set to 1 when an earlier journal was kept.
+ZS_EXPORT ZsResumeJournal* zs_journal_open(const char* path,
+                                           const char* peer_id,
+                                           size_t peer_id_len,
+                                           uint64_t file_size, int64_t mtime_ms,
+                                           uint32_t chunk_size,
+                                           const uint8_t* digest,
+                                           int32_t* resumed);
+ZS_EXPORT void zs_journal_close(ZsResumeJournal* journal);
+ZS_EXPORT uint32_t zs_journal_chunk_count(const ZsResumeJournal* journal);
+ZS_EXPORT uint32_t zs_journal_completed(const ZsResumeJournal* journal);
+ZS_EXPORT int32_t zs_journal_is_done(const ZsResumeJournal* journal,
+                                     uint32_t index);
+ZS_EXPORT void zs_journal_mark(ZsResumeJournal* journal, uint32_t index);
+ZS_EXPORT void zs_journal_clear(ZsResumeJournal* journal, uint32_t index);
+// Writes the bitmap (ChunkCount() bits, LSB first) to |out|, which must hold
+// (ChunkCount() + 7) / 8 bytes.
+ZS_EXPORT void zs_journal_copy_bitmap(const ZsResumeJournal* journal,
+                                      uint8_t* out);
+ZS_EXPORT int32_t zs_journal_sync(ZsResumeJournal* journal);
+ZS_EXPORT int32_t zs_journal_remove(const char* path);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_RESUME_JOURNAL_H_
@@ -0,0 +1,211 @@
+#include "screen_capture.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(ZS_HAVE_X11)
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+namespace zapshare {
+
+#if defined(ZS_HAVE_X11)
+
+namespace {
+
+// Xlib's default handler exits the process; a failed grab should only end
+// the mirror. Errors are only expected from XShmAttach on a remote server.
+int IgnoreXError(Display*, XErrorEvent*) { return 0; }
+
+class X11ScreenSource : public ScreenSource {
+ public:
+  explicit X11ScreenSource(Display* display)
+      : display_(display), root_(DefaultRootWindow(display)) {}
+
+  ~X11ScreenSource() override {
+    Release();
+    XCloseDisplay(display_);
+  }
+
+  bool Open() {
+    XWindowAttributes attributes;
+    if (!XGetWindowAttributes(display_, root_, &attributes)) return false;
+    Visual* visual = attributes.visual;
+    if (attributes.depth < 24 || visual->red_mask != 0xFF0000 ||
+        visual->green_mask != 0x00FF00 || visual->blue_mask != 0x0000FF) {
+      return false;
+    }
+    use_shm_ = XShmQueryExtension(display_) == True;
+    return Allocate(attributes.width, attributes.height, attributes.depth,
+                    visual);
+  }
+
+  bool Grab(ScreenFrame* frame) override {
+    XWindowAttributes attributes;
+    if (!XGetWindowAttributes(display_, root_, &attributes)) return false;
+    if (attributes.width != width_ || attributes.height != height_) {
+      Release();
+      if (!Allocate(attributes.width, attributes.height, attributes.depth,
+                    attributes.visual)) {
+        return false;
+      }
+    }
+    if (use_shm_) {
+      if (!XShmGetImage(display_, root_, image_, 0, 0, AllPlanes)) {
+        return false;
+      }
+    } else {
+      if (image_ != nullptr) XDestroyImage(image_);
+      image_ = XGetImage(display_, root_, 0, 0, width_, height_, AllPlanes,
+                         ZPixmap);
+      if (image_ == nullptr || image_->bits_per_pixel != 32) return false;
+    }
+    frame->pixels = reinterpret_cast<const uint8_t*>(image_->data);
+    frame->width = width_;
+    frame->height = height_;
+    frame->stride = image_->bytes_per_line;
+    return true;
+  }
+
+ private:
+  bool Allocate(int width, int height, int depth, Visual* visual) {
+    width_ = width;
+    height_ = height;
+    if (!use_shm_) return true;
+    image_ = XShmCreateImage(display_, visual, depth, ZPixmap, nullptr,
+                             &shm_, width, height);
+    if (image_ == nullptr || image_->bits_per_pixel != 32) {
+      return FallBack();
+    }
+    shm_.shmid = shmget(IPC_PRIVATE,
+                        static_cast<size_t>(image_->bytes_per_line) *
+                            image_->height,
+                        IPC_CREAT | 0600);
+    if (shm_.shmid < 0) return FallBack();
+    shm_.shmaddr = image_->data =
+        static_cast<char*>(shmat(shm_.shmid, nullptr, 0));
+    // Removed now so it goes away with the last detach, even on a crash.
+    shmctl(shm_.shmid, IPC_RMID, nullptr);
+    if (shm_.shmaddr == reinterpret_cast<char*>(-1)) {
+      shm_.shmaddr = nullptr;
+      return FallBack();
+    }
+    shm_.readOnly = False;
+    XErrorHandler previous = XSetErrorHandler(IgnoreXError);
+    const bool attached = XShmAttach(display_, &shm_) == True;
+    XSync(display_, False);
+    XSetErrorHandler(previous);
+    if (!attached) return FallBack();
+    attached_ = true;
+    return true;
+  }
+
+  // Drops what Allocate() set up and grabs with XGetImage from now on.
+  bool FallBack() {
+    Release();
+    use_shm_ = false;
+    return true;
+  }
+
+  void Release() {
+    if (attached_) {
+      XShmDetach(display_, &shm_);
+      XSync(display_, False);
+      attached_ = false;
+    }
+    if (image_ != nullptr) {
+      if (use_shm_) image_->data = nullptr;  // Not Xlib's to free.
+      XDestroyImage(image_);
+      image_ = nullptr;
+    }
+    if (shm_.shmaddr != nullptr) {
+      shmdt(shm_.shmaddr);
+      shm_.shmaddr = nullptr;
+    }
+  }
+
+  Display* display_;
+  Window root_;
+  XImage* image_ = nullptr;
+  XShmSegmentInfo shm_ = {};
+  bool use_shm_ = false;
+  bool attached_ = false;
+  int width_ = 0;
+  int height_ = 0;
+};
+
+}  // namespace
+
+bool ScreenSource::Available() { return true; }
+
+std::unique_ptr<ScreenSource> ScreenSource::OpenDisplay(
+    const std::string& display) {
+  Display* x = XOpenDisplay(display.empty() ? nullptr : display.c_str());
+  if (x == nullptr) return nullptr;
+  auto source = std::make_unique<X11ScreenSource>(x);
+  if (!source->Open()) return nullptr;
+  return source;
+}
+
+#else
+
+bool ScreenSource::Available() { return false; }
+
+std::unique_ptr<ScreenSource> ScreenSource::OpenDisplay(const std::string&) {
+  return nullptr;
+}
+
+#endif  // defined(ZS_HAVE_X11)
+
+size_t TileDiffer::Diff(const ScreenFrame& frame) {
+  const size_t row_bytes = static_cast<size_t>(frame.width) * 4;
+  if (!valid_ || frame.width != width_ || frame.height != height_) {
+    width_ = frame.width;
+    height_ = frame.height;
+    columns_ = (width_ + kScreenTileSize - 1) / kScreenTileSize;
+    rows_ = (height_ + kScreenTileSize - 1) / kScreenTileSize;
+    previous_.resize(row_bytes * height_);
+    for (int y = 0; y < height_; y++) {
+      std::memcpy(&previous_[row_bytes * y], frame.pixels + frame.stride * y,
+                  row_bytes);
+    }
+    dirty_.assign(static_cast<size_t>(columns_) * rows_, 1);
+    valid_ = true;
+    return dirty_.size();
+  }
+
+  size_t count = 0;
+  for (int row = 0; row < rows_; row++) {
+    const int top = row * kScreenTileSize;
+    const int bottom = std::min(top + kScreenTileSize, height_);
+    for (int column = 0; column < columns_; column++) {
+      const size_t left = static_cast<size_t>(column) * kScreenTileSize * 4;
+      const size_t bytes = std::min<size_t>(kScreenTileSize * 4,
+                                            row_bytes - left);
+      // Rows above the first difference are already the same.
+      int y = top;
+      while (y < bottom &&
+             std::memcmp(&previous_[row_bytes * y + left],
+                         frame.pixels + frame.stride * y + left,
+                         bytes) == 0) {
+        y++;
+      }
+      const bool dirty = y < bottom;
+      dirty_[static_cast<size_t>(row) * columns_ + column] = dirty;
+      if (!dirty) continue;
+      count++;
+      for (; y < bottom; y++) {
+        std::memcpy(&previous_[row_bytes * y + left],
+                    frame.pixels + frame.stride * y + left, bytes);
+      }
+    }
+  }
+  return count;
+}
+
+}  // namespace zapshare
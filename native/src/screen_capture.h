@@ -0,0 +1,83 @@
+#ifndef ZAPSHARE_NATIVE_SCREEN_CAPTURE_H_
+#define ZAPSHARE_NATIVE_SCREEN_CAPTURE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace zapshare {
+
+// Where a desktop's screen mirror frames come from, and which parts of
+// them changed.
+//
+// Mirroring used to be sender-side on Android only: the desktop viewer
+// could show a phone, but a desktop had nothing to send. A ScreenSource
+// grabs the whole screen into one reused buffer of BGRX pixels, the layout
+// X11 hands out, so a grab is a copy out of shared memory and nothing
+// else. On Linux that's XShmGetImage against the root window (XGetImage
+// where the server has no MIT-SHM, e.g. a remote display); a Wayland
+// session is only reachable through its XWayland root, which shows X
+// clients alone.
+//
+// A TileDiffer then compares each grab against the one before it in
+// 64 x 64 tiles. Most frames of a desktop differ from the previous one by
+// a cursor, a caret or nothing at all, and the encoder and the protocol
+// use the dirty tiles to skip the rest.
+
+struct ScreenFrame {
+  const uint8_t* pixels = nullptr;  // BGRX, |stride| bytes a row.
+  int width = 0;
+  int height = 0;
+  size_t stride = 0;
+};
+
+class ScreenSource {
+ public:
+  virtual ~ScreenSource() = default;
+
+  // Grabs the screen as it is now. |frame| stays valid until the next
+  // call; false if the screen can't be read any more.
+  virtual bool Grab(ScreenFrame* frame) = 0;
+
+  // Whether this build can capture a display at all.
+  static bool Available();
+  // The X display named |display|, or $DISPLAY if empty. Null if it can't
+  // be opened or doesn't use 32-bit true colour.
+  static std::unique_ptr<ScreenSource> OpenDisplay(const std::string& display);
+};
+
+constexpr int kScreenTileSize = 64;
+
+class TileDiffer {
+ public:
+  // Marks the tiles of |frame| that differ from the previous frame.
+  // Every tile is dirty on the first frame and whenever the size changes.
+  // Returns how many tiles are dirty.
+  size_t Diff(const ScreenFrame& frame);
+
+  // Marks every tile dirty on the next Diff(), e.g. for a keyframe.
+  void Invalidate() { valid_ = false; }
+
+  int columns() const { return columns_; }
+  int rows() const { return rows_; }
+  // Row-major, columns() x rows(); 1 for a dirty tile.
+  const std::vector<uint8_t>& dirty() const { return dirty_; }
+  bool dirty(int column, int row) const {
+    return dirty_[static_cast<size_t>(row) * columns_ + column] != 0;
+  }
+
+ private:
+  std::vector<uint8_t> previous_;  // Tightly packed BGRX.
+  std::vector<uint8_t> dirty_;
+  int width_ = 0;
+  int height_ = 0;
+  int columns_ = 0;
+  int rows_ = 0;
+  bool valid_ = false;
+};
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_SCREEN_CAPTURE_H_
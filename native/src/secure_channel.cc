@@ -0,0 +1,365 @@
+#include "secure_channel.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "blake3.h"
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint8_t kMagic[4] = {'Z', 'S', 'E', '1'};
+constexpr size_t kNonceSize = 32;
+constexpr size_t kConfirmSize = 32;
+constexpr size_t kClientHelloSize = 4 + 1 + 1 + kNonceSize + kX25519Size;
+constexpr size_t kServerHelloBody = 1 + kNonceSize + kX25519Size;
+constexpr size_t kServerHelloSize = kServerHelloBody + kConfirmSize;
+
+uint32_t LoadLe32(const uint8_t* p) {
+  return uint32_t{p[0]} | uint32_t{p[1]} << 8 | uint32_t{p[2]} << 16 |
+         uint32_t{p[3]} << 24;
+}
+
+void StoreLe32(uint8_t* p, uint32_t v) {
+  p[0] = static_cast<uint8_t>(v);
+  p[1] = static_cast<uint8_t>(v >> 8);
+  p[2] = static_cast<uint8_t>(v >> 16);
+  p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+bool ConstantTimeEqual(const uint8_t* a, const uint8_t* b, size_t len) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; i++) diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+void Wipe(void* p, size_t len) {
+  volatile uint8_t* b = static_cast<volatile uint8_t*>(p);
+  for (size_t i = 0; i < len; i++) b[i] = 0;
+}
+
+// BLAKE3 over |prk| and a label. Every derived value has its own label, so
+// they are independent.
+void Expand(const uint8_t prk[kBlake3OutLen], const char* label,
+            uint8_t out[kBlake3OutLen]) {
+  const size_t label_len = std::strlen(label);
+  Blake3 h;
+  h.Update(prk, kBlake3OutLen);
+  const uint8_t len = static_cast<uint8_t>(label_len);
+  h.Update(&len, 1);
+  h.Update(reinterpret_cast<const uint8_t*>(label), label_len);
+  h.Final(out);
+}
+
+bool IsSingleCipher(uint32_t c) {
+  return c == static_cast<uint32_t>(AeadCipher::kAes256Gcm) ||
+         c == static_cast<uint32_t>(AeadCipher::kChaCha20Poly1305);
+}
+
+}  // namespace
+
+SecureChannel::SecureChannel(Role role, const uint8_t* code, size_t code_len,
+                             const uint8_t entropy[kSecureEntropySize],
+                             uint32_t ciphers)
+    : role_(role),
+      state_(role == Role::kClient ? State::kServerHello
+                                   : State::kClientHello),
+      ciphers_(ciphers & AeadSupportedCiphers()),
+      code_(code, code + std::min(code_len, kSecureMaxCode)) {
+  std::memcpy(scalar_, entropy, kX25519Size);
+  std::memcpy(nonce_, entropy + kX25519Size, kNonceSize);
+  if (ciphers_ == 0) {
+    Fail();
+    return;
+  }
+  if (role_ != Role::kClient) return;
+
+  uint8_t g[kX25519Size];
+  uint8_t pub[kX25519Size];
+  Generator(nonce_, g);
+  if (!X25519(pub, scalar_, g)) {
+    Fail();
+    return;
+  }
+  transcript_.assign(kMagic, kMagic + sizeof(kMagic));
+  transcript_.push_back(kSecureVersion);
+  transcript_.push_back(static_cast<uint8_t>(ciphers_));
+  transcript_.insert(transcript_.end(), nonce_, nonce_ + kNonceSize);
+  transcript_.insert(transcript_.end(), pub, pub + kX25519Size);
+  out_ = transcript_;
+}
+
+SecureChannel::~SecureChannel() {
+  Wipe(scalar_, sizeof(scalar_));
+  Wipe(code_.data(), code_.size());
+}
+
+size_t SecureChannel::Receive(const uint8_t* data, size_t len) {
+  size_t used = 0;
+  while (used < len) {
+    size_t need;
+    switch (state_) {
+      case State::kClientHello:
+        need = kClientHelloSize;
+        break;
+      case State::kServerHello:
+        need = kServerHelloSize;
+        break;
+      case State::kClientConfirm:
+        need = kConfirmSize;
+        break;
+      default:
+        return used;
+    }
+    const size_t take = std::min(need - in_.size(), len - used);
+    in_.insert(in_.end(), data + used, data + used + take);
+    used += take;
+    if (in_.size() < need) break;
+
+    bool ok = false;
+    if (state_ == State::kClientHello) {
+      ok = HandleClientHello(in_.data());
+    } else if (state_ == State::kServerHello) {
+      ok = HandleServerHello(in_.data());
+    } else {
+      ok = HandleClientConfirm(in_.data());
+    }
+    in_.clear();
+    if (!ok) {
+      Fail();
+      return len;
+    }
+  }
+  return used;
+}
+
+size_t SecureChannel::Read(uint8_t* out, size_t cap) {
+  const size_t n = std::min(cap, Pending());
+  std::memcpy(out, out_.data() + out_read_, n);
+  out_read_ += n;
+  if (out_read_ == out_.size()) {
+    out_.clear();
+    out_read_ = 0;
+  }
+  return n;
+}
+
+void SecureChannel::Generator(const uint8_t nonce[32],
+                              uint8_t out[kX25519Size]) const {
+  static const char kLabel[] = "zapshare-cpace-v1";
+  Blake3 h;
+  h.Update(reinterpret_cast<const uint8_t*>(kLabel), sizeof(kLabel) - 1);
+  const uint8_t len = static_cast<uint8_t>(code_.size());
+  h.Update(&len, 1);
+  h.Update(code_.data(), code_.size());
+  h.Update(nonce, kNonceSize);
+  uint8_t hash[kBlake3OutLen];
+  h.Final(hash);
+  X25519MapToCurve(out, hash);
+}
+
+bool SecureChannel::DeriveKeys(const uint8_t* peer_public,
+                               AeadCipher cipher) {
+  uint8_t shared[kX25519Size];
+  if (!X25519(shared, scalar_, peer_public)) return false;
+
+  static const char kLabel[] = "zapshare-secure-v1";
+  uint8_t transcript_hash[kBlake3OutLen];
+  Blake3::Hash(transcript_.data(), transcript_.size(), transcript_hash);
+  uint8_t prk[kBlake3OutLen];
+  Blake3 h;
+  h.Update(reinterpret_cast<const uint8_t*>(kLabel), sizeof(kLabel) - 1);
+  h.Update(shared, sizeof(shared));
+  h.Update(transcript_hash, sizeof(transcript_hash));
+  h.Final(prk);
+  Wipe(shared, sizeof(shared));
+
+  uint8_t c2s_key[kBlake3OutLen];
+  uint8_t s2c_key[kBlake3OutLen];
+  uint8_t c2s_iv[kBlake3OutLen];
+  uint8_t s2c_iv[kBlake3OutLen];
+  Expand(prk, "server confirm", server_confirm_);
+  Expand(prk, "client confirm", client_confirm_);
+  Expand(prk, "c2s key", c2s_key);
+  Expand(prk, "s2c key", s2c_key);
+  Expand(prk, "c2s iv", c2s_iv);
+  Expand(prk, "s2c iv", s2c_iv);
+  Wipe(prk, sizeof(prk));
+
+  const bool client = role_ == Role::kClient;
+  std::memcpy(send_iv_, client ? c2s_iv : s2c_iv, kAeadNonceSize);
+  std::memcpy(recv_iv_, client ? s2c_iv : c2s_iv, kAeadNonceSize);
+  const bool ok = send_.Init(cipher, client ? c2s_key : s2c_key) &&
+                  recv_.Init(cipher, client ? s2c_key : c2s_key);
+  Wipe(c2s_key, sizeof(c2s_key));
+  Wipe(s2c_key, sizeof(s2c_key));
+  return ok;
+}
+
+bool SecureChannel::HandleClientHello(const uint8_t* m) {
+  if (std::memcmp(m, kMagic, sizeof(kMagic)) != 0 || m[4] != kSecureVersion) {
+    return false;
+  }
+  const uint32_t both = ciphers_ & m[5];
+  AeadCipher cipher;
+  if (both & static_cast<uint32_t>(AeadCipher::kAes256Gcm)) {
+    cipher = AeadCipher::kAes256Gcm;
+  } else if (both & static_cast<uint32_t>(AeadCipher::kChaCha20Poly1305)) {
+    cipher = AeadCipher::kChaCha20Poly1305;
+  } else {
+    return false;
+  }
+
+  const uint8_t* client_nonce = m + 6;
+  const uint8_t* client_public = client_nonce + kNonceSize;
+  uint8_t g[kX25519Size];
+  uint8_t pub[kX25519Size];
+  Generator(client_nonce, g);
+  if (!X25519(pub, scalar_, g)) return false;
+
+  transcript_.assign(m, m + kClientHelloSize);
+  transcript_.push_back(static_cast<uint8_t>(cipher));
+  transcript_.insert(transcript_.end(), nonce_, nonce_ + kNonceSize);
+  transcript_.insert(transcript_.end(), pub, pub + kX25519Size);
+  if (!DeriveKeys(client_public, cipher)) return false;
+
+  out_.insert(out_.end(), transcript_.begin() + kClientHelloSize,
+              transcript_.end());
+  out_.insert(out_.end(), server_confirm_, server_confirm_ + kConfirmSize);
+  state_ = State::kClientConfirm;
+  return true;
+}
+
+bool SecureChannel::HandleServerHello(const uint8_t* m) {
+  const uint32_t cipher = m[0];
+  if (!IsSingleCipher(cipher) || (ciphers_ & cipher) == 0) return false;
+  transcript_.insert(transcript_.end(), m, m + kServerHelloBody);
+  if (!DeriveKeys(m + 1 + kNonceSize, static_cast<AeadCipher>(cipher))) {
+    return false;
+  }
+  if (!ConstantTimeEqual(m + kServerHelloBody, server_confirm_,
+                         kConfirmSize)) {
+    return false;
+  }
+  out_.insert(out_.end(), client_confirm_, client_confirm_ + kConfirmSize);
+  state_ = State::kEstablished;
+  return true;
+}
+
+bool SecureChannel::HandleClientConfirm(const uint8_t* m) {
+  if (!ConstantTimeEqual(m, client_confirm_, kConfirmSize)) return false;
+  state_ = State::kEstablished;
+  return true;
+}
+
+void SecureChannel::Fail() {
+  state_ = State::kFailed;
+  Wipe(scalar_, sizeof(scalar_));
+}
+
+void SecureChannel::MakeNonce(const uint8_t iv[kAeadNonceSize], uint64_t seq,
+                              uint8_t out[kAeadNonceSize]) const {
+  std::memcpy(out, iv, kAeadNonceSize);
+  for (int i = 0; i < 8; i++) {
+    out[kAeadNonceSize - 1 - i] ^= static_cast<uint8_t>(seq >> (8 * i));
+  }
+}
+
+size_t SecureChannel::Seal(uint8_t* record, size_t len) {
+  if (!established() || len > kSecureMaxRecord) return 0;
+  StoreLe32(record, static_cast<uint32_t>(len + kAeadTagSize));
+  uint8_t nonce[kAeadNonceSize];
+  MakeNonce(send_iv_, send_seq_++, nonce);
+  uint8_t* body = record + kSecureRecordHeader;
+  send_.Seal(nonce, record, kSecureRecordHeader, body, len, body + len);
+  return len + kSecureRecordOverhead;
+}
+
+size_t SecureChannel::RecordSize(const uint8_t header[kSecureRecordHeader]) {
+  const size_t n = LoadLe32(header);
+  if (n < kAeadTagSize || n > kSecureMaxRecord + kAeadTagSize) return 0;
+  return kSecureRecordHeader + n;
+}
+
+bool SecureChannel::Open(uint8_t* record, size_t size) {
+  if (!established() || size < kSecureRecordOverhead ||
+      RecordSize(record) != size) {
+    return false;
+  }
+  uint8_t nonce[kAeadNonceSize];
+  MakeNonce(recv_iv_, recv_seq_, nonce);
+  uint8_t* body = record + kSecureRecordHeader;
+  const size_t len = size - kSecureRecordOverhead;
+  if (!recv_.Open(nonce, record, kSecureRecordHeader, body, len,
+                  body + len)) {
+    state_ = State::kFailed;
+    return false;
+  }
+  recv_seq_++;
+  return true;
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::SecureChannel* Unwrap(ZsSecureChannel* c) {
+  return reinterpret_cast<zapshare::SecureChannel*>(c);
+}
+
+const zapshare::SecureChannel* Unwrap(const ZsSecureChannel* c) {
+  return reinterpret_cast<const zapshare::SecureChannel*>(c);
+}
+
+}  // namespace
+
+uint32_t zs_aead_supported(void) { return zapshare::AeadSupportedCiphers(); }
+
+ZsSecureChannel* zs_secure_new(int32_t server, const uint8_t* code,
+                               size_t code_len, const uint8_t* entropy,
+                               uint32_t ciphers) {
+  using zapshare::SecureChannel;
+  return reinterpret_cast<ZsSecureChannel*>(new SecureChannel(
+      server ? SecureChannel::Role::kServer : SecureChannel::Role::kClient,
+      code, code_len, entropy, ciphers));
+}
+
+void zs_secure_free(ZsSecureChannel* channel) { delete Unwrap(channel); }
+
+size_t zs_secure_receive(ZsSecureChannel* channel, const uint8_t* data,
+                         size_t len) {
+  return Unwrap(channel)->Receive(data, len);
+}
+
+size_t zs_secure_pending(const ZsSecureChannel* channel) {
+  return Unwrap(channel)->Pending();
+}
+
+size_t zs_secure_read(ZsSecureChannel* channel, uint8_t* out, size_t cap) {
+  return Unwrap(channel)->Read(out, cap);
+}
+
+int32_t zs_secure_state(const ZsSecureChannel* channel) {
+  const zapshare::SecureChannel* c = Unwrap(channel);
+  if (c->failed()) return -1;
+  return c->established() ? 1 : 0;
+}
+
+uint32_t zs_secure_cipher(const ZsSecureChannel* channel) {
+  return static_cast<uint32_t>(Unwrap(channel)->cipher());
+}
+
+size_t zs_secure_seal(ZsSecureChannel* channel, uint8_t* record,
+                      size_t len) {
+  return Unwrap(channel)->Seal(record, len);
+}
+
+size_t zs_secure_record_size(const uint8_t* header) {
+  return zapshare::SecureChannel::RecordSize(header);
+}
+
+int32_t zs_secure_open(ZsSecureChannel* channel, uint8_t* record,
+                       size_t size) {
+  return Unwrap(channel)->Open(record, size) ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+#ifndef ZAPSHARE_NATIVE_SECURE_CHANNEL_H_
+#define ZAPSHARE_NATIVE_SECURE_CHANNEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "aead.h"
+#include "export.h"
+#include "x25519.h"
+
+namespace zapshare {
+
+// Encrypted transport for the TCP transfer protocols, keyed by a
+// password-authenticated handshake on the pairing code.
+//
+// The handshake is CPace over X25519: both sides map the code and the
+// client's nonce to a curve point with Elligator 2, use it as the generator
+// of an ephemeral Diffie-Hellman exchange, and prove they got the same key
+// before any data flows. A recorded handshake gives nothing to brute-force
+// the code from offline, but the protocol is only as strong as the code is
+// secret. The app keys it with the share code, which is derived from the
+// sender's address and port, so this keeps file contents from passive
+// eavesdroppers on the LAN, not from an active attacker who can see where
+// the sender is and complete the handshake itself.
+//
+//   C1  client  "ZSE1" | u8 version | u8 cipher mask | nonce[32] | Y_a[32]
+//   S1  server  u8 cipher | nonce[32] | Y_b[32] | server confirm[32]
+//   C2  client  client confirm[32]
+//
+// The magic can't start a v1 request or the "ZSM2" of the multiplexed
+// protocol, so all three share the port. AES-256-GCM is picked when both
+// peers run it in hardware, ChaCha20-Poly1305 otherwise.
+//
+// After that every record is
+//
+//   le32 n | n - 16 bytes of ciphertext | 16-byte tag
+//
+// with the length as associated data and a nonce made from a per-direction
+// IV and record counter, so records can't be dropped, replayed or
+// reordered without Open() failing. Records are sealed and opened where
+// they lie: the caller reserves kSecureRecordHeader bytes in front of the
+// plaintext and kAeadTagSize after it.
+//
+// Like MuxSession it does no I/O; Receive()/Pending()/Read() carry the
+// handshake and Seal()/Open() work on records the caller frames.
+
+constexpr uint8_t kSecureVersion = 1;
+constexpr size_t kSecureEntropySize = 64;  // Scalar and nonce.
+constexpr size_t kSecureRecordHeader = 4;
+constexpr size_t kSecureRecordOverhead = kSecureRecordHeader + kAeadTagSize;
+constexpr size_t kSecureMaxRecord = 1024 * 1024;  // Plaintext bytes.
+constexpr size_t kSecureMaxCode = 255;
+
+class SecureChannel {
+ public:
+  enum class Role { kClient, kServer };
+
+  // |entropy| must come from a CSPRNG. |ciphers| is a mask of AeadCipher
+  // values to offer, intersected with what this machine supports.
+  SecureChannel(Role role, const uint8_t* code, size_t code_len,
+                const uint8_t entropy[kSecureEntropySize], uint32_t ciphers);
+  ~SecureChannel();
+  SecureChannel(const SecureChannel&) = delete;
+  SecureChannel& operator=(const SecureChannel&) = delete;
+
+  // Handshake input. Returns how many bytes belonged to the handshake; the
+  // rest are records (a client may send its first record right behind C2).
+  size_t Receive(const uint8_t* data, size_t len);
+  size_t Pending() const { return out_.size() - out_read_; }
+  size_t Read(uint8_t* out, size_t cap);
+
+  bool established() const { return state_ == State::kEstablished; }
+  bool failed() const { return state_ == State::kFailed; }
+  AeadCipher cipher() const { return send_.cipher(); }
+
+  // Seals the |len| plaintext bytes at record + kSecureRecordHeader and
+  // returns the record size, len + kSecureRecordOverhead. Returns 0 before
+  // the handshake is done or if |len| exceeds kSecureMaxRecord.
+  size_t Seal(uint8_t* record, size_t len);
+  // Whole record size announced by a header, or 0 if it can't be valid.
+  static size_t RecordSize(const uint8_t header[kSecureRecordHeader]);
+  // Authenticates and decrypts a whole record in place; the plaintext is
+  // at record + kSecureRecordHeader. False means the stream was tampered
+  // with and the connection must be dropped.
+  bool Open(uint8_t* record, size_t size);
+
+ private:
+  enum class State { kClientHello, kServerHello, kClientConfirm,
+                     kEstablished, kFailed };
+
+  void Generator(const uint8_t nonce[32], uint8_t out[kX25519Size]) const;
+  // Derives the keys from the shared point and the transcript so far and
+  // fills in both confirmation values.
+  bool DeriveKeys(const uint8_t* peer_public, AeadCipher cipher);
+  bool HandleClientHello(const uint8_t* m);
+  bool HandleServerHello(const uint8_t* m);
+  bool HandleClientConfirm(const uint8_t* m);
+  void Fail();
+  void MakeNonce(const uint8_t iv[kAeadNonceSize], uint64_t seq,
+                 uint8_t out[kAeadNonceSize]) const;
+
+  const Role role_;
+  State state_;
+  uint32_t ciphers_;
+  std::vector<uint8_t> code_;
+  uint8_t scalar_[kX25519Size];
+  uint8_t nonce_[32];
+  std::vector<uint8_t> transcript_;  // C1 and S1 up to the confirm.
+  std::vector<uint8_t> in_;          // Partial handshake message.
+  std::vector<uint8_t> out_;
+  size_t out_read_ = 0;
+
+  uint8_t server_confirm_[32] = {};
+  uint8_t client_confirm_[32] = {};
+  Aead send_;
+  Aead recv_;
+  uint8_t send_iv_[kAeadNonceSize] = {};
+  uint8_t recv_iv_[kAeadNonceSize] = {};
+  uint64_t send_seq_ = 0;
+  uint64_t recv_seq_ = 0;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsSecureChannel ZsSecureChannel;
+
+// Mask of AeadCipher values this machine runs.
+ZS_EXPORT uint32_t zs_aead_supported(void);
+
+ZS_EXPORT ZsSecureChannel* zs_secure_new(int32_t server, const uint8_t* code,
+                                         size_t code_len,
+                                         const uint8_t* entropy,
+                                         uint32_t ciphers);
+ZS_EXPORT void zs_secure_free(ZsSecureChannel* channel);
+ZS_EXPORT size_t zs_secure_receive(ZsSecureChannel* channel,
+                                   const uint8_t* data, size_t len);
+ZS_EXPORT size_t zs_secure_pending(const ZsSecureChannel* channel);
+ZS_EXPORT size_t zs_secure_read(ZsSecureChannel* channel, uint8_t* out,
+                                size_t cap);
+// 0 while the handshake runs, 1 once established, -1 if it failed.
+ZS_EXPORT int32_t zs_secure_state(const ZsSecureChannel* channel);
+ZS_EXPORT uint32_t zs_secure_cipher(const ZsSecureChannel* channel);
+ZS_EXPORT size_t zs_secure_seal(ZsSecureChannel* channel, uint8_t* record,
+                                size_t len);
+ZS_EXPORT size_t zs_secure_record_size(const uint8_t* header);
+ZS_EXPORT int32_t zs_secure_open(ZsSecureChannel* channel, uint8_t* record,
+                                 size_t size);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_SECURE_CHANNEL_H_
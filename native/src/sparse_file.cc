@@ -0,0 +1,330 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // SEEK_DATA, SEEK_HOLE, fallocate()
+#endif
+
+#include "sparse_file.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint8_t kMapMagic[4] = {'Z', 'S', 'X', '1'};
+
+uint32_t LoadLe32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+uint64_t LoadLe64(const uint8_t* p) {
+  return static_cast<uint64_t>(LoadLe32(p)) |
+         static_cast<uint64_t>(LoadLe32(p + 4)) << 32;
+}
+
+void AppendLe32(std::vector<uint8_t>* out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out->push_back(static_cast<uint8_t>(v >> (8 * i)));
+  }
+}
+
+void AppendLe64(std::vector<uint8_t>* out, uint64_t v) {
+  AppendLe32(out, static_cast<uint32_t>(v));
+  AppendLe32(out, static_cast<uint32_t>(v >> 32));
+}
+
+// Appends data [from, to), folding it into the last extent when the hole
+// between them is too short to be worth skipping.
+void AddData(std::vector<Extent>* out, uint64_t from, uint64_t to) {
+  if (to <= from) return;
+  if (!out->empty() && from <= out->back().end() + kMinSparseHole) {
+    Extent& last = out->back();
+    last.length = std::max(last.end(), to) - last.offset;
+    return;
+  }
+  out->push_back({from, to - from});
+}
+
+// The holes of a |size|-byte file with |extents|.
+std::vector<Extent> Gaps(const std::vector<Extent>& extents, uint64_t size) {
+  std::vector<Extent> gaps;
+  uint64_t at = 0;
+  for (const Extent& e : extents) {
+    if (e.offset > at) gaps.push_back({at, e.offset - at});
+    at = e.end();
+  }
+  if (at < size) gaps.push_back({at, size - at});
+  return gaps;
+}
+
+#if defined(__APPLE__)
+bool WriteZeros(int fd, uint64_t from, uint64_t to) {
+  static const uint8_t kZeros[4096] = {};
+  while (from < to) {
+    const size_t n =
+        static_cast<size_t>(std::min<uint64_t>(to - from, sizeof(kZeros)));
+    const ssize_t w = pwrite(fd, kZeros, n, static_cast<off_t>(from));
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return false;
+    from += static_cast<uint64_t>(w);
+  }
+  return true;
+}
+#endif
+
+}  // namespace
+
+#if defined(_WIN32)
+
+bool FileDataExtents(const std::string& path, uint64_t* size,
+                     std::vector<Extent>* out) {
+  HANDLE file = CreateFileW(WidenPath(path).c_str(), GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER length;
+  bool ok = GetFileSizeEx(file, &length) != 0;
+  out->clear();
+  *size = ok ? static_cast<uint64_t>(length.QuadPart) : 0;
+
+  // Files that aren't marked sparse report one range covering everything.
+  FILE_ALLOCATED_RANGE_BUFFER query;
+  query.FileOffset.QuadPart = 0;
+  query.Length.QuadPart = static_cast<LONGLONG>(*size);
+  FILE_ALLOCATED_RANGE_BUFFER ranges[64];
+  while (ok && query.Length.QuadPart > 0) {
+    DWORD bytes = 0;
+    const BOOL done =
+        DeviceIoControl(file, FSCTL_QUERY_ALLOCATED_RANGES, &query,
+                        sizeof(query), ranges, sizeof(ranges), &bytes, nullptr);
+    if (!done && GetLastError() != ERROR_MORE_DATA) {
+      ok = false;
+      break;
+    }
+    const size_t n = bytes / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+    for (size_t i = 0; i < n; i++) {
+      const uint64_t from =
+          static_cast<uint64_t>(ranges[i].FileOffset.QuadPart);
+      const uint64_t length = static_cast<uint64_t>(ranges[i].Length.QuadPart);
+      AddData(out, from, std::min(*size, from + length));
+    }
+    if (done || n == 0) break;
+    const LONGLONG next =
+        ranges[n - 1].FileOffset.QuadPart + ranges[n - 1].Length.QuadPart;
+    query.FileOffset.QuadPart = next;
+    query.Length.QuadPart = static_cast<LONGLONG>(*size) - next;
+  }
+  CloseHandle(file);
+  return ok;
+}
+
+bool PrepareSparseFile(const std::string& path, uint64_t size,
+                       const std::vector<Extent>& extents) {
+  HANDLE file = CreateFileW(WidenPath(path).c_str(),
+                            GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  DWORD bytes = 0;
+  bool ok = DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0,
+                            &bytes, nullptr) != 0;
+  LARGE_INTEGER to;
+  to.QuadPart = static_cast<LONGLONG>(size);
+  ok = ok && SetFilePointerEx(file, to, nullptr, FILE_BEGIN) &&
+       SetEndOfFile(file);
+  for (const Extent& gap : Gaps(extents, size)) {
+    if (!ok) break;
+    FILE_ZERO_DATA_INFORMATION zero;
+    zero.FileOffset.QuadPart = static_cast<LONGLONG>(gap.offset);
+    zero.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(gap.end());
+    ok = DeviceIoControl(file, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero),
+                         nullptr, 0, &bytes, nullptr) != 0;
+  }
+  CloseHandle(file);
+  return ok;
+}
+
+#else
+
+bool FileDataExtents(const std::string& path, uint64_t* size,
+                     std::vector<Extent>* out) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  *size = ok ? static_cast<uint64_t>(st.st_size) : 0;
+  out->clear();
+  // File systems without hole support report all of it as one extent.
+  for (uint64_t at = 0; ok && at < *size;) {
+    const off_t data = lseek(fd, static_cast<off_t>(at), SEEK_DATA);
+    if (data < 0) {
+      ok = errno == ENXIO;  // Only holes from |at| to the end.
+      break;
+    }
+    const off_t hole = lseek(fd, data, SEEK_HOLE);
+    if (hole < 0) {
+      ok = false;
+      break;
+    }
+    const uint64_t end = std::min(*size, static_cast<uint64_t>(hole));
+    AddData(out, static_cast<uint64_t>(data), end);
+    at = end;
+  }
+  close(fd);
+  return ok;
+#else
+  (void)path;
+  (void)size;
+  (void)out;
+  return false;
+#endif
+}
+
+bool PrepareSparseFile(const std::string& path, uint64_t size,
+                       const std::vector<Extent>& extents) {
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  // Growing with ftruncate leaves a hole; nothing is allocated.
+  bool ok = ftruncate(fd, static_cast<off_t>(size)) == 0;
+  struct stat st;
+  ok = ok && fstat(fd, &st) == 0;
+  if (ok && st.st_blocks > 0) {
+    // A preallocated or earlier part file: free what the holes cover.
+    for (const Extent& gap : Gaps(extents, size)) {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+      ok = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                     static_cast<off_t>(gap.offset),
+                     static_cast<off_t>(gap.length)) == 0;
+#elif defined(__APPLE__) && defined(F_PUNCHHOLE)
+      // Only whole blocks can be punched; the ends are zeroed instead.
+      const uint64_t block = static_cast<uint64_t>(st.st_blksize);
+      const uint64_t from = (gap.offset + block - 1) / block * block;
+      const uint64_t to = gap.end() / block * block;
+      if (to > from) {
+        fpunchhole_t punch = {};
+        punch.fp_offset = static_cast<off_t>(from);
+        punch.fp_length = static_cast<off_t>(to - from);
+        ok = fcntl(fd, F_PUNCHHOLE, &punch) == 0 &&
+             WriteZeros(fd, gap.offset, from) &&
+             WriteZeros(fd, to, gap.end());
+      } else {
+        ok = WriteZeros(fd, gap.offset, gap.end());
+      }
+#else
+      (void)gap;
+      ok = false;
+#endif
+      if (!ok) break;
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+#endif
+
+uint64_t DataBytes(const std::vector<Extent>& extents) {
+  uint64_t total = 0;
+  for (const Extent& e : extents) total += e.length;
+  return total;
+}
+
+std::vector<uint8_t> EncodeExtentMap(uint64_t size,
+                                     const std::vector<Extent>& extents) {
+  std::vector<uint8_t> out(kMapMagic, kMapMagic + sizeof(kMapMagic));
+  out.reserve(kExtentMapHeaderSize + extents.size() * kExtentMapEntrySize);
+  AppendLe64(&out, size);
+  AppendLe32(&out, static_cast<uint32_t>(extents.size()));
+  for (const Extent& e : extents) {
+    AppendLe64(&out, e.offset);
+    AppendLe64(&out, e.length);
+  }
+  return out;
+}
+
+bool DecodeExtentMap(const uint8_t* data, size_t len, uint64_t* size,
+                     std::vector<Extent>* extents) {
+  if (len < kExtentMapHeaderSize ||
+      std::memcmp(data, kMapMagic, sizeof(kMapMagic)) != 0) {
+    return false;
+  }
+  const uint64_t file_size = LoadLe64(data + 4);
+  const uint32_t count = LoadLe32(data + 12);
+  if ((len - kExtentMapHeaderSize) / kExtentMapEntrySize != count ||
+      (len - kExtentMapHeaderSize) % kExtentMapEntrySize != 0) {
+    return false;
+  }
+  std::vector<Extent> out;
+  out.reserve(count);
+  uint64_t at = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const uint8_t* p =
+        data + kExtentMapHeaderSize + size_t{i} * kExtentMapEntrySize;
+    const Extent e = {LoadLe64(p), LoadLe64(p + 8)};
+    // Sorted, apart, non-empty and inside the file; no overflow either.
+    if (e.length == 0 || e.offset < at || (i > 0 && e.offset == at) ||
+        e.offset > file_size || e.length > file_size - e.offset) {
+      return false;
+    }
+    out.push_back(e);
+    at = e.end();
+  }
+  *size = file_size;
+  *extents = std::move(out);
+  return true;
+}
+
+std::vector<Extent> AlignExtents(const std::vector<Extent>& extents,
+                                 uint64_t align, uint64_t size) {
+  std::vector<Extent> out;
+  if (align == 0) align = 1;
+  for (const Extent& e : extents) {
+    const uint64_t from = e.offset / align * align;
+    const uint64_t to = std::min(size, (e.end() + align - 1) / align * align);
+    if (!out.empty() && from <= out.back().end()) {
+      out.back().length = std::max(out.back().end(), to) - out.back().offset;
+    } else if (to > from) {
+      out.push_back({from, to - from});
+    }
+  }
+  return out;
+}
+
+}  // namespace zapshare
+
+int64_t zs_extent_map(const char* path, uint8_t* out, size_t cap) {
+  uint64_t size = 0;
+  std::vector<zapshare::Extent> extents;
+  if (!zapshare::FileDataExtents(path, &size, &extents)) {
+    // Either it can't be opened or its holes can't be found.
+    int64_t mtime_ms;
+    return zapshare::StatFile(path, &size, &mtime_ms) ? 0 : -1;
+  }
+  if (zapshare::DataBytes(extents) == size) return 0;
+  const std::vector<uint8_t> map = zapshare::EncodeExtentMap(size, extents);
+  if (map.size() <= cap) std::memcpy(out, map.data(), map.size());
+  return static_cast<int64_t>(map.size());
+}
+
+int32_t zs_prepare_sparse_file(const char* path, const uint8_t* map,
+                               size_t len) {
+  uint64_t size = 0;
+  std::vector<zapshare::Extent> extents;
+  if (!zapshare::DecodeExtentMap(map, len, &size, &extents)) return 0;
+  return zapshare::PrepareSparseFile(path, size, extents) ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+#ifndef ZAPSHARE_NATIVE_SPARSE_FILE_H_
+#define ZAPSHARE_NATIVE_SPARSE_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// Sparse files without their holes: VM disk images, databases and
+// preallocated downloads are mostly zeros the file system never stored.
+//
+// The sender lists a file's data extents (SEEK_DATA/SEEK_HOLE, or
+// FSCTL_QUERY_ALLOCATED_RANGES on Windows) and publishes them as an
+// extent map. The receiver recreates the file with holes in the same
+// places and fetches only the extents. Holes shorter than kMinSparseHole
+// are folded into the data around them; they'd cost more requests than
+// they save.
+//
+// Extent map, little-endian:
+//
+//   "ZSX1" | le64 file size | le32 count | count x (le64 offset, le64 length)
+//
+// Extents are sorted, don't overlap or touch, and lie within the file.
+
+constexpr uint64_t kMinSparseHole = 64 * 1024;
+constexpr size_t kExtentMapHeaderSize = 16;
+constexpr size_t kExtentMapEntrySize = 16;
+
+struct Extent {
+  uint64_t offset;
+  uint64_t length;
+
+  uint64_t end() const { return offset + length; }
+  bool operator==(const Extent& o) const {
+    return offset == o.offset && length == o.length;
+  }
+};
+
+// The data extents of the file at |path|, and its size. False if it can't
+// be opened or its file system can't report holes; then it's sent dense.
+bool FileDataExtents(const std::string& path, uint64_t* size,
+                     std::vector<Extent>* out);
+
+uint64_t DataBytes(const std::vector<Extent>& extents);
+
+std::vector<uint8_t> EncodeExtentMap(uint64_t size,
+                                     const std::vector<Extent>& extents);
+// False if |data| isn't a well-formed map.
+bool DecodeExtentMap(const uint8_t* data, size_t len, uint64_t* size,
+                     std::vector<Extent>* extents);
+
+// Rounds every extent out to multiples of |align| (clamped to |size|) and
+// merges those that then touch, for transfers done in whole chunks.
+std::vector<Extent> AlignExtents(const std::vector<Extent>& extents,
+                                 uint64_t align, uint64_t size);
+
+// Makes |path| a |size|-byte file whose bytes outside |extents| are holes,
+// creating it if needed: the size is set without allocating, and blocks a
+// reused file already has outside the extents are punched out. What's in
+// the extents is left for the caller to write. False if the file system
+// can't make holes; the file may then be any size.
+bool PrepareSparseFile(const std::string& path, uint64_t size,
+                       const std::vector<Extent>& extents);
+
+}  // namespace zapshare
+
+extern "C" {
+
+// Writes the extent map of the file at |path| to |out| and returns its
+// length; if that's more than |cap| nothing is written, so call again with
+// a bigger buffer. 0 when the file has no holes worth skipping or they
+// can't be found, -1 if it can't be opened.
+ZS_EXPORT int64_t zs_extent_map(const char* path, uint8_t* out, size_t cap);
+// Returns 1 once |path| is laid out as |map| describes.
+ZS_EXPORT int32_t zs_prepare_sparse_file(const char* path, const uint8_t* map,
+                                         size_t len);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_SPARSE_FILE_H_
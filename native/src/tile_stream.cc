@@ -0,0 +1,610 @@
+#include "tile_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#include "compress.h"
+
+#if defined(ZS_HAVE_JPEG)
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr char kMagic[kTileStreamMagicSize] = {'Z', 'S', 'T', '1'};
+// Keeps tile counts within a le16; no screen is larger.
+constexpr int kMaxSide = 8192;
+constexpr size_t kMaxTables = 4096;
+constexpr size_t kMaxPayload = kScreenTileSize * kScreenTileSize * 4 * 2;
+// An LZ4 tile this small is taken without trying JPEG.
+constexpr size_t kLosslessAlways = 512;
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void PutLe16(std::vector<uint8_t>* out, uint32_t v) {
+  out->push_back(static_cast<uint8_t>(v));
+  out->push_back(static_cast<uint8_t>(v >> 8));
+}
+
+void PutLe32(std::vector<uint8_t>* out, uint32_t v) {
+  PutLe16(out, v & 0xFFFF);
+  PutLe16(out, v >> 16);
+}
+
+uint32_t GetLe16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+uint32_t GetLe32(const uint8_t* p) {
+  return GetLe16(p) | (static_cast<uint32_t>(GetLe16(p + 2)) << 16);
+}
+
+// The power of two M/8 at which a |width| x |height| screen still covers
+// what it's shown at inside |target_width| x |target_height|, letterboxed.
+// Tiles scale by whole pixels only at these.
+int TileScaleEighths(int width, int height, int target_width,
+                     int target_height) {
+  if (target_width <= 0 || target_height <= 0 || width <= 0 ||
+      height <= 0) {
+    return 8;
+  }
+  const int by_width = (8 * target_width + width - 1) / width;
+  const int by_height = (8 * target_height + height - 1) / height;
+  int eighths = std::clamp(std::min(by_width, by_height), 1, 8);
+  while ((eighths & (eighths - 1)) != 0) eighths++;
+  return eighths;
+}
+
+// Pixels a |size|-pixel side takes at |eighths|, as libjpeg rounds it.
+int Scaled(int size, int eighths) { return (size * eighths + 7) / 8; }
+
+#if defined(ZS_HAVE_JPEG)
+
+struct ErrorManager {
+  jpeg_error_mgr base;
+  jmp_buf jump;
+};
+
+void OnError(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void OnMessage(j_common_ptr, int) {}
+
+struct VectorDestination {
+  jpeg_destination_mgr base;
+  std::vector<uint8_t>* out;
+};
+
+void InitDestination(j_compress_ptr cinfo) {
+  auto* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  dest->out->resize(std::max<size_t>(dest->out->capacity(), 16 * 1024));
+  dest->base.next_output_byte = dest->out->data();
+  dest->base.free_in_buffer = dest->out->size();
+}
+
+boolean EmptyOutputBuffer(j_compress_ptr cinfo) {
+  auto* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  const size_t used = dest->out->size();
+  dest->out->resize(used * 2);
+  dest->base.next_output_byte = dest->out->data() + used;
+  dest->base.free_in_buffer = dest->out->size() - used;
+  return TRUE;
+}
+
+void TermDestination(j_compress_ptr cinfo) {
+  auto* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  dest->out->resize(dest->out->size() - dest->base.free_in_buffer);
+}
+
+#endif  // defined(ZS_HAVE_JPEG)
+
+}  // namespace
+
+#if defined(ZS_HAVE_JPEG)
+
+// Set up once: every tile is an abbreviated image sharing these tables.
+struct TileEncoder::Compressor {
+  jpeg_compress_struct cinfo;
+  ErrorManager error;
+  VectorDestination dest;
+  std::vector<uint8_t> jpeg;
+  std::vector<JSAMPROW> rows;
+#if !defined(JCS_EXTENSIONS)
+  std::vector<uint8_t> rgb;
+#endif
+
+  explicit Compressor(int quality) {
+    cinfo.err = jpeg_std_error(&error.base);
+    error.base.error_exit = OnError;
+    error.base.emit_message = OnMessage;
+    jpeg_create_compress(&cinfo);
+    dest.base.init_destination = InitDestination;
+    dest.base.empty_output_buffer = EmptyOutputBuffer;
+    dest.base.term_destination = TermDestination;
+    dest.out = &jpeg;
+    cinfo.dest = &dest.base;
+#if defined(JCS_EXTENSIONS)
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_BGRX;
+#else
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+#endif
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.write_JFIF_header = FALSE;
+  }
+
+  ~Compressor() { jpeg_destroy_compress(&cinfo); }
+
+  // The tables-only datastream the stream header carries.
+  bool Tables(std::vector<uint8_t>* out) {
+    if (setjmp(error.jump) != 0) {
+      jpeg_abort_compress(&cinfo);
+      return false;
+    }
+    jpeg_write_tables(&cinfo);
+    *out = jpeg;
+    return true;
+  }
+
+  // Nothing in here may own memory: an error longjmps out of libjpeg.
+  bool Encode(const ScreenFrame& frame, int left, int top, int width,
+              int height) {
+    if (setjmp(error.jump) != 0) {
+      jpeg_abort_compress(&cinfo);
+      return false;
+    }
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    jpeg_suppress_tables(&cinfo, TRUE);
+    jpeg_start_compress(&cinfo, FALSE);
+#if defined(JCS_EXTENSIONS)
+    rows.resize(height);
+    for (int y = 0; y < height; y++) {
+      rows[y] = const_cast<JSAMPROW>(frame.pixels + frame.stride * (top + y) +
+                                     left * 4);
+    }
+    while (cinfo.next_scanline < cinfo.image_height) {
+      jpeg_write_scanlines(&cinfo, rows.data() + cinfo.next_scanline,
+                           cinfo.image_height - cinfo.next_scanline);
+    }
+#else
+    rgb.resize(static_cast<size_t>(width) * 3);
+    JSAMPROW row = rgb.data();
+    while (cinfo.next_scanline < cinfo.image_height) {
+      const uint8_t* src = frame.pixels +
+                           frame.stride * (top + cinfo.next_scanline) +
+                           left * 4;
+      for (int x = 0; x < width; x++) {
+        rgb[x * 3] = src[x * 4 + 2];
+        rgb[x * 3 + 1] = src[x * 4 + 1];
+        rgb[x * 3 + 2] = src[x * 4];
+      }
+      jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+#endif
+    jpeg_finish_compress(&cinfo);
+    return true;
+  }
+};
+
+bool TileEncoder::Available() { return true; }
+
+#else
+
+struct TileEncoder::Compressor {
+  std::vector<uint8_t> jpeg;
+
+  explicit Compressor(int) {}
+  bool Tables(std::vector<uint8_t>*) { return false; }
+  bool Encode(const ScreenFrame&, int, int, int, int) { return false; }
+};
+
+bool TileEncoder::Available() { return false; }
+
+#endif  // defined(ZS_HAVE_JPEG)
+
+TileEncoder::TileEncoder(int quality)
+    : quality_(std::clamp(quality, 1, 100)),
+      compressor_(new Compressor(quality_)) {
+  std::vector<uint8_t> tables;
+  compressor_->Tables(&tables);
+  header_.assign(kMagic, kMagic + sizeof(kMagic));
+  PutLe16(&header_, static_cast<uint32_t>(tables.size()));
+  header_.insert(header_.end(), tables.begin(), tables.end());
+}
+
+TileEncoder::~TileEncoder() = default;
+
+std::shared_ptr<const TileSnapshot> TileEncoder::Update(
+    const ScreenFrame& frame, const TileDiffer& differ) {
+  if (!Available() || frame.width <= 0 || frame.height <= 0 ||
+      frame.width > kMaxSide || frame.height > kMaxSide) {
+    return nullptr;
+  }
+  const uint64_t start = NowNs();
+  const int columns = (frame.width + kScreenTileSize - 1) / kScreenTileSize;
+  const int rows = (frame.height + kScreenTileSize - 1) / kScreenTileSize;
+  auto next = snapshot_ != nullptr
+                  ? std::make_shared<TileSnapshot>(*snapshot_)
+                  : std::make_shared<TileSnapshot>();
+  next->sequence++;
+  const bool whole = snapshot_ == nullptr || frame.width != next->width ||
+                     frame.height != next->height ||
+                     differ.columns() != columns || differ.rows() != rows;
+  if (whole) {
+    next->resized = next->sequence;
+    next->width = frame.width;
+    next->height = frame.height;
+    next->columns = columns;
+    next->rows = rows;
+    next->tiles.assign(static_cast<size_t>(columns) * rows, nullptr);
+  }
+
+  for (int row = 0; row < rows; row++) {
+    const int top = row * kScreenTileSize;
+    const int height = std::min(kScreenTileSize, frame.height - top);
+    for (int column = 0; column < columns; column++) {
+      if (!whole && !differ.dirty(column, row)) continue;
+      const int left = column * kScreenTileSize;
+      const int width = std::min(kScreenTileSize, frame.width - left);
+      auto tile = std::make_shared<EncodedTile>();
+      tile->version = next->sequence;
+
+      // Lossless first: it's cheap, and for UI it's usually the smaller.
+      const size_t raw = static_cast<size_t>(width) * height * 3;
+      packed_.resize(raw);
+      uint8_t* p = packed_.data();
+      for (int y = 0; y < height; y++) {
+        const uint8_t* src = frame.pixels + frame.stride * (top + y) + left * 4;
+        for (int x = 0; x < width; x++, p += 3) {
+          p[0] = src[x * 4 + 2];
+          p[1] = src[x * 4 + 1];
+          p[2] = src[x * 4];
+        }
+      }
+      tile->payload.resize(raw);
+      const size_t lossless =
+          Lz4Compress(packed_.data(), raw, tile->payload.data(), raw);
+      if (lossless != 0 && lossless <= kLosslessAlways) {
+        tile->encoding = TileEncoding::kLossless;
+        tile->payload.resize(lossless);
+      } else {
+        if (!compressor_->Encode(frame, left, top, width, height)) {
+          return nullptr;
+        }
+        if (lossless != 0 && lossless <= compressor_->jpeg.size()) {
+          tile->encoding = TileEncoding::kLossless;
+          tile->payload.resize(lossless);
+        } else {
+          tile->encoding = TileEncoding::kJpeg;
+          tile->payload = compressor_->jpeg;
+        }
+      }
+      (tile->encoding == TileEncoding::kJpeg ? stats_.jpeg_tiles
+                                             : stats_.lossless_tiles)++;
+      next->tiles[static_cast<size_t>(row) * columns + column] =
+          std::move(tile);
+    }
+  }
+
+  snapshot_ = std::move(next);
+  stats_.frames++;
+  stats_.encode_ns += NowNs() - start;
+  return snapshot_;
+}
+
+size_t WriteTileFrame(const TileSnapshot& snapshot, uint32_t base,
+                      std::vector<uint8_t>* out) {
+  const bool keyframe = base == 0 || base < snapshot.resized ||
+                        base > snapshot.sequence;
+  PutLe32(out, snapshot.sequence);
+  PutLe32(out, keyframe ? 0 : base);
+  PutLe16(out, snapshot.width);
+  PutLe16(out, snapshot.height);
+  const size_t count_at = out->size();
+  PutLe16(out, 0);
+  size_t count = 0;
+  for (int row = 0; row < snapshot.rows; row++) {
+    for (int column = 0; column < snapshot.columns; column++) {
+      const EncodedTile* tile =
+          snapshot.tiles[static_cast<size_t>(row) * snapshot.columns + column]
+              .get();
+      if (tile == nullptr || (!keyframe && tile->version <= base)) continue;
+      PutLe16(out, column);
+      PutLe16(out, row);
+      out->push_back(static_cast<uint8_t>(tile->encoding));
+      PutLe32(out, static_cast<uint32_t>(tile->payload.size()));
+      out->insert(out->end(), tile->payload.begin(), tile->payload.end());
+      count++;
+    }
+  }
+  (*out)[count_at] = static_cast<uint8_t>(count);
+  (*out)[count_at + 1] = static_cast<uint8_t>(count >> 8);
+  return count;
+}
+
+void TileStreamReader::Feed(const uint8_t* data, size_t len) {
+  if (failed_) return;
+  if (head_ > 0) {
+    buffer_.erase(buffer_.begin(), buffer_.begin() + head_);
+    head_ = 0;
+  }
+  buffer_.insert(buffer_.end(), data, data + len);
+}
+
+bool TileStreamReader::Next(TileFrame* out) {
+  if (failed_) return false;
+  const uint8_t* p = buffer_.data() + head_;
+  size_t available = buffer_.size() - head_;
+  if (!started_) {
+    if (available < sizeof(kMagic) + 2) return false;
+    const size_t tables = GetLe16(p + sizeof(kMagic));
+    if (std::memcmp(p, kMagic, sizeof(kMagic)) != 0 || tables > kMaxTables) {
+      failed_ = true;
+      return false;
+    }
+    if (available < sizeof(kMagic) + 2 + tables) return false;
+    tables_.assign(p + sizeof(kMagic) + 2, p + sizeof(kMagic) + 2 + tables);
+    head_ += sizeof(kMagic) + 2 + tables;
+    started_ = true;
+    p = buffer_.data() + head_;
+    available = buffer_.size() - head_;
+  }
+
+  if (available < kTileFrameHeaderSize) return false;
+  const int width = static_cast<int>(GetLe16(p + 8));
+  const int height = static_cast<int>(GetLe16(p + 10));
+  const size_t count = GetLe16(p + 12);
+  const int columns = (width + kScreenTileSize - 1) / kScreenTileSize;
+  const int rows = (height + kScreenTileSize - 1) / kScreenTileSize;
+  if (width <= 0 || height <= 0 || width > kMaxSide || height > kMaxSide ||
+      count > static_cast<size_t>(columns) * rows) {
+    failed_ = true;
+    return false;
+  }
+  out->tiles.clear();
+  size_t pos = kTileFrameHeaderSize;
+  for (size_t i = 0; i < count; i++) {
+    if (available < pos + kTileHeaderSize) return false;
+    TileRecord tile;
+    tile.column = static_cast<int>(GetLe16(p + pos));
+    tile.row = static_cast<int>(GetLe16(p + pos + 2));
+    const uint8_t encoding = p[pos + 4];
+    tile.size = GetLe32(p + pos + 5);
+    if (tile.column >= columns || tile.row >= rows ||
+        encoding > static_cast<uint8_t>(TileEncoding::kLossless) ||
+        tile.size > kMaxPayload) {
+      failed_ = true;
+      return false;
+    }
+    tile.encoding = static_cast<TileEncoding>(encoding);
+    pos += kTileHeaderSize;
+    if (available < pos + tile.size) return false;
+    tile.data = p + pos;
+    pos += tile.size;
+    out->tiles.push_back(tile);
+  }
+  out->sequence = GetLe32(p);
+  out->base = GetLe32(p + 4);
+  out->width = width;
+  out->height = height;
+  head_ += pos;
+  return true;
+}
+
+bool LooksLikeTileStream(const uint8_t* data, size_t len) {
+  return len >= sizeof(kMagic) &&
+         std::memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+#if defined(ZS_HAVE_JPEG)
+
+// One decompressor for the life of the canvas; it holds the stream's
+// tables between tiles.
+struct TileCanvas::Decoder {
+  jpeg_decompress_struct cinfo;
+  ErrorManager error;
+  std::vector<JSAMPROW> rows;
+#if !defined(JCS_EXTENSIONS)
+  std::vector<uint8_t> rgb;
+#endif
+
+  Decoder() {
+    cinfo.err = jpeg_std_error(&error.base);
+    error.base.error_exit = OnError;
+    error.base.emit_message = OnMessage;
+    jpeg_create_decompress(&cinfo);
+  }
+
+  ~Decoder() { jpeg_destroy_decompress(&cinfo); }
+
+  bool LoadTables(const std::vector<uint8_t>& tables) {
+    if (setjmp(error.jump) != 0) {
+      jpeg_abort_decompress(&cinfo);
+      return false;
+    }
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(tables.data()),
+                 static_cast<unsigned long>(tables.size()));
+    return jpeg_read_header(&cinfo, FALSE) == JPEG_HEADER_TABLES_ONLY;
+  }
+
+  // Decodes into the |width| x |height| RGBA rect at |out|, |stride| bytes
+  // a row; false if the tile isn't that size at |eighths|.
+  bool Decode(const std::vector<uint8_t>& jpeg, int eighths, uint8_t* out,
+              size_t stride, int width, int height) {
+    if (setjmp(error.jump) != 0) {
+      jpeg_abort_decompress(&cinfo);
+      return false;
+    }
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(jpeg.data()),
+                 static_cast<unsigned long>(jpeg.size()));
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+      jpeg_abort_decompress(&cinfo);
+      return false;
+    }
+    cinfo.scale_num = eighths;
+    cinfo.scale_denom = 8;
+    cinfo.dct_method = JDCT_IFAST;
+#if defined(JCS_EXTENSIONS)
+    cinfo.out_color_space = JCS_EXT_RGBA;
+#else
+    cinfo.out_color_space = JCS_RGB;
+#endif
+    jpeg_start_decompress(&cinfo);
+    if (static_cast<int>(cinfo.output_width) != width ||
+        static_cast<int>(cinfo.output_height) != height) {
+      jpeg_abort_decompress(&cinfo);
+      return false;
+    }
+#if defined(JCS_EXTENSIONS)
+    rows.resize(height);
+    for (int y = 0; y < height; y++) rows[y] = out + stride * y;
+    while (cinfo.output_scanline < cinfo.output_height) {
+      jpeg_read_scanlines(&cinfo, rows.data() + cinfo.output_scanline,
+                          cinfo.output_height - cinfo.output_scanline);
+    }
+#else
+    rgb.resize(static_cast<size_t>(width) * 3);
+    JSAMPROW row = rgb.data();
+    while (cinfo.output_scanline < cinfo.output_height) {
+      uint8_t* dst = out + stride * cinfo.output_scanline;
+      jpeg_read_scanlines(&cinfo, &row, 1);
+      for (int x = 0; x < width; x++) {
+        dst[x * 4] = rgb[x * 3];
+        dst[x * 4 + 1] = rgb[x * 3 + 1];
+        dst[x * 4 + 2] = rgb[x * 3 + 2];
+        dst[x * 4 + 3] = 0xFF;
+      }
+    }
+#endif
+    jpeg_finish_decompress(&cinfo);
+    return true;
+  }
+};
+
+#else
+
+struct TileCanvas::Decoder {
+  bool LoadTables(const std::vector<uint8_t>&) { return false; }
+  bool Decode(const std::vector<uint8_t>&, int, uint8_t*, size_t, int,
+              int) {
+    return false;
+  }
+};
+
+#endif  // defined(ZS_HAVE_JPEG)
+
+TileCanvas::TileCanvas() : decoder_(new Decoder) {}
+
+TileCanvas::~TileCanvas() = default;
+
+bool TileCanvas::SetTables(const std::vector<uint8_t>& tables) {
+  return decoder_->LoadTables(tables);
+}
+
+void TileCanvas::Put(int width, int height, bool reset, int column, int row,
+                     Tile tile) {
+  if (reset || width != width_ || height != height_) {
+    width_ = width;
+    height_ = height;
+    columns_ = (width + kScreenTileSize - 1) / kScreenTileSize;
+    rows_ = (height + kScreenTileSize - 1) / kScreenTileSize;
+    tiles_.assign(static_cast<size_t>(columns_) * rows_, Tile());
+    changed_.assign(tiles_.size(), 0);
+    eighths_ = 0;
+  }
+  const size_t index = static_cast<size_t>(row) * columns_ + column;
+  tiles_[index] = std::move(tile);
+  changed_[index] = 1;
+}
+
+size_t TileCanvas::Draw(int target_width, int target_height) {
+  if (width_ == 0) return 0;
+  const int eighths =
+      TileScaleEighths(width_, height_, target_width, target_height);
+  if (eighths != eighths_) {
+    eighths_ = eighths;
+    canvas_width_ = Scaled(width_, eighths);
+    canvas_height_ = Scaled(height_, eighths);
+    pixels_.assign(static_cast<size_t>(canvas_width_) * canvas_height_ * 4,
+                   0);
+    std::fill(changed_.begin(), changed_.end(), 1);
+  }
+  size_t failed = 0;
+  for (int row = 0; row < rows_; row++) {
+    for (int column = 0; column < columns_; column++) {
+      const size_t index = static_cast<size_t>(row) * columns_ + column;
+      if (!changed_[index]) continue;
+      changed_[index] = 0;
+      if (!DrawTile(column, row)) failed++;
+    }
+  }
+  return failed;
+}
+
+bool TileCanvas::DrawTile(int column, int row) {
+  const Tile& tile = tiles_[static_cast<size_t>(row) * columns_ + column];
+  if (tile.payload.empty()) return true;  // Not sent yet.
+  const int tile_width = std::min(kScreenTileSize,
+                                  width_ - column * kScreenTileSize);
+  const int tile_height = std::min(kScreenTileSize,
+                                   height_ - row * kScreenTileSize);
+  const int width = Scaled(tile_width, eighths_);
+  const int height = Scaled(tile_height, eighths_);
+  const size_t stride = static_cast<size_t>(canvas_width_) * 4;
+  uint8_t* out = &pixels_[stride * Scaled(row * kScreenTileSize, eighths_) +
+                          Scaled(column * kScreenTileSize, eighths_) * 4];
+  if (tile.encoding == TileEncoding::kJpeg) {
+    return decoder_->Decode(tile.payload, eighths_, out, stride, width,
+                            height);
+  }
+
+  const size_t raw = static_cast<size_t>(tile_width) * tile_height * 3;
+  rgb_.resize(raw);
+  if (Lz4Decompress(tile.payload.data(), tile.payload.size(), rgb_.data(),
+                    raw) != raw) {
+    return false;
+  }
+  // Each output pixel averages the factor x factor block it covers.
+  const int factor = 8 / eighths_;
+  for (int y = 0; y < height; y++) {
+    uint8_t* dst = out + stride * y;
+    const int y0 = y * factor;
+    const int y1 = std::min(y0 + factor, tile_height);
+    for (int x = 0; x < width; x++) {
+      const int x0 = x * factor;
+      const int x1 = std::min(x0 + factor, tile_width);
+      uint32_t sum[3] = {0, 0, 0};
+      for (int sy = y0; sy < y1; sy++) {
+        const uint8_t* src =
+            &rgb_[(static_cast<size_t>(sy) * tile_width + x0) * 3];
+        for (int sx = x0; sx < x1; sx++, src += 3) {
+          sum[0] += src[0];
+          sum[1] += src[1];
+          sum[2] += src[2];
+        }
+      }
+      const uint32_t n = static_cast<uint32_t>((y1 - y0) * (x1 - x0));
+      dst[x * 4] = static_cast<uint8_t>(sum[0] / n);
+      dst[x * 4 + 1] = static_cast<uint8_t>(sum[1] / n);
+      dst[x * 4 + 2] = static_cast<uint8_t>(sum[2] / n);
+      dst[x * 4 + 3] = 0xFF;
+    }
+  }
+  return true;
+}
+
+}  // namespace zapshare
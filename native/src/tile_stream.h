@@ -0,0 +1,230 @@
+#ifndef ZAPSHARE_NATIVE_TILE_STREAM_H_
+#define ZAPSHARE_NATIVE_TILE_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "screen_capture.h"
+
+namespace zapshare {
+
+// A screen mirror stream that carries only the tiles that changed.
+//
+// In MJPEG every frame is a whole JPEG, so a moving cursor costs as much
+// as a scrolling page, and most of a hotspot's bandwidth goes on pixels the
+// viewer already has. This stream sends, per frame, just the 64 x 64 tiles
+// a TileDiffer marked dirty, each as whichever is smaller of a JPEG and a
+// lossless LZ4 block: text and flat UI usually compress losslessly below
+// what JPEG would cost, and stay sharp; photos and video go as JPEG.
+//
+// Negotiation: a viewer that can composite tiles asks for the usual
+// GET /stream with a kTileStreamRequestHeader: kTileStreamVersion header.
+// A sender that speaks the protocol answers with kTileStreamContentType;
+// any other (the Android sender, older desktops) ignores the header and
+// answers with MJPEG, which the viewer tells from the Content-Type.
+//
+// Stream, little-endian:
+//   "ZST1" | le16 tables length | JPEG tables | frame*
+//   frame = le32 sequence | le32 base | le16 width | le16 height
+//         | le16 tile count | tile*
+//   tile  = le16 column | le16 row | u8 encoding | le32 length | payload
+//
+// The tables are a tables-only JPEG datastream (quantisation and Huffman
+// tables); JPEG tiles are abbreviated images that rely on them, which
+// saves some 600 bytes of headers per tile. A lossless tile is an LZ4
+// block of its pixels, three bytes (R, G, B) each, row by row.
+//
+// |base| is the sequence the frame applies on top of: the frame holds
+// every tile that changed after it. 0 marks a keyframe that holds every
+// tile. Because the sender tracks each tile's last change rather than a
+// queue of frames, a viewer that is sent only some of the frames still
+// ends up with the whole screen, and one that finds a base it doesn't
+// hold (it lost sync) drops frames until the next keyframe, which the
+// sender sends every kTileKeyframeInterval and after any size change. A
+// frame without tiles keeps a still screen's connection alive.
+
+constexpr char kTileStreamRequestHeader[] = "X-ZapShare-Mirror";
+constexpr char kTileStreamVersion[] = "tiles/1";
+constexpr char kTileStreamContentType[] = "application/x-zapshare-tiles";
+constexpr size_t kTileStreamMagicSize = 4;
+constexpr size_t kTileFrameHeaderSize = 14;
+constexpr size_t kTileHeaderSize = 9;
+constexpr int kTileKeyframeIntervalSec = 10;
+
+enum class TileEncoding : uint8_t {
+  kJpeg = 0,
+  kLossless = 1,
+};
+
+// Sender side.
+
+struct EncodedTile {
+  TileEncoding encoding = TileEncoding::kJpeg;
+  std::vector<uint8_t> payload;
+  uint32_t version = 0;  // The sequence it last changed in.
+};
+
+// The whole screen as of one sequence. Immutable once published, so every
+// viewer can write frames from it without holding up the capture.
+struct TileSnapshot {
+  uint32_t sequence = 0;
+  uint32_t resized = 0;  // The first sequence at this size.
+  int width = 0;
+  int height = 0;
+  int columns = 0;
+  int rows = 0;
+  std::vector<std::shared_ptr<const EncodedTile>> tiles;  // Row-major.
+};
+
+struct TileEncoderStats {
+  uint64_t frames = 0;
+  uint64_t jpeg_tiles = 0;
+  uint64_t lossless_tiles = 0;
+  uint64_t encode_ns = 0;  // Over frames.
+};
+
+class TileEncoder {
+ public:
+  // Whether this build can encode tiles (it needs libjpeg).
+  static bool Available();
+
+  explicit TileEncoder(int quality = 70);
+  ~TileEncoder();
+
+  TileEncoder(const TileEncoder&) = delete;
+  TileEncoder& operator=(const TileEncoder&) = delete;
+
+  // The stream's header: magic and JPEG tables.
+  const std::vector<uint8_t>& header() const { return header_; }
+
+  // Encodes the tiles |differ| marked dirty in |frame| and returns the
+  // screen after them as the next sequence. The first frame, and any of a
+  // new size, are encoded whole. Null if libjpeg failed; the differ should
+  // then be invalidated.
+  std::shared_ptr<const TileSnapshot> Update(const ScreenFrame& frame,
+                                             const TileDiffer& differ);
+
+  const TileEncoderStats& stats() const { return stats_; }
+
+ private:
+  struct Compressor;
+
+  int quality_;
+  std::unique_ptr<Compressor> compressor_;
+  std::vector<uint8_t> header_;
+  std::shared_ptr<const TileSnapshot> snapshot_;
+  std::vector<uint8_t> packed_;  // One tile's pixels, for LZ4.
+  TileEncoderStats stats_;
+};
+
+// Appends to |out| the frame that brings a viewer holding |base| to
+// |snapshot|: the tiles changed since, or every tile if |base| is 0 or from
+// before the last size change. Returns the number of tiles written.
+size_t WriteTileFrame(const TileSnapshot& snapshot, uint32_t base,
+                      std::vector<uint8_t>* out);
+
+// Receiver side.
+
+struct TileRecord {
+  int column = 0;
+  int row = 0;
+  TileEncoding encoding = TileEncoding::kJpeg;
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+struct TileFrame {
+  uint32_t sequence = 0;
+  uint32_t base = 0;
+  int width = 0;
+  int height = 0;
+  std::vector<TileRecord> tiles;
+};
+
+// Cuts a tile stream into frames as its bytes arrive.
+class TileStreamReader {
+ public:
+  // Appends |data|. Frames returned by Next() before are invalid after.
+  void Feed(const uint8_t* data, size_t len);
+  // The next complete frame; false until more is fed, or once the stream
+  // is found to be malformed.
+  bool Next(TileFrame* out);
+
+  // The JPEG tables, once the stream header has arrived.
+  const std::vector<uint8_t>& tables() const { return tables_; }
+  bool failed() const { return failed_; }
+
+ private:
+  std::vector<uint8_t> buffer_;
+  size_t head_ = 0;
+  std::vector<uint8_t> tables_;
+  bool started_ = false;
+  bool failed_ = false;
+};
+
+// Whether |data| starts like a tile stream, for a viewer that hasn't been
+// told which kind it's reading; needs kTileStreamMagicSize bytes.
+bool LooksLikeTileStream(const uint8_t* data, size_t len);
+
+// The screen a viewer composes from tiles, as RGBA.
+//
+// Decoding scales by a power of two towards a target size, like the MJPEG
+// path's scaled IDCT: JPEG tiles through libjpeg, lossless ones by
+// averaging. The newest payload of every tile is kept, so a change of
+// scale or a lost canvas is redrawn without asking the sender for a
+// keyframe.
+class TileCanvas {
+ public:
+  TileCanvas();
+  ~TileCanvas();
+
+  TileCanvas(const TileCanvas&) = delete;
+  TileCanvas& operator=(const TileCanvas&) = delete;
+
+  // Loads the stream's JPEG tables; false if they aren't valid.
+  bool SetTables(const std::vector<uint8_t>& tables);
+
+  struct Tile {
+    TileEncoding encoding = TileEncoding::kJpeg;
+    std::vector<uint8_t> payload;
+  };
+
+  // Replaces tile (|column|, |row|) of a |width| x |height| screen. A new
+  // size, or |reset|, forgets every tile first.
+  void Put(int width, int height, bool reset, int column, int row,
+           Tile tile);
+  // Draws what changed since the last call at the scale |target_width| x
+  // |target_height| calls for (0 for full size). Returns the number of
+  // tiles that failed to decode.
+  size_t Draw(int target_width, int target_height);
+
+  const std::vector<uint8_t>& pixels() const { return pixels_; }
+  int width() const { return canvas_width_; }
+  int height() const { return canvas_height_; }
+
+ private:
+  struct Decoder;
+
+  // False if the tile can't be decoded.
+  bool DrawTile(int column, int row);
+
+  std::unique_ptr<Decoder> decoder_;
+  int width_ = 0;
+  int height_ = 0;
+  int columns_ = 0;
+  int rows_ = 0;
+  std::vector<Tile> tiles_;
+  std::vector<uint8_t> changed_;
+  int eighths_ = 0;  // 0 until drawn.
+  int canvas_width_ = 0;
+  int canvas_height_ = 0;
+  std::vector<uint8_t> pixels_;
+  std::vector<uint8_t> rgb_;  // One lossless tile, unpacked.
+};
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_TILE_STREAM_H_
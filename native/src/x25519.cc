@@ -0,0 +1,221 @@
+#include "x25519.h"
+
+#include <cstring>
+
+namespace zapshare {
+
+namespace {
+
+// Field elements mod 2^255 - 19 as sixteen 16-bit limbs held in int64, the
+// representation TweetNaCl uses: products fit without 128-bit arithmetic
+// and every operation is branch-free.
+using Fe = int64_t[16];
+
+constexpr int64_t kOne[16] = {1};
+constexpr int64_t k121665[16] = {0xDB41, 1};
+constexpr int64_t kCurveA[16] = {0x6D06, 7};  // 486662
+
+void Copy(Fe out, const Fe in) { std::memcpy(out, in, sizeof(Fe)); }
+
+void Carry(Fe o) {
+  for (int i = 0; i < 16; i++) {
+    o[i] += int64_t{1} << 16;
+    const int64_t c = o[i] >> 16;
+    // The carry out of the top limb wraps around times 38 (2^256 = 38).
+    if (i < 15) {
+      o[i + 1] += c - 1;
+    } else {
+      o[0] += 38 * (c - 1);
+    }
+    o[i] -= c * 65536;
+  }
+}
+
+// Swaps |p| and |q| when |b| is 1, without branching on it.
+void Select(Fe p, Fe q, int64_t b) {
+  const int64_t mask = ~(b - 1);
+  for (int i = 0; i < 16; i++) {
+    const int64_t t = mask & (p[i] ^ q[i]);
+    p[i] ^= t;
+    q[i] ^= t;
+  }
+}
+
+void Pack(uint8_t out[32], const Fe n) {
+  Fe m;
+  Fe t;
+  Copy(t, n);
+  Carry(t);
+  Carry(t);
+  Carry(t);
+  // Subtract p at most twice to get the canonical value.
+  for (int j = 0; j < 2; j++) {
+    m[0] = t[0] - 0xFFED;
+    for (int i = 1; i < 15; i++) {
+      m[i] = t[i] - 0xFFFF - ((m[i - 1] >> 16) & 1);
+      m[i - 1] &= 0xFFFF;
+    }
+    m[15] = t[15] - 0x7FFF - ((m[14] >> 16) & 1);
+    const int64_t borrow = (m[15] >> 16) & 1;
+    m[14] &= 0xFFFF;
+    Select(t, m, 1 - borrow);
+  }
+  for (int i = 0; i < 16; i++) {
+    out[2 * i] = static_cast<uint8_t>(t[i] & 0xFF);
+    out[2 * i + 1] = static_cast<uint8_t>(t[i] >> 8);
+  }
+}
+
+void Unpack(Fe out, const uint8_t in[32]) {
+  for (int i = 0; i < 16; i++) {
+    out[i] = in[2 * i] + (int64_t{in[2 * i + 1]} << 8);
+  }
+  out[15] &= 0x7FFF;
+}
+
+void Add(Fe o, const Fe a, const Fe b) {
+  for (int i = 0; i < 16; i++) o[i] = a[i] + b[i];
+}
+
+void Sub(Fe o, const Fe a, const Fe b) {
+  for (int i = 0; i < 16; i++) o[i] = a[i] - b[i];
+}
+
+void Mul(Fe o, const Fe a, const Fe b) {
+  int64_t t[31] = {};
+  for (int i = 0; i < 16; i++) {
+    for (int j = 0; j < 16; j++) t[i + j] += a[i] * b[j];
+  }
+  for (int i = 0; i < 15; i++) t[i] += 38 * t[i + 16];
+  for (int i = 0; i < 16; i++) o[i] = t[i];
+  Carry(o);
+  Carry(o);
+}
+
+void Square(Fe o, const Fe a) { Mul(o, a, a); }
+
+// a^(p - 2) by Fermat.
+void Invert(Fe o, const Fe a) {
+  Fe c;
+  Copy(c, a);
+  for (int i = 253; i >= 0; i--) {
+    Square(c, c);
+    if (i != 2 && i != 4) Mul(c, c, a);
+  }
+  Copy(o, c);
+}
+
+// 1 if |a| is zero mod p, else 0. Branch-free over the packed bytes.
+int64_t IsZero(const Fe a) {
+  uint8_t bytes[32];
+  Pack(bytes, a);
+  uint32_t acc = 0;
+  for (uint8_t b : bytes) acc |= b;
+  return static_cast<int64_t>((acc - 1) >> 31 & 1);
+}
+
+// 1 if |a| is a square mod p (zero included), via Euler's criterion:
+// a^((p - 1) / 2) is 1 or 0 for squares and -1 otherwise.
+int64_t IsSquare(const Fe a) {
+  // (p - 1) / 2 = 2^254 - 10: bits 253..4 set, then 0110.
+  Fe c;
+  Copy(c, kOne);
+  for (int i = 253; i >= 0; i--) {
+    Square(c, c);
+    const bool bit = i >= 4 || i == 1 || i == 2;
+    if (bit) Mul(c, c, a);
+  }
+  Fe minus_one;
+  Sub(minus_one, c, kOne);
+  return IsZero(minus_one) | IsZero(c);
+}
+
+}  // namespace
+
+bool X25519(uint8_t out[kX25519Size], const uint8_t scalar[kX25519Size],
+            const uint8_t point[kX25519Size]) {
+  uint8_t z[32];
+  std::memcpy(z, scalar, 32);
+  z[31] = (z[31] & 127) | 64;
+  z[0] &= 248;
+
+  // Montgomery ladder over (a : c) and (b : d).
+  Fe x;
+  Fe a = {1};
+  Fe b;
+  Fe c = {};
+  Fe d = {1};
+  Fe e;
+  Fe f;
+  Unpack(x, point);
+  Copy(b, x);
+  for (int i = 254; i >= 0; i--) {
+    const int64_t bit = (z[i >> 3] >> (i & 7)) & 1;
+    Select(a, b, bit);
+    Select(c, d, bit);
+    Add(e, a, c);
+    Sub(a, a, c);
+    Add(c, b, d);
+    Sub(b, b, d);
+    Square(d, e);
+    Square(f, a);
+    Mul(a, c, a);
+    Mul(c, b, e);
+    Add(e, a, c);
+    Sub(a, a, c);
+    Square(b, a);
+    Sub(c, d, f);
+    Mul(a, c, k121665);
+    Add(a, a, d);
+    Mul(c, c, a);
+    Mul(a, d, f);
+    Mul(d, b, x);
+    Square(b, e);
+    Select(a, b, bit);
+    Select(c, d, bit);
+  }
+  Invert(c, c);
+  Mul(a, a, c);
+  Pack(out, a);
+
+  uint8_t acc = 0;
+  for (size_t i = 0; i < kX25519Size; i++) acc |= out[i];
+  return acc != 0;
+}
+
+void X25519MapToCurve(uint8_t point[kX25519Size],
+                      const uint8_t hash[kX25519Size]) {
+  Fe r;
+  Unpack(r, hash);
+
+  // x1 = -A / (1 + 2r^2), with the denominator forced to 1 when it is 0.
+  Fe t;
+  Fe den;
+  Square(t, r);
+  Add(t, t, t);
+  Add(den, kOne, t);
+  Fe one;
+  Copy(one, kOne);
+  Select(den, one, IsZero(den));
+  Fe x1;
+  Fe zero = {};
+  Invert(den, den);
+  Mul(x1, kCurveA, den);
+  Sub(x1, zero, x1);
+
+  // g(x1) = x1^3 + A x1^2 + x1; if it isn't a square, use x2 = -x1 - A.
+  Fe gx1;
+  Fe t2;
+  Square(t, x1);
+  Mul(t2, kCurveA, x1);
+  Add(t, t, t2);
+  Add(t, t, kOne);
+  Mul(gx1, t, x1);
+  Fe x2;
+  Sub(x2, zero, x1);
+  Sub(x2, x2, kCurveA);
+  Select(x2, x1, IsSquare(gx1));
+  Pack(point, x2);
+}
+
+}  // namespace zapshare
@@ -0,0 +1,29 @@
+#ifndef ZAPSHARE_NATIVE_X25519_H_
+#define ZAPSHARE_NATIVE_X25519_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace zapshare {
+
+constexpr size_t kX25519Size = 32;
+
+// Curve25519 Diffie-Hellman (RFC 7748) on u-coordinates. Constant time in
+// the scalar, which is clamped as the RFC describes. Only used for the
+// pairing handshake, so it favours short, auditable field arithmetic over
+// speed (a few hundred microseconds per call).
+//
+// Returns false if the result is all zeros, which means |point| had small
+// order and the exchange must be abandoned.
+bool X25519(uint8_t out[kX25519Size], const uint8_t scalar[kX25519Size],
+            const uint8_t point[kX25519Size]);
+
+// Maps 32 uniform bytes to a curve point with Elligator 2 (the
+// map_to_curve_elligator2_curve25519 of RFC 9380). Used to derive a
+// password-dependent generator, so nobody knows its discrete log.
+void X25519MapToCurve(uint8_t point[kX25519Size],
+                      const uint8_t hash[kX25519Size]);
+
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_X25519_H_
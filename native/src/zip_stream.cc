@@ -0,0 +1,691 @@
+#include "zip_stream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "compress.h"
+#include "crc32.h"
+
+#if defined(ZS_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace zapshare {
+
+namespace {
+
+constexpr uint32_t kLocalSig = 0x04034b50;
+constexpr uint32_t kDescriptorSig = 0x08074b50;
+constexpr uint32_t kCentralSig = 0x02014b50;
+constexpr uint32_t kZip64EndSig = 0x06064b50;
+constexpr uint32_t kZip64LocatorSig = 0x07064b50;
+constexpr uint32_t kEndSig = 0x06054b50;
+
+constexpr uint16_t kFlags = 0x0808;  // Data descriptor, UTF-8 names.
+constexpr uint16_t kMethodStore = 0;
+constexpr uint16_t kMethodDeflate = 8;
+constexpr uint16_t kVersion = 20;
+constexpr uint16_t kVersionZip64 = 45;
+constexpr uint16_t kZip64ExtraId = 0x0001;
+constexpr uint32_t kMax32 = 0xFFFFFFFF;
+constexpr uint16_t kMax16 = 0xFFFF;
+
+constexpr size_t kLocalFixed = 30;
+constexpr size_t kCentralFixed = 46;
+constexpr size_t kEndFixed = 22;
+constexpr size_t kZip64EndFixed = 56 + 20;  // Record plus locator.
+
+// The writer decides between store and deflate from this much of an entry.
+constexpr size_t kDecideBytes = 64 * 1024;
+constexpr uint64_t kMinDeflateSize = 256;
+// Deflate can grow incompressible input slightly; staying well under 4 GB
+// keeps a deflated entry out of ZIP64, whose local header would need the
+// compressed size up front.
+constexpr uint64_t kMaxDeflateSize = 0xF0000000;
+constexpr double kIncompressibleEntropy = 7.2;
+
+struct DosTime {
+  uint16_t time;
+  uint16_t date;
+};
+
+// UTC, clamped to the 1980-2107 range DOS dates can hold.
+DosTime ToDos(int64_t mtime_ms) {
+  int64_t secs = mtime_ms / 1000;
+  if (secs < 315532800) secs = 315532800;  // 1980-01-01
+  int64_t days = secs / 86400;
+  const int64_t rem = secs % 86400;
+  // Days to civil date, after Howard Hinnant's days_from_civil inverse.
+  days += 719468;
+  const int64_t era = days / 146097;
+  const int64_t doe = days - era * 146097;
+  const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const int64_t mp = (5 * doy + 2) / 153;
+  const int64_t day = doy - (153 * mp + 2) / 5 + 1;
+  const int64_t month = mp < 10 ? mp + 3 : mp - 9;
+  int64_t year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+  if (year > 2107) return {0xBF7D, 0xFF9F};  // 2107-12-31 23:59:58
+  DosTime t;
+  t.time = static_cast<uint16_t>((rem / 3600) << 11 | (rem / 60 % 60) << 5 |
+                                 (rem % 60) / 2);
+  t.date = static_cast<uint16_t>((year - 1980) << 9 | month << 5 | day);
+  return t;
+}
+
+void Put16(std::vector<uint8_t>* out, uint16_t v) {
+  out->push_back(static_cast<uint8_t>(v));
+  out->push_back(static_cast<uint8_t>(v >> 8));
+}
+
+void Put32(std::vector<uint8_t>* out, uint32_t v) {
+  for (int i = 0; i < 4; i++) out->push_back(static_cast<uint8_t>(v >> 8 * i));
+}
+
+void Put64(std::vector<uint8_t>* out, uint64_t v) {
+  for (int i = 0; i < 8; i++) out->push_back(static_cast<uint8_t>(v >> 8 * i));
+}
+
+uint32_t Clamp32(uint64_t v, bool zip64) {
+  return zip64 ? kMax32 : static_cast<uint32_t>(v);
+}
+
+// The local header of an entry that may reach 4 GB carries a ZIP64 extra
+// field, which also makes its data descriptor use 8-byte sizes.
+bool LocalZip64(uint64_t size) { return size >= kMax32; }
+
+bool CentralZip64(uint64_t compressed, uint64_t size, uint64_t offset) {
+  return compressed >= kMax32 || size >= kMax32 || offset >= kMax32;
+}
+
+bool EndZip64(uint64_t count, uint64_t cd_offset, uint64_t cd_size) {
+  return count >= kMax16 || cd_offset >= kMax32 || cd_size >= kMax32;
+}
+
+uint64_t LocalSize(const std::string& name, uint64_t size) {
+  return kLocalFixed + name.size() + (LocalZip64(size) ? 20 : 0);
+}
+
+uint64_t DescriptorSize(uint64_t size) { return LocalZip64(size) ? 24 : 16; }
+
+uint64_t CentralSize(const std::string& name, uint64_t compressed,
+                     uint64_t size, uint64_t offset) {
+  return kCentralFixed + name.size() +
+         (CentralZip64(compressed, size, offset) ? 28 : 0);
+}
+
+uint64_t EndSize(uint64_t count, uint64_t cd_offset, uint64_t cd_size) {
+  return kEndFixed +
+         (EndZip64(count, cd_offset, cd_size) ? kZip64EndFixed : 0);
+}
+
+void AppendLocal(std::vector<uint8_t>* out, const ZipEntry& e,
+                 uint16_t method) {
+  const bool zip64 = LocalZip64(e.size);
+  const DosTime t = ToDos(e.mtime_ms);
+  Put32(out, kLocalSig);
+  Put16(out, zip64 ? kVersionZip64 : kVersion);
+  Put16(out, kFlags);
+  Put16(out, method);
+  Put16(out, t.time);
+  Put16(out, t.date);
+  Put32(out, 0);  // CRC and sizes follow in the data descriptor.
+  Put32(out, zip64 ? kMax32 : 0);
+  Put32(out, zip64 ? kMax32 : 0);
+  Put16(out, static_cast<uint16_t>(e.name.size()));
+  Put16(out, zip64 ? 20 : 0);
+  out->insert(out->end(), e.name.begin(), e.name.end());
+  if (zip64) {
+    Put16(out, kZip64ExtraId);
+    Put16(out, 16);
+    Put64(out, 0);
+    Put64(out, 0);
+  }
+}
+
+void AppendDescriptor(std::vector<uint8_t>* out, uint32_t crc,
+                      uint64_t compressed, uint64_t size) {
+  Put32(out, kDescriptorSig);
+  Put32(out, crc);
+  if (LocalZip64(size)) {
+    Put64(out, compressed);
+    Put64(out, size);
+  } else {
+    Put32(out, static_cast<uint32_t>(compressed));
+    Put32(out, static_cast<uint32_t>(size));
+  }
+}
+
+void AppendCentral(std::vector<uint8_t>* out, const ZipEntry& e,
+                   uint16_t method, uint32_t crc, uint64_t compressed,
+                   uint64_t offset) {
+  const bool zip64 = CentralZip64(compressed, e.size, offset);
+  const DosTime t = ToDos(e.mtime_ms);
+  const uint16_t version =
+      zip64 || LocalZip64(e.size) ? kVersionZip64 : kVersion;
+  Put32(out, kCentralSig);
+  Put16(out, kVersionZip64);  // Made by: MS-DOS attributes, spec 4.5.
+  Put16(out, version);
+  Put16(out, kFlags);
+  Put16(out, method);
+  Put16(out, t.time);
+  Put16(out, t.date);
+  Put32(out, crc);
+  Put32(out, Clamp32(compressed, zip64));
+  Put32(out, Clamp32(e.size, zip64));
+  Put16(out, static_cast<uint16_t>(e.name.size()));
+  Put16(out, zip64 ? 28 : 0);
+  Put16(out, 0);  // Comment.
+  Put16(out, 0);  // Disk.
+  Put16(out, 0);  // Internal attributes.
+  Put32(out, 0);  // External attributes.
+  Put32(out, Clamp32(offset, zip64));
+  out->insert(out->end(), e.name.begin(), e.name.end());
+  if (zip64) {
+    Put16(out, kZip64ExtraId);
+    Put16(out, 24);
+    Put64(out, e.size);
+    Put64(out, compressed);
+    Put64(out, offset);
+  }
+}
+
+void AppendEnd(std::vector<uint8_t>* out, uint64_t count, uint64_t cd_offset,
+               uint64_t cd_size) {
+  const bool zip64 = EndZip64(count, cd_offset, cd_size);
+  if (zip64) {
+    const uint64_t record_offset = cd_offset + cd_size;
+    Put32(out, kZip64EndSig);
+    Put64(out, 44);  // Size of the rest of the record.
+    Put16(out, kVersionZip64);
+    Put16(out, kVersionZip64);
+    Put32(out, 0);
+    Put32(out, 0);
+    Put64(out, count);
+    Put64(out, count);
+    Put64(out, cd_size);
+    Put64(out, cd_offset);
+    Put32(out, kZip64LocatorSig);
+    Put32(out, 0);
+    Put64(out, record_offset);
+    Put32(out, 1);
+  }
+  Put32(out, kEndSig);
+  Put16(out, 0);
+  Put16(out, 0);
+  const uint16_t count16 =
+      zip64 ? kMax16 : static_cast<uint16_t>(count);
+  Put16(out, count16);
+  Put16(out, count16);
+  Put32(out, Clamp32(cd_size, zip64));
+  Put32(out, Clamp32(cd_offset, zip64));
+  Put16(out, 0);  // Comment.
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// ZipLayout
+
+ZipLayout::ZipLayout(std::vector<ZipEntry> entries) {
+  entries_.resize(entries.size());
+  uint64_t pos = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    Item& item = entries_[i];
+    item.entry = std::move(entries[i]);
+    item.header_offset = pos;
+    const uint32_t e = static_cast<uint32_t>(i);
+    const uint64_t size = item.entry.size;
+    const uint64_t local = LocalSize(item.entry.name, size);
+    regions_.push_back({pos, local, Part::kLocal, e});
+    pos += local;
+    if (size > 0) {
+      regions_.push_back({pos, size, Part::kData, e});
+      pos += size;
+    }
+    regions_.push_back({pos, DescriptorSize(size), Part::kDescriptor, e});
+    pos += DescriptorSize(size);
+  }
+  central_offset_ = pos;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const Item& item = entries_[i];
+    const uint64_t len = CentralSize(item.entry.name, item.entry.size,
+                                     item.entry.size, item.header_offset);
+    regions_.push_back({pos, len, Part::kCentral, static_cast<uint32_t>(i)});
+    pos += len;
+  }
+  central_size_ = pos - central_offset_;
+  const uint64_t end =
+      EndSize(entries_.size(), central_offset_, central_size_);
+  regions_.push_back({pos, end, Part::kEnd, 0});
+  size_ = pos + end;
+}
+
+size_t ZipLayout::RegionAt(uint64_t pos) const {
+  auto it = std::upper_bound(
+      regions_.begin(), regions_.end(), pos,
+      [](uint64_t p, const Region& r) { return p < r.start; });
+  return static_cast<size_t>(it - regions_.begin()) - 1;
+}
+
+ZipLayout::Span ZipLayout::Locate(uint64_t pos) const {
+  size_t i = RegionAt(pos);
+  const Region& r = regions_[i];
+  if (r.part == Part::kData) {
+    return {static_cast<int64_t>(r.entry), pos - r.start,
+            r.start + r.length - pos};
+  }
+  // Run to the next entry's data, or the end of the archive.
+  while (i + 1 < regions_.size() && regions_[i + 1].part != Part::kData) i++;
+  return {-1, pos, regions_[i].start + regions_[i].length - pos};
+}
+
+bool ZipLayout::Render(uint64_t pos, size_t len, uint8_t* out,
+                       uint32_t* missing) const {
+  std::vector<uint8_t> bytes;
+  while (len > 0) {
+    const Region& r = regions_[RegionAt(pos)];
+    if (r.part == Part::kData) {
+      *missing = kMax32;
+      return false;
+    }
+    if (r.part == Part::kDescriptor || r.part == Part::kCentral) {
+      uint32_t crc;
+      if (!EntryCrc(r.entry, &crc)) {
+        *missing = r.entry;
+        return false;
+      }
+    }
+    bytes.clear();
+    RenderRegion(r, &bytes);
+    const size_t skip = static_cast<size_t>(pos - r.start);
+    const size_t take = std::min(len, bytes.size() - skip);
+    std::memcpy(out, bytes.data() + skip, take);
+    out += take;
+    pos += take;
+    len -= take;
+  }
+  return true;
+}
+
+void ZipLayout::RenderRegion(const Region& r,
+                             std::vector<uint8_t>* out) const {
+  uint32_t crc = 0;
+  switch (r.part) {
+    case Part::kLocal:
+      AppendLocal(out, entries_[r.entry].entry, kMethodStore);
+      break;
+    case Part::kDescriptor:
+      EntryCrc(r.entry, &crc);
+      AppendDescriptor(out, crc, entries_[r.entry].entry.size,
+                       entries_[r.entry].entry.size);
+      break;
+    case Part::kCentral: {
+      const Item& item = entries_[r.entry];
+      EntryCrc(r.entry, &crc);
+      AppendCentral(out, item.entry, kMethodStore, crc, item.entry.size,
+                    item.header_offset);
+      break;
+    }
+    case Part::kEnd:
+      AppendEnd(out, entries_.size(), central_offset_, central_size_);
+      break;
+    case Part::kData:
+      break;
+  }
+}
+
+void ZipLayout::RecordCrc(uint32_t entry, uint64_t offset, uint64_t len,
+                          uint32_t crc) {
+  if (entry >= entries_.size() || len == 0) return;
+  Item& item = entries_[entry];
+  if (offset > item.entry.size || len > item.entry.size - offset) return;
+  auto& pieces = item.pieces;
+  if (offset == 0 && len == item.entry.size) {
+    pieces.clear();
+    pieces[0] = {len, crc};
+    return;
+  }
+
+  auto next = pieces.lower_bound(offset);
+  if (next != pieces.end() && next->first < offset + len) return;
+  if (next != pieces.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second.length > offset) return;
+    if (prev->first + prev->second.length == offset) {
+      prev->second.crc = Crc32Combine(prev->second.crc, crc, len);
+      prev->second.length += len;
+      if (next != pieces.end() && next->first == offset + len) {
+        prev->second.crc = Crc32Combine(prev->second.crc, next->second.crc,
+                                        next->second.length);
+        prev->second.length += next->second.length;
+        pieces.erase(next);
+      }
+      return;
+    }
+  }
+  CrcPiece piece{len, crc};
+  if (next != pieces.end() && next->first == offset + len) {
+    piece.crc = Crc32Combine(crc, next->second.crc, next->second.length);
+    piece.length += next->second.length;
+    pieces.erase(next);
+  }
+  pieces[offset] = piece;
+}
+
+bool ZipLayout::EntryCrc(uint32_t entry, uint32_t* crc) const {
+  const Item& item = entries_[entry];
+  if (item.entry.size == 0) {
+    *crc = 0;
+    return true;
+  }
+  if (item.pieces.size() != 1) return false;
+  const auto& first = *item.pieces.begin();
+  if (first.first != 0 || first.second.length != item.entry.size) {
+    return false;
+  }
+  *crc = first.second.crc;
+  return true;
+}
+
+bool ZipLayout::CrcGap(uint32_t entry, uint64_t* start, uint64_t* end) const {
+  const Item& item = entries_[entry];
+  uint64_t cursor = 0;
+  for (const auto& p : item.pieces) {
+    if (p.first > cursor) {
+      *start = cursor;
+      *end = p.first;
+      return true;
+    }
+    cursor = p.first + p.second.length;
+  }
+  if (cursor >= item.entry.size) return false;
+  *start = cursor;
+  *end = item.entry.size;
+  return true;
+}
+
+uint64_t ZipLayout::CrcCovered(uint32_t entry) const {
+  uint64_t covered = 0;
+  for (const auto& p : entries_[entry].pieces) covered += p.second.length;
+  return covered;
+}
+
+// ---------------------------------------------------------------------------
+// ZipStreamWriter
+
+// One raw-deflate stream, reset between entries.
+struct ZipStreamWriter::Deflater {
+#if defined(ZS_HAVE_ZLIB)
+  z_stream z;
+  bool ready = false;
+
+  ~Deflater() {
+    if (ready) deflateEnd(&z);
+  }
+
+  z_stream* Get() {
+    if (!ready) {
+      std::memset(&z, 0, sizeof(z));
+      if (deflateInit2(&z, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) !=
+          Z_OK) {
+        return nullptr;
+      }
+      ready = true;
+    }
+    return &z;
+  }
+#endif
+};
+
+ZipStreamWriter::ZipStreamWriter(bool deflate)
+    : deflate_(deflate), deflater_(new Deflater) {
+#if !defined(ZS_HAVE_ZLIB)
+  deflate_ = false;
+#endif
+}
+
+ZipStreamWriter::~ZipStreamWriter() = default;
+
+void ZipStreamWriter::BeginEntry(const ZipEntry& entry) {
+  written_.push_back({entry, kMethodStore, 0, 0, offset_});
+  in_entry_ = true;
+  started_ = false;
+  method_ = kMethodStore;
+  crc_ = 0;
+  fed_ = 0;
+  compressed_ = 0;
+  head_.clear();
+  if (!deflate_ || entry.size < kMinDeflateSize ||
+      entry.size >= kMaxDeflateSize) {
+    StartData();
+  }
+}
+
+void ZipStreamWriter::StartData() {
+  const ZipEntry& entry = written_.back().entry;
+  if (deflate_ && entry.size >= kMinDeflateSize &&
+      entry.size < kMaxDeflateSize &&
+      SampleEntropy(head_.data(), head_.size()) < kIncompressibleEntropy) {
+    method_ = kMethodDeflate;
+  }
+  std::vector<uint8_t> header;
+  AppendLocal(&header, entry, method_);
+  Emit(header.data(), header.size());
+  started_ = true;
+  if (head_.empty()) return;
+  if (method_ == kMethodDeflate) {
+    Compress(head_.data(), head_.size(), false);
+  } else {
+    Emit(head_.data(), head_.size());
+    compressed_ += head_.size();
+  }
+  head_.clear();
+}
+
+void ZipStreamWriter::Update(const uint8_t* data, size_t len) {
+  if (!in_entry_ || len == 0) return;
+  crc_ = Crc32(crc_, data, len);
+  fed_ += len;
+  if (!started_) {
+    const size_t want = static_cast<size_t>(
+        std::min<uint64_t>(kDecideBytes, written_.back().entry.size));
+    const size_t take = std::min(len, want - std::min(want, head_.size()));
+    head_.insert(head_.end(), data, data + take);
+    data += take;
+    len -= take;
+    if (head_.size() < want) return;
+    StartData();
+  }
+  if (len == 0) return;
+  if (method_ == kMethodDeflate) {
+    Compress(data, len, false);
+  } else {
+    Emit(data, len);
+    compressed_ += len;
+  }
+}
+
+void ZipStreamWriter::Compress(const uint8_t* data, size_t len, bool finish) {
+#if defined(ZS_HAVE_ZLIB)
+  z_stream* z = deflater_->Get();
+  if (z == nullptr) return;
+  uint8_t buf[64 * 1024];
+  z->next_in = const_cast<Bytef*>(data);
+  z->avail_in = static_cast<uInt>(len);
+  int ret;
+  do {
+    z->next_out = buf;
+    z->avail_out = sizeof(buf);
+    ret = deflate(z, finish ? Z_FINISH : Z_NO_FLUSH);
+    const size_t n = sizeof(buf) - z->avail_out;
+    Emit(buf, n);
+    compressed_ += n;
+  } while (z->avail_out == 0 || (finish && ret == Z_OK));
+  if (finish) deflateReset(z);
+#else
+  (void)data;
+  (void)len;
+  (void)finish;
+#endif
+}
+
+bool ZipStreamWriter::EndEntry() {
+  if (!in_entry_) return false;
+  if (!started_) StartData();
+  if (method_ == kMethodDeflate) Compress(nullptr, 0, true);
+  Written& w = written_.back();
+  const bool complete = fed_ == w.entry.size;
+  w.method = method_;
+  w.crc = crc_;
+  w.compressed = compressed_;
+  std::vector<uint8_t> descriptor;
+  AppendDescriptor(&descriptor, crc_, compressed_, w.entry.size);
+  Emit(descriptor.data(), descriptor.size());
+  in_entry_ = false;
+  return complete;
+}
+
+void ZipStreamWriter::Finish() {
+  if (in_entry_) EndEntry();
+  const uint64_t cd_offset = offset_;
+  std::vector<uint8_t> record;
+  for (const Written& w : written_) {
+    record.clear();
+    AppendCentral(&record, w.entry, w.method, w.crc, w.compressed,
+                  w.header_offset);
+    Emit(record.data(), record.size());
+  }
+  record.clear();
+  AppendEnd(&record, written_.size(), cd_offset, offset_ - cd_offset);
+  Emit(record.data(), record.size());
+}
+
+void ZipStreamWriter::Emit(const uint8_t* data, size_t len) {
+  out_.insert(out_.end(), data, data + len);
+  offset_ += len;
+}
+
+size_t ZipStreamWriter::Read(uint8_t* out, size_t cap) {
+  const size_t n = std::min(cap, Pending());
+  std::memcpy(out, out_.data() + out_read_, n);
+  out_read_ += n;
+  if (out_read_ == out_.size()) {
+    out_.clear();
+    out_read_ = 0;
+  }
+  return n;
+}
+
+}  // namespace zapshare
+
+namespace {
+
+zapshare::ZipLayout* Unwrap(ZsZipLayout* l) {
+  return reinterpret_cast<zapshare::ZipLayout*>(l);
+}
+
+const zapshare::ZipLayout* Unwrap(const ZsZipLayout* l) {
+  return reinterpret_cast<const zapshare::ZipLayout*>(l);
+}
+
+zapshare::ZipStreamWriter* Unwrap(ZsZipWriter* w) {
+  return reinterpret_cast<zapshare::ZipStreamWriter*>(w);
+}
+
+const zapshare::ZipStreamWriter* Unwrap(const ZsZipWriter* w) {
+  return reinterpret_cast<const zapshare::ZipStreamWriter*>(w);
+}
+
+}  // namespace
+
+ZsZipLayout* zs_zip_layout_new(const char* names, size_t names_len,
+                               const uint64_t* sizes,
+                               const int64_t* mtimes_ms, uint32_t count) {
+  std::vector<zapshare::ZipEntry> entries(count);
+  size_t pos = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (pos >= names_len) return nullptr;
+    const void* nul = std::memchr(names + pos, 0, names_len - pos);
+    if (nul == nullptr) return nullptr;
+    const size_t len = static_cast<const char*>(nul) - (names + pos);
+    if (len > 0xFFFF) return nullptr;
+    entries[i].name.assign(names + pos, len);
+    entries[i].size = sizes[i];
+    entries[i].mtime_ms = mtimes_ms[i];
+    pos += len + 1;
+  }
+  return reinterpret_cast<ZsZipLayout*>(
+      new zapshare::ZipLayout(std::move(entries)));
+}
+
+void zs_zip_layout_free(ZsZipLayout* layout) { delete Unwrap(layout); }
+
+uint64_t zs_zip_layout_size(const ZsZipLayout* layout) {
+  return Unwrap(layout)->size();
+}
+
+void zs_zip_layout_locate(const ZsZipLayout* layout, uint64_t pos,
+                          int64_t* entry, uint64_t* offset,
+                          uint64_t* length) {
+  const zapshare::ZipLayout::Span span = Unwrap(layout)->Locate(pos);
+  *entry = span.entry;
+  *offset = span.offset;
+  *length = span.length;
+}
+
+int32_t zs_zip_layout_render(const ZsZipLayout* layout, uint64_t pos,
+                             size_t len, uint8_t* out, uint32_t* missing) {
+  return Unwrap(layout)->Render(pos, len, out, missing) ? 1 : 0;
+}
+
+void zs_zip_layout_record_crc(ZsZipLayout* layout, uint32_t entry,
+                              uint64_t offset, uint64_t len, uint32_t crc) {
+  Unwrap(layout)->RecordCrc(entry, offset, len, crc);
+}
+
+int32_t zs_zip_layout_crc_gap(const ZsZipLayout* layout, uint32_t entry,
+                              uint64_t* start, uint64_t* end) {
+  return Unwrap(layout)->CrcGap(entry, start, end) ? 1 : 0;
+}
+
+uint64_t zs_zip_layout_crc_covered(const ZsZipLayout* layout,
+                                   uint32_t entry) {
+  return Unwrap(layout)->CrcCovered(entry);
+}
+
+ZsZipWriter* zs_zip_writer_new(int32_t deflate) {
+  return reinterpret_cast<ZsZipWriter*>(
+      new zapshare::ZipStreamWriter(deflate != 0));
+}
+
+void zs_zip_writer_free(ZsZipWriter* writer) { delete Unwrap(writer); }
+
+void zs_zip_writer_begin_entry(ZsZipWriter* writer, const char* name,
+                               uint64_t size, int64_t mtime_ms) {
+  zapshare::ZipEntry entry;
+  entry.name = name;
+  entry.size = size;
+  entry.mtime_ms = mtime_ms;
+  Unwrap(writer)->BeginEntry(entry);
+}
+
+void zs_zip_writer_update(ZsZipWriter* writer, const uint8_t* data,
+                          size_t len) {
+  Unwrap(writer)->Update(data, len);
+}
+
+int32_t zs_zip_writer_end_entry(ZsZipWriter* writer) {
+  return Unwrap(writer)->EndEntry() ? 1 : 0;
+}
+
+void zs_zip_writer_finish(ZsZipWriter* writer) { Unwrap(writer)->Finish(); }
+
+size_t zs_zip_writer_pending(const ZsZipWriter* writer) {
+  return Unwrap(writer)->Pending();
+}
+
+size_t zs_zip_writer_read(ZsZipWriter* writer, uint8_t* out, size_t cap) {
+  return Unwrap(writer)->Read(out, cap);
+}
@@ -0,0 +1,196 @@
+#ifndef ZAPSHARE_NATIVE_ZIP_STREAM_H_
+#define ZAPSHARE_NATIVE_ZIP_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "export.h"
+
+namespace zapshare {
+
+// ZIP archives generated while they are being sent, so sharing a folder no
+// longer means writing the whole archive to the cache first.
+//
+// Every entry is written with a data descriptor (general purpose bit 3): the
+// local header carries no CRC, and the CRC follows the data once it has gone
+// past. Entries of 4 GB and more, offsets past 4 GB and more than 65534
+// entries switch the affected records to ZIP64. Names are flagged UTF-8.
+//
+// ZipLayout covers the stored (uncompressed) case. Every offset in the
+// archive follows from the names and sizes alone, so any byte range can be
+// produced on demand, which is what lets an archive download use HTTP Range
+// requests, parallel streams and resume. ZipStreamWriter writes front to
+// back and can also deflate entries; its length isn't known in advance.
+// Both render the same bytes for the same stored entries.
+
+struct ZipEntry {
+  std::string name;  // UTF-8, '/' separated.
+  uint64_t size = 0;
+  int64_t mtime_ms = 0;  // Unix time; stored as a DOS date in UTC.
+};
+
+class ZipLayout {
+ public:
+  explicit ZipLayout(std::vector<ZipEntry> entries);
+
+  uint64_t size() const { return size_; }
+  size_t entry_count() const { return entries_.size(); }
+  const ZipEntry& entry(size_t i) const { return entries_[i].entry; }
+
+  // A run of archive bytes that is either generated metadata (|entry| -1,
+  // |offset| is the archive offset) or the data of one entry (|offset| is
+  // the offset within that file).
+  struct Span {
+    int64_t entry;
+    uint64_t offset;
+    uint64_t length;
+  };
+  // |pos| must be below size().
+  Span Locate(uint64_t pos) const;
+
+  // Renders archive bytes [pos, pos + len), which must lie in metadata.
+  // Returns false and sets |missing| when they include the CRC of an entry
+  // that hasn't been recorded in full yet.
+  bool Render(uint64_t pos, size_t len, uint8_t* out, uint32_t* missing) const;
+
+  // Records the CRC of bytes [offset, offset + len) of an entry. Pieces can
+  // arrive in any order, from several ranges being served at once, and are
+  // merged with Crc32Combine; pieces overlapping what is already known are
+  // ignored unless they cover the whole entry.
+  void RecordCrc(uint32_t entry, uint64_t offset, uint64_t len, uint32_t crc);
+  bool EntryCrc(uint32_t entry, uint32_t* crc) const;
+  // First byte range of an entry whose CRC is still unknown, as
+  // [*start, *end). False once the whole entry is covered.
+  bool CrcGap(uint32_t entry, uint64_t* start, uint64_t* end) const;
+  uint64_t CrcCovered(uint32_t entry) const;
+
+ private:
+  enum class Part : uint8_t { kLocal, kData, kDescriptor, kCentral, kEnd };
+  struct Region {
+    uint64_t start;
+    uint64_t length;
+    Part part;
+    uint32_t entry;
+  };
+  struct CrcPiece {
+    uint64_t length;
+    uint32_t crc;
+  };
+  struct Item {
+    ZipEntry entry;
+    uint64_t header_offset = 0;
+    std::map<uint64_t, CrcPiece> pieces;  // Keyed by offset.
+  };
+
+  size_t RegionAt(uint64_t pos) const;
+  void RenderRegion(const Region& r, std::vector<uint8_t>* out) const;
+
+  std::vector<Item> entries_;
+  std::vector<Region> regions_;
+  uint64_t central_offset_ = 0;
+  uint64_t central_size_ = 0;
+  uint64_t size_ = 0;
+};
+
+class ZipStreamWriter {
+ public:
+  // |deflate| compresses entries that look compressible (ignored without
+  // zlib); media, tiny files and entries near 4 GB are always stored.
+  explicit ZipStreamWriter(bool deflate);
+  ~ZipStreamWriter();
+
+  ZipStreamWriter(const ZipStreamWriter&) = delete;
+  ZipStreamWriter& operator=(const ZipStreamWriter&) = delete;
+
+  // Starts the next entry; exactly |entry.size| bytes must follow.
+  void BeginEntry(const ZipEntry& entry);
+  void Update(const uint8_t* data, size_t len);
+  // False if the entry got a different number of bytes than announced; the
+  // archive is then unusable.
+  bool EndEntry();
+  // Writes the central directory.
+  void Finish();
+
+  size_t Pending() const { return out_.size() - out_read_; }
+  size_t Read(uint8_t* out, size_t cap);
+  uint64_t bytes_written() const { return offset_; }
+
+ private:
+  struct Deflater;
+  struct Written {
+    ZipEntry entry;
+    uint16_t method;
+    uint32_t crc;
+    uint64_t compressed;
+    uint64_t header_offset;
+  };
+
+  void StartData();
+  void Emit(const uint8_t* data, size_t len);
+  void Compress(const uint8_t* data, size_t len, bool finish);
+
+  bool deflate_;
+  std::unique_ptr<Deflater> deflater_;
+  std::vector<Written> written_;
+  bool in_entry_ = false;
+  bool started_ = false;  // Local header written for the current entry.
+  uint16_t method_ = 0;
+  uint32_t crc_ = 0;
+  uint64_t fed_ = 0;
+  uint64_t compressed_ = 0;
+  std::vector<uint8_t> head_;  // Bytes held back to choose the method.
+  std::vector<uint8_t> out_;
+  size_t out_read_ = 0;
+  uint64_t offset_ = 0;
+};
+
+}  // namespace zapshare
+
+extern "C" {
+
+typedef struct ZsZipLayout ZsZipLayout;
+typedef struct ZsZipWriter ZsZipWriter;
+
+// |names| holds |count| NUL-terminated UTF-8 names back to back.
+ZS_EXPORT ZsZipLayout* zs_zip_layout_new(const char* names, size_t names_len,
+                                         const uint64_t* sizes,
+                                         const int64_t* mtimes_ms,
+                                         uint32_t count);
+ZS_EXPORT void zs_zip_layout_free(ZsZipLayout* layout);
+ZS_EXPORT uint64_t zs_zip_layout_size(const ZsZipLayout* layout);
+ZS_EXPORT void zs_zip_layout_locate(const ZsZipLayout* layout, uint64_t pos,
+                                    int64_t* entry, uint64_t* offset,
+                                    uint64_t* length);
+// Returns 1 on success, 0 with |missing| set when a CRC isn't known yet.
+ZS_EXPORT int32_t zs_zip_layout_render(const ZsZipLayout* layout,
+                                       uint64_t pos, size_t len, uint8_t* out,
+                                       uint32_t* missing);
+ZS_EXPORT void zs_zip_layout_record_crc(ZsZipLayout* layout, uint32_t entry,
+                                        uint64_t offset, uint64_t len,
+                                        uint32_t crc);
+ZS_EXPORT int32_t zs_zip_layout_crc_gap(const ZsZipLayout* layout,
+                                        uint32_t entry, uint64_t* start,
+                                        uint64_t* end);
+ZS_EXPORT uint64_t zs_zip_layout_crc_covered(const ZsZipLayout* layout,
+                                             uint32_t entry);
+
+ZS_EXPORT ZsZipWriter* zs_zip_writer_new(int32_t deflate);
+ZS_EXPORT void zs_zip_writer_free(ZsZipWriter* writer);
+ZS_EXPORT void zs_zip_writer_begin_entry(ZsZipWriter* writer,
+                                         const char* name, uint64_t size,
+                                         int64_t mtime_ms);
+ZS_EXPORT void zs_zip_writer_update(ZsZipWriter* writer, const uint8_t* data,
+                                    size_t len);
+ZS_EXPORT int32_t zs_zip_writer_end_entry(ZsZipWriter* writer);
+ZS_EXPORT void zs_zip_writer_finish(ZsZipWriter* writer);
+ZS_EXPORT size_t zs_zip_writer_pending(const ZsZipWriter* writer);
+ZS_EXPORT size_t zs_zip_writer_read(ZsZipWriter* writer, uint8_t* out,
+                                    size_t cap);
+
+}  // extern "C"
+
+#endif  // ZAPSHARE_NATIVE_ZIP_STREAM_H_
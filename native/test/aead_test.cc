@@ -0,0 +1,168 @@
+#include "aead.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+using test::FromHex;
+using test::Random;
+
+bool Supported(AeadCipher cipher) {
+  return (AeadSupportedCiphers() & static_cast<uint32_t>(cipher)) != 0;
+}
+
+std::vector<AeadCipher> SupportedCiphers() {
+  std::vector<AeadCipher> out;
+  for (AeadCipher c :
+       {AeadCipher::kAes256Gcm, AeadCipher::kChaCha20Poly1305}) {
+    if (Supported(c)) out.push_back(c);
+  }
+  return out;
+}
+
+struct Vector {
+  std::string key, nonce, aad, plaintext, ciphertext, tag;
+};
+
+void CheckVector(AeadCipher cipher, const Vector& v) {
+  Aead aead;
+  ASSERT_TRUE(aead.Init(cipher, FromHex(v.key).data()));
+  const std::vector<uint8_t> nonce = FromHex(v.nonce);
+  const std::vector<uint8_t> aad = FromHex(v.aad);
+  std::vector<uint8_t> data = FromHex(v.plaintext);
+  uint8_t tag[kAeadTagSize];
+  aead.Seal(nonce.data(), aad.data(), aad.size(), data.data(), data.size(),
+            tag);
+  EXPECT_EQ(data, FromHex(v.ciphertext));
+  EXPECT_EQ(std::vector<uint8_t>(tag, tag + kAeadTagSize), FromHex(v.tag));
+
+  ASSERT_TRUE(aead.Open(nonce.data(), aad.data(), aad.size(), data.data(),
+                        data.size(), tag));
+  EXPECT_EQ(data, FromHex(v.plaintext));
+}
+
+TEST(AeadTest, ChaCha20Poly1305MatchesRfc8439) {
+  const std::string text =
+      "Ladies and Gentlemen of the class of '99: If I could offer you only "
+      "one tip for the future, sunscreen would be it.";
+  std::string hex;
+  for (unsigned char c : text) {
+    static const char kDigits[] = "0123456789abcdef";
+    hex += kDigits[c >> 4];
+    hex += kDigits[c & 15];
+  }
+  CheckVector(
+      AeadCipher::kChaCha20Poly1305,
+      {"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f",
+       "070000004041424344454647", "50515253c0c1c2c3c4c5c6c7", hex,
+       "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+       "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+       "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+       "3ff4def08e4b7a9de576d26586cec64b6116",
+       "1ae10b594f09e26a7e902ecbd0600691"});
+}
+
+TEST(AeadTest, AesGcmMatchesNistVectors) {
+  if (!Supported(AeadCipher::kAes256Gcm)) {
+    GTEST_SKIP() << "no AES-NI on this machine";
+  }
+  const std::string zero_key(64, '0');
+  const std::string zero_nonce(24, '0');
+  // Test cases 13, 14 and 16 of the GCM specification.
+  CheckVector(AeadCipher::kAes256Gcm,
+              {zero_key, zero_nonce, "", "", "",
+               "530f8afbc74536b9a963b4f1c4cb738b"});
+  CheckVector(AeadCipher::kAes256Gcm,
+              {zero_key, zero_nonce, "", std::string(32, '0'),
+               "cea7403d4d606b6e074ec5d3baf39d18",
+               "d0d1c8a799996bf0265b98b5d48ab919"});
+  CheckVector(
+      AeadCipher::kAes256Gcm,
+      {"feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+       "cafebabefacedbaddecaf888", "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+       "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+       "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+       "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+       "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+       "76fc6ece0f4e1768cddf8853bb2d551b"});
+}
+
+// The wide SIMD paths and the one-block tail must produce the same
+// keystream, so every shorter message is a prefix of a longer one.
+TEST(AeadTest, KeystreamDoesNotDependOnLength) {
+  const std::vector<uint8_t> key = Random(kAeadKeySize, 1);
+  const std::vector<uint8_t> nonce = Random(kAeadNonceSize, 2);
+  for (AeadCipher cipher : SupportedCiphers()) {
+    Aead aead;
+    ASSERT_TRUE(aead.Init(cipher, key.data()));
+    std::vector<uint8_t> full(4099, 0);
+    uint8_t tag[kAeadTagSize];
+    aead.Seal(nonce.data(), nullptr, 0, full.data(), full.size(), tag);
+    for (size_t len : {1, 15, 16, 17, 63, 64, 65, 127, 128, 129, 255, 256,
+                       257, 1000, 4096}) {
+      std::vector<uint8_t> part(len, 0);
+      aead.Seal(nonce.data(), nullptr, 0, part.data(), part.size(), tag);
+      EXPECT_TRUE(std::equal(part.begin(), part.end(), full.begin()))
+          << "cipher " << static_cast<int>(cipher) << " length " << len;
+    }
+  }
+}
+
+TEST(AeadTest, RoundTripsAndRejectsTampering) {
+  const std::vector<uint8_t> key = Random(kAeadKeySize, 3);
+  const std::vector<uint8_t> nonce = Random(kAeadNonceSize, 4);
+  const std::vector<uint8_t> aad = Random(13, 5);
+  for (AeadCipher cipher : SupportedCiphers()) {
+    Aead aead;
+    ASSERT_TRUE(aead.Init(cipher, key.data()));
+    for (size_t len : {0, 1, 100, 1000, 70000}) {
+      const std::vector<uint8_t> plain = Random(len, 6 + len);
+      std::vector<uint8_t> data = plain;
+      uint8_t tag[kAeadTagSize];
+      aead.Seal(nonce.data(), aad.data(), aad.size(), data.data(), len, tag);
+      if (len > 0) {
+        EXPECT_NE(data, plain);
+      }
+
+      if (len > 0) {
+        std::vector<uint8_t> flipped = data;
+        flipped[len / 2] ^= 0x10;
+        const std::vector<uint8_t> before = flipped;
+        EXPECT_FALSE(aead.Open(nonce.data(), aad.data(), aad.size(),
+                               flipped.data(), len, tag));
+        EXPECT_EQ(flipped, before);
+      }
+      std::vector<uint8_t> other_aad = aad;
+      other_aad[0] ^= 1;
+      EXPECT_FALSE(aead.Open(nonce.data(), other_aad.data(), aad.size(),
+                             data.data(), len, tag));
+      uint8_t bad_tag[kAeadTagSize];
+      std::memcpy(bad_tag, tag, kAeadTagSize);
+      bad_tag[kAeadTagSize - 1] ^= 0x80;
+      EXPECT_FALSE(aead.Open(nonce.data(), aad.data(), aad.size(),
+                             data.data(), len, bad_tag));
+
+      ASSERT_TRUE(aead.Open(nonce.data(), aad.data(), aad.size(), data.data(),
+                            len, tag));
+      EXPECT_EQ(data, plain);
+    }
+  }
+}
+
+TEST(AeadTest, RejectsUnsupportedCipher) {
+  const std::vector<uint8_t> key(kAeadKeySize, 0);
+  Aead aead;
+  EXPECT_FALSE(aead.Init(AeadCipher::kNone, key.data()));
+  EXPECT_FALSE(aead.Init(static_cast<AeadCipher>(4), key.data()));
+  EXPECT_TRUE(Supported(AeadCipher::kChaCha20Poly1305));
+}
+
+}  // namespace
+}  // namespace zapshare
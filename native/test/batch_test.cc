@@ -0,0 +1,234 @@
+#include "batch.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+namespace fs = std::filesystem;
+
+using test::Random;
+
+std::string FreshDir(const std::string& name) {
+  const fs::path dir = fs::path(::testing::TempDir()) / ("zs_batch_" + name);
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  return dir.string();
+}
+
+std::vector<uint8_t> ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {});
+}
+
+struct File {
+  std::string name;
+  std::vector<uint8_t> data;
+};
+
+// Writer output for |files| followed by skip records for |skipped|. Data is
+// fed in uneven pieces the way a file reader would.
+std::vector<uint8_t> Container(const std::vector<File>& files,
+                               const std::vector<uint32_t>& skipped = {}) {
+  BatchWriter writer;
+  std::vector<uint8_t> out;
+  auto drain = [&] {
+    std::vector<uint8_t> buf(999);
+    while (writer.Pending() > 0) {
+      size_t n = writer.Read(buf.data(), buf.size());
+      out.insert(out.end(), buf.begin(), buf.begin() + n);
+    }
+  };
+  for (uint32_t i = 0; i < files.size(); i++) {
+    const File& f = files[i];
+    writer.BeginFile(i, f.name, f.data.size());
+    drain();
+    for (size_t pos = 0; pos < f.data.size(); pos += 3001) {
+      const size_t n = std::min<size_t>(3001, f.data.size() - pos);
+      writer.Update(f.data.data() + pos, n);
+      out.insert(out.end(), f.data.begin() + pos, f.data.begin() + pos + n);
+    }
+    EXPECT_TRUE(writer.EndFile());
+    drain();
+  }
+  for (uint32_t index : skipped) writer.SkipFile(index);
+  writer.Finish();
+  drain();
+  return out;
+}
+
+std::map<uint32_t, BatchResult> Receive(BatchReceiver* receiver,
+                                        const std::vector<uint8_t>& stream,
+                                        size_t piece, size_t expected) {
+  for (size_t pos = 0; pos < stream.size(); pos += piece) {
+    receiver->Update(stream.data() + pos,
+                     std::min(piece, stream.size() - pos));
+  }
+  std::map<uint32_t, BatchResult> results;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (results.size() < expected &&
+         std::chrono::steady_clock::now() < deadline) {
+    BatchResult r;
+    if (receiver->NextResult(&r)) {
+      results[r.index] = r;
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  return results;
+}
+
+TEST(BatchTest, RoundTripsManyFiles) {
+  const std::string dir = FreshDir("round_trip");
+  std::vector<File> files;
+  for (uint32_t i = 0; i < 200; i++) {
+    files.push_back({"photo" + std::to_string(i) + ".jpg",
+                     Random(i * 517 % 40000, i)});
+  }
+  files[7].data.clear();  // Empty files are files too.
+  const std::vector<uint8_t> stream = Container(files);
+
+  for (size_t piece : {1u, 4096u, 1u << 20}) {
+    const std::string sub = dir + "/" + std::to_string(piece);
+    fs::create_directories(sub);
+    BatchReceiver receiver(sub, 3);
+    auto results = Receive(&receiver, stream, piece, files.size());
+    EXPECT_TRUE(receiver.complete());
+    EXPECT_FALSE(receiver.failed());
+    ASSERT_EQ(results.size(), files.size()) << "piece=" << piece;
+    for (uint32_t i = 0; i < files.size(); i++) {
+      ASSERT_EQ(results[i].status, BatchFileStatus::kWritten);
+      EXPECT_EQ(fs::path(results[i].path).filename(), files[i].name);
+      EXPECT_EQ(ReadFile(results[i].path), files[i].data) << i;
+      ChunkHasher hasher(files[i].data.size(), kDefaultDigestChunkSize);
+      hasher.Update(0, files[i].data.data(), files[i].data.size());
+      Digest digest;
+      ASSERT_TRUE(hasher.FileDigest(&digest));
+      EXPECT_EQ(results[i].digest, digest);
+    }
+    EXPECT_EQ(receiver.BytesInFlight(), 0u);
+    EXPECT_FALSE(receiver.Busy());
+  }
+  fs::remove_all(dir);
+}
+
+TEST(BatchTest, CorruptFileIsReportedAndNotWritten) {
+  const std::string dir = FreshDir("corrupt");
+  std::vector<File> files = {{"a.txt", Random(5000, 1)},
+                             {"b.txt", Random(6000, 2)}};
+  std::vector<uint8_t> stream = Container(files);
+  // First byte of a.txt's data: magic, tag, header and the 5-byte name.
+  stream[4 + 1 + 14 + 5] ^= 1;
+
+  BatchReceiver receiver(dir, 2);
+  auto results = Receive(&receiver, stream, 65536, 2);
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_EQ(results[0].status, BatchFileStatus::kCorrupt);
+  EXPECT_EQ(results[1].status, BatchFileStatus::kWritten);
+  EXPECT_FALSE(fs::exists(dir + "/a.txt"));
+  EXPECT_TRUE(receiver.complete());
+  fs::remove_all(dir);
+}
+
+TEST(BatchTest, SkipRecordsAndDuplicateNames) {
+  const std::string dir = FreshDir("dupes");
+  std::ofstream(dir + "/notes.txt") << "already here";
+  std::vector<File> files = {{"notes.txt", Random(100, 1)},
+                             {"notes.txt", Random(200, 2)},
+                             {"README", Random(10, 3)},
+                             {"README", Random(20, 4)}};
+  BatchReceiver receiver(dir, 1);
+  auto results = Receive(&receiver, Container(files, {9, 10}), 777, 6);
+  ASSERT_EQ(results.size(), 6u);
+  EXPECT_EQ(results[9].status, BatchFileStatus::kSkipped);
+  EXPECT_EQ(results[10].status, BatchFileStatus::kSkipped);
+  // One worker, so files land in stream order.
+  EXPECT_EQ(fs::path(results[0].path).filename(), "notes_1.txt");
+  EXPECT_EQ(fs::path(results[1].path).filename(), "notes_2.txt");
+  EXPECT_EQ(fs::path(results[2].path).filename(), "README");
+  EXPECT_EQ(fs::path(results[3].path).filename(), "README_1");
+  EXPECT_EQ(ReadFile(dir + "/notes_2.txt"), files[1].data);
+  EXPECT_TRUE(receiver.complete());
+  fs::remove_all(dir);
+}
+
+TEST(BatchTest, NamesStayInsideTheDestination) {
+  const std::string dir = FreshDir("names");
+  std::vector<File> files = {{"../../escape.txt", Random(10, 1)},
+                             {"C:\\Users\\me\\win.txt", Random(10, 2)},
+                             {"a<b>c?.txt", Random(10, 3)},
+                             {"..", Random(10, 4)},
+                             {"trailing. ", Random(10, 5)}};
+  BatchReceiver receiver(dir, 1);
+  auto results = Receive(&receiver, Container(files), 4096, files.size());
+  ASSERT_EQ(results.size(), files.size());
+  const std::vector<std::string> expected = {"escape.txt", "win.txt",
+                                             "a_b_c_.txt", "file",
+                                             "trailing"};
+  for (uint32_t i = 0; i < files.size(); i++) {
+    ASSERT_EQ(results[i].status, BatchFileStatus::kWritten);
+    EXPECT_EQ(fs::path(results[i].path).parent_path(), fs::path(dir));
+    EXPECT_EQ(fs::path(results[i].path).filename(), expected[i]);
+  }
+  fs::remove_all(dir);
+}
+
+TEST(BatchTest, RejectsMalformedStreams) {
+  const std::string dir = FreshDir("malformed");
+  std::vector<uint8_t> stream = Container({{"x.bin", Random(1000, 1)}});
+
+  {
+    // Truncated: the file still arrives, but the batch isn't complete.
+    BatchReceiver receiver(dir, 1);
+    Receive(&receiver, std::vector<uint8_t>(stream.begin(), stream.end() - 3),
+            512, 1);
+    EXPECT_FALSE(receiver.complete());
+    EXPECT_FALSE(receiver.failed());
+  }
+  {
+    std::vector<uint8_t> bad = stream;
+    bad[0] = 'X';
+    BatchReceiver receiver(dir, 1);
+    EXPECT_FALSE(receiver.Update(bad.data(), bad.size()));
+    EXPECT_TRUE(receiver.failed());
+  }
+  {
+    // End record counting a file that never came.
+    std::vector<uint8_t> bad = stream;
+    bad[bad.size() - 4]++;
+    BatchReceiver receiver(dir, 1);
+    EXPECT_FALSE(receiver.Update(bad.data(), bad.size()));
+    EXPECT_FALSE(receiver.complete());
+  }
+  {
+    // Announced size over the limit is refused before any allocation.
+    std::vector<uint8_t> bad(stream.begin(), stream.begin() + 19);
+    bad[4 + 1 + 4 + 3] = 0x10;  // Size byte 3: 256 MB.
+    BatchReceiver receiver(dir, 1);
+    EXPECT_FALSE(receiver.Update(bad.data(), bad.size()));
+  }
+  {
+    BatchWriter writer;
+    writer.BeginFile(0, "short", 100);
+    std::vector<uint8_t> data(50);
+    writer.Update(data.data(), data.size());
+    EXPECT_FALSE(writer.EndFile());
+  }
+  fs::remove_all(dir);
+}
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,206 @@
+#include "compress.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+using test::Random;
+
+// Log-like text: repetitive structure with varying numbers.
+std::vector<uint8_t> Text(size_t len, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::string s;
+  while (s.size() < len) {
+    s += "2024-05-0" + std::to_string(rng() % 9) + " INFO transfer[" +
+         std::to_string(rng() % 100000) + "] chunk sent bytes=" +
+         std::to_string(rng() % 1000000) + "\n";
+  }
+  s.resize(len);
+  return std::vector<uint8_t>(s.begin(), s.end());
+}
+
+std::vector<uint8_t> Compress(const std::vector<uint8_t>& data,
+                              uint32_t codecs, CompressStats* stats,
+                              double link_rate = 0, size_t piece = 65536) {
+  ChunkCompressor c(codecs);
+  c.SetLinkRate(link_rate);
+  std::vector<uint8_t> out;
+  std::vector<uint8_t> buf(10000);
+  auto drain = [&] {
+    while (c.Pending() > 0) {
+      size_t n = c.Read(buf.data(), buf.size());
+      out.insert(out.end(), buf.begin(), buf.begin() + n);
+    }
+  };
+  for (size_t pos = 0; pos < data.size(); pos += piece) {
+    c.Update(data.data() + pos, std::min(piece, data.size() - pos));
+    drain();
+  }
+  c.Finish();
+  drain();
+  if (stats != nullptr) *stats = c.stats();
+  return out;
+}
+
+std::vector<uint8_t> Decompress(const std::vector<uint8_t>& frames,
+                                size_t piece = 7777) {
+  ChunkDecompressor d;
+  std::vector<uint8_t> out;
+  std::vector<uint8_t> buf(10000);
+  for (size_t pos = 0; pos < frames.size(); pos += piece) {
+    EXPECT_TRUE(
+        d.Update(frames.data() + pos, std::min(piece, frames.size() - pos)));
+    while (d.Pending() > 0) {
+      size_t n = d.Read(buf.data(), buf.size());
+      out.insert(out.end(), buf.begin(), buf.begin() + n);
+    }
+  }
+  EXPECT_TRUE(d.AtFrameBoundary());
+  return out;
+}
+
+TEST(CompressTest, Lz4RoundTrip) {
+  std::vector<std::vector<uint8_t>> inputs = {
+      {}, {1}, Random(11, 1), Random(13, 2), Text(100000, 3),
+      std::vector<uint8_t>(70000, 0), Random(70000, 4)};
+  for (const auto& in : inputs) {
+    std::vector<uint8_t> packed(in.size() + in.size() / 255 + 16);
+    size_t n = Lz4Compress(in.data(), in.size(), packed.data(), packed.size());
+    ASSERT_GT(n, 0u) << "len=" << in.size();
+    std::vector<uint8_t> out(in.size());
+    EXPECT_EQ(Lz4Decompress(packed.data(), n, out.data(), out.size()),
+              in.size());
+    EXPECT_EQ(out, in);
+  }
+}
+
+TEST(CompressTest, Lz4ShrinksRedundantData) {
+  std::vector<uint8_t> zeros(128 * 1024, 0);
+  std::vector<uint8_t> packed(zeros.size());
+  EXPECT_LT(Lz4Compress(zeros.data(), zeros.size(), packed.data(),
+                        packed.size()),
+            zeros.size() / 100);
+  std::vector<uint8_t> text = Text(128 * 1024, 5);
+  EXPECT_LT(Lz4Compress(text.data(), text.size(), packed.data(),
+                        packed.size()),
+            text.size() * 3 / 4);
+  // Random data doesn't fit in less than its own size.
+  std::vector<uint8_t> noise = Random(128 * 1024, 6);
+  EXPECT_EQ(Lz4Compress(noise.data(), noise.size(), packed.data(),
+                        noise.size() - 1),
+            0u);
+}
+
+TEST(CompressTest, Lz4RejectsMalformedInput) {
+  std::vector<uint8_t> text = Text(50000, 7);
+  std::vector<uint8_t> packed(text.size());
+  size_t n = Lz4Compress(text.data(), text.size(), packed.data(),
+                         packed.size());
+  ASSERT_GT(n, 0u);
+  std::vector<uint8_t> out(text.size());
+  // Truncated, and output buffer too small.
+  EXPECT_EQ(Lz4Decompress(packed.data(), n - 3, out.data(), out.size()),
+            SIZE_MAX);
+  EXPECT_EQ(Lz4Decompress(packed.data(), n, out.data(), out.size() - 1),
+            SIZE_MAX);
+  // Offset reaching before the start of the output.
+  const uint8_t bad[] = {0x10, 'a', 0x09, 0x00};
+  EXPECT_EQ(Lz4Decompress(bad, sizeof(bad), out.data(), out.size()),
+            SIZE_MAX);
+}
+
+TEST(CompressTest, EntropySeparatesTextFromMedia) {
+  EXPECT_EQ(SampleEntropy(nullptr, 0), 0);
+  std::vector<uint8_t> zeros(100000, 0);
+  EXPECT_EQ(SampleEntropy(zeros.data(), zeros.size()), 0);
+  std::vector<uint8_t> text = Text(100000, 8);
+  EXPECT_LT(SampleEntropy(text.data(), text.size()), 5.5);
+  std::vector<uint8_t> noise = Random(100000, 9);
+  EXPECT_GT(SampleEntropy(noise.data(), noise.size()), 7.2);
+}
+
+TEST(CompressTest, RoundTripsEveryCodecMix) {
+  // Text, zeros and noise in one stream, with a partial last chunk.
+  std::vector<uint8_t> data = Text(300000, 10);
+  data.resize(data.size() + 200000, 0);
+  std::vector<uint8_t> noise = Random(400000 + 123, 11);
+  data.insert(data.end(), noise.begin(), noise.end());
+
+  for (uint32_t codecs :
+       {CodecBit(Codec::kStore), CodecBit(Codec::kLz4), SupportedCodecs()}) {
+    for (size_t piece : {1000u, 128u * 1024, 300000u}) {
+      CompressStats stats;
+      std::vector<uint8_t> frames = Compress(data, codecs, &stats, 1e6, piece);
+      EXPECT_EQ(Decompress(frames), data)
+          << "codecs=" << codecs << " piece=" << piece;
+      EXPECT_EQ(stats.raw_bytes, data.size());
+      EXPECT_EQ(stats.wire_bytes, frames.size());
+    }
+  }
+}
+
+TEST(CompressTest, MediaIsStoredWithoutCompressing) {
+  std::vector<uint8_t> noise = Random(1024 * 1024, 12);
+  CompressStats stats;
+  std::vector<uint8_t> frames =
+      Compress(noise, SupportedCodecs(), &stats, 1e6);
+  EXPECT_EQ(stats.frames[0], 8u);
+  EXPECT_EQ(frames.size(), noise.size() + 8 * kFrameHeaderSize);
+}
+
+TEST(CompressTest, SlowLinkCompressesFastLinkStores) {
+  std::vector<uint8_t> text = Text(2 * 1024 * 1024, 13);
+  CompressStats slow;
+  Compress(text, SupportedCodecs(), &slow, 250e3);  // 2 Mbit/s.
+  EXPECT_EQ(slow.frames[0], 0u);
+  EXPECT_LT(slow.wire_bytes, text.size() / 2);
+
+  ChunkCompressor fast(SupportedCodecs());
+  fast.SetLinkRate(10e9);  // Faster than any codec.
+  EXPECT_EQ(fast.Choose(4.5), Codec::kStore);
+  EXPECT_EQ(fast.Choose(7.9), Codec::kStore);
+}
+
+TEST(CompressTest, NegotiatedMaskIsRespected) {
+  ChunkCompressor c(CodecBit(Codec::kLz4));
+  c.SetLinkRate(250e3);
+  EXPECT_EQ(c.Choose(4.0), Codec::kLz4);
+  CompressStats stats;
+  Compress(Text(1024 * 1024, 14), CodecBit(Codec::kLz4), &stats, 250e3);
+  EXPECT_EQ(stats.frames[2] + stats.frames[3], 0u);
+  EXPECT_EQ(stats.frames[1], 8u);
+}
+
+TEST(CompressTest, DecompressorRejectsCorruptFrames) {
+  std::vector<uint8_t> frames =
+      Compress(Text(200000, 15), CodecBit(Codec::kLz4), nullptr, 250e3);
+  std::vector<uint8_t> bad_codec = frames;
+  bad_codec[0] = 9;
+  ChunkDecompressor d1;
+  EXPECT_FALSE(d1.Update(bad_codec.data(), bad_codec.size()));
+  EXPECT_TRUE(d1.failed());
+
+  std::vector<uint8_t> bad_payload = frames;
+  bad_payload[kFrameHeaderSize + 40] ^= 0xFF;
+  bad_payload[kFrameHeaderSize + 41] ^= 0xFF;
+  ChunkDecompressor d2;
+  const bool ok = d2.Update(bad_payload.data(), bad_payload.size());
+  // Either the frame fails to decode or it decodes to the wrong bytes, which
+  // the content digest catches; it never overruns the frames' raw lengths.
+  EXPECT_TRUE(!ok || d2.Pending() == 200000u);
+
+  ChunkDecompressor d3;
+  EXPECT_TRUE(d3.Update(frames.data(), frames.size() - 1));
+  EXPECT_FALSE(d3.AtFrameBoundary());
+}
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,184 @@
+#include "connection_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace {
+
+#if !defined(_WIN32)
+
+constexpr char kHost[] = "127.0.0.1";
+
+bool WaitFor(const std::function<bool()>& done) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return true;
+}
+
+// A loopback listener on |port|, 0 for any; -1 if it's taken.
+int Listen(uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, 8) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+uint16_t PortOf(int fd) {
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+// Listeners on an HTTP port and the v1 port after it, as a sender has.
+bool ListenPair(int* http, int* v1) {
+  for (int attempt = 0; attempt < 50; attempt++) {
+    *http = Listen(0);
+    *v1 = Listen(static_cast<uint16_t>(PortOf(*http) + 1));
+    if (*v1 >= 0) return true;
+    close(*http);
+  }
+  return false;
+}
+
+std::unique_ptr<ConnectionPool> MakePool(uint32_t per_peer,
+                                         uint32_t idle_ms = 30000) {
+  ConnectionPoolConfig config;
+  config.per_peer = per_peer;
+  config.idle_ms = idle_ms;
+  return ConnectionPool::Start(config);
+}
+
+TEST(ConnectionPoolTest, HandsOutWarmConnectionsAndRefills) {
+  const int listener = Listen(0);
+  const uint16_t port = PortOf(listener);
+  auto pool = MakePool(2);
+  ASSERT_NE(pool, nullptr);
+  pool->Warm(kHost, port, false);
+  ASSERT_TRUE(WaitFor([&] { return pool->stats().ready == 2; }));
+
+  const int fd = pool->Take(kHost, port);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(fcntl(fd, F_GETFL) & O_NONBLOCK, 0);
+  ASSERT_EQ(send(fd, "hi", 2, 0), 2);
+  const int served = accept(listener, nullptr, nullptr);
+  char buf[2];
+  EXPECT_EQ(recv(served, buf, sizeof(buf), MSG_WAITALL), 2);
+  close(served);
+  close(fd);
+
+  // Another takes the place of the one handed out.
+  EXPECT_TRUE(WaitFor([&] { return pool->stats().connects == 3; }));
+  EXPECT_EQ(pool->stats().ready, 2u);
+  EXPECT_EQ(pool->stats().taken, 1u);
+  close(listener);
+}
+
+TEST(ConnectionPoolTest, MissesWhatIsNotWarm) {
+  auto pool = MakePool(2);
+  EXPECT_EQ(pool->Take(kHost, 8080), -1);
+
+  // Nothing listens here, so every try is refused.
+  const int listener = Listen(0);
+  const uint16_t port = PortOf(listener);
+  close(listener);
+  pool->Warm(kHost, port, false);
+  ASSERT_TRUE(WaitFor([&] { return pool->stats().failures >= 2; }));
+  EXPECT_EQ(pool->Take(kHost, port), -1);
+  const ConnectionPoolStats s = pool->stats();
+  EXPECT_EQ(s.missed, 2u);
+  EXPECT_EQ(s.connects, 0u);
+  EXPECT_EQ(s.ready, 0u);
+}
+
+TEST(ConnectionPoolTest, DropsWhatTheSenderClosed) {
+  const int listener = Listen(0);
+  const uint16_t port = PortOf(listener);
+  auto pool = MakePool(1);
+  pool->Warm(kHost, port, false);
+  ASSERT_TRUE(WaitFor([&] { return pool->stats().ready == 1; }));
+  close(accept(listener, nullptr, nullptr));
+
+  ASSERT_TRUE(WaitFor([&] {
+    const ConnectionPoolStats s = pool->stats();
+    return s.stale == 1 && s.ready == 1;
+  }));
+  const int fd = pool->Take(kHost, port);
+  ASSERT_GE(fd, 0);
+  // The replacement, still open at the other end.
+  const int served = accept(listener, nullptr, nullptr);
+  ASSERT_EQ(send(served, "ok", 2, 0), 2);
+  char buf[2];
+  EXPECT_EQ(recv(fd, buf, sizeof(buf), MSG_WAITALL), 2);
+  close(served);
+  close(fd);
+  close(listener);
+}
+
+TEST(ConnectionPoolTest, FetchesTheListAhead) {
+  int http, v1;
+  ASSERT_TRUE(ListenPair(&http, &v1));
+  const uint16_t port = PortOf(http);
+  const std::string list = R"([{"name":"a.jpg","size":3}])";
+  std::string asked;
+  std::thread server([&] {
+    const int fd = accept(v1, nullptr, nullptr);
+    char buf[5];
+    if (recv(fd, buf, sizeof(buf), MSG_WAITALL) == 5) asked.assign(buf, 5);
+    const std::string line = list + "\n";
+    send(fd, line.data(), line.size(), 0);
+    close(fd);
+  });
+
+  auto pool = MakePool(1);
+  std::string got;
+  EXPECT_FALSE(pool->Listing(kHost, port, &got));
+  pool->Warm(kHost, port, true);
+  EXPECT_TRUE(WaitFor([&] { return pool->Listing(kHost, port, &got); }));
+  server.join();
+  EXPECT_EQ(asked, "LIST\n");
+  EXPECT_EQ(got, list);
+  EXPECT_EQ(pool->stats().listings, 1u);
+  close(http);
+  close(v1);
+}
+
+TEST(ConnectionPoolTest, LetsIdlePeersGo) {
+  const int listener = Listen(0);
+  const uint16_t port = PortOf(listener);
+  auto pool = MakePool(1, 100);
+  pool->Warm(kHost, port, false);
+  ASSERT_TRUE(WaitFor([&] { return pool->stats().ready == 1; }));
+  EXPECT_TRUE(WaitFor([&] { return pool->stats().ready == 0; }));
+  EXPECT_EQ(pool->Take(kHost, port), -1);
+  close(listener);
+}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,210 @@
+#include "content_hash.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace zapshare {
+namespace {
+
+std::string Hex(const uint8_t* d, size_t n) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string s;
+  for (size_t i = 0; i < n; i++) {
+    s += kDigits[d[i] >> 4];
+    s += kDigits[d[i] & 15];
+  }
+  return s;
+}
+
+// Input pattern used by the official BLAKE3 test vectors.
+std::vector<uint8_t> Pattern(size_t len) {
+  std::vector<uint8_t> v(len);
+  for (size_t i = 0; i < len; i++) v[i] = static_cast<uint8_t>(i % 251);
+  return v;
+}
+
+std::string HashHex(const std::vector<uint8_t>& v) {
+  uint8_t out[kBlake3OutLen];
+  Blake3::Hash(v.data(), v.size(), out);
+  return Hex(out, sizeof(out));
+}
+
+TEST(Blake3Test, KnownVectors) {
+  EXPECT_EQ(HashHex(Pattern(0)),
+            "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+  EXPECT_EQ(HashHex(Pattern(1)),
+            "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213");
+  EXPECT_EQ(HashHex(Pattern(1024)),
+            "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7");
+  EXPECT_EQ(HashHex(Pattern(1025)),
+            "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444");
+  const std::string abc = "abc";
+  EXPECT_EQ(HashHex(std::vector<uint8_t>(abc.begin(), abc.end())),
+            "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85");
+}
+
+// Byte-at-a-time updates never take the multi-chunk SIMD path, so this
+// checks the vectorised code against the portable one across tree shapes.
+TEST(Blake3Test, IncrementalMatchesOneShot) {
+  for (size_t len : {1023u, 2048u, 4095u, 4096u, 5121u, 16384u, 31745u,
+                     65536u, 100000u}) {
+    std::vector<uint8_t> data = Pattern(len);
+    Blake3 hasher;
+    for (uint8_t b : data) hasher.Update(&b, 1);
+    uint8_t incremental[kBlake3OutLen];
+    hasher.Final(incremental);
+    EXPECT_EQ(Hex(incremental, sizeof(incremental)), HashHex(data))
+        << "len=" << len;
+  }
+}
+
+TEST(Blake3Test, RandomSplitsMatchOneShot) {
+  std::mt19937 rng(7);
+  std::vector<uint8_t> data = Pattern(300000);
+  const std::string expected = HashHex(data);
+  for (int round = 0; round < 20; round++) {
+    Blake3 hasher;
+    size_t pos = 0;
+    while (pos < data.size()) {
+      size_t n = std::min<size_t>(rng() % 20000, data.size() - pos);
+      hasher.Update(data.data() + pos, n);
+      pos += n;
+    }
+    uint8_t out[kBlake3OutLen];
+    hasher.Final(out);
+    EXPECT_EQ(Hex(out, sizeof(out)), expected);
+  }
+}
+
+TEST(ChunkHasherTest, SequentialFeedProducesChunkAndFileDigests) {
+  const uint32_t chunk = 64 * 1024;
+  std::vector<uint8_t> data = Pattern(3 * chunk + 1234);
+  ChunkHasher hasher(data.size(), chunk);
+  ASSERT_EQ(hasher.ChunkCount(), 4u);
+
+  for (size_t pos = 0; pos < data.size(); pos += 10000) {
+    size_t n = std::min<size_t>(10000, data.size() - pos);
+    hasher.Update(pos, data.data() + pos, n);
+  }
+  EXPECT_EQ(hasher.CompletedChunks(), 4u);
+
+  std::vector<Digest> expected;
+  for (uint32_t i = 0; i < 4; i++) {
+    size_t start = static_cast<size_t>(i) * chunk;
+    size_t len = std::min<size_t>(chunk, data.size() - start);
+    Digest d;
+    Blake3::Hash(data.data() + start, len, d.data());
+    Digest got;
+    ASSERT_TRUE(hasher.ChunkDigest(i, &got));
+    EXPECT_EQ(got, d);
+    expected.push_back(d);
+  }
+
+  Digest file;
+  ASSERT_TRUE(hasher.FileDigest(&file));
+  Digest combined;
+  ChunkHasher::CombineDigests(data.size(), chunk, expected, &combined);
+  EXPECT_EQ(file, combined);
+}
+
+TEST(ChunkHasherTest, InterleavedRangeStreams) {
+  const uint32_t chunk = 16 * 1024;
+  std::vector<uint8_t> data = Pattern(8 * chunk);
+
+  ChunkHasher sequential(data.size(), chunk);
+  sequential.Update(0, data.data(), data.size());
+  Digest want;
+  ASSERT_TRUE(sequential.FileDigest(&want));
+
+  // Two streams, each owning half the file, delivering 1000-byte pieces
+  // alternately.
+  ChunkHasher parallel(data.size(), chunk);
+  size_t half = data.size() / 2;
+  size_t a = 0;
+  size_t b = half;
+  while (a < half || b < data.size()) {
+    if (a < half) {
+      size_t n = std::min<size_t>(1000, half - a);
+      parallel.Update(a, data.data() + a, n);
+      a += n;
+    }
+    if (b < data.size()) {
+      size_t n = std::min<size_t>(1000, data.size() - b);
+      parallel.Update(b, data.data() + b, n);
+      b += n;
+    }
+  }
+  Digest got;
+  ASSERT_TRUE(parallel.FileDigest(&got));
+  EXPECT_EQ(got, want);
+}
+
+TEST(ChunkHasherTest, GapDropsChunkUntilRefed) {
+  const uint32_t chunk = 4096;
+  std::vector<uint8_t> data = Pattern(2 * chunk);
+  ChunkHasher hasher(data.size(), chunk);
+
+  hasher.Update(0, data.data(), 100);
+  hasher.Update(200, data.data() + 200, chunk - 200);
+  EXPECT_EQ(hasher.CompletedChunks(), 0u);
+  Digest d;
+  EXPECT_FALSE(hasher.ChunkDigest(0, &d));
+
+  // Re-requesting the chunk from its boundary hashes it again.
+  hasher.Update(0, data.data(), chunk);
+  EXPECT_TRUE(hasher.ChunkDigest(0, &d));
+  EXPECT_FALSE(hasher.FileDigest(&d));
+}
+
+TEST(ChunkHasherTest, ResetChunkAllowsRehash) {
+  const uint32_t chunk = 4096;
+  std::vector<uint8_t> data = Pattern(2 * chunk);
+  ChunkHasher hasher(data.size(), chunk);
+  hasher.Update(0, data.data(), data.size());
+  Digest good;
+  ASSERT_TRUE(hasher.ChunkDigest(1, &good));
+
+  hasher.ResetChunk(1);
+  EXPECT_EQ(hasher.CompletedChunks(), 1u);
+  std::vector<uint8_t> corrupt(data.begin() + chunk, data.end());
+  corrupt[10] ^= 0xFF;
+  hasher.Update(chunk, corrupt.data(), corrupt.size());
+  Digest bad;
+  ASSERT_TRUE(hasher.ChunkDigest(1, &bad));
+  EXPECT_NE(bad, good);
+}
+
+TEST(ChunkHasherTest, ZerosMatchHashingZeroBytes) {
+  // Data, then a hole covering two whole chunks, then a short last chunk
+  // that is partly hole.
+  const uint32_t chunk = 4096;
+  std::vector<uint8_t> data(3 * chunk + 1000 + 100, 0);
+  for (size_t i = 0; i < 1000; i++) data[i] = static_cast<uint8_t>(i);
+  for (size_t i = data.size() - 100; i < data.size(); i++) data[i] = 7;
+
+  ChunkHasher reference(data.size(), chunk);
+  reference.Update(0, data.data(), data.size());
+  ChunkHasher sparse(data.size(), chunk);
+  sparse.Update(0, data.data(), 1000);
+  sparse.UpdateZeros(1000, data.size() - 1100);
+  sparse.Update(data.size() - 100, data.data() + data.size() - 100, 100);
+
+  Digest want;
+  Digest got;
+  ASSERT_TRUE(reference.FileDigest(&want));
+  ASSERT_TRUE(sparse.FileDigest(&got));
+  EXPECT_EQ(got, want);
+}
+
+TEST(ChunkHasherTest, EmptyFile) {
+  ChunkHasher hasher(0, kDefaultDigestChunkSize);
+  EXPECT_EQ(hasher.ChunkCount(), 0u);
+  Digest d;
+  EXPECT_TRUE(hasher.FileDigest(&d));
+}
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,158 @@
+#include "content_store.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+using test::ReadFile;
+using test::TempPath;
+
+// Writes |content| to |path| and returns its digest.
+Digest WriteFile(const std::string& path, const std::string& content) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << content;
+  Digest digest;
+  Blake3::Hash(reinterpret_cast<const uint8_t*>(content.data()),
+               content.size(), digest.data());
+  return digest;
+}
+
+TEST(ContentStoreTest, FindsAddedFileAfterReopen) {
+  const std::string index = TempPath("reopen.zsc");
+  const std::string file = TempPath("reopen.bin");
+  RemoveFile(index);
+  const Digest digest = WriteFile(file, "holiday photos");
+  {
+    auto store = ContentStore::Open(index);
+    ASSERT_NE(store, nullptr);
+    EXPECT_EQ(store->count(), 0u);
+    ASSERT_TRUE(store->Add(file, digest));
+    EXPECT_EQ(store->count(), 1u);
+  }
+  auto store = ContentStore::Open(index);
+  ASSERT_NE(store, nullptr);
+  EXPECT_EQ(store->count(), 1u);
+  std::string found;
+  ASSERT_TRUE(store->Find(14, digest, &found));
+  EXPECT_EQ(found, file);
+  // Same digest, different size: not the same content.
+  EXPECT_FALSE(store->Find(15, digest, &found));
+  store.reset();
+  RemoveFile(index);
+  RemoveFile(file);
+}
+
+TEST(ContentStoreTest, DropsEntriesWhoseFileChanged) {
+  const std::string index = TempPath("stale.zsc");
+  const std::string file = TempPath("stale.bin");
+  RemoveFile(index);
+  const Digest digest = WriteFile(file, "version one");
+  auto store = ContentStore::Open(index);
+  ASSERT_TRUE(store->Add(file, digest));
+
+  WriteFile(file, "version two, longer");
+  std::string found;
+  EXPECT_FALSE(store->Find(11, digest, &found));
+  EXPECT_EQ(store->count(), 0u);
+
+  // Deleted files are dropped too.
+  const Digest again = WriteFile(file, "version three");
+  ASSERT_TRUE(store->Add(file, again));
+  RemoveFile(file);
+  EXPECT_FALSE(store->Find(13, again, &found));
+  EXPECT_EQ(store->count(), 0u);
+  store.reset();
+  RemoveFile(index);
+}
+
+TEST(ContentStoreTest, GrowsAndReusesTombstones) {
+  const std::string index = TempPath("grow.zsc");
+  RemoveFile(index);
+  auto store = ContentStore::Open(index);
+  ASSERT_NE(store, nullptr);
+  const uint32_t initial = store->capacity();
+
+  std::vector<std::string> files;
+  std::vector<Digest> digests;
+  for (int i = 0; i < 300; i++) {
+    files.push_back(TempPath("grow_" + std::to_string(i)));
+    digests.push_back(WriteFile(files.back(), "file #" + std::to_string(i)));
+    ASSERT_TRUE(store->Add(files.back(), digests.back())) << i;
+  }
+  EXPECT_GT(store->capacity(), initial);
+  EXPECT_EQ(store->count(), 300u);
+
+  // Re-adding the same content updates in place.
+  ASSERT_TRUE(store->Add(files[7], digests[7]));
+  EXPECT_EQ(store->count(), 300u);
+
+  for (int i = 0; i < 300; i += 2) {
+    store->Remove(ReadFile(files[i]).size(), digests[i]);
+  }
+  EXPECT_EQ(store->count(), 150u);
+
+  store = ContentStore::Open(index);
+  ASSERT_NE(store, nullptr);
+  EXPECT_EQ(store->count(), 150u);
+  for (int i = 0; i < 300; i++) {
+    std::string found;
+    const bool hit =
+        store->Find(ReadFile(files[i]).size(), digests[i], &found);
+    EXPECT_EQ(hit, i % 2 == 1) << i;
+    if (hit) {
+      EXPECT_EQ(found, files[i]);
+    }
+  }
+  store.reset();
+  RemoveFile(index);
+  for (const std::string& f : files) RemoveFile(f);
+}
+
+TEST(ContentStoreTest, RejectsOverlongAndMissingPaths) {
+  const std::string index = TempPath("reject.zsc");
+  RemoveFile(index);
+  auto store = ContentStore::Open(index);
+  Digest digest{};
+  EXPECT_FALSE(store->Add(std::string(ContentStore::kMaxPath + 1, 'a'),
+                          digest));
+  EXPECT_FALSE(store->Add(TempPath("does_not_exist"), digest));
+  EXPECT_EQ(store->count(), 0u);
+  store.reset();
+  RemoveFile(index);
+}
+
+TEST(ContentStoreTest, CorruptIndexIsRebuilt) {
+  const std::string index = TempPath("corrupt.zsc");
+  std::ofstream(index, std::ios::binary | std::ios::trunc)
+      << std::string(5000, 'x');
+  auto store = ContentStore::Open(index);
+  ASSERT_NE(store, nullptr);
+  EXPECT_EQ(store->count(), 0u);
+  store.reset();
+  RemoveFile(index);
+}
+
+TEST(ContentStoreTest, CloneOrLinkSharesContent) {
+  const std::string from = TempPath("link_from");
+  const std::string to = TempPath("link_to");
+  RemoveFile(to);
+  const std::string content = "already have it";
+  WriteFile(from, content);
+  const LinkKind kind = CloneOrLink(from, to);
+  ASSERT_NE(kind, LinkKind::kFailed);
+  EXPECT_EQ(ReadFile(to),
+            std::vector<uint8_t>(content.begin(), content.end()));
+  // Never overwrites an existing file.
+  EXPECT_EQ(CloneOrLink(from, to), LinkKind::kFailed);
+  RemoveFile(from);
+  RemoveFile(to);
+}
+
+}  // namespace
+}  // namespace zapshare
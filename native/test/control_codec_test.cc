@@ -0,0 +1,242 @@
+#include "control_codec.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace zapshare {
+namespace {
+
+std::vector<uint8_t> Bytes(const std::string& s) {
+  return std::vector<uint8_t>(s.begin(), s.end());
+}
+
+bool DecodeJson(const std::string& json, ControlMessage* out) {
+  return DecodeControl(reinterpret_cast<const uint8_t*>(json.data()),
+                       json.size(), out);
+}
+
+// Every field of |type| set to something that depends on |seed|.
+ControlMessage Filled(ControlType type, int seed) {
+  ControlMessage m;
+  m.Reset(type);
+  for (size_t i = 0; i < m.schema->count; i++) {
+    ControlValue& v = m.values[i];
+    v.present = true;
+    const std::string text =
+        std::string(m.schema->fields[i].key) + "-" + std::to_string(seed);
+    switch (m.schema->fields[i].kind) {
+      case ControlKind::kString:
+        v.s = text;
+        break;
+      case ControlKind::kInt:
+        v.i = (seed % 2 == 0 ? -1 : 1) * (int64_t{1} << (seed + 20));
+        break;
+      case ControlKind::kDouble:
+        v.d = seed * 0.1 + 1.0 / 3;
+        break;
+      case ControlKind::kBool:
+        v.i = seed % 2;
+        break;
+      case ControlKind::kStrings:
+        v.list = {text, "", "é 😀"};
+        break;
+    }
+  }
+  return m;
+}
+
+void ExpectSame(const ControlMessage& a, const ControlMessage& b) {
+  ASSERT_EQ(a.type(), b.type());
+  for (size_t i = 0; i < a.values.size(); i++) {
+    SCOPED_TRACE(a.schema->fields[i].key);
+    EXPECT_EQ(a.values[i].present, b.values[i].present);
+    EXPECT_EQ(a.values[i].i, b.values[i].i);
+    EXPECT_EQ(a.values[i].d, b.values[i].d);
+    EXPECT_EQ(a.values[i].s, b.values[i].s);
+    EXPECT_EQ(a.values[i].list, b.values[i].list);
+  }
+}
+
+TEST(ControlCodecTest, EveryTypeRoundTrips) {
+  for (int t = 1; t <= kControlTypes; t++) {
+    const ControlType type = static_cast<ControlType>(t);
+    SCOPED_TRACE(FindControlSchema(type)->name);
+    for (int seed = 0; seed < 3; seed++) {
+      const ControlMessage m = Filled(type, seed);
+      std::vector<uint8_t> binary;
+      EncodeControl(m, &binary);
+      ControlMessage out;
+      ASSERT_TRUE(DecodeControl(binary.data(), binary.size(), &out));
+      EXPECT_EQ(out.version, kControlVersion);
+      ExpectSame(m, out);
+
+      std::string json;
+      EncodeControlJson(m, &json);
+      ASSERT_TRUE(DecodeJson(json, &out)) << json;
+      EXPECT_EQ(out.version, kControlVersion);
+      ExpectSame(m, out);
+      // Smaller on the wire than what it replaces.
+      EXPECT_LT(binary.size(), json.size());
+    }
+  }
+}
+
+TEST(ControlCodecTest, ReadsWhatDartSends) {
+  const std::string json =
+      "{ \"type\" : \"ZAPSHARE_CONNECTION_REQUEST\", \"deviceId\": "
+      "\"a\\\"b\\\\c\\u00e9\\ud83d\\ude00\", \"deviceName\": null, "
+      "\"port\": 8080, \"extra\": {\"nested\": [1, {\"x\": true}]}, "
+      "\"fileNames\": [\"one.jpg\", \"two\\n.jpg\"], \"totalSize\": 12 }";
+  ControlMessage m;
+  ASSERT_TRUE(DecodeJson(json, &m));
+  EXPECT_EQ(m.type(), ControlType::kConnectionRequest);
+  EXPECT_EQ(m.version, 0);
+  EXPECT_EQ(m.Find("deviceId")->s, "a\"b\\c\xc3\xa9\xf0\x9f\x98\x80");
+  EXPECT_FALSE(m.Find("deviceName")->present);
+  EXPECT_EQ(m.Find("port")->i, 8080);
+  EXPECT_EQ(m.Find("fileNames")->list,
+            (std::vector<std::string>{"one.jpg", "two\n.jpg"}));
+  EXPECT_EQ(m.Find("totalSize")->i, 12);
+  EXPECT_FALSE(m.Find("platform")->present);
+
+  // The type may come last, and doubles may be written as ints.
+  ASSERT_TRUE(DecodeJson(
+      R"({"volume":1,"position":2.5,"type":"ZAPSHARE_CAST_STATUS"})", &m));
+  EXPECT_EQ(m.type(), ControlType::kCastStatus);
+  EXPECT_EQ(m.Find("volume")->d, 1.0);
+  EXPECT_EQ(m.Find("position")->d, 2.5);
+}
+
+TEST(ControlCodecTest, WritesJsonDartReads) {
+  ControlMessage m;
+  m.Reset(ControlType::kCastControl);
+  m.Find("action")->s = "seek\t\"now\"";
+  m.Find("action")->present = true;
+  m.Find("seekPosition")->d = 120;
+  m.Find("seekPosition")->present = true;
+  std::string json;
+  EncodeControlJson(m, &json);
+  EXPECT_EQ(json,
+            R"({"type":"ZAPSHARE_CAST_CONTROL","action":"seek\t\"now\"",)"
+            R"("seekPosition":120.0,"zsc":1})");
+}
+
+TEST(ControlCodecTest, RejectsMalformedJson) {
+  ControlMessage m;
+  for (const char* json : {
+           "", "{", "[]", R"({"type":"ZAPSHARE_CAST_ACK")",
+           R"({"type":"ZAPSHARE_DISCOVERY","deviceId":"a"})",
+           R"({"type":"ZAPSHARE_CAST_ACK"} x)",
+           R"({"type":"ZAPSHARE_CAST_ACK","accepted":"yes"})",
+           R"({"type":"ZAPSHARE_CONNECTION_REQUEST","port":80.5})",
+           R"({"type":"ZAPSHARE_CONNECTION_REQUEST","fileNames":[1]})",
+           "{\"type\":\"ZAPSHARE_CAST_URL\",\"url\":\"a\x01\"}",
+           R"({"type":"ZAPSHARE_CAST_URL","url":"\ud83d"})",
+       }) {
+    EXPECT_FALSE(DecodeJson(json, &m)) << json;
+  }
+}
+
+TEST(ControlCodecTest, RejectsEveryTruncation) {
+  std::vector<uint8_t> binary;
+  EncodeControl(Filled(ControlType::kConnectionRequest, 1), &binary);
+  ControlMessage m;
+  for (size_t len = 0; len < binary.size(); len++) {
+    // Cut between fields it's a shorter message, and may decode; never
+    // with what wasn't there.
+    if (!DecodeControl(binary.data(), len, &m)) continue;
+    std::vector<uint8_t> again;
+    EncodeControl(m, &again);
+    EXPECT_EQ(again,
+              std::vector<uint8_t>(binary.begin(), binary.begin() + len));
+  }
+  // The last byte always ends a value, so without it there's nothing whole.
+  EXPECT_FALSE(DecodeControl(binary.data(), binary.size() - 1, &m));
+}
+
+TEST(ControlCodecTest, SkipsFieldsFromLaterVersions) {
+  std::vector<uint8_t> binary = Bytes("ZSC");
+  binary.insert(binary.end(), {2, 6});
+  // Field 30 of each wire kind, then accepted = true.
+  binary.insert(binary.end(), {30 << 3 | 0, 0xff, 0x01});
+  binary.insert(binary.end(), {30 << 3 | 1, 1, 2, 3, 4, 5, 6, 7, 8});
+  binary.insert(binary.end(), {31 << 3 | 2, 3, 'a', 'b', 'c'});
+  binary.insert(binary.end(), {4 << 3 | 0, 1});
+  ControlMessage m;
+  ASSERT_TRUE(DecodeControl(binary.data(), binary.size(), &m));
+  EXPECT_EQ(m.type(), ControlType::kCastAck);
+  EXPECT_EQ(m.version, 2);
+  EXPECT_TRUE(m.Find("accepted")->present);
+  EXPECT_EQ(m.Find("accepted")->i, 1);
+}
+
+TEST(ControlCodecTest, RejectsBadFraming) {
+  ControlMessage m;
+  const std::vector<std::vector<uint8_t>> bad = {
+      {'Z', 'S', 'C', 0, 6},                   // Version 0.
+      {'Z', 'S', 'C', 1, 9},                   // Unknown type.
+      {'Z', 'S', 'C', 1, 6, 4 << 3 | 0, 1, 4 << 3 | 0, 0},  // Twice.
+      {'Z', 'S', 'C', 1, 6, 4 << 3 | 2, 0},    // Wrong wire kind.
+      {'Z', 'S', 'C', 1, 6, 30 << 3 | 3},      // Unknown wire kind.
+      {'Z', 'S', 'C', 1, 3, 4 << 3 | 2, 9, 'a'},  // Past the end.
+  };
+  for (const std::vector<uint8_t>& b : bad) {
+    EXPECT_FALSE(DecodeControl(b.data(), b.size(), &m));
+  }
+}
+
+TEST(ControlCodecTest, CApiBuildsAndReadsMessages) {
+  const int32_t type = zs_control_type_of("ZAPSHARE_CONNECTION_REQUEST");
+  ASSERT_EQ(type, 1);
+  EXPECT_STREQ(zs_control_type_name(type), "ZAPSHARE_CONNECTION_REQUEST");
+  int32_t port = -1, names = -1;
+  for (int32_t i = 0; i < zs_control_field_count(type); i++) {
+    const std::string key = zs_control_field_key(type, i);
+    if (key == "port") port = i;
+    if (key == "fileNames") names = i;
+  }
+  ASSERT_GE(port, 0);
+  ASSERT_GE(names, 0);
+  EXPECT_EQ(zs_control_field_kind(type, names),
+            static_cast<int32_t>(ControlKind::kStrings));
+  EXPECT_EQ(zs_control_field_key(type, 99), nullptr);
+
+  ZsControlMessage* out = zs_control_new();
+  ASSERT_EQ(zs_control_reset(out, type), 1);
+  zs_control_set_int(out, port, 8080);
+  zs_control_set_double(out, port, 1.5);  // Not a double; ignored.
+  const std::string a = "a.jpg", b = "b.jpg";
+  zs_control_add_string(out, names, reinterpret_cast<const uint8_t*>(a.data()),
+                        a.size());
+  zs_control_add_string(out, names, reinterpret_cast<const uint8_t*>(b.data()),
+                        b.size());
+  const size_t size = zs_control_encode(out, 0);
+  const std::vector<uint8_t> binary(zs_control_encoded(out),
+                                    zs_control_encoded(out) + size);
+
+  ZsControlMessage* in = zs_control_new();
+  EXPECT_EQ(zs_control_decode(in, binary.data(), binary.size()), type);
+  EXPECT_EQ(zs_control_version(in), kControlVersion);
+  EXPECT_EQ(zs_control_get_int(in, port), 8080);
+  EXPECT_EQ(zs_control_list_size(in, names), 2);
+  size_t len = 0;
+  const uint8_t* item = zs_control_get_string(in, names, 1, &len);
+  ASSERT_NE(item, nullptr);
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(item), len), b);
+  EXPECT_EQ(zs_control_get_string(in, names, 2, &len), nullptr);
+  EXPECT_EQ(zs_control_present(in, 0), 0);
+
+  const size_t json_size = zs_control_encode(in, 1);
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(zs_control_encoded(in)),
+                        json_size),
+            R"({"type":"ZAPSHARE_CONNECTION_REQUEST","port":8080,)"
+            R"("fileNames":["a.jpg","b.jpg"],"zsc":1})");
+  EXPECT_EQ(zs_control_decode(in, binary.data(), 3), 0);
+  zs_control_free(in);
+  zs_control_free(out);
+}
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,81 @@
+#include "crc32.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+using test::Random;
+
+uint32_t Bitwise(const uint8_t* data, size_t len) {
+  uint32_t c = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    c ^= data[i];
+    for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+  }
+  return ~c;
+}
+
+TEST(Crc32Test, KnownValues) {
+  const char* check = "123456789";
+  const auto* p = reinterpret_cast<const uint8_t*>(check);
+  EXPECT_EQ(Crc32(0, p, 9), 0xCBF43926u);
+  EXPECT_EQ(Crc32Portable(0, p, 9), 0xCBF43926u);
+  EXPECT_EQ(Crc32(0, nullptr, 0), 0u);
+  std::vector<uint8_t> zeros(4096, 0);
+  EXPECT_EQ(Crc32(0, zeros.data(), zeros.size()),
+            Bitwise(zeros.data(), zeros.size()));
+}
+
+TEST(Crc32Test, AcceleratedMatchesPortable) {
+  const std::vector<uint8_t> data = Random(70000, 1);
+  // Unaligned starts and every length around the 16- and 64-byte folding
+  // boundaries.
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t len = 0; len < 300; len++) {
+      ASSERT_EQ(Crc32(0, data.data() + offset, len),
+                Crc32Portable(0, data.data() + offset, len))
+          << "offset=" << offset << " len=" << len;
+    }
+  }
+  for (size_t len : {1023u, 4096u, 65536u, 69999u}) {
+    EXPECT_EQ(Crc32(0, data.data() + 1, len),
+              Bitwise(data.data() + 1, len))
+        << "len=" << len;
+  }
+}
+
+TEST(Crc32Test, IncrementalMatchesOneShot) {
+  const std::vector<uint8_t> data = Random(100000, 2);
+  const uint32_t whole = Crc32(0, data.data(), data.size());
+  for (size_t split : {0u, 1u, 63u, 64u, 65u, 4097u, 99999u}) {
+    uint32_t c = Crc32(0, data.data(), split);
+    c = Crc32(c, data.data() + split, data.size() - split);
+    EXPECT_EQ(c, whole) << "split=" << split;
+  }
+}
+
+TEST(Crc32Test, CombineMatchesConcatenation) {
+  const std::vector<uint8_t> data = Random(300000, 3);
+  const uint32_t whole = Crc32(0, data.data(), data.size());
+  for (size_t split : {0u, 1u, 1000u, 131072u, 299999u, 300000u}) {
+    const uint32_t a = Crc32(0, data.data(), split);
+    const uint32_t b = Crc32(0, data.data() + split, data.size() - split);
+    EXPECT_EQ(Crc32Combine(a, b, data.size() - split), whole)
+        << "split=" << split;
+  }
+  // Three pieces combined out of order of arrival still chain correctly.
+  const uint32_t a = Crc32(0, data.data(), 1000);
+  const uint32_t b = Crc32(0, data.data() + 1000, 2000);
+  const uint32_t c = Crc32(0, data.data() + 3000, 5000);
+  EXPECT_EQ(Crc32Combine(a, Crc32Combine(b, c, 5000), 7000),
+            Crc32(0, data.data(), 8000));
+}
+
+}  // namespace
+}  // namespace zapshare
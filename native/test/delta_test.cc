@@ -0,0 +1,181 @@
+#include "delta.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+using test::Random;
+
+std::vector<uint8_t> Signature(const std::vector<uint8_t>& basis,
+                               uint32_t block_size = 0) {
+  SignatureBuilder builder(basis.size(), block_size);
+  // Odd piece size so blocks straddle Update() calls.
+  for (size_t pos = 0; pos < basis.size(); pos += 7777) {
+    builder.Update(basis.data() + pos,
+                   std::min<size_t>(7777, basis.size() - pos));
+  }
+  return builder.Finish();
+}
+
+struct Encoded {
+  std::vector<uint8_t> delta;
+  DeltaStats stats;
+};
+
+Encoded Encode(const std::vector<uint8_t>& sig,
+               const std::vector<uint8_t>& target, size_t piece = 65536) {
+  auto encoder = DeltaEncoder::Create(sig.data(), sig.size(), target.size());
+  EXPECT_NE(encoder, nullptr);
+  Encoded e;
+  std::vector<uint8_t> buf(10000);
+  auto drain = [&] {
+    while (encoder->Pending() > 0) {
+      size_t n = encoder->Read(buf.data(), buf.size());
+      e.delta.insert(e.delta.end(), buf.begin(), buf.begin() + n);
+    }
+  };
+  for (size_t pos = 0; pos < target.size(); pos += piece) {
+    encoder->Update(target.data() + pos,
+                    std::min(piece, target.size() - pos));
+    drain();
+  }
+  encoder->Finish();
+  drain();
+  e.stats = encoder->stats();
+  return e;
+}
+
+void ExpectRoundTrip(const std::vector<uint8_t>& basis,
+                     const std::vector<uint8_t>& delta,
+                     const std::vector<uint8_t>& target) {
+  std::vector<uint8_t> rebuilt;
+  ASSERT_TRUE(ApplyDelta(basis.data(), basis.size(), delta.data(),
+                         delta.size(), &rebuilt));
+  EXPECT_EQ(rebuilt, target);
+}
+
+TEST(DeltaTest, WeakChecksumSimdMatchesPortable) {
+  std::vector<uint8_t> data = Random(70000, 1);
+  std::fill(data.begin() + 1000, data.begin() + 3000, 0xFF);
+  for (size_t len : {0u, 1u, 15u, 16u, 17u, 31u, 32u, 100u, 2048u, 4099u,
+                     65536u, 70000u}) {
+    EXPECT_EQ(DeltaWeakChecksum(data.data(), len),
+              DeltaWeakChecksumPortable(data.data(), len))
+        << "len=" << len;
+  }
+}
+
+TEST(DeltaTest, BlockSizeScalesWithFile) {
+  EXPECT_EQ(DeltaBlockSize(0), kDeltaMinBlockSize);
+  EXPECT_EQ(DeltaBlockSize(1024 * 1024), kDeltaMinBlockSize);
+  EXPECT_EQ(DeltaBlockSize(1ull << 30), 32u * 1024);
+  EXPECT_EQ(DeltaBlockSize(1ull << 40), kDeltaMaxBlockSize);
+}
+
+TEST(DeltaTest, IdenticalFileIsAllCopies) {
+  // Not a multiple of the block size, so the short last block must match
+  // the tail.
+  std::vector<uint8_t> basis = Random(1000000 + 123, 2);
+  Encoded e = Encode(Signature(basis), basis);
+  EXPECT_EQ(e.stats.literal_bytes, 0u);
+  EXPECT_EQ(e.stats.copied_bytes, basis.size());
+  // Header, one merged copy op and the trailer.
+  EXPECT_LT(e.delta.size(), 64u);
+  ExpectRoundTrip(basis, e.delta, basis);
+}
+
+TEST(DeltaTest, AppendedLogSendsOnlyTheTail) {
+  std::vector<uint8_t> basis = Random(3 * 1024 * 1024, 3);
+  std::vector<uint8_t> target = basis;
+  std::vector<uint8_t> tail = Random(50000, 4);
+  target.insert(target.end(), tail.begin(), tail.end());
+
+  Encoded e = Encode(Signature(basis), target);
+  const uint32_t block = DeltaBlockSize(basis.size());
+  EXPECT_GE(e.stats.copied_bytes, basis.size() - block);
+  EXPECT_LT(e.stats.literal_bytes, tail.size() + 2 * block);
+  ExpectRoundTrip(basis, e.delta, target);
+}
+
+TEST(DeltaTest, InsertionShiftsButStillMatches) {
+  std::vector<uint8_t> basis = Random(2 * 1024 * 1024, 5);
+  std::vector<uint8_t> target = basis;
+  std::vector<uint8_t> insert = Random(333, 6);
+  target.insert(target.begin() + 777777, insert.begin(), insert.end());
+  target.erase(target.begin() + 1500000, target.begin() + 1500100);
+
+  Encoded e = Encode(Signature(basis), target, 4096);
+  EXPECT_LT(e.stats.literal_bytes, 6u * DeltaBlockSize(basis.size()));
+  EXPECT_LT(e.delta.size(), target.size() / 50);
+  ExpectRoundTrip(basis, e.delta, target);
+}
+
+TEST(DeltaTest, UnrelatedTargetGivesUpAndStillRoundTrips) {
+  std::vector<uint8_t> basis = Random(4 * 1024 * 1024, 7);
+  std::vector<uint8_t> target = Random(20 * 1024 * 1024, 8);
+  Encoded e = Encode(Signature(basis), target, 1024 * 1024);
+  EXPECT_TRUE(e.stats.gave_up);
+  EXPECT_EQ(e.stats.copied_bytes, 0u);
+  EXPECT_EQ(e.stats.literal_bytes, target.size());
+  // Framing overhead stays negligible.
+  EXPECT_LT(e.delta.size(), target.size() + target.size() / 100000 + 64);
+  ExpectRoundTrip(basis, e.delta, target);
+}
+
+TEST(DeltaTest, EmptyBasisAndEmptyTarget) {
+  std::vector<uint8_t> empty;
+  std::vector<uint8_t> data = Random(5000, 9);
+
+  Encoded from_empty = Encode(Signature(empty), data);
+  EXPECT_EQ(from_empty.stats.literal_bytes, data.size());
+  ExpectRoundTrip(empty, from_empty.delta, data);
+
+  Encoded to_empty = Encode(Signature(data), empty);
+  EXPECT_EQ(to_empty.stats.output_bytes, to_empty.delta.size());
+  ExpectRoundTrip(data, to_empty.delta, empty);
+}
+
+TEST(DeltaTest, PieceSizeDoesNotChangeOutput) {
+  std::vector<uint8_t> basis = Random(600000, 10);
+  std::vector<uint8_t> target = basis;
+  for (size_t i = 0; i < target.size(); i += 50000) target[i] ^= 0x5A;
+  const std::vector<uint8_t> sig = Signature(basis, 4096);
+  Encoded whole = Encode(sig, target, target.size());
+  for (size_t piece : {1u, 1000u, 4096u, 65537u}) {
+    Encoded pieces = Encode(sig, target, piece);
+    EXPECT_EQ(pieces.delta, whole.delta) << "piece=" << piece;
+  }
+  ExpectRoundTrip(basis, whole.delta, target);
+}
+
+TEST(DeltaTest, RejectsMalformedInput) {
+  std::vector<uint8_t> basis = Random(100000, 11);
+  std::vector<uint8_t> sig = Signature(basis);
+  EXPECT_EQ(DeltaEncoder::Create(sig.data(), sig.size() - 1, 10), nullptr);
+  std::vector<uint8_t> bad_magic = sig;
+  bad_magic[0] = 'X';
+  EXPECT_EQ(DeltaEncoder::Create(bad_magic.data(), bad_magic.size(), 10),
+            nullptr);
+
+  std::vector<uint8_t> target = basis;
+  target[500] ^= 1;
+  Encoded e = Encode(sig, target);
+  std::vector<uint8_t> corrupt = e.delta;
+  corrupt.back() ^= 1;  // Digest no longer matches.
+  std::vector<uint8_t> out;
+  EXPECT_FALSE(ApplyDelta(basis.data(), basis.size(), corrupt.data(),
+                          corrupt.size(), &out));
+  // Wrong basis: copies pull in the wrong bytes.
+  std::vector<uint8_t> other = Random(100000, 12);
+  EXPECT_FALSE(ApplyDelta(other.data(), other.size(), e.delta.data(),
+                          e.delta.size(), &out));
+}
+
+}  // namespace
+}  // namespace zapshare
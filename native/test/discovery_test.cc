@@ -0,0 +1,831 @@
+#include "discovery.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace {
+
+Beacon MakeBeacon(uint64_t id, const std::string& name) {
+  Beacon b;
+  b.id = id;
+  b.port = 8080;
+  b.platform = static_cast<uint8_t>(BeaconPlatform::kAndroid);
+  b.name = name;
+  b.avatar = "face_3";
+  return b;
+}
+
+TEST(BeaconTest, RoundTrips) {
+  const Beacon in = MakeBeacon(0x0123456789abcdefull, "Pixel 8");
+  uint8_t wire[kBeaconSize];
+  EncodeBeacon(in, wire);
+  Beacon out;
+  ASSERT_TRUE(DecodeBeacon(wire, sizeof(wire), &out));
+  EXPECT_EQ(out.id, in.id);
+  EXPECT_EQ(out.port, 8080);
+  EXPECT_EQ(out.platform, in.platform);
+  EXPECT_EQ(out.name, "Pixel 8");
+  EXPECT_EQ(out.avatar, "face_3");
+}
+
+TEST(BeaconTest, CutsLongNamesAtACharacter) {
+  // 31 bytes and then a two-byte character that would straddle the end.
+  const std::string name = std::string(31, 'a') + "\xc3\xa9";
+  uint8_t wire[kBeaconSize];
+  EncodeBeacon(MakeBeacon(1, name), wire);
+  Beacon out;
+  ASSERT_TRUE(DecodeBeacon(wire, sizeof(wire), &out));
+  EXPECT_EQ(out.name, std::string(31, 'a'));
+}
+
+TEST(BeaconTest, LeavesOutLongAvatars) {
+  Beacon in = MakeBeacon(1, "Laptop");
+  in.avatar = "https://example.com/me.png";
+  uint8_t wire[kBeaconSize];
+  EncodeBeacon(in, wire);
+  Beacon out;
+  ASSERT_TRUE(DecodeBeacon(wire, sizeof(wire), &out));
+  EXPECT_EQ(out.avatar, "");
+}
+
+TEST(BeaconTest, RejectsWhatIsNotABeacon) {
+  uint8_t wire[kBeaconSize + 8];
+  EncodeBeacon(MakeBeacon(7, "Phone"), wire);
+  Beacon out;
+  EXPECT_FALSE(DecodeBeacon(wire, kBeaconV1Size - 1, &out));
+
+  const std::string json = "{\"type\":\"ZAPSHARE_DISCOVERY\"," +
+                           std::string(kBeaconSize, ' ') + "}";
+  EXPECT_FALSE(DecodeBeacon(reinterpret_cast<const uint8_t*>(json.data()),
+                            json.size(), &out));
+
+  wire[3] = 0;
+  EXPECT_FALSE(DecodeBeacon(wire, kBeaconSize, &out));
+
+  EncodeBeacon(MakeBeacon(0, "Phone"), wire);
+  EXPECT_FALSE(DecodeBeacon(wire, kBeaconSize, &out));
+}
+
+TEST(BeaconTest, DeviceIdOnlyFromVersionThree) {
+  const std::string device_id = "19216801_1700000000000";
+  Beacon in = MakeBeacon(DeviceIdFromString(device_id), "Phone");
+  in.device_id = device_id;
+  uint8_t wire[kBeaconSize];
+  EncodeBeacon(in, wire);
+  Beacon out;
+  ASSERT_TRUE(DecodeBeacon(wire, sizeof(wire), &out));
+  EXPECT_EQ(out.device_id, device_id);
+
+  // What a version 2 sender puts on the wire.
+  wire[3] = 2;
+  ASSERT_TRUE(DecodeBeacon(wire, kBeaconV2Size, &out));
+  EXPECT_EQ(out.device_id, "");
+  EXPECT_EQ(out.id, in.id);
+
+  // One that isn't what the id was hashed from.
+  in.device_id = "19216801_1700000000001";
+  EncodeBeacon(in, wire);
+  ASSERT_TRUE(DecodeBeacon(wire, sizeof(wire), &out));
+  EXPECT_EQ(out.device_id, "");
+
+  in.device_id = std::string(kBeaconDeviceIdSize + 1, 'a');
+  in.id = DeviceIdFromString(in.device_id);
+  EncodeBeacon(in, wire);
+  ASSERT_TRUE(DecodeBeacon(wire, sizeof(wire), &out));
+  EXPECT_EQ(out.device_id, "");
+}
+
+TEST(BeaconTest, ReadsLaterVersions) {
+  uint8_t wire[kBeaconSize + 8];
+  EncodeBeacon(MakeBeacon(7, "Phone"), wire);
+  wire[3] = kBeaconVersion + 1;
+  memset(wire + kBeaconSize, 0xee, 8);
+  Beacon out;
+  ASSERT_TRUE(DecodeBeacon(wire, sizeof(wire), &out));
+  EXPECT_EQ(out.id, 7u);
+  EXPECT_EQ(out.name, "Phone");
+}
+
+TEST(BeaconTest, TtlOnlyFromVersionTwo) {
+  Beacon in = MakeBeacon(7, "Phone");
+  in.ttl_s = 96;
+  uint8_t wire[kBeaconSize];
+  EncodeBeacon(in, wire);
+  Beacon out;
+  ASSERT_TRUE(DecodeBeacon(wire, sizeof(wire), &out));
+  EXPECT_EQ(out.ttl_s, 96);
+
+  // What a version 1 sender puts on the wire.
+  wire[3] = 1;
+  ASSERT_TRUE(DecodeBeacon(wire, kBeaconV1Size, &out));
+  EXPECT_EQ(out.ttl_s, 0);
+  EXPECT_EQ(out.name, "Phone");
+}
+
+TEST(BeaconTest, DeviceIdsAreStable) {
+  EXPECT_EQ(DeviceIdFromString("19216801_1700000000000"),
+            DeviceIdFromString("19216801_1700000000000"));
+  EXPECT_NE(DeviceIdFromString("19216801_1700000000000"),
+            DeviceIdFromString("19216801_1700000000001"));
+  EXPECT_NE(DeviceIdFromString(""), 0u);
+}
+
+#if !defined(_WIN32)
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  uint8_t kind = 0;
+  uint64_t id = 0;
+  std::string name;
+  std::string device_id;
+  std::vector<uint32_t> addresses;
+  uint32_t from = 0;
+  std::string data;
+};
+
+uint32_t Get32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+uint64_t Get64(const uint8_t* p) {
+  return static_cast<uint64_t>(Get32(p)) << 32 | Get32(p + 4);
+}
+
+std::vector<Event> Parse(const uint8_t* p, size_t len) {
+  std::vector<Event> events;
+  const uint8_t* end = p + len;
+  while (p < end) {
+    Event e;
+    e.kind = *p;
+    if (e.kind == kGoneEvent) {
+      e.id = Get64(p + 1);
+      p += 9;
+    } else if (e.kind == kPeerEvent) {
+      e.id = Get64(p + 4);
+      p += 13;
+      e.name.assign(reinterpret_cast<const char*>(p + 1), *p);
+      p += 1 + *p;
+      p += 1 + *p;  // Avatar.
+      e.device_id.assign(reinterpret_cast<const char*>(p + 1), *p);
+      p += 1 + *p;
+      const int n = *p++;
+      for (int i = 0; i < n; i++, p += 4) e.addresses.push_back(Get32(p));
+    } else {
+      EXPECT_EQ(e.kind, kMessageEvent);
+      e.from = Get32(p + 1);
+      const size_t n = static_cast<size_t>(p[5] << 8 | p[6]);
+      e.data.assign(reinterpret_cast<const char*>(p + 7), n);
+      p += 7 + n;
+    }
+    events.push_back(e);
+  }
+  EXPECT_EQ(p, end);
+  return events;
+}
+
+// Polls until |want| events have come or |timeout| passes, waiting on
+// Notify() in between as the app does, so a change that doesn't wake it
+// is never seen here either.
+std::vector<Event> PollFor(DiscoveryEngine* engine, size_t want,
+                           std::chrono::milliseconds timeout =
+                               std::chrono::seconds(5)) {
+  struct Signal {
+    std::mutex mu;
+    std::condition_variable cv;
+    bool fired = false;
+  };
+  std::vector<uint8_t> buffer(kDiscoveryPollBufferSize);
+  std::vector<Event> events;
+  const auto deadline = Clock::now() + timeout;
+  while (events.size() < want && Clock::now() < deadline) {
+    const size_t n = engine->Poll(buffer.data(), buffer.size());
+    if (n > 0) {
+      for (const Event& e : Parse(buffer.data(), n)) events.push_back(e);
+      continue;
+    }
+    auto signal = std::make_shared<Signal>();
+    engine->Notify([signal] {
+      std::lock_guard<std::mutex> lock(signal->mu);
+      signal->fired = true;
+      signal->cv.notify_all();
+    });
+    std::unique_lock<std::mutex> lock(signal->mu);
+    while (!signal->fired &&
+           signal->cv.wait_until(lock, deadline) != std::cv_status::timeout) {
+    }
+  }
+  return events;
+}
+
+uint32_t Loopback(int host) { return 0x7f000000u + host; }  // 127.x.y.z
+
+// A UDP socket on one loopback address, standing in for a peer.
+class FakePeer {
+ public:
+  explicit FakePeer(uint32_t ip) : ip_(ip) {
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(ip);
+    socklen_t len = sizeof(addr);
+    EXPECT_EQ(bind(fd_, reinterpret_cast<sockaddr*>(&addr), len), 0);
+    getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+  }
+  ~FakePeer() { close(fd_); }
+
+  FakePeer(const FakePeer&) = delete;
+  FakePeer& operator=(const FakePeer&) = delete;
+
+  void Send(uint16_t port, const std::string& data) {
+    sockaddr_in to{};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = htonl(Loopback(1));
+    sendto(fd_, data.data(), data.size(), 0,
+           reinterpret_cast<sockaddr*>(&to), sizeof(to));
+  }
+
+  void Beacon(uint16_t port, const zapshare::Beacon& beacon) {
+    std::string wire(kBeaconSize, '\0');
+    EncodeBeacon(beacon, reinterpret_cast<uint8_t*>(&wire[0]));
+    Send(port, wire);
+  }
+
+  // The next datagram sent to this peer, or "" after a second.
+  std::string Receive() {
+    timeval tv{1, 0};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char buf[2048];
+    const ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+    return n > 0 ? std::string(buf, static_cast<size_t>(n)) : "";
+  }
+
+  uint32_t ip() const { return ip_; }
+  uint16_t port() const { return port_; }
+
+ private:
+  const uint32_t ip_;
+  int fd_;
+  uint16_t port_ = 0;
+};
+
+// An engine on a free port of 127.0.0.1 whose own beacons go to |sink|.
+std::unique_ptr<DiscoveryEngine> StartEngine(const FakePeer& sink,
+                                             uint32_t ttl_ms = 30000) {
+  DiscoveryConfig config;
+  config.self = MakeBeacon(DeviceIdFromString("self"), "This device");
+  config.self.device_id = "self";
+  config.port = 0;
+  config.interfaces = {"127.0.0.1"};
+  config.targets = {"127.0.0.1:" + std::to_string(sink.port())};
+  config.min_interval_ms = 20;
+  config.max_interval_ms = 640;
+  config.ttl_ms = ttl_ms;
+  config.legacy_beacon = {'{', '}'};
+  return DiscoveryEngine::Start(config);
+}
+
+TEST(DiscoveryEngineTest, SendsBothBeaconsAtStart) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  const std::string wire = sink.Receive();
+  Beacon beacon;
+  ASSERT_TRUE(DecodeBeacon(reinterpret_cast<const uint8_t*>(wire.data()),
+                           wire.size(), &beacon));
+  EXPECT_EQ(beacon.id, DeviceIdFromString("self"));
+  EXPECT_EQ(beacon.name, "This device");
+  EXPECT_EQ(beacon.device_id, "self");
+  EXPECT_EQ(sink.Receive(), "{}");
+}
+
+TEST(DiscoveryEngineTest, ReportsAPeerOnlyWhenItChanges) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  FakePeer wifi(Loopback(0x000102));
+  FakePeer ethernet(Loopback(0x000103));
+
+  for (int i = 0; i < 5; i++) wifi.Beacon(engine->port(), MakeBeacon(42, "A"));
+  std::vector<Event> events = PollFor(engine.get(), 1);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].kind, kPeerEvent);
+  EXPECT_EQ(events[0].id, 42u);
+  EXPECT_EQ(events[0].addresses, std::vector<uint32_t>{wifi.ip()});
+  // Nothing new, nothing to report.
+  EXPECT_TRUE(PollFor(engine.get(), 1, std::chrono::milliseconds(100))
+                  .empty());
+
+  // Heard on a second network.
+  ethernet.Beacon(engine->port(), MakeBeacon(42, "A"));
+  events = PollFor(engine.get(), 1);
+  ASSERT_EQ(events.size(), 1u);
+  // The one it was heard on last comes first.
+  EXPECT_EQ(events[0].addresses,
+            (std::vector<uint32_t>{ethernet.ip(), wifi.ip()}));
+
+  wifi.Beacon(engine->port(), MakeBeacon(42, "Renamed"));
+  events = PollFor(engine.get(), 1);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].name, "Renamed");
+  EXPECT_EQ(events[0].addresses,
+            (std::vector<uint32_t>{wifi.ip(), ethernet.ip()}));
+  EXPECT_EQ(engine->stats().peers, 1u);
+}
+
+TEST(DiscoveryEngineTest, ReportsThePeersDeviceId) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  FakePeer peer(Loopback(0x000102));
+  Beacon beacon = MakeBeacon(DeviceIdFromString("tablet"), "Tablet");
+  beacon.device_id = "tablet";
+  peer.Beacon(engine->port(), beacon);
+  std::vector<Event> events = PollFor(engine.get(), 1);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].id, DeviceIdFromString("tablet"));
+  EXPECT_EQ(events[0].device_id, "tablet");
+}
+
+TEST(DiscoveryEngineTest, IgnoresItsOwnBeacons) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  FakePeer peer(Loopback(0x000102));
+  peer.Beacon(engine->port(),
+              MakeBeacon(DeviceIdFromString("self"), "This device"));
+  EXPECT_TRUE(PollFor(engine.get(), 1, std::chrono::milliseconds(100))
+                  .empty());
+}
+
+TEST(DiscoveryEngineTest, PeerIsGoneOnceSilentOnEveryAddress) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink, 300);
+  ASSERT_NE(engine, nullptr);
+  FakePeer peer(Loopback(0x000102));
+  peer.Beacon(engine->port(), MakeBeacon(42, "A"));
+  std::vector<Event> events = PollFor(engine.get(), 1);
+  ASSERT_EQ(events.size(), 1u);
+
+  events = PollFor(engine.get(), 1);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].kind, kGoneEvent);
+  EXPECT_EQ(events[0].id, 42u);
+  EXPECT_EQ(engine->stats().peers, 0u);
+}
+
+TEST(DiscoveryEngineTest, NewIdTakesTheAddressOver) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  FakePeer peer(Loopback(0x000102));
+  peer.Beacon(engine->port(), MakeBeacon(42, "A"));
+  ASSERT_EQ(PollFor(engine.get(), 1).size(), 1u);
+
+  // The app regenerated its device id.
+  peer.Beacon(engine->port(), MakeBeacon(43, "A"));
+  std::vector<Event> events = PollFor(engine.get(), 2);
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[0].kind, kGoneEvent);
+  EXPECT_EQ(events[0].id, 42u);
+  EXPECT_EQ(events[1].kind, kPeerEvent);
+  EXPECT_EQ(events[1].id, 43u);
+}
+
+TEST(DiscoveryEngineTest, HandsOverOtherDatagrams) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  FakePeer modern(Loopback(0x000102));
+  FakePeer old(Loopback(0x000103));
+  const std::string request = "{\"type\":\"ZAPSHARE_CONNECTION_REQUEST\"}";
+  const std::string legacy = "{\"type\":\"ZAPSHARE_DISCOVERY\"}";
+
+  modern.Beacon(engine->port(), MakeBeacon(42, "A"));
+  ASSERT_EQ(PollFor(engine.get(), 1).size(), 1u);
+  // Its JSON beacon says nothing new; an older peer's is all there is.
+  modern.Send(engine->port(), legacy);
+  old.Send(engine->port(), legacy);
+  modern.Send(engine->port(), request);
+  std::vector<Event> events = PollFor(engine.get(), 2);
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[0].kind, kMessageEvent);
+  EXPECT_EQ(events[0].from, old.ip());
+  EXPECT_EQ(events[0].data, legacy);
+  EXPECT_EQ(events[1].from, modern.ip());
+  EXPECT_EQ(events[1].data, request);
+  EXPECT_TRUE(PollFor(engine.get(), 1, std::chrono::milliseconds(100))
+                  .empty());
+}
+
+TEST(DiscoveryEngineTest, WakesTheAppOnlyForChanges) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink, 300);
+  ASSERT_NE(engine, nullptr);
+  FakePeer peer(Loopback(0x000104));
+  std::atomic<int> woken{0};
+  auto wait_woken = [&woken](int n) {
+    const auto deadline = Clock::now() + std::chrono::seconds(5);
+    while (woken.load() < n && Clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return woken.load() == n;
+  };
+
+  // A newcomer wakes it.
+  engine->Notify([&woken] { woken++; });
+  peer.Beacon(engine->port(), MakeBeacon(43, "B"));
+  ASSERT_TRUE(wait_woken(1));
+  ASSERT_EQ(PollFor(engine.get(), 1).size(), 1u);
+
+  // The same beacon again doesn't.
+  engine->Notify([&woken] { woken++; });
+  const uint64_t beacons = engine->stats().beacons;
+  peer.Beacon(engine->port(), MakeBeacon(43, "B"));
+  const auto deadline = Clock::now() + std::chrono::seconds(5);
+  while (engine->stats().beacons == beacons && Clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(woken.load(), 1);
+
+  // A message does, and while it is queued asking again answers at once.
+  peer.Send(engine->port(), "{\"type\":\"ZAPSHARE_CONNECTION_REQUEST\"}");
+  ASSERT_TRUE(wait_woken(2));
+  EXPECT_TRUE(test::AwaitReady(engine.get()));
+  EXPECT_EQ(PollFor(engine.get(), 1).size(), 1u);
+
+  // So does the peer going silent.
+  engine->Notify([&woken] { woken++; });
+  ASSERT_TRUE(wait_woken(3));
+  const std::vector<Event> events = PollFor(engine.get(), 1);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].kind, kGoneEvent);
+
+  // Nothing left: destroying the engine is what wakes the waiter.
+  engine->Notify([&woken] { woken++; });
+  EXPECT_EQ(woken.load(), 3);
+  engine.reset();
+  EXPECT_EQ(woken.load(), 4);
+}
+
+TEST(DiscoveryEngineTest, ByeIsGoneAtOnce) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  FakePeer peer(Loopback(0x000102));
+  Beacon beacon = MakeBeacon(42, "A");
+  peer.Beacon(engine->port(), beacon);
+  ASSERT_EQ(PollFor(engine.get(), 1).size(), 1u);
+
+  beacon.flags = kBeaconBye;
+  peer.Beacon(engine->port(), beacon);
+  const std::vector<Event> events =
+      PollFor(engine.get(), 1, std::chrono::milliseconds(500));
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].kind, kGoneEvent);
+  EXPECT_EQ(engine->stats().peers, 0u);
+}
+
+TEST(DiscoveryEngineTest, SaysByeWhenStopping) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  ASSERT_FALSE(sink.Receive().empty());
+  engine.reset();
+  bool bye = false;
+  for (std::string wire = sink.Receive(); !wire.empty() && !bye;
+       wire = sink.Receive()) {
+    Beacon beacon;
+    bye = DecodeBeacon(reinterpret_cast<const uint8_t*>(wire.data()),
+                       wire.size(), &beacon) &&
+          (beacon.flags & kBeaconBye) != 0;
+  }
+  EXPECT_TRUE(bye);
+}
+
+TEST(DiscoveryEngineTest, BacksOffUntilAnnounced) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  // 20, 40, ..., 640 ms: six intervals, where every 20 ms would be 75.
+  // Each beacon is two datagrams with the legacy one.
+  const uint64_t sent = engine->stats().sent;
+  EXPECT_LE(sent, 2u * 8);
+
+  engine->Announce();
+  const auto deadline = Clock::now() + std::chrono::milliseconds(200);
+  while (engine->stats().sent == sent && Clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_GT(engine->stats().sent, sent);
+}
+
+TEST(DiscoveryEngineTest, RepeatsWithinTheWindowAreNotFirst) {
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  EXPECT_TRUE(engine->FirstInWindow("phone", 200));
+  EXPECT_FALSE(engine->FirstInWindow("phone", 200));
+  EXPECT_TRUE(engine->FirstInWindow("laptop", 200));
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  EXPECT_TRUE(engine->FirstInWindow("phone", 200));
+}
+
+// A crowded LAN: hundreds of peers beaconing at once, many times over.
+// Every peer must show up exactly once, and the engine must keep up at a
+// small CPU cost per beacon.
+TEST(DiscoveryEngineTest, CrowdedLan) {
+  constexpr int kPeers = 400;
+  constexpr int kRounds = 20;
+  FakePeer sink(Loopback(1));
+  auto engine = StartEngine(sink);
+  ASSERT_NE(engine, nullptr);
+  std::vector<std::unique_ptr<FakePeer>> peers;
+  for (int i = 0; i < kPeers; i++) {
+    peers.emplace_back(new FakePeer(Loopback(0x010000 + i + 1)));
+  }
+
+  const auto start = Clock::now();
+  for (int i = 0; i < kPeers; i++) {
+    peers[i]->Beacon(engine->port(), MakeBeacon(1000 + i, "Peer"));
+  }
+  std::vector<Event> events = PollFor(engine.get(), kPeers);
+  const double all_ms =
+      std::chrono::duration<double, std::milli>(Clock::now() - start)
+          .count();
+  ASSERT_EQ(events.size(), static_cast<size_t>(kPeers));
+
+  // The same beacons again are no news at all.
+  for (int round = 1; round < kRounds; round++) {
+    for (int i = 0; i < kPeers; i++) {
+      peers[i]->Beacon(engine->port(), MakeBeacon(1000 + i, "Peer"));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  // One newcomer, timed from its beacon to its event.
+  FakePeer late(Loopback(0x020001));
+  const auto sent = Clock::now();
+  late.Beacon(engine->port(), MakeBeacon(99, "Late"));
+  events = PollFor(engine.get(), 1);
+  const double late_ms =
+      std::chrono::duration<double, std::milli>(Clock::now() - sent).count();
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].id, 99u);
+
+  const DiscoveryStats stats = engine->stats();
+  EXPECT_EQ(stats.peers, static_cast<uint64_t>(kPeers + 1));
+  const double us_per_beacon =
+      stats.cpu_ns / 1e3 / std::max<uint64_t>(stats.beacons, 1);
+  RecordProperty("beacons", static_cast<int>(stats.beacons));
+  RecordProperty("cpu_us_per_beacon", std::to_string(us_per_beacon));
+  RecordProperty("first_round_ms", std::to_string(all_ms));
+  RecordProperty("newcomer_ms", std::to_string(late_ms));
+  // Datagrams beyond the socket buffer may drop under the burst, but not
+  // most of them.
+  EXPECT_GT(stats.beacons, static_cast<uint64_t>(kPeers * kRounds / 2));
+  EXPECT_LT(us_per_beacon, 50.0);
+  EXPECT_LT(late_ms, 100.0);
+}
+
+uint16_t FreeUdpPort() {
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  socklen_t len = sizeof(addr);
+  bind(fd, reinterpret_cast<sockaddr*>(&addr), len);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  close(fd);
+  return ntohs(addr.sin_port);
+}
+
+// Engines as phones on one Wi-Fi: each on its own loopback address, all
+// on one port and in one multicast group.
+class Lan {
+ public:
+  Lan(uint32_t min_interval_ms, uint32_t max_interval_ms,
+      uint16_t mdns_port = 0)
+      : port_(FreeUdpPort()),
+        mdns_port_(mdns_port),
+        min_interval_ms_(min_interval_ms),
+        max_interval_ms_(max_interval_ms) {}
+
+  DiscoveryEngine* Join() {
+    const int host = static_cast<int>(engines_.size()) + 2;
+    DiscoveryConfig config;
+    config.self = MakeBeacon(1000 + host, "Peer");
+    config.port = port_;
+    config.group = "239.255.67.1";
+    config.interfaces = {"127.0.0." + std::to_string(host)};
+    config.broadcast = false;
+    config.min_interval_ms = min_interval_ms_;
+    config.max_interval_ms = max_interval_ms_;
+    config.mdns_port = mdns_port_;
+    engines_.push_back(DiscoveryEngine::Start(config));
+    EXPECT_NE(engines_.back(), nullptr);
+    return engines_.back().get();
+  }
+
+  // Whether everyone knew everyone else within |timeout|.
+  bool AllKnown(std::chrono::milliseconds timeout) const {
+    const auto deadline = Clock::now() + timeout;
+    for (;;) {
+      const bool all = std::all_of(
+          engines_.begin(), engines_.end(), [&](const auto& engine) {
+            return engine && engine->stats().peers == engines_.size() - 1;
+          });
+      if (all) return true;
+      if (Clock::now() >= deadline) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  uint16_t port() const { return port_; }
+
+  uint64_t Sent() const {
+    uint64_t sent = 0;
+    for (const auto& engine : engines_) sent += engine->stats().sent;
+    return sent;
+  }
+
+  uint64_t Suppressed() const {
+    uint64_t suppressed = 0;
+    for (const auto& engine : engines_) {
+      suppressed += engine->stats().suppressed;
+    }
+    return suppressed;
+  }
+
+ private:
+  const uint16_t port_;
+  const uint16_t mdns_port_;
+  const uint32_t min_interval_ms_;
+  const uint32_t max_interval_ms_;
+  std::vector<std::unique_ptr<DiscoveryEngine>> engines_;
+};
+
+TEST(TrickleTest, EveryoneAnswersANewcomerAtOnce) {
+  Lan lan(20, 2000);
+  for (int i = 0; i < 8; i++) lan.Join();
+  ASSERT_TRUE(lan.AllKnown(std::chrono::seconds(3)));
+  // Long enough that everyone's intervals are far longer than the minimum.
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+  const auto start = Clock::now();
+  lan.Join();
+  ASSERT_TRUE(lan.AllKnown(std::chrono::seconds(3)));
+  const double ms =
+      std::chrono::duration<double, std::milli>(Clock::now() - start)
+          .count();
+  RecordProperty("newcomer_ms", std::to_string(ms));
+  EXPECT_LT(ms, 300.0);
+}
+
+TEST(TrickleTest, LeavesOutRedundantBeacons) {
+  Lan lan(20, 160);
+  for (int i = 0; i < 8; i++) lan.Join();
+  ASSERT_TRUE(lan.AllKnown(std::chrono::seconds(3)));
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  const uint64_t sent = lan.Sent();
+  const uint64_t suppressed = lan.Suppressed();
+  RecordProperty("sent", static_cast<int>(sent));
+  RecordProperty("suppressed", static_cast<int>(suppressed));
+  EXPECT_GT(suppressed, 0u);
+  // Nobody went quiet for long enough to be taken for gone.
+  EXPECT_TRUE(lan.AllKnown(std::chrono::milliseconds(0)));
+}
+
+// A socket on 127.0.0.|host| sending multicast from there, as a newcomer
+// on its own port would: the engines of a Lan share one port, so only
+// one of them could take a unicast answer.
+int Asker(int host) {
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(Loopback(host));
+  EXPECT_EQ(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  in_addr via;
+  via.s_addr = htonl(Loopback(host));
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &via, sizeof(via));
+  timeval tv{0, 200000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  return fd;
+}
+
+void SendTo(int fd, const char* group, uint16_t port, const uint8_t* data,
+            size_t len) {
+  sockaddr_in to{};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  inet_pton(AF_INET, group, &to.sin_addr);
+  sendto(fd, data, len, 0, reinterpret_cast<sockaddr*>(&to), sizeof(to));
+}
+
+// Intervals far too long to find anyone in time without asking.
+TEST(QueryTest, EveryoneAnswersAQueryAtOnce) {
+  Lan lan(2000, 2000);
+  std::vector<DiscoveryEngine*> engines;
+  for (int i = 0; i < 4; i++) engines.push_back(lan.Join());
+  ASSERT_TRUE(lan.AllKnown(std::chrono::seconds(6)));
+
+  const int fd = Asker(9);
+  uint8_t query[kBeaconSize];
+  Beacon self = MakeBeacon(7, "Newcomer");
+  self.flags = kBeaconQuery;
+  EncodeBeacon(self, query);
+  const auto start = Clock::now();
+  SendTo(fd, "239.255.67.1", lan.port(), query, sizeof(query));
+  std::set<uint64_t> answered;
+  uint8_t buf[kBeaconSize];
+  while (answered.size() < 4 && recv(fd, buf, sizeof(buf), 0) > 0) {
+    Beacon b;
+    ASSERT_TRUE(DecodeBeacon(buf, sizeof(buf), &b));
+    EXPECT_EQ(b.flags, 0);
+    answered.insert(b.id);
+  }
+  const double ms =
+      std::chrono::duration<double, std::milli>(Clock::now() - start)
+          .count();
+  RecordProperty("query_ms", std::to_string(ms));
+  EXPECT_EQ(answered.size(), 4u);
+  EXPECT_LT(ms, 100.0);
+  // Everyone took the query for a beacon, too.
+  for (DiscoveryEngine* engine : engines) {
+    EXPECT_EQ(engine->stats().peers, 4u);
+  }
+
+  // Asked again straight away, nobody answers twice.
+  SendTo(fd, "239.255.67.1", lan.port(), query, sizeof(query));
+  EXPECT_LT(recv(fd, buf, sizeof(buf), 0), 0);
+  close(fd);
+}
+
+// A one-shot resolver, as `dns-sd -B` is, browsing on its own port and
+// taking unicast answers from every responder.
+TEST(QueryTest, AnswersAnMdnsBrowse) {
+  const uint16_t mdns_port = FreeUdpPort();
+  Lan lan(20, 640, mdns_port);
+  std::vector<DiscoveryEngine*> engines;
+  for (int i = 0; i < 4; i++) engines.push_back(lan.Join());
+  ASSERT_EQ(engines[0]->mdns_port(), mdns_port);
+
+  const int fd = Asker(9);
+  MdnsMessage browse;
+  browse.id = 77;
+  browse.questions.push_back({kMdnsServiceType, kMdnsPtr, false});
+  const std::vector<uint8_t> query = EncodeMdns(browse);
+
+  std::set<std::string> instances;
+  std::set<uint32_t> hosts;
+  const auto deadline = Clock::now() + std::chrono::seconds(3);
+  while (instances.size() < engines.size() && Clock::now() < deadline) {
+    // Asked again, as resolvers do, in case a responder missed it.
+    SendTo(fd, kMdnsGroup, mdns_port, query.data(), query.size());
+    uint8_t buf[9000];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+      MdnsMessage answer;
+      ASSERT_TRUE(ParseMdns(buf, static_cast<size_t>(n), &answer));
+      EXPECT_EQ(answer.id, 77);
+      for (const MdnsRecord& r : answer.records) {
+        if (r.type == kMdnsPtr) instances.insert(r.target);
+        if (r.type == kMdnsSrv) {
+          EXPECT_EQ(r.port, 8080);
+        }
+        if (r.type == kMdnsA) hosts.insert(r.ipv4);
+      }
+    }
+  }
+  close(fd);
+  EXPECT_EQ(instances.size(), engines.size());
+  EXPECT_EQ(hosts.size(), engines.size());
+  EXPECT_GT(engines[0]->stats().answered, 0u);
+}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace
+}  // namespace zapshare
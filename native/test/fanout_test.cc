@@ -0,0 +1,209 @@
+#include "fanout.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+using test::AwaitReady;
+using test::Random;
+using test::WriteTemp;
+
+constexpr size_t kBlock = 4096;
+
+// Up to |cap| bytes from |reader|, waiting for the stream's thread.
+std::vector<uint8_t> ReadSome(FanoutReader* reader, size_t cap) {
+  std::vector<uint8_t> out(cap);
+  for (;;) {
+    const int64_t n = reader->Read(out.data(), cap);
+    if (n < 0) return {};
+    if (n > 0 || reader->position() == reader->end()) {
+      out.resize(static_cast<size_t>(n));
+      return out;
+    }
+    if (!AwaitReady(reader)) {
+      ADD_FAILURE() << "no wakeup at " << reader->position();
+      return {};
+    }
+  }
+}
+
+std::vector<uint8_t> ReadAll(FanoutReader* reader) {
+  std::vector<uint8_t> out;
+  while (reader->position() < reader->end()) {
+    const std::vector<uint8_t> piece = ReadSome(reader, 3000);
+    if (piece.empty()) break;
+    out.insert(out.end(), piece.begin(), piece.end());
+  }
+  return out;
+}
+
+TEST(FanoutTest, SingleReaderReadsTheFileOnce) {
+  const auto data = Random(10 * kBlock + 123, 1);
+  const std::string path = WriteTemp("single", data);
+  FanoutCache cache(kBlock, 4);
+  auto reader = cache.Open(path, 0, UINT64_MAX);
+  ASSERT_NE(reader, nullptr);
+  EXPECT_EQ(reader->end(), data.size());
+  EXPECT_EQ(ReadAll(reader.get()), data);
+  EXPECT_EQ(cache.stats().disk_bytes, data.size());
+  EXPECT_EQ(cache.stats().served_bytes, data.size());
+}
+
+TEST(FanoutTest, ConcurrentReadersShareOneDiskRead) {
+  const auto data = Random(40 * kBlock + 7, 2);
+  const std::string path = WriteTemp("shared", data);
+  FanoutCache cache(kBlock, 4);
+  std::vector<std::unique_ptr<FanoutReader>> readers;
+  for (int i = 0; i < 8; i++) {
+    readers.push_back(cache.Open(path, 0, UINT64_MAX));
+  }
+  std::vector<std::vector<uint8_t>> got(readers.size());
+  // Lockstep, like receivers on the same Wi-Fi.
+  for (bool more = true; more;) {
+    more = false;
+    for (size_t i = 0; i < readers.size(); i++) {
+      if (readers[i]->position() == readers[i]->end()) continue;
+      const auto piece = ReadSome(readers[i].get(), 1000);
+      got[i].insert(got[i].end(), piece.begin(), piece.end());
+      more = true;
+    }
+  }
+  for (const auto& g : got) EXPECT_EQ(g, data);
+  EXPECT_EQ(cache.stats().joined, 7u);
+  EXPECT_EQ(cache.stats().disk_bytes, data.size());
+  EXPECT_EQ(cache.stats().served_bytes, 8 * data.size());
+}
+
+TEST(FanoutTest, ReadersOnTheirOwnThreads) {
+  const auto data = Random(64 * kBlock + 99, 3);
+  const std::string path = WriteTemp("threads", data);
+  FanoutCache cache(kBlock, 8);
+  std::vector<std::vector<uint8_t>> got(6);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < got.size(); i++) {
+    threads.emplace_back([&, i] {
+      auto reader = cache.Open(path, 0, UINT64_MAX);
+      if (reader != nullptr) got[i] = ReadAll(reader.get());
+    });
+  }
+  for (auto& t : threads) t.join();
+  for (const auto& g : got) EXPECT_EQ(g, data);
+  EXPECT_GE(cache.stats().disk_bytes, data.size());
+}
+
+TEST(FanoutTest, LateJoinerCatchesUpFromDisk) {
+  const auto data = Random(30 * kBlock, 4);
+  const std::string path = WriteTemp("late", data);
+  FanoutCache cache(kBlock, 4);
+  auto early = cache.Open(path, 0, UINT64_MAX);
+  std::vector<uint8_t> first;
+  while (first.size() < 20 * kBlock) {
+    const auto piece = ReadSome(early.get(), kBlock);
+    first.insert(first.end(), piece.begin(), piece.end());
+  }
+  auto late = cache.Open(path, 0, UINT64_MAX);
+  EXPECT_EQ(ReadAll(late.get()), data);
+  const auto rest = ReadAll(early.get());
+  first.insert(first.end(), rest.begin(), rest.end());
+  EXPECT_EQ(first, data);
+  EXPECT_EQ(cache.stats().joined, 1u);
+}
+
+TEST(FanoutTest, SlowReaderDoesNotHoldBackAFastOne) {
+  const auto data = Random(50 * kBlock + 1, 5);
+  const std::string path = WriteTemp("slow", data);
+  FanoutCache cache(kBlock, 4);
+  auto slow = cache.Open(path, 0, UINT64_MAX);
+  auto fast = cache.Open(path, 0, UINT64_MAX);
+  const auto head = ReadSome(slow.get(), 10);
+  EXPECT_EQ(ReadAll(fast.get()), data);
+  auto got = head;
+  const auto rest = ReadAll(slow.get());
+  got.insert(got.end(), rest.begin(), rest.end());
+  EXPECT_EQ(got, data);
+}
+
+TEST(FanoutTest, ReadsRanges) {
+  const auto data = Random(20 * kBlock, 6);
+  const std::string path = WriteTemp("range", data);
+  FanoutCache cache(kBlock, 4);
+  auto whole = cache.Open(path, 0, UINT64_MAX);
+  auto middle = cache.Open(path, 5 * kBlock + 17, 9 * kBlock + 3);
+  auto tail = cache.Open(path, data.size() - 100, data.size() + 1000);
+  EXPECT_EQ(ReadAll(middle.get()),
+            std::vector<uint8_t>(data.begin() + 5 * kBlock + 17,
+                                 data.begin() + 9 * kBlock + 3));
+  EXPECT_EQ(ReadAll(tail.get()),
+            std::vector<uint8_t>(data.end() - 100, data.end()));
+  EXPECT_EQ(ReadAll(whole.get()), data);
+  auto empty = cache.Open(path, data.size(), data.size());
+  uint8_t b;
+  EXPECT_EQ(empty->Read(&b, 1), 0);
+}
+
+TEST(FanoutTest, ChangedFileStartsANewStream) {
+  const std::string path = WriteTemp("changed", Random(3 * kBlock, 7));
+  FanoutCache cache(kBlock, 4);
+  auto before = cache.Open(path, 0, UINT64_MAX);
+  const auto data = Random(5 * kBlock, 8);
+  WriteTemp("changed", data);
+  auto after = cache.Open(path, 0, UINT64_MAX);
+  EXPECT_EQ(cache.stats().joined, 0u);
+  EXPECT_EQ(ReadAll(after.get()), data);
+}
+
+TEST(FanoutTest, NotifyWakesAWaitingReader) {
+  const auto data = Random(8 * kBlock, 9);
+  const std::string path = WriteTemp("notify", data);
+  FanoutCache cache(kBlock, 4);
+  auto reader = cache.Open(path, 0, UINT64_MAX);
+  // Nothing read yet says nothing is on its way, so it fires at once.
+  EXPECT_TRUE(AwaitReady(reader.get()));
+  std::vector<uint8_t> got;
+  int waits = 0;
+  while (reader->position() < reader->end()) {
+    std::vector<uint8_t> piece(kBlock);
+    const int64_t n = reader->Read(piece.data(), piece.size());
+    ASSERT_GE(n, 0);
+    if (n == 0) {
+      ASSERT_TRUE(AwaitReady(reader.get()));
+      waits++;
+      continue;
+    }
+    got.insert(got.end(), piece.begin(), piece.begin() + n);
+  }
+  EXPECT_EQ(got, data);
+  EXPECT_GE(waits, 1);
+  // At the end there is nothing to wait for.
+  EXPECT_TRUE(AwaitReady(reader.get()));
+}
+
+TEST(FanoutTest, NotifyFiresOnceEvenIfTheReaderIsClosed) {
+  const std::string path = WriteTemp("close", Random(4 * kBlock, 10));
+  FanoutCache cache(kBlock, 4);
+  auto reader = cache.Open(path, 0, UINT64_MAX);
+  uint8_t b;
+  // The first read puts the stream on this reader, so it can't be ready.
+  ASSERT_EQ(reader->Read(&b, 1), 0);
+  std::atomic<int> fired{0};
+  reader->Notify([&fired] { fired++; });
+  reader.reset();
+  EXPECT_EQ(fired.load(), 1);
+}
+
+TEST(FanoutTest, MissingFile) {
+  FanoutCache cache(0, 0);
+  EXPECT_EQ(cache.Open(WriteTemp("gone", {}) + ".missing", 0, 1), nullptr);
+}
+
+}  // namespace
+}  // namespace zapshare
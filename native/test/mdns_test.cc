@@ -0,0 +1,187 @@
+#include "mdns.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace zapshare {
+namespace {
+
+MdnsService MakeService() {
+  MdnsService s;
+  s.instance = "Pixel 8 (3fa2)";
+  s.host = "zapshare-3fa2c0ffee000001.local";
+  s.port = 8080;
+  s.txt = {"id=3fa2c0ffee000001", "name=Pixel 8", "v=2"};
+  s.addresses = {0xc0a80105, 0x0a000002};
+  return s;
+}
+
+MdnsMessage Ask(const std::string& name, uint16_t type) {
+  MdnsMessage query;
+  query.id = 0x1234;
+  query.questions.push_back({name, type, false});
+  return query;
+}
+
+size_t Count(const MdnsMessage& m, uint16_t type) {
+  size_t n = 0;
+  for (const MdnsRecord& r : m.records) n += r.type == type;
+  return n;
+}
+
+TEST(MdnsTest, RoundTrips) {
+  MdnsMessage in;
+  in.id = 7;
+  in.response = true;
+  in.questions.push_back({kMdnsServiceType, kMdnsPtr, true});
+  MdnsRecord ptr;
+  ptr.name = kMdnsServiceType;
+  ptr.type = kMdnsPtr;
+  ptr.ttl = 4500;
+  ptr.target = "Laptop._zapshare._tcp.local";
+  MdnsRecord srv;
+  srv.name = ptr.target;
+  srv.type = kMdnsSrv;
+  srv.unique = true;
+  srv.ttl = 120;
+  srv.port = 8080;
+  srv.target = "laptop.local";
+  MdnsRecord txt;
+  txt.name = ptr.target;
+  txt.type = kMdnsTxt;
+  txt.txt = {"a=1", "", "b=2"};
+  MdnsRecord a;
+  a.name = "laptop.local";
+  a.type = kMdnsA;
+  a.ipv4 = 0xc0a80105;
+  in.records = {ptr, srv, txt, a};
+
+  const std::vector<uint8_t> wire = EncodeMdns(in);
+  MdnsMessage out;
+  ASSERT_TRUE(ParseMdns(wire.data(), wire.size(), &out));
+  EXPECT_EQ(out.id, 7);
+  EXPECT_TRUE(out.response);
+  ASSERT_EQ(out.questions.size(), 1u);
+  EXPECT_EQ(out.questions[0].name, kMdnsServiceType);
+  EXPECT_TRUE(out.questions[0].unicast_response);
+  ASSERT_EQ(out.records.size(), 4u);
+  EXPECT_EQ(out.records[0].target, ptr.target);
+  EXPECT_FALSE(out.records[0].unique);
+  EXPECT_EQ(out.records[1].port, 8080);
+  EXPECT_EQ(out.records[1].target, "laptop.local");
+  EXPECT_TRUE(out.records[1].unique);
+  EXPECT_EQ(out.records[1].ttl, 120u);
+  // Empty strings carry nothing, and are dropped.
+  EXPECT_EQ(out.records[2].txt, (std::vector<std::string>{"a=1", "b=2"}));
+  EXPECT_EQ(out.records[3].ipv4, 0xc0a80105u);
+}
+
+TEST(MdnsTest, RefusesLabelsItCantWrite) {
+  EXPECT_TRUE(EncodeMdns(Ask("a..local", kMdnsA)).empty());
+  EXPECT_TRUE(EncodeMdns(Ask(std::string(64, 'a') + ".local", kMdnsA))
+                  .empty());
+}
+
+// A PTR answer as responders send it, its target pointing back into its
+// own name, after a record of a type we skip.
+TEST(MdnsTest, ReadsCompressedNames) {
+  std::vector<uint8_t> wire = {0, 0, 0x84, 0, 0, 0, 0, 2, 0, 0, 0, 0};
+  const uint8_t name[] = "\x09_zapshare\x04_tcp\x05local";
+  wire.insert(wire.end(), name, name + sizeof(name));  // With its 0.
+  // AAAA, skipped.
+  wire.insert(wire.end(), {0, 28, 0, 1, 0, 0, 0, 120, 0, 16});
+  wire.insert(wire.end(), 16, 0xfe);
+  wire.insert(wire.end(), {0xc0, 12, 0, 12, 0, 1, 0, 0, 0x11, 0x94, 0, 8});
+  wire.insert(wire.end(), {5, 'P', 'h', 'o', 'n', 'e', 0xc0, 12});
+
+  MdnsMessage out;
+  ASSERT_TRUE(ParseMdns(wire.data(), wire.size(), &out));
+  ASSERT_EQ(out.records.size(), 1u);
+  EXPECT_EQ(out.records[0].name, "_zapshare._tcp.local");
+  EXPECT_EQ(out.records[0].ttl, 4500u);
+  EXPECT_EQ(out.records[0].target, "Phone._zapshare._tcp.local");
+}
+
+TEST(MdnsTest, RejectsLoopsAndTruncation) {
+  std::vector<uint8_t> wire = {0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+  wire.insert(wire.end(), {0xc0, 12, 0, 12, 0, 1});  // Points at itself.
+  MdnsMessage out;
+  EXPECT_FALSE(ParseMdns(wire.data(), wire.size(), &out));
+
+  const std::vector<uint8_t> ok = EncodeMdns(Ask(kMdnsServiceType, 12));
+  for (size_t len = 0; len < ok.size(); len++) {
+    EXPECT_FALSE(ParseMdns(ok.data(), len, &out)) << len;
+  }
+  EXPECT_TRUE(ParseMdns(ok.data(), ok.size(), &out));
+}
+
+TEST(MdnsTest, AnswersABrowseWithEverythingItLeadsTo) {
+  MdnsMessage answer;
+  ASSERT_TRUE(AnswerMdns(Ask("_ZapShare._tcp.local", kMdnsPtr),
+                         MakeService(), false, &answer));
+  EXPECT_TRUE(answer.response);
+  EXPECT_EQ(answer.id, 0);
+  EXPECT_TRUE(answer.questions.empty());
+  ASSERT_EQ(answer.records.size(), 5u);
+  EXPECT_EQ(answer.records[0].type, kMdnsPtr);
+  EXPECT_EQ(answer.records[0].target,
+            "Pixel 8 (3fa2)._zapshare._tcp.local");
+  EXPECT_FALSE(answer.records[0].unique);  // Shared: many answer it.
+  EXPECT_EQ(answer.records[1].type, kMdnsSrv);
+  EXPECT_EQ(answer.records[1].port, 8080);
+  EXPECT_TRUE(answer.records[1].unique);
+  EXPECT_EQ(Count(answer, kMdnsTxt), 1u);
+  EXPECT_EQ(Count(answer, kMdnsA), 2u);
+  EXPECT_FALSE(EncodeMdns(answer).empty());
+}
+
+TEST(MdnsTest, AnswersByName) {
+  const MdnsService service = MakeService();
+  MdnsMessage answer;
+  ASSERT_TRUE(AnswerMdns(Ask(kMdnsServiceEnumeration, kMdnsPtr), service,
+                         false, &answer));
+  ASSERT_EQ(answer.records.size(), 1u);
+  EXPECT_EQ(answer.records[0].target, kMdnsServiceType);
+
+  ASSERT_TRUE(AnswerMdns(
+      Ask("Pixel 8 (3fa2)._zapshare._tcp.local", kMdnsTxt), service, false,
+      &answer));
+  ASSERT_EQ(answer.records.size(), 1u);
+  EXPECT_EQ(answer.records[0].txt, service.txt);
+
+  ASSERT_TRUE(AnswerMdns(Ask(service.host, kMdnsAny), service, false,
+                         &answer));
+  EXPECT_EQ(Count(answer, kMdnsA), 2u);
+  EXPECT_EQ(answer.records.size(), 2u);
+}
+
+TEST(MdnsTest, LegacyQueriesGetTheirIdAndQuestionsBack) {
+  MdnsMessage answer;
+  ASSERT_TRUE(AnswerMdns(Ask(kMdnsServiceType, kMdnsPtr), MakeService(),
+                         true, &answer));
+  EXPECT_EQ(answer.id, 0x1234);
+  ASSERT_EQ(answer.questions.size(), 1u);
+  EXPECT_EQ(answer.questions[0].name, kMdnsServiceType);
+  for (const MdnsRecord& r : answer.records) {
+    EXPECT_FALSE(r.unique);
+    EXPECT_EQ(r.ttl, 10u);
+  }
+}
+
+TEST(MdnsTest, IgnoresWhatIsNotOurs) {
+  MdnsMessage answer;
+  EXPECT_FALSE(AnswerMdns(Ask("_airplay._tcp.local", kMdnsPtr),
+                          MakeService(), false, &answer));
+  EXPECT_FALSE(AnswerMdns(Ask(kMdnsServiceType, kMdnsA), MakeService(),
+                          false, &answer));
+  EXPECT_FALSE(AnswerMdns(Ask("Other._zapshare._tcp.local", kMdnsSrv),
+                          MakeService(), false, &answer));
+  MdnsMessage response = Ask(kMdnsServiceType, kMdnsPtr);
+  response.response = true;
+  EXPECT_FALSE(AnswerMdns(response, MakeService(), false, &answer));
+}
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,326 @@
+#include "mirror_receiver.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if __has_include(<jpeglib.h>)
+#include <jpeglib.h>
+#define ZS_TEST_HAVE_JPEG 1
+#endif
+
+namespace zapshare {
+namespace {
+
+#if defined(ZS_TEST_HAVE_JPEG)
+
+using Bytes = std::vector<uint8_t>;
+
+bool WaitFor(const std::function<bool()>& done) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return true;
+}
+
+// A |width| x |height| JPEG filled with one color.
+Bytes Jpeg(int width, int height, uint8_t r, uint8_t g, uint8_t b) {
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr error;
+  cinfo.err = jpeg_std_error(&error);
+  jpeg_create_compress(&cinfo);
+  unsigned char* out = nullptr;
+  unsigned long size = 0;
+  jpeg_mem_dest(&cinfo, &out, &size);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 90, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  Bytes row(static_cast<size_t>(width) * 3);
+  for (int x = 0; x < width; x++) {
+    row[x * 3] = r;
+    row[x * 3 + 1] = g;
+    row[x * 3 + 2] = b;
+  }
+  JSAMPROW rows[1] = {row.data()};
+  while (cinfo.next_scanline < cinfo.image_height) {
+    jpeg_write_scanlines(&cinfo, rows, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  Bytes jpeg(out, out + size);
+  std::free(out);
+  return jpeg;
+}
+
+void AppendPart(Bytes* out, const Bytes& jpeg) {
+  const std::string header =
+      "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " +
+      std::to_string(jpeg.size()) + "\r\n\r\n";
+  out->insert(out->end(), header.begin(), header.end());
+  out->insert(out->end(), jpeg.begin(), jpeg.end());
+  out->push_back('\r');
+  out->push_back('\n');
+}
+
+bool Near(uint8_t a, uint8_t b) { return a > b ? a - b <= 8 : b - a <= 8; }
+
+constexpr std::chrono::milliseconds kTick(10);
+
+// Holds the decoder thread inside the frame callback until Release().
+class Gate {
+ public:
+  static void Callback(void* user_data) {
+    Gate* gate = static_cast<Gate*>(user_data);
+    std::unique_lock<std::mutex> lock(gate->mu_);
+    gate->entered_ = true;
+    gate->cv_.notify_all();
+    while (!gate->open_) gate->cv_.wait_for(lock, kTick);
+  }
+
+  void WaitEntered() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (!entered_) cv_.wait_for(lock, kTick);
+  }
+
+  void Release() {
+    std::lock_guard<std::mutex> lock(mu_);
+    open_ = true;
+    cv_.notify_all();
+  }
+
+ private:
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool entered_ = false;
+  bool open_ = false;
+};
+
+TEST(MirrorReceiverTest, DecodesToRgba) {
+  ASSERT_TRUE(MirrorReceiver::Available());
+  MirrorReceiver receiver;
+  EXPECT_EQ(receiver.AcquireFrame(), nullptr);
+  const Bytes jpeg = Jpeg(64, 48, 200, 40, 90);
+  receiver.Submit(jpeg.data(), jpeg.size());
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 1; }));
+  const MirrorPicture* picture = receiver.AcquireFrame();
+  ASSERT_NE(picture, nullptr);
+  EXPECT_EQ(picture->width, 64);
+  EXPECT_EQ(picture->height, 48);
+  ASSERT_EQ(picture->pixels.size(), 64u * 48u * 4u);
+  for (size_t i = 0; i < picture->pixels.size(); i += 4) {
+    ASSERT_TRUE(Near(picture->pixels[i], 200) &&
+                Near(picture->pixels[i + 1], 40) &&
+                Near(picture->pixels[i + 2], 90) &&
+                picture->pixels[i + 3] == 0xFF)
+        << i;
+  }
+  // Nothing newer: the same frame again.
+  EXPECT_EQ(receiver.AcquireFrame(), picture);
+  EXPECT_EQ(receiver.stats().presented, 1u);
+}
+
+TEST(MirrorReceiverTest, ScalesDownToTheTargetSize) {
+  const Bytes jpeg = Jpeg(640, 480, 10, 200, 30);
+  struct Case {
+    int target_width;
+    int target_height;
+    int width;
+    int height;
+  };
+  // Letterboxed: the side that fits first decides; never below the
+  // target, never above the frame.
+  for (const Case& c : {Case{0, 0, 640, 480}, Case{160, 120, 160, 120},
+                        Case{200, 100, 160, 120}, Case{300, 1000, 320, 240},
+                        Case{161, 121, 240, 180}, Case{4000, 3000, 640, 480},
+                        Case{10, 10, 80, 60}}) {
+    SCOPED_TRACE(std::to_string(c.target_width) + "x" +
+                 std::to_string(c.target_height));
+    MirrorReceiver receiver;
+    receiver.SetTargetSize(c.target_width, c.target_height);
+    receiver.Submit(jpeg.data(), jpeg.size());
+    ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 1; }));
+    const MirrorPicture* picture = receiver.AcquireFrame();
+    ASSERT_NE(picture, nullptr);
+    EXPECT_EQ(picture->width, c.width);
+    EXPECT_EQ(picture->height, c.height);
+    EXPECT_EQ(receiver.stats().width, static_cast<uint64_t>(c.width));
+  }
+}
+
+TEST(MirrorReceiverTest, DropsFramesThatWaitBehindANewerOne) {
+  Gate gate;
+  MirrorReceiver receiver;
+  receiver.SetFrameCallback(&Gate::Callback, &gate);
+  const Bytes first = Jpeg(32, 32, 255, 0, 0);
+  receiver.Submit(first.data(), first.size());
+  gate.WaitEntered();
+  // The decoder thread is held: each of these replaces the one before.
+  for (uint8_t i = 1; i <= 4; i++) {
+    const Bytes jpeg = Jpeg(32, 32, 0, i * 50, 0);
+    receiver.Submit(jpeg.data(), jpeg.size());
+  }
+  const Bytes last = Jpeg(32, 32, 0, 0, 255);
+  receiver.Submit(last.data(), last.size());
+  // The first is decoded; only the newest waits.
+  EXPECT_EQ(receiver.stats().queue_depth, 1u);
+  gate.Release();
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 2; }));
+  const MirrorStats stats = receiver.stats();
+  EXPECT_EQ(stats.received, 6u);
+  EXPECT_EQ(stats.dropped, 4u);
+  EXPECT_EQ(stats.queue_depth, 0u);
+  EXPECT_EQ(stats.max_queue_depth, 1u);
+  // The first was never acquired before the last replaced it.
+  EXPECT_EQ(stats.unshown, 1u);
+  EXPECT_GT(stats.decode_ns, 0u);
+  EXPECT_GE(stats.max_decode_ns, stats.last_decode_ns);
+  const MirrorPicture* picture = receiver.AcquireFrame();
+  ASSERT_NE(picture, nullptr);
+  EXPECT_TRUE(Near(picture->pixels[2], 255));
+  receiver.SetFrameCallback(nullptr, nullptr);
+}
+
+TEST(MirrorReceiverTest, FeedQueuesOnlyTheNewestFrameOfAChunk) {
+  MirrorReceiver receiver("frame");
+  Bytes stream;
+  for (uint8_t i = 0; i < 3; i++) AppendPart(&stream, Jpeg(16, 16, i, 0, 0));
+  AppendPart(&stream, Jpeg(16, 16, 0, 250, 0));
+  // One chunk with all four, then half of a fifth.
+  const Bytes tail = Jpeg(16, 16, 0, 0, 250);
+  AppendPart(&stream, tail);
+  const size_t cut = stream.size() - tail.size() / 2;
+  receiver.Feed(stream.data(), cut);
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 1; }));
+  MirrorStats stats = receiver.stats();
+  EXPECT_EQ(stats.received, 4u);
+  EXPECT_EQ(stats.dropped, 3u);
+  const MirrorPicture* picture = receiver.AcquireFrame();
+  ASSERT_NE(picture, nullptr);
+  EXPECT_TRUE(Near(picture->pixels[1], 250));
+  receiver.Feed(stream.data() + cut, stream.size() - cut);
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 2; }));
+  picture = receiver.AcquireFrame();
+  EXPECT_TRUE(Near(picture->pixels[2], 250));
+}
+
+TEST(MirrorReceiverTest, KeepsTheLastGoodFrameOverACorruptOne) {
+  MirrorReceiver receiver;
+  const Bytes good = Jpeg(32, 16, 0, 0, 200);
+  receiver.Submit(good.data(), good.size());
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 1; }));
+  const Bytes junk = {0xFF, 0xD8, 0xFF, 0xD9};
+  receiver.Submit(junk.data(), junk.size());
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().failed == 1; }));
+  const MirrorPicture* picture = receiver.AcquireFrame();
+  ASSERT_NE(picture, nullptr);
+  EXPECT_EQ(picture->width, 32);
+  // The decoder recovers for the next frame.
+  const Bytes next = Jpeg(8, 8, 1, 2, 3);
+  receiver.Submit(next.data(), next.size());
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 2; }));
+  EXPECT_EQ(receiver.AcquireFrame()->width, 8);
+}
+
+TEST(MirrorReceiverTest, ComposesATileStream) {
+  Bytes screen(128 * 64 * 4);
+  for (size_t i = 0; i < screen.size(); i += 4) {
+    screen[i] = 0x10;  // BGRX.
+    screen[i + 1] = 0x80;
+    screen[i + 2] = 0xF0;
+  }
+  ScreenFrame frame;
+  frame.pixels = screen.data();
+  frame.width = 128;
+  frame.height = 64;
+  frame.stride = 128 * 4;
+  TileDiffer differ;
+  TileEncoder encoder;
+  differ.Diff(frame);
+  Bytes stream = encoder.header();
+  WriteTileFrame(*encoder.Update(frame, differ), 0, &stream);
+
+  MirrorReceiver receiver;
+  receiver.Feed(stream.data(), 3);  // Too little to tell it from MJPEG.
+  receiver.Feed(stream.data() + 3, stream.size() - 3);
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 1; }));
+  const MirrorPicture* picture = receiver.AcquireFrame();
+  ASSERT_NE(picture, nullptr);
+  ASSERT_EQ(picture->width, 128);
+  ASSERT_EQ(picture->height, 64);
+  EXPECT_EQ(picture->pixels[0], 0xF0);
+  EXPECT_EQ(picture->pixels[1], 0x80);
+  EXPECT_EQ(picture->pixels[2], 0x10);
+  EXPECT_EQ(picture->pixels[3], 0xFF);
+
+  // Sequence 3 built on 2, which never arrived: dropped.
+  screen[0] = 0;
+  differ.Diff(frame);
+  encoder.Update(frame, differ);
+  screen[70 * 4] = 0;
+  differ.Diff(frame);
+  auto third = encoder.Update(frame, differ);
+  Bytes lost;
+  WriteTileFrame(*third, 2, &lost);
+  receiver.Feed(lost.data(), lost.size());
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().failed == 1; }));
+  Bytes keyframe;
+  WriteTileFrame(*third, 0, &keyframe);
+  receiver.Feed(keyframe.data(), keyframe.size());
+  ASSERT_TRUE(WaitFor([&] { return receiver.stats().decoded == 2; }));
+  picture = receiver.AcquireFrame();
+  EXPECT_EQ(picture->pixels[2], 0);
+  EXPECT_EQ(picture->pixels[70 * 4 + 2], 0);
+}
+
+void CountFrame(void* user_data) { (*static_cast<int*>(user_data))++; }
+
+TEST(MirrorReceiverTest, CApi) {
+  ASSERT_EQ(zs_mirror_receiver_available(), 1);
+  ZsMirrorReceiver* receiver = zs_mirror_receiver_new(nullptr);
+  ASSERT_NE(receiver, nullptr);
+  int frames = 0;
+  zs_mirror_receiver_set_frame_callback(receiver, &CountFrame, &frames);
+  zs_mirror_receiver_set_target_size(receiver, 40, 30);
+  Bytes stream;
+  AppendPart(&stream, Jpeg(160, 120, 9, 9, 9));
+  zs_mirror_receiver_feed(receiver, stream.data(), stream.size());
+  uint64_t stats[13];
+  ASSERT_TRUE(WaitFor([&] {
+    zs_mirror_receiver_stats(receiver, stats);
+    return stats[1] == 1;
+  }));
+  zs_mirror_receiver_set_frame_callback(receiver, nullptr, nullptr);
+  EXPECT_EQ(frames, 1);
+  EXPECT_EQ(stats[0], 1u);
+  EXPECT_EQ(stats[11], 40u);
+  EXPECT_EQ(stats[12], 30u);
+  // A second reference outlives the first.
+  zs_mirror_receiver_retain(receiver);
+  zs_mirror_receiver_free(receiver);
+  int32_t width = 0;
+  int32_t height = 0;
+  ASSERT_NE(zs_mirror_receiver_acquire(receiver, &width, &height), nullptr);
+  EXPECT_EQ(width, 40);
+  EXPECT_EQ(height, 30);
+  zs_mirror_receiver_free(receiver);
+}
+
+#endif  // defined(ZS_TEST_HAVE_JPEG)
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,302 @@
+#include "mirror_sender.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "mjpeg_demuxer.h"
+
+#if __has_include(<jpeglib.h>)
+#define ZS_TEST_HAVE_JPEG 1
+#endif
+
+namespace zapshare {
+namespace {
+
+#if !defined(_WIN32) && defined(ZS_TEST_HAVE_JPEG)
+
+using Bytes = std::vector<uint8_t>;
+
+bool WaitFor(const std::function<bool()>& done) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return true;
+}
+
+// A screen the test draws on, in place of a display.
+class FakeScreen : public ScreenSource {
+ public:
+  FakeScreen(int width, int height) : width_(width), height_(height) {
+    pixels_.assign(static_cast<size_t>(width) * height * 4, 0x40);
+  }
+
+  bool Grab(ScreenFrame* frame) override {
+    std::lock_guard<std::mutex> lock(mu_);
+    grabbed_ = pixels_;
+    frame->pixels = grabbed_.data();
+    frame->width = width_;
+    frame->height = height_;
+    frame->stride = static_cast<size_t>(width_) * 4;
+    return true;
+  }
+
+  // Paints a 16 x 16 white square at |x|, |y|.
+  void Touch(int x, int y) {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (int j = y; j < y + 16; j++) {
+      std::memset(&pixels_[(static_cast<size_t>(j) * width_ + x) * 4], 0xFF,
+                  16 * 4);
+    }
+  }
+
+ private:
+  const int width_;
+  const int height_;
+  std::mutex mu_;
+  Bytes pixels_;
+  Bytes grabbed_;  // Stays put until the next Grab(), like a real one.
+};
+
+// A client connected to |port| that has sent a GET for |path|, with
+// |headers| ("Name: value\r\n" each).
+int Get(uint16_t port, const std::string& path,
+        const std::string& headers = "") {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  const std::string request =
+      "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" + headers + "\r\n";
+  send(fd, request.data(), request.size(), 0);
+  timeval timeout = {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return fd;
+}
+
+// Reads the response to a GET /stream into |demuxer| until it has cut
+// |count| frames; returns the last of them.
+Bytes ReadFrames(int fd, MjpegDemuxer* demuxer, int count,
+                 std::string* head = nullptr) {
+  Bytes last;
+  std::string response;
+  bool in_body = head == nullptr;
+  uint8_t buffer[16 * 1024];
+  while (count > 0) {
+    const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) return Bytes();
+    size_t at = 0;
+    if (!in_body) {
+      response.append(reinterpret_cast<char*>(buffer), n);
+      const size_t end = response.find("\r\n\r\n");
+      if (end == std::string::npos) continue;
+      *head = response.substr(0, end);
+      at = n - (response.size() - end - 4);
+      in_body = true;
+    }
+    demuxer->Feed(buffer + at, n - at);
+    MjpegFrame frame;
+    while (count > 0 && demuxer->Next(&frame)) {
+      last.assign(frame.data, frame.data + frame.size);
+      count--;
+    }
+  }
+  return last;
+}
+
+// Reads a tile stream into |reader| until it has the next frame with
+// tiles; fills |head| with the response head first if given.
+bool ReadTileFrame(int fd, TileStreamReader* reader, TileFrame* frame,
+                   std::string* head = nullptr) {
+  std::string response;
+  bool in_body = head == nullptr;
+  uint8_t buffer[16 * 1024];
+  while (true) {
+    while (in_body && reader->Next(frame)) {
+      if (!frame->tiles.empty()) return true;
+    }
+    const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) return false;
+    size_t at = 0;
+    if (!in_body) {
+      response.append(reinterpret_cast<char*>(buffer), n);
+      const size_t end = response.find("\r\n\r\n");
+      if (end == std::string::npos) continue;
+      *head = response.substr(0, end);
+      at = n - (response.size() - end - 4);
+      in_body = true;
+    }
+    reader->Feed(buffer + at, n - at);
+  }
+}
+
+TEST(ScreenMirrorSenderTest, ServesTheScreenAsMjpeg) {
+  ScreenMirrorConfig config;
+  config.fps = 100;
+  auto sender = ScreenMirrorSender::Start(
+      std::make_unique<FakeScreen>(320, 200), config);
+  ASSERT_NE(sender, nullptr);
+  ASSERT_NE(sender->port(), 0);
+
+  const int fd = Get(sender->port(), "/stream");
+  ASSERT_GE(fd, 0);
+  MjpegDemuxer demuxer("frame");
+  std::string head;
+  const Bytes jpeg = ReadFrames(fd, &demuxer, 1, &head);
+  EXPECT_EQ(head.compare(0, 15, "HTTP/1.1 200 OK"), 0);
+  EXPECT_NE(head.find("multipart/x-mixed-replace; boundary=frame"),
+            std::string::npos);
+  ASSERT_GE(jpeg.size(), 4u);
+  EXPECT_EQ(jpeg[0], 0xFF);
+  EXPECT_EQ(jpeg[1], 0xD8);
+  EXPECT_EQ(demuxer.stats().by_length, 1u);
+  EXPECT_TRUE(WaitFor([&] { return sender->stats().frames_sent == 1; }));
+  EXPECT_EQ(sender->stats().clients, 1u);
+  close(fd);
+}
+
+TEST(ScreenMirrorSenderTest, StaticScreenIsNotEncodedAgain) {
+  ScreenMirrorConfig config;
+  config.fps = 100;
+  auto sender = ScreenMirrorSender::Start(
+      std::make_unique<FakeScreen>(320, 200), config);
+  ASSERT_NE(sender, nullptr);
+  const int fd = Get(sender->port(), "/stream");
+  MjpegDemuxer demuxer("frame");
+  std::string head;
+  ASSERT_FALSE(ReadFrames(fd, &demuxer, 1, &head).empty());
+
+  ASSERT_TRUE(WaitFor([&] { return sender->stats().captured >= 20; }));
+  const ScreenMirrorStats s = sender->stats();
+  EXPECT_EQ(s.encoded, 1u);
+  EXPECT_GE(s.unchanged, s.captured - 1);
+  EXPECT_EQ(s.frames_sent, 1u);
+  close(fd);
+}
+
+TEST(ScreenMirrorSenderTest, SendsChangesByEncodingOnlyTheirBands) {
+  ScreenMirrorConfig config;
+  config.fps = 100;
+  auto screen = std::make_unique<FakeScreen>(320, 256);
+  FakeScreen* raw = screen.get();
+  auto sender = ScreenMirrorSender::Start(std::move(screen), config);
+  ASSERT_NE(sender, nullptr);
+  const int fd = Get(sender->port(), "/stream");
+  MjpegDemuxer demuxer("frame");
+  std::string head;
+  const Bytes first = ReadFrames(fd, &demuxer, 1, &head);
+  ASSERT_FALSE(first.empty());
+
+  raw->Touch(10, 70);  // Band 1 of 4.
+  const Bytes second = ReadFrames(fd, &demuxer, 1);
+  ASSERT_FALSE(second.empty());
+  EXPECT_NE(first, second);
+  const ScreenMirrorStats s = sender->stats();
+  EXPECT_EQ(s.encoded, 2u);
+  EXPECT_EQ(s.bands_encoded, 4u + 1u);
+  EXPECT_EQ(s.bands_reused, 3u);
+  close(fd);
+}
+
+TEST(ScreenMirrorSenderTest, ServesTilesToViewersThatAskForThem) {
+  ScreenMirrorConfig config;
+  config.fps = 100;
+  auto screen = std::make_unique<FakeScreen>(320, 256);
+  FakeScreen* raw = screen.get();
+  auto sender = ScreenMirrorSender::Start(std::move(screen), config);
+  ASSERT_NE(sender, nullptr);
+  const int fd = Get(sender->port(), "/stream",
+                     std::string("x-zapshare-mirror: mjpeg, ") +
+                         kTileStreamVersion + "\r\n");
+  TileStreamReader reader;
+  TileFrame frame;
+  std::string head;
+  ASSERT_TRUE(ReadTileFrame(fd, &reader, &frame, &head));
+  EXPECT_NE(head.find(kTileStreamContentType), std::string::npos);
+  EXPECT_FALSE(reader.tables().empty());
+  EXPECT_EQ(frame.base, 0u);
+  EXPECT_EQ(frame.width, 320);
+  EXPECT_EQ(frame.tiles.size(), 5u * 4u);
+  const uint32_t first = frame.sequence;
+
+  // An MJPEG viewer alongside is served as before.
+  const int mjpeg = Get(sender->port(), "/stream");
+  MjpegDemuxer demuxer("frame");
+  std::string mjpeg_head;
+  ASSERT_FALSE(ReadFrames(mjpeg, &demuxer, 1, &mjpeg_head).empty());
+  EXPECT_NE(mjpeg_head.find("boundary=frame"), std::string::npos);
+  EXPECT_TRUE(WaitFor([&] { return sender->stats().clients == 2; }));
+
+  // Starting the MJPEG encoder sent the tiles whole again.
+  ASSERT_TRUE(ReadTileFrame(fd, &reader, &frame));
+  EXPECT_EQ(frame.tiles.size(), 5u * 4u);
+  EXPECT_EQ(frame.base, first);
+  const uint32_t second = frame.sequence;
+
+  raw->Touch(10, 70);  // Tile (0, 1).
+  ASSERT_TRUE(ReadTileFrame(fd, &reader, &frame));
+  EXPECT_EQ(frame.base, second);
+  ASSERT_EQ(frame.tiles.size(), 1u);
+  EXPECT_EQ(frame.tiles[0].column, 0);
+  EXPECT_EQ(frame.tiles[0].row, 1);
+  close(mjpeg);
+  close(fd);
+}
+
+TEST(ScreenMirrorSenderTest, IdlesWithoutViewersAndRejectsOtherPaths) {
+  ScreenMirrorConfig config;
+  config.fps = 100;
+  auto sender = ScreenMirrorSender::Start(
+      std::make_unique<FakeScreen>(64, 64), config);
+  ASSERT_NE(sender, nullptr);
+
+  const int fd = Get(sender->port(), "/audio");
+  char buffer[256] = {};
+  ASSERT_GT(recv(fd, buffer, sizeof(buffer) - 1, 0), 0);
+  EXPECT_EQ(std::strncmp(buffer, "HTTP/1.1 404", 12), 0);
+  close(fd);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(sender->stats().captured, 0u);
+}
+
+TEST(ScreenMirrorSenderTest, StopDisconnectsViewers) {
+  ScreenMirrorConfig config;
+  auto sender = ScreenMirrorSender::Start(
+      std::make_unique<FakeScreen>(64, 64), config);
+  ASSERT_NE(sender, nullptr);
+  const int fd = Get(sender->port(), "/stream");
+  MjpegDemuxer demuxer("frame");
+  std::string head;
+  ASSERT_FALSE(ReadFrames(fd, &demuxer, 1, &head).empty());
+  sender.reset();
+  uint8_t buffer[64];
+  EXPECT_LE(recv(fd, buffer, sizeof(buffer), 0), 0);
+  close(fd);
+}
+
+#endif  // !defined(_WIN32) && defined(ZS_TEST_HAVE_JPEG)
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,202 @@
+#include "mjpeg_demuxer.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace zapshare {
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+// SOI, |size| bytes of scan data with no markers in it, EOI.
+Bytes Jpeg(size_t size, uint8_t seed) {
+  Bytes jpeg = {0xFF, 0xD8};
+  for (size_t i = 0; i < size; i++) {
+    jpeg.push_back(static_cast<uint8_t>((i * 131 + seed) % 0xFF));
+  }
+  jpeg.push_back(0xFF);
+  jpeg.push_back(0xD9);
+  return jpeg;
+}
+
+void Append(Bytes* out, const std::string& s) {
+  out->insert(out->end(), s.begin(), s.end());
+}
+
+// A part as the mirror server writes it.
+void AppendPart(Bytes* out, const Bytes& body, bool with_length,
+                const std::string& boundary = "frame",
+                const std::string& type = "image/jpeg") {
+  Append(out, "--" + boundary + "\r\nContent-Type: " + type + "\r\n");
+  if (with_length) {
+    Append(out, "Content-Length: " + std::to_string(body.size()) + "\r\n");
+  }
+  Append(out, "\r\n");
+  out->insert(out->end(), body.begin(), body.end());
+  Append(out, "\r\n");
+}
+
+// Feeds |stream| |chunk| bytes at a time, copying every frame out.
+std::vector<Bytes> Split(MjpegDemuxer* demuxer, const Bytes& stream,
+                         size_t chunk) {
+  std::vector<Bytes> frames;
+  for (size_t at = 0; at < stream.size(); at += chunk) {
+    demuxer->Feed(stream.data() + at, std::min(chunk, stream.size() - at));
+    MjpegFrame frame;
+    while (demuxer->Next(&frame)) {
+      frames.emplace_back(frame.data, frame.data + frame.size);
+    }
+  }
+  return frames;
+}
+
+TEST(MjpegDemuxerTest, CutsPartsByContentLength) {
+  std::vector<Bytes> jpegs;
+  Bytes stream;
+  for (uint8_t i = 0; i < 5; i++) {
+    jpegs.push_back(Jpeg(1000 + i * 777, i));
+    AppendPart(&stream, jpegs.back(), true);
+  }
+  for (const size_t chunk : {size_t{1}, size_t{7}, size_t{1000},
+                             stream.size()}) {
+    SCOPED_TRACE(chunk);
+    MjpegDemuxer demuxer;
+    EXPECT_EQ(Split(&demuxer, stream, chunk), jpegs);
+    EXPECT_EQ(demuxer.stats().by_length, 5u);
+    EXPECT_EQ(demuxer.stats().bytes, stream.size());
+  }
+}
+
+TEST(MjpegDemuxerTest, CutsPartsWithoutLengthAtTheBoundary) {
+  // An EOI inside, as an embedded thumbnail has, doesn't end the frame.
+  Bytes with_thumbnail = Jpeg(500, 1);
+  const Bytes thumbnail = Jpeg(50, 2);
+  with_thumbnail.insert(with_thumbnail.begin() + 100, thumbnail.begin(),
+                        thumbnail.end());
+  const std::vector<Bytes> jpegs = {with_thumbnail, Jpeg(3000, 3)};
+  Bytes stream;
+  for (const Bytes& jpeg : jpegs) {
+    AppendPart(&stream, jpeg, false, "my-boundary_01");
+  }
+  Append(&stream, "--my-boundary_01--\r\n");
+  for (const std::string boundary : {"", "my-boundary_01"}) {
+    for (const size_t chunk : {size_t{3}, size_t{512}}) {
+      MjpegDemuxer demuxer(boundary);
+      EXPECT_EQ(Split(&demuxer, stream, chunk), jpegs);
+      EXPECT_EQ(demuxer.stats().by_marker, 2u);
+      EXPECT_EQ(demuxer.buffered(), 0u);
+    }
+  }
+}
+
+TEST(MjpegDemuxerTest, FallsBackToMarkers) {
+  const std::vector<Bytes> jpegs = {Jpeg(700, 4), Jpeg(10, 5),
+                                    Jpeg(4000, 6)};
+  Bytes stream;
+  for (const Bytes& jpeg : jpegs) {
+    Append(&stream, "junk\r\n");
+    stream.insert(stream.end(), jpeg.begin(), jpeg.end());
+  }
+  for (const size_t chunk : {size_t{1}, size_t{64}, stream.size()}) {
+    MjpegDemuxer demuxer;
+    EXPECT_EQ(Split(&demuxer, stream, chunk), jpegs);
+    EXPECT_EQ(demuxer.stats().by_marker, 3u);
+  }
+}
+
+TEST(MjpegDemuxerTest, SkipsPartsThatAreNotJpeg) {
+  Bytes stream;
+  const Bytes text = {'h', 'e', 'l', 'l', 'o'};
+  const Bytes jpeg = Jpeg(100, 7);
+  AppendPart(&stream, text, true, "frame", "text/plain");
+  // Garbage between parts, and a part that lies about its length.
+  Append(&stream, "xx");
+  AppendPart(&stream, jpeg, false);
+  Append(&stream, "--frame\r\nContent-Length: 99999999999\r\n\r\n");
+  stream.insert(stream.end(), jpeg.begin(), jpeg.end());
+  Append(&stream, "\r\n");
+  AppendPart(&stream, jpeg, true);
+  MjpegDemuxer demuxer("frame");
+  EXPECT_EQ(Split(&demuxer, stream, 16),
+            (std::vector<Bytes>{jpeg, jpeg, jpeg}));
+  EXPECT_EQ(demuxer.stats().skipped, 1u);
+}
+
+TEST(MjpegDemuxerTest, FramesStayPutUntilTheNextFeed) {
+  std::vector<Bytes> jpegs;
+  Bytes stream;
+  for (uint8_t i = 0; i < 4; i++) {
+    jpegs.push_back(Jpeg(200, i));
+    AppendPart(&stream, jpegs.back(), true);
+  }
+  MjpegDemuxer demuxer;
+  demuxer.Feed(stream.data(), stream.size());
+  std::vector<MjpegFrame> frames;
+  MjpegFrame frame;
+  while (demuxer.Next(&frame)) frames.push_back(frame);
+  ASSERT_EQ(frames.size(), 4u);
+  for (size_t i = 0; i < frames.size(); i++) {
+    EXPECT_EQ(Bytes(frames[i].data, frames[i].data + frames[i].size),
+              jpegs[i]);
+  }
+}
+
+TEST(MjpegDemuxerTest, SteadyStreamStopsAllocating) {
+  Bytes stream;
+  for (uint8_t i = 0; i < 200; i++) {
+    AppendPart(&stream, Jpeg(30000 + (i % 7) * 1000, i), true);
+  }
+  MjpegDemuxer demuxer;
+  const size_t half = stream.size() / 2;
+  const Bytes first(stream.begin(), stream.begin() + half);
+  const Bytes second(stream.begin() + half, stream.end());
+  Split(&demuxer, first, 16384);
+  const uint64_t allocations = demuxer.stats().allocations;
+  EXPECT_LE(allocations, 4u);
+  Split(&demuxer, second, 16384);
+  EXPECT_EQ(demuxer.stats().allocations, allocations);
+  EXPECT_EQ(demuxer.stats().frames, 200u);
+}
+
+TEST(MjpegDemuxerTest, DropsWhatOutgrowsTheBuffer) {
+  MjpegDemuxer demuxer("frame", 64 * 1024);
+  Bytes stream;
+  // A part with no end in sight, then good ones.
+  Append(&stream, "--frame\r\n\r\n");
+  const Bytes endless = Jpeg(100 * 1024, 8);
+  stream.insert(stream.end(), endless.begin(), endless.end() - 2);
+  const Bytes jpeg = Jpeg(1000, 9);
+  for (int i = 0; i < 3; i++) AppendPart(&stream, jpeg, true);
+  const std::vector<Bytes> frames = Split(&demuxer, stream, 4096);
+  EXPECT_GE(demuxer.stats().resyncs, 1u);
+  ASSERT_GE(frames.size(), 2u);
+  for (const Bytes& frame : frames) EXPECT_EQ(frame, jpeg);
+}
+
+TEST(MjpegDemuxerTest, CApi) {
+  Bytes stream;
+  const Bytes jpeg = Jpeg(64, 10);
+  AppendPart(&stream, jpeg, true);
+  AppendPart(&stream, jpeg, true);
+  ZsMjpegDemuxer* demuxer = zs_mjpeg_demuxer_new(nullptr);
+  zs_mjpeg_demuxer_feed(demuxer, stream.data(), stream.size());
+  size_t size = 0;
+  for (int i = 0; i < 2; i++) {
+    const uint8_t* data = zs_mjpeg_demuxer_next(demuxer, &size);
+    ASSERT_NE(data, nullptr);
+    EXPECT_EQ(Bytes(data, data + size), jpeg);
+  }
+  EXPECT_EQ(zs_mjpeg_demuxer_next(demuxer, &size), nullptr);
+  uint64_t stats[8];
+  zs_mjpeg_demuxer_stats(demuxer, stats);
+  EXPECT_EQ(stats[0], 2u);
+  EXPECT_EQ(stats[1], 2u);
+  EXPECT_EQ(stats[3], stream.size());
+  zs_mjpeg_demuxer_free(demuxer);
+}
+
+}  // namespace
+}  // namespace zapshare
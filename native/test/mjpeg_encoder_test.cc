@@ -0,0 +1,203 @@
+#include "mjpeg_encoder.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#if __has_include(<jpeglib.h>)
+#include <jpeglib.h>
+#define ZS_TEST_HAVE_JPEG 1
+#endif
+
+namespace zapshare {
+namespace {
+
+#if defined(ZS_TEST_HAVE_JPEG)
+
+using Bytes = std::vector<uint8_t>;
+
+// A smooth BGRX gradient, which survives JPEG nearly unchanged.
+struct Screen {
+  Bytes pixels;
+  int width;
+  int height;
+
+  Screen(int w, int h) : width(w), height(h) {
+    pixels.assign(static_cast<size_t>(w) * h * 4, 0);
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        uint8_t* p = At(x, y);
+        p[0] = static_cast<uint8_t>(x * 255 / w);  // Blue.
+        p[1] = static_cast<uint8_t>(y * 255 / h);  // Green.
+        p[2] = 128;                                // Red.
+      }
+    }
+  }
+
+  uint8_t* At(int x, int y) {
+    return &pixels[(static_cast<size_t>(y) * width + x) * 4];
+  }
+
+  // Fills a |size| square at |x|, |y| with one color.
+  void Fill(int x, int y, int size, uint8_t b, uint8_t g, uint8_t r) {
+    for (int j = y; j < y + size; j++) {
+      for (int i = x; i < x + size; i++) {
+        uint8_t* p = At(i, j);
+        p[0] = b;
+        p[1] = g;
+        p[2] = r;
+      }
+    }
+  }
+
+  ScreenFrame Frame() const {
+    ScreenFrame frame;
+    frame.pixels = pixels.data();
+    frame.width = width;
+    frame.height = height;
+    frame.stride = static_cast<size_t>(width) * 4;
+    return frame;
+  }
+};
+
+// Decodes |jpeg| to RGB with a stock libjpeg; false if it isn't valid.
+bool Decode(const Bytes& jpeg, int* width, int* height, Bytes* rgb) {
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr error;
+  cinfo.err = jpeg_std_error(&error);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, const_cast<unsigned char*>(jpeg.data()),
+               static_cast<unsigned long>(jpeg.size()));
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_RGB;
+  jpeg_start_decompress(&cinfo);
+  *width = cinfo.output_width;
+  *height = cinfo.output_height;
+  rgb->resize(static_cast<size_t>(*width) * *height * 3);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = &(*rgb)[static_cast<size_t>(cinfo.output_scanline) *
+                           *width * 3];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  // Any warning here is a restart marker out of sequence or a short scan.
+  const long warnings = error.num_warnings;
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return warnings == 0;
+}
+
+bool Near(uint8_t a, uint8_t b) { return a > b ? a - b <= 12 : b - a <= 12; }
+
+// Whether |rgb| shows |screen|, give or take the compression.
+void ExpectShows(const Bytes& rgb, Screen& screen) {
+  for (int y = 0; y < screen.height; y += 7) {
+    for (int x = 0; x < screen.width; x += 5) {
+      const uint8_t* p = screen.At(x, y);
+      const uint8_t* q = &rgb[(static_cast<size_t>(y) * screen.width + x) * 3];
+      ASSERT_TRUE(Near(q[0], p[2]) && Near(q[1], p[1]) && Near(q[2], p[0]))
+          << "at " << x << ", " << y;
+    }
+  }
+}
+
+TEST(MjpegEncoderTest, FrameIsAPlainJpeg) {
+  ASSERT_TRUE(MjpegEncoder::Available());
+  // Neither side a multiple of a tile or an MCU.
+  Screen screen(300, 211);
+  TileDiffer differ;
+  differ.Diff(screen.Frame());
+  MjpegEncoder encoder(90, 1);
+  Bytes jpeg;
+  ASSERT_TRUE(encoder.Encode(screen.Frame(), differ, &jpeg));
+
+  int width = 0;
+  int height = 0;
+  Bytes rgb;
+  ASSERT_TRUE(Decode(jpeg, &width, &height, &rgb));
+  EXPECT_EQ(width, 300);
+  EXPECT_EQ(height, 211);
+  ExpectShows(rgb, screen);
+  EXPECT_EQ(encoder.stats().bands_encoded, 4u);
+  EXPECT_EQ(encoder.stats().last_bytes, jpeg.size());
+}
+
+TEST(MjpegEncoderTest, ReusedBandsMatchAWholeEncode) {
+  Screen screen(320, 300);
+  TileDiffer differ;
+  MjpegEncoder encoder(80, 1);
+  Bytes first;
+  differ.Diff(screen.Frame());
+  ASSERT_TRUE(encoder.Encode(screen.Frame(), differ, &first));
+
+  screen.Fill(100, 140, 20, 0, 0, 255);  // Band 2 only.
+  ASSERT_EQ(differ.Diff(screen.Frame()), 1u);
+  Bytes second;
+  ASSERT_TRUE(encoder.Encode(screen.Frame(), differ, &second));
+  EXPECT_EQ(encoder.stats().bands_encoded, 5u + 1u);
+  EXPECT_EQ(encoder.stats().bands_reused, 4u);
+
+  // Byte for byte what encoding the new frame from scratch gives.
+  TileDiffer fresh_differ;
+  fresh_differ.Diff(screen.Frame());
+  MjpegEncoder fresh(80, 1);
+  Bytes whole;
+  ASSERT_TRUE(fresh.Encode(screen.Frame(), fresh_differ, &whole));
+  EXPECT_EQ(second, whole);
+  EXPECT_NE(second, first);
+
+  int width = 0;
+  int height = 0;
+  Bytes rgb;
+  ASSERT_TRUE(Decode(second, &width, &height, &rgb));
+  const uint8_t* red = &rgb[(static_cast<size_t>(150) * 320 + 110) * 3];
+  EXPECT_TRUE(Near(red[0], 255) && Near(red[1], 0) && Near(red[2], 0));
+}
+
+TEST(MjpegEncoderTest, ThreadsProduceTheSameFrame) {
+  Screen screen(640, 1000);
+  TileDiffer differ;
+  differ.Diff(screen.Frame());
+  MjpegEncoder single(70, 1);
+  MjpegEncoder pool(70, 4);
+  Bytes a;
+  Bytes b;
+  ASSERT_TRUE(single.Encode(screen.Frame(), differ, &a));
+  ASSERT_TRUE(pool.Encode(screen.Frame(), differ, &b));
+  EXPECT_EQ(a, b);
+
+  // Every other band changes; the pool still agrees.
+  for (int y = 0; y < 1000; y += 128) screen.Fill(10, y, 30, 255, 0, 0);
+  differ.Diff(screen.Frame());
+  ASSERT_TRUE(single.Encode(screen.Frame(), differ, &a));
+  ASSERT_TRUE(pool.Encode(screen.Frame(), differ, &b));
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(pool.stats().bands_reused, 8u);
+}
+
+TEST(MjpegEncoderTest, SizeChangeEncodesWhole) {
+  MjpegEncoder encoder(70, 2);
+  Bytes jpeg;
+  Screen small(200, 100);
+  TileDiffer differ;
+  differ.Diff(small.Frame());
+  ASSERT_TRUE(encoder.Encode(small.Frame(), differ, &jpeg));
+
+  Screen large(400, 300);
+  differ.Diff(large.Frame());
+  ASSERT_TRUE(encoder.Encode(large.Frame(), differ, &jpeg));
+  EXPECT_EQ(encoder.stats().bands_encoded, 2u + 5u);
+  int width = 0;
+  int height = 0;
+  Bytes rgb;
+  ASSERT_TRUE(Decode(jpeg, &width, &height, &rgb));
+  EXPECT_EQ(width, 400);
+  EXPECT_EQ(height, 300);
+  ExpectShows(rgb, large);
+}
+
+#endif  // defined(ZS_TEST_HAVE_JPEG)
+
+}  // namespace
+}  // namespace zapshare
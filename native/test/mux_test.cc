@@ -0,0 +1,328 @@
+#include "mux.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+using test::Random;
+
+// Moves everything |from| has to send into |to|, in |piece|-sized reads.
+size_t Transfer(MuxSession* from, MuxSession* to, size_t piece = 10000) {
+  std::vector<uint8_t> buf(piece);
+  size_t total = 0;
+  while (from->Pending() > 0) {
+    const size_t n = from->Read(buf.data(), buf.size());
+    EXPECT_TRUE(to->Receive(buf.data(), n));
+    total += n;
+  }
+  return total;
+}
+
+std::vector<MuxEvent> Events(MuxSession* session) {
+  std::vector<MuxEvent> events;
+  MuxEvent e;
+  while (session->NextEvent(&e)) events.push_back(e);
+  return events;
+}
+
+// A client and server with the handshake done.
+struct Pair {
+  MuxSession client{MuxSession::Role::kClient};
+  MuxSession server{MuxSession::Role::kServer};
+
+  Pair() {
+    Transfer(&client, &server);
+    Transfer(&server, &client);
+    EXPECT_EQ(Events(&server).size(), 1u);
+    EXPECT_EQ(Events(&client).size(), 1u);
+  }
+};
+
+// Collects the body of each stream from client events, consuming as it
+// goes the way the app does once bytes are on disk.
+struct Bodies {
+  std::map<uint32_t, std::vector<uint8_t>> data;
+  std::map<uint32_t, uint64_t> sizes;
+  std::vector<uint32_t> ended;
+  std::vector<uint32_t> order;  // Stream of each DATA event.
+
+  void Take(MuxSession* client, bool consume = true) {
+    for (const MuxEvent& e : Events(client)) {
+      if (e.type == MuxEventType::kHeaders) sizes[e.stream] = e.a;
+      if (e.type == MuxEventType::kData) {
+        auto& body = data[e.stream];
+        body.insert(body.end(), e.data.begin(), e.data.end());
+        order.push_back(e.stream);
+        if (consume) client->Consumed(e.stream, e.data.size());
+      }
+      if (e.type == MuxEventType::kEnd) ended.push_back(e.stream);
+    }
+  }
+};
+
+// Serves |files| for every request the server has seen, feeding data as
+// buffer space frees up, until nothing moves.
+void Serve(Pair* p, const std::vector<std::vector<uint8_t>>& files,
+           Bodies* bodies, std::map<uint32_t, size_t>* sent) {
+  std::map<uint32_t, uint32_t> index_of;
+  for (const MuxEvent& e : Events(&p->server)) {
+    if (e.type != MuxEventType::kRequest) continue;
+    index_of[e.stream] = static_cast<uint32_t>(e.a);
+    p->server.Respond(e.stream, files[e.a].size(), nullptr, 0);
+    if (files[e.a].empty()) p->server.End(e.stream);
+    (*sent)[e.stream] = 0;
+  }
+  for (int round = 0; round < 100000; round++) {
+    bool moved = false;
+    for (auto& [stream, pos] : *sent) {
+      if (index_of.count(stream) == 0) continue;
+      const auto& file = files[index_of[stream]];
+      if (pos == file.size()) continue;
+      const size_t n = p->server.Write(stream, file.data() + pos,
+                                       file.size() - pos);
+      pos += n;
+      if (pos == file.size()) p->server.End(stream);
+      moved = moved || n > 0;
+    }
+    moved = Transfer(&p->server, &p->client, 65536) > 0 || moved;
+    bodies->Take(&p->client);
+    moved = Transfer(&p->client, &p->server) > 0 || moved;
+    if (!moved) break;
+  }
+}
+
+TEST(MuxTest, PipelinedRequestsRoundTrip) {
+  Pair p;
+  std::vector<std::vector<uint8_t>> files = {Random(3 * 1024 * 1024, 1),
+                                             Random(1, 2), {},
+                                             Random(100000, 3)};
+  std::vector<uint32_t> streams;
+  for (uint32_t i = 0; i < files.size(); i++) {
+    streams.push_back(p.client.Request(i, 0, kMuxToEnd, kMuxDefaultPriority));
+  }
+  EXPECT_EQ(streams, (std::vector<uint32_t>{1, 3, 5, 7}));
+  Transfer(&p.client, &p.server);
+
+  Bodies bodies;
+  std::map<uint32_t, size_t> sent;
+  Serve(&p, files, &bodies, &sent);
+  for (uint32_t i = 0; i < files.size(); i++) {
+    EXPECT_EQ(bodies.sizes[streams[i]], files[i].size());
+    EXPECT_EQ(bodies.data[streams[i]], files[i]) << "file " << i;
+  }
+  EXPECT_EQ(bodies.ended.size(), files.size());
+  EXPECT_EQ(p.client.open_streams(), 0u);
+  EXPECT_EQ(p.server.open_streams(), 0u);
+}
+
+TEST(MuxTest, RequestFieldsReachTheServer) {
+  Pair p;
+  p.client.Request(42, 1000, 5000, 9);  // Priority clamps to the lowest.
+  Transfer(&p.client, &p.server);
+  std::vector<MuxEvent> events = Events(&p.server);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].type, MuxEventType::kRequest);
+  EXPECT_EQ(events[0].stream, 1u);
+  EXPECT_EQ(events[0].a, 42u);
+  EXPECT_EQ(events[0].b, 1000u);
+  EXPECT_EQ(events[0].c, 5000u);
+  EXPECT_EQ(events[0].d, kMuxLowestPriority);
+
+  const char meta[] = "{\"name\":\"a.jpg\"}";
+  p.server.Respond(1, 5000, reinterpret_cast<const uint8_t*>(meta),
+                   sizeof(meta) - 1);
+  Transfer(&p.server, &p.client);
+  events = Events(&p.client);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].type, MuxEventType::kHeaders);
+  EXPECT_EQ(events[0].a, 5000u);
+  EXPECT_EQ(std::string(events[0].data.begin(), events[0].data.end()), meta);
+}
+
+TEST(MuxTest, HigherPriorityGoesFirstAndEqualOnesTakeTurns) {
+  Pair p;
+  const std::vector<uint8_t> file = Random(200000, 4);
+  const uint32_t bulk_a = p.client.Request(0, 0, kMuxToEnd, 5);
+  const uint32_t bulk_b = p.client.Request(0, 0, kMuxToEnd, 5);
+  const uint32_t urgent = p.client.Request(0, 0, kMuxToEnd, 0);
+  Transfer(&p.client, &p.server);
+  Events(&p.server);
+  for (uint32_t s : {bulk_a, bulk_b, urgent}) {
+    p.server.Respond(s, file.size(), nullptr, 0);
+    ASSERT_EQ(p.server.Write(s, file.data(), file.size()), file.size());
+    p.server.End(s);
+  }
+  Transfer(&p.server, &p.client);
+  Bodies bodies;
+  bodies.Take(&p.client);
+
+  const size_t frames = (file.size() + kMuxDataFrame - 1) / kMuxDataFrame;
+  ASSERT_EQ(bodies.order.size(), 3 * frames);
+  for (size_t i = 0; i < frames; i++) EXPECT_EQ(bodies.order[i], urgent);
+  for (size_t i = frames; i < 3 * frames; i++) {
+    EXPECT_EQ(bodies.order[i], (i - frames) % 2 == 0 ? bulk_a : bulk_b);
+  }
+  EXPECT_EQ(bodies.data[urgent], file);
+  EXPECT_EQ(bodies.data[bulk_b], file);
+}
+
+TEST(MuxTest, ControlFramesOvertakeQueuedData) {
+  Pair p;
+  const std::vector<uint8_t> file = Random(kMuxStreamBuffer, 5);
+  const uint32_t s = p.client.Request(0, 0, kMuxToEnd, kMuxDefaultPriority);
+  Transfer(&p.client, &p.server);
+  Events(&p.server);
+  p.server.Respond(s, file.size(), nullptr, 0);
+  p.server.Write(s, file.data(), file.size());
+
+  // Take one DATA frame, then ping: the pong is next on the wire.
+  std::vector<uint8_t> buf(kMuxHeaderSize + kMuxDataFrame + 50);
+  size_t n = p.server.Read(buf.data(), buf.size());
+  ASSERT_TRUE(p.client.Receive(buf.data(), n));
+  p.client.Ping(77);
+  Transfer(&p.client, &p.server);
+  n = p.server.Read(buf.data(), buf.size());
+  ASSERT_TRUE(p.client.Receive(buf.data(), n));
+  std::vector<MuxEvent> events = Events(&p.client);
+  ASSERT_GE(events.size(), 2u);
+  EXPECT_EQ(events.back().type, MuxEventType::kPong);
+  EXPECT_EQ(events.back().a, 77u);
+}
+
+TEST(MuxTest, FlowControlStopsUntilTheClientConsumes) {
+  Pair p;
+  const std::vector<uint8_t> file = Random(3 * kMuxStreamWindow, 6);
+  const uint32_t s = p.client.Request(0, 0, kMuxToEnd, kMuxDefaultPriority);
+  Transfer(&p.client, &p.server);
+  Events(&p.server);
+  p.server.Respond(s, file.size(), nullptr, 0);
+
+  Bodies bodies;
+  size_t pos = 0;
+  for (int i = 0; i < 100; i++) {
+    pos += p.server.Write(s, file.data() + pos, file.size() - pos);
+    Transfer(&p.server, &p.client);
+    bodies.Take(&p.client, /*consume=*/false);
+  }
+  // The window is used up and the server has stopped sending.
+  EXPECT_EQ(bodies.data[s].size(), kMuxStreamWindow);
+  EXPECT_EQ(p.server.Pending(), 0u);
+
+  p.client.Consumed(s, bodies.data[s].size());
+  Transfer(&p.client, &p.server);
+  EXPECT_GT(p.server.Pending(), 0u);
+}
+
+TEST(MuxTest, ResetStopsAStreamAndItsLateDataIsIgnored) {
+  Pair p;
+  const std::vector<uint8_t> file = Random(500000, 7);
+  const uint32_t s = p.client.Request(0, 0, kMuxToEnd, kMuxDefaultPriority);
+  Transfer(&p.client, &p.server);
+  Events(&p.server);
+  p.server.Respond(s, file.size(), nullptr, 0);
+  p.server.Write(s, file.data(), file.size());
+  Transfer(&p.server, &p.client);  // Lands after the client gave up.
+  Events(&p.client);
+
+  p.client.Reset(s, MuxError::kCancel);
+  EXPECT_EQ(p.client.open_streams(), 0u);
+  Transfer(&p.client, &p.server);
+  std::vector<MuxEvent> events = Events(&p.server);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].type, MuxEventType::kReset);
+  EXPECT_EQ(events[0].a, static_cast<uint64_t>(MuxError::kCancel));
+  EXPECT_EQ(p.server.Writable(s), 0u);
+
+  // The server refuses files it doesn't have.
+  const uint32_t missing = p.client.Request(99, 0, kMuxToEnd, 0);
+  Transfer(&p.client, &p.server);
+  Events(&p.server);
+  p.server.Reset(missing, MuxError::kNotFound);
+  Transfer(&p.server, &p.client);
+  events = Events(&p.client);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].type, MuxEventType::kReset);
+  EXPECT_EQ(events[0].a, static_cast<uint64_t>(MuxError::kNotFound));
+}
+
+TEST(MuxTest, LimitsOpenStreams) {
+  Pair p;
+  for (uint32_t i = 0; i < kMuxMaxStreams; i++) {
+    ASSERT_NE(p.client.Request(i, 0, kMuxToEnd, 3), 0u);
+  }
+  EXPECT_EQ(p.client.Request(0, 0, kMuxToEnd, 3), 0u);
+  Transfer(&p.client, &p.server);
+  EXPECT_EQ(Events(&p.server).size(), kMuxMaxStreams);
+  EXPECT_EQ(p.server.open_streams(), kMuxMaxStreams);
+}
+
+TEST(MuxTest, RejectsProtocolViolations) {
+  {
+    MuxSession server(MuxSession::Role::kServer);
+    const uint8_t bad[] = {'G', 'E', 'T', ' '};
+    EXPECT_FALSE(server.Receive(bad, sizeof(bad)));
+    EXPECT_TRUE(server.failed());
+    EXPECT_GT(server.Pending(), 0u);  // GOAWAY.
+  }
+  {
+    // Frames before HELLO.
+    std::vector<uint8_t> ping = {'Z', 'S', 'M', '2', 8, 0, 0, 0,
+                                 static_cast<uint8_t>(MuxFrame::kPing),
+                                 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8};
+    MuxSession fresh(MuxSession::Role::kServer);
+    EXPECT_FALSE(fresh.Receive(ping.data(), ping.size()));
+  }
+  {
+    // Data beyond the stream window.
+    Pair p;
+    const uint32_t s = p.client.Request(0, 0, kMuxToEnd, 3);
+    Transfer(&p.client, &p.server);
+    std::vector<uint8_t> frame(kMuxHeaderSize + kMuxMaxPayload);
+    frame[0] = 0;
+    frame[1] = 0;
+    frame[2] = 1;  // 64 KB payload.
+    frame[4] = static_cast<uint8_t>(MuxFrame::kData);
+    frame[6] = static_cast<uint8_t>(s);
+    bool ok = true;
+    for (uint32_t i = 0; ok && i <= kMuxStreamWindow / kMuxMaxPayload; i++) {
+      ok = p.client.Receive(frame.data(), frame.size());
+    }
+    EXPECT_FALSE(ok);
+    EXPECT_TRUE(p.client.failed());
+  }
+  {
+    // A client may not send DATA.
+    Pair p;
+    const uint8_t data[kMuxHeaderSize] = {
+        0, 0, 0, 0, static_cast<uint8_t>(MuxFrame::kData), 0, 1, 0, 0, 0};
+    EXPECT_FALSE(p.server.Receive(data, sizeof(data)));
+  }
+}
+
+TEST(MuxTest, PieceSizeDoesNotMatter) {
+  for (size_t piece : {1u, 7u, 10u, 4096u}) {
+    Pair p;
+    const std::vector<uint8_t> file = Random(70000, 8);
+    const uint32_t s = p.client.Request(0, 0, kMuxToEnd, 3);
+    Transfer(&p.client, &p.server, piece);
+    Events(&p.server);
+    p.server.Respond(s, file.size(), nullptr, 0);
+    p.server.Write(s, file.data(), file.size());
+    p.server.End(s);
+    Transfer(&p.server, &p.client, piece);
+    Bodies bodies;
+    bodies.Take(&p.client);
+    EXPECT_EQ(bodies.data[s], file) << "piece=" << piece;
+    EXPECT_EQ(bodies.ended.size(), 1u);
+  }
+}
+
+}  // namespace
+}  // namespace zapshare
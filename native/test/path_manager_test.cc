@@ -0,0 +1,327 @@
+#include "path_manager.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "range_receiver.h"
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+constexpr uint64_t kMs = 1'000'000;
+constexpr uint64_t kMiB = 1024 * 1024;
+
+class PathManagerTest : public ::testing::Test {
+ protected:
+  PathManager manager_{[this] { return now_; }};
+  uint64_t now_ = 1;
+};
+
+TEST_F(PathManagerTest, AddingAPathTwiceKeepsItsId) {
+  EXPECT_EQ(manager_.AddPath("192.168.1.5", "192.168.1.9"), 0);
+  EXPECT_EQ(manager_.AddPath("10.0.0.2", "10.0.0.7"), 1);
+  EXPECT_EQ(manager_.AddPath("192.168.1.5", "192.168.1.9"), 0);
+  EXPECT_EQ(manager_.size(), 2u);
+  EXPECT_EQ(manager_.local(1), "10.0.0.2");
+  EXPECT_EQ(manager_.remote(1), "10.0.0.7");
+}
+
+TEST_F(PathManagerTest, UnmeasuredPathsShareWorkEvenly) {
+  manager_.AddPath("", "a");
+  manager_.AddPath("", "b");
+  EXPECT_EQ(manager_.Assign(kMiB), 0);
+  EXPECT_EQ(manager_.Assign(kMiB), 1);
+  EXPECT_EQ(manager_.Assign(kMiB), 0);
+  EXPECT_EQ(manager_.Assign(kMiB), 1);
+  EXPECT_EQ(manager_.Stats(0).queued, 2 * kMiB);
+  EXPECT_EQ(manager_.Stats(0).in_flight, 2u);
+}
+
+TEST_F(PathManagerTest, WorkFollowsMeasuredRates) {
+  const int32_t fast = manager_.AddPath("", "ethernet");
+  const int32_t slow = manager_.AddPath("", "wifi");
+  ASSERT_EQ(manager_.Assign(kMiB), fast);
+  ASSERT_EQ(manager_.Assign(kMiB), slow);
+  // 40 MB/s against 10 MB/s over one rate window.
+  now_ += 100 * kMs;
+  manager_.Delivered(fast, 4'000'000);
+  manager_.Delivered(slow, 1'000'000);
+  EXPECT_EQ(manager_.Stats(fast).rate, 40'000'000u);
+  EXPECT_EQ(manager_.Stats(slow).rate, 10'000'000u);
+  manager_.Release(fast, 0, false);
+  manager_.Release(slow, 0, false);
+
+  int counts[2] = {0, 0};
+  for (int i = 0; i < 50; i++) counts[manager_.Assign(kMiB)]++;
+  EXPECT_EQ(counts[fast], 40);
+  EXPECT_EQ(counts[slow], 10);
+}
+
+TEST_F(PathManagerTest, NewPathIsTriedAtTheBestRate) {
+  const int32_t known = manager_.AddPath("", "a");
+  manager_.Assign(kMiB);
+  now_ += 100 * kMs;
+  manager_.Delivered(known, 2'000'000);
+  manager_.Release(known, 0, false);
+  const int32_t fresh = manager_.AddPath("", "b");
+  EXPECT_EQ(manager_.Assign(kMiB), known);
+  EXPECT_EQ(manager_.Assign(kMiB), fresh);
+}
+
+TEST_F(PathManagerTest, StalledPathLosesItsRate) {
+  const int32_t stalled = manager_.AddPath("", "a");
+  manager_.Assign(kMiB);
+  now_ += 100 * kMs;
+  manager_.Delivered(stalled, 1'000'000);
+  ASSERT_EQ(manager_.Stats(stalled).rate, 10'000'000u);
+  // Still in flight, but nothing arrives.
+  now_ += 100 * kMs;
+  manager_.Assign(kMiB);
+  EXPECT_EQ(manager_.Stats(stalled).rate, 5'000'000u);
+}
+
+TEST_F(PathManagerTest, DroppedPathBacksOffAndComesBack) {
+  const int32_t a = manager_.AddPath("", "a");
+  const int32_t b = manager_.AddPath("", "b");
+  ASSERT_EQ(manager_.Assign(kMiB), a);
+  ASSERT_EQ(manager_.Assign(kMiB), b);
+  ASSERT_EQ(manager_.Assign(kMiB), a);
+  // Both of a's pieces die with it; that counts as one failure.
+  manager_.Release(a, kMiB, true);
+  manager_.Release(a, kMiB, true);
+  PathStats s = manager_.Stats(a);
+  EXPECT_FALSE(s.up);
+  EXPECT_EQ(s.failures, 1u);
+  EXPECT_EQ(s.queued, 0u);
+  EXPECT_EQ(s.in_flight, 0u);
+  EXPECT_EQ(manager_.Assign(kMiB), b);
+  EXPECT_EQ(manager_.Assign(kMiB), b);
+
+  now_ += kPathRetryAfterNs;
+  EXPECT_TRUE(manager_.Stats(a).up);
+  EXPECT_EQ(manager_.Assign(kMiB), a);
+  // Failing again doubles the wait.
+  manager_.Release(a, kMiB, true);
+  now_ += kPathRetryAfterNs;
+  EXPECT_FALSE(manager_.Stats(a).up);
+  now_ += kPathRetryAfterNs;
+  EXPECT_TRUE(manager_.Stats(a).up);
+  // A piece getting through clears the count, but not the drops.
+  EXPECT_EQ(manager_.Assign(kMiB), a);
+  manager_.Delivered(a, kMiB);
+  EXPECT_EQ(manager_.Stats(a).failures, 2u);
+  manager_.Release(a, 0, false);
+  s = manager_.Stats(a);
+  EXPECT_EQ(s.failures, 0u);
+  EXPECT_EQ(s.drops, 2u);
+}
+
+TEST_F(PathManagerTest, LateBytesDontClearFailures) {
+  const int32_t a = manager_.AddPath("", "a");
+  ASSERT_EQ(manager_.Assign(kMiB), a);
+  ASSERT_EQ(manager_.Assign(kMiB), a);
+  manager_.Release(a, kMiB, true);
+  // The other piece was still reading what was buffered before the drop.
+  manager_.Delivered(a, kMiB / 2);
+  manager_.Release(a, kMiB / 2, false);
+  PathStats s = manager_.Stats(a);
+  EXPECT_EQ(s.failures, 1u);
+  EXPECT_EQ(s.drops, 1u);
+  EXPECT_FALSE(s.up);
+
+  // So a path that keeps dropping is still given up on.
+  for (uint32_t i = 1; i < kMaxPathFailures; i++) {
+    now_ += kPathMaxRetryAfterNs;
+    ASSERT_EQ(manager_.Assign(kMiB), a);
+    ASSERT_EQ(manager_.Assign(kMiB), a);
+    manager_.Release(a, kMiB, true);
+    manager_.Delivered(a, 1);
+    manager_.Release(a, kMiB - 1, false);
+  }
+  s = manager_.Stats(a);
+  EXPECT_EQ(s.failures, kMaxPathFailures);
+  EXPECT_EQ(s.drops, kMaxPathFailures);
+  EXPECT_EQ(manager_.Assign(kMiB), kNoPathsLeft);
+}
+
+TEST_F(PathManagerTest, AllPathsDown) {
+  const int32_t only = manager_.AddPath("", "a");
+  EXPECT_EQ(PathManager().Assign(kMiB), kNoPathsLeft);
+  for (uint32_t i = 0; i < kMaxPathFailures; i++) {
+    ASSERT_EQ(manager_.Assign(kMiB), only);
+    manager_.Release(only, kMiB, true);
+    EXPECT_EQ(manager_.Assign(kMiB),
+              i + 1 < kMaxPathFailures ? kAllPathsDown : kNoPathsLeft);
+    now_ += kPathMaxRetryAfterNs;
+  }
+  EXPECT_EQ(manager_.Assign(kMiB), kNoPathsLeft);
+}
+
+#if !defined(_WIN32)
+
+using test::Random;
+using test::RangeServer;
+using test::ReadFile;
+using test::TempPath;
+
+// One network link: a range server on a loopback address of its own,
+// whose connections share a rate limit. All of 127/8 is loopback on
+// Linux, so no aliases need adding.
+RangeServer::Options Link(const std::string& address, uint16_t port,
+                          uint64_t bytes_per_second) {
+  RangeServer::Options options;
+  options.address = address;
+  options.port = port;
+  options.bytes_per_second = bytes_per_second;
+  return options;
+}
+
+// Connections to |link| that didn't come from |peer|, as they would from
+// a receiver bound to the link's interface.
+int Strays(const RangeServer& link, const std::string& peer) {
+  int strays = 0;
+  for (const std::string& from : link.peers()) strays += from != peer;
+  return strays;
+}
+
+// Fetches [0, size) into |path| in |piece|-sized ranges over |streams|
+// workers, each asking |manager| for a path per piece, the way
+// ParallelTransferService does. A piece whose path fails goes back on the
+// queue from where it stopped. False if the paths all gave out.
+bool Fetch(PathManager* manager, uint16_t port, uint64_t size,
+           uint64_t piece, int streams, const std::string& path) {
+  std::mutex mu;
+  std::deque<std::pair<uint64_t, uint64_t>> queue;
+  for (uint64_t at = 0; at < size; at += piece) {
+    queue.emplace_back(at, std::min(at + piece, size));
+  }
+  std::atomic<int> busy{0};
+  std::atomic<bool> gave_up{false};
+
+  auto worker = [&] {
+    for (;;) {
+      std::pair<uint64_t, uint64_t> range;
+      {
+        std::lock_guard<std::mutex> lock(mu);
+        if (queue.empty()) {
+          if (busy == 0 || gave_up) return;
+          range = {0, 0};
+        } else {
+          range = queue.front();
+          queue.pop_front();
+          busy++;
+        }
+      }
+      if (range.second == 0) {  // Others may still hand work back.
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        continue;
+      }
+      const int32_t id = manager->Assign(range.second - range.first);
+      if (id < 0) {
+        {
+          std::lock_guard<std::mutex> lock(mu);
+          queue.push_front(range);
+          busy--;
+        }
+        if (id == kNoPathsLeft) {
+          gave_up = true;
+          return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        continue;
+      }
+      ReceiveRequest r;
+      r.host = manager->remote(id);
+      r.bind_address = manager->local(id);
+      r.port = port;
+      r.target = "/file/0";
+      r.start = range.first;
+      r.end = range.second;
+      r.path = path;
+      r.sync_every = 0;
+      auto receiver = RangeReceiver::Start(r);
+      uint64_t reported = 0;
+      for (;;) {
+        const bool finished = receiver->state() != ReceiveState::kRunning;
+        const uint64_t received = receiver->stats().received;
+        manager->Delivered(id, received - reported);
+        reported = received;
+        if (finished) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+      const uint64_t undelivered = range.second - range.first - reported;
+      const bool failed = receiver->state() != ReceiveState::kDone;
+      manager->Release(id, undelivered, failed);
+      std::lock_guard<std::mutex> lock(mu);
+      if (failed) queue.emplace_front(range.first + reported, range.second);
+      busy--;
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 0; i < streams; i++) workers.emplace_back(worker);
+  for (std::thread& t : workers) t.join();
+  return !gave_up;
+}
+
+TEST(PathManagerLoopbackTest, FasterLinkCarriesMore) {
+  const auto data = Random(24 * kMiB, 1);
+  RangeServer fast(data, Link("127.0.0.1", 0, 24 * kMiB));
+  RangeServer slow(data, Link("127.0.0.2", fast.port(), 6 * kMiB));
+  if (!slow.bound()) GTEST_SKIP() << "127.0.0.2 isn't usable";
+
+  PathManager manager;
+  const int32_t a = manager.AddPath("127.0.0.11", "127.0.0.1");
+  const int32_t b = manager.AddPath("127.0.0.12", "127.0.0.2");
+  const std::string path = TempPath("weighted");
+  ASSERT_TRUE(PreallocateFile(path, data.size()));
+  ASSERT_TRUE(Fetch(&manager, fast.port(), data.size(), kMiB, 4, path));
+
+  EXPECT_EQ(ReadFile(path), data);
+  EXPECT_EQ(Strays(fast, "127.0.0.11") + Strays(slow, "127.0.0.12"), 0);
+  const PathStats fast_stats = manager.Stats(a);
+  const PathStats slow_stats = manager.Stats(b);
+  EXPECT_EQ(fast_stats.delivered + slow_stats.delivered, data.size());
+  EXPECT_GT(slow_stats.delivered, 0u);
+  EXPECT_GT(fast_stats.delivered, 2 * slow_stats.delivered);
+  EXPECT_GT(fast_stats.rate, 2 * slow_stats.rate);
+}
+
+TEST(PathManagerLoopbackTest, SurvivesALinkDropping) {
+  const auto data = Random(16 * kMiB, 2);
+  RangeServer stays(data, Link("127.0.0.1", 0, 16 * kMiB));
+  RangeServer drops(data, Link("127.0.0.2", stays.port(), 16 * kMiB));
+  if (!drops.bound()) GTEST_SKIP() << "127.0.0.2 isn't usable";
+
+  PathManager manager;
+  const int32_t a = manager.AddPath("127.0.0.11", "127.0.0.1");
+  const int32_t b = manager.AddPath("127.0.0.12", "127.0.0.2");
+  const std::string path = TempPath("dropped");
+  ASSERT_TRUE(PreallocateFile(path, data.size()));
+  std::thread cut([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    drops.Drop();
+  });
+  const bool ok = Fetch(&manager, stays.port(), data.size(), kMiB, 4, path);
+  cut.join();
+  ASSERT_TRUE(ok);
+
+  EXPECT_EQ(ReadFile(path), data);
+  const PathStats dropped = manager.Stats(b);
+  EXPECT_GE(dropped.drops, 1u);
+  EXPECT_GT(dropped.delivered, 0u);
+  EXPECT_GT(manager.Stats(a).delivered, dropped.delivered);
+}
+
+#endif
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,124 @@
+#include "peer_table.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <vector>
+
+namespace zapshare {
+namespace {
+
+TEST(FlatIndexTest, InsertFindErase) {
+  FlatIndex index;
+  EXPECT_EQ(index.Find(42), FlatIndex::kNone);
+  index.Insert(42, 7);
+  index.Insert(0x7f000001, 8);
+  EXPECT_EQ(index.Find(42), 7u);
+  EXPECT_EQ(index.Find(0x7f000001), 8u);
+  index.Insert(42, 9);
+  EXPECT_EQ(index.Find(42), 9u);
+  EXPECT_EQ(index.size(), 2u);
+  EXPECT_TRUE(index.Erase(42));
+  EXPECT_FALSE(index.Erase(42));
+  EXPECT_EQ(index.Find(42), FlatIndex::kNone);
+  EXPECT_EQ(index.Find(0), FlatIndex::kNone);
+  EXPECT_EQ(index.size(), 1u);
+}
+
+// Random churn against std::map, through growth and many deletions from
+// the middle of probe runs.
+TEST(FlatIndexTest, MatchesAMapUnderChurn) {
+  FlatIndex index;
+  std::map<uint64_t, uint32_t> model;
+  std::mt19937_64 rng(1);
+  for (uint32_t i = 0; i < 200000; i++) {
+    // Keys on a few subnets, as addresses are.
+    const uint64_t key = 0xc0a80000 + rng() % 5000 + 1;
+    if (rng() % 3 == 0) {
+      EXPECT_EQ(index.Erase(key), model.erase(key) == 1);
+    } else {
+      index.Insert(key, i);
+      model[key] = i;
+    }
+  }
+  EXPECT_EQ(index.size(), model.size());
+  for (uint64_t key = 0xc0a80000; key <= 0xc0a80000 + 5001; key++) {
+    auto it = model.find(key);
+    ASSERT_EQ(index.Find(key),
+              it == model.end() ? FlatIndex::kNone : it->second)
+        << key;
+  }
+}
+
+std::vector<uint32_t> AdvanceTo(TimerWheel* wheel, uint64_t now_ms) {
+  std::vector<uint32_t> fired;
+  wheel->Advance(now_ms, [&](uint32_t timer) { fired.push_back(timer); });
+  return fired;
+}
+
+TEST(TimerWheelTest, FiresOnTheTickAtOrAfterItsTime) {
+  TimerWheel wheel(10, 1000);
+  wheel.Schedule(1, 1025);  // Rounded up to the tick at 1030.
+  wheel.Schedule(2, 1010);
+  EXPECT_TRUE(AdvanceTo(&wheel, 1009).empty());
+  EXPECT_EQ(AdvanceTo(&wheel, 1010), std::vector<uint32_t>{2});
+  EXPECT_TRUE(AdvanceTo(&wheel, 1029).empty());
+  EXPECT_EQ(AdvanceTo(&wheel, 1030), std::vector<uint32_t>{1});
+  EXPECT_EQ(wheel.size(), 0u);
+  // Already due fires on the next advance.
+  wheel.Schedule(3, 0);
+  EXPECT_EQ(AdvanceTo(&wheel, 1030), std::vector<uint32_t>{3});
+}
+
+TEST(TimerWheelTest, CancelAndReschedule) {
+  TimerWheel wheel(1, 0);
+  wheel.Schedule(1, 100);
+  wheel.Schedule(2, 100);
+  wheel.Cancel(1);
+  EXPECT_FALSE(wheel.armed(1));
+  wheel.Schedule(2, 5000);  // Moves it, rather than arming it twice.
+  EXPECT_TRUE(AdvanceTo(&wheel, 4999).empty());
+  EXPECT_EQ(AdvanceTo(&wheel, 5000), std::vector<uint32_t>{2});
+}
+
+// Times across every level and beyond the outermost, fired in order and
+// never early, including timers re-armed from inside |fire|.
+TEST(TimerWheelTest, MatchesASortOverEveryLevel) {
+  TimerWheel wheel(1, 0);
+  std::mt19937_64 rng(2);
+  std::vector<uint64_t> due(3000);
+  for (uint32_t t = 0; t < due.size(); t++) {
+    const int digits = static_cast<int>(rng() % 27) + 1;
+    due[t] = rng() % (1ull << digits);
+    wheel.Schedule(t, due[t]);
+  }
+  uint64_t now = 0;
+  uint64_t last = 0;
+  size_t fired = 0;
+  bool rearmed = false;
+  while (wheel.size() > 0) {
+    now += 1 + rng() % 50000;
+    wheel.Advance(now, [&](uint32_t t) {
+      EXPECT_LE(due[t], now);
+      EXPECT_GE(due[t], last);
+      last = due[t];
+      fired++;
+      if (!rearmed) {
+        rearmed = true;
+        due[t] = now + 1000000;
+        wheel.Schedule(t, due[t]);
+      }
+    });
+    // Whatever is left isn't due yet.
+    for (uint32_t t = 0; t < due.size(); t++) {
+      if (wheel.armed(t)) {
+        ASSERT_GT(due[t], now) << t;
+      }
+    }
+  }
+  EXPECT_EQ(fired, due.size() + 1);
+}
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,222 @@
+#include "range_receiver.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace {
+
+namespace fs = std::filesystem;
+
+using test::Random;
+using test::ReadFile;
+using test::TempPath;
+
+TEST(RangeReceiverTest, PreallocateFile) {
+  const std::string path = TempPath("prealloc");
+  ASSERT_TRUE(PreallocateFile(path, 3 << 20));
+  EXPECT_EQ(fs::file_size(path), 3u << 20);
+  // Never shrinks.
+  ASSERT_TRUE(PreallocateFile(path, 1 << 20));
+  EXPECT_EQ(fs::file_size(path), 3u << 20);
+}
+
+#if !defined(_WIN32)
+
+using test::RangeServer;
+using Behavior = RangeServer::Behavior;
+
+// A loopback port nothing listens on.
+uint16_t UnusedPort() {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  bind(fd, reinterpret_cast<sockaddr*>(&addr), len);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  close(fd);
+  return ntohs(addr.sin_port);
+}
+
+ReceiveRequest Request(uint16_t port, const std::string& path,
+                       uint64_t start, uint64_t end) {
+  ReceiveRequest r;
+  r.host = "127.0.0.1";
+  r.port = port;
+  r.target = "/file/0";
+  r.start = start;
+  r.end = end;
+  r.path = path;
+  return r;
+}
+
+void Wait(RangeReceiver* receiver) {
+  while (receiver->state() == ReceiveState::kRunning) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+class RangeReceiverModes : public ::testing::TestWithParam<bool> {};
+
+TEST_P(RangeReceiverModes, RangesLandAtTheirOffsets) {
+  const auto data = Random(3 * 1024 * 1024 + 777, 1);
+  RangeServer server(data);
+  const std::string path = TempPath(GetParam() ? "splice" : "copy");
+  ASSERT_TRUE(PreallocateFile(path, data.size()));
+  ChunkHasher hasher(data.size(), 1024 * 1024);
+
+  // Chunk-aligned pieces, like ParallelTransferService asks for.
+  const uint64_t cut = 2 * 1024 * 1024;
+  for (auto [start, end] : {std::pair<uint64_t, uint64_t>{cut, data.size()},
+                            {0, cut}}) {
+    ReceiveRequest r = Request(server.port(), path, start, end);
+    r.hasher = &hasher;
+    r.sync_every = 1024 * 1024;
+    r.zero_copy = GetParam();
+    auto receiver = RangeReceiver::Start(r);
+    ASSERT_NE(receiver, nullptr);
+    Wait(receiver.get());
+    ASSERT_EQ(receiver->state(), ReceiveState::kDone)
+        << static_cast<int>(receiver->error());
+    EXPECT_EQ(receiver->http_status(), 206);
+    const ReceiveStats s = receiver->stats();
+    EXPECT_EQ(s.received, end - start);
+    EXPECT_EQ(s.durable, end - start);
+    EXPECT_GE(s.syncs, 1u);
+#if defined(__linux__)
+    EXPECT_EQ(s.spliced, GetParam());
+#endif
+  }
+  EXPECT_EQ(ReadFile(path), data);
+
+  Digest got;
+  Digest want;
+  ASSERT_TRUE(hasher.FileDigest(&got));
+  ChunkHasher reference(data.size(), 1024 * 1024);
+  reference.Update(0, data.data(), data.size());
+  ASSERT_TRUE(reference.FileDigest(&want));
+  EXPECT_EQ(got, want);
+}
+
+INSTANTIATE_TEST_SUITE_P(ZeroCopy, RangeReceiverModes, ::testing::Bool());
+
+TEST(RangeReceiverTest, PlainGetOfTheWholeFile) {
+  const auto data = Random(200 * 1024, 2);
+  RangeServer server(data);
+  const std::string path = TempPath("plain");
+  ReceiveRequest r = Request(server.port(), path, 0, data.size());
+  r.ranged = false;
+  auto receiver = RangeReceiver::Start(r);
+  Wait(receiver.get());
+  EXPECT_EQ(receiver->state(), ReceiveState::kDone);
+  EXPECT_EQ(receiver->http_status(), 200);
+  EXPECT_EQ(server.last_request().find("Range:"), std::string::npos);
+  EXPECT_EQ(ReadFile(path), data);
+}
+
+TEST(RangeReceiverTest, ServerWithoutRangesOnlyServesFromZero) {
+  const auto data = Random(100 * 1024, 3);
+  RangeServer server(data, {Behavior::kNoRanges});
+  const std::string path = TempPath("noranges");
+  auto whole = RangeReceiver::Start(Request(server.port(), path, 0,
+                                            data.size()));
+  Wait(whole.get());
+  EXPECT_EQ(whole->state(), ReceiveState::kDone);
+  auto tail = RangeReceiver::Start(Request(server.port(), path, 10,
+                                           data.size()));
+  Wait(tail.get());
+  EXPECT_EQ(tail->error(), ReceiveError::kStatus);
+}
+
+TEST(RangeReceiverTest, SendsOnAWarmConnection) {
+  const auto data = Random(300 * 1024, 6);
+  RangeServer server(data);
+  const std::string path = TempPath("warm");
+  ConnectionPoolConfig config;
+  config.per_peer = 1;  // The server takes one connection at a time.
+  auto pool = ConnectionPool::Start(config);
+  pool->Warm("127.0.0.1", server.port(), false);
+  while (pool->stats().ready == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ReceiveRequest r = Request(server.port(), path, 0, data.size());
+  r.pool = pool.get();
+  auto receiver = RangeReceiver::Start(r);
+  Wait(receiver.get());
+  EXPECT_EQ(receiver->state(), ReceiveState::kDone);
+  EXPECT_TRUE(receiver->stats().warm);
+  EXPECT_EQ(pool->stats().taken, 1u);
+  EXPECT_EQ(ReadFile(path), data);
+}
+
+TEST(RangeReceiverTest, Failures) {
+  const auto data = Random(512 * 1024, 4);
+  const std::string path = TempPath("failures");
+  {
+    RangeServer server(data, {Behavior::kNotFound});
+    auto r = RangeReceiver::Start(Request(server.port(), path, 0, 10));
+    Wait(r.get());
+    EXPECT_EQ(r->error(), ReceiveError::kStatus);
+    EXPECT_EQ(r->http_status(), 404);
+  }
+  {
+    RangeServer server(data, {Behavior::kCloseEarly});
+    auto r = RangeReceiver::Start(Request(server.port(), path, 0,
+                                          data.size()));
+    Wait(r.get());
+    EXPECT_EQ(r->error(), ReceiveError::kClosed);
+    EXPECT_LT(r->stats().received, data.size());
+  }
+  {
+    RangeServer server(data, {Behavior::kChunked});
+    auto r = RangeReceiver::Start(Request(server.port(), path, 0, 100));
+    Wait(r.get());
+    EXPECT_EQ(r->error(), ReceiveError::kStatus);
+  }
+  {
+    auto r = RangeReceiver::Start(Request(UnusedPort(), path, 0, 100));
+    Wait(r.get());
+    EXPECT_EQ(r->error(), ReceiveError::kConnect);
+  }
+  {
+    RangeServer server(data);
+    ReceiveRequest request = Request(server.port(), path, 0, 100);
+    request.bind_address = "not an address";
+    auto r = RangeReceiver::Start(request);
+    Wait(r.get());
+    EXPECT_EQ(r->error(), ReceiveError::kConnect);
+  }
+}
+
+TEST(RangeReceiverTest, PauseAndCancel) {
+  const auto data = Random(8 * 1024 * 1024, 5);
+  RangeServer server(data);
+  const std::string path = TempPath("cancel");
+  auto r = RangeReceiver::Start(Request(server.port(), path, 0, data.size()));
+  r->SetPaused(true);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(r->state(), ReceiveState::kRunning);
+  EXPECT_LT(r->stats().received, data.size());
+  // Destroying a running receiver cancels it without hanging.
+  r.reset();
+}
+
+#endif
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,177 @@
+#include "read_ahead.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace {
+
+using test::AwaitReady;
+using test::Random;
+using test::WriteTemp;
+
+constexpr size_t kBuffer = 4096;
+
+// Everything left in |reader|, |cap| bytes at a time. Empty on an error.
+std::vector<uint8_t> ReadAll(ReadAhead* reader, size_t cap) {
+  std::vector<uint8_t> out;
+  std::vector<uint8_t> buf(cap);
+  while (reader->position() < reader->end()) {
+    const int64_t n = reader->Read(buf.data(), cap);
+    if (n < 0) return {};
+    if (n == 0) {
+      if (!AwaitReady(reader)) {
+        ADD_FAILURE() << "no wakeup at " << reader->position();
+        return {};
+      }
+      continue;
+    }
+    out.insert(out.end(), buf.begin(), buf.begin() + n);
+  }
+  return out;
+}
+
+TEST(ReadAheadTest, ReadsTheWholeFile) {
+  const auto data = Random(20 * kBuffer + 321, 1);
+  auto reader =
+      ReadAhead::Open(WriteTemp("whole", data), 0, UINT64_MAX, 3, kBuffer);
+  ASSERT_NE(reader, nullptr);
+  EXPECT_EQ(reader->end(), data.size());
+  EXPECT_EQ(ReadAll(reader.get(), 1000), data);
+  const ReadAheadStats s = reader->stats();
+  EXPECT_EQ(s.disk_bytes, data.size());
+  EXPECT_LE(s.max_depth, 3u);
+  EXPECT_GT(s.depth_samples, 0u);
+}
+
+TEST(ReadAheadTest, ReadsSpanSeveralBuffers) {
+  const auto data = Random(10 * kBuffer, 2);
+  auto reader =
+      ReadAhead::Open(WriteTemp("span", data), 0, UINT64_MAX, 8, kBuffer);
+  // Let the thread fill the ring, then take it in one call.
+  while (reader->stats().max_depth < 8) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::vector<uint8_t> buf(8 * kBuffer);
+  EXPECT_EQ(reader->Read(buf.data(), buf.size()),
+            static_cast<int64_t>(buf.size()));
+  EXPECT_TRUE(std::equal(buf.begin(), buf.end(), data.begin()));
+  EXPECT_GE(reader->stats().reader_stalls, 1u);
+}
+
+TEST(ReadAheadTest, ReadsRanges) {
+  const auto data = Random(16 * kBuffer, 3);
+  const std::string path = WriteTemp("range", data);
+  auto middle = ReadAhead::Open(path, 3 * kBuffer + 5, 7 * kBuffer + 1, 2,
+                                kBuffer);
+  EXPECT_EQ(ReadAll(middle.get(), 777),
+            std::vector<uint8_t>(data.begin() + 3 * kBuffer + 5,
+                                 data.begin() + 7 * kBuffer + 1));
+  auto tail = ReadAhead::Open(path, data.size() - 10, data.size() + 99, 2,
+                              kBuffer);
+  EXPECT_EQ(ReadAll(tail.get(), 777),
+            std::vector<uint8_t>(data.end() - 10, data.end()));
+  auto empty = ReadAhead::Open(path, data.size(), data.size(), 2, kBuffer);
+  uint8_t b;
+  EXPECT_EQ(empty->Read(&b, 1), 0);
+  EXPECT_EQ(empty->stats().consumer_stalls, 0u);
+}
+
+TEST(ReadAheadTest, DefaultsAndUnalignedBufferSize) {
+  const auto data = Random(3 * kReadAheadBufferSize + 17, 4);
+  const std::string path = WriteTemp("defaults", data);
+  auto defaults = ReadAhead::Open(path, 0, UINT64_MAX, 0, 0);
+  EXPECT_EQ(ReadAll(defaults.get(), 65536), data);
+  auto odd = ReadAhead::Open(path, 0, UINT64_MAX, 2, 1000);
+  EXPECT_EQ(ReadAll(odd.get(), 999), data);
+}
+
+TEST(ReadAheadTest, CountsConsumerStalls) {
+  const auto data = Random(64 * kBuffer, 5);
+  auto reader =
+      ReadAhead::Open(WriteTemp("stalls", data), 0, UINT64_MAX, 2, kBuffer);
+  uint8_t b;
+  // Straight after opening the thread has rarely read anything yet; the
+  // stall is counted once however often the consumer polls.
+  const int64_t first = reader->Read(&b, 1);
+  const uint64_t stalls = reader->stats().consumer_stalls;
+  EXPECT_EQ(stalls, first == 0 ? 1u : 0u);
+  if (first == 0) {
+    reader->Read(&b, 1);
+    EXPECT_LE(reader->stats().consumer_stalls, 1u);
+  }
+}
+
+TEST(ReadAheadTest, NotifyFiresOnceEvenIfTheReaderIsClosed) {
+  const auto data = Random(64 * kBuffer, 9);
+  auto reader =
+      ReadAhead::Open(WriteTemp("notify", data), 0, UINT64_MAX, 2, kBuffer);
+  std::atomic<int> fired{0};
+  reader->Notify([&fired] { fired++; });
+  reader.reset();
+  EXPECT_EQ(fired.load(), 1);
+}
+
+TEST(ReadAheadTest, MissingFile) {
+  EXPECT_EQ(ReadAhead::Open(WriteTemp("gone", {}) + ".missing", 0, 1, 0, 0),
+            nullptr);
+}
+
+#if !defined(_WIN32)
+TEST(ReadAheadTest, ReadsADescriptor) {
+  const auto data = Random(5 * kBuffer + 3, 6);
+  const int fd = open(WriteTemp("fd", data).c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  auto reader = ReadAhead::OpenFd(fd, 100, UINT64_MAX, 2, kBuffer);
+  ASSERT_NE(reader, nullptr);
+  EXPECT_EQ(reader->end(), data.size());
+  EXPECT_EQ(ReadAll(reader.get(), 4096),
+            std::vector<uint8_t>(data.begin() + 100, data.end()));
+}
+
+TEST(ReadAheadTest, ReadsAPipeOfUnknownSize) {
+  const auto data = Random(6 * kBuffer + 11, 7);
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  std::thread writer([&] {
+    size_t off = 0;
+    while (off < data.size()) {
+      const ssize_t n = write(fds[1], data.data() + off,
+                              std::min<size_t>(1500, data.size() - off));
+      if (n <= 0) break;
+      off += static_cast<size_t>(n);
+    }
+    close(fds[1]);
+  });
+  auto reader = ReadAhead::OpenFd(fds[0], 50, UINT64_MAX, 2, kBuffer);
+  ASSERT_NE(reader, nullptr);
+  EXPECT_EQ(ReadAll(reader.get(), 3000),
+            std::vector<uint8_t>(data.begin() + 50, data.end()));
+  EXPECT_EQ(reader->end(), data.size());
+  writer.join();
+}
+
+TEST(ReadAheadTest, FileThatShrankFails) {
+  const auto data = Random(8 * kBuffer, 8);
+  const std::string path = WriteTemp("shrank", data);
+  auto reader = ReadAhead::Open(path, 0, UINT64_MAX, 2, kBuffer);
+  // The thread can't get past two buffers before the consumer reads.
+  ASSERT_EQ(truncate(path.c_str(), 2 * kBuffer), 0);
+  EXPECT_TRUE(ReadAll(reader.get(), 4096).empty());
+}
+#endif
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,315 @@
+#include "resume_journal.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace {
+
+using test::TempPath;
+
+JournalIdentity SampleIdentity() {
+  JournalIdentity id;
+  id.peer_id = "peer-1234/file/0";
+  id.file_size = 10 * 1024 * 1024 + 17;
+  id.mtime_ms = 1700000000000;
+  id.chunk_size = 1024 * 1024;
+  id.digest.fill(0xAB);
+  return id;
+}
+
+TEST(ResumeJournalTest, FreshJournalStartsEmpty) {
+  const std::string path = TempPath("fresh");
+  ResumeJournal::Remove(path);
+  bool resumed = true;
+  auto journal = ResumeJournal::Open(path, SampleIdentity(), &resumed);
+  ASSERT_NE(journal, nullptr);
+  EXPECT_FALSE(resumed);
+  EXPECT_EQ(journal->ChunkCount(), 11u);
+  EXPECT_EQ(journal->CompletedChunks(), 0u);
+  for (uint32_t i = 0; i < journal->ChunkCount(); i++) {
+    EXPECT_FALSE(journal->IsChunkDone(i));
+  }
+  journal.reset();
+  ResumeJournal::Remove(path);
+}
+
+TEST(ResumeJournalTest, MarksSurviveReopen) {
+  const std::string path = TempPath("reopen");
+  ResumeJournal::Remove(path);
+  bool resumed = false;
+  {
+    auto journal = ResumeJournal::Open(path, SampleIdentity(), &resumed);
+    ASSERT_NE(journal, nullptr);
+    journal->MarkChunk(0);
+    journal->MarkChunk(3);
+    journal->MarkChunk(10);
+    journal->MarkChunk(3);  // idempotent
+    journal->MarkChunk(99);  // out of range, ignored
+    EXPECT_EQ(journal->CompletedChunks(), 3u);
+  }
+  auto journal = ResumeJournal::Open(path, SampleIdentity(), &resumed);
+  ASSERT_NE(journal, nullptr);
+  EXPECT_TRUE(resumed);
+  EXPECT_EQ(journal->CompletedChunks(), 3u);
+  EXPECT_TRUE(journal->IsChunkDone(3));
+  EXPECT_FALSE(journal->IsChunkDone(4));
+
+  journal->ClearChunk(3);
+  EXPECT_FALSE(journal->IsChunkDone(3));
+  EXPECT_EQ(journal->CompletedChunks(), 2u);
+  EXPECT_TRUE(journal->Sync());
+  journal.reset();
+  ResumeJournal::Remove(path);
+}
+
+TEST(ResumeJournalTest, DifferentIdentityResets) {
+  const std::string path = TempPath("identity");
+  ResumeJournal::Remove(path);
+
+  std::vector<JournalIdentity> variants(4, SampleIdentity());
+  variants[0].peer_id = "another-peer/file/0";
+  variants[1].mtime_ms += 1;
+  variants[2].digest[5] ^= 1;
+  variants[3].file_size += 1;
+
+  for (const JournalIdentity& other : variants) {
+    bool resumed = false;
+    {
+      auto journal = ResumeJournal::Open(path, SampleIdentity(), &resumed);
+      ASSERT_NE(journal, nullptr);
+      journal->MarkChunk(1);
+    }
+    auto journal = ResumeJournal::Open(path, other, &resumed);
+    ASSERT_NE(journal, nullptr);
+    EXPECT_FALSE(resumed);
+    EXPECT_EQ(journal->CompletedChunks(), 0u);
+  }
+  ResumeJournal::Remove(path);
+}
+
+TEST(ResumeJournalTest, DigestLearntLaterKeepsProgress) {
+  const std::string path = TempPath("late_digest");
+  JournalIdentity unknown = SampleIdentity();
+  unknown.digest.fill(0);
+  bool resumed = false;
+  {
+    auto journal = ResumeJournal::Open(path, unknown, &resumed);
+    ASSERT_NE(journal, nullptr);
+    journal->MarkChunk(1);
+  }
+  // The sender has hashed the file by the second attempt.
+  {
+    auto journal = ResumeJournal::Open(path, SampleIdentity(), &resumed);
+    ASSERT_NE(journal, nullptr);
+    EXPECT_TRUE(resumed);
+    EXPECT_EQ(journal->CompletedChunks(), 1u);
+    journal->MarkChunk(2);
+  }
+  // And has forgotten it again by the third.
+  {
+    auto journal = ResumeJournal::Open(path, unknown, &resumed);
+    ASSERT_NE(journal, nullptr);
+    EXPECT_TRUE(resumed);
+    EXPECT_EQ(journal->CompletedChunks(), 2u);
+  }
+  // The digest from the second attempt was kept, so a different one still
+  // means a different file.
+  JournalIdentity changed = SampleIdentity();
+  changed.digest[0] ^= 1;
+  auto journal = ResumeJournal::Open(path, changed, &resumed);
+  ASSERT_NE(journal, nullptr);
+  EXPECT_FALSE(resumed);
+  EXPECT_EQ(journal->CompletedChunks(), 0u);
+  journal.reset();
+  ResumeJournal::Remove(path);
+}
+
+TEST(ResumeJournalTest, DamagedJournalIsRebuilt) {
+  const std::string path = TempPath("damaged");
+  ResumeJournal::Remove(path);
+  bool resumed = false;
+  {
+    auto journal = ResumeJournal::Open(path, SampleIdentity(), &resumed);
+    ASSERT_NE(journal, nullptr);
+    journal->MarkChunk(2);
+  }
+  {
+    // Lose the magic, as if creation had been interrupted.
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    f.write("\0\0\0\0", 4);
+  }
+  auto journal = ResumeJournal::Open(path, SampleIdentity(), &resumed);
+  ASSERT_NE(journal, nullptr);
+  EXPECT_FALSE(resumed);
+  EXPECT_EQ(journal->CompletedChunks(), 0u);
+  journal.reset();
+
+  {
+    // A truncated file is rebuilt too.
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    f.write("ZSRJ", 4);
+  }
+  journal = ResumeJournal::Open(path, SampleIdentity(), &resumed);
+  ASSERT_NE(journal, nullptr);
+  EXPECT_FALSE(resumed);
+  journal.reset();
+  ResumeJournal::Remove(path);
+}
+
+TEST(ResumeJournalTest, ConcurrentMarksAreCounted) {
+  const std::string path = TempPath("concurrent");
+  ResumeJournal::Remove(path);
+  JournalIdentity id = SampleIdentity();
+  id.file_size = 4096ull * id.chunk_size;
+  bool resumed = false;
+  auto journal = ResumeJournal::Open(path, id, &resumed);
+  ASSERT_NE(journal, nullptr);
+
+  // Neighbouring bits share bytes, so lost updates would show up here.
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 4; t++) {
+    threads.emplace_back([&journal, t] {
+      for (uint32_t i = t; i < 4096; i += 4) journal->MarkChunk(i);
+    });
+  }
+  for (std::thread& t : threads) t.join();
+  EXPECT_EQ(journal->CompletedChunks(), 4096u);
+  journal.reset();
+
+  journal = ResumeJournal::Open(path, id, &resumed);
+  EXPECT_TRUE(resumed);
+  EXPECT_EQ(journal->CompletedChunks(), 4096u);
+  journal.reset();
+  ResumeJournal::Remove(path);
+}
+
+#if !defined(_WIN32)
+
+using test::RangeServer;
+
+// Fetches one chunk into |dest_fd| at its offset and marks it.
+bool FetchChunk(uint16_t port, int dest_fd, ResumeJournal* journal,
+                uint32_t index, uint64_t file_size) {
+  const uint64_t start = static_cast<uint64_t>(index) * journal->chunk_size();
+  const uint64_t end = std::min<uint64_t>(start + journal->chunk_size(),
+                                          file_size);
+  const bool ok = test::GetRange(
+      port, start, end, [&](uint64_t at, const uint8_t* data, size_t len) {
+        return pwrite(dest_fd, data, len, static_cast<off_t>(at)) ==
+               static_cast<ssize_t>(len);
+      });
+  if (!ok) return false;
+  journal->MarkChunk(index);
+  return true;
+}
+
+TEST(ResumeJournalTest, KillAndResumeOverLoopback) {
+  const uint32_t chunk = 64 * 1024;
+  std::vector<uint8_t> source(40 * chunk + 999);
+  for (size_t i = 0; i < source.size(); i++) {
+    source[i] = static_cast<uint8_t>((i * 2654435761u) >> 13);
+  }
+  const std::string dest = TempPath("dest");
+  const std::string jpath = dest + ".zsj";
+  std::remove(dest.c_str());
+  ResumeJournal::Remove(jpath);
+
+  JournalIdentity id;
+  id.peer_id = "127.0.0.1/file/0";
+  id.file_size = source.size();
+  id.chunk_size = chunk;
+
+  // Paced so the kill lands mid-chunk.
+  RangeServer::Options options;
+  options.bytes_per_second = 32 * 1024 * 1024;
+  RangeServer server(source, options);
+  int progress[2];
+  ASSERT_EQ(pipe(progress), 0);
+
+  pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0) {
+    close(progress[0]);
+    bool resumed = false;
+    auto journal = ResumeJournal::Open(jpath, id, &resumed);
+    int fd = open(dest.c_str(), O_RDWR | O_CREAT, 0644);
+    if (journal == nullptr || fd < 0) _exit(1);
+    for (uint32_t i = 0; i < journal->ChunkCount(); i++) {
+      if (!FetchChunk(server.port(), fd, journal.get(), i, id.file_size)) {
+        _exit(1);
+      }
+      char b = 1;
+      if (write(progress[1], &b, 1) != 1) _exit(1);
+    }
+    _exit(0);
+  }
+
+  // Let the child land some chunks, then kill it without warning.
+  close(progress[1]);
+  int landed = 0;
+  char b;
+  while (landed < 12 && read(progress[0], &b, 1) == 1) landed++;
+  kill(child, SIGKILL);
+  int status = 0;
+  waitpid(child, &status, 0);
+  close(progress[0]);
+  ASSERT_TRUE(WIFSIGNALED(status)) << "child finished before it was killed";
+
+  bool resumed = false;
+  auto journal = ResumeJournal::Open(jpath, id, &resumed);
+  ASSERT_NE(journal, nullptr);
+  ASSERT_TRUE(resumed);
+  const uint32_t done = journal->CompletedChunks();
+  EXPECT_GE(done, 12u);
+  EXPECT_LT(done, journal->ChunkCount());
+
+  // Resume: fetch only what the journal says is missing.
+  int fd = open(dest.c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  uint64_t missing_bytes = 0;
+  for (uint32_t i = 0; i < journal->ChunkCount(); i++) {
+    if (journal->IsChunkDone(i)) continue;
+    uint64_t start = static_cast<uint64_t>(i) * chunk;
+    missing_bytes += std::min<uint64_t>(chunk, id.file_size - start);
+    ASSERT_TRUE(FetchChunk(server.port(), fd, journal.get(), i, id.file_size));
+  }
+  close(fd);
+  EXPECT_EQ(journal->CompletedChunks(), journal->ChunkCount());
+  EXPECT_EQ(missing_bytes, id.file_size - static_cast<uint64_t>(done) * chunk);
+
+  // The stitched file hashes the same as the source.
+  std::ifstream in(dest, std::ios::binary);
+  std::vector<uint8_t> got((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+  ASSERT_EQ(got.size(), source.size());
+  Digest want_digest;
+  Digest got_digest;
+  Blake3::Hash(source.data(), source.size(), want_digest.data());
+  Blake3::Hash(got.data(), got.size(), got_digest.data());
+  EXPECT_EQ(got_digest, want_digest);
+
+  journal.reset();
+  ResumeJournal::Remove(jpath);
+  std::remove(dest.c_str());
+}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,98 @@
+#include "screen_capture.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace zapshare {
+namespace {
+
+// A BGRX screen with |padding| spare bytes at the end of each row.
+struct Screen {
+  std::vector<uint8_t> pixels;
+  int width;
+  int height;
+  size_t stride;
+
+  Screen(int w, int h, size_t padding = 0)
+      : width(w), height(h), stride(static_cast<size_t>(w) * 4 + padding) {
+    pixels.assign(stride * h, 0);
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        uint8_t* p = At(x, y);
+        p[0] = static_cast<uint8_t>(x);
+        p[1] = static_cast<uint8_t>(y);
+        p[2] = static_cast<uint8_t>(x ^ y);
+      }
+    }
+  }
+
+  uint8_t* At(int x, int y) { return &pixels[stride * y + x * 4]; }
+
+  ScreenFrame Frame() const {
+    ScreenFrame frame;
+    frame.pixels = pixels.data();
+    frame.width = width;
+    frame.height = height;
+    frame.stride = stride;
+    return frame;
+  }
+};
+
+TEST(TileDifferTest, FirstFrameIsAllDirty) {
+  Screen screen(200, 130);
+  TileDiffer differ;
+  EXPECT_EQ(differ.Diff(screen.Frame()), 4u * 3u);
+  EXPECT_EQ(differ.columns(), 4);
+  EXPECT_EQ(differ.rows(), 3);
+  EXPECT_TRUE(differ.dirty(3, 2));
+}
+
+TEST(TileDifferTest, UnchangedFrameHasNoDirtyTiles) {
+  Screen screen(200, 130);
+  TileDiffer differ;
+  differ.Diff(screen.Frame());
+  EXPECT_EQ(differ.Diff(screen.Frame()), 0u);
+  for (uint8_t dirty : differ.dirty()) EXPECT_EQ(dirty, 0);
+}
+
+TEST(TileDifferTest, MarksOnlyTheChangedTiles) {
+  Screen screen(200, 130);
+  TileDiffer differ;
+  differ.Diff(screen.Frame());
+
+  screen.At(130, 70)[0] ^= 1;   // Tile (2, 1).
+  screen.At(199, 129)[1] ^= 1;  // The partial corner tile, (3, 2).
+  EXPECT_EQ(differ.Diff(screen.Frame()), 2u);
+  EXPECT_TRUE(differ.dirty(2, 1));
+  EXPECT_TRUE(differ.dirty(3, 2));
+  EXPECT_FALSE(differ.dirty(1, 1));
+  EXPECT_FALSE(differ.dirty(2, 0));
+
+  // The change is now the previous frame.
+  EXPECT_EQ(differ.Diff(screen.Frame()), 0u);
+}
+
+TEST(TileDifferTest, IgnoresRowPadding) {
+  Screen screen(100, 70, 32);
+  TileDiffer differ;
+  differ.Diff(screen.Frame());
+  screen.pixels[screen.stride - 1] = 0xAA;  // Past the last pixel.
+  EXPECT_EQ(differ.Diff(screen.Frame()), 0u);
+}
+
+TEST(TileDifferTest, SizeChangeAndInvalidateMarkEverything) {
+  Screen screen(128, 128);
+  TileDiffer differ;
+  differ.Diff(screen.Frame());
+  differ.Invalidate();
+  EXPECT_EQ(differ.Diff(screen.Frame()), 4u);
+
+  Screen larger(192, 128);
+  EXPECT_EQ(differ.Diff(larger.Frame()), 6u);
+  EXPECT_EQ(differ.columns(), 3);
+}
+
+}  // namespace
+}  // namespace zapshare
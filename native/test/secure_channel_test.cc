@@ -0,0 +1,226 @@
+#include "secure_channel.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+namespace zapshare {
+namespace {
+
+using test::FromHex;
+using test::Random;
+
+std::vector<uint8_t> X(const std::string& scalar, const std::string& point) {
+  std::vector<uint8_t> out(kX25519Size);
+  EXPECT_TRUE(X25519(out.data(), FromHex(scalar).data(),
+                     FromHex(point).data()));
+  return out;
+}
+
+TEST(X25519Test, MatchesRfc7748) {
+  EXPECT_EQ(
+      X("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+        "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c"),
+      FromHex(
+          "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552"));
+  EXPECT_EQ(
+      X("4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+        "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493"),
+      FromHex(
+          "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957"));
+
+  const std::string base(
+      "0900000000000000000000000000000000000000000000000000000000000000");
+  const std::string alice(
+      "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+  const std::string bob(
+      "5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb");
+  const std::string alice_public(
+      "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a");
+  const std::string bob_public(
+      "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f");
+  const std::vector<uint8_t> shared = FromHex(
+      "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742");
+  EXPECT_EQ(X(alice, base), FromHex(alice_public));
+  EXPECT_EQ(X(bob, base), FromHex(bob_public));
+  EXPECT_EQ(X(alice, bob_public), shared);
+  EXPECT_EQ(X(bob, alice_public), shared);
+}
+
+TEST(X25519Test, RejectsSmallOrderPoints) {
+  const std::vector<uint8_t> scalar = Random(kX25519Size, 1);
+  const std::vector<uint8_t> zero(kX25519Size, 0);
+  std::vector<uint8_t> one(kX25519Size, 0);
+  one[0] = 1;
+  uint8_t out[kX25519Size];
+  EXPECT_FALSE(X25519(out, scalar.data(), zero.data()));
+  EXPECT_FALSE(X25519(out, scalar.data(), one.data()));
+}
+
+TEST(X25519Test, MappedPointsAgree) {
+  // Diffie-Hellman over a mapped generator works like over the base point.
+  const std::vector<uint8_t> hash = Random(kX25519Size, 2);
+  uint8_t g[kX25519Size];
+  X25519MapToCurve(g, hash.data());
+  uint8_t g2[kX25519Size];
+  X25519MapToCurve(g2, Random(kX25519Size, 3).data());
+  EXPECT_NE(std::memcmp(g, g2, kX25519Size), 0);
+
+  const std::vector<uint8_t> a = Random(kX25519Size, 4);
+  const std::vector<uint8_t> b = Random(kX25519Size, 5);
+  uint8_t ya[kX25519Size], yb[kX25519Size], ka[kX25519Size], kb[kX25519Size];
+  ASSERT_TRUE(X25519(ya, a.data(), g));
+  ASSERT_TRUE(X25519(yb, b.data(), g));
+  ASSERT_TRUE(X25519(ka, a.data(), yb));
+  ASSERT_TRUE(X25519(kb, b.data(), ya));
+  EXPECT_EQ(std::memcmp(ka, kb, kX25519Size), 0);
+}
+
+// Runs the handshake between two channels, optionally letting |tamper|
+// change bytes on the wire.
+struct Pair {
+  SecureChannel client;
+  SecureChannel server;
+
+  Pair(const std::string& client_code, const std::string& server_code,
+       uint32_t client_ciphers = ~0u, uint32_t server_ciphers = ~0u)
+      : client(SecureChannel::Role::kClient, Bytes(client_code),
+               client_code.size(), Random(kSecureEntropySize, 10).data(),
+               client_ciphers),
+        server(SecureChannel::Role::kServer, Bytes(server_code),
+               server_code.size(), Random(kSecureEntropySize, 11).data(),
+               server_ciphers) {}
+
+  static const uint8_t* Bytes(const std::string& s) {
+    return reinterpret_cast<const uint8_t*>(s.data());
+  }
+
+  // Moves handshake bytes until neither side has anything to say, feeding
+  // them |piece| bytes at a time.
+  void Run(size_t piece = 1000, int flip = -1) {
+    int sent = 0;
+    for (int round = 0; round < 4; round++) {
+      for (auto [from, to] : {std::pair{&client, &server},
+                              std::pair{&server, &client}}) {
+        std::vector<uint8_t> buf(from->Pending());
+        from->Read(buf.data(), buf.size());
+        for (uint8_t& b : buf) {
+          if (sent++ == flip) b ^= 1;
+        }
+        for (size_t i = 0; i < buf.size(); i += piece) {
+          const size_t n = std::min(piece, buf.size() - i);
+          EXPECT_EQ(to->Receive(buf.data() + i, n), n);
+        }
+      }
+    }
+  }
+};
+
+TEST(SecureChannelTest, HandshakeAgreesOnKeys) {
+  for (size_t piece : {1, 7, 1000}) {
+    Pair p("0a1b2c3d4e5", "0a1b2c3d4e5");
+    p.Run(piece);
+    ASSERT_TRUE(p.client.established());
+    ASSERT_TRUE(p.server.established());
+    EXPECT_EQ(p.client.cipher(), p.server.cipher());
+
+    std::vector<uint8_t> record(kSecureRecordOverhead + 5);
+    std::memcpy(record.data() + kSecureRecordHeader, "hello", 5);
+    ASSERT_EQ(p.client.Seal(record.data(), 5), record.size());
+    EXPECT_NE(std::memcmp(record.data() + kSecureRecordHeader, "hello", 5),
+              0);
+    EXPECT_EQ(SecureChannel::RecordSize(record.data()), record.size());
+    ASSERT_TRUE(p.server.Open(record.data(), record.size()));
+    EXPECT_EQ(std::memcmp(record.data() + kSecureRecordHeader, "hello", 5),
+              0);
+  }
+}
+
+TEST(SecureChannelTest, FallsBackToChaCha) {
+  const uint32_t chacha =
+      static_cast<uint32_t>(AeadCipher::kChaCha20Poly1305);
+  Pair p("code", "code", ~0u, chacha);
+  p.Run();
+  ASSERT_TRUE(p.client.established());
+  EXPECT_EQ(p.client.cipher(), AeadCipher::kChaCha20Poly1305);
+  EXPECT_EQ(p.server.cipher(), AeadCipher::kChaCha20Poly1305);
+}
+
+TEST(SecureChannelTest, WrongCodeFails) {
+  Pair p("0a1b2c3d4e5", "0a1b2c3d4e6");
+  p.Run();
+  EXPECT_TRUE(p.client.failed());
+  EXPECT_FALSE(p.server.established());
+  std::vector<uint8_t> record(kSecureRecordOverhead);
+  EXPECT_EQ(p.client.Seal(record.data(), 0), 0u);
+}
+
+TEST(SecureChannelTest, TamperedHandshakeFails) {
+  // Flip one bit in each byte position of C1 and S1 in turn.
+  for (int flip = 0; flip < 70 + 97; flip += 11) {
+    Pair p("code", "code");
+    p.Run(1000, flip);
+    EXPECT_FALSE(p.client.established() && p.server.established())
+        << "flipped byte " << flip;
+  }
+}
+
+TEST(SecureChannelTest, RejectsOtherProtocols) {
+  SecureChannel server(SecureChannel::Role::kServer,
+                       reinterpret_cast<const uint8_t*>("c"), 1,
+                       Random(kSecureEntropySize, 1).data(), ~0u);
+  std::vector<uint8_t> request(100, ' ');
+  std::memcpy(request.data(), "ZSM2", 4);
+  server.Receive(request.data(), request.size());
+  EXPECT_TRUE(server.failed());
+}
+
+TEST(SecureChannelTest, RecordsCannotBeReplayedOrReordered) {
+  Pair p("code", "code");
+  p.Run();
+  ASSERT_TRUE(p.server.established());
+
+  const std::vector<uint8_t> plain = Random(70000, 3);
+  std::vector<std::vector<uint8_t>> records;
+  for (int i = 0; i < 3; i++) {
+    std::vector<uint8_t> r(plain.size() + kSecureRecordOverhead);
+    std::memcpy(r.data() + kSecureRecordHeader, plain.data(), plain.size());
+    ASSERT_EQ(p.server.Seal(r.data(), plain.size()), r.size());
+    records.push_back(r);
+  }
+  EXPECT_NE(records[0], records[1]);
+
+  std::vector<uint8_t> r = records[0];
+  ASSERT_TRUE(p.client.Open(r.data(), r.size()));
+  EXPECT_TRUE(std::equal(plain.begin(), plain.end(),
+                         r.begin() + kSecureRecordHeader));
+  // Record 0 again, then record 2 before 1: both fail.
+  r = records[0];
+  EXPECT_FALSE(p.client.Open(r.data(), r.size()));
+  EXPECT_TRUE(p.client.failed());
+
+  Pair q("code", "code");
+  q.Run();
+  std::vector<uint8_t> a(kSecureRecordOverhead + 1);
+  std::vector<uint8_t> b(kSecureRecordOverhead + 1);
+  q.client.Seal(a.data(), 1);
+  q.client.Seal(b.data(), 1);
+  EXPECT_FALSE(q.server.Open(b.data(), b.size()));
+}
+
+TEST(SecureChannelTest, RecordSizeRejectsBadHeaders) {
+  uint8_t header[4] = {15, 0, 0, 0};
+  EXPECT_EQ(SecureChannel::RecordSize(header), 0u);
+  header[0] = 16;
+  EXPECT_EQ(SecureChannel::RecordSize(header), 20u);
+  header[0] = 0xFF;
+  header[3] = 0x7F;
+  EXPECT_EQ(SecureChannel::RecordSize(header), 0u);
+}
+
+}  // namespace
+}  // namespace zapshare
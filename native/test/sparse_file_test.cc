@@ -0,0 +1,232 @@
+#include "sparse_file.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "range_receiver.h"
+#include "test_util.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr uint64_t kMiB = 1024 * 1024;
+
+using test::TempPath;
+
+TEST(SparseFileTest, MapRoundTrip) {
+  const std::vector<Extent> extents = {{0, 100}, {1 << 20, 4096}};
+  const std::vector<uint8_t> map = EncodeExtentMap(10 << 20, extents);
+  EXPECT_EQ(map.size(), kExtentMapHeaderSize + 2 * kExtentMapEntrySize);
+  uint64_t size = 0;
+  std::vector<Extent> decoded;
+  ASSERT_TRUE(DecodeExtentMap(map.data(), map.size(), &size, &decoded));
+  EXPECT_EQ(size, 10u << 20);
+  EXPECT_EQ(decoded, extents);
+  EXPECT_EQ(DataBytes(decoded), 4196u);
+}
+
+TEST(SparseFileTest, MalformedMapsAreRejected) {
+  uint64_t size;
+  std::vector<Extent> out;
+  auto decodes = [&](uint64_t file_size, const std::vector<Extent>& e) {
+    const std::vector<uint8_t> map = EncodeExtentMap(file_size, e);
+    return DecodeExtentMap(map.data(), map.size(), &size, &out);
+  };
+  EXPECT_TRUE(decodes(100, {}));
+  EXPECT_FALSE(decodes(100, {{50, 0}}));             // Empty.
+  EXPECT_FALSE(decodes(100, {{50, 51}}));            // Past the end.
+  EXPECT_FALSE(decodes(100, {{20, 10}, {0, 5}}));    // Unsorted.
+  EXPECT_FALSE(decodes(100, {{0, 10}, {5, 10}}));    // Overlapping.
+  EXPECT_FALSE(decodes(100, {{0, 10}, {10, 10}}));   // Touching.
+  EXPECT_FALSE(decodes(~0ull, {{~0ull - 1, 10}}));   // Overflowing.
+
+  std::vector<uint8_t> map = EncodeExtentMap(100, {{0, 10}});
+  EXPECT_FALSE(DecodeExtentMap(map.data(), map.size() - 1, &size, &out));
+  map[0] = 'X';
+  EXPECT_FALSE(DecodeExtentMap(map.data(), map.size(), &size, &out));
+}
+
+TEST(SparseFileTest, AlignExtentsRoundsOutAndMerges) {
+  const uint64_t chunk = 4 * kMiB;
+  const std::vector<Extent> aligned = AlignExtents(
+      {{100, 10}, {chunk - 1, 2}, {5 * chunk, 1}, {9 * chunk + 5, 10}},
+      chunk, 9 * chunk + 100);
+  const std::vector<Extent> want = {
+      {0, 2 * chunk}, {5 * chunk, chunk}, {9 * chunk, 100}};
+  EXPECT_EQ(aligned, want);
+}
+
+#if !defined(_WIN32)
+
+std::vector<uint8_t> Pattern(size_t len, uint8_t seed) {
+  std::vector<uint8_t> v(len);
+  for (size_t i = 0; i < len; i++) {
+    v[i] = static_cast<uint8_t>(i * 131 + seed) | 1;  // Never zero.
+  }
+  return v;
+}
+
+void WriteAt(const std::string& path, uint64_t offset,
+             const std::vector<uint8_t>& data) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset)),
+            static_cast<ssize_t>(data.size()));
+  close(fd);
+}
+
+uint64_t AllocatedBytes(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return 0;
+  return static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+// What a receiver does with a map: lay out the holes, then write the data
+// it was sent at the extents' offsets.
+void CopyExtents(const std::string& from, const std::string& to,
+                 const std::vector<Extent>& extents) {
+  const int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  const int out = open(to.c_str(), O_WRONLY | O_CLOEXEC);
+  ASSERT_GE(in, 0);
+  ASSERT_GE(out, 0);
+  std::vector<uint8_t> buf(kMiB);
+  for (const Extent& e : extents) {
+    for (uint64_t at = e.offset; at < e.end();) {
+      const size_t n =
+          static_cast<size_t>(std::min<uint64_t>(buf.size(), e.end() - at));
+      ASSERT_EQ(pread(in, buf.data(), n, static_cast<off_t>(at)),
+                static_cast<ssize_t>(n));
+      ASSERT_EQ(pwrite(out, buf.data(), n, static_cast<off_t>(at)),
+                static_cast<ssize_t>(n));
+      at += n;
+    }
+  }
+  close(in);
+  close(out);
+}
+
+TEST(SparseFileTest, TenGigabytesWithAHundredMegabytesOfData) {
+  const uint64_t size = 10ull * 1024 * kMiB;
+  const std::string source = TempPath("source");
+  const std::string dest = TempPath("dest");
+  {
+    std::ofstream create(source, std::ios::binary);
+  }
+  fs::resize_file(source, size);
+
+  // Ten 10 MiB runs spread over the file, the last one at the very end.
+  std::vector<Extent> written;
+  for (uint64_t i = 0; i < 10; i++) {
+    const uint64_t offset = i == 9 ? size - 10 * kMiB : i * 1000 * kMiB;
+    WriteAt(source, offset, Pattern(10 * kMiB, static_cast<uint8_t>(i)));
+    written.push_back({offset, 10 * kMiB});
+  }
+
+  uint64_t found_size = 0;
+  std::vector<Extent> extents;
+  if (!FileDataExtents(source, &found_size, &extents) ||
+      DataBytes(extents) == size) {
+    fs::remove(source);
+    GTEST_SKIP() << "File system doesn't report holes";
+  }
+  EXPECT_EQ(found_size, size);
+  EXPECT_EQ(extents, written);
+  EXPECT_EQ(DataBytes(extents), 100 * kMiB);
+
+  const std::vector<uint8_t> map = EncodeExtentMap(size, extents);
+  EXPECT_LT(map.size(), 256u);
+  uint64_t map_size = 0;
+  std::vector<Extent> received;
+  ASSERT_TRUE(DecodeExtentMap(map.data(), map.size(), &map_size, &received));
+
+  ASSERT_TRUE(PrepareSparseFile(dest, map_size, received));
+  CopyExtents(source, dest, received);
+
+  EXPECT_EQ(fs::file_size(dest), size);
+  EXPECT_LT(AllocatedBytes(dest), 110 * kMiB);
+  std::vector<Extent> dest_extents;
+  ASSERT_TRUE(FileDataExtents(dest, &found_size, &dest_extents));
+  EXPECT_EQ(dest_extents, written);
+
+  // Holes read back as zeros; data as written.
+  std::ifstream in(dest, std::ios::binary);
+  std::vector<char> got(10 * kMiB);
+  in.seekg(static_cast<std::streamoff>(500 * kMiB));
+  in.read(got.data(), 4096);
+  EXPECT_EQ(std::vector<char>(got.begin(), got.begin() + 4096),
+            std::vector<char>(4096, 0));
+  in.seekg(static_cast<std::streamoff>(3000 * kMiB));
+  in.read(got.data(), static_cast<std::streamsize>(got.size()));
+  const std::vector<uint8_t> want = Pattern(10 * kMiB, 3);
+  EXPECT_TRUE(std::equal(want.begin(), want.end(),
+                         reinterpret_cast<uint8_t*>(got.data())));
+
+  fs::remove(source);
+  fs::remove(dest);
+}
+
+TEST(SparseFileTest, PrepareFreesAPreallocatedFile) {
+  const std::string path = TempPath("prealloc");
+  const uint64_t size = 64 * kMiB;
+  ASSERT_TRUE(PreallocateFile(path, size));
+  const std::vector<Extent> extents = {{8 * kMiB, kMiB}};
+  if (!PrepareSparseFile(path, size, extents)) {
+    GTEST_SKIP() << "File system can't punch holes";
+  }
+  EXPECT_EQ(fs::file_size(path), size);
+  EXPECT_LE(AllocatedBytes(path), 2 * kMiB);
+}
+
+TEST(SparseFileTest, DenseFileIsOneExtent) {
+  const std::string path = TempPath("dense");
+  WriteAt(path, 0, Pattern(300 * 1024, 1));
+  uint64_t size = 0;
+  std::vector<Extent> extents;
+  ASSERT_TRUE(FileDataExtents(path, &size, &extents));
+  const std::vector<Extent> want = {{0, 300 * 1024}};
+  EXPECT_EQ(extents, want);
+
+  uint8_t map[64];
+  EXPECT_EQ(zs_extent_map(path.c_str(), map, sizeof(map)), 0);
+  EXPECT_EQ(zs_extent_map(TempPath("missing").c_str(), map, sizeof(map)), -1);
+}
+
+TEST(SparseFileTest, ShortHolesFoldIntoData) {
+  const std::string path = TempPath("short_holes");
+  WriteAt(path, 0, Pattern(4096, 1));
+  WriteAt(path, 4096 + 16 * 1024, Pattern(4096, 2));  // Under kMinSparseHole.
+  WriteAt(path, 8 * kMiB, Pattern(4096, 3));
+  uint64_t size = 0;
+  std::vector<Extent> extents;
+  ASSERT_TRUE(FileDataExtents(path, &size, &extents));
+  if (extents.size() == 1) GTEST_SKIP() << "File system doesn't report holes";
+  const std::vector<Extent> want = {{0, 8192 + 16 * 1024},
+                                    {8 * kMiB, 4096}};
+  EXPECT_EQ(extents, want);
+
+  uint8_t small[8];
+  const int64_t len = zs_extent_map(path.c_str(), small, sizeof(small));
+  ASSERT_EQ(len, 48);
+  std::vector<uint8_t> map(static_cast<size_t>(len));
+  ASSERT_EQ(zs_extent_map(path.c_str(), map.data(), map.size()), len);
+  const std::string copy = TempPath("short_holes_copy");
+  EXPECT_EQ(zs_prepare_sparse_file(copy.c_str(), map.data(), map.size()), 1);
+  EXPECT_EQ(fs::file_size(copy), size);
+}
+
+#endif
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,351 @@
+#ifndef ZAPSHARE_NATIVE_TEST_UTIL_H_
+#define ZAPSHARE_NATIVE_TEST_UTIL_H_
+
+// Helpers shared by the native tests: scratch files, waiting on readers'
+// Notify(), and a loopback HTTP server that answers Range requests the way
+// the sender's HttpServer does.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace zapshare {
+namespace test {
+
+inline std::vector<uint8_t> Random(size_t len, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> v(len);
+  for (uint8_t& b : v) b = static_cast<uint8_t>(rng());
+  return v;
+}
+
+// "00ff..." as bytes.
+inline std::vector<uint8_t> FromHex(const std::string& hex) {
+  std::vector<uint8_t> out(hex.size() / 2);
+  for (size_t i = 0; i < out.size(); i++) {
+    out[i] =
+        static_cast<uint8_t>(std::stoi(hex.substr(2 * i, 2), nullptr, 16));
+  }
+  return out;
+}
+
+// A path under the test temp dir named after the running suite, so
+// binaries running side by side don't share files. Whatever was there is
+// removed.
+inline std::string TempPath(const std::string& name) {
+  const ::testing::TestInfo* info =
+      ::testing::UnitTest::GetInstance()->current_test_info();
+  std::string suite = info != nullptr ? info->test_suite_name() : "test";
+  std::replace(suite.begin(), suite.end(), '/', '_');
+  const std::filesystem::path path =
+      std::filesystem::path(::testing::TempDir()) /
+      ("zs_" + suite + "_" + name);
+  std::error_code ignored;
+  std::filesystem::remove(path, ignored);
+  return path.string();
+}
+
+// TempPath(|name|) holding |data|.
+inline std::string WriteTemp(const std::string& name,
+                             const std::vector<uint8_t>& data) {
+  const std::string path = TempPath(name);
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(data.data()),
+            static_cast<std::streamsize>(data.size()));
+  return path;
+}
+
+inline std::vector<uint8_t> ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {});
+}
+
+// Blocks until |reader|, a FanoutReader, ReadAhead or DiscoveryEngine,
+// says its next read is worth trying. False if it hasn't within a few
+// seconds.
+template <typename Reader>
+bool AwaitReady(Reader* reader) {
+  struct Signal {
+    std::mutex mu;
+    std::condition_variable cv;
+    bool fired = false;
+  };
+  auto signal = std::make_shared<Signal>();
+  reader->Notify([signal] {
+    std::lock_guard<std::mutex> lock(signal->mu);
+    signal->fired = true;
+    signal->cv.notify_all();
+  });
+  std::unique_lock<std::mutex> lock(signal->mu);
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!signal->fired) {
+    if (signal->cv.wait_until(lock, deadline) == std::cv_status::timeout) {
+      return signal->fired;
+    }
+  }
+  return true;
+}
+
+#if !defined(_WIN32)
+
+// Serves |data| as "/file/0" over loopback HTTP, a thread per connection
+// and one response each. "Range: bytes=a-b" gets a 206 of exactly that;
+// otherwise the whole of it comes back with a 200. The header goes out
+// with the first body bytes in one segment, as real servers send it.
+class RangeServer {
+ public:
+  enum class Behavior {
+    kNormal,
+    kNotFound,    // 404 to everything.
+    kCloseEarly,  // Hangs up halfway through the body.
+    kChunked,     // Claims a chunked body.
+    kNoRanges,    // Ignores Range and sends a 200 from byte 0.
+  };
+
+  struct Options {
+    Behavior behavior = Behavior::kNormal;
+    // Any address in 127/8, which on Linux is all loopback.
+    std::string address = "127.0.0.1";
+    uint16_t port = 0;  // 0 for any free one.
+    // Shared by every connection; 0 for as fast as loopback goes.
+    uint64_t bytes_per_second = 0;
+  };
+
+  explicit RangeServer(const std::vector<uint8_t>& data)
+      : RangeServer(data, Options()) {}
+
+  RangeServer(const std::vector<uint8_t>& data, Options options)
+      : data_(data), options_(std::move(options)) {
+    listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options_.port);
+    inet_pton(AF_INET, options_.address.c_str(), &addr.sin_addr);
+    socklen_t len = sizeof(addr);
+    bound_ = bind(listen_, reinterpret_cast<sockaddr*>(&addr), len) == 0;
+    listen(listen_, 16);
+    getsockname(listen_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread(&RangeServer::Run, this);
+  }
+
+  ~RangeServer() {
+    stop_ = true;
+    shutdown(listen_, SHUT_RDWR);
+    close(listen_);
+    thread_.join();
+    for (std::thread& t : connections_) t.join();
+  }
+
+  RangeServer(const RangeServer&) = delete;
+  RangeServer& operator=(const RangeServer&) = delete;
+
+  bool bound() const { return bound_; }
+  uint16_t port() const { return port_; }
+
+  std::string last_request() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return last_request_;
+  }
+
+  // Addresses connections came from, in order.
+  std::vector<std::string> peers() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return peers_;
+  }
+
+  // Cuts every connection at its next write and refuses new ones.
+  void Drop() { down_ = true; }
+
+ private:
+  void Run() {
+    for (;;) {
+      sockaddr_in peer{};
+      socklen_t len = sizeof(peer);
+      const int fd =
+          accept(listen_, reinterpret_cast<sockaddr*>(&peer), &len);
+      if (fd < 0) return;
+      char from[INET_ADDRSTRLEN] = {};
+      inet_ntop(AF_INET, &peer.sin_addr, from, sizeof(from));
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        peers_.push_back(from);
+      }
+      if (down_) {
+        close(fd);
+        continue;
+      }
+      connections_.emplace_back([this, fd] {
+        Serve(fd);
+        close(fd);
+      });
+    }
+  }
+
+  void Serve(int fd) {
+    std::string req;
+    char buf[1024];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+      const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0) return;
+      req.append(buf, static_cast<size_t>(n));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      last_request_ = req;
+    }
+    const Behavior behavior = options_.behavior;
+    if (behavior == Behavior::kNotFound) {
+      const std::string head =
+          "HTTP/1.1 404 Not Found\r\ncontent-length: 0\r\n\r\n";
+      Send(fd, head.data(), head.size());
+      return;
+    }
+    size_t start = 0;
+    size_t end = data_.size();
+    const size_t range = req.find("Range: bytes=");
+    const bool ranged =
+        range != std::string::npos && behavior != Behavior::kNoRanges;
+    if (ranged) {
+      start = std::stoul(req.substr(range + 13));
+      end = std::stoul(req.substr(req.find('-', range) + 1)) + 1;
+    }
+    std::string head =
+        ranged ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+    head += behavior == Behavior::kChunked
+                ? "transfer-encoding: chunked\r\n"
+                : "content-length: " + std::to_string(end - start) + "\r\n";
+    head += "accept-ranges: bytes\r\n\r\n";
+    const size_t lead = std::min<size_t>(1000, end - start);
+    head.append(reinterpret_cast<const char*>(data_.data() + start), lead);
+    if (!Send(fd, head.data(), head.size())) return;
+    if (behavior == Behavior::kCloseEarly) end = start + (end - start) / 2;
+    constexpr size_t kSlice = 64 * 1024;
+    for (size_t at = start + lead; at < end;) {
+      const size_t n = std::min(kSlice, end - at);
+      Pace(n);
+      if (down_ || stop_) return;
+      if (!Send(fd, data_.data() + at, n)) return;
+      at += n;
+    }
+  }
+
+  static bool Send(int fd, const void* p, size_t len) {
+    const char* c = static_cast<const char*>(p);
+    while (len > 0) {
+      const ssize_t n = send(fd, c, len, MSG_NOSIGNAL);
+      if (n <= 0) return false;
+      c += n;
+      len -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  // Token bucket shared by the server's connections.
+  void Pace(size_t bytes) {
+    if (options_.bytes_per_second == 0) return;
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point due;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      const Clock::time_point now = Clock::now();
+      if (next_ < now) next_ = now;
+      next_ += std::chrono::nanoseconds(bytes * 1'000'000'000ull /
+                                        options_.bytes_per_second);
+      due = next_;
+    }
+    std::this_thread::sleep_until(due);
+  }
+
+  const std::vector<uint8_t>& data_;
+  const Options options_;
+  int listen_;
+  bool bound_ = false;
+  uint16_t port_ = 0;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> down_{false};
+  mutable std::mutex mu_;
+  std::string last_request_;
+  std::vector<std::string> peers_;
+  std::chrono::steady_clock::time_point next_;
+  std::vector<std::thread> connections_;  // Only touched by Run().
+  std::thread thread_;
+};
+
+// Fetches [start, end) of |port|'s "/file/0" with a plain blocking Range
+// request, handing the body to |sink| as it arrives along with where in
+// the file it goes. False unless the whole range came back.
+inline bool GetRange(
+    uint16_t port, uint64_t start, uint64_t end,
+    const std::function<bool(uint64_t offset, const uint8_t* data,
+                             size_t len)>& sink) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return false;
+  }
+  const std::string req = "GET /file/0 HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                          "Range: bytes=" + std::to_string(start) + "-" +
+                          std::to_string(end - 1) + "\r\n\r\n";
+  send(fd, req.data(), req.size(), MSG_NOSIGNAL);
+  std::string head;
+  std::vector<uint8_t> buf(16384);
+  uint64_t at = start;
+  bool ok = true;
+  while (ok && at < end) {
+    const ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+    if (n <= 0) break;
+    const uint8_t* body = buf.data();
+    size_t len = static_cast<size_t>(n);
+    if (head.find("\r\n\r\n") == std::string::npos) {
+      head.append(reinterpret_cast<const char*>(body), len);
+      const size_t blank = head.find("\r\n\r\n");
+      if (blank == std::string::npos) continue;
+      if (head.compare(0, 12, "HTTP/1.1 206") != 0) break;
+      const size_t taken = head.size() - (blank + 4);
+      body += len - taken;
+      len = taken;
+    }
+    len = static_cast<size_t>(std::min<uint64_t>(len, end - at));
+    if (len > 0) ok = sink(at, body, len);
+    at += len;
+  }
+  close(fd);
+  return ok && at == end;
+}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace test
+}  // namespace zapshare
+
+#endif  // ZAPSHARE_NATIVE_TEST_UTIL_H_
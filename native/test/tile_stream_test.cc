@@ -0,0 +1,313 @@
+#include "tile_stream.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#if __has_include(<jpeglib.h>)
+#define ZS_TEST_HAVE_JPEG 1
+#endif
+
+namespace zapshare {
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+// A BGRX screen: flat grey, with noise in the tiles Noise() fills.
+struct Screen {
+  Bytes pixels;
+  int width;
+  int height;
+
+  Screen(int w, int h) : width(w), height(h) {
+    pixels.assign(static_cast<size_t>(w) * h * 4, 0x80);
+  }
+
+  uint8_t* At(int x, int y) {
+    return &pixels[(static_cast<size_t>(y) * width + x) * 4];
+  }
+
+  void Fill(int x, int y, int w, int h, uint8_t b, uint8_t g, uint8_t r) {
+    for (int j = y; j < y + h; j++) {
+      for (int i = x; i < x + w; i++) {
+        At(i, j)[0] = b;
+        At(i, j)[1] = g;
+        At(i, j)[2] = r;
+      }
+    }
+  }
+
+  void Noise(int column, int row, unsigned seed) {
+    for (int j = row * 64; j < row * 64 + 64 && j < height; j++) {
+      for (int i = column * 64; i < column * 64 + 64 && i < width; i++) {
+        seed = seed * 1103515245 + 12345;
+        At(i, j)[0] = static_cast<uint8_t>(seed >> 16);
+        At(i, j)[1] = static_cast<uint8_t>(seed >> 8);
+        At(i, j)[2] = static_cast<uint8_t>(seed >> 24);
+      }
+    }
+  }
+
+  ScreenFrame Frame() const {
+    ScreenFrame frame;
+    frame.pixels = pixels.data();
+    frame.width = width;
+    frame.height = height;
+    frame.stride = static_cast<size_t>(width) * 4;
+    return frame;
+  }
+};
+
+TEST(TileStreamReaderTest, CutsFramesFedByteByByte) {
+  Bytes stream = {'Z', 'S', 'T', '1', 2, 0, 0xAB, 0xCD};
+  TileSnapshot snapshot;
+  snapshot.sequence = 7;
+  snapshot.resized = 1;
+  snapshot.width = 100;
+  snapshot.height = 70;
+  snapshot.columns = 2;
+  snapshot.rows = 2;
+  snapshot.tiles.resize(4);
+  auto tile = std::make_shared<EncodedTile>();
+  tile->encoding = TileEncoding::kLossless;
+  tile->payload = {1, 2, 3};
+  tile->version = 7;
+  snapshot.tiles[3] = tile;
+  auto old = std::make_shared<EncodedTile>();
+  old->payload = {9};
+  old->version = 2;
+  snapshot.tiles[0] = old;
+  EXPECT_EQ(WriteTileFrame(snapshot, 5, &stream), 1u);
+  EXPECT_EQ(WriteTileFrame(snapshot, 0, &stream), 2u);
+
+  TileStreamReader reader;
+  std::vector<TileFrame> frames;
+  for (uint8_t byte : stream) {
+    reader.Feed(&byte, 1);
+    TileFrame frame;
+    while (reader.Next(&frame)) {
+      // The tiles point into the reader's buffer: check them now.
+      if (frames.empty()) {
+        ASSERT_EQ(frame.tiles.size(), 1u);
+        EXPECT_EQ(frame.tiles[0].column, 1);
+        EXPECT_EQ(frame.tiles[0].row, 1);
+        EXPECT_EQ(frame.tiles[0].encoding, TileEncoding::kLossless);
+        EXPECT_EQ(Bytes(frame.tiles[0].data,
+                        frame.tiles[0].data + frame.tiles[0].size),
+                  tile->payload);
+      }
+      frames.push_back(frame);
+    }
+  }
+  ASSERT_EQ(frames.size(), 2u);
+  EXPECT_EQ(reader.tables(), (Bytes{0xAB, 0xCD}));
+  EXPECT_EQ(frames[0].sequence, 7u);
+  EXPECT_EQ(frames[0].base, 5u);
+  EXPECT_EQ(frames[0].width, 100);
+  EXPECT_EQ(frames[0].height, 70);
+  EXPECT_EQ(frames[1].base, 0u);
+  EXPECT_EQ(frames[1].tiles.size(), 2u);
+  EXPECT_FALSE(reader.failed());
+}
+
+TEST(TileStreamReaderTest, RejectsMalformedStreams) {
+  TileStreamReader not_tiles;
+  const Bytes mjpeg = {0xFF, 0xD8, 0xFF, 0xE0, 0, 0};
+  not_tiles.Feed(mjpeg.data(), mjpeg.size());
+  TileFrame frame;
+  EXPECT_FALSE(not_tiles.Next(&frame));
+  EXPECT_TRUE(not_tiles.failed());
+  EXPECT_FALSE(LooksLikeTileStream(mjpeg.data(), mjpeg.size()));
+
+  // One tile in a row a 64-pixel-high screen doesn't have.
+  TileStreamReader reader;
+  const Bytes bad = {'Z', 'S', 'T', '1', 0, 0, 1, 0, 0, 0, 0, 0, 0, 0,
+                     64, 0, 64, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+                     0, 0, 0};
+  EXPECT_TRUE(LooksLikeTileStream(bad.data(), bad.size()));
+  reader.Feed(bad.data(), bad.size());
+  EXPECT_FALSE(reader.Next(&frame));
+  EXPECT_TRUE(reader.failed());
+}
+
+#if defined(ZS_TEST_HAVE_JPEG)
+
+TEST(TileEncoderTest, EncodesWholeThenOnlyTheDirtyTiles) {
+  ASSERT_TRUE(TileEncoder::Available());
+  Screen screen(200, 130);  // 4 x 3 tiles, the last ones partial.
+  TileDiffer differ;
+  TileEncoder encoder;
+  differ.Diff(screen.Frame());
+  auto first = encoder.Update(screen.Frame(), differ);
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(first->sequence, 1u);
+  EXPECT_EQ(first->resized, 1u);
+  ASSERT_EQ(first->tiles.size(), 12u);
+  for (const auto& tile : first->tiles) {
+    ASSERT_NE(tile, nullptr);
+    EXPECT_EQ(tile->version, 1u);
+  }
+
+  screen.Fill(70, 70, 4, 4, 0, 0, 0xFF);  // Tile (1, 1).
+  ASSERT_EQ(differ.Diff(screen.Frame()), 1u);
+  auto second = encoder.Update(screen.Frame(), differ);
+  ASSERT_NE(second, nullptr);
+  EXPECT_EQ(second->sequence, 2u);
+  EXPECT_EQ(second->resized, 1u);
+  for (size_t i = 0; i < second->tiles.size(); i++) {
+    if (i == 5) {
+      EXPECT_EQ(second->tiles[i]->version, 2u);
+    } else {
+      EXPECT_EQ(second->tiles[i], first->tiles[i]) << i;
+    }
+  }
+
+  Bytes delta;
+  EXPECT_EQ(WriteTileFrame(*second, 1, &delta), 1u);
+  Bytes keyframe;
+  EXPECT_EQ(WriteTileFrame(*second, 0, &keyframe), 12u);
+  // Nothing newer than what the viewer has: a keepalive.
+  Bytes empty;
+  EXPECT_EQ(WriteTileFrame(*second, 2, &empty), 0u);
+  EXPECT_EQ(empty.size(), kTileFrameHeaderSize);
+}
+
+TEST(TileEncoderTest, SizeChangeMakesAKeyframe) {
+  TileEncoder encoder;
+  TileDiffer differ;
+  Screen small(64, 64);
+  differ.Diff(small.Frame());
+  ASSERT_NE(encoder.Update(small.Frame(), differ), nullptr);
+  Screen large(128, 64);
+  differ.Diff(large.Frame());
+  auto snapshot = encoder.Update(large.Frame(), differ);
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_EQ(snapshot->resized, 2u);
+  // A viewer still on the old size gets the whole screen.
+  Bytes frame;
+  EXPECT_EQ(WriteTileFrame(*snapshot, 1, &frame), 2u);
+  EXPECT_EQ(frame[4], 0);  // Base 0.
+}
+
+TEST(TileEncoderTest, FlatTilesGoLosslessAndNoiseAsJpeg) {
+  Screen screen(128, 64);
+  screen.Noise(1, 0, 3);
+  TileDiffer differ;
+  TileEncoder encoder;
+  differ.Diff(screen.Frame());
+  auto snapshot = encoder.Update(screen.Frame(), differ);
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_EQ(snapshot->tiles[0]->encoding, TileEncoding::kLossless);
+  EXPECT_LT(snapshot->tiles[0]->payload.size(), 200u);
+  EXPECT_EQ(snapshot->tiles[1]->encoding, TileEncoding::kJpeg);
+  EXPECT_EQ(encoder.stats().lossless_tiles, 1u);
+  EXPECT_EQ(encoder.stats().jpeg_tiles, 1u);
+  // JPEG tiles are abbreviated: no tables of their own.
+  const Bytes& jpeg = snapshot->tiles[1]->payload;
+  for (size_t i = 0; i + 1 < jpeg.size(); i++) {
+    ASSERT_FALSE(jpeg[i] == 0xFF && jpeg[i + 1] == 0xDB) << i;
+  }
+}
+
+// Encodes |screen| and draws it on a canvas through a stream.
+struct RoundTrip {
+  TileEncoder encoder;
+  TileDiffer differ;
+  TileCanvas canvas;
+  TileStreamReader reader;
+  uint32_t base = 0;
+
+  RoundTrip() {
+    reader.Feed(encoder.header().data(), encoder.header().size());
+  }
+
+  size_t Send(const Screen& screen, int target_width, int target_height) {
+    differ.Diff(screen.Frame());
+    auto snapshot = encoder.Update(screen.Frame(), differ);
+    Bytes frame;
+    WriteTileFrame(*snapshot, base, &frame);
+    base = snapshot->sequence;
+    reader.Feed(frame.data(), frame.size());
+    TileFrame parsed;
+    EXPECT_TRUE(reader.Next(&parsed));
+    if (canvas.width() == 0) {
+      EXPECT_TRUE(canvas.SetTables(reader.tables()));
+    }
+    for (const TileRecord& record : parsed.tiles) {
+      TileCanvas::Tile tile;
+      tile.encoding = record.encoding;
+      tile.payload.assign(record.data, record.data + record.size);
+      canvas.Put(parsed.width, parsed.height, false, record.column,
+                 record.row, std::move(tile));
+    }
+    return canvas.Draw(target_width, target_height);
+  }
+};
+
+bool Near(uint8_t a, uint8_t b, int tolerance) {
+  return std::abs(a - b) <= tolerance;
+}
+
+TEST(TileCanvasTest, DrawsTheScreenAtFullSize) {
+  Screen screen(150, 100);
+  screen.Fill(10, 10, 30, 5, 0x10, 0x20, 0x30);
+  screen.Noise(1, 0, 5);
+  RoundTrip trip;
+  ASSERT_EQ(trip.Send(screen, 0, 0), 0u);
+  ASSERT_EQ(trip.canvas.width(), 150);
+  ASSERT_EQ(trip.canvas.height(), 100);
+  const Bytes& rgba = trip.canvas.pixels();
+  auto check = [&](int x, int y, int tolerance) {
+    const uint8_t* p = &rgba[(static_cast<size_t>(y) * 150 + x) * 4];
+    const uint8_t* s = screen.At(x, y);
+    return Near(p[0], s[2], tolerance) && Near(p[1], s[1], tolerance) &&
+           Near(p[2], s[0], tolerance) && p[3] == 0xFF;
+  };
+  // Lossless tiles are exact.
+  for (int y = 0; y < 100; y++) {
+    for (int x = 0; x < 150; x++) {
+      if (x >= 64 && x < 128 && y < 64) continue;
+      ASSERT_TRUE(check(x, y, 0)) << x << "," << y;
+    }
+  }
+  // The noise went as JPEG: close, on average.
+  long error = 0;
+  for (int y = 0; y < 64; y++) {
+    for (int x = 64; x < 128; x++) {
+      const uint8_t* p = &rgba[(static_cast<size_t>(y) * 150 + x) * 4];
+      error += std::abs(p[1] - screen.At(x, y)[1]);
+    }
+  }
+  EXPECT_LT(error / (64 * 64), 64);
+
+  // A change lands on the canvas without the rest being sent again.
+  screen.Fill(140, 90, 10, 10, 0, 0, 0xFF);
+  ASSERT_EQ(trip.Send(screen, 0, 0), 0u);
+  EXPECT_TRUE(check(145, 95, 0));
+  EXPECT_TRUE(check(10, 10, 0));
+}
+
+TEST(TileCanvasTest, ScalesByPowersOfTwo) {
+  Screen screen(200, 100);
+  screen.Fill(0, 0, 200, 100, 0, 0xFF, 0);
+  screen.Noise(0, 0, 9);
+  RoundTrip trip;
+  // 90 x 45 needs 3.6/8 of 200 x 100, which rounds up to a half.
+  ASSERT_EQ(trip.Send(screen, 90, 45), 0u);
+  EXPECT_EQ(trip.canvas.width(), 100);
+  EXPECT_EQ(trip.canvas.height(), 50);
+  const uint8_t* p = &trip.canvas.pixels()[(10 * 100 + 80) * 4];
+  EXPECT_EQ(p[0], 0);
+  EXPECT_EQ(p[1], 0xFF);
+  // A new target redraws every tile at the new scale.
+  ASSERT_EQ(trip.canvas.Draw(0, 0), 0u);
+  EXPECT_EQ(trip.canvas.width(), 200);
+  EXPECT_EQ(trip.canvas.pixels().size(), 200u * 100u * 4u);
+}
+
+#endif  // defined(ZS_TEST_HAVE_JPEG)
+
+}  // namespace
+}  // namespace zapshare
@@ -0,0 +1,325 @@
+#include "zip_stream.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "crc32.h"
+#include "test_util.h"
+
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define ZS_TEST_HAVE_ZLIB 1
+#endif
+
+namespace zapshare {
+namespace {
+
+using test::Random;
+
+std::vector<uint8_t> Text(size_t len) {
+  const std::string line = "2026-10-18 12:00:00 INFO transfer chunk ok\n";
+  std::vector<uint8_t> v(len);
+  for (size_t i = 0; i < len; i++) v[i] = line[i % line.size()];
+  return v;
+}
+
+uint64_t Le(const std::vector<uint8_t>& b, size_t pos, int bytes) {
+  uint64_t v = 0;
+  for (int i = bytes - 1; i >= 0; i--) v = v << 8 | b[pos + i];
+  return v;
+}
+
+struct Parsed {
+  std::string name;
+  uint16_t method;
+  uint32_t crc;
+  uint64_t compressed;
+  uint64_t size;
+  uint64_t data_offset;
+};
+
+// Minimal reader: finds the central directory through the end records,
+// following the ZIP64 locator when there is one.
+std::vector<Parsed> ParseZip(const std::vector<uint8_t>& zip) {
+  std::vector<Parsed> out;
+  const size_t eocd = zip.size() - 22;
+  EXPECT_EQ(Le(zip, eocd, 4), 0x06054b50u);
+  uint64_t count = Le(zip, eocd + 10, 2);
+  uint64_t cd_offset = Le(zip, eocd + 16, 4);
+  if (eocd >= 20 && Le(zip, eocd - 20, 4) == 0x07064b50u) {
+    const size_t rec = static_cast<size_t>(Le(zip, eocd - 12, 8));
+    EXPECT_EQ(Le(zip, rec, 4), 0x06064b50u);
+    count = Le(zip, rec + 32, 8);
+    cd_offset = Le(zip, rec + 48, 8);
+  }
+  size_t pos = static_cast<size_t>(cd_offset);
+  for (uint64_t i = 0; i < count; i++) {
+    EXPECT_EQ(Le(zip, pos, 4), 0x02014b50u);
+    Parsed p;
+    p.method = static_cast<uint16_t>(Le(zip, pos + 10, 2));
+    p.crc = static_cast<uint32_t>(Le(zip, pos + 16, 4));
+    p.compressed = Le(zip, pos + 20, 4);
+    p.size = Le(zip, pos + 24, 4);
+    const size_t name_len = Le(zip, pos + 28, 2);
+    const size_t extra_len = Le(zip, pos + 30, 2);
+    uint64_t local = Le(zip, pos + 42, 4);
+    p.name.assign(zip.begin() + pos + 46,
+                  zip.begin() + pos + 46 + name_len);
+    size_t x = pos + 46 + name_len;
+    if (extra_len > 0) {
+      EXPECT_EQ(Le(zip, x, 2), 1u);
+      x += 4;
+      if (p.size == 0xFFFFFFFF) p.size = Le(zip, x, 8), x += 8;
+      if (p.compressed == 0xFFFFFFFF) p.compressed = Le(zip, x, 8), x += 8;
+      if (local == 0xFFFFFFFF) local = Le(zip, x, 8);
+    }
+    EXPECT_EQ(Le(zip, local, 4), 0x04034b50u);
+    EXPECT_EQ(Le(zip, local + 6, 2), 0x0808u);
+    p.data_offset =
+        local + 30 + Le(zip, local + 26, 2) + Le(zip, local + 28, 2);
+    out.push_back(p);
+    pos += 46 + name_len + extra_len;
+  }
+  return out;
+}
+
+struct Fixture {
+  std::vector<ZipEntry> entries;
+  std::vector<std::vector<uint8_t>> data;
+};
+
+Fixture MakeFixture() {
+  Fixture f;
+  const int64_t mtime = 1760000000000;  // 2025-10-09
+  f.data = {Text(100000), {}, Random(70001, 1), Random(3, 2)};
+  const char* names[] = {"logs/app.log", "empty.txt",
+                         "photos/\xC3\xA9t\xC3\xA9.jpg", "tiny.bin"};
+  for (size_t i = 0; i < f.data.size(); i++) {
+    f.entries.push_back({names[i], f.data[i].size(), mtime});
+  }
+  return f;
+}
+
+std::vector<uint8_t> Write(const Fixture& f, bool deflate,
+                           size_t piece = 9999) {
+  ZipStreamWriter writer(deflate);
+  std::vector<uint8_t> out;
+  auto drain = [&] {
+    std::vector<uint8_t> buf(writer.Pending());
+    writer.Read(buf.data(), buf.size());
+    out.insert(out.end(), buf.begin(), buf.end());
+  };
+  for (size_t i = 0; i < f.entries.size(); i++) {
+    writer.BeginEntry(f.entries[i]);
+    const std::vector<uint8_t>& d = f.data[i];
+    for (size_t pos = 0; pos < d.size(); pos += piece) {
+      writer.Update(d.data() + pos, std::min(piece, d.size() - pos));
+      drain();
+    }
+    EXPECT_TRUE(writer.EndEntry());
+  }
+  writer.Finish();
+  drain();
+  EXPECT_EQ(writer.bytes_written(), out.size());
+  return out;
+}
+
+// Renders [pos, end) of |layout| the way the server does: metadata from
+// the layout, data from the files.
+std::vector<uint8_t> Serve(const ZipLayout& layout, const Fixture& f,
+                           uint64_t pos, uint64_t end) {
+  std::vector<uint8_t> out;
+  while (pos < end) {
+    const ZipLayout::Span span = layout.Locate(pos);
+    const size_t n =
+        static_cast<size_t>(std::min<uint64_t>(span.length, end - pos));
+    if (span.entry < 0) {
+      std::vector<uint8_t> buf(n);
+      uint32_t missing = 0;
+      EXPECT_TRUE(layout.Render(pos, n, buf.data(), &missing));
+      out.insert(out.end(), buf.begin(), buf.end());
+    } else {
+      const auto& d = f.data[static_cast<size_t>(span.entry)];
+      out.insert(out.end(), d.begin() + span.offset,
+                 d.begin() + span.offset + n);
+    }
+    pos += n;
+  }
+  return out;
+}
+
+void RecordAll(ZipLayout* layout, const Fixture& f) {
+  for (size_t i = 0; i < f.data.size(); i++) {
+    layout->RecordCrc(static_cast<uint32_t>(i), 0, f.data[i].size(),
+                      Crc32(0, f.data[i].data(), f.data[i].size()));
+  }
+}
+
+TEST(ZipStreamTest, StoredWriterMatchesLayoutAndParses) {
+  const Fixture f = MakeFixture();
+  const std::vector<uint8_t> written = Write(f, false);
+
+  ZipLayout layout(f.entries);
+  EXPECT_EQ(layout.size(), written.size());
+  RecordAll(&layout, f);
+  EXPECT_EQ(Serve(layout, f, 0, layout.size()), written);
+
+  const std::vector<Parsed> parsed = ParseZip(written);
+  ASSERT_EQ(parsed.size(), f.entries.size());
+  for (size_t i = 0; i < parsed.size(); i++) {
+    const Parsed& p = parsed[i];
+    EXPECT_EQ(p.name, f.entries[i].name);
+    EXPECT_EQ(p.method, 0);
+    EXPECT_EQ(p.size, f.data[i].size());
+    EXPECT_EQ(p.compressed, f.data[i].size());
+    EXPECT_EQ(p.crc, Crc32(0, f.data[i].data(), f.data[i].size()));
+    EXPECT_TRUE(std::equal(f.data[i].begin(), f.data[i].end(),
+                           written.begin() + p.data_offset));
+  }
+}
+
+TEST(ZipStreamTest, RangesRenderIndependently) {
+  const Fixture f = MakeFixture();
+  ZipLayout layout(f.entries);
+  RecordAll(&layout, f);
+  const std::vector<uint8_t> full = Serve(layout, f, 0, layout.size());
+  std::mt19937 rng(3);
+  for (int i = 0; i < 200; i++) {
+    const uint64_t a = rng() % layout.size();
+    const uint64_t b = a + 1 + rng() % (layout.size() - a);
+    EXPECT_TRUE(std::equal(full.begin() + a, full.begin() + b,
+                           Serve(layout, f, a, b).begin()))
+        << a << "-" << b;
+  }
+  // Metadata spans stop at the next entry's data.
+  const ZipLayout::Span first = layout.Locate(0);
+  EXPECT_EQ(first.entry, -1);
+  EXPECT_EQ(first.length, 30u + f.entries[0].name.size());
+  const ZipLayout::Span data = layout.Locate(first.length + 10);
+  EXPECT_EQ(data.entry, 0);
+  EXPECT_EQ(data.offset, 10u);
+  EXPECT_EQ(data.length, f.data[0].size() - 10);
+}
+
+TEST(ZipStreamTest, CrcPiecesMergeInAnyOrder) {
+  const Fixture f = MakeFixture();
+  ZipLayout layout(f.entries);
+  const std::vector<uint8_t>& d = f.data[0];
+  auto piece = [&](uint64_t start, uint64_t end) {
+    layout.RecordCrc(0, start, end - start,
+                     Crc32(0, d.data() + start, end - start));
+  };
+
+  // The descriptor after entry 0 needs its CRC.
+  const uint64_t descriptor = 30 + f.entries[0].name.size() + d.size();
+  uint8_t buf[16];
+  uint32_t missing = 99;
+  EXPECT_FALSE(layout.Render(descriptor, sizeof(buf), buf, &missing));
+  EXPECT_EQ(missing, 0u);
+
+  piece(60000, 100000);
+  piece(0, 20000);
+  EXPECT_EQ(layout.CrcCovered(0), 60000u);
+  uint64_t start = 0;
+  uint64_t end = 0;
+  ASSERT_TRUE(layout.CrcGap(0, &start, &end));
+  EXPECT_EQ(start, 20000u);
+  EXPECT_EQ(end, 60000u);
+  piece(10000, 30000);  // Overlap, ignored.
+  EXPECT_EQ(layout.CrcCovered(0), 60000u);
+  piece(20000, 60000);
+  EXPECT_FALSE(layout.CrcGap(0, &start, &end));
+
+  uint32_t crc = 0;
+  ASSERT_TRUE(layout.EntryCrc(0, &crc));
+  EXPECT_EQ(crc, Crc32(0, d.data(), d.size()));
+  ASSERT_TRUE(layout.Render(descriptor, sizeof(buf), buf, &missing));
+  EXPECT_EQ(Le(std::vector<uint8_t>(buf, buf + 16), 4, 4), crc);
+  // Empty entries never wait.
+  ASSERT_TRUE(layout.EntryCrc(1, &crc));
+  EXPECT_EQ(crc, 0u);
+}
+
+TEST(ZipStreamTest, Zip64ForLargeEntriesAndManyEntries) {
+  const uint64_t big = 5ull << 30;
+  ZipLayout large({{"small.bin", 10, 0}, {"huge.mkv", big, 0},
+                   {"after.txt", 1, 0}});
+  // Local headers: 30 + name (+20 ZIP64 extra); descriptors 16 or 24.
+  const uint64_t entries = (30 + 9 + 10 + 16) + (30 + 8 + 20 + big + 24) +
+                           (30 + 9 + 1 + 16);
+  // Central records: the last one's offset is past 4 GB as well.
+  const uint64_t central = (46 + 9) + (46 + 8 + 28) + (46 + 9 + 28);
+  EXPECT_EQ(large.size(), entries + central + 56 + 20 + 22);
+
+  large.RecordCrc(0, 0, 10, 1);
+  large.RecordCrc(1, 0, big, 2);
+  large.RecordCrc(2, 0, 1, 3);
+  std::vector<uint8_t> tail(static_cast<size_t>(central + 98));
+  uint32_t missing = 0;
+  ASSERT_TRUE(
+      large.Render(entries, tail.size(), tail.data(), &missing));
+  EXPECT_EQ(Le(tail, central, 4), 0x06064b50u);
+  EXPECT_EQ(Le(tail, central + 56, 4), 0x07064b50u);
+  EXPECT_EQ(Le(tail, central + 76, 4), 0x06054b50u);
+
+  std::vector<ZipEntry> many(70000);
+  for (size_t i = 0; i < many.size(); i++) {
+    many[i].name = "f" + std::to_string(i);
+  }
+  ZipLayout layout(many);
+  std::vector<uint8_t> zip(static_cast<size_t>(layout.size()));
+  ASSERT_TRUE(layout.Render(0, zip.size(), zip.data(), &missing));
+  const std::vector<Parsed> parsed = ParseZip(zip);
+  ASSERT_EQ(parsed.size(), many.size());
+  EXPECT_EQ(parsed.back().name, "f69999");
+}
+
+#if defined(ZS_TEST_HAVE_ZLIB)
+std::vector<uint8_t> Inflate(const uint8_t* data, size_t len, size_t size) {
+  std::vector<uint8_t> out(size);
+  z_stream z{};
+  EXPECT_EQ(inflateInit2(&z, -15), Z_OK);
+  z.next_in = const_cast<Bytef*>(data);
+  z.avail_in = static_cast<uInt>(len);
+  z.next_out = out.data();
+  z.avail_out = static_cast<uInt>(size);
+  EXPECT_EQ(inflate(&z, Z_FINISH), Z_STREAM_END);
+  inflateEnd(&z);
+  return out;
+}
+
+TEST(ZipStreamTest, DeflatesCompressibleEntriesOnly) {
+  const Fixture f = MakeFixture();
+  const std::vector<uint8_t> zip = Write(f, true, 4096);
+  const std::vector<Parsed> parsed = ParseZip(zip);
+  ASSERT_EQ(parsed.size(), f.entries.size());
+  EXPECT_EQ(parsed[0].method, 8);  // Log text.
+  EXPECT_LT(parsed[0].compressed, f.data[0].size() / 10);
+  EXPECT_EQ(parsed[1].method, 0);  // Empty.
+  EXPECT_EQ(parsed[2].method, 0);  // Random bytes.
+  EXPECT_EQ(parsed[3].method, 0);  // Too small to bother.
+  for (size_t i = 0; i < parsed.size(); i++) {
+    const Parsed& p = parsed[i];
+    EXPECT_EQ(p.crc, Crc32(0, f.data[i].data(), f.data[i].size()));
+    if (p.method == 8) {
+      EXPECT_EQ(Inflate(zip.data() + p.data_offset, p.compressed, p.size),
+                f.data[i]);
+    }
+  }
+}
+#endif
+
+TEST(ZipStreamTest, ShortEntryIsReported) {
+  ZipStreamWriter writer(false);
+  writer.BeginEntry({"a", 10, 0});
+  const uint8_t bytes[4] = {1, 2, 3, 4};
+  writer.Update(bytes, sizeof(bytes));
+  EXPECT_FALSE(writer.EndEntry());
+}
+
+}  // namespace
+}  // namespace zapshare
@@ -8,6 +8,7 @@
 
 #include "flutter/generated_plugin_registrant.h"
 #include "video_plugin.h"
+#include "mirror_texture_plugin.h"
 #include "mpv_window.h"
 #include <dwmapi.h>
 
@@ -48,6 +49,15 @@ bool FlutterWindow::OnCreate() {
   video_plugin_ = std::make_unique<VideoPlugin>(
       flutter_controller_->engine()->messenger(),
       mpv_window_.get());
+
+  // Screen mirror frames, decoded natively and shown as a texture
+  flutter::PluginRegistrarWindows* mirror_registrar =
+      flutter::PluginRegistrarManager::GetInstance()
+          ->GetRegistrar<flutter::PluginRegistrarWindows>(
+              flutter_controller_->engine()->GetRegistrarForPlugin(
+                  "MirrorTexturePlugin"));
+  mirror_texture_plugin_ = std::make_unique<MirrorTexturePlugin>(
+      mirror_registrar->messenger(), mirror_registrar->texture_registrar());
   
   SetChildContent(flutter_controller_->view()->GetNativeWindow());
   
@@ -86,6 +96,8 @@ void FlutterWindow::OnDestroy() {
       video_plugin_.reset();
   }
 
+  mirror_texture_plugin_.reset();
+
   if (mpv_window_) {
       mpv_window_->Destroy();
       mpv_window_.reset();
@@ -47,6 +47,7 @@ class FlutterWindow : public Win32Window {
   // MPV Overlay Window (The "Window 1")
   std::unique_ptr<class MpvWindow> mpv_window_;
   std::unique_ptr<class VideoPlugin> video_plugin_;
+  std::unique_ptr<class MirrorTexturePlugin> mirror_texture_plugin_;
 
  public: 
   class MpvWindow* GetMpvWindow() { return mpv_window_.get(); }
@@ -0,0 +1,126 @@
+#include "mirror_texture_plugin.h"
+
+#include <variant>
+
+#include "mirror_receiver.h"
+
+struct MirrorTexturePlugin::Texture {
+  flutter::TextureRegistrar* registrar = nullptr;
+  ZsMirrorReceiver* receiver = nullptr;  // Holds a reference of its own.
+  int64_t id = -1;
+  FlutterDesktopPixelBuffer buffer = {};
+  std::unique_ptr<flutter::TextureVariant> variant;
+
+  ~Texture() {
+    if (receiver != nullptr) zs_mirror_receiver_free(receiver);
+  }
+
+  // Called by the engine on its raster thread; the pixels stay put until
+  // the next call, which is after it has uploaded them.
+  const FlutterDesktopPixelBuffer* CopyPixels() {
+    int32_t width = 0;
+    int32_t height = 0;
+    const uint8_t* pixels =
+        zs_mirror_receiver_acquire(receiver, &width, &height);
+    if (pixels == nullptr) return nullptr;
+    buffer.buffer = pixels;
+    buffer.width = width;
+    buffer.height = height;
+    return &buffer;
+  }
+
+  // Called on the receiver's decoder thread. Marking a frame available
+  // only posts to the engine, which is safe from any thread.
+  static void OnFrame(void* user_data) {
+    Texture* self = static_cast<Texture*>(user_data);
+    self->registrar->MarkTextureFrameAvailable(self->id);
+  }
+};
+
+MirrorTexturePlugin::MirrorTexturePlugin(flutter::BinaryMessenger* messenger,
+                                         flutter::TextureRegistrar* textures)
+    : textures_(textures) {
+  channel_ = std::make_unique<flutter::MethodChannel<flutter::EncodableValue>>(
+      messenger, "zapshare/mirror_texture",
+      &flutter::StandardMethodCodec::GetInstance());
+
+  channel_->SetMethodCallHandler(
+      [this](const auto& call, auto result) {
+        HandleMethodCall(call, std::move(result));
+      });
+}
+
+MirrorTexturePlugin::~MirrorTexturePlugin() {
+  channel_->SetMethodCallHandler(nullptr);
+  while (!registered_.empty()) {
+    auto it = registered_.begin();
+    std::unique_ptr<Texture> texture = std::move(it->second);
+    registered_.erase(it);
+    Unregister(std::move(texture));
+  }
+}
+
+namespace {
+
+int64_t LookupInt(const flutter::EncodableValue* args, const char* key) {
+  const auto* map = std::get_if<flutter::EncodableMap>(args);
+  if (map == nullptr) return 0;
+  auto it = map->find(flutter::EncodableValue(key));
+  if (it == map->end()) return 0;
+  if (const auto* value = std::get_if<int64_t>(&it->second)) return *value;
+  if (const auto* value = std::get_if<int32_t>(&it->second)) return *value;
+  return 0;
+}
+
+}  // namespace
+
+void MirrorTexturePlugin::HandleMethodCall(
+    const flutter::MethodCall<flutter::EncodableValue>& method_call,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const std::string& method_name = method_call.method_name();
+
+  if (method_name == "create") {
+    ZsMirrorReceiver* receiver = reinterpret_cast<ZsMirrorReceiver*>(
+        static_cast<intptr_t>(LookupInt(method_call.arguments(), "receiver")));
+    if (receiver == nullptr) {
+      result->Error("BAD_ARGS", "receiver address expected");
+      return;
+    }
+    auto texture = std::make_unique<Texture>();
+    texture->registrar = textures_;
+    texture->receiver = receiver;
+    zs_mirror_receiver_retain(receiver);
+    Texture* raw = texture.get();
+    texture->variant = std::make_unique<flutter::TextureVariant>(
+        flutter::PixelBufferTexture([raw](size_t, size_t) {
+          return raw->CopyPixels();
+        }));
+    texture->id = textures_->RegisterTexture(texture->variant.get());
+    if (texture->id < 0) {
+      result->Error("REGISTER_FAILED", "texture could not be registered");
+      return;
+    }
+    const int64_t id = texture->id;
+    registered_[id] = std::move(texture);
+    zs_mirror_receiver_set_frame_callback(receiver, &Texture::OnFrame, raw);
+    result->Success(flutter::EncodableValue(id));
+  } else if (method_name == "dispose") {
+    const int64_t id = LookupInt(method_call.arguments(), "textureId");
+    auto it = registered_.find(id);
+    if (it != registered_.end()) {
+      std::unique_ptr<Texture> texture = std::move(it->second);
+      registered_.erase(it);
+      Unregister(std::move(texture));
+    }
+    result->Success();
+  } else {
+    result->NotImplemented();
+  }
+}
+
+void MirrorTexturePlugin::Unregister(std::unique_ptr<Texture> texture) {
+  zs_mirror_receiver_set_frame_callback(texture->receiver, nullptr, nullptr);
+  const int64_t id = texture->id;
+  Texture* raw = texture.release();
+  textures_->UnregisterTexture(id, [raw]() { delete raw; });
+}
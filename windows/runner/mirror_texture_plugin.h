@@ -0,0 +1,45 @@
+#ifndef RUNNER_MIRROR_TEXTURE_PLUGIN_H_
+#define RUNNER_MIRROR_TEXTURE_PLUGIN_H_
+
+#include <flutter/binary_messenger.h>
+#include <flutter/method_channel.h>
+#include <flutter/standard_method_codec.h>
+#include <flutter/texture_registrar.h>
+
+#include <map>
+#include <memory>
+
+// Shows screen mirror frames decoded by the native engine
+// (native/src/mirror_receiver.h) as external textures.
+//
+// "create" on the "zapshare/mirror_texture" channel takes the address of a
+// receiver and returns a texture id; "dispose" takes the id back. Frames
+// are decoded on the receiver's own thread and copied straight into the
+// texture, without going through Dart.
+class MirrorTexturePlugin {
+ public:
+  MirrorTexturePlugin(flutter::BinaryMessenger* messenger,
+                      flutter::TextureRegistrar* textures);
+  virtual ~MirrorTexturePlugin();
+
+  // Disallow copy and assign.
+  MirrorTexturePlugin(const MirrorTexturePlugin&) = delete;
+  MirrorTexturePlugin& operator=(const MirrorTexturePlugin&) = delete;
+
+  void HandleMethodCall(
+      const flutter::MethodCall<flutter::EncodableValue>& method_call,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+ private:
+  struct Texture;
+
+  // Stops |texture|'s frame callbacks and hands it to the registrar, which
+  // frees it once the engine is done with it.
+  void Unregister(std::unique_ptr<Texture> texture);
+
+  flutter::TextureRegistrar* textures_;
+  std::unique_ptr<flutter::MethodChannel<flutter::EncodableValue>> channel_;
+  std::map<int64_t, std::unique_ptr<Texture>> registered_;
+};
+
+#endif  // RUNNER_MIRROR_TEXTURE_PLUGIN_H_